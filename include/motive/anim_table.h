@@ -15,18 +15,49 @@
 #ifndef MOTIVE_ANIM_TABLE_H_
 #define MOTIVE_ANIM_TABLE_H_
 
+#include <atomic>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
 #include "motive/rig_anim.h"
+#include "motive/task_scheduler.h"
 
 namespace motive {
 
+struct AnimBundleFb;
 struct AnimTableFb;
 struct AnimListFb;
 class TableDescriberInterface;
 
+/// @class AnimName
+/// @brief The hash of an animation name, for AnimTable::FindAnim().
+///
+/// The name is hashed by the constructor, which can run at compile time:
+/// `constexpr AnimName kWalk("walk.motiveanim");` costs nothing at runtime.
+class AnimName {
+ public:
+  constexpr explicit AnimName(const char* name)
+      : hash_(Hash(name, 14695981039346656037ULL)) {}
+
+  constexpr uint64_t hash() const { return hash_; }
+
+ private:
+  // FNV-1a, one character per recursion, as C++11 constexpr requires.
+  static constexpr uint64_t Hash(const char* s, uint64_t hash) {
+    return *s == '\0' ? hash
+                      : Hash(s + 1, (hash ^ static_cast<uint8_t>(*s)) *
+                                        1099511628211ULL);
+  }
+
+  uint64_t hash_;
+};
+
 /// @class AnimTable
 /// @brief Hold animation lists for several object types.
 ///
@@ -42,6 +73,10 @@ class TableDescriberInterface;
 ///
 /// Duplicate animations are only loaded once. This allows different objects
 /// to use the same animations without any memory overhead.
+///
+/// Animations are decoded in parallel when a MotiveTaskScheduler has been set.
+/// The Async() loaders additionally return immediately, and make each object
+/// available as soon as all of its animations have been decoded.
 class AnimTable {
  public:
   // Array of animations corresponding to `anim_idx`.
@@ -65,6 +100,46 @@ class AnimTable {
   ///
   typedef const char* LoadFn(const char* file_name, std::string* scratch_buf);
 
+  /// Memory holding a loaded animation file, for the InPlace() loaders.
+  /// The AnimTable reads spline nodes directly from `data` instead of copying
+  /// them, so the memory must stay valid until the AnimTable calls
+  /// `release(data, size, context)`, when it is destroyed. Point `data` at a
+  /// memory-mapped file, and unmap it in `release`, to bring up animations
+  /// with almost no copying or allocation.
+  struct AnimBuffer {
+    typedef void ReleaseFn(const char* data, size_t size, void* context);
+
+    AnimBuffer()
+        : data(nullptr), size(0), release(nullptr), context(nullptr) {}
+
+    /// The .motiveanim file contents. Must be aligned as a FlatBuffer.
+    const char* data;
+    size_t size;
+
+    /// Called once the AnimTable no longer references `data`. Can be nullptr
+    /// if the memory outlives the AnimTable.
+    ReleaseFn* release;
+
+    /// Passed to `release`.
+    void* context;
+  };
+
+  /// Callback that loads `file_name` into memory described by `buffer`.
+  /// Returns false if the load fails.
+  typedef bool BufferLoadFn(const char* file_name, AnimBuffer* buffer);
+
+  /// Called by the Async() loaders once every animation has been decoded.
+  /// `success` is false if any file failed to load. Runs on whichever thread
+  /// decoded the last animation.
+  typedef std::function<void(bool success)> LoadCallback;
+
+  /// Identifies an animation by name, independently of `object`. Returned by
+  /// FindAnim(), and valid for the life of the table, including across
+  /// ReloadAnim().
+  typedef int AnimHandle;
+  static const AnimHandle kInvalidAnimHandle = -1;
+
+  AnimTable();
   ~AnimTable();
 
   /// Load the AnimTable specified in the FlatBuffer `params`.
@@ -87,8 +162,141 @@ class AnimTable {
   /// Load the AnimTable for only one `object`.
   bool InitFromAnimFileNames(const ListFileNames& list_names, LoadFn* load_fn);
 
+  /// Same as the loaders above, but the files loaded by `load_fn` are kept
+  /// by the AnimTable and referenced instead of copied. See AnimBuffer.
+  /// Embedded animations are still copied, so `table_fb` and `list_fb` can be
+  /// discarded after the call, as usual.
+  bool InitFromFlatBuffersInPlace(const AnimTableFb& table_fb,
+                                  BufferLoadFn* load_fn);
+  bool InitFromFlatBuffersInPlace(const AnimListFb& list_fb,
+                                  BufferLoadFn* load_fn);
+  bool InitFromAnimFileNamesInPlace(const TableFileNames& table_names,
+                                    BufferLoadFn* load_fn);
+  bool InitFromAnimFileNamesInPlace(const ListFileNames& list_names,
+                                    BufferLoadFn* load_fn);
+
+  /// Load every object and animation of a bundle written by
+  /// AnimTableToFlatBuffers(). The whole table comes from one file, so no
+  /// `load_fn` is needed. `bundle` can be discarded after this call.
+  bool InitFromBundle(const AnimBundleFb& bundle);
+
+  /// Same as InitFromBundle(), but `buffer` holds the bundle file and is kept
+  /// by the AnimTable. Spline nodes of uncompressed bundles are then
+  /// referenced instead of copied. See AnimBuffer. For the nodes to be cache
+  /// line aligned, `buffer.data` must be 64-byte aligned. Returns false if
+  /// `buffer` fails the check chosen by set_trust_files().
+  bool InitFromBundleInPlace(const AnimBuffer& buffer);
+
+  /// Skip FlatBuffer verification in subsequent loads. Loaded files are
+  /// verified by default, and files that fail count as failed loads. Set to
+  /// true for files produced by a trusted pipeline, to save the cost of
+  /// verification. Bundles are then only checked against their checksum.
+  ///
+  /// Only files of known size can be verified: those loaded into a
+  /// BufferLoadFn's AnimBuffer or into a LoadFn's `scratch_buf`, and bundles
+  /// loaded in place. Embedded animations and bundles passed by reference are
+  /// assumed to have been checked by the caller.
+  void set_trust_files(bool trust_files) { trust_files_ = trust_files; }
+  bool trust_files() const { return trust_files_; }
+
+  /// Replace the animation called `anim_name` with a fresh load of its file
+  /// by `load_fn`, to hot-reload a re-exported animation. Other animations
+  /// are untouched, and splines identical to ones already in the table are
+  /// shared instead of copied, so unchanged splines stay where they are.
+  /// Returns the new animation, or nullptr if `anim_name` isn't in the table,
+  /// fails to load, or doesn't match the hierarchy of the objects using it.
+  ///
+  /// The replaced animation is kept until the table is destroyed, since
+  /// rigs may still be playing it, and other animations may share its
+  /// splines. It's returned in `old_anim`, if not nullptr. Pass both to
+  /// MotiveEngine::ReplaceRigAnim() to move those rigs onto the new one.
+  /// Defining animations aren't recalculated, so adding bones or operations
+  /// needs a full load. Not supported by on-demand tables.
+  const RigAnim* ReloadAnim(const char* anim_name, LoadFn* load_fn,
+                            const RigAnim** old_anim = nullptr);
+
+  /// Same as the loaders above, but return as soon as the table's layout is
+  /// known. Animations are then loaded and decoded in the background, on the
+  /// MotiveTaskScheduler if one has been set, and on a thread owned by the
+  /// table otherwise.
+  ///
+  /// While loading, only objects for which IsObjectLoaded() returns true may
+  /// be queried. For those, Query() and DefiningAnim() are final. `load_fn`
+  /// is called from the background, possibly from several threads at once,
+  /// and embedded animations are read in the background, so `table_fb` and
+  /// `list_fb` must be kept until the load completes.
+  ///
+  /// @param callback Optional. Called when the load completes. See
+  ///                 LoadCallback. WaitForLoad() must still be called
+  ///                 before the table is initialized again.
+  void InitFromFlatBuffersAsync(const AnimTableFb& table_fb, LoadFn* load_fn,
+                                const LoadCallback& callback = LoadCallback());
+  void InitFromFlatBuffersAsync(const AnimListFb& list_fb, LoadFn* load_fn,
+                                const LoadCallback& callback = LoadCallback());
+  void InitFromAnimFileNamesAsync(
+      const TableFileNames& table_names, LoadFn* load_fn,
+      const LoadCallback& callback = LoadCallback());
+  void InitFromAnimFileNamesAsync(
+      const ListFileNames& list_names, LoadFn* load_fn,
+      const LoadCallback& callback = LoadCallback());
+
+  /// Block until the load started by an Async() loader has completed.
+  /// Returns false if any file failed to load. Returns true immediately if no
+  /// load is in flight.
+  bool WaitForLoad();
+
+  /// Load animations on demand instead of up front, and keep at most about
+  /// `bytes` of them resident. Must be set before the table is initialized,
+  /// and only applies to the synchronous loaders that take a LoadFn. Zero,
+  /// the default, loads and keeps every animation.
+  ///
+  /// Initialization still passes over every animation once, one object at a
+  /// time, to calculate the defining anims. After that, Acquire() loads an
+  /// animation when it's needed, and the least recently released animations
+  /// are evicted when the budget is exceeded. The budget can be exceeded
+  /// while more animations than fit are pinned.
+  ///
+  /// Splines are not shared between animations of on-demand tables.
+  void set_residency_budget(size_t bytes) {
+    assert(indices_.empty());
+    residency_budget_ = bytes;
+  }
+  size_t residency_budget() const { return residency_budget_; }
+
+  /// Return the bytes held by resident animations of an on-demand table.
+  size_t ResidentBytes() const { return resident_bytes_; }
+
+  /// Like Query(), but loads the animation if it's not resident, and pins it
+  /// so that it is not evicted until the matching Release(). Pin animations
+  /// for as long as a RigMotivator plays them. Returns nullptr if the
+  /// animation does not exist or fails to load.
+  ///
+  /// On tables that are not on-demand this is the same as Query().
+  const RigAnim* Acquire(int object, int anim_idx);
+
+  /// Unpin an animation returned by Acquire(). Once no pins remain, it may be
+  /// evicted, after which Query() returns nullptr for it.
+  void Release(int object, int anim_idx);
+
+  /// Return true once every animation of `object` has been decoded, and
+  /// its DefiningAnim() has been calculated. Always true when no load is in
+  /// flight.
+  bool IsObjectLoaded(int object) const {
+    assert(0 <= object && object < static_cast<int>(indices_.size()));
+    return object_pending_[object].load(std::memory_order_acquire) == 0;
+  }
+
+  /// Decode animations in parallel on `scheduler`.
+  /// @param scheduler Not owned. Must outlive the table, or be reset to
+  ///                  nullptr.
+  void set_task_scheduler(MotiveTaskScheduler* scheduler) {
+    task_scheduler_ = scheduler;
+  }
+  MotiveTaskScheduler* task_scheduler() const { return task_scheduler_; }
+
   /// Get an animation by index. This is fast and is the preferred way to
-  /// look up an animation.
+  /// look up an animation. On tables with a residency_budget(), returns
+  /// nullptr for animations that are not resident; use Acquire() instead.
   /// @param object An enum defined by the caller specifying the object type.
   ///               For example, if you want separate animations lists for
   ///               cats and dogs, then object=0 could be cats, and object=1
@@ -105,10 +313,36 @@ class AnimTable {
     return idx == kInvalidAnimIndex ? nullptr : anims_[idx];
   }
 
-  /// Get an animation by name. This is slow and should be avoided when
-  /// possible.
+  /// Get an animation by name. Compares the whole name, so prefer resolving
+  /// the name once with FindAnim() and calling QueryByHandle().
   const RigAnim* QueryByName(const char* anim_name) const {
-    return const_cast<AnimTable*>(this)->QueryByName(anim_name);
+    auto map_entry = name_map_.find(anim_name);
+    return map_entry == name_map_.end() ? nullptr : anims_[map_entry->second];
+  }
+
+  /// Return the handle of the animation called `name`, or
+  /// kInvalidAnimHandle if the table has no such animation. Looks `name` up
+  /// in a perfect hash of the table's names, built as soon as the layout of
+  /// the table is known, so there are no string compares or probing.
+  /// Only the hash of `name` is known, so names whose hashes collide with
+  /// another name in the table are left out, and return kInvalidAnimHandle
+  /// rather than the other animation. QueryByName() still finds them.
+  AnimHandle FindAnim(AnimName name) const {
+    if (name_slots_.empty()) return kInvalidAnimHandle;
+    const uint64_t hash = name.hash();
+    const uint32_t seed = name_seeds_[hash & (name_seeds_.size() - 1)];
+    const NameSlot& slot =
+        name_slots_[NameSlotIndex(hash, seed, name_slots_.size())];
+    return slot.hash == hash && slot.index != kInvalidAnimIndex
+               ? slot.index
+               : kInvalidAnimHandle;
+  }
+
+  /// Get an animation by the handle returned by FindAnim(). As fast as
+  /// Query(). Returns nullptr for kInvalidAnimHandle, and, like Query(), for
+  /// animations that failed to load or are not resident.
+  const RigAnim* QueryByHandle(AnimHandle handle) const {
+    return handle == kInvalidAnimHandle ? nullptr : anims_[handle];
   }
 
   /// Return animation that defines the complete rig of this object.
@@ -128,7 +362,16 @@ class AnimTable {
 
   /// Return the number of animations for which we've allocated memory.
   /// Internally, we avoid duplicating animations.
-  int NumUniqueAnims() const { return static_cast<int>(anims_.size()); }
+  int NumUniqueAnims() const { return num_unique_anims_; }
+
+  /// Return the number of bytes of spline data saved by sharing. Identical
+  /// splines, even across different animations, are held only once.
+  size_t SharedSplineBytes() const { return shared_spline_bytes_; }
+
+  /// Return the memory held by this table: every unique animation, the
+  /// defining animations, and the lookup tables. Use
+  /// RigAnim::AddMemoryStats() for the breakdown of a single animation.
+  MemoryStats GetMemoryStats() const;
 
  private:
   typedef uint16_t AnimIndex;
@@ -136,18 +379,61 @@ class AnimTable {
   typedef std::pair<std::string, AnimIndex> NameToIndex;
   static const AnimIndex kInvalidAnimIndex = static_cast<AnimIndex>(-1);
 
-  bool Load(TableDescriberInterface* describer, LoadFn* load_fn);
-  void AnimNames(std::vector<const char*>* anim_names) const;
-  size_t MaxAnimIndex() const;
-  size_t GatherObjectAnims(int object, const RigAnim** anims) const;
-  void CalculateDefiningAnims();
+  /// An entry of the perfect hash of animation names. See FindAnim().
+  struct NameSlot {
+    NameSlot() : hash(0), index(kInvalidAnimIndex) {}
+    uint64_t hash;
+    AnimIndex index;
+  };
 
-  RigAnim* QueryByName(const char* anim_name) {
-    auto map_entry = name_map_.find(anim_name);
-    if (map_entry == name_map_.end()) return nullptr;
-    return anims_[map_entry->second];
+  /// Position in `name_slots_` of `hash`, given the seed of its bucket.
+  /// `num_slots` must be a power of two.
+  static size_t NameSlotIndex(uint64_t hash, uint32_t seed,
+                              size_t num_slots) {
+    uint64_t x = hash ^ (seed * 0x9E3779B97F4A7C15ULL);
+    x = (x ^ (x >> 29)) * 0xBF58476D1CE4E5B9ULL;
+    return static_cast<size_t>(x ^ (x >> 32)) & (num_slots - 1);
   }
 
+  /// A unique animation that is referenced by the table but not yet loaded.
+  struct PendingAnim {
+    /// The file to load, if `embedded_fb` is nullptr.
+    std::string name;
+    const RigAnimFb* embedded_fb;
+
+    /// Index into `bundle_`, or -1 if the animation isn't from a bundle.
+    int bundle_anim;
+
+    /// Where the loaded animation goes in `anims_`.
+    AnimIndex index;
+
+    /// Objects that reference the animation, each listed once.
+    std::vector<int> objects;
+  };
+
+  /// Exactly one of `load_fn` and `buffer_load_fn` is used to load files.
+  bool Load(TableDescriberInterface* describer, LoadFn* load_fn,
+            BufferLoadFn* buffer_load_fn);
+  void LoadAsync(TableDescriberInterface* describer, LoadFn* load_fn,
+                 const LoadCallback& callback);
+  void PlanLoad(TableDescriberInterface* describer, LoadFn* load_fn,
+                BufferLoadFn* buffer_load_fn, const LoadCallback& callback);
+  void LoadPendingAnims();
+  void LoadPendingAnim(size_t pending_idx);
+  void LoadResidentAnims();
+  RigAnim* LoadAnim(const char* anim_name, const RigAnimFb* anim_fb,
+                    int bundle_anim);
+  void EvictToBudget();
+  static size_t AnimBytes(const RigAnim* anim);
+  void FinishObject(int object);
+  void AnimNames(std::vector<const char*>* anim_names) const;
+  size_t GatherObjectAnims(int object, const RigAnim** anims) const;
+  void CalculateDefiningAnim(int object);
+  void ShareSplines(RigAnim* anim);
+  void BuildNameHash();
+  bool BuildNameHash(const std::vector<NameSlot>& names, size_t num_buckets,
+                     size_t num_slots);
+
   AnimIndex CalculateIndex(int object, int anim_idx) const {
     assert(0 <= object && object < static_cast<int>(indices_.size()));
     const AnimList& list = indices_[object];
@@ -170,8 +456,87 @@ class AnimTable {
   /// animation.
   std::unordered_map<std::string, AnimIndex> name_map_;
 
+  /// Perfect hash of the names in `name_map_`, for FindAnim(). A name's hash
+  /// picks a bucket, whose seed places the name in `name_slots_` so that no
+  /// two names share a slot. Both sizes are powers of two.
+  std::vector<uint32_t> name_seeds_;
+  std::vector<NameSlot> name_slots_;
+
   /// Animation data. Contains no duplicate entries, thanks to name_map_.
+  /// Entries are nullptr for animations that failed to load, or that have not
+  /// been loaded yet.
   std::vector<RigAnim*> anims_;
+
+  /// Number of non-null entries in `anims_`.
+  int num_unique_anims_;
+
+  /// Animations replaced by ReloadAnim(). Freed with the table.
+  std::vector<RigAnim*> retired_anims_;
+
+  /// Map a hash of a spline's contents to every distinct spline with that
+  /// hash. The splines are owned by the MatrixAnims in `anims_`.
+  std::unordered_multimap<size_t, const CompactSpline*> spline_pool_;
+
+  /// Bytes that would have been allocated if splines weren't shared.
+  size_t shared_spline_bytes_;
+
+  /// Files loaded by a BufferLoadFn, which `anims_` reference. Released when
+  /// the table is destroyed.
+  std::vector<AnimBuffer> buffers_;
+
+  /// State of the load in progress. Only valid between PlanLoad() and the end
+  /// of Load() or WaitForLoad().
+  std::vector<PendingAnim> pending_;
+  LoadFn* load_fn_;
+  BufferLoadFn* buffer_load_fn_;
+  const AnimBundleFb* bundle_;
+  bool reference_bundle_;
+
+  /// See set_trust_files().
+  bool trust_files_;
+  LoadCallback load_callback_;
+  std::atomic<int> anims_remaining_;
+  std::atomic<bool> load_success_;
+
+  /// For each object, one more than the number of its animations still to be
+  /// decoded. Drops to zero once its defining anim has been calculated too.
+  std::unique_ptr<std::atomic<int>[]> object_pending_;
+
+  /// Guards `spline_pool_`, `shared_spline_bytes_`, `buffers_`, and
+  /// `num_unique_anims_` while animations are decoded in parallel.
+  std::mutex load_mutex_;
+
+  /// External job system used to decode animations, if any. Not owned.
+  MotiveTaskScheduler* task_scheduler_;
+
+  /// The load started by an Async() loader, if `async_in_flight_`.
+  /// It runs in `async_group_` when a task scheduler is set, and on
+  /// `async_thread_` otherwise.
+  bool async_in_flight_;
+  MotiveTaskGroupId async_group_;
+  std::thread async_thread_;
+
+  /// Pins and size of a resident animation of an on-demand table.
+  struct Residency {
+    Residency() : pins(0), bytes(0) {}
+    int pins;
+    size_t bytes;
+
+    /// Position in `lru_`, if `pins` is zero.
+    std::list<AnimIndex>::iterator lru;
+  };
+
+  /// See set_residency_budget(). Zero if the table is not on-demand.
+  size_t residency_budget_;
+  size_t resident_bytes_;
+
+  /// Indexed like `anims_`. Empty names can't be reloaded, so are never
+  /// evicted.
+  std::vector<Residency> residency_;
+  std::vector<std::string> lazy_names_;
+
+  /// Resident, unpinned animations, least recently released first.
+  std::list<AnimIndex> lru_;
 };
 
 }  // namespace motive
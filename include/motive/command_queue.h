@@ -0,0 +1,216 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_COMMAND_QUEUE_H_
+#define MOTIVE_COMMAND_QUEUE_H_
+
+#include <assert.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "motive/common.h"
+#include "motive/math/compact_spline.h"
+#include "motive/target.h"
+
+namespace motive {
+
+class MotivatorNf;
+class RigAnim;
+class RigMotivator;
+
+/// @struct MotiveCommand
+/// @brief A call on a Motivator, queued by MotiveCommandQueue.
+struct MotiveCommand {
+  enum Type : uint8_t {
+    /// MotivatorNf::SetTargets() on `vector`, with `targets`.
+    kSetTargets,
+
+    /// RigMotivator::BlendToAnim() on `rig`, with `anim` and `playback`.
+    kBlendToAnim,
+
+    /// RigMotivator::SetPlaybackRate() on `rig`, with `playback_rate`.
+    kSetPlaybackRate,
+  };
+
+  /// Most dimensions of the MotivatorNf of a kSetTargets command.
+  static const MotiveDimension kMaxDimensions = 4;
+
+  MotiveCommand()
+      : type(kSetTargets),
+        dimensions(0),
+        vector(nullptr),
+        rig(nullptr),
+        anim(nullptr),
+        playback_rate(1.0f) {}
+
+  Type type;
+  MotiveDimension dimensions;
+  MotivatorNf* vector;
+  RigMotivator* rig;
+  const RigAnim* anim;
+  SplinePlayback playback;
+  float playback_rate;
+  MotiveTarget1f targets[kMaxDimensions];
+};
+
+/// @class MotiveCommandQueue
+/// @brief Lets any thread queue calls on the Motivators of a MotiveEngine.
+///
+/// MotiveEngine isn't thread safe, but threads such as AI, physics or
+/// networking can push commands here without locks, and without waiting for
+/// each other. The engine applies them at the start of its next
+/// AdvanceFrame(), sorted by processor so that each processor gets them in
+/// bulk, as with SetTargetsInBulk() and RigMotivator::BlendToAnimInBulk().
+/// The commands on any one Motivator are applied in the order they were
+/// pushed.
+///
+/// The queue holds a fixed number of commands, set with
+/// MotiveEngine::set_command_capacity(). Pushing to a full queue fails, so
+/// that pushing never allocates, or waits for the engine.
+///
+/// A Motivator must not move or be destroyed while it has commands in the
+/// queue. Commands on Motivators that have since been invalidated are
+/// ignored.
+class MotiveCommandQueue {
+ public:
+  MotiveCommandQueue() : capacity_(0), head_(0), tail_(0) {}
+
+  /// Queue `vector->SetTargets(targets)`. `dimensions` must equal
+  /// `vector->Dimensions()`. Returns false if the queue is full.
+  bool SetTargets(MotivatorNf* vector, MotiveDimension dimensions,
+                  const MotiveTarget1f* targets) {
+    assert(dimensions <= MotiveCommand::kMaxDimensions);
+    MotiveCommand command;
+    command.type = MotiveCommand::kSetTargets;
+    command.vector = vector;
+    command.dimensions = dimensions;
+    for (MotiveDimension i = 0; i < dimensions; ++i) {
+      command.targets[i] = targets[i];
+    }
+    return Push(command);
+  }
+
+  /// Queue `rig->BlendToAnim(anim, playback)`. `anim` must outlive the
+  /// command. Returns false if the queue is full.
+  bool BlendToAnim(RigMotivator* rig, const RigAnim& anim,
+                   const SplinePlayback& playback) {
+    MotiveCommand command;
+    command.type = MotiveCommand::kBlendToAnim;
+    command.rig = rig;
+    command.anim = &anim;
+    command.playback = playback;
+    return Push(command);
+  }
+
+  /// Queue `rig->SetPlaybackRate(playback_rate)`. Returns false if the queue
+  /// is full.
+  bool SetPlaybackRate(RigMotivator* rig, float playback_rate) {
+    MotiveCommand command;
+    command.type = MotiveCommand::kSetPlaybackRate;
+    command.rig = rig;
+    command.playback_rate = playback_rate;
+    return Push(command);
+  }
+
+  /// Queue `command`. Safe to call from any number of threads at once.
+  /// Returns false if the queue is full.
+  bool Push(const MotiveCommand& command) {
+    if (capacity_ == 0) return false;
+
+    // Claim the slot at the tail, unless the engine hasn't taken its previous
+    // command yet, in which case the queue is full.
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    Slot* slot;
+    for (;;) {
+      slot = &slots_[pos & (capacity_ - 1)];
+      const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      const intptr_t lag =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+      if (lag == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (lag < 0) {
+        return false;
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+
+    // Publish the command to Drain().
+    slot->command = command;
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Move the queued commands, in the order they were pushed, to the end of
+  /// `commands`. Only one thread may drain at once; MotiveEngine does so
+  /// from AdvanceFrame(). Commands that are still being pushed are left for
+  /// the next call.
+  void Drain(std::vector<MotiveCommand>* commands) {
+    if (capacity_ == 0) return;
+    for (;;) {
+      Slot& slot = slots_[head_ & (capacity_ - 1)];
+      if (slot.sequence.load(std::memory_order_acquire) != head_ + 1) return;
+      commands->push_back(slot.command);
+
+      // Hand the slot back to Push(), for its next lap around the queue.
+      slot.sequence.store(head_ + capacity_, std::memory_order_release);
+      ++head_;
+    }
+  }
+
+  /// Resize the queue to hold `capacity` commands, rounded up to a power of
+  /// two. Any queued commands are dropped. Not thread safe.
+  void SetCapacity(size_t capacity) {
+    size_t rounded = 0;
+    if (capacity > 0) {
+      rounded = 1;
+      while (rounded < capacity) rounded <<= 1;
+    }
+    capacity_ = rounded;
+    slots_.reset(rounded == 0 ? nullptr : new Slot[rounded]);
+    for (size_t i = 0; i < rounded; ++i) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    head_ = 0;
+    tail_.store(0, std::memory_order_relaxed);
+  }
+
+  size_t capacity() const { return capacity_; }
+
+ private:
+  struct Slot {
+    // Which lap around the queue the slot is on. Equals its position in the
+    // queue when it's free to push to, and its position + 1 once its command
+    // has been published.
+    std::atomic<size_t> sequence;
+    MotiveCommand command;
+  };
+
+  std::unique_ptr<Slot[]> slots_;
+  size_t capacity_;
+
+  // Position of the next command to drain. Only touched by Drain().
+  size_t head_;
+
+  // Position of the next command to push.
+  std::atomic<size_t> tail_;
+};
+
+}  // namespace motive
+
+#endif  // MOTIVE_COMMAND_QUEUE_H_
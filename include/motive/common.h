@@ -22,13 +22,25 @@ namespace motive {
 
 class MotiveProcessor;
 
+/// @struct MotivatorTypeInfo
+/// The run-time type information behind a MotivatorType. `name` is the
+/// readable name of the MotiveProcessor. `id` is assigned when the type is
+/// registered, counting up from 0, so that the MotiveEngine can keep its
+/// processors in a flat array indexed by `id`.
+struct MotivatorTypeInfo {
+  const char* name;
+  int id;
+};
+static const int kMotivatorTypeIdInvalid = -1;
+
 /// @typedef MotivatorType
 /// MotivatorType is used for run-time type information. It's implemented as a
-/// pointer to a string. Each derivation of MotivatorInit supplies a `kType`
-/// static member that's identifies the corresponding MotiveProcessor.
+/// pointer to a MotivatorTypeInfo. Each derivation of MotivatorInit supplies
+/// a `kType` static member that's identifies the corresponding
+/// MotiveProcessor.
 /// We put `kType` in MotivatorInit instead of MotiveProcessor because
 /// only MotivatorInit is in the external API.
-typedef const char** MotivatorType;
+typedef const MotivatorTypeInfo* MotivatorType;
 static const MotivatorType kMotivatorTypeInvalid = nullptr;
 
 /// @typedef MotiveIndex
@@ -58,6 +70,36 @@ typedef int MotiveTime;
 static const MotiveTime kMotiveTimeEndless =
     std::numeric_limits<MotiveTime>::max();
 
+/// @class MotiveUpdateDivisor
+/// @brief Evaluate an item only once every `divisor` frames.
+///
+/// Used for animation level-of-detail. Distant characters, for instance, can
+/// be evaluated at a fraction of the frame rate. Time still advances on the
+/// frames in between, so animations stay in sync with frame-rate ones.
+/// Items with the same `divisor` are evaluated on the same frames, unless
+/// `phase` is used to stagger them.
+struct MotiveUpdateDivisor {
+  MotiveUpdateDivisor() : divisor(1), phase(0) {}
+  MotiveUpdateDivisor(int divisor, int phase)
+      : divisor(divisor), phase(phase) {}
+
+  /// Return true if the item should be evaluated on frame number `frame`.
+  bool Due(uint32_t frame) const {
+    if (divisor <= 1) return true;
+    const uint32_t offset_frame = frame + static_cast<uint32_t>(phase);
+    return offset_frame % static_cast<uint32_t>(divisor) == 0;
+  }
+
+  /// Return true if the item is evaluated on every frame.
+  bool EveryFrame() const { return divisor <= 1; }
+
+  /// Evaluate once every `divisor` frames. Values <= 1 evaluate every frame.
+  int divisor;
+
+  /// Offset of the frames on which we evaluate.
+  int phase;
+};
+
 /// @typedef BoneIndex
 /// Identify bone for skeletal animation. Each non-root bone has a parent
 /// whose BoneIndex is less than its own. Each bone has a transformation matrix.
@@ -89,9 +131,10 @@ class MotivatorInit {
 /// Add this to the public interface of your derivation of Init. It defines
 /// a unique identifier for this type as kType. Your derivation's constructor
 /// should construct base class with Init(kType).
-#define MOTIVE_INTERFACE()                  \
-  static const char* kName;                 \
-  static const motive::MotivatorType kType; \
+#define MOTIVE_INTERFACE()                    \
+  static const char* kName;                   \
+  static motive::MotivatorTypeInfo kTypeInfo; \
+  static const motive::MotivatorType kType;   \
   static void Register()
 
 /// Add this to the source file with your processor code. It instantiates the
@@ -106,11 +149,13 @@ class MotivatorInit {
   void InitType::Register() {                                                  \
     const motive::MotiveProcessorFunctions functions(ProcessorType##Create,    \
                                                      ProcessorType##Destroy);  \
-    motive::MotiveEngine::RegisterProcessorFactory(InitType::kType,            \
+    motive::MotiveEngine::RegisterProcessorFactory(&InitType::kTypeInfo,       \
                                                    functions);                 \
   }                                                                            \
   const char* InitType::kName = #ProcessorType;                                \
-  const motive::MotivatorType InitType::kType = &InitType::kName
+  motive::MotivatorTypeInfo InitType::kTypeInfo = {                            \
+      #ProcessorType, motive::kMotivatorTypeIdInvalid};                        \
+  const motive::MotivatorType InitType::kType = &InitType::kTypeInfo
 
 /// Return the number of elements in an array 'a', as type `size_t`.
 /// If 'a' is not an array, generates an error by dividing by zero.
@@ -134,6 +179,14 @@ class MotivatorInit {
 #define MOTIVE_NO_SANITIZE(x)
 #endif
 
+/// Hint that the memory at `address` will be read soon, so that it can be
+/// fetched into cache while other work is done.
+#if defined(__GNUC__) || defined(__clang__)
+#define MOTIVE_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define MOTIVE_PREFETCH(address) static_cast<void>(address)
+#endif
+
 }  // namespace motive
 
 #endif  // MOTIVE_COMMON_H_
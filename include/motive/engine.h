@@ -16,14 +16,27 @@
 #define MOTIVE_ENGINE_H_
 
 #include <map>
+#include <memory>
 #include <set>
+#include <thread>
+#include <vector>
 
+#include "motive/command_queue.h"
 #include "motive/common.h"
+#include "motive/motivator_handle.h"
 #include "motive/processor.h"
+#include "motive/task_scheduler.h"
+#include "motive/thread_pool.h"
+#include "motive/util/allocator.h"
+#include "motive/util/counters.h"
+#include "motive/util/optimizations.h"
+#include "motive/vector_motivator.h"
 
 namespace motive {
 
 struct MotiveVersion;
+class RigAnim;
+struct TransformKernels;
 
 /// @class MotiveEngine
 /// @brief Hold and update all animation data.
@@ -33,6 +46,23 @@ struct MotiveVersion;
 /// for scalability. The engine is not a singleton, but you should try to
 /// minimize the number of engines in your game. As more Motivators are added to
 /// the processors, you start to get economies of scale.
+///
+/// When the work is naturally split, such as one engine per game room on a
+/// server, engines can run concurrently on different threads:
+///   - Register every MotivatorInit type, for example with SplineInit::
+///     Register(), before creating engines on other threads. The registry is
+///     global, and only read once registration is done.
+///   - Each engine, and its Motivators, must only be used by one thread at a
+///     time. Engines share no mutable state with each other.
+///   - Data that Motivators only read, such as CompactSplines, RigAnims and
+///     AnimTables, can be shared by any number of engines on any threads, as
+///     long as nothing modifies it while they're running.
+///   - frame_counters() are process-wide, so include the other engines' work.
+///   - Benchmark builds (BENCHMARK_MOTIVE) record samples into global tables,
+///     so aren't suitable for concurrent engines.
+/// Engines create their processors only when first used, so an engine with a
+/// modest population costs little more than its Motivators.
+/// See AdvanceFrames().
 class MotiveEngine {
   struct ProcessorDetails {
     MotiveProcessor* processor;
@@ -40,11 +70,11 @@ class MotiveEngine {
       return processor->Priority() < rhs.processor->Priority();
     }
   };
-  typedef std::map<MotivatorType, MotiveProcessor*> ProcessorMap;
-  typedef std::pair<MotivatorType, MotiveProcessor*> ProcessorPair;
+  typedef std::vector<MotiveProcessor*> ProcessorArray;
   typedef std::multiset<ProcessorDetails> ProcessorSet;
-  typedef std::map<MotivatorType, MotiveProcessorFunctions> FunctionMap;
-  typedef std::pair<MotivatorType, MotiveProcessorFunctions> FunctionPair;
+  typedef std::vector<MotiveProcessorFunctions> FunctionArray;
+  typedef std::pair<MotiveProcessor*, const MotiveProcessor*> Dependency;
+  typedef std::map<Dependency, int> DependencyCounts;
 
  public:
   MotiveEngine();
@@ -62,30 +92,518 @@ class MotiveEngine {
   ///                   the x-axis.
   void AdvanceFrame(MotiveTime delta_time);
 
+  /// Call AdvanceFrame() on each of the `count` engines in `engines`. With a
+  /// `scheduler`, the engines are split into batches of adjacent engines,
+  /// one batch per task, so each thread works through a few engines from
+  /// start to finish instead of interleaving them. Returns once every engine
+  /// has advanced. The engines must not have frames in flight from
+  /// AdvanceFrameAsync(), and are best left without task schedulers or
+  /// threads of their own. See the class comment for the guarantees.
+  static void AdvanceFrames(MotiveEngine* const* engines, size_t count,
+                            MotiveTime delta_time,
+                            MotiveTaskScheduler* scheduler = nullptr);
+
+  /// Number of calls to AdvanceFrame() that have completed, or of fixed
+  /// steps taken, when set_fixed_time_step() is on. Processors use this to
+  /// decide which Motivators are due. See MotiveUpdateDivisor.
+  uint32_t frame_count() const { return frame_count_; }
+
+  /// When `step` > 0, AdvanceFrame() advances the processors only in whole
+  /// steps of `step`, as many as fit in the time accumulated so far, and
+  /// keeps the rest for later frames. Simulation then no longer depends on
+  /// the frame rate. Render between the last two steps with
+  /// MotivatorNf::InterpolatedValues(), passing render_alpha().
+  /// Pass 0, the default, to advance by the full `delta_time` every frame.
+  void set_fixed_time_step(MotiveTime step) {
+    fixed_time_step_ = step;
+    fixed_time_remainder_ = 0;
+  }
+  MotiveTime fixed_time_step() const { return fixed_time_step_; }
+
+  /// How far the time accumulated since the last fixed step is towards the
+  /// next one, in [0, 1). 0 when set_fixed_time_step() is off. For frames
+  /// started by AdvanceFrameAsync(), read this only after WaitForFrame().
+  float render_alpha() const {
+    return fixed_time_step_ > 0 ? static_cast<float>(fixed_time_remainder_) /
+                                      static_cast<float>(fixed_time_step_)
+                                : 0.0f;
+  }
+
+  /// Events pushed by the processors during the most recent frame. Use these
+  /// to find Motivators whose animations have ended, instead of polling
+  /// TimeRemaining() on each of them every frame.
+  ///
+  /// Replaced whenever a frame completes. For frames started by
+  /// AdvanceFrameAsync(), that's when the frame is published.
+  const std::vector<MotiveEvent>& events() const { return events_; }
+
+  /// The MotiveCounters counted during the most recent frame, from the end
+  /// of the previous AdvanceFrame() to the end of this one.
+  ///
+  /// The counters are process-wide, so this includes work done by other
+  /// engines, and by Motivator calls made between frames, such as
+  /// BlendToAnim(). For frames started by AdvanceFrameAsync(), read this
+  /// only after WaitForFrame().
+  const MotiveCounters& frame_counters() const { return frame_counters_; }
+
+  /// Keep a front copy of every processor's outputs, that Motivator value
+  /// accessors read from. The copy is refreshed only when a frame is
+  /// published by AdvanceFrameAsync() or WaitForFrame(). Required by
+  /// AdvanceFrameAsync().
+  ///
+  /// Only the primary outputs are double buffered: MotivatorNf values,
+  /// MatrixMotivator4f::Value(), and RigMotivator::GlobalTransforms().
+  /// Velocities, targets, and other secondary accessors read the live data.
+  ///
+  /// Other threads can read the front copy while this one advances and
+  /// publishes frames, by reading inside Motivator::ReadPublished().
+  void set_double_buffered(bool double_buffered);
+  bool double_buffered() const { return double_buffered_; }
+
+  /// Publish the previous frame, then start advancing by `delta_time` in the
+  /// background and return immediately. Motivator outputs keep returning the
+  /// published frame until the next call to AdvanceFrameAsync() or
+  /// WaitForFrame(), so they can be read freely in the meantime.
+  ///
+  /// While a frame is in flight, Motivators of this engine must not be
+  /// initialized, modified, moved, or destroyed. Call WaitForFrame() first.
+  ///
+  /// The frame runs on the MotiveTaskScheduler, if one has been set, and on
+  /// a thread owned by the engine otherwise. Must be double buffered.
+  /// @param delta_time Elapsed time since the last call to AdvanceFrame() or
+  ///                   AdvanceFrameAsync().
+  void AdvanceFrameAsync(MotiveTime delta_time);
+
+  /// Block until the frame started by AdvanceFrameAsync() has finished, and
+  /// publish it. Does nothing if no frame is in flight.
+  void WaitForFrame();
+
+  /// Advance MotiveProcessors of the same tier concurrently, on up to
+  /// `num_threads` threads. A tier holds processors of equal Priority() that
+  /// don't depend on each other. Each tier still finishes before the next
+  /// starts, so child Motivators are always up-to-date when their parents
+  /// read them. See RegisterDependency().
+  /// The extra threads belong to a MotiveThreadPool that lives until the
+  /// number of threads changes, so nothing is created per frame.
+  /// @param num_threads Maximum number of threads used by AdvanceFrame().
+  ///                    The calling thread counts as one of them. Values <= 1
+  ///                    select the single-threaded path, which is the default.
+  void set_num_threads(int num_threads);
+  int num_threads() const { return num_threads_; }
+
+  /// Run AdvanceFrame() through your own job system instead of on threads
+  /// created by the engine. Processors of equal priority are submitted as
+  /// tasks, and processors that do bulk work split it with
+  /// MotiveTaskScheduler::ParallelFor(). When set, num_threads() is ignored.
+  /// @param scheduler Not owned. Must outlive the engine, or be reset to
+  ///                  nullptr first. nullptr restores the default behavior.
+  void set_task_scheduler(MotiveTaskScheduler* scheduler) {
+    task_scheduler_ = scheduler;
+  }
+  MotiveTaskScheduler* task_scheduler() const { return task_scheduler_; }
+
+  /// Use the functions of `optimization` to calculate the transforms of
+  /// matrix, SQT, and rig Motivators. Defaults to BestProcessorOptimization().
+  /// kNoOptimizations selects the C++ functions. Instruction sets that the
+  /// processor doesn't support must not be selected.
+  void set_optimization(ProcessorOptimization optimization);
+  ProcessorOptimization optimization() const { return optimization_; }
+
+  /// @private For internal use only.
+  /// Functions for optimization(), or nullptr to call the C++ functions.
+  const TransformKernels* transform_kernels() const {
+    return transform_kernels_;
+  }
+
+  /// Allocate processor data from `allocator` instead of the heap, for
+  /// example to keep each level's animation data in its own arena.
+  /// This covers every per-index array of the processors, the ops of matrix
+  /// and sqt motivators, the per-bone arrays of rig motivators, and the
+  /// splines created by spline motivators. Animations loaded by AnimTable,
+  /// and the processors' small caches and scratch arrays, stay on the heap.
+  /// Must be called before any Motivator is initialized, or after Reset().
+  /// @param allocator Not owned. Must outlive the engine, or every Reset()
+  ///                  that follows its use. nullptr restores the default.
+  void set_allocator(MotiveAllocator* allocator);
+  MotiveAllocator* allocator() const {
+    return allocator_ == nullptr ? MotiveAllocator::Default() : allocator_;
+  }
+
+  /// Log every call made to this engine and its Motivators to `recorder`,
+  /// so that the session can be replayed offline by MotiveReplayer.
+  /// Motivators initialized before recording started are not recorded.
+  /// @param recorder Not owned. Must outlive the engine, or be reset to
+  ///                 nullptr first. nullptr stops recording.
+  void set_recorder(MotiveRecorder* recorder);
+  MotiveRecorder* recorder() const { return recorder_; }
+
+  /// Queue of calls on this engine's Motivators that any thread can push to
+  /// without locks. AdvanceFrame() and AdvanceFrameAsync() apply the queued
+  /// commands before advancing. See MotiveCommandQueue.
+  MotiveCommandQueue& commands() { return commands_; }
+
+  /// Let commands() hold up to `capacity` commands at once. The queue holds
+  /// none until this is called. Must not be called while other threads
+  /// push commands, and drops any commands not yet applied.
+  void set_command_capacity(size_t capacity) {
+    commands_.SetCapacity(capacity);
+  }
+
+  /// @private For internal use only.
+  /// Call `fn(begin, end)` on sub-ranges covering [0, count). The sub-ranges
+  /// are processed in parallel when a MotiveTaskScheduler has been set, and
+  /// `fn(0, count)` is called directly otherwise.
+  template <class RangeFn>
+  void ParallelFor(int count, int min_range_size, const RangeFn& fn) const {
+    if (task_scheduler_ == nullptr || count <= min_range_size) {
+      fn(0, count);
+      return;
+    }
+    task_scheduler_->ParallelFor(
+        count, min_range_size, [&fn](int begin, int end) {
+          const MotiveProcessor::AdvancingScope advancing;
+          fn(begin, end);
+        });
+  }
+
+  /// Pre-allocate the processor of `type` for `count` indices, so that
+  /// initializing Motivators of that type doesn't reallocate during gameplay.
+  /// Call at load time, with the largest number you expect to be in use at
+  /// once. Each dimension of a Motivator takes one index, so 100
+  /// Motivator3fs need 300. A MatrixMotivator4f or RigMotivator takes one.
+  /// @return false if no processor is registered for `type`.
+  bool Reserve(MotivatorType type, int count);
+
+  /// Spread the defragmenting of the processor of `type` over several frames,
+  /// to avoid a spike after many Motivators are destroyed at once.
+  /// See MotiveProcessor::SetDefragmentBudget().
+  /// @return false if no processor is registered for `type`.
+  bool SetDefragmentBudget(MotivatorType type, int max_moves,
+                           int max_microseconds);
+
+  /// Reorder every processor's indices so that Motivators are processed in
+  /// the order they're read: a rig's bones together and in bone order, the
+  /// children of each MatrixMotivator4f together, and splines that share a
+  /// CompactSpline side by side. Call after loading or spawning many
+  /// Motivators, for example at the end of a level load. Every index is
+  /// moved, so don't call this every frame.
+  /// See MotiveProcessor::ReorderIndices().
+  void ReorderIndices();
+
+  /// Defragment every processor fully, then release the memory its arrays
+  /// hold beyond the indices in use. Arrays keep the capacity of their
+  /// busiest frame otherwise, so call this once a peak in the number of
+  /// Motivators has passed, for example when a level is unloaded.
+  /// See MotiveProcessor::Trim().
+  void Trim();
+
+  /// When `frames` > 0, automatically Trim() each processor once fewer than
+  /// a quarter of the indices its arrays have room for have been in use for
+  /// `frames` frames in a row. Pass 0, the default, to only trim when Trim()
+  /// is called.
+  void set_auto_trim_frames(uint32_t frames) { auto_trim_frames_ = frames; }
+  uint32_t auto_trim_frames() const { return auto_trim_frames_; }
+
+  /// Stop advancing the `count` Motivators in `motivators`, and every
+  /// Motivator they drive, such as the bones of a rig, for example while a
+  /// character is off-screen. Their indices are moved past the range that
+  /// AdvanceFrame() processes, so they cost nothing per frame, and their
+  /// values hold. Splines keep track of the time that passes, though, so
+  /// ResumeMotivators() jumps them to where they'd be had they never been
+  /// suspended, without replaying the frames in between.
+  /// See MotiveProcessor::SetSuspended().
+  void SuspendMotivators(const Motivator* const* motivators, size_t count);
+
+  /// Start advancing the `count` Motivators in `motivators`, and every
+  /// Motivator they drive, again. See SuspendMotivators().
+  void ResumeMotivators(const Motivator* const* motivators, size_t count);
+
+  /// Create a Motivator that's owned by the engine, for short-lived effects
+  /// such as particles and hit flashes. It's initialized to `init` with
+  /// `dimensions`, and moves towards `targets`, one per dimension. Once it's
+  /// Finished(), the end of the frame destroys it, along with every other
+  /// finished transient, and recycles its slot for the next one. The handle
+  /// is stale from then on.
+  MotiveHandle CreateTransient(const MotivatorInit& init,
+                               MotiveDimension dimensions,
+                               const MotiveTarget1f* targets);
+
+  /// Return the transient Motivator of `handle`, to read its values or give
+  /// it new targets, or nullptr once it has been destroyed.
+  MotivatorNf* Transient(MotiveHandle handle) {
+    return transients_.Get(handle);
+  }
+  const MotivatorNf* Transient(MotiveHandle handle) const {
+    return transients_.Get(handle);
+  }
+
+  /// Destroy the transient Motivator of `handle` before it has finished.
+  /// Does nothing if `handle` is already stale.
+  void DestroyTransient(MotiveHandle handle) { transients_.Destroy(handle); }
+
+  /// The number of transient Motivators that haven't been destroyed yet.
+  size_t NumTransients() const { return transients_.Size(); }
+
+  /// Report the memory held by every processor that has been created,
+  /// keyed by the processor's MotivatorType. `type->name` is the readable
+  /// name.
+  /// Useful for budgeting memory per processor, and for catching leaks.
+  void GetMemoryStats(std::map<MotivatorType, MemoryStats>* stats) const;
+
+  /// Save the state of every Motivator to `snapshot`, overwriting what it
+  /// held, so that Restore() can later return to it. Useful for rollback,
+  /// where the state is restored and the frames since are re-simulated.
+  /// Each processor's arrays are copied whole, and `snapshot` keeps its
+  /// buffer, so this doesn't allocate once `snapshot` has grown to fit.
+  ///
+  /// Waits for any frame in flight, and defragments every processor.
+  void Snapshot(MotiveSnapshot* snapshot);
+
+  /// Return every Motivator to its state when `snapshot` was taken.
+  /// Targets, splines, blends, playback times and rates, and the outputs
+  /// are all restored, and every output counts as changed on the current
+  /// frame_count(), which isn't restored.
+  ///
+  /// Only state is restored, not structure: if any Motivator has been
+  /// initialized, moved or removed since, or any rig or matrix has gained or
+  /// lost child Motivators, for example by blending to an animation with
+  /// other bones or ops, nothing is changed and false is returned. The
+  /// splines and animations that the Motivators played must still exist.
+  /// The restore isn't logged by the recorder.
+  /// @return true if the state was restored.
+  bool Restore(const MotiveSnapshot& snapshot);
+
+  /// Move every RigMotivator that is playing `old_anim` onto `new_anim`,
+  /// without restarting it. Call after AnimTable::ReloadAnim().
+  /// See RigProcessor::ReplaceAnim(). Returns the number of rigs moved.
+  int ReplaceRigAnim(const RigAnim& old_anim, const RigAnim& new_anim,
+                     MotiveTime blend_time);
+
+  /// @private For internal use only.
+  /// Return the processor for `type`, creating it the first time. Returns
+  /// nullptr if `type` hasn't been registered. Once created, the lookup is
+  /// a single array load, indexed by the type's id.
+  MotiveProcessor* Processor(MotivatorType type) {
+    MotiveProcessor* processor = FindProcessor(type);
+    return processor != nullptr ? processor : CreateProcessor(type);
+  }
+
+  /// @private For internal use only.
+  /// Same as Processor(InitT::kType), for when the type is known at compile
+  /// time.
+  template <class InitT>
+  MotiveProcessor* Processor() {
+    return Processor(InitT::kType);
+  }
+
   /// @private For internal use only.
-  MotiveProcessor* Processor(MotivatorType type);
+  /// Record that an item in `dependent` reads the output of `dependency`
+  /// every frame. For example, a MatrixMotivator reads its child Motivator1fs.
+  ///
+  /// Registrations are reference counted. Call UnregisterDependency() with
+  /// the returned processor once the item no longer reads `dependency`.
+  ///
+  /// AdvanceFrame() advances processors in a topological order of the
+  /// registered dependencies, falling back on Priority() order between
+  /// processors that don't depend on each other. So `dependent` advances
+  /// after `dependency`, even when its Priority() says otherwise. Only
+  /// cycles can't be ordered. For those, AdvanceFrame() follows its normal
+  /// pass with `dependent->UpdateDependents()`, and then lets everything
+  /// downstream of `dependent` catch up too. Only items that read the changed
+  /// processors are recalculated, and time is not advanced again.
+  /// @return The processor driving `dependency`, or nullptr if `dependency`
+  ///         is not valid, in which case nothing is registered.
+  const MotiveProcessor* RegisterDependency(MotiveProcessor* dependent,
+                                            const Motivator& dependency);
 
   /// @private For internal use only.
-  static void RegisterProcessorFactory(MotivatorType type,
+  /// Remove one registration made by RegisterDependency().
+  void UnregisterDependency(MotiveProcessor* dependent,
+                            const MotiveProcessor* dependency);
+
+  /// @private For internal use only.
+  /// Assigns `type->id`, if it doesn't already have one.
+  static void RegisterProcessorFactory(MotivatorTypeInfo* type,
                                        const MotiveProcessorFunctions& fns);
 
  private:
-  /// Map from the MotivatorType to the MotiveProcessor. Only one
-  /// MotiveProcessor per type per engine. This is to maximize centralization
-  /// of data.
-  ProcessorMap mapped_processors_;
+  /// Advance every processor in `tier_` by `delta_time`, in parallel.
+  void AdvanceTier(MotiveTime delta_time);
+
+  /// Recalculate outputs that were read before the processor that drives them
+  /// had advanced. See RegisterDependency().
+  void UpdateLateDependencies();
+
+  /// Rebuild `ordered_processors_`, `tier_ends_`, and `late_dependencies_`
+  /// from `sorted_processors_` and `dependency_counts_`.
+  void OrderProcessors();
+
+  /// Publish the outputs of every processor. See set_double_buffered().
+  void UpdateFrontBuffers();
+
+  /// Pass the state of every processor to `archive`. See Snapshot().
+  void ArchiveProcessors(MotiveStateArchive* archive);
+
+  /// Create the processor for `type` and store it in `processors_`.
+  /// Returns nullptr if `type` hasn't been registered.
+  MotiveProcessor* CreateProcessor(MotivatorType type);
+
+  /// Return the processor for `type`, or nullptr if it hasn't been created.
+  MotiveProcessor* FindProcessor(MotivatorType type) const {
+    const int id = type == kMotivatorTypeInvalid ? kMotivatorTypeIdInvalid
+                                                 : type->id;
+    return 0 <= id && id < static_cast<int>(processors_.size())
+               ? processors_[id]
+               : nullptr;
+  }
+
+  /// Suspend or resume `motivators` and all of their descendants.
+  /// See SuspendMotivators().
+  void SetSuspended(const Motivator* const* motivators, size_t count,
+                    bool suspended);
+
+  /// Advance every processor by `delta_time`, in priority order, then update
+  /// late dependencies. One step of AdvanceFrame().
+  void AdvanceProcessors(MotiveTime delta_time);
+
+  /// Advance `processor` by `delta_time`, then let it write its outputs.
+  static void AdvanceProcessor(MotiveProcessor* processor,
+                               MotiveTime delta_time);
+
+  /// Apply the commands pushed to `commands_` since the previous frame.
+  void ApplyCommands();
+
+  /// Gather the events pushed by every processor during the current frame.
+  void TakeEvents();
+
+  /// Destroy every transient Motivator that has finished. Called once the
+  /// frame is published. See CreateTransient().
+  void ReclaimTransients();
+
+  /// Trim the processors that have been underused for long enough.
+  /// See set_auto_trim_frames().
+  void AutoTrim();
+
+  /// Set `frame_counters_` to the counts since the previous frame.
+  void TakeCounters();
+
+  /// The MotiveProcessor of each MotivatorType, indexed by the type's id, or
+  /// nullptr if it hasn't been created yet. Only one MotiveProcessor per type
+  /// per engine. This is to maximize centralization of data.
+  ProcessorArray processors_;
+
+  /// Motivators created by CreateTransient(). The table keeps them at
+  /// stable addresses, so the processors' pointers back to them stay valid.
+  MotivatorHandleTable<MotivatorNf> transients_;
 
   /// Sort the MotiveProcessors by priority. Low numbered priorities run first.
   /// This allows high number priorities to have child motivators, as long as
   /// the child motivators have lower priority.
   ProcessorSet sorted_processors_;
 
+  /// Processors whose IsStatic() is true. These are never advanced, so they
+  /// are kept out of `sorted_processors_`.
+  std::vector<MotiveProcessor*> static_processors_;
+
+  /// Processors of a single tier, gathered from `ordered_processors_` by
+  /// the threaded AdvanceFrame(). Held here to avoid reallocating every frame.
+  std::vector<MotiveProcessor*> tier_;
+
+  /// Events of the most recently completed frame. See events().
+  std::vector<MotiveEvent> events_;
+
+  /// Events of the frame being advanced. Swapped into `events_` when the
+  /// frame completes.
+  std::vector<MotiveEvent> frame_events_;
+
+  /// See commands(). `drained_commands_` holds the commands taken from the
+  /// queue by ApplyCommands(), and `command_indices_` and `command_targets_`
+  /// the arguments it gathers for each processor, to avoid reallocating every
+  /// frame.
+  MotiveCommandQueue commands_;
+  std::vector<MotiveCommand> drained_commands_;
+  std::vector<MotiveIndex> command_indices_;
+  std::vector<MotiveTarget1f> command_targets_;
+
+  /// Maximum number of threads AdvanceFrame() may use, and the workers that
+  /// make up the difference. See set_num_threads().
+  int num_threads_;
+  std::unique_ptr<MotiveThreadPool> thread_pool_;
+
+  /// External job system used by AdvanceFrame(), if any. Not owned.
+  MotiveTaskScheduler* task_scheduler_;
+
+  /// See set_optimization().
+  ProcessorOptimization optimization_;
+  const TransformKernels* transform_kernels_;
+
+  /// Source of processor memory, if not the default. Not owned.
+  /// See set_allocator().
+  MotiveAllocator* allocator_;
+
+  /// Receives every call made to the engine, if not nullptr. Not owned.
+  /// See set_recorder().
+  MotiveRecorder* recorder_;
+
+  /// Incremented at the end of every AdvanceFrame(), or of every fixed step.
+  uint32_t frame_count_;
+
+  /// See set_fixed_time_step(). `fixed_time_remainder_` is the time
+  /// accumulated by AdvanceFrame() that hasn't yet made up a whole step.
+  MotiveTime fixed_time_step_;
+  MotiveTime fixed_time_remainder_;
+
+  /// See set_auto_trim_frames().
+  uint32_t auto_trim_frames_;
+
+  /// Process-wide counter totals at the end of the previous AdvanceFrame().
+  MotiveCounters counters_at_last_frame_;
+
+  /// See frame_counters().
+  MotiveCounters frame_counters_;
+
+  /// True if processors keep a front copy of their outputs.
+  /// See set_double_buffered().
+  bool double_buffered_;
+
+  /// The frame started by AdvanceFrameAsync(), if `async_in_flight_`.
+  /// It runs in `async_group_` when a task scheduler is set, and on
+  /// `async_thread_` otherwise.
+  bool async_in_flight_;
+  MotiveTaskGroupId async_group_;
+  std::thread async_thread_;
+
+  /// Number of times each dependent processor has registered on each
+  /// dependency processor. See RegisterDependency().
+  DependencyCounts dependency_counts_;
+
+  /// The processors of `sorted_processors_`, in the order that
+  /// AdvanceFrame() advances them. Every dependency advances in an earlier
+  /// tier than its dependents, unless they form a cycle. `tier_ends_` holds
+  /// the end of each tier, whose processors may advance concurrently.
+  std::vector<MotiveProcessor*> ordered_processors_;
+  std::vector<size_t> tier_ends_;
+
+  /// Dependencies whose `dependency` processor does not advance in an
+  /// earlier tier than its `dependent` processor, because they're in a cycle.
+  std::vector<Dependency> late_dependencies_;
+
+  /// True when the processors or their dependencies have changed since
+  /// OrderProcessors() was last called.
+  bool order_dirty_;
+
+  /// Processors that recalculated outputs in the current and previous passes
+  /// of UpdateLateDependencies(). Held here to avoid reallocating.
+  std::vector<const MotiveProcessor*> changed_;
+  std::vector<const MotiveProcessor*> next_changed_;
+
   /// Current version of the Motive Animation System.
   const MotiveVersion* version_;
 
-  /// ProcessorMap from the MotivatorType to the factory that creates the
-  /// MotiveProcessor. We only create an MotiveProcessor when one is needed.
-  static FunctionMap function_map_;
+  /// The factory that creates the MotiveProcessor of each MotivatorType,
+  /// indexed by the type's id. We only create an MotiveProcessor when one is
+  /// needed.
+  static FunctionArray factories_;
 };
 
 }  // namespace motive
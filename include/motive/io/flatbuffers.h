@@ -15,13 +15,23 @@
 #ifndef MOTIVE_IO_FLATBUFFERS_H_
 #define MOTIVE_IO_FLATBUFFERS_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
+namespace flatbuffers {
+class FlatBufferBuilder;
+}  // namespace flatbuffers
+
 namespace motive {
 
+struct AnimBundleFb;
 class AnimTable;
 class MatrixAnim;
 struct MatrixAnimFb;
 class OvershootInit;
 struct OvershootParameters;
+class PresetTable;
+struct MotivatorPresetsFb;
 class RigAnim;
 struct RigAnimFb;
 class SplineInit;
@@ -41,11 +51,86 @@ void SplineInitFromFlatBuffers(const SplineParameters& params,
 void Settled1fFromFlatBuffers(const Settled1fParameters& params,
                               Settled1f* settled);
 
+/// Decode every preset in `params`, and add it to `table` under its name.
+/// Presets whose parameters are missing are skipped.
+void PresetTableFromFlatBuffers(const MotivatorPresetsFb& params,
+                                PresetTable* table);
+
+/// Same as PresetTableFromFlatBuffers(), for the MotivatorPresetsFb file in
+/// `data`. If `verify` is true, returns false without touching `table` when
+/// `data` is not a well-formed MotivatorPresetsFb of at most `size` bytes.
+bool PresetTableFromFlatBuffers(const void* data, size_t size, bool verify,
+                                PresetTable* table);
+
+/// Returns true if `data` holds a well-formed MotivatorPresetsFb of at most
+/// `size` bytes, as checked by the FlatBuffers verifier.
+bool VerifyMotivatorPresetsFlatBuffer(const void* data, size_t size);
+
 /// Convert from FlatBuffer params to Motive MatrixAnim.
-void MatrixAnimFromFlatBuffers(const MatrixAnimFb& params, MatrixAnim* anim);
+/// If `reference_params` is true, splines point directly at the node data
+/// inside `params` instead of copying it. `params` must then outlive `anim`.
+/// Packed splines are expanded into full-size nodes, so are always copied.
+/// Returns false if a packed spline's data is invalid. Its operation is then
+/// left without a spline, so `anim` is still safe to destroy.
+bool MatrixAnimFromFlatBuffers(const MatrixAnimFb& params, MatrixAnim* anim,
+                               bool reference_params = false);
 
 /// Convert from FlatBuffer params to Motive MatrixAnim.
-void RigAnimFromFlatBuffers(const RigAnimFb& params, RigAnim* anim);
+/// See MatrixAnimFromFlatBuffers() for `reference_params` and the return
+/// value.
+bool RigAnimFromFlatBuffers(const RigAnimFb& params, RigAnim* anim,
+                            bool reference_params = false);
+
+/// Same as RigAnimFromFlatBuffers(), but first sizes the whole animation, so
+/// that every spline and bone name is placed in one block owned by `anim`,
+/// instead of being allocated separately. Decodes with a few allocations per
+/// bone instead of one per spline, and frees as cheaply. The splines can't be
+/// freed individually, so sharing them with MatrixAnim::ShareSpline() saves
+/// no memory.
+bool RigAnimFromFlatBuffersContiguous(const RigAnimFb& params, RigAnim* anim,
+                                      bool reference_params = false);
+
+/// Convert the .motiveanim file in `data` to a Motive RigAnim.
+/// If `verify` is true, returns false without touching `anim` when `data`
+/// is not a well-formed RigAnimFb of at most `size` bytes. Only skip
+/// verification for files produced by a trusted pipeline. Also returns false
+/// if a packed spline's data is invalid.
+bool RigAnimFromFlatBuffers(const void* data, size_t size, bool verify,
+                            RigAnim* anim, bool reference_params = false);
+
+/// Returns true if `data` holds a well-formed RigAnimFb of at most `size`
+/// bytes, as checked by the FlatBuffers verifier, whose packed splines all
+/// have valid packings and enough bits for their nodes.
+bool VerifyRigAnimFlatBuffer(const void* data, size_t size);
+
+/// Convert animation `anim_idx` of an AnimBundleFb to a Motive RigAnim.
+/// See MatrixAnimFromFlatBuffers() for `reference_params`. Packed bundles are
+/// always copied. Returns false if a packed spline's data is invalid, which
+/// VerifyAnimBundleFlatBuffer() rules out.
+bool RigAnimFromFlatBuffers(const AnimBundleFb& bundle, size_t anim_idx,
+                            RigAnim* anim, bool reference_params = false);
+
+/// Write every animation in `table` into `fbb` as a finished AnimBundleFb.
+/// If `pack_y_tolerance` is positive, spline nodes are bit-packed, and
+/// evaluate to within `pack_y_tolerance` of the originals. Otherwise they're
+/// stored as is, and can be referenced in place when loaded.
+void AnimTableToFlatBuffers(const AnimTable& table, float pack_y_tolerance,
+                            flatbuffers::FlatBufferBuilder* fbb);
+
+/// Returns true if `data` holds a well-formed AnimBundleFb of at most `size`
+/// bytes, whose indices and spline blocks are all in range. Safe to call on
+/// untrusted data.
+bool VerifyAnimBundleFlatBuffer(const void* data, size_t size);
+
+/// Returns the checksum of the `size`-byte AnimBundleFb in `data`, as stored
+/// in its header by AnimTableToFlatBuffers().
+uint32_t AnimBundleChecksum(const void* data, size_t size);
+
+/// Cheap integrity check for bundles from a trusted pipeline. Returns true if
+/// the stored checksum matches the `size` bytes in `data`. Unlike
+/// VerifyAnimBundleFlatBuffer(), this does not protect against maliciously
+/// crafted data.
+bool CheckAnimBundleChecksum(const void* data, size_t size);
 
 }  // namespace motive
 
@@ -337,6 +337,17 @@ class Angle {
     return Angle(ModWithinThreePi(angle));
   }
 
+  /// Same as FromWithinThreePi(), for `count` angles at once. Writes the
+  /// equivalent angles in (-pi, pi], in radians, to `out`, which may equal
+  /// `angles`. The loop has no branches, so that the compiler can vectorize
+  /// it.
+  static void NormalizeWithinThreePi(const float* angles, size_t count,
+                                     float* out) {
+    for (size_t i = 0; i < count; ++i) {
+      out[i] = ModWithinThreePi(angles[i]);
+    }
+  }
+
   /// Create from `radians`, which is converted to the range (-pi, pi].
   static Angle FromRadians(const float radians) {
     return Angle(WrapAngle(radians));
@@ -15,8 +15,13 @@
 #ifndef MOTIVE_MATH_BULK_SPLINE_EVALUATOR_H_
 #define MOTIVE_MATH_BULK_SPLINE_EVALUATOR_H_
 
+#include <algorithm>
 #include "motive/math/compact_spline.h"
+#include "motive/math/fixed_cubic.h"
+#include "motive/math/spline_state.h"
+#include "motive/util/allocator.h"
 #include "motive/util/optimizations.h"
+#include "motive/util/snapshot.h"
 
 namespace motive {
 
@@ -38,11 +43,34 @@ class BulkSplineEvaluator {
  public:
   typedef int Index;
 
-  // TODO: Call BestProcessorOptimization() to initialize `optimizations_`.
-  BulkSplineEvaluator() : optimization_(kNoOptimizations) {
-    // Avoid "private member variable unused" warning on OSX.
-    (void)optimization_;
-  }
+  /// How the coefficients of the current cubics are stored.
+  enum CoefficientLayout {
+    /// One CubicCurve per index. Matches the NEON assembly functions.
+    kInterleavedCoefficients,
+
+    /// One array per coefficient, padded to kCoefficientPadding. Lets the
+    /// SIMD functions load four or eight of the same coefficient at once,
+    /// instead of transposing interleaved curves.
+    kSeparateCoefficients,
+
+    /// One FixedCubic per index. x is advanced and the cubics are evaluated
+    /// with integer arithmetic, for processors without a fast FPU, or when
+    /// every platform must compute the same values. Before Y() is rounded
+    /// to float, it errs by less than 2^-25 of the cubic's largest
+    /// coefficient, scaled to the segment width, which is within the error
+    /// of the float layouts. See FixedCubic for the error bounds.
+    kFixedPointCoefficients
+  };
+
+  /// The coefficient arrays of kSeparateCoefficients are padded to a multiple
+  /// of this many floats, the widest SIMD register we use.
+  static const Index kCoefficientPadding = 8;
+
+  BulkSplineEvaluator();
+
+  /// Hold the per-index arrays in `allocator` instead of the heap. Must be
+  /// called while there are no indices.
+  void SetAllocator(MotiveAllocator* allocator);
 
   /// Return the number of indices currently allocated. Each index is one
   /// spline that's being evaluated.
@@ -57,6 +85,23 @@ class BulkSplineEvaluator {
   ///   - splines are allocated or removed at the highest indices
   void SetNumIndices(const Index num_indices);
 
+  /// Pre-allocate storage for `num_indices`, so that SetNumIndices() doesn't
+  /// reallocate until the number of indices exceeds it.
+  void Reserve(const Index num_indices);
+
+  /// Release the memory held beyond the current number of indices. Ys() and
+  /// the other arrays may move.
+  void ShrinkToFit();
+
+  /// Add the memory held by this evaluator to `stats`. The splines are not
+  /// owned, so are not included.
+  void AddMemoryStats(MemoryStats* stats) const;
+
+  /// Save, verify or restore the state of every index with `archive`.
+  /// The coefficient layout must be the same when restored as when saved.
+  /// The splines are not owned, so only the pointers to them are saved.
+  void ArchiveState(MotiveStateArchive* archive);
+
   /// Move the data at `old_index` into `new_index`. Move `count` indices total.
   ///
   /// Unused indices are still processed every frame. You can fill these index
@@ -97,14 +142,45 @@ class BulkSplineEvaluator {
   void SetSplines(const Index index, const Index count,
                   const CompactSpline* splines, const SplinePlayback& playback);
 
+  /// Start `indices[i]` at the beginning of `splines[i]`, without blending,
+  /// for every i in [0, num_indices). Equivalent to calling SetSplines() on
+  /// each index in turn, but the first segment of every spline is
+  /// initialized in one batch. `indices` must not contain duplicates.
+  void JumpToSplines(const Index* indices, size_t num_indices,
+                     const CompactSpline* const* splines,
+                     const SplinePlayback& playback);
+
+  /// Same as calling SetSplines() on `indices[i]` with `splines[i]`, for every
+  /// i in [0, num_indices), including blending from the current splines. But
+  /// the cubics of every index are initialized in batches. `indices` must not
+  /// contain duplicates, and `splines` must not contain nullptr.
+  void SetSplinesAt(const Index* indices, size_t num_indices,
+                    const CompactSpline* const* splines,
+                    const SplinePlayback& playback);
+
   /// Mark spline range as invalid.
   void ClearSplines(const Index index, const Index count);
 
+  /// Return the playback state of `index`, for SetSplineState() to apply to
+  /// another evaluator.
+  void GetSplineState(const Index index, SplineState* state) const;
+
+  /// Continue `index` from `state`, without re-deriving its cubic. The Y()
+  /// value is immediately available. If `state.spline` is nullptr, `index`
+  /// is cleared, as in ClearSplines(), but held along `state.cubic`.
+  void SetSplineState(const Index index, const SplineState& state);
+
   /// Reposition the spline at `index` evaluate from `x`.
   /// Same as calling SetSpline() with the same spline and
   /// `playback.start_x = x`.
   void SetXs(const Index index, const Index count, const float x);
 
+  /// Move the splines at [index, index + count) forward by `delta_x`, scaled
+  /// by each spline's playback rate, as though AdvanceFrame() had been called
+  /// with deltas summing to `delta_x`. Only the new segment is initialized,
+  /// so this is much cheaper than advancing frame by frame.
+  void AdvanceXs(const Index index, const Index count, const float delta_x);
+
   /// Set conversion rate from AdvanceFrame's delta_x to the speed at which
   /// we traverse the spline.
   ///     0   ==> paused
@@ -117,17 +193,75 @@ class BulkSplineEvaluator {
   /// Set repeat state for splines.
   void SetRepeating(const Index index, const Index count, bool repeat);
 
+  /// Only evaluate the splines at [index, index + count) on frames where
+  /// `divisor` is due. Their x values still advance every frame, so on due
+  /// frames they catch up with all the time that has passed.
+  /// Indices with update divisors are processed one-by-one, instead of in
+  /// bulk, so only use divisors when they skip a good deal of work. Indices
+  /// without them, even in the same shard, are still processed in bulk.
+  void SetUpdateDivisors(const Index index, const Index count,
+                         const MotiveUpdateDivisor& divisor);
+
+  /// Set the frame number that update divisors are tested against.
+  /// AdvanceFrame() increments the frame number after every call, so this
+  /// only needs to be called when using AdvanceFrameShards() directly.
+  void SetFrame(uint32_t frame) { frame_ = frame; }
+
   /// Increment x and update the Y() and Derivative() values for all indices.
   /// Process all indices in bulk to efficiently traverse memory and allow SIMD
   /// instructions to be effective.
   void AdvanceFrame(const float delta_x);
 
+  /// Number of indices in each shard processed by AdvanceFrameShards().
+  /// A multiple of 16, so that each shard's float arrays begin on a 64-byte
+  /// boundary relative to the start of the array, and neighbouring shards
+  /// rarely write to the same cache line.
+  static const Index kIndicesPerShard = 256;
+
+  /// Number of shards needed to cover all active indices.
+  Index NumShards() const {
+    return (NumActiveIndices() + kIndicesPerShard - 1) / kIndicesPerShard;
+  }
+
+  /// Only advance the indices below `num_active_indices` in AdvanceFrame()
+  /// and AdvanceFrameShards(). The others keep their current x and y values,
+  /// until they're moved below it, or AdvanceXs() is called on them.
+  /// Negative to advance every index, which is the default.
+  void SetNumActiveIndices(const Index num_active_indices) {
+    num_active_indices_ = num_active_indices;
+  }
+  Index NumActiveIndices() const {
+    return num_active_indices_ < 0
+               ? NumIndices()
+               : std::min(num_active_indices_, NumIndices());
+  }
+
+  /// Same as AdvanceFrame(), but only for indices in the shards
+  /// [first_shard, end_shard). Every index is processed independently, so
+  /// disjoint shard ranges can be advanced concurrently on different threads.
+  void AdvanceFrameShards(const float delta_x, const Index first_shard,
+                          const Index end_shard);
+
+  /// Choose which optimized functions AdvanceFrame() calls. Defaults to the
+  /// best set supported by both this library and the current CPU. Requesting
+  /// a set that the CPU doesn't support will crash. Sets without functions
+  /// of their own use the functions of the next-best set.
+  void set_optimization(ProcessorOptimization optimization);
+  ProcessorOptimization optimization() const { return optimization_; }
+
+  /// Choose how the cubic coefficients are stored. Defaults to
+  /// kSeparateCoefficients when the chosen optimization has functions for it.
+  /// Changing the layout converts the existing coefficients. The optimized
+  /// functions are not used with kFixedPointCoefficients.
+  void set_coefficient_layout(CoefficientLayout layout);
+  CoefficientLayout coefficient_layout() const { return coefficient_layout_; }
+
   /// Return true if the spline for `index` has valid spline data.
   bool Valid(const Index index) const;
 
   /// Return the current x value for the spline at `index`.
   float X(const Index index) const {
-    return CubicStartX(index) + cubic_xs_[index];
+    return CubicStartX(index) + CubicX(index);
   }
 
   /// Return the current y value for the spline at `index`.
@@ -139,6 +273,13 @@ class BulkSplineEvaluator {
     return NormalizeY(index, ys_[index]);
   }
 
+  /// Same as NormalizedY(), for the `count` indices starting at `index`.
+  /// `out` is an array of length `count`.
+  void NormalizedYs(const Index index, const Index count, float* out) const {
+    std::copy(&ys_[index], &ys_[index] + count, out);
+    NormalizeYs(index, count, out);
+  }
+
   /// Return the current y value for splines, from index onward.
   /// Since this is the most commonly called function, we keep it fast by
   /// returning a pointer to the pre-calculated array. Note that we don't
@@ -146,9 +287,13 @@ class BulkSplineEvaluator {
   /// different.
   const float* Ys(const Index index) const { return &ys_[index]; }
 
+  /// Return the current y values of every index, as one contiguous array.
+  /// Invalidated by SetNumIndices().
+  const float* Ys() const { return ys_.data(); }
+
   /// Return the current slope for the spline at `index`.
   float Derivative(const Index index) const {
-    return PlaybackRate(index) * Cubic(index).Derivative(cubic_xs_[index]);
+    return PlaybackRate(index) * Cubic(index).Derivative(CubicX(index));
   }
 
   /// Return the slopes for the `count` splines starting at `index`.
@@ -165,7 +310,7 @@ class BulkSplineEvaluator {
   /// rate. This is useful for times when the playback rate is 0, but you
   /// still want to get information about the underlying spline.
   float DerivativeWithoutPlayback(const Index index) const {
-    return Cubic(index).Derivative(cubic_xs_[index]);
+    return Cubic(index).Derivative(CubicX(index));
   }
 
   /// Return the slopes for the `count` splines starting at `index`, ignoring
@@ -181,7 +326,9 @@ class BulkSplineEvaluator {
   }
 
   /// Return the current playback rate of the spline at `index`.
-  float PlaybackRate(const Index index) const { return sources_[index].rate; }
+  float PlaybackRate(const Index index) const {
+    return playback_rates_[index];
+  }
 
   /// Return the spline that is currently being traversed at `index`.
   const CompactSpline* SourceSpline(const Index index) const {
@@ -196,11 +343,23 @@ class BulkSplineEvaluator {
   /// Return the raw cubic curve for `index`. Useful if you need to calculate
   /// the second or third derivatives (which are not calculated in
   /// AdvanceFrame), or plot the curve for debug reasons.
-  const CubicCurve& Cubic(const Index index) const { return cubics_[index]; }
+  CubicCurve Cubic(const Index index) const {
+    if (coefficient_layout_ == kInterleavedCoefficients) return cubics_[index];
+    if (coefficient_layout_ == kFixedPointCoefficients) {
+      return fixed_cubics_[index].ToCubic();
+    }
+    return CubicCurve(coefficients_[3][index], coefficients_[2][index],
+                      coefficients_[1][index], coefficients_[0][index]);
+  }
 
   /// Return the current x value for the current cubic. Each spline segment
   /// is evaluated as a cubic that starts at x=0.
-  float CubicX(const Index index) const { return cubic_xs_[index]; }
+  float CubicX(const Index index) const {
+    if (coefficient_layout_ == kFixedPointCoefficients) {
+      return fixed_cubics_[index].X();
+    }
+    return cubic_xs_[index];
+  }
 
   /// Return x-value at the end of the spline.
   float EndX(const Index index) const { return sources_[index].spline->EndX(); }
@@ -243,13 +402,13 @@ class BulkSplineEvaluator {
     return NormalizeY(index, EndY(index) - Y(index));
   }
 
-  /// TODO OPT: Write assembly versions of this function.
   void YDifferencesToEnd(const Index index, const Index count,
                          float* out) const {
     assert(Valid(index) && Valid(index + count - 1));
     for (Index i = 0; i < count; ++i) {
-      out[i] = YDifferenceToEnd(index + i);
+      out[i] = EndY(index + i) - Y(index + i);
     }
+    NormalizeYs(index, count, out);
   }
 
   /// Apply modular arithmetic to ensure that `y` is within the valid y_range.
@@ -258,6 +417,11 @@ class BulkSplineEvaluator {
     return r.modular_range.Valid() ? r.modular_range.NormalizeCloseValue(y) : y;
   }
 
+  /// Same as NormalizeY(), for `ys[i]` and the y_range of `index + i`, for
+  /// every i in [0, count). Uses SIMD on supported processors, and gives
+  /// exactly the same results as NormalizeY().
+  void NormalizeYs(const Index index, const Index count, float* ys) const;
+
   /// Helper function to calculate the next y-value in a series of y-values
   /// that are restricted by `direction`. There are always two paths that a y
   /// value can take, in modular arithmetic. This function chooses the correct
@@ -288,6 +452,19 @@ class BulkSplineEvaluator {
 
  private:
   void InitCubic(const Index index, const float start_x);
+  /// Resize the storage of the current `coefficient_layout_`.
+  void ResizeCoefficients(const Index num_indices);
+
+  /// Same as calling InitCubic() for each of `indices`, but in three passes:
+  /// segment lookups, then solving for all the coefficients in one
+  /// vectorizable loop, then storing them. If `start_x` is nullptr, each
+  /// index is reinitialized at its current X().
+  void InitCubics(const Index* indices, size_t num_indices,
+                  const float* start_x);
+  /// Prefetch the spline nodes that `indices` read when they move on to
+  /// their next segments. The nodes are scattered across the heap, so
+  /// otherwise nearly every segment change waits on a cache miss.
+  void PrefetchNextSegments(const Index* indices, size_t num_indices) const;
   float SplineStartX(const Index index) const {
     return sources_[index].spline->StartX();
   }
@@ -298,44 +475,82 @@ class BulkSplineEvaluator {
   }
   CubicInit CalculateBlendInit(const Index index, const CompactSpline& spline,
                                const SplinePlayback& playback) const;
-  void BlendToSpline(const Index index, const CompactSpline& spline,
-                     const SplinePlayback& playback);
+  /// Start playing `spline`, blending from the current curve. Returns the
+  /// blend cubic, which must then be shifted right by `cubic_start_x` and
+  /// set with SetCubic(). SetSplines() solves the cubics in batches.
+  CubicInit BlendToSpline(const Index index, const CompactSpline& spline,
+                          const SplinePlayback& playback,
+                          float* cubic_start_x);
+  /// Start playing `spline` without blending. Call InitCubic() or
+  /// InitCubics() afterwards to initialize the first segment.
   void JumpToSpline(const Index index, const CompactSpline& spline,
                     const SplinePlayback& playback);
+  void SetPlaybackRate(const Index index, const float playback_rate);
+  /// Recalculate `shares_x_keys` for `index` and the index after it. Call
+  /// whenever the spline at `index` changes.
+  void UpdateSharedXKeys(const Index index);
 
   // These functions have C and assembly language variants.
-  void UpdateCubicXsAndGetMask(const float delta_x, uint8_t* masks);
-  void UpdateCubicXsAndGetMask_C(const float delta_x, uint8_t* masks);
-  size_t UpdateCubicXs(const float delta_x, Index* indices_to_init);
-  size_t UpdateCubicXs_TwoSteps(const float delta_x, Index* indices_to_init);
-  size_t UpdateCubicXs_OneStep(const float delta_x, Index* indices_to_init);
+  // All operate on the index range [begin, end).
+  void UpdateCubicXsAndGetMask(const float delta_x, const Index begin,
+                               const Index end, uint8_t* masks);
+  void UpdateCubicXsAndGetMask_C(const float delta_x, const Index begin,
+                                 const Index end, uint8_t* masks);
+  /// Write the indices that have passed the ends of their cubics to the
+  /// front of `indices_to_init`, and return how many there are. Write the
+  /// `num_rollovers` indices that will pass them next frame, if it's as long
+  /// as this one, to the back. `indices_to_init` has `end - begin` slots.
+  size_t UpdateCubicXs(const float delta_x, const Index begin,
+                       const Index end, Index* indices_to_init,
+                       size_t* num_rollovers);
+  size_t UpdateCubicXs_TwoSteps(const float delta_x, const Index begin,
+                                const Index end, Index* indices_to_init,
+                                size_t* num_rollovers);
+  size_t UpdateCubicXs_OneStep(const float delta_x, const Index begin,
+                               const Index end, Index* indices_to_init,
+                               size_t* num_rollovers);
+  size_t UpdateFixedXs(const float delta_x, const Index begin,
+                       const Index end, Index* indices_to_init,
+                       size_t* num_rollovers);
+  /// With kFixedPointCoefficients, also sets the fixed-point x from
+  /// `cubic_xs_` and `cubic_x_ends_`, so set those first.
+  void SetCubic(const Index index, const CubicCurve& cubic);
   void EvaluateIndex(const Index index);
-  void EvaluateCubics();
-  void EvaluateCubics_C();
+  void EvaluateCubics(const Index begin, const Index end);
+  void EvaluateCubics_C(const Index begin, const Index end);
+  void EvaluateFixedCubics(const Index begin, const Index end);
+  void NormalizeYs_C(const Index index, const Index count, float* ys) const;
+  void AdvanceIndices(const float delta_x, const Index begin, const Index end);
+  void AdvanceDividedIndices(const float delta_x, const Index begin,
+                             const Index end);
+  void AdvanceMixedIndices(const float delta_x, const Index begin,
+                           const Index end);
+  void AdvanceUndividedIndices(const float delta_x, const Index begin,
+                               const Index end);
+  Index KernelGroupSize() const {
+    return kernels_ == nullptr ? 1 : kernels_->group_size;
+  }
+  bool Divided(const Index index) const {
+    return !sources_[index].update_divisor.EveryFrame();
+  }
+  void CountDividedIndices();
 
   struct Source {
     Source()
-        : rate(1.0f),
-          y_offset(0.0f),
+        : y_offset(0.0f),
           y_scale(1.0f),
           spline(nullptr),
           x_index(kInvalidSplineIndex),
-          repeat(false) {}
+          repeat(false),
+          shares_x_keys(false) {}
 
-    Source(float rate, float y_offset, float y_scale)
-        : rate(rate),
-          y_offset(y_offset),
+    Source(float y_offset, float y_scale)
+        : y_offset(y_offset),
           y_scale(y_scale),
           spline(nullptr),
           x_index(kInvalidSplineIndex),
-          repeat(false) {}
-
-    /// Speed at which time flows, relative to the spline's authored rate.
-    ///     0   ==> paused
-    ///     0.5 ==> half speed (slow motion)
-    ///     1   ==> authored speed
-    ///     2   ==> double speed (fast forward)
-    float rate;
+          repeat(false),
+          shares_x_keys(false) {}
 
     /// Offset that we add to spline to shift it along the y-axis.
     float y_offset;
@@ -355,8 +570,56 @@ class BulkSplineEvaluator {
     /// If true, start again at the beginning of the spline when we reach
     /// the end.
     bool repeat;
+
+    /// If true, `spline` has the same x keys as the spline at the previous
+    /// index. When both indices are at the same x, the segment lookup for the
+    /// previous index holds for this one too. See CompactSpline::SharesXKeys().
+    /// Consecutive channels from CompactSpline::CreateChannels() always do.
+    bool shares_x_keys;
+
+    /// The frames on which this spline is evaluated.
+    MotiveUpdateDivisor update_divisor;
+  };
+
+  /// Optimized variants of UpdateCubicXsAndGetMask_C(), EvaluateCubics_C()
+  /// and NormalizeYs_C() for one instruction set. Chosen once, in
+  /// set_optimization(), so that AdvanceFrame() doesn't re-check the CPU.
+  /// Masks are 0xFF for xs that have passed the ends of their cubics, 0x01
+  /// for xs that will after another step, and 0 otherwise. Functions that
+  /// never write 0x01, such as NEON's, only lose those segments' prefetches.
+  typedef void (*UpdateCubicXsAndGetMaskFn)(const float& delta_x,
+                                            const float* x_ends,
+                                            const float* playback_rates,
+                                            int num_xs, float* xs,
+                                            uint8_t* masks);
+  typedef void (*EvaluateCubicsFn)(const CubicCurve* cubics, const float* xs,
+                                   const void* y_ranges, int num_cubics,
+                                   float* ys);
+  typedef void (*EvaluateSeparateCubicsFn)(const float* const* coefficients,
+                                           const float* xs, int num_cubics,
+                                           float* ys);
+  typedef void (*NormalizeYsFn)(const void* y_ranges, int num_ys, float* ys);
+  struct Kernels {
+    UpdateCubicXsAndGetMaskFn update_cubic_xs_and_get_mask;
+    EvaluateCubicsFn evaluate_cubics;
+
+    /// Same as `evaluate_cubics`, but for kSeparateCoefficients. May be
+    /// nullptr, in which case that layout is evaluated in C++.
+    EvaluateSeparateCubicsFn evaluate_separate_cubics;
+
+    /// Optimized NormalizeYs_C(). May be nullptr, in which case NormalizeYs()
+    /// runs in C++.
+    NormalizeYsFn normalize_ys;
+
+    /// The functions only process whole groups of this many indices, and
+    /// each range must start at a multiple of it. 1 if any range will do.
+    Index group_size;
   };
 
+  /// Return the functions for `optimization`, or nullptr if it has none and
+  /// the plain C++ functions should be called.
+  static const Kernels* KernelsFor(ProcessorOptimization optimization);
+
   struct YRange {
     /// If using modular arithmetic, hold the min and max extents of the
     /// modular range. Modular ranges are used for things like angles,
@@ -368,40 +631,79 @@ class BulkSplineEvaluator {
   // Data is organized in struct-of-arrays format to match the algorithm`s
   // consumption of the data.
   // - The algorithm that updates x values, and detects when we must transition
-  //   to the next segment of the spline looks only at data in `cubic_xs_` and
-  //   `cubic_x_ends_`.
+  //   to the next segment of the spline looks only at data in `cubic_xs_`,
+  //   `cubic_x_ends_`, and `playback_rates_`.
   // - The algorithm that updates `ys_` looks only at the data in `cubic_xs_`,
-  //   `cubics_`, and `y_ranges_`. It writes to `ys_`.
-  // These vectors grow when SetNumIndices() is called, but they never shrink.
-  // So, we`ll have a few reallocs (which are slow) until the highwater mark is
-  // reached. Then the cost of reallocs disappears. In this way we have a
-  // reasonable tradeoff between memory conservation and runtime performance.
+  //   `cubics_` (or `coefficients_`), and `y_ranges_`. It writes to `ys_`.
+  // These vectors grow when SetNumIndices() is called, but only shrink when
+  // ShrinkToFit() is called, which MotiveEngine::Trim() does through the
+  // processors. So, we`ll have a few reallocs (which are slow) until the
+  // highwater mark is reached. Then the cost of reallocs disappears. In this
+  // way we have a reasonable tradeoff between memory conservation and runtime
+  // performance.
 
   /// Source spline nodes and our current index into these splines.
-  std::vector<Source> sources_;
+  MotiveVector<Source> sources_;
 
   /// Define the valid output values. We can clamp to a range, or wrap around to
   /// a range using modular arithmetic (two modes of operation).
-  std::vector<YRange> y_ranges_;
+  MotiveVector<YRange> y_ranges_;
 
   /// The current `x` value at which `cubics_` are evaluated.
   ///   ys_[i] = cubics_[i].Evaluate(cubic_xs_[i])
-  std::vector<float> cubic_xs_;
+  /// With kFixedPointCoefficients, only up to date when the cubic is set.
+  /// `fixed_cubics_` holds the current x.
+  MotiveVector<float> cubic_xs_;
 
   /// The last valid x value in `cubics_`.
-  std::vector<float> cubic_x_ends_;
+  MotiveVector<float> cubic_x_ends_;
+
+  /// Speed at which time flows, relative to the spline's authored rate.
+  ///     0   ==> paused
+  ///     0.5 ==> half speed (slow motion)
+  ///     1   ==> authored speed
+  ///     2   ==> double speed (fast forward)
+  /// Kept out of `sources_` so that the SIMD functions can load it directly.
+  MotiveVector<float> playback_rates_;
 
   /// Currently active segment of sources_.spline.
   /// Instantiated from
   /// sources_[i].spline->CreateInitCubic(sources_[i].x_index).
-  std::vector<CubicCurve> cubics_;
+  /// Only used with kInterleavedCoefficients. Use Cubic() and SetCubic() to
+  /// access the current segment in either layout.
+  MotiveVector<CubicCurve> cubics_;
+
+  /// Same as `cubics_`, but with coefficients_[j][i] = cubics_[i].Coeff(j).
+  /// Only used with kSeparateCoefficients.
+  MotiveVector<float> coefficients_[CubicCurve::kNumCoeff];
+
+  /// Same as `cubics_`, with the current x, in fixed-point.
+  /// Only used with kFixedPointCoefficients.
+  MotiveVector<FixedCubic> fixed_cubics_;
+
+  /// `playback_rates_` in the fixed-point format of FixedCubic::Advance().
+  /// Only used with kFixedPointCoefficients.
+  MotiveVector<int32_t> fixed_playback_rates_;
 
   /// Value of the spline at `cubic_xs_`, normalized and clamped to be within
   /// `y_ranges_`. Evaluated in AdvanceFrame.
-  std::vector<float> ys_;
+  MotiveVector<float> ys_;
+
+  /// Stratch buffer used for internal calculations. Each shard in
+  /// AdvanceFrameShards() uses only the slots of its own indices.
+  MotiveVector<Index> scratch_;
+
+  /// Frame number that update divisors are tested against.
+  uint32_t frame_;
 
-  /// Stratch buffer used for internal calculations.
-  std::vector<Index> scratch_;
+  /// Indices at or above this are not advanced. Negative for every index.
+  /// See SetNumActiveIndices().
+  Index num_active_indices_;
+
+  /// Number of indices with update divisors in each shard, and in total.
+  /// Shards without any are evaluated in bulk.
+  MotiveVector<Index> divided_counts_;
+  Index num_divided_;
 
   /// Call the specified optimized functions, when available, instead of the
   /// plain C++ functions. Note that we must perform this check at runtime,
@@ -411,6 +713,13 @@ class BulkSplineEvaluator {
   /// support neither. Therefore, x86 code always includes the C++ functions as
   /// a fallback, and chooses the best functions at runtime.
   ProcessorOptimization optimization_;
+
+  /// Functions for `optimization_`, or nullptr to call the C++ functions.
+  const Kernels* kernels_;
+
+  /// Whether `cubics_`, `coefficients_` or `fixed_cubics_` holds the current
+  /// cubics.
+  CoefficientLayout coefficient_layout_;
 };
 
 }  // namespace motive
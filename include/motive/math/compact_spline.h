@@ -18,10 +18,13 @@
 #include "motive/common.h"
 #include "motive/math/compact_spline_node.h"
 #include "motive/math/curve.h"
+#include "motive/util/allocator.h"
+#include "motive/util/memory_stats.h"
 
 namespace motive {
 
 class BulkSplineEvaluator;
+class MotiveTaskScheduler;
 
 /// @typedef CompactSplineIndex
 /// Index into the spline. Some high values have special meaning (see below).
@@ -79,17 +82,34 @@ class CompactSpline {
   static const CompactSplineIndex kDefaultMaxNodes = 7;
 
   CompactSpline()
-      : x_granularity_(0.0f), num_nodes_(0), max_nodes_(kDefaultMaxNodes) {}
+      : x_granularity_(0.0f),
+        num_nodes_(0),
+        max_nodes_(kDefaultMaxNodes),
+        uniform_x_step_(0),
+        channel_(0),
+        num_channels_(0),
+        external_(nullptr) {}
   CompactSpline(const Range& y_range, const float x_granularity)
       : max_nodes_(kDefaultMaxNodes) {
     Init(y_range, x_granularity);
   }
+  /// Copies the nodes of `rhs`, even if `rhs` is a view or a channel.
   CompactSpline& operator=(const CompactSpline& rhs) {
     assert(rhs.num_nodes_ <= max_nodes_);
     y_range_ = rhs.y_range_;
     x_granularity_ = rhs.x_granularity_;
     num_nodes_ = rhs.num_nodes_;
-    memcpy(nodes_, rhs.nodes_, rhs.num_nodes_ * sizeof(nodes_[0]));
+    uniform_x_step_ = rhs.uniform_x_step_;
+    channel_ = 0;
+    num_channels_ = 0;
+    external_ = nullptr;
+    if (rhs.IsChannel()) {
+      for (CompactSplineIndex i = 0; i < rhs.num_nodes_; ++i) {
+        nodes_[i] = rhs.Node(i);
+      }
+    } else {
+      memcpy(nodes_, rhs.Nodes(), rhs.num_nodes_ * sizeof(nodes_[0]));
+    }
     return *this;
   }
 
@@ -113,6 +133,10 @@ class CompactSpline {
   ///                      an x_granularity of 0.5 or 1 is probably best.
   void Init(const Range& y_range, const float x_granularity) {
     num_nodes_ = 0;
+    uniform_x_step_ = 0;
+    channel_ = 0;
+    num_channels_ = 0;
+    external_ = nullptr;
     y_range_ = y_range;
     x_granularity_ = x_granularity;
   }
@@ -154,6 +178,19 @@ class CompactSpline {
     AddNodeVerbatim(detail::CompactSplineNode(x, y, angle));
   }
 
+  /// Replace the y and derivative of the node at `index`, keeping its x.
+  /// Evaluators that are part way through a segment that ends at the node
+  /// keep the old curve until they enter another segment. See RingSpline.
+  ///
+  /// @param y Must be within the `y_range` specified in Init().
+  void SetNode(const CompactSplineIndex index, const float y,
+               const float derivative)
+      MOTIVE_NO_SANITIZE("bounds") /* nodes_ has variable size */ {
+    assert(!IsView() && index < num_nodes_);
+    nodes_[index].SetY(y, y_range_);
+    nodes_[index].SetDerivative(derivative);
+  }
+
   /// Compress `nodes` and append them to the spline.
   ///
   /// @param nodes An array of uncompressed nodes.
@@ -198,7 +235,10 @@ class CompactSpline {
   }
 
   /// Remove all nodes from the spline.
-  void Clear() { num_nodes_ = 0; }
+  void Clear() {
+    num_nodes_ = 0;
+    uniform_x_step_ = 0;
+  }
 
   /// Returns the memory occupied by this spline.
   size_t Size() const { return Size(max_nodes_); }
@@ -233,6 +273,8 @@ class CompactSpline {
   ///                    Often the caller will be traversing from low to high x,
   ///                    so a good guess is the index after the current index.
   ///                    If you have no idea, set to 0.
+  ///                    Ignored if HasUniformX(), since the index can be
+  ///                    calculated directly.
   CompactSplineIndex IndexForX(const float x,
                                const CompactSplineIndex guess_index) const;
 
@@ -251,7 +293,7 @@ class CompactSpline {
   // First and last x, y, and derivatives in the spline.
   float StartX() const { return Front().X(x_granularity_); }
   float StartY() const { return Front().Y(y_range_); }
-  float StartDerivative() const { return nodes_[0].Derivative(); }
+  float StartDerivative() const { return Front().Derivative(); }
 
   float EndX() const { return Back().X(x_granularity_); }
   float EndY() const { return Back().Y(y_range_); }
@@ -260,7 +302,7 @@ class CompactSpline {
   float NodeY(const CompactSplineIndex index) const;
   float NodeDerivative(const CompactSplineIndex index) const {
     assert(index < num_nodes_);
-    return nodes_[index].Derivative();
+    return Node(index).Derivative();
   }
   float LengthX() const { return EndX() - StartX(); }
   Range RangeX() const { return Range(StartX(), EndX()); }
@@ -268,7 +310,8 @@ class CompactSpline {
 
   /// Calls CalculatedSlowly at `x`, with `kCurveValue` to evaluate the y value.
   /// If calling from inside a loop, replace the loop with one call to Ys(),
-  /// which is significantly faster.
+  /// which is significantly faster. If the x values aren't evenly spaced,
+  /// but are mostly increasing or close together, use a CompactSplineCursor.
   float YCalculatedSlowly(const float x) const {
     return CalculatedSlowly(x, kCurveValue);
   }
@@ -308,18 +351,40 @@ class CompactSpline {
   CompactSplineIndex num_nodes() const { return num_nodes_; }
   CompactSplineIndex max_nodes() const { return max_nodes_; }
 
+  /// Returns true if the nodes are read from external memory, instead of
+  /// being held by this class. See CreateView().
+  bool IsView() const { return external_ != nullptr; }
+
+  /// Returns true if this spline is one channel of a set created by
+  /// CreateChannels(). Channels are views that share their x keys.
+  bool IsChannel() const { return num_channels_ != 0; }
+
+  /// Returns true if the nodes are evenly spaced along the x-axis. Splines
+  /// sampled at a fixed rate, like those from the anim pipeline, usually are.
+  /// IndexForX() takes constant time on these splines.
+  bool HasUniformX() const { return uniform_x_step_ != 0; }
+
+  /// Returns true if `rhs` has nodes at exactly the same x values. Splines
+  /// with the same x keys, like the x, y, and z channels of a translation,
+  /// always change segments together. Takes constant time for channels
+  /// created together by CreateChannels().
+  bool SharesXKeys(const CompactSpline& rhs) const;
+
   /// Return const versions of internal values. For serialization.
-  const detail::CompactSplineNode* nodes() const { return nodes_; }
+  /// Channels have no array of whole nodes, so nodes() is null for them.
+  const detail::CompactSplineNode* nodes() const { return Nodes(); }
   const Range& y_range() const { return y_range_; }
   float x_granularity() const { return x_granularity_; }
 
-  /// Allocate memory for a spline using global `new`.
+  /// Allocate memory for a spline using global `new`, or `allocator` when
+  /// it's specified. Pass the same `allocator` to Destroy().
   /// @param max_nodes The maximum number of nodes that this spline class
   ///                  can hold. Memory is allocated so that these nodes are
   ///                  held contiguously in memory with the rest of the
   ///                  class.
-  static CompactSpline* Create(CompactSplineIndex max_nodes) {
-    uint8_t* buffer = new uint8_t[Size(max_nodes)];
+  static CompactSpline* Create(CompactSplineIndex max_nodes,
+                               MotiveAllocator* allocator = nullptr) {
+    void* buffer = AllocateBuffer(Size(max_nodes), allocator);
     return CreateInPlace(max_nodes, buffer);
   }
 
@@ -334,14 +399,45 @@ class CompactSpline {
     return spline;
   }
 
+  /// Allocate memory using global `new` for a spline that reads its nodes
+  /// directly from `nodes`, instead of copying them. Useful for pointing at
+  /// node data inside a loaded FlatBuffer.
+  ///
+  /// The returned spline cannot have nodes added to it, and you must stop
+  /// referencing it once the memory behind `nodes` disappears. Destroy it
+  /// with Destroy(), as usual. Only the small header is allocated.
+  /// @param nodes Quantized nodes, in the same format as returned by nodes().
+  /// @param num_nodes Length of the `nodes` array.
+  static CompactSpline* CreateView(const Range& y_range,
+                                   const float x_granularity,
+                                   const detail::CompactSplineNode* nodes,
+                                   CompactSplineIndex num_nodes,
+                                   MotiveAllocator* allocator = nullptr) {
+    void* buffer = AllocateBuffer(Size(0), allocator);
+    return CreateViewInPlace(y_range, x_granularity, nodes, num_nodes, buffer);
+  }
+
+  /// Same as CreateView(), but in the memory provided by `buffer`.
+  /// @param buffer chunk of memory of size CompactSpline::Size(0).
+  static CompactSpline* CreateViewInPlace(
+      const Range& y_range, const float x_granularity,
+      const detail::CompactSplineNode* nodes, CompactSplineIndex num_nodes,
+      void* buffer) {
+    CompactSpline* spline = CreateInPlace(0, buffer);
+    spline->InitView(y_range, x_granularity, nodes, num_nodes);
+    return spline;
+  }
+
   /// Allocate memory using global `new`, and initialize it with `nodes`.
   /// @param nodes An array holding the curve, in uncompressed floats.
   /// @param num_nodes The length of the `nodes` array, and max nodes in the
   ///                  returned spline.
   static CompactSpline* CreateFromNodes(const UncompressedNode* nodes,
-                                        size_t num_nodes) {
+                                        size_t num_nodes,
+                                        MotiveAllocator* allocator = nullptr) {
     assert(num_nodes <= kMaxSplineIndex);
-    CompactSpline* spline = Create(static_cast<CompactSplineIndex>(num_nodes));
+    CompactSpline* spline =
+        Create(static_cast<CompactSplineIndex>(num_nodes), allocator);
     spline->InitFromNodes(nodes, num_nodes);
     return spline;
   }
@@ -371,9 +467,11 @@ class CompactSpline {
   /// @param num_nodes The number of uniform x-intervals in the returned spline.
   ///                  Also the max_nodes of the returned spline.
   static CompactSpline* CreateFromSpline(const CompactSpline& source_spline,
-                                         size_t num_nodes) {
+                                         size_t num_nodes,
+                                         MotiveAllocator* allocator = nullptr) {
     assert(num_nodes <= kMaxSplineIndex);
-    CompactSpline* spline = Create(static_cast<CompactSplineIndex>(num_nodes));
+    CompactSpline* spline =
+        Create(static_cast<CompactSplineIndex>(num_nodes), allocator);
     spline->InitFromSpline(source_spline);
     return spline;
   }
@@ -395,13 +493,16 @@ class CompactSpline {
     return spline;
   }
 
-  /// Deallocate the splines memory using global `delete`.
+  /// Deallocate the splines memory using global `delete`, or `allocator`
+  /// when it's specified.
   /// Be sure to call this for every spline returned from @ref Create(),
-  /// @ref CreateFromNodes(), @ref CreateFromSpline().
-  static void Destroy(CompactSpline* spline) {
+  /// @ref CreateFromNodes(), @ref CreateFromSpline(), with the same
+  /// `allocator` that created it.
+  static void Destroy(CompactSpline* spline,
+                      MotiveAllocator* allocator = nullptr) {
     if (spline == nullptr) return;
     // By design, spline does not have a destructor.
-    delete[] reinterpret_cast<uint8_t*>(spline);
+    FreeBuffer(spline, allocator);
   }
 
   /// Allocate an array of splines, contiguous in memory, each of which can
@@ -412,8 +513,9 @@ class CompactSpline {
   /// to MotivatorNf::SetSplines(), for example Motivator3f::SetSplines() takes
   /// an array of three splines, like this function returns.
   static CompactSpline* CreateArray(CompactSplineIndex max_nodes,
-                                    int num_splines) {
-    uint8_t* buffer = new uint8_t[Size(max_nodes) * num_splines];
+                                    int num_splines,
+                                    MotiveAllocator* allocator = nullptr) {
+    void* buffer = AllocateBuffer(Size(max_nodes) * num_splines, allocator);
     return CreateArrayInPlace(max_nodes, num_splines, buffer);
   }
 
@@ -437,11 +539,53 @@ class CompactSpline {
     return reinterpret_cast<CompactSpline*>(buffer);
   }
 
-  /// Frees the memory allocated with CreateArray() using global `delete`.
-  static void DestroyArray(CompactSpline* splines, int /*num_splines*/) {
+  /// Allocate `num_splines` channels, contiguous in memory, that hold the
+  /// curves of `splines` packed together. The splines must share their x
+  /// keys (see SharesXKeys()), as the x, y, and z of a translation usually
+  /// do. Returns nullptr if they don't.
+  ///
+  /// The x keys are held once, for all channels, followed by the y and
+  /// derivative of every channel at each key. Each node then takes
+  /// 2 + 4 * num_splines bytes, instead of 6 * num_splines, and the
+  /// channels change segments together. BulkSplineEvaluator looks up the
+  /// segment once for all channels at consecutive indices.
+  ///
+  /// The channels are views, so nodes can't be added to them. Access the
+  /// next channel with Next(), and pass the first to, for example,
+  /// Motivator3f::SetSplines(). Free with DestroyArray().
+  static CompactSpline* CreateChannels(const CompactSpline* const* splines,
+                                       int num_splines,
+                                       MotiveAllocator* allocator = nullptr) {
+    if (!CanCreateChannels(splines, num_splines)) return nullptr;
+    void* buffer = AllocateBuffer(
+        ChannelsSize(num_splines, splines[0]->num_nodes()), allocator);
+    return CreateChannelsInPlace(splines, num_splines, buffer);
+  }
+
+  /// Same as CreateChannels(), but in the memory provided by `buffer`.
+  /// @param buffer chunk of memory of size
+  ///               CompactSpline::ChannelsSize(num_splines, num_nodes)
+  static CompactSpline* CreateChannelsInPlace(
+      const CompactSpline* const* splines, int num_splines, void* buffer);
+
+  /// Returns the size, in bytes, of `num_splines` channels of `num_nodes`
+  /// nodes each, as created by CreateChannels().
+  static size_t ChannelsSize(int num_splines, CompactSplineIndex num_nodes) {
+    return num_splines * Size(0) + num_nodes * sizeof(CompactSplineXGrain) +
+           num_splines * num_nodes * sizeof(detail::CompactSplineChannelNode);
+  }
+
+  /// Returns true if `splines` can be packed by CreateChannels().
+  static bool CanCreateChannels(const CompactSpline* const* splines,
+                                int num_splines);
+
+  /// Frees the memory allocated with CreateArray() or CreateChannels() using
+  /// global `delete`, or the `allocator` that was passed to it.
+  static void DestroyArray(CompactSpline* splines, int /*num_splines*/,
+                           MotiveAllocator* allocator = nullptr) {
     if (splines == nullptr) return;
     // By design, spline does not have a destructor.
-    delete[] reinterpret_cast<uint8_t*>(splines);
+    FreeBuffer(splines, allocator);
   }
 
   /// Returns the size, in bytes, of a CompactSpline class with `max_nodes`
@@ -461,6 +605,10 @@ class CompactSpline {
     return aligned;
   }
 
+  /// Add the memory held by this spline to `stats`. The spline is assumed to
+  /// have been allocated with Size(max_nodes()) bytes.
+  void AddMemoryStats(MemoryStats* stats) const;
+
   /// Returns the size, in bytes, of an array of CompactSplines (as allocated
   /// with CreateArray(), say).
   ///
@@ -522,17 +670,110 @@ class CompactSpline {
            reinterpret_cast<float*>(ys));
   }
 
+  /// Evaluate many splines over a uniform grid, for example to bake
+  /// animation textures. Each spline is evaluated at start_x + n * delta_x,
+  /// for n = 0..num_points-1. Unlike BulkYs(), each spline walks forward
+  /// through its segments, so only the first point is searched for, and the
+  /// splines are spread across the threads of `scheduler`.
+  /// Before the start of a spline, its start y is held, and after the end,
+  /// its end y, with a derivative of 0.
+  /// @param splines Array of `num_splines` pointers to the splines.
+  /// @param delta_x Increment for each point. Must not be negative.
+  /// @param ys Two dimensional output array, ys[num_splines][num_points].
+  ///           Unlike BulkYs(), the points of a spline are contiguous.
+  /// @param derivatives Output array with the same indexing as `ys`, or
+  ///                    nullptr.
+  /// @param scheduler Evaluates the splines in parallel, if not nullptr.
+  static void BakeYs(const CompactSpline* const* splines, size_t num_splines,
+                     float start_x, float delta_x, size_t num_points,
+                     float* ys, float* derivatives = nullptr,
+                     MotiveTaskScheduler* scheduler = nullptr);
+
  private:
   static const size_t kBaseSize;
 
+  /// BakeYs() for this spline alone.
+  void BakeYs(float start_x, float delta_x, size_t num_points, float* ys,
+              float* derivatives) const;
+
   CompactSpline(const CompactSpline& rhs) : max_nodes_(rhs.max_nodes_) {
     *this = rhs;
   }
 
+  /// Memory for Create() and friends. Global `new` when `allocator` is null.
+  static void* AllocateBuffer(size_t size, MotiveAllocator* allocator) {
+    return allocator == nullptr
+               ? new uint8_t[size]
+               : allocator->Allocate(size,
+                                     std::alignment_of<CompactSpline>::value);
+  }
+
+  /// Release memory returned by AllocateBuffer() with the same `allocator`.
+  static void FreeBuffer(void* buffer, MotiveAllocator* allocator) {
+    if (allocator == nullptr) {
+      delete[] static_cast<uint8_t*>(buffer);
+    } else {
+      allocator->Free(buffer);
+    }
+  }
+
+  /// Point at `nodes` instead of holding nodes internally.
+  void InitView(const Range& y_range, const float x_granularity,
+                const detail::CompactSplineNode* nodes,
+                CompactSplineIndex num_nodes);
+
+  /// The nodes, wherever they're held, or null for channels, whose nodes
+  /// are split up. Reads of single nodes should go through Node().
+  const detail::CompactSplineNode* Nodes() const {
+    if (IsChannel()) return nullptr;
+    return external_ == nullptr
+               ? nodes_
+               : static_cast<const detail::CompactSplineNode*>(external_);
+  }
+
+  /// The x keys that all channels share. Only valid for channels.
+  const CompactSplineXGrain* ChannelXs() const {
+    assert(IsChannel());
+    return static_cast<const CompactSplineXGrain*>(external_);
+  }
+
+  /// The y and angle of this channel at the first x key. Those at later
+  /// keys are `num_channels_` apart. Only valid for channels.
+  const detail::CompactSplineChannelNode* ChannelNodes() const {
+    return reinterpret_cast<const detail::CompactSplineChannelNode*>(
+               ChannelXs() + num_nodes_) +
+           channel_;
+  }
+
+  /// The node at `index`, wherever it's held.
+  detail::CompactSplineNode Node(const CompactSplineIndex index) const
+      MOTIVE_NO_SANITIZE("bounds") /* nodes_ has variable size */ {
+    assert(index < num_nodes_);
+    if (!IsChannel()) return Nodes()[index];
+    const detail::CompactSplineChannelNode& n =
+        ChannelNodes()[index * num_channels_];
+    return detail::CompactSplineNode(ChannelXs()[index], n.y, n.angle);
+  }
+
+  /// The quantized x of the node at `index`, wherever it's held.
+  CompactSplineXGrain QuantizedX(const CompactSplineIndex index) const
+      MOTIVE_NO_SANITIZE("bounds") /* nodes_ has variable size */ {
+    assert(index < num_nodes_);
+    return IsChannel() ? ChannelXs()[index] : Nodes()[index].x();
+  }
+
   /// All other AddNode() functions end up calling this one.
   void AddNodeVerbatim(const detail::CompactSplineNode& node)
       MOTIVE_NO_SANITIZE("bounds") /* nodes_ has variable size */ {
+    assert(!IsView());
     assert(num_nodes_ < max_nodes_);
+
+    // Track whether every node so far is the same distance from the last.
+    if (num_nodes_ == 1) {
+      uniform_x_step_ = node.x() - Back().x();
+    } else if (num_nodes_ > 1 && node.x() - Back().x() != uniform_x_step_) {
+      uniform_x_step_ = 0;
+    }
     nodes_[num_nodes_++] = node;
   }
 
@@ -554,15 +795,14 @@ class CompactSpline {
   CubicInit CreateCubicInit(const detail::CompactSplineNode& s,
                             const detail::CompactSplineNode& e) const;
 
-  const detail::CompactSplineNode& Front() const {
+  detail::CompactSplineNode Front() const {
     assert(num_nodes_ > 0);
-    return nodes_[0];
+    return Node(0);
   }
 
-  const detail::CompactSplineNode& Back() const
-      MOTIVE_NO_SANITIZE("bounds") /* nodes_ has variable size */ {
+  detail::CompactSplineNode Back() const {
     assert(num_nodes_ > 0);
-    return nodes_[num_nodes_ - 1];
+    return Node(num_nodes_ - 1);
   }
 
   /// Extreme values for y. See comments on Init() for details.
@@ -578,6 +818,23 @@ class CompactSpline {
   /// `kDefaultMaxNodes` if CreateInPlace() was called.
   CompactSplineIndex max_nodes_;
 
+  /// Distance, in units of `x_granularity_`, between every pair of adjacent
+  /// nodes, or 0 if the nodes are not evenly spaced. When non-zero, the
+  /// segment that contains an x can be computed directly, instead of being
+  /// searched for.
+  CompactSplineXGrain uniform_x_step_;
+
+  /// For channels, the index of this channel, and the number of channels
+  /// whose nodes are interleaved with ours. `num_channels_` is 0 for
+  /// splines that aren't channels. See CreateChannels().
+  uint8_t channel_;
+  uint8_t num_channels_;
+
+  /// If non-null, the nodes are held in external memory, and `nodes_` is
+  /// unused. Points at the shared x keys for channels, and at an array of
+  /// CompactSplineNodes for other views. See CreateView().
+  const void* external_;
+
   /// Array of key points (x, y, derivative) that describe the curve.
   /// The curve is interpolated smoothly between these key points.
   /// Key points are stored in quantized form, and converted back to world
@@ -588,6 +845,62 @@ class CompactSpline {
   detail::CompactSplineNode nodes_[kDefaultMaxNodes];
 };
 
+/// @class CompactSplineCursor
+/// @brief Evaluate a spline at arbitrary x values, remembering the segment
+///        of the last evaluation.
+///
+/// CompactSpline::CalculatedSlowly() searches for the segment and rebuilds its
+/// cubic on every call. A cursor keeps the cubic of the last segment, so
+/// queries in that segment or an adjacent one, as when following a camera
+/// rail, take constant time. Queries further away fall back to a search.
+class CompactSplineCursor {
+ public:
+  explicit CompactSplineCursor(const CompactSpline* spline = nullptr) {
+    set_spline(spline);
+  }
+
+  /// Evaluate a different spline. The next query searches for its segment.
+  void set_spline(const CompactSpline* spline) {
+    spline_ = spline;
+    index_ = kInvalidSplineIndex;
+  }
+  const CompactSpline* spline() const { return spline_; }
+
+  /// Same as CompactSpline::YCalculatedSlowly(), but usually without the
+  /// search or the cubic rebuild.
+  float Y(float x) { return Calculated(x, kCurveValue); }
+
+  /// Same as CompactSpline::CalculatedSlowly(), but usually without the
+  /// search or the cubic rebuild.
+  float Calculated(float x, CurveValueType value_type);
+
+  /// Same as CompactSpline::Ys(), but evaluates each point with Calculated(),
+  /// so `delta_x` may be negative.
+  void Ys(float start_x, float delta_x, size_t num_points, float* ys,
+          float* derivatives = nullptr);
+
+  /// The segment of the last query. kInvalidSplineIndex before the first
+  /// query, and kBeforeSplineIndex or kAfterSplineIndex outside the spline.
+  CompactSplineIndex index() const { return index_; }
+
+ private:
+  /// Return true if `x` is in the segment of the last query.
+  bool SegmentContainsX(float x) const;
+
+  /// Find the segment of `x`, and build its cubic.
+  void Seek(float x);
+
+  const CompactSpline* spline_;
+
+  /// The segment of the last query, and the x values it covers.
+  CompactSplineIndex index_;
+  float start_x_;
+  float end_x_;
+
+  /// The curve of segment `index_`, starting at `start_x_`.
+  CubicCurve cubic_;
+};
+
 /// @class SplinePlayback
 /// @brief Parameters to specify how a spline should be traversed.
 struct SplinePlayback {
@@ -162,6 +162,13 @@ class CompactSplineNode {
   CompactSplineAngle angle_;
 };
 
+// The y and angle of a node whose x is held elsewhere, so that it can be
+// shared with other channels. See CompactSpline::CreateChannels().
+struct CompactSplineChannelNode {
+  CompactSplineYRung y;
+  CompactSplineAngle angle;
+};
+
 }  // namespace detail
 }  // namespace motive
 
@@ -0,0 +1,93 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_MATH_COMPACT_SPLINE_PACKING_H_
+#define MOTIVE_MATH_COMPACT_SPLINE_PACKING_H_
+
+#include "motive/math/compact_spline.h"
+
+namespace motive {
+
+/// @class CompactSplinePacking
+/// @brief Bit widths for a variable bit-rate encoding of CompactSpline nodes.
+///
+/// Each node of a CompactSpline holds three 16-bit values: x grain, y rung,
+/// and derivative angle. Many channels need far less precision than that, so
+/// for storage the nodes can be packed into a bit stream with a narrower
+/// width for each field.
+///
+/// - x is stored as the difference from the previous node's x, with just
+///   enough bits for the largest difference. It is lossless.
+/// - y and the derivative angle are requantized to `y_bits` and `angle_bits`.
+///   Use ForTolerance() to choose the narrowest widths that stay within an
+///   error bound.
+///
+/// The bit stream is expanded back into regular nodes by
+/// UnpackCompactSplineNodes(), so evaluation is unchanged. Packing shrinks
+/// files and downloads, not memory: loaded splines hold full-size nodes.
+struct CompactSplinePacking {
+  /// Bits for a full CompactSplineNode field. Packing with these widths is
+  /// lossless.
+  static const int kMaxBits = 16;
+
+  CompactSplinePacking()
+      : x_bits(kMaxBits), y_bits(kMaxBits), angle_bits(kMaxBits) {}
+  CompactSplinePacking(int x_bits, int y_bits, int angle_bits)
+      : x_bits(x_bits), y_bits(y_bits), angle_bits(angle_bits) {}
+
+  /// Return the narrowest packing for which every unpacked y value, and the
+  /// curve between nodes, is within `y_tolerance` of `spline`. Half the
+  /// tolerance goes to the y values and half to the derivatives.
+  static CompactSplinePacking ForTolerance(const CompactSpline& spline,
+                                           float y_tolerance);
+
+  /// Bits used to encode one node.
+  int BitsPerNode() const { return x_bits + y_bits + angle_bits; }
+
+  /// Bytes needed to hold `num_nodes` packed nodes.
+  size_t PackedSize(size_t num_nodes) const {
+    return (num_nodes * BitsPerNode() + 7) / 8;
+  }
+
+  /// True if every width is between 1 and kMaxBits.
+  bool Valid() const {
+    return 1 <= x_bits && x_bits <= kMaxBits && 1 <= y_bits &&
+           y_bits <= kMaxBits && 1 <= angle_bits && angle_bits <= kMaxBits;
+  }
+
+  int x_bits;
+  int y_bits;
+  int angle_bits;
+};
+
+/// Write the nodes of `spline` into `bits`, which must have room for
+/// `packing.PackedSize(spline.num_nodes())` bytes. `packing` must hold every
+/// x difference in `spline`, as chosen by CompactSplinePacking::ForTolerance().
+void PackCompactSplineNodes(const CompactSpline& spline,
+                            const CompactSplinePacking& packing,
+                            uint8_t* bits);
+
+/// Append `num_nodes` nodes decoded from `bits` to `spline`. `spline` must
+/// already be initialized with the y range and x granularity it was packed
+/// with. Returns false, and leaves `spline` unchanged, if `packing` is
+/// invalid, if the `num_bytes` bytes of `bits` hold fewer than `num_nodes`
+/// nodes, or if `spline` doesn't have room for them.
+bool UnpackCompactSplineNodes(const uint8_t* bits, size_t num_bytes,
+                              CompactSplineIndex num_nodes,
+                              const CompactSplinePacking& packing,
+                              CompactSpline* spline);
+
+}  // namespace motive
+
+#endif  // MOTIVE_MATH_COMPACT_SPLINE_PACKING_H_
@@ -449,6 +449,17 @@ class CubicCurve {
   float c_[kNumCoeff];  /// c_[3] * x^3  +  c_[2] * x^2  +  c_[1] * x  +  c_[0]
 };
 
+/// Same as CubicCurve::Init(), for `count` cubics at once, in
+/// struct-of-arrays form. Cubic i runs from (0, `start_y[i]`), with slope
+/// `start_derivative[i]`, to (`width_x[i]`, `end_y[i]`), with slope
+/// `end_derivative[i]`. Its coefficient j is written to `coefficients[j][i]`.
+/// The loop has no branches, so that the compiler can vectorize it, and it
+/// gives exactly the same coefficients as CubicCurve::Init().
+void InitCubicCoefficients(const float* start_y, const float* start_derivative,
+                           const float* end_y, const float* end_derivative,
+                           const float* width_x, size_t count,
+                           float* const* coefficients);
+
 /// Draw an ASCII-art graph of the array of (x,y) 'points'.
 /// The size of the graph in (horizontal characters, vertical lines) is given
 /// by 'size'.
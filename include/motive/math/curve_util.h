@@ -559,6 +559,18 @@ class QuadraticSpring {
   /// @returns The value about which we're oscillating.
   float target() const { return target_; }
 
+  /// @brief Get the x, relative to the peak of `c`, at which to evaluate the
+  ///        quadratic described by `c`.
+  ///
+  /// The value at `external_x` is `target() + c.peak + c.coeff * q * q`, and
+  /// the derivative is `2 * c.coeff * q`, where `q` is the returned value.
+  /// This is the same arithmetic as @ref EvaluateWithContext and
+  /// @ref DerivativeWithContext, exposed so that many springs can be
+  /// evaluated at once.
+  float QuadraticX(float external_x, const Context& c) const {
+    return ToInternalX(external_x) - c.peak_x;
+  }
+
  private:
   bool ValidX(float external_x, const Context& c) const {
     const float kErrorToleranceForX = 0.01f;
@@ -568,9 +580,6 @@ class QuadraticSpring {
   void IncrementContextInternal(float x, Context* c) const;
   float ToInternalX(float external_x) const { return external_x + start_x_; }
   float ToExternalX(float internal_x) const { return internal_x - start_x_; }
-  float QuadraticX(float external_x, const Context& c) const {
-    return ToInternalX(external_x) - c.peak_x;
-  }
 
   // Quadratic coefficient when moving away from the target value (i.e. when
   // spring is slowing down). Note that coefficient when moving towards target
@@ -0,0 +1,159 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_MATH_FIXED_CUBIC_H_
+#define MOTIVE_MATH_FIXED_CUBIC_H_
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "motive/math/curve.h"
+#include "motive/math/float.h"
+
+namespace motive {
+
+/// @class FixedCubic
+/// @brief A CubicCurve, and a position `x` along it, in fixed-point.
+///
+/// Advancing x and evaluating the curve use only integer arithmetic, so they
+/// are fast on processors without a fast FPU, and give the same results on
+/// every platform.
+///
+/// The curve is stored over t = x / 2^x_shift, where 2^x_shift is the
+/// smallest power of two wider than the curve, so that t is in [0, 1] over
+/// the curve. t is held with kTBits fractional bits. The coefficients of
+///   y = c[3] * t^3  +  c[2] * t^2  +  c[1] * t  +  c[0]
+/// are held in units of 2^-y_shift, where y_shift is chosen per curve so that
+/// every |c[k]| < 2^kCoefficientBits. Evaluating is then three integer
+/// multiply-adds that can't overflow.
+///
+/// Error bounds, against evaluating the original CubicCurve exactly:
+///   - EvaluateFixed() rounds each coefficient, and each of its three
+///     products, to the nearest unit. Since |t| <= 1, it is within 3.5 units
+///     of 2^-y_shift. A unit is at most 2^-27 of the largest coefficient,
+///     M = max |cubic.Coeff(k) * 2^(k * x_shift)|, so the error is below
+///     2^-25 M. Evaluate() then rounds to float, like any float result.
+///     Evaluating the CubicCurve in float at the same x rounds each of its
+///     six operations, erring by up to about 2^-22 M.
+///   - Advance() rounds `delta_x` and `playback_rate` to kDeltaXBits and
+///     kPlaybackRateBits fractional bits, and the step to a unit of t. Each
+///     frame, x gains at most (|delta_x| + |playback_rate|) * 2^-25 plus
+///     2^(x_shift - 30) of error. Unlike float, the error doesn't grow as x
+///     grows, since every step is added exactly.
+///   - Curves wider than 2^kMaxXShift, like the constant curves of cleared
+///     splines, are held at x_shift = kMaxXShift, and evaluated at t <= 1.
+///   - |delta_x * playback_rate| must stay below 2^15 each frame.
+class FixedCubic {
+ public:
+  /// Fractional bits of t. t = 1 is 2^kTBits.
+  static const int kTBits = 30;
+
+  /// Every coefficient is less than 2^kCoefficientBits in magnitude, so the
+  /// sum of four fits in an int32_t.
+  static const int kCoefficientBits = 28;
+
+  /// Fractional bits of the fixed-point `delta_x` and `playback_rate` passed
+  /// to Advance().
+  static const int kDeltaXBits = 24;
+  static const int kPlaybackRateBits = 24;
+
+  /// Limits of x_shift. Curves narrower than 2^kMinXShift are held at
+  /// kMinXShift, which only costs precision in t.
+  static const int kMinXShift = -10;
+  static const int kMaxXShift = 30;
+
+  FixedCubic() : t_(0), t_end_(0), x_shift_(0), y_unit_(1.0f) {
+    std::fill(c_, c_ + CubicCurve::kNumCoeff, 0);
+  }
+
+  /// Quantize `cubic`, which is valid over [0, `width_x`], and start at `x`.
+  void Init(const CubicCurve& cubic, float x, float width_x);
+
+  /// Convert `delta_x` to the fixed-point format of Advance().
+  /// Call once per frame, not once per curve.
+  static int64_t DeltaX(float delta_x) {
+    return static_cast<int64_t>(
+        std::floor(static_cast<double>(delta_x) * (1 << kDeltaXBits) + 0.5));
+  }
+
+  /// Convert `playback_rate` to the fixed-point format of Advance().
+  static int32_t PlaybackRate(float playback_rate) {
+    return static_cast<int32_t>(std::floor(
+        static_cast<double>(playback_rate) * (1 << kPlaybackRateBits) + 0.5));
+  }
+
+  /// Move x forward by `delta_x * playback_rate`, both of which come from
+  /// DeltaX() and PlaybackRate(). Return true if x has passed the end of the
+  /// curve.
+  bool Advance(int64_t delta_x, int32_t playback_rate) {
+    const int kStepShift = kDeltaXBits + kPlaybackRateBits - kTBits;
+    const int64_t step = (delta_x * playback_rate) >> (kStepShift + x_shift_);
+    const int64_t t = std::max<int64_t>(
+        std::numeric_limits<int32_t>::min(),
+        std::min<int64_t>(t_ + step, std::numeric_limits<int32_t>::max()));
+    t_ = static_cast<int32_t>(t);
+    return t_ > t_end_;
+  }
+
+  /// Evaluate the curve at the current x, in units of 2^-y_shift.
+  int32_t EvaluateFixed() const {
+    const int64_t kOne = int64_t(1) << kTBits;
+    const int64_t kHalf = kOne >> 1;
+    const int64_t t = std::max(-kOne, std::min<int64_t>(t_, kOne));
+    int64_t y = c_[3];
+    y = ((y * t + kHalf) >> kTBits) + c_[2];
+    y = ((y * t + kHalf) >> kTBits) + c_[1];
+    y = ((y * t + kHalf) >> kTBits) + c_[0];
+    return static_cast<int32_t>(y);
+  }
+
+  /// Evaluate the curve at the current x. One int-to-float conversion.
+  float Evaluate() const {
+    return static_cast<float>(EvaluateFixed()) * y_unit_;
+  }
+
+  /// The current x, relative to the start of the curve.
+  float X() const {
+    return static_cast<float>(t_) * ExponentFromInt(x_shift_ - kTBits);
+  }
+
+  /// The curve, converted back to floating point over x.
+  CubicCurve ToCubic() const;
+
+  /// Raw fixed-point state, for tests and debugging.
+  int32_t t() const { return t_; }
+  int32_t t_end() const { return t_end_; }
+  int x_shift() const { return x_shift_; }
+  float y_unit() const { return y_unit_; }
+  int32_t Coeff(int i) const { return c_[i]; }
+
+ private:
+  // Coefficients over t, in units of `y_unit_`.
+  int32_t c_[CubicCurve::kNumCoeff];
+
+  // Current x, and the end of the curve, in units of t.
+  int32_t t_;
+  int32_t t_end_;
+
+  // t = x / 2^x_shift_.
+  int32_t x_shift_;
+
+  // 2^-y_shift, the value of one unit of the coefficients.
+  float y_unit_;
+};
+
+}  // namespace motive
+
+#endif  // MOTIVE_MATH_FIXED_CUBIC_H_
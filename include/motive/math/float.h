@@ -113,6 +113,62 @@ inline float ClampNearZero(const float x, const float epsilon) {
   return is_near_zero ? 0.0f : x;
 }
 
+/// @brief Convert `f` to an IEEE 754 half-precision float, rounding to the
+///        nearest representable value.
+/// Values too large for a half become infinity, and values too small become
+/// zero. NaN stays NaN.
+inline uint16_t FloatToHalf(const float f) {
+  IntFloatUnion u;
+  u.f = f;
+  const uint32_t sign = (u.i >> 16) & 0x8000;
+  const int float_exponent =
+      static_cast<int>((u.i >> kExponentShift) & kExponentMask);
+  const int exponent = float_exponent - kExponentOffset + 15;
+  uint32_t mantissa = u.i & 0x007FFFFF;
+
+  // Infinity and NaN.
+  if (float_exponent == static_cast<int>(kExponentMask)) {
+    return static_cast<uint16_t>(sign | 0x7C00 | (mantissa != 0 ? 0x200 : 0));
+  }
+
+  // Too large, so round to infinity.
+  if (exponent >= 31) return static_cast<uint16_t>(sign | 0x7C00);
+
+  // Too small for a normalized half, so denormalize, or round to zero.
+  if (exponent <= 0) {
+    if (exponent < -10) return static_cast<uint16_t>(sign);
+    mantissa |= 0x00800000;
+    const int shift = 14 - exponent;
+    uint32_t half = mantissa >> shift;
+    if ((mantissa >> (shift - 1)) & 1) half++;
+    return static_cast<uint16_t>(sign | half);
+  }
+
+  // Rounding up may carry into the exponent, which is still correct.
+  uint32_t half =
+      sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+  if (mantissa & 0x1000) half++;
+  return static_cast<uint16_t>(half);
+}
+
+/// @brief Convert `f` to a signed normalized 16-bit integer, with -1 mapping
+///        to -32767 and 1 to 32767, as GPUs read them.
+/// Values outside [-1, 1] are clamped.
+inline int16_t FloatToSnorm16(const float f) {
+  const float clamped = std::min(std::max(f, -1.0f), 1.0f);
+  return static_cast<int16_t>(std::lround(clamped * 32767.0f));
+}
+
+/// @brief Convert `f` to an unsigned 16-bit integer, with the start of
+///        `range` mapping to 0 and the end to 65535.
+/// Values outside `range` are clamped.
+inline uint16_t FloatToUnorm16(const float f, const Range& range) {
+  const float length = range.Length();
+  const float t = length > 0.0f ? (f - range.start()) / length : 0.0f;
+  const float clamped = std::min(std::max(t, 0.0f), 1.0f);
+  return static_cast<uint16_t>(std::lround(clamped * 65535.0f));
+}
+
 }  // namespace motive
 
 #endif  // MOTIVE_MATH_FLOAT_H_
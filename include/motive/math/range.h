@@ -225,6 +225,79 @@ class RangeT {
     return 0.0f;
   }
 
+  /// Same as Normalize(), for `count` values at once. `out` may equal `xs`.
+  /// The loop has no branches, so that the compiler can vectorize it.
+  void NormalizeValues(const T* xs, size_t count, T* out) const {
+    for (size_t i = 0; i < count; ++i) {
+      out[i] = xs[i] + ModularAdjustment(xs[i]);
+    }
+  }
+
+  /// Same as NormalizeCloseValue(), for `count` values at once. `out` may
+  /// equal `xs`. Values within one Length() of the range are normalized
+  /// without branching. Any that are farther away are then finished off by
+  /// NormalizeCloseValue().
+  void NormalizeCloseValues(const T* xs, size_t count, T* out) const {
+    int num_outside = 0;
+    for (size_t i = 0; i < count; ++i) {
+      const T x = xs[i];
+      const T adjustment = ModularAdjustment(x);
+      out[i] = adjustment == static_cast<T>(0) ? x : x + adjustment;
+      num_outside += !ContainsExcludingStart(out[i]);
+    }
+    if (num_outside == 0) return;
+
+    for (size_t i = 0; i < count; ++i) {
+      if (!ContainsExcludingStart(out[i])) {
+        out[i] = NormalizeCloseValue(out[i]);
+      }
+    }
+  }
+
+  /// Same as ModDiff(), for `count` pairs of values at once. `out` may equal
+  /// `a` or `b`. `direction` is checked once, outside the loop, so that the
+  /// loop has no branches.
+  void ModDiffs(const T* a, const T* b, size_t count,
+                ModularDirection direction, T* out) const {
+    const T length = Length();
+    const T zero = static_cast<T>(0);
+    switch (direction) {
+      case kDirectionClosest:
+        for (size_t i = 0; i < count; ++i) {
+          const T diff = b[i] - a[i];
+          out[i] = diff + ModularAdjustment(diff);
+        }
+        return;
+      case kDirectionFarthest:
+        for (size_t i = 0; i < count; ++i) {
+          const T diff = b[i] - a[i];
+          const T close = diff + ModularAdjustment(diff);
+          out[i] = close >= zero ? close - length : close + length;
+        }
+        return;
+      case kDirectionPositive:
+        for (size_t i = 0; i < count; ++i) {
+          const T diff = b[i] - a[i];
+          const T close = diff + ModularAdjustment(diff);
+          out[i] = close >= zero ? close : close + length;
+        }
+        return;
+      case kDirectionNegative:
+        for (size_t i = 0; i < count; ++i) {
+          const T diff = b[i] - a[i];
+          const T close = diff + ModularAdjustment(diff);
+          out[i] = close >= zero ? close - length : close;
+        }
+        return;
+      case kDirectionDirect:
+        for (size_t i = 0; i < count; ++i) {
+          out[i] = b[i] - a[i];
+        }
+        return;
+    }
+    assert(false);
+  }
+
   /// Return true if `x` is in [start_, end_], i.e. the **inclusive** range.
   bool Contains(const T x) const { return start_ <= x && x <= end_; }
 
@@ -0,0 +1,66 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_MATH_SPLINE_STATE_H_
+#define MOTIVE_MATH_SPLINE_STATE_H_
+
+#include "motive/math/compact_spline.h"
+#include "motive/math/curve.h"
+
+namespace motive {
+
+/// @struct SplineState
+/// @brief Everything needed to continue playback of one spline index exactly
+///        where another BulkSplineEvaluator left off.
+///
+/// Read with BulkSplineEvaluator::GetSplineState() and applied with
+/// SetSplineState(). Holding the current cubic means a blend in progress
+/// continues along the same curve, instead of being re-derived.
+struct SplineState {
+  SplineState()
+      : spline(nullptr),
+        cubic_x(0.0f),
+        cubic_x_end(0.0f),
+        playback_rate(1.0f),
+        y_offset(0.0f),
+        y_scale(1.0f),
+        x_index(kInvalidSplineIndex),
+        repeat(false) {}
+
+  /// The spline being played, or nullptr if the value is held constant by
+  /// `cubic`. Not owned.
+  const CompactSpline* spline;
+
+  /// The current segment, or the blend into `spline`, already scaled by
+  /// `y_scale` and shifted by `y_offset`.
+  CubicCurve cubic;
+
+  /// The current x along `cubic`, and the x at which `cubic` ends. Both are
+  /// relative to the start of node `x_index` of `spline`.
+  float cubic_x;
+  float cubic_x_end;
+
+  float playback_rate;
+  float y_offset;
+  float y_scale;
+
+  /// The node of `spline` at which `cubic` starts.
+  CompactSplineIndex x_index;
+
+  bool repeat;
+};
+
+}  // namespace motive
+
+#endif  // MOTIVE_MATH_SPLINE_STATE_H_
@@ -0,0 +1,394 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_MATH_SPLINE_STREAM_H_
+#define MOTIVE_MATH_SPLINE_STREAM_H_
+
+#include <deque>
+#include <vector>
+
+#include "motive/math/bulk_spline_evaluator.h"
+#include "motive/math/compact_spline.h"
+
+namespace motive {
+
+/// @class SplineChunkSource
+/// @brief Supplies a long curve as a series of shorter CompactSplines.
+///
+/// Very long curves, such as cinematics and mocap takes, are split into
+/// chunks. Each chunk is a regular CompactSpline that starts at x = 0, and
+/// the last node of each chunk is the first node of the next, so consecutive
+/// chunks join continuously. Only a window of chunks needs to be resident
+/// while the curve plays. See CreateSplineChunks() and SplineStreamer.
+///
+/// Implement this interface on top of your own file or package system.
+class SplineChunkSource {
+ public:
+  virtual ~SplineChunkSource() {}
+
+  /// Total number of chunks in the curve.
+  virtual int NumChunks() const = 0;
+
+  /// The x at which `chunk` starts on the whole curve. Must be available
+  /// without loading the chunk.
+  virtual float ChunkStartX(int chunk) const = 0;
+
+  /// Start loading `chunk`, so that it's available soon. May be asynchronous.
+  virtual void Prefetch(int chunk) = 0;
+
+  /// Return `chunk` if it's loaded, or nullptr if it isn't available yet.
+  /// The spline must remain valid until Evict() is called on `chunk`.
+  virtual const CompactSpline* Chunk(int chunk) = 0;
+
+  /// `chunk` is no longer being played, and can be freed.
+  virtual void Evict(int chunk) = 0;
+};
+
+/// Split the curve through `nodes` into chunks of at most `nodes_per_chunk`
+/// nodes each, for a SplineChunkSource. Each chunk starts at x = 0, and
+/// `start_xs` receives the x at which each chunk starts on the whole curve.
+/// Destroy the chunks with CompactSpline::Destroy().
+void CreateSplineChunks(const UncompressedNode* nodes, size_t num_nodes,
+                        size_t nodes_per_chunk,
+                        std::vector<CompactSpline*>* chunks,
+                        std::vector<float>* start_xs);
+
+/// @class LiveSplineChunkSource
+/// @brief A SplineChunkSource that grows while it plays, for live data such
+///        as mocap.
+///
+/// Nodes are appended to the end of the curve with AddNode(). Every
+/// `nodes_per_chunk` nodes are sealed into a new chunk, which a SplineStreamer
+/// that is waiting at the end of the curve then moves onto. Only the newest
+/// `max_chunks` chunks are kept in memory, plus any chunk still held by the
+/// streamer, so the source can be fed indefinitely.
+///
+/// Supports one SplineStreamer at a time.
+class LiveSplineChunkSource : public SplineChunkSource {
+ public:
+  /// @param nodes_per_chunk Nodes in each chunk, including the node shared
+  ///                        with the previous chunk.
+  /// @param max_chunks Number of recent chunks to keep in memory.
+  LiveSplineChunkSource(size_t nodes_per_chunk, int max_chunks);
+  ~LiveSplineChunkSource() override;
+
+  /// Append `node` to the end of the curve. `node.x` is on the whole curve,
+  /// and must not be less than the x of the previous node.
+  void AddNode(const UncompressedNode& node);
+
+  /// Seal the nodes added since the last chunk into a chunk now, instead of
+  /// waiting for `nodes_per_chunk` of them. Use when the data pauses, so that
+  /// playback can reach the latest node. Does nothing if no nodes have been
+  /// added since the last chunk.
+  void Flush();
+
+  /// The x of the most recent node, or 0 if no nodes have been added.
+  float EndX() const { return pending_.empty() ? 0.0f : pending_.back().x; }
+
+  /// Number of chunks that are still in memory.
+  int NumResidentChunks() const { return static_cast<int>(resident_.size()); }
+
+  int NumChunks() const override { return static_cast<int>(start_xs_.size()); }
+  float ChunkStartX(int chunk) const override { return start_xs_[chunk]; }
+  void Prefetch(int chunk) override;
+  const CompactSpline* Chunk(int chunk) override;
+  void Evict(int chunk) override;
+
+ private:
+  struct ResidentChunk {
+    CompactSpline* spline;
+    bool held;
+  };
+
+  ResidentChunk* Resident(int chunk);
+  void SealChunk();
+  void DropOldChunks();
+
+  size_t nodes_per_chunk_;
+  size_t max_chunks_;
+
+  /// Nodes of the chunk being built, with x on the whole curve. The first
+  /// node is the last node of the previous chunk.
+  std::vector<UncompressedNode> pending_;
+
+  /// The chunks in memory, oldest first. The front is chunk
+  /// `first_resident_`.
+  std::deque<ResidentChunk> resident_;
+  int first_resident_;
+
+  /// Start x of every chunk ever sealed, including those no longer resident.
+  std::vector<float> start_xs_;
+
+  MOTIVE_DISALLOW_COPY_AND_ASSIGN(LiveSplineChunkSource);
+};
+
+/// @class SplineStreamTarget
+/// @brief Whatever a SplineStreamer plays its chunks on.
+///
+/// The streamer uses an index of a BulkSplineEvaluator by default. Implement
+/// this interface to stream into something else, such as a Motivator1f.
+/// See MotivatorStreamTarget.
+class SplineStreamTarget {
+ public:
+  virtual ~SplineStreamTarget() {}
+
+  /// The x of the playhead on the spline being played. Must keep advancing
+  /// past EndX() once the end of the spline is reached.
+  virtual float X() const = 0;
+
+  /// The x at which the spline being played ends.
+  virtual float EndX() const = 0;
+
+  /// Play `spline` as described by `playback`.
+  virtual void SetSpline(const CompactSpline* spline,
+                         const SplinePlayback& playback) = 0;
+};
+
+/// @class BulkSplineStreamTarget
+/// @brief Streams into one index of a BulkSplineEvaluator.
+class BulkSplineStreamTarget : public SplineStreamTarget {
+ public:
+  BulkSplineStreamTarget() : evaluator_(nullptr), index_(0) {}
+  BulkSplineStreamTarget(BulkSplineEvaluator* evaluator,
+                         BulkSplineEvaluator::Index index)
+      : evaluator_(evaluator), index_(index) {}
+
+  float X() const override { return evaluator_->X(index_); }
+  float EndX() const override { return evaluator_->EndX(index_); }
+  void SetSpline(const CompactSpline* spline,
+                 const SplinePlayback& playback) override {
+    evaluator_->SetSplines(index_, 1, spline, playback);
+  }
+
+ private:
+  BulkSplineEvaluator* evaluator_;
+  BulkSplineEvaluator::Index index_;
+};
+
+/// @class SplineStreamer
+/// @brief Plays a SplineChunkSource on one index of a BulkSplineEvaluator,
+///        or on any other SplineStreamTarget.
+///
+/// Keeps the chunk under the playhead playing, and prefetches the next chunk
+/// as soon as playback enters the current one, so only two chunks are ever
+/// needed at once. When the playhead crosses into the next chunk, the index
+/// is moved onto it at the equivalent x.
+///
+/// If the next chunk has not arrived in time, the index holds at the end of
+/// the current chunk, which is also the start of the next one. It then blends
+/// over `playback.blend_x` to where playback should be, once the chunk
+/// arrives.
+///
+/// Likewise, if playback reaches the end of a source that is still growing,
+/// such as a LiveSplineChunkSource, it holds there and blends on into new
+/// chunks as they are added, so playback never has to be restarted.
+class SplineStreamer {
+ public:
+  SplineStreamer();
+
+  /// Play `source` on `index` of `evaluator`, from `playback.start_x` on the
+  /// whole curve. `playback.repeat` loops back to the first chunk at the end.
+  /// @param evaluator Not owned. Must outlive the streamer, or be reset by
+  ///                  another call to Start().
+  /// @param source Not owned. Same lifetime requirement as `evaluator`.
+  void Start(BulkSplineEvaluator* evaluator, BulkSplineEvaluator::Index index,
+             SplineChunkSource* source, const SplinePlayback& playback);
+
+  /// Play `source` on `target`, from `playback.start_x` on the whole curve.
+  /// @param target Not owned. Must outlive the streamer, or be reset by
+  ///               another call to Start().
+  /// @param source Not owned. Same lifetime requirement as `target`.
+  void Start(SplineStreamTarget* target, SplineChunkSource* source,
+             const SplinePlayback& playback);
+
+  /// Call after every BulkSplineEvaluator::AdvanceFrame(). Moves onto the next
+  /// chunk when the current one has been played.
+  void Update();
+
+  /// Stop streaming, and evict any chunks that are held.
+  void Stop();
+
+  /// The x of the playhead on the whole curve.
+  float X() const;
+
+  /// The chunk under the playhead.
+  int chunk() const { return chunk_; }
+
+  /// True if playback is held waiting for a chunk to load.
+  bool starved() const { return starved_; }
+
+  /// True if playback is held at the end of the last chunk.
+  bool held_at_end() const { return held_at_end_; }
+
+ private:
+  void EnterChunk(float start_x, float blend_x);
+  int NextChunk() const;
+  int ChunkForX(float x) const;
+
+  /// Used by the BulkSplineEvaluator version of Start().
+  BulkSplineStreamTarget evaluator_target_;
+  SplineStreamTarget* target_;
+  SplineChunkSource* source_;
+  SplinePlayback playback_;
+
+  /// The chunk being played, or waited for if `starved_`.
+  int chunk_;
+
+  /// The chunk that `target_` references, or -1 if none. Is
+  /// the previous chunk while `starved_`.
+  int playing_chunk_;
+
+  /// The chunk after `chunk_` that was prefetched, or -1 if none.
+  int prefetched_chunk_;
+
+  /// When `starved_`, the x in `chunk_` reported by X().
+  float pending_x_;
+  bool starved_;
+
+  /// True once playback has passed the end of the last chunk, without
+  /// `playback_.repeat`.
+  bool held_at_end_;
+};
+
+/// @class RingSpline
+/// @brief A repeating CompactSpline that live data, such as mocap, is
+///        appended to while it plays. Only the most recent nodes are kept.
+///
+/// The nodes are evenly spaced, `x_step` apart, and held in a ring: each
+/// AddNode() overwrites the oldest node in place. spline() repeats every
+/// period(), so playback with SplinePlayback::repeat runs around the ring
+/// forever, and never has to be restarted to pick up new data.
+///
+/// spline() is always the same CompactSpline, so it can be referenced by the
+/// ops of a MatrixAnim, and played by matrix and rig motivators like any
+/// other spline. See AddVector3RingCurves() and AddQuaternionRingCurves().
+/// Playback must stay behind the most recent node, since the node after it
+/// is the oldest one. RingSplineClock keeps it there.
+///
+/// Add nodes between calls to MotiveEngine::AdvanceFrame(), not during.
+class RingSpline {
+ public:
+  /// @param num_nodes Number of the most recent nodes that are kept. Must
+  ///                  cover the playback latency, plus any hiccups in the
+  ///                  data.
+  /// @param x_step Distance along x between consecutive nodes, for example,
+  ///               the frame time of the capture.
+  /// @param y_range Bounds of the values. AddNode() clamps to these.
+  RingSpline(CompactSplineIndex num_nodes, float x_step, const Range& y_range,
+             MotiveAllocator* allocator = nullptr);
+  ~RingSpline();
+
+  /// Append a node `x_step` after the most recent one, replacing the oldest
+  /// node once the ring is full. Until then, the first node's value fills the
+  /// ring.
+  void AddNode(float y, float derivative);
+
+  /// Same as AddNode(), with the derivative taken from the slope between
+  /// the most recent value and `y`.
+  void AddValue(float y);
+
+  /// The spline to play. Its address never changes.
+  const CompactSpline& spline() const { return *spline_; }
+
+  /// The x on spline() of the most recent node. Playback should stay before
+  /// this x, modulo period().
+  float NewestX() const;
+
+  /// Return `x` wrapped into one period of spline().
+  float WrapX(float x) const;
+
+  /// The x at which spline() repeats.
+  float period() const { return num_ring_nodes_ * x_step_; }
+
+  float x_step() const { return x_step_; }
+
+  /// The value of the most recent node, or 0 if no nodes have been added.
+  float newest_y() const { return newest_y_; }
+
+  /// Total number of nodes added, including those no longer held.
+  size_t num_added() const { return num_added_; }
+
+ private:
+  CompactSpline* spline_;
+  MotiveAllocator* allocator_;
+  float x_step_;
+  float newest_y_;
+  CompactSplineIndex num_ring_nodes_;
+
+  /// `x_step_`, in units of the spline's x granularity.
+  CompactSplineXGrain grains_per_step_;
+  size_t num_added_;
+
+  MOTIVE_DISALLOW_COPY_AND_ASSIGN(RingSpline);
+};
+
+/// @class RingSplineClock
+/// @brief Chooses playback rates that keep playback of RingSplines a steady
+///        distance behind their most recent nodes.
+///
+/// Live data arrives at its own pace, so playback that runs at a fixed rate
+/// drifts towards the newest data, or away from it. The clock speeds
+/// playback up or slows it down in proportion to the drift, so that the
+/// latency from capture to pose stays roughly constant. Playback is paused,
+/// rather than allowed to pass the newest node, if the data stops.
+///
+/// One clock drives every ring that is fed together, such as all the
+/// channels of a rig. Use it like this:
+///
+///     rig.BlendToAnim(live_anim, clock.Start(ring));
+///     // Every frame, after adding the frame's nodes to the rings:
+///     engine.AdvanceFrame(delta_time);
+///     rig.SetPlaybackRate(clock.Update(ring, delta_time));
+class RingSplineClock {
+ public:
+  /// @param latency Distance along x to keep playback behind the most recent
+  ///                node. Should be at least one x_step plus one frame.
+  /// @param max_rate Fastest playback rate used to catch up.
+  explicit RingSplineClock(float latency, float max_rate = 2.0f)
+      : latency_(latency),
+        max_rate_(max_rate),
+        lag_(latency),
+        playback_rate_(1.0f),
+        num_added_(0) {
+    assert(latency > 0.0f && max_rate >= 1.0f);
+  }
+
+  /// Playback that starts `latency` behind the most recent node of `ring`,
+  /// and repeats with the ring. Pass it to RigMotivator::BlendToAnim() or
+  /// MatrixMotivator4f::BlendToOps().
+  SplinePlayback Start(const RingSpline& ring, float blend_x = 0.0f);
+
+  /// Call after every MotiveEngine::AdvanceFrame(), with the same
+  /// `delta_x`. Returns the playback rate for the next frame, to pass to
+  /// RigMotivator::SetPlaybackRate() or MatrixMotivator4f::SetPlaybackRate().
+  float Update(const RingSpline& ring, float delta_x);
+
+  /// How far, along x, playback is behind the most recent node.
+  float lag() const { return lag_; }
+
+  float playback_rate() const { return playback_rate_; }
+
+ private:
+  float latency_;
+  float max_rate_;
+  float lag_;
+  float playback_rate_;
+
+  /// RingSpline::num_added() when the lag was last updated.
+  size_t num_added_;
+};
+
+}  // namespace motive
+
+#endif  // MOTIVE_MATH_SPLINE_STREAM_H_
@@ -0,0 +1,85 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_MATH_TRANSFORM_KERNELS_H_
+#define MOTIVE_MATH_TRANSFORM_KERNELS_H_
+
+#include "motive/util/optimizations.h"
+
+namespace motive {
+
+/// The functions below process many transforms at once, stored as
+/// structures-of-arrays: element `k` of transform `j` is at
+/// `values[k * stride + j]`, so that the inner loops run across transforms.
+///
+/// Affine transforms are 3x4 matrices, the bottom row of the 4x4 matrix being
+/// (0, 0, 0, 1). Element `k` is at row `k / 4` and column `k % 4`.
+static const int kNumAffineElements = 12;
+
+/// Elements of the translation, rotation, and scale transforms read by
+/// SqtsToAffines(). The rotation is a quaternion.
+enum SqtElement {
+  kSqtTranslationX,
+  kSqtTranslationY,
+  kSqtTranslationZ,
+  kSqtRotationW,
+  kSqtRotationX,
+  kSqtRotationY,
+  kSqtRotationZ,
+  kSqtScaleX,
+  kSqtScaleY,
+  kSqtScaleZ,
+  kNumSqtElements
+};
+
+/// Write `parents[j]` * `locals[j]` to `globals[j]`, for `count` affine
+/// transforms.
+typedef void (*MultiplyAffinesFn)(const float* parents, const float* locals,
+                                  int count, int stride, float* globals);
+
+/// Normalize the quaternions of `count` SQT transforms, in place, and write
+/// the affine transforms they describe to `affines`. Equivalent to
+/// mathfu::mat4::Transform() with a normalized quaternion, to within
+/// rounding.
+typedef void (*SqtsToAffinesFn)(float* sqts, int count, int stride,
+                                float* affines);
+
+/// Optimized variants of the functions above, for one instruction set.
+struct TransformKernels {
+  MultiplyAffinesFn multiply_affines;
+  SqtsToAffinesFn sqts_to_affines;
+};
+
+/// Return the functions for `optimization`, or nullptr if it has none and
+/// the plain C++ functions should be called.
+const TransformKernels* TransformKernelsFor(
+    ProcessorOptimization optimization);
+
+/// Call the function of `kernels`, or the C++ function if `kernels` is
+/// nullptr. When MOTIVE_ASSEMBLY_TEST is defined, run both the C++ and
+/// assembly functions instead, and assert that they match exactly.
+void MultiplyAffines(const TransformKernels* kernels, const float* parents,
+                     const float* locals, int count, int stride,
+                     float* globals);
+void SqtsToAffines(const TransformKernels* kernels, float* sqts, int count,
+                   int stride, float* affines);
+
+/// The C++ functions, which the optimized ones match bit-for-bit.
+void MultiplyAffines_C(const float* parents, const float* locals, int count,
+                       int stride, float* globals);
+void SqtsToAffines_C(float* sqts, int count, int stride, float* affines);
+
+}  // namespace motive
+
+#endif  // MOTIVE_MATH_TRANSFORM_KERNELS_H_
@@ -17,6 +17,7 @@
 
 #include "motive/matrix_op.h"
 #include "motive/spline_init.h"
+#include "motive/util/memory_stats.h"
 
 namespace motive {
 
@@ -25,13 +26,17 @@ namespace motive {
 class MatrixAnim {
  public:
   struct Spline {
-    Spline() : spline(nullptr) {}
+    Spline() : spline(nullptr), owned(true) {}
     ~Spline() {
-      CompactSpline::Destroy(spline);
+      if (owned) CompactSpline::Destroy(spline);
       spline = nullptr;
     }
     CompactSpline* spline;
     SplineInit init;
+
+    /// False if `spline` is in memory reserved by the RigAnim, in which case
+    /// it's freed along with the RigAnim instead. See RigAnim::Reserve().
+    bool owned;
   };
 
   explicit MatrixAnim(int expected_num_ops = 0) {
@@ -53,12 +58,47 @@ class MatrixAnim {
     return splines_.data();
   }
 
+  /// For construction. Replace this animation's copy of `spline` with
+  /// `shared`, an identical spline that outlives this MatrixAnim, and free
+  /// the copy. Returns the number of bytes freed. Copies that aren't `owned`
+  /// can't be freed on their own, so are only no longer referenced.
+  size_t ShareSpline(const CompactSpline* spline, const CompactSpline* shared) {
+    assert(spline != shared);
+    for (auto op = ops_.begin(); op != ops_.end(); ++op) {
+      if (op->union_type == MatrixOperationInit::kUnionSpline &&
+          op->spline == spline) {
+        op->spline = shared;
+      }
+    }
+
+    size_t bytes_freed = 0;
+    for (auto s = splines_.begin(); s != splines_.end(); ++s) {
+      if (s->spline != spline || !s->owned) continue;
+      bytes_freed += CompactSpline::Size(s->spline->max_nodes());
+      CompactSpline::Destroy(s->spline);
+      s->spline = nullptr;
+    }
+    return bytes_freed;
+  }
+
   /// Return the op array. Non-const version is for construction.
   std::vector<MatrixOperationInit>& ops() { return ops_; }
 
   /// Return the op array. Const version is to initialize a MatrixMotivator.
   const std::vector<MatrixOperationInit>& ops() const { return ops_; }
 
+  /// Add the memory held by this animation to `stats`. Splines that have been
+  /// replaced by ShareSpline() belong to another MatrixAnim, so are counted
+  /// there instead.
+  void AddMemoryStats(MemoryStats* stats) const {
+    stats->AddVector(ops_);
+    stats->op_bytes += ops_.size() * sizeof(ops_[0]);
+    stats->AddVector(splines_);
+    for (auto s = splines_.begin(); s != splines_.end(); ++s) {
+      if (s->spline != nullptr) s->spline->AddMemoryStats(stats);
+    }
+  }
+
   /// Configures this MatrixAnim to use an SqtInit instead of a MatrixInit,
   /// indicating that it contains quaternion operations.
   void SetSqtAnim() { is_sqt_anim_ = true; }
@@ -51,13 +51,16 @@ class MatrixMotivator4fTemplate : public Motivator {
     InitializeWithDimension(init, engine, 1);
   }
 
-  /// Return the current value of the Motivator. The processor returns a
-  /// vector-aligned matrix, so the cast should be valid for any user-defined
-  /// matrix type.
-  const Mat4& Value() const {
-    // TODO: Return by value here. Necessary for matrix formats that are not
-    //       byte-wise compatible. For example, row-major matrices.
-    return reinterpret_cast<const Mat4&>(Processor().Value(index_));
+  /// Return the current value of the Motivator.
+  Mat4 Value() const {
+    const mathfu::mat4 m = Processor().Value(index_);
+    return C::FromPtr(&m(0), Mat4());
+  }
+
+  /// Return the current value of the Motivator as an affine transform. This is
+  /// how the processor stores the value, so no conversion is necessary.
+  const mathfu::AffineTransform& AffineValue() const {
+    return Processor().AffineValue(index_);
   }
 
   /// Return the current value of the Motivator decomposed into a translation,
@@ -71,8 +74,9 @@ class MatrixMotivator4fTemplate : public Motivator {
   /// The matrix is a 3D affine transform, so the translation component is the
   /// fourth column.
   Vec3 Position() const {
-    const mathfu::vec3 position =
-        Processor().Value(index_).TranslationVector3D();
+    // Column `r` of an AffineTransform is row `r` of the 3x4 matrix.
+    const mathfu::AffineTransform& t = Processor().AffineValue(index_);
+    const mathfu::vec3 position(t(3, 0), t(3, 1), t(3, 2));
     return C::FromPtr(&position[0], Vec3());
   }
 
@@ -82,6 +86,11 @@ class MatrixMotivator4fTemplate : public Motivator {
     return Valid() ? Processor().TimeRemaining(index_) : 0;
   }
 
+  /// Returns the most recent MotiveEngine::frame_count() on which Value()
+  /// changed. If Value() might change every frame, returns the largest
+  /// uint32_t instead.
+  uint32_t ChangedFrame() const { return Processor().ChangedFrame(index_); }
+
   /// Query the number of matrix operations. This equals the number of
   /// operations in the `init` initializer.
   int NumChildren() const { return Processor().NumChildren(index_); }
@@ -161,6 +170,35 @@ class MatrixMotivator4fTemplate : public Motivator {
     Processor().BlendToOps(index_, ops, playback);
   }
 
+  /// Same as calling BlendToOps() on each of `motivators`, with the same `ops`
+  /// and `playback`, but with one call into each of their processors. When
+  /// many matrices switch to the same ops at once, such as the same bone of a
+  /// crowd of rigs, the processor can then plan the blend once for all of
+  /// them, and start all of their splines together.
+  /// @param motivators Array of length `count`. Every Motivator must be
+  ///                   valid, and appear only once. Consecutive Motivators
+  ///                   with the same processor are blended together.
+  static void BlendToOpsInBulk(MatrixMotivator4fTemplate* const* motivators,
+                               size_t count,
+                               const std::vector<MatrixOperationInit>& ops,
+                               const SplinePlayback& playback) {
+    std::vector<MotiveIndex> indices;
+    size_t begin = 0;
+    while (begin < count) {
+      MatrixProcessor4f& processor = motivators[begin]->Processor();
+      indices.clear();
+      size_t end = begin;
+      for (; end < count && &motivators[end]->Processor() == &processor;
+           ++end) {
+        indices.push_back(motivators[end]->index_);
+      }
+      processor.BlendToOpsAt(indices.data(),
+                             static_cast<MotiveIndex>(indices.size()), ops,
+                             playback);
+      begin = end;
+    }
+  }
+
   void SetPlaybackRate(float playback_rate) {
     if (Valid()) {
       Processor().SetPlaybackRate(index_, playback_rate);
@@ -15,6 +15,7 @@
 #ifndef MOTIVE_MATRIX_OP_H_
 #define MOTIVE_MATRIX_OP_H_
 
+#include "mathfu/glsl_mappings.h"
 #include "motive/engine.h"
 #include "motive/math/angle.h"
 #include "motive/math/compact_spline.h"
@@ -213,7 +214,8 @@ class MatrixOperation {
 
   MatrixOperation(const MatrixOperationInit& init,
                   const motive::SplinePlayback& playback,
-                  MotiveEngine* engine) {
+                  MotiveEngine* engine,
+                  MotivatorSplineBatch* spline_batch = nullptr) {
     SetId(init.id);
     SetType(init.type);
 
@@ -229,7 +231,7 @@ class MatrixOperation {
 
     // Initialize the value. For defining animations, init.union_type will
     // be kUnionEmpty, so this will not set up any splines.
-    BlendToOp(init, playback, engine);
+    BlendToOp(init, playback, engine, spline_batch);
   }
 
   MatrixOperation(MatrixOperation&& rhs) noexcept { *this = std::move(rhs); }
@@ -299,8 +301,18 @@ class MatrixOperation {
     const_value_ = value;
   }
 
+  // Save, verify or restore the constant value. The child motivator's state
+  // is archived by its own processor.
+  void ArchiveState(MotiveStateArchive* archive) {
+    archive->Value(&const_value_);
+  }
+
+  // Smoothly transition to `init`. When `spline_batch` is not nullptr, a new
+  // spline is added to it rather than started, so that the caller can start
+  // the splines of many ops together.
   void BlendToOp(const MatrixOperationInit& init,
-                 const motive::SplinePlayback& playback, MotiveEngine* engine) {
+                 const motive::SplinePlayback& playback, MotiveEngine* engine,
+                 MotivatorSplineBatch* spline_batch = nullptr) {
     switch (init.union_type) {
       case MatrixOperationInit::kUnionEmpty:
         break;
@@ -338,7 +350,11 @@ class MatrixOperation {
           motivator_ = Motivator1f(*init.init, engine);
           motivator_.SetTarget(Current1f(const_value_));
         }
-        motivator_.SetSpline(*init.spline, playback);
+        if (spline_batch != nullptr) {
+          spline_batch->Add(&motivator_, init.spline);
+        } else {
+          motivator_.SetSpline(*init.spline, playback);
+        }
         break;
 
       default:
@@ -370,6 +386,11 @@ class MatrixOperation {
     motivator_.SetSplineRepeating(repeat);
   }
 
+  void SetUpdateDivisor(const MotiveUpdateDivisor& divisor) {
+    if (!motivator_.Valid()) return;
+    motivator_.SetUpdateDivisor(divisor.divisor, divisor.phase);
+  }
+
   MotiveTime TimeRemaining() const {
     if (motivator_.Valid()) {
       // Return the time time to reach the target for the motivator.
@@ -380,10 +401,136 @@ class MatrixOperation {
     }
   }
 
-  // Execute the series of basic matrix operations in 'ops'.
+  // Columns of a matrix being built by a series of basic matrix operations,
+  // and its scale. Starts as the identity matrix.
+  struct ResultColumns {
+    ResultColumns()
+        : c0(mathfu::kAxisX4f),
+          c1(mathfu::kAxisY4f),
+          c2(mathfu::kAxisZ4f),
+          c3(mathfu::kAxisW4f),
+          scale(mathfu::kOnes3f) {}
+
+    mathfu::mat4 Matrix() const { return mathfu::mat4(c0, c1, c2, c3); }
+
+    // The bottom row of the matrix is always (0, 0, 0, 1), so it can be
+    // dropped. Column `r` of an AffineTransform is row `r` of the matrix.
+    mathfu::AffineTransform Affine() const {
+      return mathfu::AffineTransform(mathfu::vec4(c0.x, c1.x, c2.x, c3.x),
+                                     mathfu::vec4(c0.y, c1.y, c2.y, c3.y),
+                                     mathfu::vec4(c0.z, c1.z, c2.z, c3.z));
+    }
+
+    mathfu::vec4 c0;
+    mathfu::vec4 c1;
+    mathfu::vec4 c2;
+    mathfu::vec4 c3;
+
+    // Separately keep track of the scale.
+    mathfu::vec3 scale;
+  };
+
+  // Function that executes a series of basic matrix operations on `m`, with
+  // the same arguments and result as ApplyOperations().
+  typedef void (*Kernel)(const MatrixOperation* ops, size_t num_ops,
+                         ResultColumns* m);
+
+  // Number of floats in a ResultColumns: its four columns, then its scale.
+  static const size_t kResultFloats = 19;
+
+  // Function that executes the same series of basic matrix operations on
+  // `count` matrices in `results` at once. `values` holds the operation values
+  // in structure-of-arrays order: the value of operation `i` for matrix `j` is
+  // `values[i * count + j]`. `results` holds the matrices in the same order:
+  // float `k` of the ResultColumns of matrix `j` is `results[k * count + j]`,
+  // so the kernel's loops run over contiguous floats and vectorize.
+  // See ScatterResult() and GatherResult().
+  typedef void (*BatchKernel)(const float* values, size_t count,
+                              float* results);
+
+  // Write `m` as matrix `j` of the `count` matrices in `results`, in the
+  // structure-of-arrays order of a BatchKernel.
+  static void ScatterResult(const ResultColumns& m, size_t j, size_t count,
+                            float* results);
+
+  // Read matrix `j` of the `count` matrices in `results`, in the
+  // structure-of-arrays order of a BatchKernel, into `m`.
+  static void GatherResult(const float* results, size_t j, size_t count,
+                           ResultColumns* m);
+
+  // Apply one basic matrix operation of type `kType` to `m`. Since the type is
+  // known at compile time, the switch compiles away.
   // We break out the matrix into four column vectors to avoid matrix multiplies
   // (which are slow) in preference of operation-specific matrix math (which is
   // fast).
+  template <MatrixOperationType kType>
+  static inline void ApplyOperation(const float value, ResultColumns* m) {
+    switch (kType) {
+      // ( |  |  |  |)(c -s  0  0)   (c*  c*   |   |)
+      // (c0 c1 c2 c3)(s  c  0  0) = (c0+ c1- c2  c3)
+      // ( |  |  |  |)(0  0  1  0)   (s*  s*   |   |)
+      // ( |  |  |  |)(0  0  0  1)   (c1  c0   |   |)
+      case kRotateAboutX:
+        RotateAboutAxis(value, &m->c1, &m->c2);
+        break;
+
+      case kRotateAboutY:
+        RotateAboutAxis(value, &m->c2, &m->c0);
+        break;
+
+      case kRotateAboutZ:
+        RotateAboutAxis(value, &m->c0, &m->c1);
+        break;
+
+      // ( |  |  |  |)(1  0  0 tx)   ( |  |  | tx*c0+ )
+      // (c0 c1 c2 c3)(0  1  0 ty) = (c0 c1 c2 ty*c1+ )
+      // ( |  |  |  |)(0  0  1 tz)   ( |  |  | tz*c2+ )
+      // ( |  |  |  |)(0  0  0  1)   ( |  |  |    c3  )
+      case kTranslateX:
+        m->c3 += value * m->c0;
+        break;
+
+      case kTranslateY:
+        m->c3 += value * m->c1;
+        break;
+
+      case kTranslateZ:
+        m->c3 += value * m->c2;
+        break;
+
+      // ( |  |  |  |)(sx 0  0  0)   ( |   |   |   |)
+      // (c0 c1 c2 c3)(0  sy 0  0) = (sx* sy* sz*  |)
+      // ( |  |  |  |)(0  0  sz 0)   (c0  c1  c2  c3)
+      // ( |  |  |  |)(0  0  0  1)   ( |   |   |   |)
+      case kScaleX:
+        m->c0 *= value;
+        m->scale.x *= value;
+        break;
+
+      case kScaleY:
+        m->c1 *= value;
+        m->scale.y *= value;
+        break;
+
+      case kScaleZ:
+        m->c2 *= value;
+        m->scale.z *= value;
+        break;
+
+      case kScaleUniformly:
+        m->c0 *= value;
+        m->c1 *= value;
+        m->c2 *= value;
+        m->scale *= value;
+        break;
+
+      default:
+        // All other operations, including quaternions, are not supported.
+        assert(false);
+    }
+  }
+
+  // Execute the series of basic matrix operations in 'ops'.
   static mathfu::mat4 CalculateResultMatrix(const MatrixOperation* ops,
                                             size_t num_ops) {
     return CalculateResultMatrix(ops, num_ops, nullptr);
@@ -394,89 +541,76 @@ class MatrixOperation {
   static mathfu::mat4 CalculateResultMatrix(const MatrixOperation* ops,
                                             size_t num_ops,
                                             mathfu::vec3* out_scale) {
-    // Start with the identity matrix.
-    mathfu::vec4 c0 = mathfu::kAxisX4f;
-    mathfu::vec4 c1 = mathfu::kAxisY4f;
-    mathfu::vec4 c2 = mathfu::kAxisZ4f;
-    mathfu::vec4 c3 = mathfu::kAxisW4f;
-
-    // Separately keep track of the scale.
-    mathfu::vec3 scale = mathfu::kOnes3f;
+    ResultColumns m;
+    ApplyOperations(ops, num_ops, &m);
+    if (out_scale) {
+      *out_scale = m.scale;
+    }
+    return m.Matrix();
+  }
 
+  // Execute the series of basic matrix operations in 'ops' on `m`.
+  // This interprets the operations one at a time. FindKernel() returns a
+  // faster function for common sequences of operations.
+  static void ApplyOperations(const MatrixOperation* ops, size_t num_ops,
+                              ResultColumns* m) {
     for (size_t i = 0; i < num_ops; ++i) {
-      const MatrixOperation& op = ops[i];
-      const float value = op.Value();
-
-      switch (op.Type()) {
-        // ( |  |  |  |)(c -s  0  0)   (c*  c*   |   |)
-        // (c0 c1 c2 c3)(s  c  0  0) = (c0+ c1- c2  c3)
-        // ( |  |  |  |)(0  0  1  0)   (s*  s*   |   |)
-        // ( |  |  |  |)(0  0  0  1)   (c1  c0   |   |)
-        case kRotateAboutX:
-          RotateAboutAxis(value, &c1, &c2);
-          break;
-
-        case kRotateAboutY:
-          RotateAboutAxis(value, &c2, &c0);
-          break;
-
-        case kRotateAboutZ:
-          RotateAboutAxis(value, &c0, &c1);
-          break;
-
-        // ( |  |  |  |)(1  0  0 tx)   ( |  |  | tx*c0+ )
-        // (c0 c1 c2 c3)(0  1  0 ty) = (c0 c1 c2 ty*c1+ )
-        // ( |  |  |  |)(0  0  1 tz)   ( |  |  | tz*c2+ )
-        // ( |  |  |  |)(0  0  0  1)   ( |  |  |    c3  )
-        case kTranslateX:
-          c3 += value * c0;
-          break;
-
-        case kTranslateY:
-          c3 += value * c1;
-          break;
-
-        case kTranslateZ:
-          c3 += value * c2;
-          break;
-
-        // ( |  |  |  |)(sx 0  0  0)   ( |   |   |   |)
-        // (c0 c1 c2 c3)(0  sy 0  0) = (sx* sy* sz*  |)
-        // ( |  |  |  |)(0  0  sz 0)   (c0  c1  c2  c3)
-        // ( |  |  |  |)(0  0  0  1)   ( |   |   |   |)
-        case kScaleX:
-          c0 *= value;
-          scale.x *= value;
-          break;
-
-        case kScaleY:
-          c1 *= value;
-          scale.y *= value;
-          break;
-
-        case kScaleZ:
-          c2 *= value;
-          scale.z *= value;
-          break;
-
-        case kScaleUniformly:
-          c0 *= value;
-          c1 *= value;
-          c2 *= value;
-          scale *= value;
-          break;
-
-        default:
-          // All other operations, including quaternions, are not supported.
-          assert(false);
-      }
+      ApplyOperation(ops[i].Type(), ops[i].Value(), m);
     }
-    if (out_scale) {
-      *out_scale = scale;
+  }
+
+  // Apply one basic matrix operation of type `type` to `m`.
+  static void ApplyOperation(MatrixOperationType type, const float value,
+                             ResultColumns* m) {
+    switch (type) {
+      case kRotateAboutX:
+        ApplyOperation<kRotateAboutX>(value, m);
+        break;
+      case kRotateAboutY:
+        ApplyOperation<kRotateAboutY>(value, m);
+        break;
+      case kRotateAboutZ:
+        ApplyOperation<kRotateAboutZ>(value, m);
+        break;
+      case kTranslateX:
+        ApplyOperation<kTranslateX>(value, m);
+        break;
+      case kTranslateY:
+        ApplyOperation<kTranslateY>(value, m);
+        break;
+      case kTranslateZ:
+        ApplyOperation<kTranslateZ>(value, m);
+        break;
+      case kScaleX:
+        ApplyOperation<kScaleX>(value, m);
+        break;
+      case kScaleY:
+        ApplyOperation<kScaleY>(value, m);
+        break;
+      case kScaleZ:
+        ApplyOperation<kScaleZ>(value, m);
+        break;
+      case kScaleUniformly:
+        ApplyOperation<kScaleUniformly>(value, m);
+        break;
+
+      default:
+        // All other operations, including quaternions, are not supported.
+        assert(false);
     }
-    return mathfu::mat4(c0, c1, c2, c3);
   }
 
+  // Return a kernel that's specialized for the sequence of operation types in
+  // `ops`, without any branching on the types. If the sequence isn't a common
+  // one, return the generic ApplyOperations(). Either way, the kernel gives
+  // exactly the same result as ApplyOperations().
+  // The kernel is only valid for as long as the types in `ops` don't change.
+  static Kernel FindKernel(const MatrixOperation* ops, size_t num_ops);
+
+  // Return the batched version of `kernel`, or nullptr if `kernel` is not
+  // one of the specialized kernels returned by FindKernel().
+  static BatchKernel FindBatchKernel(Kernel kernel);
+
  private:
   // Perform a matrix rotation about
   static inline void RotateAboutAxis(const float angle, mathfu::vec4* column0,
@@ -15,6 +15,9 @@
 #ifndef MOTIVE_MATRIX_PROCESSOR_H_
 #define MOTIVE_MATRIX_PROCESSOR_H_
 
+#include <limits>
+
+#include "mathfu/glsl_mappings.h"
 #include "motive/matrix_op.h"
 #include "motive/processor.h"
 
@@ -25,8 +28,15 @@ namespace motive {
 /// That is, for MotiveProcessors that interface with MatrixMotivator4f's.
 class MatrixProcessor4f : public MotiveProcessor {
  public:
+  /// Get the current matrix value from the processor, as an affine transform.
+  /// This is how the value is stored, so prefer it to Value().
+  virtual const mathfu::AffineTransform& AffineValue(
+      MotiveIndex index) const = 0;
+
   /// Get the current matrix value from the processor.
-  virtual const mathfu::mat4& Value(MotiveIndex index) const = 0;
+  mathfu::mat4 Value(MotiveIndex index) const {
+    return mathfu::mat4::FromAffineTransform(AffineValue(index));
+  }
 
   /// Get the current matrix value from the processor in the form of a
   /// translation, rotation, and scale.
@@ -57,6 +67,17 @@ class MatrixProcessor4f : public MotiveProcessor {
                           const std::vector<MatrixOperationInit>& /*ops*/,
                           const motive::SplinePlayback& /*playback*/) {}
 
+  /// Same as calling BlendToOps() on each of the `count` distinct `indices`.
+  /// Processors can override this to share the work between indices whose
+  /// ops are laid out alike.
+  virtual void BlendToOpsAt(const MotiveIndex* indices, MotiveIndex count,
+                            const std::vector<MatrixOperationInit>& ops,
+                            const motive::SplinePlayback& playback) {
+    for (MotiveIndex i = 0; i < count; ++i) {
+      BlendToOps(indices[i], ops, playback);
+    }
+  }
+
   /// Instantly change the playback speed of this animation.
   virtual void SetPlaybackRate(MotiveIndex index, float playback_rate) = 0;
 
@@ -70,6 +91,12 @@ class MatrixProcessor4f : public MotiveProcessor {
   /// a playback rate of 0.5 will take 2s to finish.  However, TimeRemaining()
   /// at the start of the animation will return 1s.
   virtual MotiveTime TimeRemaining(MotiveIndex index) const = 0;
+
+  /// Returns the most recent MotiveEngine::frame_count() on which the matrix
+  /// value changed. The default assumes the matrix changes every frame.
+  virtual uint32_t ChangedFrame(MotiveIndex /*index*/) const {
+    return std::numeric_limits<uint32_t>::max();
+  }
 };
 
 }  // namespace motive
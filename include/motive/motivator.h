@@ -125,6 +125,32 @@ class Motivator {
     }
   }
 
+  /// Evaluate this Motivator only once every `divisor` frames. Useful for
+  /// animation level-of-detail. See MotiveUpdateDivisor for details.
+  ///
+  /// Motivators that drive child Motivators, such as RigMotivator and
+  /// MatrixMotivator4f, pass the divisor on to their children. Processors
+  /// that cannot skip frames, such as the physics-based ones, ignore it.
+  ///
+  /// @param divisor Evaluate once every `divisor` frames. 1 evaluates every
+  ///                frame, which is the default.
+  /// @param phase Offset of the frames on which we evaluate. Give distant
+  ///              characters different phases to spread their cost across
+  ///              frames.
+  void SetUpdateDivisor(int divisor, int phase = 0) {
+    processor_->SetUpdateDivisor(index_, MotiveUpdateDivisor(divisor, phase));
+  }
+
+  /// Call `read`, which should copy this Motivator's outputs, so that every
+  /// output it copies is from the same published frame. Lets another thread,
+  /// such as a render thread, read a double-buffered engine while frames are
+  /// advanced and published, without locks. `read` may be called more than
+  /// once. See MotiveProcessor::ReadPublished().
+  template <typename ReadFn>
+  void ReadPublished(const ReadFn& read) const {
+    processor_->ReadPublished(read);
+  }
+
  protected:
   Motivator(const MotivatorInit& init, MotiveEngine* engine,
             MotiveDimension dimensions)
@@ -139,6 +165,10 @@ class Motivator {
   /// directly.
   friend class MotiveProcessor;
 
+  /// The MotiveEngine uses Processor() to track dependencies between
+  /// MotiveProcessors.
+  friend class MotiveEngine;
+
   /// These should only be called by MotiveProcessor!
   void Init(MotiveProcessor* processor, MotiveIndex index) {
     processor_ = processor;
@@ -0,0 +1,142 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_MOTIVATOR_HANDLE_H_
+#define MOTIVE_MOTIVATOR_HANDLE_H_
+
+#include <deque>
+#include <vector>
+
+#include "motive/common.h"
+#include "motive/motivator.h"
+
+namespace motive {
+
+/// @class MotiveHandle
+/// @brief Plain-old-data reference to a Motivator in a MotivatorHandleTable.
+///
+/// Unlike a Motivator, a handle can be copied and memcpy'd freely, so it can
+/// live in component arrays that are relocated in bulk. The generation
+/// detects handles whose Motivator has since been destroyed.
+struct MotiveHandle {
+  MotiveHandle() : index(0), generation(0) {}
+  MotiveHandle(uint32_t index, uint32_t generation)
+      : index(index), generation(generation) {}
+
+  /// True unless default constructed. A valid handle may still be stale.
+  /// See MotivatorHandleTable::Alive().
+  bool Valid() const { return generation != 0; }
+
+  bool operator==(const MotiveHandle& rhs) const {
+    return index == rhs.index && generation == rhs.generation;
+  }
+  bool operator!=(const MotiveHandle& rhs) const { return !operator==(rhs); }
+
+  /// Slot in the MotivatorHandleTable.
+  uint32_t index;
+
+  /// Incremented every time the slot is reused. Never 0 for a valid handle.
+  uint32_t generation;
+};
+
+/// @class MotivatorHandleTable
+/// @brief Own Motivators at stable addresses, and refer to them by handle.
+///
+/// The MotiveProcessors keep a pointer back to every Motivator, so a
+/// Motivator has to be patched whenever it moves. This table keeps its
+/// Motivators in place for their whole life, and gives out MotiveHandles
+/// instead. Resolve a handle with Get() to drive the Motivator as usual.
+///
+/// `MotivatorT` is the Motivator class held, for example Motivator1f.
+template <class MotivatorT>
+class MotivatorHandleTable {
+ public:
+  /// Create an uninitialized Motivator and return its handle. Initialize it
+  /// through Get().
+  MotiveHandle Create() {
+    uint32_t index;
+    if (!free_indices_.empty()) {
+      index = free_indices_.back();
+      free_indices_.pop_back();
+    } else {
+      index = static_cast<uint32_t>(motivators_.size());
+      motivators_.emplace_back();
+      generations_.push_back(1);
+    }
+    return MotiveHandle(index, generations_[index]);
+  }
+
+  /// Invalidate the Motivator referenced by `handle` and recycle its slot.
+  /// `handle`, and every copy of it, is stale afterwards. Does nothing if
+  /// `handle` is already stale.
+  void Destroy(MotiveHandle handle) {
+    MotivatorT* motivator = Get(handle);
+    if (motivator == nullptr) return;
+    motivator->Invalidate();
+
+    // Skip generation 0, which is reserved for invalid handles.
+    uint32_t& generation = generations_[handle.index];
+    if (++generation == 0) generation = 1;
+    free_indices_.push_back(handle.index);
+  }
+
+  /// Return the Motivator referenced by `handle`, or nullptr if `handle` is
+  /// stale. The address is stable until Destroy() is called.
+  MotivatorT* Get(MotiveHandle handle) {
+    return Alive(handle) ? &motivators_[handle.index] : nullptr;
+  }
+  const MotivatorT* Get(MotiveHandle handle) const {
+    return Alive(handle) ? &motivators_[handle.index] : nullptr;
+  }
+
+  /// True if `handle` was returned by Create() and not yet destroyed.
+  bool Alive(MotiveHandle handle) const {
+    return handle.generation != 0 && handle.index < generations_.size() &&
+           generations_[handle.index] == handle.generation;
+  }
+
+  /// Number of handles that are alive.
+  size_t Size() const { return motivators_.size() - free_indices_.size(); }
+
+  /// Destroy every initialized Motivator for which `expired(motivator)`
+  /// returns true, in one pass over the table. Motivators that were created
+  /// but not yet initialized are skipped. Returns the number destroyed.
+  template <class ExpiredFn>
+  size_t DestroyIf(const ExpiredFn& expired) {
+    if (Size() == 0) return 0;
+    size_t num_destroyed = 0;
+    for (uint32_t index = 0; index < motivators_.size(); ++index) {
+      MotivatorT& motivator = motivators_[index];
+      if (!motivator.Valid() || !expired(motivator)) continue;
+      Destroy(MotiveHandle(index, generations_[index]));
+      ++num_destroyed;
+    }
+    return num_destroyed;
+  }
+
+ private:
+  /// A deque never moves its elements when it grows, so the processors'
+  /// pointers to these Motivators stay valid.
+  std::deque<MotivatorT> motivators_;
+
+  /// Current generation of each slot in `motivators_`.
+  std::vector<uint32_t> generations_;
+
+  /// Slots released by Destroy(), for reuse by Create().
+  std::vector<uint32_t> free_indices_;
+};
+
+}  // namespace motive
+
+#endif  // MOTIVE_MOTIVATOR_HANDLE_H_
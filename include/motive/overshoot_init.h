@@ -34,6 +34,7 @@ class OvershootInit : public MotivatorInit {
         range_(Range::Full()),
         modular_(false),
         max_velocity_(0.0f),
+        max_delta_(0.0f),
         accel_per_difference_(0.0f),
         wrong_direction_multiplier_(0.0f),
         max_delta_time_(0) {}
@@ -57,6 +58,20 @@ class OvershootInit : public MotivatorInit {
     return at_target_.Settled(dist, velocity);
   }
 
+  /// Return true if `rhs` moves Motivators in exactly the same way. The
+  /// processor keeps one copy of each distinct set of parameters, shared by
+  /// every Motivator initialized with them.
+  bool SameParameters(const OvershootInit& rhs) const {
+    return range_ == rhs.range_ && modular_ == rhs.modular_ &&
+           max_velocity_ == rhs.max_velocity_ &&
+           max_delta_ == rhs.max_delta_ &&
+           at_target_.max_difference == rhs.at_target_.max_difference &&
+           at_target_.max_velocity == rhs.at_target_.max_velocity &&
+           accel_per_difference_ == rhs.accel_per_difference_ &&
+           wrong_direction_multiplier_ == rhs.wrong_direction_multiplier_ &&
+           max_delta_time_ == rhs.max_delta_time_;
+  }
+
   const Range& range() const { return range_; }
   void set_range(const Range& r) { range_ = r; }
   bool modular() const { return modular_; }
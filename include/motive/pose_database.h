@@ -0,0 +1,180 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_POSE_DATABASE_H_
+#define MOTIVE_POSE_DATABASE_H_
+
+#include <stdint.h>
+#include <limits>
+#include <vector>
+
+#include "mathfu/glsl_mappings.h"
+#include "motive/common.h"
+#include "motive/math/compact_spline.h"
+
+namespace motive {
+
+class AnimTable;
+class RigAnim;
+
+/// The pose of a PoseDatabase closest to a query, found by
+/// PoseDatabase::Search().
+struct PoseMatch {
+  PoseMatch()
+      : clip(-1),
+        pose(-1),
+        time(0.0f),
+        distance(std::numeric_limits<float>::infinity()) {}
+
+  /// Index into PoseDatabase::clips() of the animation, or -1 if none.
+  int clip;
+
+  /// Index of the pose in the database.
+  int pose;
+
+  /// Time of the pose in its animation.
+  float time;
+
+  /// Squared distance from the query, with each feature scaled by its
+  /// standard deviation over the database.
+  float distance;
+};
+
+/// @class PoseDatabase
+/// @brief Features of the poses of many animations, sampled at a fixed rate,
+///        for motion matching.
+///
+/// The features of a pose are the positions and velocities of a few bones,
+/// relative to the root, as RigMotivator::GlobalTransforms(). Build() samples
+/// the animations of an AnimTable, and each frame Search() finds the pose
+/// closest to the features of the character's current, or desired, motion.
+/// Play the match by passing Anim() and Playback() to
+/// RigMotivator::BlendToAnim().
+///
+/// Poses are stored in blocks of kPosesPerBlock, with the bounds of each
+/// block's features, so Search() only compares against the poses of blocks
+/// that could hold a closer match than the best found so far. Within a block
+/// the features are stored as a structure of arrays, so the comparisons
+/// vectorize. Search() doesn't allocate, and can be called from many threads
+/// at once.
+class PoseDatabase {
+ public:
+  /// Features of each bone: x, y, and z position, then x, y, and z velocity.
+  static const int kFeaturesPerBone = 6;
+
+  /// Most bones whose features can be matched.
+  static const int kMaxFeatureBones = 16;
+
+  /// Poses in each block of the search structure.
+  static const int kPosesPerBlock = 32;
+
+  /// A sampled animation.
+  struct Clip {
+    Clip() : anim(nullptr), first_pose(0), num_poses(0), pose_time(0.0f) {}
+
+    const RigAnim* anim;
+
+    /// Index of the clip's first pose in the database.
+    int first_pose;
+    int num_poses;
+
+    /// Time between the clip's poses.
+    float pose_time;
+  };
+
+  PoseDatabase() : num_poses_(0), num_features_(0) {}
+
+  /// Sample the animations `anim_indices` of `object` in `table`, with at
+  /// most `pose_time` between poses, matching the features of the
+  /// `num_bones` bones in `bones`. Each clip's poses are evenly spaced from
+  /// the start of its animation to its end, both included. Times are in the
+  /// units of the animations. Clips are sampled in parallel on the table's
+  /// task scheduler, if it has one.
+  /// Returns false if any animation is missing, or doesn't animate every bone
+  /// of the object's DefiningAnim(), or if there are more than
+  /// kMaxFeatureBones bones.
+  bool Build(const AnimTable& table, int object, const int* anim_indices,
+             int count, float pose_time, const BoneIndex* bones,
+             int num_bones);
+
+  /// Write the features of a rig to `features`, an array of NumFeatures().
+  /// `globals` and `previous_globals` are the rig's GlobalTransforms() now
+  /// and `delta_time` ago. Velocities are estimated from the difference, the
+  /// same way as Build() does.
+  void ComputeFeatures(const mathfu::AffineTransform* globals,
+                       const mathfu::AffineTransform* previous_globals,
+                       float delta_time, float* features) const;
+
+  /// Find the pose whose features are closest to `features`, an array of
+  /// NumFeatures(). Returns false if the database is empty.
+  bool Search(const float* features, PoseMatch* match) const;
+
+  /// The animation of `match`, to pass to RigMotivator::BlendToAnim().
+  const RigAnim& Anim(const PoseMatch& match) const {
+    return *clips_[match.clip].anim;
+  }
+
+  /// Playback that starts at the time of `match`, blending to it over
+  /// `blend_time`, to pass to RigMotivator::BlendToAnim().
+  SplinePlayback Playback(const PoseMatch& match, float blend_time) const;
+
+  /// Features of pose `pose`, unscaled, written to `features`, an array of
+  /// NumFeatures().
+  void PoseFeatures(int pose, float* features) const;
+
+  const std::vector<Clip>& clips() const { return clips_; }
+  int NumPoses() const { return num_poses_; }
+  int NumFeatures() const { return num_features_; }
+
+ private:
+  void Clear();
+
+  // Return the squared distance from `query` to the nearest point in the
+  // bounds of block `block`, a lower bound of the distance to its poses.
+  float BlockBound(const float* query, int block) const;
+
+  // Compare `query` to every pose of block `block`, and update `match` if
+  // one is closer.
+  void SearchBlock(const float* query, int block, PoseMatch* match) const;
+
+  int num_poses_;
+  int num_features_;
+  std::vector<Clip> clips_;
+
+  // Bones whose features are matched.
+  std::vector<BoneIndex> bones_;
+
+  // Scaled features of every pose. Block `b` holds poses
+  // [b * kPosesPerBlock, (b + 1) * kPosesPerBlock), with feature `f` of the
+  // `p`th pose at `features_[(b * num_features_ + f) * kPosesPerBlock + p]`.
+  // Poses past the end of the last block have infinite features.
+  std::vector<float> features_;
+
+  // Smallest and largest of each scaled feature in each block, at
+  // `[b * num_features_ + f]`.
+  std::vector<float> block_mins_;
+  std::vector<float> block_maxes_;
+
+  // Each feature is stored as (value - feature_means_) * feature_scales_,
+  // so that every feature varies by about as much as the others.
+  std::vector<float> feature_means_;
+  std::vector<float> feature_scales_;
+
+  // Clip of each pose.
+  std::vector<int> pose_clips_;
+};
+
+}  // namespace motive
+
+#endif  // MOTIVE_POSE_DATABASE_H_
@@ -0,0 +1,173 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_POSE_TEXTURE_H_
+#define MOTIVE_POSE_TEXTURE_H_
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mathfu/glsl_mappings.h"
+#include "motive/rig_processor.h"
+
+namespace motive {
+
+class AnimTable;
+
+/// Where a RigGpuPlayback reads from a PoseTexture. The GPU blends the
+/// `previous_` pose into the current one by `blend`, the same way as
+/// RigGpuPlayback. Frames are fractional, so the GPU can interpolate
+/// between the two nearest rows.
+struct PoseTextureSample {
+  PoseTextureSample()
+      : clip(-1),
+        frame(0.0f),
+        previous_clip(-1),
+        previous_frame(0.0f),
+        blend(1.0f) {}
+
+  int clip;
+  float frame;
+
+  /// -1 when nothing is being blended out.
+  int previous_clip;
+  float previous_frame;
+
+  float blend;
+};
+
+/// @class PoseTexture
+/// @brief Global bone transforms of several animations, baked at a fixed
+///        rate into a texture, for crowds that are animated on the GPU.
+///
+/// Each row of the texture is one frame of one clip. A row holds three texels
+/// per bone, which are the three rows of the bone's 3x4 affine matrix, as in
+/// SkinningOutput::kAffineFloat. The matrix of `bone` in frame `frame` of
+/// `clip` is then at texels (3 * bone + r, clips()[clip].first_frame + frame),
+/// for r = 0, 1, 2.
+///
+/// Each clip's frames are evenly spaced from the start of its animation to
+/// its end, both included, so that repeating clips loop seamlessly.
+///
+/// At runtime, put the rigs that are far away into GPU playback with
+/// RigMotivator::SetGpuPlayback(), and pass their RigMotivator::GpuPlayback()
+/// to Locate() to find which rows the GPU should sample.
+class PoseTexture {
+ public:
+  /// Format of each element of the texels.
+  enum Format {
+    /// 32-bit floats, for RGBA32F textures.
+    kFloat,
+
+    /// IEEE 754 half-precision floats, for RGBA16F textures.
+    kHalf,
+
+    /// Unsigned 16-bit integers, for RGBA16 textures. Element `c` of every
+    /// texel is decoded as DequantizeOffset(c) + DequantizeScale(c) * q, where
+    /// q is the normalized value, from 0 to 1, that the GPU samples.
+    kQuantized,
+  };
+
+  /// A baked animation.
+  struct Clip {
+    Clip() : first_frame(0), num_frames(0), duration(0.0f) {}
+
+    /// RigAnim::anim_name() of the animation.
+    std::string name;
+
+    /// Row of the clip's first frame.
+    uint32_t first_frame;
+    uint32_t num_frames;
+
+    /// RigAnim::end_time() of the animation.
+    float duration;
+  };
+
+  PoseTexture();
+
+  /// Bake the animations `anim_indices` of `object` in `table`, one clip each,
+  /// with at most `frame_time` between frames. Times are in the units of the
+  /// animations. The transforms are global, as RigMotivator::
+  /// GlobalTransforms() with no root motion bone, and are multiplied by
+  /// `inverse_bind_pose`, an array of one transform per bone, unless it is
+  /// nullptr. Clips are baked in parallel on the table's task scheduler, if it
+  /// has one.
+  /// Returns false if any animation is missing, or doesn't animate every bone
+  /// of the object's DefiningAnim().
+  bool Bake(const AnimTable& table, int object, const int* anim_indices,
+            int count, float frame_time, Format format,
+            const mathfu::AffineTransform* inverse_bind_pose = nullptr);
+
+  /// Append the texture and its metadata to `out`, for InitFromBuffer().
+  void Serialize(std::vector<uint8_t>* out) const;
+
+  /// Load a texture written by Serialize(). Returns false if `data` is
+  /// malformed, in which case the texture is left empty.
+  bool InitFromBuffer(const uint8_t* data, size_t size);
+
+  /// Find the rows of the texture that hold `playback`. Returns false if
+  /// `playback.anim` has not been baked into this texture, or is nullptr.
+  /// If only the previous animation is missing, it's skipped.
+  bool Locate(const RigGpuPlayback& playback, PoseTextureSample* sample) const;
+
+  /// Index into clips() of the animation called `name`, or -1.
+  int ClipIndex(const std::string& name) const;
+
+  /// Fractional frame of `clip` at `time`. `time` wraps if `repeat`, and is
+  /// clamped to the clip otherwise.
+  float FrameForTime(int clip, float time, bool repeat) const;
+
+  const std::vector<Clip>& clips() const { return clips_; }
+  Format format() const { return format_; }
+  int num_bones() const { return num_bones_; }
+
+  /// Dimensions of the texture, in RGBA texels.
+  int width() const { return 3 * num_bones_; }
+  int height() const { return num_frames_; }
+
+  /// Bytes of each element of a texel, and of the whole texture.
+  size_t ElementSize() const {
+    return format_ == kFloat ? sizeof(float) : sizeof(uint16_t);
+  }
+  size_t DataSize() const {
+    return static_cast<size_t>(width()) * height() * 4 * ElementSize();
+  }
+
+  /// The texels, row by row. DataSize() bytes.
+  const uint8_t* data() const { return data_.data(); }
+
+  /// Decodes element `c` of kQuantized texels. See Format.
+  float DequantizeOffset(int c) const { return dequantize_offset_[c]; }
+  float DequantizeScale(int c) const { return dequantize_scale_[c]; }
+
+ private:
+  void Clear();
+  void BuildClipIndices();
+  void Encode(const std::vector<float>& values);
+
+  Format format_;
+  int num_bones_;
+  int num_frames_;
+  std::vector<Clip> clips_;
+  std::unordered_map<std::string, int> clip_indices_;
+  float dequantize_offset_[4];
+  float dequantize_scale_[4];
+  std::vector<uint8_t> data_;
+};
+
+}  // namespace motive
+
+#endif  // MOTIVE_POSE_TEXTURE_H_
@@ -0,0 +1,122 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_PRESET_TABLE_H_
+#define MOTIVE_PRESET_TABLE_H_
+
+#include <assert.h>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "motive/overshoot_init.h"
+#include "motive/spline_init.h"
+
+namespace motive {
+
+/// Identifies a preset in a PresetTable.
+typedef int PresetId;
+static const PresetId kInvalidPresetId = -1;
+
+/// @class PresetTable
+/// @brief Named MotivatorInits, decoded once and shared by ID.
+///
+/// Load a config of OvershootParameters and SplineParameters with
+/// PresetTableFromFlatBuffers(), look up each preset's ID once with
+/// FindId(), and then initialize Motivators with Preset(id), instead of
+/// decoding the parameters for every Motivator.
+///
+/// Presets with the same parameters share one MotivatorInit. The
+/// MotivatorInits keep their addresses until Clear() or destruction.
+/// Overshoot processors also keep only one copy of each distinct set of
+/// parameters, so Motivators made from the same preset share it there too.
+class PresetTable {
+ public:
+  /// Add `init` under `name`, and return its ID. If `name` is already in the
+  /// table, it now finds the new preset.
+  PresetId AddOvershoot(const std::string& name, const OvershootInit& init) {
+    for (size_t i = 0; i < overshoots_.size(); ++i) {
+      if (overshoots_[i].SameParameters(init)) {
+        return AddPreset(name, &overshoots_[i]);
+      }
+    }
+    overshoots_.push_back(init);
+    return AddPreset(name, &overshoots_.back());
+  }
+
+  /// Same as AddOvershoot(), for Motivators that follow splines.
+  PresetId AddSpline(const std::string& name, const SplineInit& init) {
+    for (size_t i = 0; i < splines_.size(); ++i) {
+      if (splines_[i].range() == init.range()) {
+        return AddPreset(name, &splines_[i]);
+      }
+    }
+    splines_.push_back(init);
+    return AddPreset(name, &splines_.back());
+  }
+
+  /// Return the ID of the preset called `name`, or kInvalidPresetId if there
+  /// is none.
+  PresetId FindId(const std::string& name) const {
+    const auto it = ids_.find(name);
+    return it == ids_.end() ? kInvalidPresetId : it->second;
+  }
+
+  /// Return the preset with ID `id`. Pass it to Motivator::Initialize().
+  const MotivatorInit& Preset(PresetId id) const {
+    assert(0 <= id && id < NumPresets());
+    return *presets_[id];
+  }
+
+  /// Return the preset called `name`, or nullptr if there is none.
+  const MotivatorInit* Find(const std::string& name) const {
+    const PresetId id = FindId(name);
+    return id == kInvalidPresetId ? nullptr : presets_[id];
+  }
+
+  /// Number of presets added, including any whose names have been reused.
+  int NumPresets() const { return static_cast<int>(presets_.size()); }
+
+  /// Remove every preset. Motivators initialized from them keep working,
+  /// since processors copy the parameters they need.
+  void Clear() {
+    overshoots_.clear();
+    splines_.clear();
+    presets_.clear();
+    ids_.clear();
+  }
+
+ private:
+  PresetId AddPreset(const std::string& name, const MotivatorInit* init) {
+    const PresetId id = static_cast<PresetId>(presets_.size());
+    presets_.push_back(init);
+    ids_[name] = id;
+    return id;
+  }
+
+  /// Distinct parameters. Deques, so that they never move.
+  std::deque<OvershootInit> overshoots_;
+  std::deque<SplineInit> splines_;
+
+  /// Preset of each PresetId, pointing into `overshoots_` or `splines_`.
+  std::vector<const MotivatorInit*> presets_;
+
+  /// PresetId of each preset name.
+  std::unordered_map<std::string, PresetId> ids_;
+};
+
+}  // namespace motive
+
+#endif  // MOTIVE_PRESET_TABLE_H_
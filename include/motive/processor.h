@@ -15,19 +15,57 @@
 #ifndef MOTIVE_PROCESSOR_H_
 #define MOTIVE_PROCESSOR_H_
 
+#include <atomic>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "motive/common.h"
 #include "motive/math/compact_spline.h"
 #include "motive/math/vector_converter.h"
 #include "motive/target.h"
+#include "motive/util/allocator.h"
 #include "motive/util/index_allocator.h"
+#include "motive/util/memory_stats.h"
+#include "motive/util/recorder.h"
+#include "motive/util/snapshot.h"
 
 namespace motive {
 
 class Motivator;
 class MotiveEngine;
 
+/// @enum MotiveEventType
+/// @brief Things that MotiveProcessors report to the MotiveEngine during
+///        AdvanceFrame(). See MotiveEngine::events().
+enum MotiveEventType {
+  /// The animation played by a MatrixMotivator4f or RigMotivator has reached
+  /// its end. That is, its TimeRemaining() has dropped to 0. Repeating
+  /// animations never end.
+  kMotiveEventPlaybackEnded,
+
+  /// A Motivator has settled on its target, and will not move again until it
+  /// is given a new target.
+  kMotiveEventTargetReached,
+};
+
+/// @struct MotiveEvent
+/// @brief Records that `type` happened to `motivator` during a frame.
+struct MotiveEvent {
+  MotiveEvent(Motivator* motivator, MotiveEventType type)
+      : motivator(motivator), type(type) {}
+
+  /// Points to the Motivator when the event happened. No longer valid once
+  /// that Motivator has been moved or destroyed.
+  Motivator* motivator;
+  MotiveEventType type;
+};
+
+/// Minimum number of indices given to each task when a MotiveProcessor splits
+/// its AdvanceFrame() across a MotiveTaskScheduler. Smaller batches cost more
+/// in scheduling overhead than they gain in parallelism.
+static const int kMinIndicesPerTask = 64;
+
 /// @class MotiveProcessor
 /// @brief A MotiveProcessor processes *all* instances of one type of Motivator.
 ///
@@ -56,10 +94,19 @@ class MotiveEngine;
 class MotiveProcessor {
  public:
   MotiveProcessor()
-      : index_allocator_(allocator_callbacks_),
+      : num_suspended_(0),
+        index_allocator_(allocator_callbacks_),
         engine_(nullptr),
+        allocator_(MotiveAllocator::Default()),
+        defragment_max_moves_(-1),
+        defragment_max_microseconds_(-1),
+        double_buffered_(false),
+        recorder_(nullptr),
+        publish_sequence_(0),
+        publish_depth_(0),
         benchmark_id_for_advance_frame_(-1),
-        benchmark_id_for_init_(-1) {
+        benchmark_id_for_init_(-1),
+        underused_frames_(0) {
     allocator_callbacks_.set_processor(this);
   }
   virtual ~MotiveProcessor();
@@ -142,6 +189,29 @@ class MotiveProcessor {
   ///                   are determined by the user.
   virtual void AdvanceFrame(MotiveTime delta_time) = 0;
 
+  /// Recalculate the outputs of items that read from `dependency`, without
+  /// advancing time.
+  ///
+  /// This function should only be called by MotiveEngine::AdvanceFrame, and
+  /// only for dependencies registered with MotiveEngine::RegisterDependency().
+  /// It is called when `dependency` has advanced after this processor, or when
+  /// `dependency` has itself recalculated some of its outputs.
+  ///
+  /// @param dependency A processor that some of our items read from.
+  /// @return true if any outputs were recalculated. Our own dependents will
+  ///         then be given a chance to recalculate too.
+  virtual bool UpdateDependents(const MotiveProcessor* /*dependency*/) {
+    return false;
+  }
+
+  /// Evaluate the Motivator at `index` only on frames where `divisor` is due.
+  ///
+  /// This function should only be called by Motivator::SetUpdateDivisor().
+  /// The default implementation ignores `divisor`, and so evaluates every
+  /// frame. See MotiveEngine::frame_count() for the current frame number.
+  virtual void SetUpdateDivisor(MotiveIndex /*index*/,
+                                const MotiveUpdateDivisor& /*divisor*/) {}
+
   /// Should return kType of the MotivatorInit class for the derived processor.
   /// kType is defined by the macro MOTIVE_INTERFACE, which is put in
   /// a processor's MotivatorInit derivation.
@@ -153,6 +223,13 @@ class MotiveProcessor {
   /// we impose a strict ordering here.
   virtual int Priority() const = 0;
 
+  /// Static processors have values that only change when a Motivator is
+  /// initialized, removed, or given new targets. The MotiveEngine never calls
+  /// AdvanceFrame() on them, and removed indices are backfilled immediately
+  /// instead of on the next frame.
+  /// Should never change, like Priority().
+  virtual bool IsStatic() const { return false; }
+
   /// The number of slots occupied in the MotiveProcessor. For example,
   /// a position in 3D space would return 3. A single 4x4 matrix would return 1.
   MotiveDimension Dimensions(MotiveIndex index) const {
@@ -175,7 +252,187 @@ class MotiveProcessor {
   /// effect if it has been called before on this processor.
   void SetEngine(MotiveEngine* engine);
 
+  /// Pre-allocate storage for `count` indices, so that initializing
+  /// Motivators doesn't reallocate until more than `count` indices are in
+  /// use. Each dimension of a Motivator takes one index.
+  /// See MotiveEngine::Reserve().
+  void Reserve(MotiveIndex count);
+
+  /// Defragment fully, ignoring SetDefragmentBudget(), then release the
+  /// memory held beyond the indices in use, such as that left by Reserve()
+  /// or by a peak in the number of Motivators.
+  /// See MotiveEngine::Trim().
+  void Trim();
+
+  /// Trim() once fewer than a quarter of the indices that fit in the
+  /// processor's arrays have been in use for `frames` calls in a row.
+  /// Returns true if trimmed. See MotiveEngine::set_auto_trim_frames().
+  bool TrimIfUnderused(uint32_t frames);
+
+  /// Add the memory held by this processor to `stats`. Processors should
+  /// override this to add their own arrays, after calling the base version.
+  /// See MotiveEngine::GetMemoryStats().
+  virtual void AddMemoryStats(MemoryStats* stats) const;
+
+  /// Save, verify or restore this processor's state with `archive`.
+  /// Processors should override this to pass their own arrays, after
+  /// calling the base version. Arrays and values that Motivators' calls and
+  /// AdvanceFrame() change are state, and are passed to Array() or Value().
+  /// Those that only change when Motivators are initialized, moved or
+  /// removed are structure, and are passed to Layout(). Front buffers and
+  /// scratch space are left out.
+  /// When restoring, the outputs must match the restored state before the
+  /// next AdvanceFrame(), and every output counts as changed on the current
+  /// frame. See MotiveEngine::Snapshot().
+  virtual void ArchiveState(MotiveStateArchive* archive);
+
+  /// Spread the work of Defragment() over several frames. Each call moves at
+  /// most `max_moves` blocks of indices, and stops moving once
+  /// `max_microseconds` have passed. Negative values remove that limit, and
+  /// both are negative by default, so that Defragment() always finishes.
+  ///
+  /// While the indices are not fully defragmented, AdvanceFrame() still
+  /// processes the unused indices that remain, which have been reset.
+  void SetDefragmentBudget(int max_moves, int max_microseconds) {
+    defragment_max_moves_ = max_moves;
+    defragment_max_microseconds_ = max_microseconds;
+  }
+
+  /// Sets the allocator for this processor's data, moves the base class
+  /// arrays to it, then calls UseAllocator(). This function is called by the
+  /// MotiveEngine at creation time, before any indices are initialized.
+  void SetAllocator(MotiveAllocator* allocator);
+
+  /// Enable or disable the front buffer. When double buffered, the output
+  /// accessors (for example, MotiveProcessorNf::Values() or
+  /// MatrixProcessor4f::Value()) read from a copy of the outputs that is only
+  /// refreshed by UpdateFrontBuffer(). This lets the outputs be read while
+  /// AdvanceFrame() runs on another thread.
+  /// This function is called by the MotiveEngine.
+  void SetDoubleBuffered(bool double_buffered);
+  bool double_buffered() const { return double_buffered_; }
+
+  /// Log the calls made to this processor's Motivators to `recorder`, or stop
+  /// if nullptr. This function is called by the MotiveEngine.
+  /// See MotiveEngine::set_recorder().
+  void SetRecorder(MotiveRecorder* recorder) { recorder_ = recorder; }
+  MotiveRecorder* recorder() const { return recorder_; }
+
+  /// True if output accessors should read the front buffer. Always false on
+  /// threads that are advancing the engine, so that processors read the
+  /// latest outputs of the Motivators they depend on.
+  bool ReadFrontBuffer() const { return double_buffered_ && !advancing_; }
+
+  /// Call `read` so that it sees the front buffer of a single published
+  /// frame, without blocking the thread that advances and publishes frames.
+  /// `read` should copy out the outputs it needs. If a frame is published
+  /// while it runs, `read` is called again, so it must not have side
+  /// effects beyond those copies.
+  ///
+  /// The front buffer is reallocated when it grows, which `read` must not
+  /// overlap, so Reserve() enough indices before reading from another
+  /// thread while Motivators are being initialized. Has no effect on
+  /// consistency if the processor is not double buffered.
+  template <typename ReadFn>
+  void ReadPublished(const ReadFn& read) const {
+    for (;;) {
+      const uint32_t sequence =
+          publish_sequence_.load(std::memory_order_acquire);
+      if ((sequence & 1) == 0) {
+        read();
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (publish_sequence_.load(std::memory_order_relaxed) == sequence) {
+          return;
+        }
+      }
+      std::this_thread::yield();
+    }
+  }
+
+  /// @private For internal use only.
+  /// Held by the MotiveEngine around all work done in AdvanceFrame(), on
+  /// every thread that does some of that work.
+  class AdvancingScope {
+   public:
+    AdvancingScope() : previous_(advancing_) { advancing_ = true; }
+    ~AdvancingScope() { advancing_ = previous_; }
+
+   private:
+    bool previous_;
+  };
+
+  /// @private For internal use only.
+  /// Append the events pushed since the last call to `events`, and forget
+  /// them. Called by the MotiveEngine once the frame has been advanced.
+  void TakeEvents(std::vector<MotiveEvent>* events);
+
+  /// For each Motivator, its place in the order that indices should be
+  /// stored in. See ReorderIndices().
+  typedef std::unordered_map<const Motivator*, size_t> MotivatorRanks;
+
+  /// Defragment fully, then move the indices so that they're in the order
+  /// of their Motivators' `ranks`. Motivators without a rank go last, and
+  /// ties are grouped by IndexSource(), then kept in their current order.
+  /// Moves every index twice, so it's only done when requested.
+  /// This function should only be called by MotiveEngine::ReorderIndices().
+  void ReorderIndices(const MotivatorRanks& ranks);
+
+  /// Append the Motivators driven by the Motivators of this processor, in
+  /// index order. MotiveEngine::ReorderIndices() stores the children in
+  /// the order of their parents.
+  void AppendChildMotivators(std::vector<const Motivator*>* children) const;
+
+  /// Append the Motivators driven by the Motivator at `index`, for example
+  /// the bones of a rig. Processors whose Motivators drive others should
+  /// override this function.
+  virtual void AppendChildMotivatorsOf(
+      MotiveIndex /*index*/,
+      std::vector<const Motivator*>* /*children*/) const {}
+
+  /// Stop, or restart, advancing the Motivator at `index`. Suspended
+  /// Motivators are moved after the others by the next Defragment(), so that
+  /// they're outside the range that AdvanceFrame() processes. Processors that
+  /// override SuspendIndices() and ResumeIndices() keep their clocks running,
+  /// and catch up when resumed. Other processors evaluate them as usual.
+  /// This function should normally be called by
+  /// MotiveEngine::SuspendMotivators(), which suspends the children too.
+  void SetSuspended(MotiveIndex index, bool suspended);
+
+  /// True if the Motivator at `index` has been suspended by SetSuspended().
+  bool Suspended(MotiveIndex index) const {
+    return index < static_cast<MotiveIndex>(suspended_.size()) &&
+           suspended_[index] != 0;
+  }
+
+  /// Called by the MotiveEngine before each step, when it advances in fixed
+  /// steps. Processors that interpolate between steps should remember their
+  /// current outputs here. See MotiveEngine::set_fixed_time_step().
+  virtual void BeginFixedStep() {}
+
+  /// Called by the MotiveEngine right after AdvanceFrame(), on the same
+  /// thread. Processors that write their outputs into user buffers, in
+  /// formats of the user's choosing, should do so here.
+  virtual void WriteOutputs() {}
+
+  /// Defragment, then copy the outputs of every index into the front buffer.
+  /// Has no effect if the processor is not double buffered.
+  /// This function should only be called by the MotiveEngine while no
+  /// AdvanceFrame() is in flight.
+  void UpdateFrontBuffer();
+
  protected:
+  /// Called by SetSuspended() when [index, index + dimensions) is suspended.
+  /// Processors that skip suspended indices in AdvanceFrame() should
+  /// remember when they were suspended here.
+  virtual void SuspendIndices(MotiveIndex /*index*/,
+                              MotiveDimension /*dimensions*/) {}
+
+  /// Called by SetSuspended() when [index, index + dimensions) is resumed.
+  /// Processors that skip suspended indices should catch them up here, with
+  /// the time that passed while they were suspended.
+  virtual void ResumeIndices(MotiveIndex /*index*/,
+                             MotiveDimension /*dimensions*/) {}
+
   /// Initialize data at [index, index + dimensions).
   /// The meaning of `index` is determined by the MotiveProcessor
   /// implementation (most likely it is the index into one or more data_ arrays
@@ -222,20 +479,101 @@ class MotiveProcessor {
   /// new items in the arrays should be initialized as reset.
   virtual void SetNumIndices(MotiveIndex num_indices) = 0;
 
+  /// Hooks for intermediate base classes, such as MotiveProcessorNf, that
+  /// keep per-index data of their own. Called when indices are allocated to
+  /// a Motivator, along with RemoveIndices(), MoveIndices(), SetNumIndices(),
+  /// and CopyToFrontBuffer(), respectively. Concrete processors should use
+  /// the functions above and below.
+  virtual void InitializeBaseIndices(MotiveIndex /*index*/,
+                                     MotiveDimension /*dimensions*/) {}
+  virtual void RemoveBaseIndices(MotiveIndex /*index*/,
+                                 MotiveDimension /*dimensions*/) {}
+  virtual void MoveBaseIndices(MotiveIndex /*old_index*/,
+                               MotiveIndex /*new_index*/,
+                               MotiveDimension /*dimensions*/) {}
+  virtual void SetNumBaseIndices(MotiveIndex /*num_indices*/) {}
+  virtual void CopyBaseToFrontBuffer(MotiveIndex /*index*/,
+                                     MotiveDimension /*dimensions*/) {}
+
+  /// Same as UseAllocator(), for intermediate base classes. Called before
+  /// UseAllocator().
+  virtual void UseBaseAllocator(MotiveAllocator* /*allocator*/) {}
+
+  /// Copy the outputs at [index, index + dimensions) into the front buffer,
+  /// growing the front buffer if required. Processors that support double
+  /// buffering should override this function and read from the front buffer
+  /// in their output accessors when double_buffered() is true.
+  virtual void CopyToFrontBuffer(MotiveIndex /*index*/,
+                                 MotiveDimension /*dimensions*/) {}
+
+  /// The shared data that `index` reads from as it's processed, such as a
+  /// CompactSpline. ReorderIndices() stores indices with the same source
+  /// together, so that the source stays in cache.
+  virtual const void* IndexSource(MotiveIndex /*index*/) const {
+    return nullptr;
+  }
+
+  /// Pre-allocate the internal arrays for `count` indices. Processors
+  /// should override this to reserve every array that SetNumIndices() grows,
+  /// and refresh any pointers into them, since indices may already be live.
+  virtual void ReserveIndices(MotiveIndex /*count*/) {}
+
+  /// Release the memory held by the internal arrays beyond their size.
+  /// Processors should override this to shrink every array that
+  /// ReserveIndices() reserves, and refresh any pointers into them.
+  virtual void TrimIndices() {}
+
+  /// Called when the allocator is set, before any indices are initialized.
+  /// Processors should recreate each of their MotiveVector arrays with
+  /// `allocator` here, and pass it on to the helpers that hold arrays.
+  virtual void UseAllocator(MotiveAllocator* /*allocator*/) {}
+
   /// When an index is moved, the Motivator that references that index is
   /// updated. Can be called at the discretion of your MotiveProcessor,
   /// but normally called at the beginning of your
   /// MotiveProcessor::AdvanceFrame.
-  void Defragment() { index_allocator_.Defragment(); }
+  /// Moves are limited by SetDefragmentBudget(), so some unused indices may
+  /// remain afterwards. See ActiveIndexRanges().
+  void Defragment();
+
+  typedef IndexAllocator<MotiveIndex> MotiveIndexAllocator;
+  typedef MotiveIndexAllocator::IndexRange IndexRange;
+
+  /// The number of indices, including unused and suspended ones.
+  MotiveIndex NumAllocatedIndices() const {
+    return index_allocator_.num_indices();
+  }
+
+  /// The number of indices before the suspended ones. After Defragment(),
+  /// indices at or above this belong to suspended Motivators, and needn't be
+  /// advanced. See SetSuspended().
+  MotiveIndex NumActiveIndices() const {
+    return index_allocator_.num_indices() - num_suspended_;
+  }
+
+  /// Append the ranges of indices that are in use to `ranges`, for loops
+  /// that want to skip the unused indices left by a budgeted Defragment().
+  void ActiveIndexRanges(std::vector<IndexRange>* ranges) const {
+    index_allocator_.ActiveRanges(ranges);
+  }
+
+  /// Report `type` for the Motivator at `index`. It will appear in
+  /// MotiveEngine::events() once the frame has been advanced.
+  /// Must not be called concurrently, so only call it outside of the tasks
+  /// passed to MotiveEngine::ParallelFor().
+  void PushEvent(MotiveIndex index, MotiveEventType type);
+
+  /// Return the first index of the Motivator that occupies `index`.
+  MotiveIndex MotivatorIndex(MotiveIndex index) const;
 
   /// Return a handle to the MotiveEngine instance that owns this processor.
   MotiveEngine* Engine() { return engine_; }
   const MotiveEngine* Engine() const { return engine_; }
 
- private:
-  typedef IndexAllocator<MotiveIndex> MotiveIndexAllocator;
-  typedef MotiveIndexAllocator::IndexRange IndexRange;
+  /// Return the allocator for this processor's data. See SetAllocator().
+  MotiveAllocator* Allocator() const { return allocator_; }
 
+ private:
   /// Allocate an index for `motivator` and initialize it to that index. Returns
   /// the newly allocated index.
   MotiveIndex AllocateMotivatorIndices(Motivator* motivator,
@@ -244,10 +582,29 @@ class MotiveProcessor {
   /// Don't notify derived class.
   void RemoveMotivatorWithoutNotifying(MotiveIndex index);
 
+  /// Move the suspended indices after all the others, if they aren't already.
+  /// Called at the end of Defragment().
+  void PartitionSuspended();
+
+  /// Held around every write to the front buffer, and to the indices that
+  /// Motivators read it with. Makes `publish_sequence_` odd for the
+  /// duration, so that ReadPublished() retries. Nests.
+  class PublishScope {
+   public:
+    explicit PublishScope(MotiveProcessor* processor);
+    ~PublishScope();
+
+   private:
+    MotiveProcessor* processor_;
+  };
+
   /// Handle callbacks from IndexAllocator.
   void MoveIndexRangeBase(const IndexRange& source, MotiveIndex target);
   void SetNumIndicesBase(MotiveIndex num_indices);
 
+  /// Copy the outputs of base and derived classes into the front buffer.
+  void CopyToFrontBufferBase(MotiveIndex index, MotiveDimension dimensions);
+
   /// Proxy callbacks from IndexAllocator into MotiveProcessor.
   class AllocatorCallbacks : public MotiveIndexAllocator::CallbackInterface {
    public:
@@ -271,7 +628,14 @@ class MotiveProcessor {
   /// Note that we only keep a reference to a single Motivator per index.
   /// When a Motivator is moved, the old Motivator is Reset and the reference
   /// here is updated.
-  std::vector<Motivator*> motivators_;
+  MotiveVector<Motivator*> motivators_;
+
+  /// Non-zero for each index of a suspended Motivator. Moves with the
+  /// indices. See SetSuspended().
+  MotiveVector<uint8_t> suspended_;
+
+  /// The number of indices that are non-zero in `suspended_`.
+  MotiveIndex num_suspended_;
 
   /// Proxy calbacks into MotiveProcessor. The other option is to derive
   /// MotiveProcessor from IndexAllocator::CallbackInterface, but that would
@@ -290,8 +654,41 @@ class MotiveProcessor {
   /// are created outside of typical initialization times.
   MotiveEngine* engine_;
 
+  /// Source of memory for this processor's data. Not owned.
+  MotiveAllocator* allocator_;
+
+  /// Limits on the work done by each call to Defragment(). Negative for no
+  /// limit. See SetDefragmentBudget().
+  int defragment_max_moves_;
+  int defragment_max_microseconds_;
+
+  /// True if output accessors should read from the front buffer.
+  /// See SetDoubleBuffered().
+  bool double_buffered_;
+
+  /// Receives the calls made to this processor's Motivators, if not nullptr.
+  /// Not owned. See SetRecorder().
+  MotiveRecorder* recorder_;
+
+  /// Events pushed by PushEvent() that the MotiveEngine hasn't taken yet.
+  std::vector<MotiveEvent> events_;
+
+  /// Incremented at the start and end of each outermost PublishScope, so
+  /// odd while the front buffer is being written. See ReadPublished().
+  std::atomic<uint32_t> publish_sequence_;
+
+  /// Number of PublishScopes currently open. Only touched by the thread
+  /// that writes the front buffer.
+  int publish_depth_;
+
+  /// True while the current thread is inside an AdvancingScope.
+  static thread_local bool advancing_;
+
   int benchmark_id_for_advance_frame_;
   int benchmark_id_for_init_;
+
+  /// Consecutive calls to TrimIfUnderused() that found the arrays underused.
+  uint32_t underused_frames_;
 };
 
 /// Static functions in MotiveProcessor-derived classes.
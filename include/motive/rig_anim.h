@@ -25,7 +25,7 @@ namespace motive {
 /// @brief Animation for a RigMotivator. Drives a fully rigged model.
 class RigAnim {
  public:
-  RigAnim() : end_time_(0), repeat_(false) {}
+  RigAnim() : spline_block_used_(0), end_time_(0), repeat_(false) {}
 
   /// Initialize the basic data. After calling this function, `InitMatrixAnim()`
   /// should be called once for every bone in the animation.
@@ -39,12 +39,32 @@ class RigAnim {
   MatrixAnim& InitMatrixAnim(BoneIndex idx, BoneIndex parent,
                              const char* bone_name);
 
+  /// For construction. Reserve room for `num_splines` splines with
+  /// `num_nodes` nodes between them, and for `name_chars` characters of bone
+  /// names, including terminators. Call once, after Init(), when the sizes
+  /// are known up front. Splines from AllocateSpline() and names passed to
+  /// InitMatrixAnim() then fill the reserved memory instead of each being
+  /// allocated separately.
+  void Reserve(int num_splines, size_t num_nodes, size_t name_chars);
+
+  /// For construction. Returns memory for a CompactSpline of `max_nodes`
+  /// nodes, from the block reserved by Reserve(), or nullptr if the block is
+  /// full. The memory belongs to this RigAnim, so splines created in it must
+  /// not be destroyed. Mark their MatrixAnim::Spline as not `owned`.
+  void* AllocateSpline(CompactSplineIndex max_nodes);
+
   /// Return the animation of the `idx`th bone. Each bone animates a matrix.
   const MatrixAnim& Anim(BoneIndex idx) const {
     assert(idx < anims_.size());
     return anims_[idx];
   }
 
+  /// For construction. Non-const version of Anim().
+  MatrixAnim& Anim(BoneIndex idx) {
+    assert(idx < anims_.size());
+    return anims_[idx];
+  }
+
   /// Number of bones. Bones are arranged in an hierarchy. Each bone animates
   /// a matrix. The matrix describes the transform of the bone from its parent.
   BoneIndex NumBones() const { return static_cast<BoneIndex>(anims_.size()); }
@@ -54,7 +74,9 @@ class RigAnim {
   /// that doesn't match: with the bone names you can determine whether the
   /// mesh or the animation is out of date.
   const char* BoneName(BoneIndex idx) const {
-    return idx < bone_names_.size() ? bone_names_[idx].c_str() : "unknown";
+    return idx < bone_name_offsets_.size()
+               ? &bone_name_chars_[bone_name_offsets_[idx]]
+               : "unknown";
   }
 
   /// Total number of matrix operations across all MatrixAnims in this RigAnim.
@@ -113,6 +135,10 @@ class RigAnim {
   /// Set the repeat flag.
   bool set_repeat(bool repeat) { return repeat_ = repeat; }
 
+  /// Add the memory held by this animation to `stats`, including the op
+  /// tables and splines of every bone. sizeof(RigAnim) itself is not added.
+  void AddMemoryStats(MemoryStats* stats) const;
+
   /// For debugging. The name of the animation currently being played.
   /// Only valid if `record_names` is true in `Init()`.
   const std::string& anim_name() const { return anim_name_; }
@@ -120,7 +146,16 @@ class RigAnim {
  private:
   std::vector<MatrixAnim> anims_;
   std::vector<BoneIndex> bone_parents_;
-  std::vector<std::string> bone_names_;
+
+  /// Bone names are null-terminated strings in `bone_name_chars_`, starting
+  /// at `bone_name_offsets_`. Empty unless `record_names` was true in Init().
+  std::vector<char> bone_name_chars_;
+  std::vector<uint32_t> bone_name_offsets_;
+
+  /// Memory for splines, from Reserve().
+  std::vector<uint8_t> spline_block_;
+  size_t spline_block_used_;
+
   MotiveTime end_time_;
   bool repeat_;
   std::string anim_name_;
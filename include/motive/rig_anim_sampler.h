@@ -0,0 +1,105 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_RIG_ANIM_SAMPLER_H_
+#define MOTIVE_RIG_ANIM_SAMPLER_H_
+
+#include <vector>
+
+#include "mathfu/glsl_mappings.h"
+#include "motive/rig_anim.h"
+
+namespace motive {
+
+/// @class RigAnimSampler
+/// @brief Evaluate the bone transforms of a RigAnim at any time, without a
+///        MotiveEngine or RigMotivator.
+///
+/// Useful to predict poses, for example for hit reactions, AI look-ahead or
+/// thumbnails. The splines are evaluated directly, a batch at a time. The
+/// segment of each spline found by the last sample is remembered, so
+/// sampling at nearby times, in either direction, rarely searches.
+///
+/// Memory is allocated by Init() only. Sampling doesn't allocate, and
+/// doesn't touch any engine. Not thread safe: give each thread its own
+/// sampler. Many samplers can share one RigAnim.
+///
+/// The transforms match those of a RigMotivator playing the animation alone
+/// with no root motion bone, up to float rounding.
+class RigAnimSampler {
+ public:
+  RigAnimSampler() : anim_(nullptr) {}
+  explicit RigAnimSampler(const RigAnim& anim) : anim_(nullptr) { Init(anim); }
+
+  /// Prepare to sample `anim`, which must outlive the sampler.
+  void Init(const RigAnim& anim);
+
+  /// The animation being sampled, or nullptr before Init().
+  const RigAnim* anim() const { return anim_; }
+
+  /// Number of transforms written by LocalTransforms() and
+  /// GlobalTransforms().
+  BoneIndex NumBones() const {
+    return anim_ == nullptr ? 0 : anim_->NumBones();
+  }
+
+  /// Write the transform of every bone, relative to its parent, at `time` to
+  /// `out`, an array of NumBones(). If `repeat`, times past the end of a
+  /// spline wrap back to its start, as with SplinePlayback::repeat.
+  /// Otherwise, each spline holds its end value.
+  void LocalTransforms(float time, bool repeat, mathfu::AffineTransform* out);
+
+  /// Same as LocalTransforms(), but each bone's transform is relative to the
+  /// root, as RigMotivator::GlobalTransforms().
+  void GlobalTransforms(float time, bool repeat, mathfu::AffineTransform* out);
+
+ private:
+  // One operation of a bone's MatrixAnim.
+  struct Op {
+    MatrixOperationType type;
+
+    // The spline that drives the op, or nullptr if it's constant.
+    const CompactSpline* spline;
+  };
+
+  // Evaluate every op at `time` into `values_`.
+  void EvaluateOps(float time, bool repeat);
+
+  const RigAnim* anim_;
+
+  // Ops of every bone, in order. Bone i has ops [bone_ops_[i],
+  // bone_ops_[i + 1]).
+  std::vector<Op> ops_;
+  std::vector<int> bone_ops_;
+
+  // Value of each op at the last sampled time. Constant ops are set by
+  // Init().
+  std::vector<float> values_;
+
+  // Indices into `ops_` of the ops driven by splines.
+  std::vector<int> spline_ops_;
+
+  // Segment of each spline op found by the last sample, the first guess for
+  // the next one.
+  std::vector<CompactSplineIndex> segment_hints_;
+
+  // Scratch space for GlobalTransforms().
+  std::vector<mathfu::AffineTransform,
+              mathfu::simd_allocator<mathfu::AffineTransform>>
+      local_transforms_;
+};
+
+}  // namespace motive
+
+#endif  // MOTIVE_RIG_ANIM_SAMPLER_H_
@@ -15,6 +15,8 @@
 #ifndef MOTIVE_RIG_INIT_H_
 #define MOTIVE_RIG_INIT_H_
 
+#include <vector>
+
 #include "motive/common.h"
 #include "mathfu/glsl_mappings.h"
 
@@ -34,6 +36,32 @@ class RigInit : public MotivatorInit {
   }
   const BoneIndex root_motion_bone() const { return root_motion_bone_; }
 
+  /// Only evaluate the bones in `bone_mask`, and their ancestors. The other
+  /// bones keep their default pose. If empty, every bone is evaluated.
+  const std::vector<BoneIndex>& bone_mask() const { return bone_mask_; }
+  void set_bone_mask(const std::vector<BoneIndex>& bone_mask) {
+    bone_mask_ = bone_mask;
+  }
+
+  /// Levels of detail, from most to least detailed, selected with
+  /// RigMotivator::SetLod(). LOD 0, the default, evaluates every bone in the
+  /// bone mask. LOD `l` > 0 only evaluates the bones in `lods()[l - 1]`, and
+  /// their ancestors. The other bones have no motivators, and follow their
+  /// parent at their offset in the defining animation's default pose.
+  const std::vector<std::vector<BoneIndex>>& lods() const { return lods_; }
+  void set_lods(const std::vector<std::vector<BoneIndex>>& lods) {
+    lods_ = lods;
+  }
+
+  /// Return the bones of the hierarchy defined by `parents` that are at least
+  /// `num_leaf_levels` levels above their deepest descendant leaf. With 1,
+  /// only the leaves are culled, and their parents are kept. Passed to
+  /// set_lods(), each extra level culls another layer of leaves, such as
+  /// finger tips, then fingers.
+  static std::vector<BoneIndex> CullLeafBones(const BoneIndex* parents,
+                                              BoneIndex num_bones,
+                                              int num_leaf_levels);
+
   // Utility functions. Ensure that animations are compatible with rigs.
   static bool MatchesHierarchy(const BoneIndex* parents_a, BoneIndex len_a,
                                const BoneIndex* parents_b, BoneIndex len_b);
@@ -60,6 +88,12 @@ class RigInit : public MotivatorInit {
   /// be accessed using RigMotivator::RootMotionTransform(). If kInvalidBoneIdx,
   /// root motion will not be extracted.
   BoneIndex root_motion_bone_;
+
+  /// The bones that need to be evaluated. See bone_mask().
+  std::vector<BoneIndex> bone_mask_;
+
+  /// The bones evaluated at each level of detail. See lods().
+  std::vector<std::vector<BoneIndex>> lods_;
 };
 
 }  // namespace motive
@@ -15,6 +15,8 @@
 #ifndef MOTIVE_RIG_MOTIVATOR_H_
 #define MOTIVE_RIG_MOTIVATOR_H_
 
+#include <vector>
+
 #include "motive/motivator.h"
 #include "motive/rig_processor.h"
 
@@ -40,28 +42,67 @@ class RigMotivator : public Motivator {
   /// If the current state is unspecified because no animation has yet been
   /// played, snap to `anim`.
   void BlendToAnim(const RigAnim& anim, const SplinePlayback& playback) {
+    MotiveRecorder* recorder = processor_->recorder();
+    if (recorder != nullptr) {
+      recorder->RecordBlendToAnim(this, anim, playback);
+    }
+    const MotiveRecorder::NestedScope nested(recorder);
     Processor().BlendToAnim(index_, anim, playback);
   }
 
+  /// Same as calling BlendToAnim() on each of the `count` rigs in `rigs`, but
+  /// the bone motivators of every rig are blended together, a bone at a time.
+  /// Prefer this when switching a crowd to a new animation. The rigs must all
+  /// belong to the same engine, and appear only once.
+  static void BlendToAnimInBulk(RigMotivator* const* rigs, int count,
+                                const RigAnim& anim,
+                                const SplinePlayback& playback) {
+    if (count <= 0) return;
+    MotiveRecorder* recorder = rigs[0]->processor_->recorder();
+    std::vector<MotiveIndex> indices(count);
+    for (int i = 0; i < count; ++i) {
+      assert(rigs[i]->processor_ == rigs[0]->processor_);
+      indices[i] = rigs[i]->index_;
+      if (recorder != nullptr) {
+        recorder->RecordBlendToAnim(rigs[i], anim, playback);
+      }
+    }
+    const MotiveRecorder::NestedScope nested(recorder);
+    rigs[0]->Processor().BlendToAnimAt(indices.data(), count, anim, playback);
+  }
+
   /// Blend from the current state to the animations specified in `anims`,
   /// blending them according to `weights`. Blend time and playback parameters
   /// for each animation are specified in `playbacks`. All arguments must
   /// contain at least `count` elements.
   /// If the current state is unspecified because no animation has yet been
   /// played, snap to `anims`.
+  /// Once every animation but one has a weight of zero and has finished
+  /// playing, the others are released and the remaining animation becomes the
+  /// only one, at index 0, and the CurrentAnim().
   void BlendToAnims(const RigAnim** anims, const SplinePlayback* playbacks,
                     const float* weights, int count) {
+    MotiveRecorder* recorder = processor_->recorder();
+    if (recorder != nullptr) {
+      recorder->RecordBlendToAnims(this, anims, playbacks, weights, count);
+    }
+    const MotiveRecorder::NestedScope nested(recorder);
     Processor().BlendToAnims(index_, anims, playbacks, weights, count);
   }
 
   /// Instantly change the playback speed of this animation. If multiple
   /// animations are running, changes the playback speed for all of them.
   void SetPlaybackRate(float playback_rate) {
+    if (processor_->recorder() != nullptr) {
+      processor_->recorder()->RecordSetPlaybackRate(this, playback_rate);
+    }
     Processor().SetPlaybackRate(index_, playback_rate);
   }
 
   /// Instantly change the playback speed of individual animations. If there
   /// are more animations than `count`, their playback speeds remain unchanged.
+  /// If there are fewer, the extra rates are ignored. This happens once a
+  /// blend collapses to a single animation, as described in BlendToAnims().
   void SetPlaybackRates(const float* playback_rates, int count) {
     Processor().SetPlaybackRates(index_, playback_rates, count);
   }
@@ -72,6 +113,16 @@ class RigMotivator : public Motivator {
     Processor().SetWeights(index_, weights, count);
   }
 
+  /// Add the `count` animations in `layers` on top of the blended animations,
+  /// replacing any earlier layers. Each layer's difference from its reference
+  /// pose, scaled by its weight, is applied to every bone, so aim, lean or
+  /// breathing animations can play over any base animation. Layers have
+  /// their own playback, unaffected by BlendToAnim(), SetPlaybackRate() and
+  /// SetRepeating(). A `count` of 0 removes every layer.
+  void SetAdditiveLayers(const RigAdditiveLayer* layers, int count) {
+    Processor().SetAdditiveLayers(index_, layers, count);
+  }
+
   /// Instantly change the repeat state of this animation. If multiple
   /// animations are running changes the repeat state of all of them. If the
   /// current animation is done playing, has no effect.
@@ -79,6 +130,80 @@ class RigMotivator : public Motivator {
     Processor().SetRepeating(index_, repeat);
   }
 
+  /// Share global transforms with other rigs that have the same defining
+  /// animation and are playing the same animation, with the same playback
+  /// parameters, at the same time. The transforms are only calculated for one
+  /// of the rigs. Times are rounded down to a multiple of `time_quantum` before
+  /// being compared, so larger quanta share more rigs at the cost of accuracy.
+  /// Only rigs that last called BlendToAnim(), and have finished blending,
+  /// are shared. Pass 0 to stop sharing.
+  void SetInstanceTimeQuantum(MotiveTime time_quantum) {
+    Processor().SetInstanceTimeQuantum(index_, time_quantum);
+  }
+
+  /// Only evaluate the `count` bones in `bones`, and their ancestors. The
+  /// motivators of the other bones are released, and their global transforms
+  /// are no longer updated. If `count` is 0, evaluate every bone.
+  /// Overrides the mask set in RigInit::set_bone_mask().
+  void SetBoneMask(const BoneIndex* bones, int count) {
+    Processor().SetBoneMask(index_, bones, count);
+  }
+
+  /// Switch to level of detail `lod`, from those set by RigInit::set_lods().
+  /// 0 evaluates every bone. Bones culled at this level have their motivators
+  /// released, so their processors skip them, and follow their parent at
+  /// their default pose offset. Bones that come back pick up the current
+  /// animation, as with SetBoneMask().
+  void SetLod(int lod) { Processor().SetLod(index_, lod); }
+
+  /// When `gpu`, stop evaluating the rig on the CPU, and only track which
+  /// animations are playing, where they're up to, and how far they've
+  /// blended. Read that with GpuPlayback(), and look it up in a PoseTexture
+  /// to animate far-away crowds on the GPU. The bones' motivators are
+  /// released, and GlobalTransforms() keeps its last value.
+  /// When turned off again, the bones pick up the current animation at its
+  /// current time. Only BlendToAnim() is tracked; BlendToAnims() is not
+  /// supported in GPU playback.
+  void SetGpuPlayback(bool gpu) { Processor().SetGpuPlayback(index_, gpu); }
+
+  /// Set `playback` to the animations, times and blend that the GPU should
+  /// sample. Returns false unless SetGpuPlayback(true) has been called.
+  bool GpuPlayback(RigGpuPlayback* playback) const {
+    return Processor().GpuPlayback(index_, playback);
+  }
+
+  /// Write final skinning matrices straight into `output`, for example a
+  /// mapped GPU buffer, whenever the global transforms are calculated. This
+  /// saves copying GlobalTransforms() and multiplying by the inverse bind pose
+  /// afterwards. The buffer must stay valid until a default SkinningOutput is
+  /// set, or the rig is destroyed. It's written while the engine advances, so
+  /// it must not be in use by the GPU during AdvanceFrame().
+  void SetSkinningOutput(const SkinningOutput& output) {
+    Processor().SetSkinningOutput(index_, output);
+  }
+
+  /// When `lazy`, AdvanceFrame() doesn't calculate the global transforms.
+  /// Instead, they're calculated the first time GlobalTransforms() or
+  /// RootMotionTransform() is called after the frame advances. Rigs that are
+  /// not read, for example because they're off-screen, then cost nothing but
+  /// their bone motivators.
+  /// Reading a lazy rig is not thread safe. When the engine is double
+  /// buffered, lazy rigs are calculated anyway, before the buffers swap.
+  void SetLazy(bool lazy) { Processor().SetLazy(index_, lazy); }
+
+  /// Calculate the global transforms of the `count` lazy rigs in `rigs` in
+  /// one batch, which is split across the engine's task scheduler if it has
+  /// one. The rigs must all belong to the same engine.
+  static void ResolveDirty(RigMotivator* const* rigs, int count) {
+    if (count <= 0) return;
+    std::vector<MotiveIndex> indices(count);
+    for (int i = 0; i < count; ++i) {
+      assert(rigs[i]->processor_ == rigs[0]->processor_);
+      indices[i] = rigs[i]->index_;
+    }
+    rigs[0]->Processor().ResolveDirty(indices.data(), count);
+  }
+
   /// Returns array of matricies: one for each bone position. The matrices are
   /// all in the space of the root bones. That is, the bone hierarchy has been
   /// flattened.
@@ -21,6 +21,125 @@ namespace motive {
 
 class RigAnim;
 
+/// @class SkinningOutput
+/// @brief Destination for a rig's skinning matrices, written whenever the
+///        rig's global transforms are calculated.
+///
+/// The skinning matrix of bone i is its global transform multiplied by
+/// `inverse_bind_pose[i]`. It's written to `data + i * stride`, typically in
+/// a mapped GPU buffer.
+struct SkinningOutput {
+  enum Format {
+    /// Three rows of four floats, in row-major order.
+    kAffineFloat,
+
+    /// Four columns of four floats, in column-major order, like mathfu::mat4.
+    kMatrixFloat,
+
+    /// As kAffineFloat, but with IEEE 754 half-precision floats.
+    kAffineHalf,
+
+    /// As kMatrixFloat, but with IEEE 754 half-precision floats.
+    kMatrixHalf,
+  };
+
+  SkinningOutput()
+      : data(nullptr),
+        stride(0),
+        format(kAffineFloat),
+        inverse_bind_pose(nullptr) {}
+  SkinningOutput(void* data, size_t stride, Format format,
+                 const mathfu::AffineTransform* inverse_bind_pose = nullptr)
+      : data(data),
+        stride(stride),
+        format(format),
+        inverse_bind_pose(inverse_bind_pose) {}
+
+  /// Size of one bone's matrix, in bytes. `stride` must be at least this.
+  size_t MatrixSize() const {
+    const size_t elements =
+        format == kAffineFloat || format == kAffineHalf ? 12 : 16;
+    const size_t element_size =
+        format == kAffineFloat || format == kMatrixFloat ? sizeof(float)
+                                                         : sizeof(uint16_t);
+    return elements * element_size;
+  }
+
+  /// Where to write the matrices. Nothing is written when nullptr.
+  void* data;
+
+  /// Distance between the matrices of consecutive bones, in bytes.
+  size_t stride;
+
+  /// Layout and precision of each matrix.
+  Format format;
+
+  /// One transform per bone, or nullptr to write the global transforms as is.
+  const mathfu::AffineTransform* inverse_bind_pose;
+};
+
+/// Playback state of a rig whose pose is evaluated on the GPU, for example
+/// from a PoseTexture. The pose is `blend` of `anim` at `time`, plus
+/// 1 - `blend` of `previous_anim` at `previous_time`. Times are in the
+/// animations' own time, and are not wrapped or clamped to their ends.
+struct RigGpuPlayback {
+  RigGpuPlayback()
+      : anim(nullptr),
+        time(0.0f),
+        repeat(false),
+        previous_anim(nullptr),
+        previous_time(0.0f),
+        previous_repeat(false),
+        blend(1.0f) {}
+
+  /// The animation passed to the most recent BlendToAnim(), or nullptr if
+  /// none has been played.
+  const RigAnim* anim;
+  float time;
+  bool repeat;
+
+  /// The animation being blended out, or nullptr if there is none.
+  const RigAnim* previous_anim;
+  float previous_time;
+  bool previous_repeat;
+
+  /// Weight of `anim`, from 0 at the start of the blend to 1 at its end.
+  float blend;
+};
+
+/// An animation added on top of a rig's blended animations, for example to
+/// aim, lean or breathe. Each bone's transform in `anim` is compared to its
+/// transform in the reference pose, and `weight` of the difference is applied
+/// to the bone's blended transform: translations are offset, rotations are
+/// turned and scales are multiplied.
+struct RigAdditiveLayer {
+  RigAdditiveLayer()
+      : anim(nullptr),
+        weight(1.0f),
+        reference_anim(nullptr),
+        reference_time(0.0f) {}
+  RigAdditiveLayer(const RigAnim* anim, const SplinePlayback& playback,
+                   float weight, const RigAnim* reference_anim = nullptr,
+                   float reference_time = 0.0f)
+      : anim(anim),
+        playback(playback),
+        weight(weight),
+        reference_anim(reference_anim),
+        reference_time(reference_time) {}
+
+  /// The animation to add, and how to play it.
+  const RigAnim* anim;
+  SplinePlayback playback;
+
+  /// 0 adds nothing, 1 adds the whole difference from the reference pose.
+  float weight;
+
+  /// The pose that `anim` is relative to, sampled once at `reference_time`.
+  /// If nullptr, `anim` itself is sampled.
+  const RigAnim* reference_anim;
+  float reference_time;
+};
+
 class RigProcessor : public MotiveProcessor {
  public:
   /// Returns an array of length `DefiningAnim.NumBones()`.
@@ -56,6 +175,27 @@ class RigProcessor : public MotiveProcessor {
   virtual void BlendToAnim(MotiveIndex index, const RigAnim& anim,
                            const motive::SplinePlayback& playback) = 0;
 
+  /// Same as calling BlendToAnim() on each of the `count` distinct `indices`.
+  /// Processors can override this to blend the same bone of every rig
+  /// together.
+  virtual void BlendToAnimAt(const MotiveIndex* indices, MotiveIndex count,
+                             const RigAnim& anim,
+                             const motive::SplinePlayback& playback) {
+    for (MotiveIndex i = 0; i < count; ++i) {
+      BlendToAnim(indices[i], anim, playback);
+    }
+  }
+
+  /// Move every rig that is playing `old_anim` on its own onto `new_anim`,
+  /// from the same playback time, blending over `blend_time`. Used to
+  /// hot-reload animations. Rigs that are blending several animations are
+  /// left as they are. Returns the number of rigs moved.
+  virtual int ReplaceAnim(const RigAnim& /*old_anim*/,
+                          const RigAnim& /*new_anim*/,
+                          MotiveTime /*blend_time*/) {
+    return 0;
+  }
+
   /// Smoothly transition to the animations in `anims`, blending them according
   /// to `weights` and using `playbacks` for each transition. All arguments must
   /// contain at least `count` elements.
@@ -74,11 +214,56 @@ class RigProcessor : public MotiveProcessor {
   /// Instantly change the weights of running animations.
   virtual void SetWeights(MotiveIndex index, const float* weights, int count) {}
 
+  /// Replace the additive layers with the `count` layers in `layers`. Layers
+  /// keep playing when the animations under them change. A `count` of 0
+  /// removes every layer.
+  virtual void SetAdditiveLayers(MotiveIndex index,
+                                 const RigAdditiveLayer* layers, int count) {}
+
   /// Instantly change the repeat state of this animation. If multiple
   /// animations are running, set the repeat state for all of them. If no
   /// animations are running, has no effect.
   virtual void SetRepeating(MotiveIndex index, bool repeat) {}
 
+  /// Let rigs that play the same animation at the same time share global
+  /// transforms, which are then only calculated once. Playback times are
+  /// compared after rounding down to a multiple of `time_quantum`, so larger
+  /// quanta share more rigs at the cost of accuracy. 0 stops sharing.
+  virtual void SetInstanceTimeQuantum(MotiveIndex index,
+                                      MotiveTime time_quantum) {}
+
+  /// Write skinning matrices to `output` whenever the global transforms are
+  /// calculated. Pass a default SkinningOutput to stop.
+  virtual void SetSkinningOutput(MotiveIndex index,
+                                 const SkinningOutput& output) {}
+
+  /// When `lazy`, only calculate global transforms when they're read, instead
+  /// of on every AdvanceFrame().
+  virtual void SetLazy(MotiveIndex index, bool lazy) {}
+
+  /// Calculate the global transforms of the `count` rigs in `indices`, if
+  /// they're lazy and out of date.
+  virtual void ResolveDirty(const MotiveIndex* indices, int count) {}
+
+  /// Only evaluate the `count` bones in `bones`, and their ancestors. If
+  /// `count` is 0, evaluate every bone.
+  virtual void SetBoneMask(MotiveIndex index, const BoneIndex* bones,
+                           int count) {}
+
+  /// Switch to level of detail `lod`. See RigInit::lods().
+  virtual void SetLod(MotiveIndex index, int lod) {}
+
+  /// When `gpu`, don't evaluate any bones. Only track the playback state,
+  /// for GpuPlayback().
+  virtual void SetGpuPlayback(MotiveIndex index, bool gpu) {}
+
+  /// Set `playback` to the state of a rig in GPU playback. Returns false if
+  /// the rig is not in GPU playback.
+  virtual bool GpuPlayback(MotiveIndex index,
+                           RigGpuPlayback* playback) const {
+    return false;
+  }
+
   virtual std::string CsvHeaderForDebugging(MotiveIndex /*index*/) const {
     return std::string();
   }
@@ -38,7 +38,7 @@ class SimpleProcessorTemplate : public MotiveProcessorNf {
 
   // Accessors to allow the user to get and set simluation values.
   virtual const float* Values(MotiveIndex index) const {
-    return &values_[index];
+    return ReadFrontBuffer() ? &front_values_[index] : &values_[index];
   }
 
   virtual void Velocities(MotiveIndex index, MotiveDimension dimensions,
@@ -108,11 +108,51 @@ class SimpleProcessorTemplate : public MotiveProcessorNf {
     }
   }
 
+  virtual void UseBaseAllocator(MotiveAllocator* allocator) {
+    MotiveProcessorNf::UseBaseAllocator(allocator);
+    data_ = MotiveVector<T>(MotiveStdAllocator<T>(allocator));
+    values_ = MotiveVector<float>(MotiveStdAllocator<float>(allocator));
+    front_values_ = MotiveVector<float>(MotiveStdAllocator<float>(allocator));
+  }
+
   virtual void SetNumIndices(MotiveIndex num_indices) {
     data_.resize(num_indices);
     values_.resize(num_indices);
   }
 
+  virtual void ReserveIndices(MotiveIndex count) {
+    data_.reserve(count);
+    values_.reserve(count);
+    if (double_buffered()) front_values_.reserve(count);
+  }
+
+  virtual void TrimIndices() {
+    MotiveProcessorNf::TrimIndices();
+    data_.shrink_to_fit();
+    values_.shrink_to_fit();
+    front_values_.shrink_to_fit();
+  }
+
+  virtual void AddMemoryStats(MemoryStats* stats) const {
+    MotiveProcessorNf::AddMemoryStats(stats);
+    stats->AddVector(data_);
+    stats->AddVector(values_);
+    stats->AddVector(front_values_);
+  }
+
+  virtual void ArchiveState(MotiveStateArchive* archive) {
+    MotiveProcessorNf::ArchiveState(archive);
+    archive->Array(&data_);
+    archive->Array(&values_);
+  }
+
+  virtual void CopyToFrontBuffer(MotiveIndex index,
+                                 MotiveDimension dimensions) {
+    front_values_.resize(values_.size());
+    std::copy(values_.begin() + index, values_.begin() + index + dimensions,
+              front_values_.begin() + index);
+  }
+
   const T& Data(MotiveIndex index) const {
     assert(ValidIndex(index));
     return data_[index];
@@ -123,8 +163,11 @@ class SimpleProcessorTemplate : public MotiveProcessorNf {
     return data_[index];
   }
 
-  std::vector<T> data_;
-  std::vector<float> values_;
+  MotiveVector<T> data_;
+  MotiveVector<float> values_;
+
+  // Copy of `values_` that's read by Values() when double buffered.
+  MotiveVector<float> front_values_;
 };
 
 }  // namespace motive
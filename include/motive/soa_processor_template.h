@@ -0,0 +1,253 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_SOA_PROCESSOR_TEMPLATE_H_
+#define MOTIVE_SOA_PROCESSOR_TEMPLATE_H_
+
+#include <algorithm>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "motive/engine.h"
+#include "motive/vector_processor.h"
+
+namespace motive {
+
+/// @class SoaProcessorTemplate
+/// @brief Base class for MotiveProcessorNf's whose per-index state is stored
+///        as a structure-of-arrays.
+///
+/// `Fields` lists the type of each piece of per-index state. Each field is
+/// stored in its own contiguous array, accessed with Field<k>(), so that
+/// AdvanceFrame() can loop over one field at a time. Those loops are easily
+/// vectorized by the compiler, unlike loops over an array of structs.
+///
+/// For example, a processor that stores a target value and a target time for
+/// each index would derive from `SoaProcessorTemplate<float, float>`, and
+/// read the target times with `Field<1>()[index]`.
+///
+/// Moving, removing, and resizing indices is handled generically for every
+/// field, as are the current values and the double-buffered copy of them.
+/// Every array is held in the processor's Allocator().
+/// Derived classes only need to implement the simulation and the
+/// MotiveProcessorNf accessors.
+template <class... Fields>
+class SoaProcessorTemplate : public MotiveProcessorNf {
+ public:
+  virtual ~SoaProcessorTemplate() {}
+
+  const float* Values(MotiveIndex index) const override {
+    return ReadFrontBuffer() ? &front_values_[index] : &values_[index];
+  }
+
+ protected:
+  /// The type of the field at position `kField` in `Fields`.
+  template <size_t kField>
+  using FieldType =
+      typename std::tuple_element<kField, std::tuple<Fields...>>::type;
+
+  /// The array that holds field `kField` of every index.
+  template <size_t kField>
+  MotiveVector<FieldType<kField>>& Field() {
+    return std::get<kField>(fields_);
+  }
+
+  template <size_t kField>
+  const MotiveVector<FieldType<kField>>& Field() const {
+    return std::get<kField>(fields_);
+  }
+
+  /// Reset every field to its default value, and the current value to 0.
+  /// Derived classes that override this should call it first.
+  void RemoveIndices(MotiveIndex index, MotiveDimension dimensions) override {
+    ForEachArray(ResetRange(index, dimensions));
+    std::fill(values_.begin() + index, values_.begin() + index + dimensions,
+              0.0f);
+  }
+
+  void MoveIndices(MotiveIndex old_index, MotiveIndex new_index,
+                   MotiveDimension dimensions) override {
+    ForEachArray(MoveRange(old_index, new_index, dimensions));
+    std::copy(values_.begin() + old_index,
+              values_.begin() + old_index + dimensions,
+              values_.begin() + new_index);
+  }
+
+  /// Derived classes that override this should call it first.
+  void UseBaseAllocator(MotiveAllocator* allocator) override {
+    MotiveProcessorNf::UseBaseAllocator(allocator);
+    ForEachArray(UseAllocatorOp(allocator));
+    values_ = MotiveVector<float>(MotiveStdAllocator<float>(allocator));
+    front_values_ = MotiveVector<float>(MotiveStdAllocator<float>(allocator));
+  }
+
+  void SetNumIndices(MotiveIndex num_indices) override {
+    ForEachArray(Resize(num_indices));
+    values_.resize(num_indices);
+    SetBulkValues(values_.data(), front_values_.data());
+  }
+
+  void ReserveIndices(MotiveIndex count) override {
+    ForEachArray(Reserve(count));
+    values_.reserve(count);
+    if (double_buffered()) front_values_.reserve(count);
+    SetBulkValues(values_.data(), front_values_.data());
+  }
+
+  void TrimIndices() override {
+    MotiveProcessorNf::TrimIndices();
+    ForEachArray(ShrinkToFit());
+    values_.shrink_to_fit();
+    front_values_.shrink_to_fit();
+    SetBulkValues(values_.data(), front_values_.data());
+  }
+
+  void AddMemoryStats(MemoryStats* stats) const override {
+    MotiveProcessorNf::AddMemoryStats(stats);
+    ForEachArray(AddStats(stats));
+    stats->AddVector(values_);
+    stats->AddVector(front_values_);
+  }
+
+  void ArchiveState(MotiveStateArchive* archive) override {
+    MotiveProcessorNf::ArchiveState(archive);
+    ForEachArray(Archive(archive));
+    archive->Array(&values_);
+  }
+
+  void CopyToFrontBuffer(MotiveIndex index,
+                         MotiveDimension dimensions) override {
+    front_values_.resize(values_.size());
+    SetBulkValues(values_.data(), front_values_.data());
+    std::copy(values_.begin() + index, values_.begin() + index + dimensions,
+              front_values_.begin() + index);
+  }
+
+  /// The current value of every index.
+  MotiveVector<float> values_;
+
+  /// Copy of `values_` that's read by Values() when double buffered.
+  MotiveVector<float> front_values_;
+
+ private:
+  // Operations applied to the array of every field by ForEachArray().
+  struct ResetRange {
+    ResetRange(MotiveIndex index, MotiveDimension dimensions)
+        : index(index), dimensions(dimensions) {}
+    template <class T>
+    void operator()(MotiveVector<T>* v) const {
+      std::fill(v->begin() + index, v->begin() + index + dimensions, T());
+    }
+    MotiveIndex index;
+    MotiveDimension dimensions;
+  };
+
+  struct MoveRange {
+    MoveRange(MotiveIndex old_index, MotiveIndex new_index,
+              MotiveDimension dimensions)
+        : old_index(old_index), new_index(new_index), dimensions(dimensions) {}
+    template <class T>
+    void operator()(MotiveVector<T>* v) const {
+      std::copy(v->begin() + old_index, v->begin() + old_index + dimensions,
+                v->begin() + new_index);
+    }
+    MotiveIndex old_index;
+    MotiveIndex new_index;
+    MotiveDimension dimensions;
+  };
+
+  struct Resize {
+    explicit Resize(MotiveIndex num_indices) : num_indices(num_indices) {}
+    template <class T>
+    void operator()(MotiveVector<T>* v) const {
+      v->resize(num_indices);
+    }
+    MotiveIndex num_indices;
+  };
+
+  struct AddStats {
+    explicit AddStats(MemoryStats* stats) : stats(stats) {}
+    template <class T>
+    void operator()(const MotiveVector<T>* v) const {
+      stats->AddVector(*v);
+    }
+    MemoryStats* stats;
+  };
+
+  struct Archive {
+    explicit Archive(MotiveStateArchive* archive) : archive(archive) {}
+    template <class T>
+    void operator()(MotiveVector<T>* v) const {
+      archive->Array(v);
+    }
+    MotiveStateArchive* archive;
+  };
+
+  struct Reserve {
+    explicit Reserve(MotiveIndex count) : count(count) {}
+    template <class T>
+    void operator()(MotiveVector<T>* v) const {
+      v->reserve(count);
+    }
+    MotiveIndex count;
+  };
+
+  struct UseAllocatorOp {
+    explicit UseAllocatorOp(MotiveAllocator* allocator)
+        : allocator(allocator) {}
+    template <class T>
+    void operator()(MotiveVector<T>* v) const {
+      *v = MotiveVector<T>(MotiveStdAllocator<T>(allocator));
+    }
+    MotiveAllocator* allocator;
+  };
+
+  struct ShrinkToFit {
+    template <class T>
+    void operator()(MotiveVector<T>* v) const {
+      v->shrink_to_fit();
+    }
+  };
+
+  // Call `op` on the array of every field, starting from field `kField`.
+  template <size_t kField = 0, class Op>
+  typename std::enable_if<(kField < sizeof...(Fields))>::type ForEachArray(
+      const Op& op) {
+    op(&std::get<kField>(fields_));
+    ForEachArray<kField + 1>(op);
+  }
+
+  template <size_t kField, class Op>
+  typename std::enable_if<(kField == sizeof...(Fields))>::type ForEachArray(
+      const Op& /*op*/) {}
+
+  // Const version, for operations that only read the arrays.
+  template <size_t kField = 0, class Op>
+  typename std::enable_if<(kField < sizeof...(Fields))>::type ForEachArray(
+      const Op& op) const {
+    op(&std::get<kField>(fields_));
+    ForEachArray<kField + 1>(op);
+  }
+
+  template <size_t kField, class Op>
+  typename std::enable_if<(kField == sizeof...(Fields))>::type ForEachArray(
+      const Op& /*op*/) const {}
+
+  std::tuple<MotiveVector<Fields>...> fields_;
+};
+
+}  // namespace motive
+
+#endif  // MOTIVE_SOA_PROCESSOR_TEMPLATE_H_
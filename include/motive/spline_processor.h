@@ -0,0 +1,84 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_SPLINE_PROCESSOR_H_
+#define MOTIVE_SPLINE_PROCESSOR_H_
+
+#include <vector>
+
+#include "motive/math/bulk_spline_evaluator.h"
+#include "motive/spline_init.h"
+#include "motive/util/allocator.h"
+#include "motive/vector_motivator.h"
+
+namespace motive {
+
+/// @class SplineProcessor
+/// @brief Interface of the processor that drives SplineInit motivators.
+///
+/// The accessors are final and read straight from the processor's arrays, so
+/// calls through a SplineProcessor need no virtual dispatch and can be
+/// inlined. SplineMotivator1f, etc. use this to read their values, velocities
+/// and targets without the virtual calls that Motivator1f, etc. make.
+class SplineProcessor : public MotiveProcessorNf {
+ public:
+  MotivatorType Type() const final { return SplineInit::kType; }
+
+  const float* Values(MotiveIndex index) const final {
+    return ReadFrontBuffer() ? &front_ys_[index] : interpolator_.Ys(index);
+  }
+  void Velocities(MotiveIndex index, MotiveDimension dimensions,
+                  float* out) const final {
+    interpolator_.Derivatives(index, dimensions, out);
+  }
+  void Directions(MotiveIndex index, MotiveDimension dimensions,
+                  float* out) const final {
+    interpolator_.DerivativesWithoutPlayback(index, dimensions, out);
+  }
+  void TargetValues(MotiveIndex index, MotiveDimension dimensions,
+                    float* out) const final {
+    interpolator_.EndYs(index, dimensions, out);
+  }
+  void TargetVelocities(MotiveIndex index, MotiveDimension dimensions,
+                        float* out) const final {
+    interpolator_.EndDerivatives(index, dimensions, out);
+  }
+  void Differences(MotiveIndex index, MotiveDimension dimensions,
+                   float* out) const final {
+    interpolator_.YDifferencesToEnd(index, dimensions, out);
+  }
+
+ protected:
+  // Perform the spline evaluation, over time. Indices in 'interpolator_'
+  // are the same as the MotiveIndex values in this class.
+  BulkSplineEvaluator interpolator_;
+
+  // Copy of the y-values in 'interpolator_' that's read by Values() when
+  // double buffered.
+  MotiveVector<float> front_ys_;
+};
+
+// These Motivator types must be initialized with a SplineInit.
+typedef MotivatorXfTypedTemplate<MathFuVectorConverter, 1, SplineProcessor>
+    SplineMotivator1f;
+typedef MotivatorXfTypedTemplate<MathFuVectorConverter, 2, SplineProcessor>
+    SplineMotivator2f;
+typedef MotivatorXfTypedTemplate<MathFuVectorConverter, 3, SplineProcessor>
+    SplineMotivator3f;
+typedef MotivatorXfTypedTemplate<MathFuVectorConverter, 4, SplineProcessor>
+    SplineMotivator4f;
+
+}  // namespace motive
+
+#endif  // MOTIVE_SPLINE_PROCESSOR_H_
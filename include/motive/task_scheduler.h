@@ -0,0 +1,77 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_TASK_SCHEDULER_H_
+#define MOTIVE_TASK_SCHEDULER_H_
+
+#include <functional>
+
+#include "motive/common.h"
+
+namespace motive {
+
+/// @typedef MotiveTask
+/// A unit of work handed to a MotiveTaskScheduler.
+typedef std::function<void()> MotiveTask;
+
+/// @typedef MotiveRangeTask
+/// Work on the half-open index range [begin, end).
+typedef std::function<void(int begin, int end)> MotiveRangeTask;
+
+/// @typedef MotiveTaskGroupId
+/// Handle to a group of tasks. Returned by MotiveTaskScheduler::BeginGroup()
+/// and valid until the matching MotiveTaskScheduler::Wait().
+typedef int MotiveTaskGroupId;
+
+/// @class MotiveTaskScheduler
+/// @brief Interface to your job system.
+///
+/// Pass a MotiveTaskScheduler to MotiveEngine::set_task_scheduler() to have
+/// MotiveEngine::AdvanceFrame(), and the MotiveProcessors that do bulk work,
+/// run in parallel on your threads. Motive creates no threads of its own when
+/// a scheduler is set.
+///
+/// Tasks may themselves call ParallelFor() or BeginGroup()/Wait(), so
+/// Wait() should help run outstanding tasks instead of blocking outright.
+class MotiveTaskScheduler {
+ public:
+  virtual ~MotiveTaskScheduler() {}
+
+  /// Start a new group of tasks.
+  virtual MotiveTaskGroupId BeginGroup() = 0;
+
+  /// Queue `task` to run, possibly on another thread, as part of `group`.
+  virtual void Submit(MotiveTaskGroupId group, const MotiveTask& task) = 0;
+
+  /// Return only when every task submitted to `group` has completed.
+  /// `group` is no longer valid after this call.
+  virtual void Wait(MotiveTaskGroupId group) = 0;
+
+  /// Maximum number of tasks that can run at the same time.
+  /// Used to decide how finely to split work.
+  virtual int NumThreads() const = 0;
+
+  /// Call `task` on consecutive sub-ranges that together cover [0, count).
+  /// Every sub-range, except possibly the last, has at least `min_range_size`
+  /// elements. Returns once all sub-ranges have been processed.
+  ///
+  /// The default implementation submits one task per thread to a new group.
+  /// Override if your job system has a native parallel-for.
+  virtual void ParallelFor(int count, int min_range_size,
+                           const MotiveRangeTask& task);
+};
+
+}  // namespace motive
+
+#endif  // MOTIVE_TASK_SCHEDULER_H_
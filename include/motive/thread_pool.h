@@ -0,0 +1,97 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_THREAD_POOL_H_
+#define MOTIVE_THREAD_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "motive/common.h"
+#include "motive/task_scheduler.h"
+
+namespace motive {
+
+/// @class MotiveThreadPool
+/// @brief A MotiveTaskScheduler backed by threads that live as long as the
+///        pool.
+///
+/// Used by MotiveEngine::set_num_threads() when you have no job system of
+/// your own. The workers are started once, in the constructor, and sleep
+/// while there are no tasks, so submitting work every frame costs a lock and
+/// a wake-up rather than the creation of a thread.
+///
+/// Wait() runs queued tasks while the group is unfinished, so tasks may wait
+/// on groups of their own without deadlocking the pool.
+class MotiveThreadPool : public MotiveTaskScheduler {
+ public:
+  /// Start `num_workers` threads. The thread that calls Wait() also runs
+  /// tasks, so a pool with no workers still makes progress.
+  explicit MotiveThreadPool(int num_workers);
+
+  /// Finish every queued task, then stop the workers.
+  ~MotiveThreadPool() override;
+
+  MotiveTaskGroupId BeginGroup() override;
+  void Submit(MotiveTaskGroupId group, const MotiveTask& task) override;
+  void Wait(MotiveTaskGroupId group) override;
+
+  /// The workers, plus the thread that waits.
+  int NumThreads() const override {
+    return static_cast<int>(workers_.size()) + 1;
+  }
+
+ private:
+  MOTIVE_DISALLOW_COPY_AND_ASSIGN(MotiveThreadPool);
+
+  struct QueuedTask {
+    QueuedTask(MotiveTaskGroupId group, const MotiveTask& task)
+        : group(group), task(task) {}
+    MotiveTaskGroupId group;
+    MotiveTask task;
+  };
+
+  void WorkerLoop();
+
+  // Pop the oldest task, and run it with `lock` released. `lock` must hold
+  // `mutex_`, and the queue must not be empty.
+  void RunTask(std::unique_lock<std::mutex>* lock);
+
+  std::vector<std::thread> workers_;
+
+  // Guards everything below.
+  std::mutex mutex_;
+
+  // Signalled when a task is queued, or when the pool is stopping.
+  std::condition_variable task_queued_;
+
+  // Signalled when the last task of a group completes.
+  std::condition_variable group_finished_;
+
+  std::deque<QueuedTask> queue_;
+
+  // Number of tasks submitted to each group that have not yet completed.
+  // Indexed by MotiveTaskGroupId. Ids are reused once waited on.
+  std::vector<int> pending_;
+  std::vector<MotiveTaskGroupId> free_groups_;
+
+  bool stopping_;
+};
+
+}  // namespace motive
+
+#endif  // MOTIVE_THREAD_POOL_H_
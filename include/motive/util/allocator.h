@@ -0,0 +1,127 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_UTIL_ALLOCATOR_H_
+#define MOTIVE_UTIL_ALLOCATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace motive {
+
+/// @class MotiveAllocator
+/// @brief Interface for redirecting the memory that Motive allocates.
+///
+/// Set one on a MotiveEngine with MotiveEngine::set_allocator() to place the
+/// engine's data in your own memory pools, for example per-level arenas.
+/// Processors may allocate from any thread that advances the engine, so the
+/// allocator must be thread safe when the engine is threaded.
+class MotiveAllocator {
+ public:
+  virtual ~MotiveAllocator() {}
+
+  /// Return at least `size` bytes, aligned to `alignment`, which is a power
+  /// of two.
+  virtual void* Allocate(size_t size, size_t alignment) = 0;
+
+  /// Release memory returned by Allocate(). `p` may be nullptr.
+  virtual void Free(void* p) = 0;
+
+  /// The allocator used when none has been set. Allocates with global `new`.
+  static MotiveAllocator* Default();
+};
+
+/// @class HeapAllocator
+/// @brief MotiveAllocator that uses the global `new` and `delete`.
+class HeapAllocator : public MotiveAllocator {
+ public:
+  virtual void* Allocate(size_t size, size_t alignment) {
+    // Over-allocate so that the result can be aligned, and remember the
+    // original pointer just before the result.
+    uint8_t* raw = static_cast<uint8_t*>(
+        ::operator new(size + alignment + sizeof(void*)));
+    const uintptr_t aligned =
+        (reinterpret_cast<uintptr_t>(raw) + sizeof(void*) + alignment - 1) &
+        ~static_cast<uintptr_t>(alignment - 1);
+    reinterpret_cast<void**>(aligned)[-1] = raw;
+    return reinterpret_cast<void*>(aligned);
+  }
+
+  virtual void Free(void* p) {
+    if (p == nullptr) return;
+    ::operator delete(static_cast<void**>(p)[-1]);
+  }
+};
+
+inline MotiveAllocator* MotiveAllocator::Default() {
+  static HeapAllocator allocator;
+  return &allocator;
+}
+
+/// @class MotiveStdAllocator
+/// @brief Adapts a MotiveAllocator for standard containers.
+///
+/// For example, `std::vector<float, MotiveStdAllocator<float>>` holds its
+/// floats in the MotiveAllocator passed to its constructor. The allocator
+/// moves along with the container's contents, so assigning an empty
+/// container constructed with a new allocator switches allocators.
+/// Elements are aligned to their type's alignment, so it can replace
+/// mathfu::simd_allocator.
+template <class T>
+class MotiveStdAllocator {
+ public:
+  typedef T value_type;
+  typedef std::true_type propagate_on_container_copy_assignment;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  MotiveStdAllocator() : allocator_(MotiveAllocator::Default()) {}
+  explicit MotiveStdAllocator(MotiveAllocator* allocator)
+      : allocator_(allocator) {}
+  template <class U>
+  MotiveStdAllocator(const MotiveStdAllocator<U>& rhs)
+      : allocator_(rhs.allocator()) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(
+        allocator_->Allocate(n * sizeof(T), std::alignment_of<T>::value));
+  }
+  void deallocate(T* p, size_t /*n*/) { allocator_->Free(p); }
+
+  MotiveAllocator* allocator() const { return allocator_; }
+
+  template <class U>
+  bool operator==(const MotiveStdAllocator<U>& rhs) const {
+    return allocator_ == rhs.allocator();
+  }
+  template <class U>
+  bool operator!=(const MotiveStdAllocator<U>& rhs) const {
+    return allocator_ != rhs.allocator();
+  }
+
+ private:
+  MotiveAllocator* allocator_;
+};
+
+/// A std::vector whose elements are held in a MotiveAllocator. Construct it
+/// with `MotiveStdAllocator<T>(allocator)` to pick the allocator.
+template <class T>
+using MotiveVector = std::vector<T, MotiveStdAllocator<T>>;
+
+}  // namespace motive
+
+#endif  // MOTIVE_UTIL_ALLOCATOR_H_
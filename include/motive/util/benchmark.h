@@ -21,6 +21,28 @@ namespace motive {
 #define FPL_TOKEN_PASTE(a, b) FPL_TOKEN_PASTE_NESTED(a, b)
 #define FPL_UNIQUE(token) FPL_TOKEN_PASTE(token, __LINE__)
 
+/// Formats for WriteBenchmarks().
+enum BenchmarkFormat {
+  /// One JSON object holding the configuration, and for each benchmark, its
+  /// samples, average, standard deviation, min, p50, p95, p99 and max.
+  kBenchmarkJson,
+
+  /// The configuration as `# key=value` comment lines, followed by one
+  /// `name,usec` row per sample. Read by CompareBenchmarks().
+  kBenchmarkCsv,
+};
+
+/// Hardware events that can be counted for each Benchmark sample.
+/// See EnableBenchmarkCounters().
+enum BenchmarkCounter {
+  kBenchmarkCycles,
+  kBenchmarkInstructions,
+  kBenchmarkL1dMisses,
+  kBenchmarkLlcMisses,
+  kBenchmarkBranchMisses,
+  kNumBenchmarkCounters
+};
+
 #if defined(BENCHMARK_MOTIVE)
 
 /// A raw tick count from the system. Guaranteed to increase.
@@ -44,6 +66,42 @@ int RegisterBenchmark(const char* name);
 /// Dump an analysis of the samples to stdout.
 void OutputBenchmarks();
 
+/// Record a configuration value, such as a population size, to be written
+/// with the samples by WriteBenchmarks(). Setting an existing `key` replaces
+/// its value.
+void SetBenchmarkConfig(const char* key, const char* value);
+
+/// Write the samples collected so far, and their statistics, to `file_name`
+/// in a machine-readable `format`. Returns false if the file can't be written.
+bool WriteBenchmarks(const char* file_name, BenchmarkFormat format);
+
+/// Compare two runs written by WriteBenchmarks() in kBenchmarkCsv format,
+/// and print the change in each benchmark's median to stdout.
+///
+/// A change is significant if a two-sided Mann-Whitney U test rejects equal
+/// distributions at level `alpha`, for example 0.01. Returns the number of
+/// benchmarks that are significantly slower in `candidate_file` by more than
+/// `min_slowdown` of the baseline median, for example 0.05 for 5%. Returns -1
+/// if either file can't be read.
+int CompareBenchmarks(const char* baseline_file, const char* candidate_file,
+                      double alpha, double min_slowdown);
+
+/// Also count hardware events, such as cache misses, during each Benchmark
+/// sample. OutputBenchmarks() and WriteBenchmarks(kBenchmarkJson) then
+/// report each benchmark's mean count per sample.
+///
+/// Uses Linux perf_event counters of the calling thread, so samples that
+/// span work on other threads miss those threads' events. Returns false when
+/// no counters can be opened, for example on other systems or when
+/// /proc/sys/kernel/perf_event_paranoid forbids it. Counters that the CPU
+/// doesn't support are left out of the reports.
+bool EnableBenchmarkCounters();
+
+/// Read the calling thread's counters into `counts`, indexed by
+/// BenchmarkCounter. Returns false if EnableBenchmarkCounters() hasn't
+/// succeeded.
+bool ReadBenchmarkCounters(unsigned long long* counts);
+
 /// @class Benchmark
 /// @brief Record the time for the scope of this variable.
 ///
@@ -52,11 +110,16 @@ void OutputBenchmarks();
 /// The sample is the time between creation and destruction of the Benchmark.
 class Benchmark {
  public:
-  explicit Benchmark(int id) : id_(id), start_time_(GetBenchmarkTime()) {}
+  explicit Benchmark(int id)
+      : id_(id),
+        has_counts_(ReadBenchmarkCounters(start_counts_)),
+        start_time_(GetBenchmarkTime()) {}
   ~Benchmark();
  private:
   int id_;
+  bool has_counts_;
   BenchmarkTime start_time_;
+  unsigned long long start_counts_[kNumBenchmarkCounters];
 };
 
 #define FPL_BENCHMARK(name) \
@@ -70,6 +133,20 @@ inline void InitBenchmarks(int /*num_ids*/) {}
 inline void ClearBenchmarks() {}
 inline int RegisterBenchmark(const char* /*name*/) { return -1; }
 inline void OutputBenchmarks() {}
+inline void SetBenchmarkConfig(const char* /*key*/, const char* /*value*/) {}
+inline bool EnableBenchmarkCounters() { return false; }
+inline bool ReadBenchmarkCounters(unsigned long long* /*counts*/) {
+  return false;
+}
+inline bool WriteBenchmarks(const char* /*file_name*/,
+                            BenchmarkFormat /*format*/) {
+  return false;
+}
+inline int CompareBenchmarks(const char* /*baseline_file*/,
+                             const char* /*candidate_file*/,
+                             double /*alpha*/, double /*min_slowdown*/) {
+  return -1;
+}
 class Benchmark {
  public:
   explicit Benchmark(int /*id*/) {}
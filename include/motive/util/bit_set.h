@@ -0,0 +1,143 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_UTIL_BIT_SET_H_
+#define MOTIVE_UTIL_BIT_SET_H_
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "motive/util/memory_stats.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif  // _MSC_VER
+
+namespace motive {
+
+/// Return the index of the lowest set bit in `x`, which must not be zero.
+inline int CountTrailingZeros(uint64_t x) {
+  assert(x != 0);
+#if defined(_MSC_VER) && defined(_WIN64)
+  unsigned long index;
+  _BitScanForward64(&index, x);
+  return static_cast<int>(index);
+#elif defined(_MSC_VER)
+  unsigned long index;
+  const uint32_t low = static_cast<uint32_t>(x);
+  if (low != 0) {
+    _BitScanForward(&index, low);
+    return static_cast<int>(index);
+  }
+  _BitScanForward(&index, static_cast<uint32_t>(x >> 32));
+  return static_cast<int>(index) + 32;
+#else
+  return __builtin_ctzll(x);
+#endif
+}
+
+/// @class HierarchicalBitSet
+/// @brief Set of bits with a summary word for every 64 words.
+///
+/// Iterating over the set bits skips empty regions 4096 bits at a time, so
+/// it stays cheap when few bits are set in a large set.
+class HierarchicalBitSet {
+ public:
+  HierarchicalBitSet() : num_bits_(0) {}
+
+  /// Grow or shrink to `num_bits`. New bits are cleared.
+  void Resize(size_t num_bits) {
+    num_bits_ = num_bits;
+    words_.resize(NumWords(num_bits), 0);
+    summary_.resize(NumWords(words_.size()), 0);
+    if (words_.empty()) return;
+
+    // Clear the bits beyond the end, and the summary of any word that empties.
+    const size_t last = words_.size() - 1;
+    words_[last] &= Mask(num_bits - 64 * last);
+    summary_.back() &= Mask(words_.size() - 64 * (summary_.size() - 1));
+    if (words_[last] == 0) ClearSummary(last);
+  }
+
+  void Set(size_t i) {
+    assert(i < num_bits_);
+    words_[i / 64] |= Bit(i % 64);
+    summary_[i / 4096] |= Bit((i / 64) % 64);
+  }
+
+  void Clear(size_t i) {
+    assert(i < num_bits_);
+    const size_t word = i / 64;
+    words_[word] &= ~Bit(i % 64);
+    if (words_[word] == 0) ClearSummary(word);
+  }
+
+  bool Test(size_t i) const {
+    return i < num_bits_ && (words_[i / 64] & Bit(i % 64)) != 0;
+  }
+
+  /// Call `fn(i)` for every set bit `i`, in increasing order.
+  template <class Fn>
+  void ForEachSet(const Fn& fn) const {
+    for (size_t s = 0; s < summary_.size(); ++s) {
+      for (uint64_t summary = summary_[s]; summary != 0;
+           summary &= summary - 1) {
+        const size_t word = 64 * s + CountTrailingZeros(summary);
+        for (uint64_t bits = words_[word]; bits != 0; bits &= bits - 1) {
+          fn(64 * word + CountTrailingZeros(bits));
+        }
+      }
+    }
+  }
+
+  size_t size() const { return num_bits_; }
+
+  /// Release the memory held beyond the current size.
+  void ShrinkToFit() {
+    words_.shrink_to_fit();
+    summary_.shrink_to_fit();
+  }
+
+  void AddMemoryStats(MemoryStats* stats) const {
+    stats->AddVector(words_);
+    stats->AddVector(summary_);
+  }
+
+ private:
+  static size_t NumWords(size_t num_bits) { return (num_bits + 63) / 64; }
+  static uint64_t Bit(size_t i) { return static_cast<uint64_t>(1) << i; }
+
+  // Bits [0, n), where n is in [1, 64].
+  static uint64_t Mask(size_t n) {
+    return n >= 64 ? ~static_cast<uint64_t>(0) : Bit(n) - 1;
+  }
+
+  void ClearSummary(size_t word) {
+    summary_[word / 64] &= ~Bit(word % 64);
+  }
+
+  // One bit per element.
+  std::vector<uint64_t> words_;
+
+  // One bit per word in `words_`, set iff that word is not zero.
+  std::vector<uint64_t> summary_;
+
+  size_t num_bits_;
+};
+
+}  // namespace motive
+
+#endif  // MOTIVE_UTIL_BIT_SET_H_
@@ -0,0 +1,122 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_UTIL_COUNTERS_H_
+#define MOTIVE_UTIL_COUNTERS_H_
+
+#include <stdint.h>
+#include <atomic>
+
+namespace motive {
+
+/// @enum MotiveCounter
+/// @brief Events on Motive's hot paths that are always counted.
+///
+/// Unlike Benchmark, these are compiled into every build. Each increment is
+/// an unshared add on a per-thread counter, so leave them on in shipping
+/// builds and read them from telemetry.
+enum MotiveCounter {
+  /// Segments of spline initialized by BulkSplineEvaluator, on every
+  /// spline node crossed or spline started.
+  kCounterCubicInits,
+
+  /// Binary searches of a CompactSpline's nodes, when an x is not in or next
+  /// to the previous segment.
+  kCounterIndexForXSearches,
+
+  /// Index ranges moved by MotiveProcessor::Defragment().
+  kCounterDefragmentMoves,
+
+  /// Calls to MatrixMotivator::BlendToOps().
+  kCounterMatrixBlends,
+
+  /// Calls to RigMotivator::BlendToAnim() or BlendToAnims().
+  kCounterRigBlends,
+
+  /// Matrices or SQT transforms rebuilt from their ops.
+  kCounterMatricesRecomputed,
+
+  /// Rigs whose global bone transforms were rebuilt.
+  kCounterRigTransformUpdates,
+
+  kNumMotiveCounters
+};
+
+/// Human-readable name of `counter`, for logs and telemetry.
+const char* MotiveCounterName(MotiveCounter counter);
+
+/// @struct MotiveCounters
+/// @brief A snapshot of every MotiveCounter.
+struct MotiveCounters {
+  MotiveCounters() {
+    for (int i = 0; i < kNumMotiveCounters; ++i) counts[i] = 0;
+  }
+
+  uint64_t operator[](MotiveCounter counter) const { return counts[counter]; }
+
+  /// The events counted between `earlier` and this snapshot.
+  MotiveCounters operator-(const MotiveCounters& earlier) const {
+    MotiveCounters r;
+    for (int i = 0; i < kNumMotiveCounters; ++i) {
+      r.counts[i] = counts[i] - earlier.counts[i];
+    }
+    return r;
+  }
+
+  uint64_t counts[kNumMotiveCounters];
+};
+
+/// Total of every counter over all threads, since the process began.
+/// Takes a lock, so call it once a frame or less, not from hot paths.
+void ReadMotiveCounters(MotiveCounters* counters);
+
+namespace detail {
+
+// Counters written only by the thread that owns them, so increments need no
+// atomic read-modify-write. They're atomic only so that ReadMotiveCounters()
+// can read them from another thread. Registers itself on creation, and adds
+// its counts to the process totals on destruction, when its thread exits.
+class CounterBlock {
+ public:
+  CounterBlock();
+  ~CounterBlock();
+
+  void Add(MotiveCounter counter, uint64_t n) {
+    std::atomic<uint64_t>& c = counts_[counter];
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  uint64_t Count(int counter) const {
+    return counts_[counter].load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::atomic<uint64_t> counts_[kNumMotiveCounters];
+};
+
+inline CounterBlock& ThreadCounterBlock() {
+  static thread_local CounterBlock block;
+  return block;
+}
+
+}  // namespace detail
+
+/// Record `n` occurrences of `counter` on the calling thread.
+inline void CountEvent(MotiveCounter counter, uint64_t n = 1) {
+  detail::ThreadCounterBlock().Add(counter, n);
+}
+
+}  // namespace motive
+
+#endif  // MOTIVE_UTIL_COUNTERS_H_
@@ -27,6 +27,8 @@
 #include <cstring>
 #include <type_traits>
 
+#include "motive/util/bit_set.h"
+
 // Define this to 0 in the build file to disable sanity checks.
 #ifndef MOTIVE_INDEX_ALLOCATOR_VERIFY_INTERNAL_STATE
 #define MOTIVE_INDEX_ALLOCATOR_VERIFY_INTERNAL_STATE 1
@@ -124,6 +126,7 @@ class IndexAllocator {
       // Perfect size. Remove from `unused_indices_` pool.
       if (excess == 0) {
         unused_indices_.erase(it);
+        unused_bits_.Clear(unused_index);
         return unused_index;
       }
 
@@ -144,6 +147,8 @@ class IndexAllocator {
       const Index remainder_index = excess_index + count;
       InitializeIndex(remainder_index, least_excess);
       *least_excess_it = remainder_index;
+      unused_bits_.Clear(excess_index);
+      unused_bits_.Set(remainder_index);
 
       return excess_index;
     }
@@ -162,6 +167,7 @@ class IndexAllocator {
   void Free(Index index) {
     assert(ValidIndex(index));
     unused_indices_.push_back(index);
+    unused_bits_.Set(index);
   }
 
   // Only one block of unused indices left, and they're at the end of the
@@ -216,8 +222,21 @@ class IndexAllocator {
   /// reallocation of the underlying array (which would be slow).
   ///
   void Defragment() {
+    DefragmentWhile([]() { return true; });
+  }
+
+  /// Incremental version of Defragment(). Calls `keep_going()` before each
+  /// call to callbacks_->MoveIndexRange(), and stops early if it returns
+  /// false. Useful for spreading the work over several frames after many
+  /// indices have been freed at once.
+  ///
+  /// Even when stopping early, the unused block at the end of the array, if
+  /// any, is trimmed. Use ActiveRanges() to skip the blocks that remain.
+  /// @return true if all unused indices have been removed.
+  template <class KeepGoingFn>
+  bool DefragmentWhile(const KeepGoingFn& keep_going) {
     // Quick check. An optimization.
-    if (unused_indices_.size() == 0) return;
+    if (unused_indices_.size() == 0) return true;
 
     for (;;) {
       // We check if unused index is the last index, so must be in sorted order.
@@ -225,18 +244,101 @@ class IndexAllocator {
 
       // If all the holes have been pushed to the end, we are done and can
       // trim the number of indices.
-      const bool unused_at_end = unused_indices_.size() == 1 &&
-                                 NextIndex(unused_indices_[0]) == num_indices();
-      if (unused_at_end) break;
+      if (UnusedAtEnd()) {
+        SetNumIndices(unused_indices_[0]);
+        unused_indices_.clear();
+        return true;
+      }
+      if (!keep_going()) break;
 
       // Find range of indices that will fit into the first block of
       // unused indices and move them into it.
       BackfillFirstUnused();
     }
 
-    // Remove hole at end.
-    SetNumIndices(unused_indices_[0]);
-    unused_indices_.clear();
+    // `unused_indices_` was just consolidated, so the last block is the
+    // highest. Remove it if it's at the end.
+    const Index last_unused = unused_indices_.back();
+    if (NextIndex(last_unused) == num_indices()) {
+      unused_indices_.pop_back();
+      SetNumIndices(last_unused);
+    }
+    return false;
+  }
+
+  /// Defragment, then move the blocks of allocated indices so that they're in
+  /// the order of `order`, which lists the first index of every block exactly
+  /// once.
+  ///
+  /// Each block is moved to the end of the array with
+  /// callbacks_->MoveIndexRange(), and then all of them are moved back to the
+  /// start in one call. So the array temporarily doubles in size, and every
+  /// index is moved twice. Nothing is moved if the blocks are already in
+  /// order.
+  void Reorder(const std::vector<Index>& order) {
+    Defragment();
+    const Index n = num_indices();
+    Index expected = 0;
+    bool in_order = true;
+    for (size_t i = 0; i < order.size() && in_order; ++i) {
+      in_order = order[i] == expected;
+      expected = NextIndex(expected);
+    }
+    if (in_order) return;
+
+    SetNumIndices(2 * n);
+    Index target = n;
+    for (size_t i = 0; i < order.size(); ++i) {
+      const Index start = order[i];
+      const Count count = CountForIndex(start);
+      InitializeIndex(target, count);
+      callbacks_->MoveIndexRange(IndexRange(start, start + count), target);
+      target += count;
+    }
+    assert(target == 2 * n);
+
+    // The first half of the array is now unused.
+    memmove(&counts_[0], &counts_[n], n * sizeof(counts_[0]));
+    callbacks_->MoveIndexRange(IndexRange(n, 2 * n), 0);
+    SetNumIndices(n);
+    VerifyInternalState();
+  }
+
+  /// Append every block of allocated indices to `ranges`, in order, merging
+  /// blocks that are adjacent. After a DefragmentWhile() that stopped early,
+  /// loops over the ranges can skip the remaining unused indices.
+  void ActiveRanges(std::vector<IndexRange>* ranges) const {
+    Index start = 0;
+    unused_bits_.ForEachSet([this, ranges, &start](size_t i) {
+      const Index unused = static_cast<Index>(i);
+      if (start < unused) ranges->push_back(IndexRange(start, unused));
+      start = NextIndex(unused);
+    });
+    if (start < num_indices()) {
+      ranges->push_back(IndexRange(start, num_indices()));
+    }
+  }
+
+  /// Pre-allocate internal storage for `count` indices, so that later calls
+  /// to Alloc() don't reallocate until more than `count` are in use.
+  void Reserve(Index count) {
+    counts_.reserve(count);
+    unused_indices_.reserve(count);
+  }
+
+  /// Release the memory held beyond the current number of indices, for
+  /// example after Reserve(), or after a peak in the number of indices.
+  void ShrinkToFit() {
+    counts_.shrink_to_fit();
+    unused_indices_.shrink_to_fit();
+    unused_bits_.ShrinkToFit();
+  }
+
+  /// Add the memory held by this allocator to `stats`.
+  void AddMemoryStats(MemoryStats* stats) const {
+    stats->AddVector(counts_);
+    stats->AddVector(unused_indices_);
+    unused_bits_.AddMemoryStats(stats);
   }
 
   /// Returns true if there are no indices allocated.
@@ -252,12 +354,7 @@ class IndexAllocator {
     if (counts_[index] == 0)
       return false;
 
-    for (ConstIndexIterator it = unused_indices_.begin();
-         it != unused_indices_.end(); ++it) {
-      if (index == *it) return false;
-    }
-
-    return true;
+    return !unused_bits_.Test(index);
   }
 
   /// Returns the number of wasted indices. These holes will be plugged when
@@ -294,6 +391,14 @@ class IndexAllocator {
       // Jump to the next block.
       i += count;
     }
+
+    // Every unused block must be marked in `unused_bits_`, and nothing else.
+    size_t num_unused_bits = 0;
+    unused_bits_.ForEachSet([&num_unused_bits](size_t) { ++num_unused_bits; });
+    assert(num_unused_bits == unused_indices_.size());
+    for (size_t i = 0; i < unused_indices_.size(); ++i) {
+      assert(unused_bits_.Test(unused_indices_[i]));
+    }
 #endif  // MOTIVE_INDEX_ALLOCATOR_VERIFY_INTERNAL_STATE
   }
 
@@ -302,7 +407,6 @@ class IndexAllocator {
   Index num_indices() const { return static_cast<Index>(counts_.size()); }
 
  private:
-  typedef typename std::vector<Index>::const_iterator ConstIndexIterator;
   static const Index kInvalidIndex = static_cast<Index>(-1);
 
   /// Returns the next allocated index. Skips over all indices associated
@@ -338,6 +442,7 @@ class IndexAllocator {
   void SetNumIndices(Index new_num_indices) {
     // Increase (or decrease) the count logger.
     counts_.resize(new_num_indices, 0);
+    unused_bits_.Resize(new_num_indices);
 
     // Report size change.
     callbacks_->SetNumIndices(new_num_indices);
@@ -346,7 +451,13 @@ class IndexAllocator {
   /// Combine adjacent blocks of unused incides in `unused_indices_`.
   void ConsolidateUnusedIndices() {
     // First put the indices in order so that we can process them efficiently.
-    std::sort(unused_indices_.begin(), unused_indices_.end());
+    // Reading them from `unused_bits_` is cheaper than sorting, since empty
+    // stretches of the bitmap are skipped a word at a time.
+    size_t num_sorted = 0;
+    unused_bits_.ForEachSet([this, &num_sorted](size_t i) {
+      unused_indices_[num_sorted++] = static_cast<Index>(i);
+    });
+    assert(num_sorted == unused_indices_.size());
 
     // Consolidate adjacent blocks of unused indices.
     size_t new_num_unused = 0;
@@ -365,6 +476,9 @@ class IndexAllocator {
       if (num_consecutive > 1) {
         const Count consolidated_count =
             NextIndex(unused_indices_[j - 1]) - unused;
+        for (size_t k = i + 1; k < j; ++k) {
+          unused_bits_.Clear(unused_indices_[k]);
+        }
         InitializeIndex(unused, consolidated_count);
       }
 
@@ -433,6 +547,8 @@ class IndexAllocator {
       // See Case 1 above: Add a hole for the range we just moved.
       InitializeIndex(fill_range.start(), fill_range.Length());
       unused_indices_[0] = fill_range.start();
+      unused_bits_.Clear(unused_range.start());
+      unused_bits_.Set(fill_range.start());
 
       // If we didn't completely fill unused_range, add a hole for the rest.
       const IndexRange unused_hole(unused_range.start() + fill_range.Length(),
@@ -440,6 +556,7 @@ class IndexAllocator {
       if (unused_hole.Length() > 0) {
         InitializeIndex(unused_hole.start(), unused_hole.Length());
         unused_indices_.push_back(unused_hole.start());
+        unused_bits_.Set(unused_hole.start());
       }
     } else {
       // See Case 2 above: Add a hole at the end of the range we shifted over.
@@ -447,6 +564,8 @@ class IndexAllocator {
                                   fill_range.end());
       InitializeIndex(shift_hole.start(), shift_hole.Length());
       unused_indices_[0] = shift_hole.start();
+      unused_bits_.Clear(unused_range.start());
+      unused_bits_.Set(shift_hole.start());
     }
 
     VerifyInternalState();
@@ -508,6 +627,9 @@ class IndexAllocator {
   // unused indices with the highest allocated indices. This reduces the total
   // size of the data arrays.
   std::vector<Index> unused_indices_;
+
+  // One bit per index, set iff that index is in `unused_indices_`.
+  HierarchicalBitSet unused_bits_;
 };
 
 }  // namespace motive
@@ -15,6 +15,10 @@
 #ifndef MOTIVE_UTIL_KEYFRAME_CONVERTER_H_
 #define MOTIVE_UTIL_KEYFRAME_CONVERTER_H_
 
+#include <memory>
+#include <vector>
+
+#include "motive/math/spline_stream.h"
 #include "motive/matrix_anim.h"
 #include "motive/matrix_op.h"
 
@@ -117,6 +121,124 @@ void AddQuaternionCurves(MatrixAnim* anim, MatrixAnim::Spline* splines,
                          MatrixOpId base_id, QuaternionOrder order,
                          const KeyframeData& data);
 
+/// Describes the arguments to one AddVector3Curves() or AddQuaternionCurves()
+/// call, so that many bones' curves can be converted at once by
+/// AddBulkCurves(). If |is_quaternion| is true, |base_type| is ignored and
+/// |order| is used, as in AddQuaternionCurves().
+struct KeyframeCurveGroup {
+  MatrixAnim* anim = nullptr;
+  MatrixAnim::Spline* splines = nullptr;
+  MatrixOperationType base_type = kTranslateX;
+  MatrixOpId base_id = 0;
+  bool is_quaternion = false;
+  QuaternionOrder order = kOrderWXYZ;
+  KeyframeData data;
+};
+
+/// Returns the buffer size required by AddBulkCurves() for |groups|.
+size_t GetRequiredBulkBufferSize(const KeyframeCurveGroup* groups,
+                                 size_t group_count);
+
+/// Identical to calling AddVector3Curves() or AddQuaternionCurves() for each
+/// of the |group_count| |groups|, but the splines are created contiguously in
+/// |buffer| instead of being allocated one by one. Derivatives and quaternion
+/// flips are computed for all channels of a keyframe together, in SIMD
+/// registers when MathFu is built with SIMD. Returns the number of bytes of
+/// |buffer| used.
+///
+/// The splines are not owned by their MatrixAnims, so |buffer| must outlive
+/// them. This function performs no bounds checking on |buffer|. Use
+/// GetRequiredBulkBufferSize() to determine how large a buffer is necessary.
+size_t AddBulkCurves(uint8_t* buffer, const KeyframeCurveGroup* groups,
+                     size_t group_count);
+
+/// @class KeyframeStream
+/// @brief Converts keyframes into curves as they arrive, for live data such
+///        as mocap.
+///
+/// Each channel's curve is a LiveSplineChunkSource, which a SplineStreamer can
+/// play while keyframes are still being appended. Playback that catches up
+/// with the data holds at the latest keyframe, and continues into new
+/// keyframes as they arrive, without restarting the animation.
+///
+/// The nodes produced are the same as those of AddArrayCurves() or
+/// AddQuaternionCurves(), except that for linear interpolation the last
+/// keyframe's right node is only added once the next keyframe arrives, since
+/// it takes the tangent between the two.
+class KeyframeStream {
+ public:
+  /// Stream |channel_count| channels of array data, as in AddArrayCurves().
+  /// |nodes_per_chunk| and |max_chunks| are passed to each channel's
+  /// LiveSplineChunkSource.
+  KeyframeStream(size_t channel_count, size_t nodes_per_chunk, int max_chunks);
+
+  /// Stream quaternion data, as in AddQuaternionCurves(). The channels are
+  /// always in the order W, X, Y, Z. |order| determines which value of each
+  /// sample is used for each channel.
+  KeyframeStream(QuaternionOrder order, size_t nodes_per_chunk,
+                 int max_chunks);
+
+  /// Appends the |data.count| keyframes in |data| to every channel.
+  /// |data.values| is in array-of-structs format, as in AddArrayCurves().
+  /// |data.times| must not be earlier than the previous keyframe's, and
+  /// |data.interpolation_type| must be the same for every call.
+  void AppendKeyframes(const KeyframeData& data);
+
+  /// Makes every keyframe appended so far playable, without waiting for the
+  /// current chunks to fill. See LiveSplineChunkSource::Flush().
+  void Flush();
+
+  /// The number of channels, each with its own source.
+  size_t channel_count() const { return sources_.size(); }
+
+  /// The curve of |channel|, which must be less than channel_count().
+  LiveSplineChunkSource* Source(size_t channel) const {
+    return sources_[channel].get();
+  }
+
+ private:
+  // Index into each keyframe's values for |channel|.
+  size_t ValueIndex(size_t channel) const;
+
+  std::vector<std::unique_ptr<LiveSplineChunkSource>> sources_;
+  bool is_quaternion_;
+  QuaternionOrder order_;
+
+  // The most recent keyframe, with values in |data.values| order, and its time
+  // in milliseconds.
+  std::vector<float> previous_values_;
+  float previous_time_;
+  bool has_previous_;
+
+  MOTIVE_DISALLOW_COPY_AND_ASSIGN(KeyframeStream);
+};
+
+/// Adds 3 operations to |anim| that play live data from |rings|. For i in
+/// [0, 3), the i'th new operation will have type |base_type + i|, id
+/// |base_id + i|, and play |rings[i]|. The rings are not owned by |anim|, so
+/// must outlive it.
+///
+/// Matrix and rig motivators play |anim| like any other animation, as the
+/// rings are filled. Start them with the SplinePlayback from
+/// RingSplineClock::Start(), and keep them behind the data with
+/// RingSplineClock::Update(). In a RigAnim, set the end time to the rings'
+/// period() and mark the anim as repeating.
+void AddVector3RingCurves(MatrixAnim* anim, const RingSpline* const* rings,
+                          MatrixOperationType base_type, MatrixOpId base_id);
+
+/// Adds 4 operations to |anim| that play a quaternion from |rings|, which are
+/// in the order W, X, Y, Z. The W component is assigned an id of |base_id|,
+/// the X component |base_id + 1|, and so on. See AddVector3RingCurves().
+void AddQuaternionRingCurves(MatrixAnim* anim, const RingSpline* const* rings,
+                             MatrixOpId base_id);
+
+/// Appends the quaternion |quat| to |rings|, which are in the order W, X, Y,
+/// Z, with RingSpline::AddValue(). |order| determines which value of |quat|
+/// is used for each ring. |quat| is negated if that brings it closer to the
+/// previous quaternion, so that playback rotates the short way around.
+void AddRingQuaternionValue(RingSpline* const* rings, const float* quat,
+                            QuaternionOrder order);
+
 }  // namespace motive
 
 #endif  // MOTIVE_UTIL_KEYFRAME_CONVERTER_H_
@@ -0,0 +1,78 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_UTIL_MEMORY_STATS_H_
+#define MOTIVE_UTIL_MEMORY_STATS_H_
+
+#include <stddef.h>
+#include <vector>
+
+namespace motive {
+
+/// @struct MemoryStats
+/// @brief Bytes of heap memory held by a part of Motive.
+///
+/// `live_bytes` holds data in use, and `slack_bytes` is capacity that has
+/// been allocated but is not in use, for example the unused capacity of a
+/// vector. The spline and op fields break down part of `live_bytes`: they
+/// are already counted there, so don't add them again.
+///
+/// Sizes of containers' own bookkeeping, such as hash map buckets, are
+/// estimates.
+struct MemoryStats {
+  MemoryStats()
+      : live_bytes(0),
+        slack_bytes(0),
+        spline_header_bytes(0),
+        spline_node_bytes(0),
+        op_bytes(0) {}
+
+  /// All bytes held, in use or not.
+  size_t TotalBytes() const { return live_bytes + slack_bytes; }
+
+  /// Count the elements of `v` as live, and its spare capacity as slack.
+  template <class T, class Allocator>
+  void AddVector(const std::vector<T, Allocator>& v) {
+    live_bytes += v.size() * sizeof(T);
+    slack_bytes += (v.capacity() - v.size()) * sizeof(T);
+  }
+
+  MemoryStats& operator+=(const MemoryStats& rhs) {
+    live_bytes += rhs.live_bytes;
+    slack_bytes += rhs.slack_bytes;
+    spline_header_bytes += rhs.spline_header_bytes;
+    spline_node_bytes += rhs.spline_node_bytes;
+    op_bytes += rhs.op_bytes;
+    return *this;
+  }
+
+  /// Bytes in use.
+  size_t live_bytes;
+
+  /// Bytes allocated, but not in use.
+  size_t slack_bytes;
+
+  /// Part of `live_bytes` held by CompactSpline headers.
+  size_t spline_header_bytes;
+
+  /// Part of `live_bytes` held by CompactSpline nodes.
+  size_t spline_node_bytes;
+
+  /// Part of `live_bytes` held by MatrixAnim op tables, in RigAnims.
+  size_t op_bytes;
+};
+
+}  // namespace motive
+
+#endif  // MOTIVE_UTIL_MEMORY_STATS_H_
@@ -15,23 +15,52 @@
 #ifndef MOTIVE_UTIL_OPTIMIZATIONS_H_
 #define MOTIVE_UTIL_OPTIMIZATIONS_H_
 
+/// Defined when compiling for x86 with a compiler that can emit SSE4.1 and
+/// AVX2 code. Define MOTIVE_NO_X86_SIMD to build without the x86 kernels.
+#if !defined(MOTIVE_NO_X86_SIMD) &&                                  \
+    (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || \
+     defined(_M_IX86))
+#define MOTIVE_X86_SIMD
+#endif
+
+/// Defined when compiling for WebAssembly with SIMD enabled (-msimd128).
+/// Browsers without SIMD can't load such a module at all, so there's nothing
+/// to check at run time.
+#if defined(__wasm_simd128__)
+#define MOTIVE_WASM_SIMD
+#endif
+
 namespace motive {
 
+/// New values are added at the end, so the values are not ordered by
+/// instruction set.
 enum ProcessorOptimization {
   kNoOptimizations,
-  kNeonOptimizations,  /// NEON is a SIMD instruction set for ARM processors
-  kSse3Optimizations,  /// SSE is a SIMD instruction set for x86 processors
-  kSsse3Optimizations  /// SSSE3 is an extension of SSE3
+  kNeonOptimizations,      /// NEON is a SIMD instruction set for ARM processors
+  kSse3Optimizations,      /// SSE is a SIMD instruction set for x86 processors
+  kSsse3Optimizations,     /// SSSE3 is an extension of SSE3
+  kSse41Optimizations,     /// SSE4.1 is an extension of SSSE3
+  kAvx2Optimizations,      /// AVX2 extends SSE to 256-bit registers
+  kAvx512Optimizations,    /// AVX-512 extends AVX2 to 512-bit registers
+  kSse2Optimizations,      /// SSE2 is the baseline for all x86-64 processors
+  kWasmSimdOptimizations   /// 128-bit SIMD for WebAssembly in browsers
 };
 
 /// Look at the capabilities of the CPU and return the most performant set of
-/// processor optimizations. For example, on Android, return kNeonOptimizations
-/// if the CPU supports the NEON instruction set. On x86 (once we have x86
-/// optimizations), return kSse2Optimizations if it's supported, or if it's not,
-/// return kSse2Optimizations if it's supported. If none of the processors are
-/// supported, return kNoOptimizations.
+/// processor optimizations. On x86, return the newest of AVX-512, AVX2,
+/// SSE4.1, SSSE3, SSE3, and SSE2 that both the CPU and OS support. On ARM
+/// (Android, Linux, and iOS), return kNeonOptimizations if the CPU supports
+/// the NEON instruction set. In WebAssembly, return kWasmSimdOptimizations
+/// if the module was compiled with SIMD. If none are supported, return
+/// kNoOptimizations.
+///
+/// The CPU is only queried on the first call. Later calls return the cached
+/// result, so this is cheap enough to call whenever an object is created.
 ProcessorOptimization BestProcessorOptimization();
 
+/// Return a human-readable name for `optimization`, for logging.
+const char* ProcessorOptimizationName(ProcessorOptimization optimization);
+
 }  // namespace motive
 
 #endif  // MOTIVE_UTIL_OPTIMIZATIONS_H_
\ No newline at end of file
@@ -0,0 +1,125 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_UTIL_RECORDER_H_
+#define MOTIVE_UTIL_RECORDER_H_
+
+#include <string>
+#include <unordered_map>
+
+#include "motive/common.h"
+
+namespace motive {
+
+class Motivator;
+class MotiveTarget1f;
+class RigAnim;
+struct SplinePlayback;
+
+/// @class MotiveRecorder
+/// @brief Log the calls made to a MotiveEngine and its Motivators, so that a
+///        session can be replayed offline by MotiveReplayer.
+///
+/// Set with MotiveEngine::set_recorder(). These calls are recorded, with
+/// their arguments:
+///   - Motivator initialization, removal and cloning,
+///   - MotivatorNf::SetTargets() and SetSplinePlaybackRate(),
+///   - RigMotivator::BlendToAnim(), BlendToAnims() and SetPlaybackRate(),
+///   - MotiveEngine::AdvanceFrame() and AdvanceFrameAsync().
+///
+/// Motivators initialized with SplineInit, OvershootInit, SpringInit,
+/// EaseInEaseOutInit, ConstInit and RigInit can be replayed. Other types are
+/// recorded by name only, and are skipped by the replay, along with calls
+/// that pass external data such as splines. Animations are recorded by
+/// RigAnim::anim_name(), so give each animation a unique name.
+///
+/// Calls that Motive makes internally, such as initializing the children of
+/// a MatrixMotivator4f, are not recorded. Not thread safe: make the recorded
+/// calls from one thread.
+class MotiveRecorder {
+ public:
+  MotiveRecorder();
+
+  /// Forget every call recorded so far. Motivators that were initialized
+  /// before are no longer recorded.
+  void Clear();
+
+  /// Number of calls recorded.
+  size_t NumCalls() const { return num_calls_; }
+
+  /// Write the recorded calls as text to `file_name`.
+  /// Returns false if the file can't be written.
+  bool Write(const char* file_name) const;
+
+  /// @private For internal use only. Called by Motive on each recorded call.
+  void RecordInitialize(const Motivator* motivator, const MotivatorInit& init,
+                        MotiveDimension dimensions);
+  void RecordRemove(const Motivator* motivator);
+  void RecordTransfer(const Motivator* from, const Motivator* to);
+  void RecordClone(const Motivator* dst, const Motivator* src);
+  void RecordSetTargets(const Motivator* motivator, MotiveDimension dimensions,
+                        const MotiveTarget1f* targets);
+  void RecordSetSplinePlaybackRate(const Motivator* motivator,
+                                   float playback_rate);
+  void RecordBlendToAnim(const Motivator* motivator, const RigAnim& anim,
+                         const SplinePlayback& playback);
+  void RecordBlendToAnims(const Motivator* motivator, const RigAnim** anims,
+                          const SplinePlayback* playbacks,
+                          const float* weights, int count);
+  void RecordSetPlaybackRate(const Motivator* motivator, float playback_rate);
+  void RecordAdvanceFrame(MotiveTime delta_time);
+
+  /// @private For internal use only.
+  /// Stop recording for the lifetime of this variable, while Motive makes
+  /// calls of its own. `recorder` may be nullptr.
+  class NestedScope {
+   public:
+    explicit NestedScope(MotiveRecorder* recorder) : recorder_(recorder) {
+      if (recorder_ != nullptr) recorder_->depth_++;
+    }
+    ~NestedScope() {
+      if (recorder_ != nullptr) recorder_->depth_--;
+    }
+    NestedScope(const NestedScope&) = delete;
+    NestedScope& operator=(const NestedScope&) = delete;
+
+   private:
+    MotiveRecorder* recorder_;
+  };
+
+ private:
+  /// The id of `motivator` in the log, or -1 if it isn't being recorded.
+  int Id(const Motivator* motivator) const;
+
+  /// Append one call, formatted by printf rules, as a line of the log.
+  void Append(const char* format, ...);
+
+  void AppendPlayback(const SplinePlayback& playback);
+  void AppendAnimName(const RigAnim& anim);
+
+  /// The recorded calls, one per line.
+  std::string log_;
+  size_t num_calls_;
+
+  /// Ids of the Motivators whose initialization was recorded.
+  std::unordered_map<const Motivator*, int> ids_;
+  int next_id_;
+
+  /// Number of NestedScopes alive. Calls are recorded only when zero.
+  int depth_;
+};
+
+}  // namespace motive
+
+#endif  // MOTIVE_UTIL_RECORDER_H_
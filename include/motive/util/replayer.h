@@ -0,0 +1,153 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_UTIL_REPLAYER_H_
+#define MOTIVE_UTIL_REPLAYER_H_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "motive/overshoot_init.h"
+#include "motive/rig_motivator.h"
+#include "motive/vector_motivator.h"
+
+namespace motive {
+
+class MotiveEngine;
+
+/// @class MotiveReplayer
+/// @brief Re-execute the calls logged by a MotiveRecorder on another engine,
+///        for profiling a recorded session offline.
+///
+/// The recording is text, one call per line: the call's name, the id of the
+/// Motivator it was made on, then its arguments. Ids are assigned in order
+/// of initialization. Animations are referred to by name, and must be added
+/// with AddAnim() before Load().
+///
+/// Replaying is deterministic: the same recording, animations and
+/// MotiveEngine settings give the same values every time.
+class MotiveReplayer {
+ public:
+  /// @param engine Not owned. Must outlive the replayer.
+  explicit MotiveReplayer(MotiveEngine* engine);
+
+  /// Let calls that name `anim` play it. Not owned, so keep `anim` alive
+  /// while replaying. Init classes must still be registered by the caller.
+  void AddAnim(const RigAnim* anim);
+
+  /// Read a recording written by MotiveRecorder::Write(), and decode every
+  /// call, so that replaying doesn't parse. Returns false if the file can't
+  /// be read, or isn't a recording.
+  bool Load(const char* file_name);
+
+  /// Make the recorded calls up to and including the next AdvanceFrame().
+  /// Returns false once every call has been made.
+  bool ReplayFrame();
+
+  /// Destroy the Motivators that are alive, and start over from the first
+  /// call.
+  void Rewind();
+
+  /// Number of AdvanceFrame() calls in the recording.
+  int NumFrames() const { return num_frames_; }
+
+  /// Number of calls made so far that could not be replayed, because their
+  /// Motivator type, animation, or Motivator isn't available.
+  int num_skipped_calls() const { return num_skipped_calls_; }
+
+  /// The replayed Motivator with recorded `id`, or nullptr if it doesn't
+  /// exist at this point of the replay.
+  const MotivatorNf* Vector(int id) const;
+  const RigMotivator* Rig(int id) const;
+
+ private:
+  enum CallType {
+    kInitialize,
+    kRemove,
+    kClone,
+    kSetTargets,
+    kSetSplinePlaybackRate,
+    kBlendToAnim,
+    kBlendToAnims,
+    kSetPlaybackRate,
+    kAdvanceFrame,
+  };
+
+  // One recorded call, with its arguments decoded.
+  struct Call {
+    Call()
+        : type(kAdvanceFrame),
+          id(-1),
+          source_id(-1),
+          init_type(kMotivatorTypeInvalid),
+          dimensions(0),
+          has_start_values(false),
+          has_start_derivatives(false),
+          root_motion_bone(kInvalidBoneIdx),
+          delta_time(0),
+          playback_rate(1.0f) {}
+
+    CallType type;
+    int id;
+    int source_id;
+
+    // kInitialize. `init_type` is invalid if the type can't be replayed.
+    MotivatorType init_type;
+    MotiveDimension dimensions;
+    Range range;
+    OvershootInit overshoot;
+    bool has_start_values;
+    bool has_start_derivatives;
+    std::vector<float> start_values;
+    std::vector<float> start_derivatives;
+    BoneIndex root_motion_bone;
+    std::vector<BoneIndex> bone_mask;
+
+    // kAdvanceFrame.
+    MotiveTime delta_time;
+
+    // kSetTargets.
+    std::vector<MotiveTarget1f> targets;
+
+    // kSetSplinePlaybackRate and kSetPlaybackRate.
+    float playback_rate;
+
+    // kBlendToAnim and kBlendToAnims. Also kInitialize of RigInit, which
+    // holds the defining animation. Animations that weren't added are
+    // nullptr.
+    std::vector<const RigAnim*> anims;
+    std::vector<SplinePlayback> playbacks;
+    std::vector<float> weights;
+  };
+
+  bool Decode(const std::string& line, Call* call) const;
+  bool Replay(const Call& call);
+  bool Initialize(const Call& call);
+
+  MotiveEngine* engine_;
+  std::unordered_map<std::string, const RigAnim*> anims_;
+  std::vector<Call> calls_;
+  size_t next_call_;
+  int num_frames_;
+  int num_skipped_calls_;
+
+  /// The replayed Motivators, by recorded id.
+  std::unordered_map<int, MotivatorNf> vectors_;
+  std::unordered_map<int, RigMotivator> rigs_;
+};
+
+}  // namespace motive
+
+#endif  // MOTIVE_UTIL_REPLAYER_H_
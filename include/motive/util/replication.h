@@ -0,0 +1,86 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_UTIL_REPLICATION_H_
+#define MOTIVE_UTIL_REPLICATION_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "motive/math/spline_state.h"
+
+namespace motive {
+
+/// @class SplineStateCodec
+/// @brief Pack the SplineStates of MotivatorNf::SplineStates() into bytes,
+///        for another process to apply with MotivatorNf::SetSplineStates().
+///
+/// Splines are sent as their index in a table of splines that both sides
+/// have loaded in the same order, for example every spline of every
+/// animation, in load order. A spline that isn't in the table, such as the
+/// spline that MotivatorNf::SetTargets() creates, is sent as its current
+/// value, held constant.
+///
+/// Each state is delta encoded against a `previous` state that the receiver
+/// already has, usually the states sent on the previous update. Only the
+/// fields that differ are sent, in a one byte mask followed by the changed
+/// fields, little endian. A spline that plays on steadily only changes its
+/// x, so costs 5 bytes per value. Fields are compared bit for bit, so the
+/// receiver's states are exact copies of the sender's.
+///
+/// Both sides must agree on `previous`. If an update can be lost, send
+/// against the last states that the receiver acknowledged, or against no
+/// previous states at all.
+class SplineStateCodec {
+ public:
+  /// Wire id of a state whose spline is nullptr.
+  static const uint32_t kNoSpline = 0xFFFFFFFF;
+
+  /// `splines` is the table of splines. `splines[i]` is sent as id `i`.
+  /// The table must outlive the codec.
+  SplineStateCodec(const CompactSpline* const* splines, int num_splines);
+
+  /// Append the `count` states to `out`. `previous` is an array of `count`
+  /// states that the receiver already has, or nullptr to send every field.
+  void Encode(const SplineState* states, const SplineState* previous,
+              size_t count, std::vector<uint8_t>* out) const;
+
+  /// Read `count` states from the `size` bytes at `data`, which were written
+  /// by Encode() with the same `previous` states. `states` may be the same
+  /// array as `previous`. Returns the number of bytes read, or 0 if the data
+  /// is too short or malformed, in which case `states` are undefined.
+  size_t Decode(const uint8_t* data, size_t size, const SplineState* previous,
+                size_t count, SplineState* states) const;
+
+  /// Bytes Encode() appends for `count` states, at most.
+  static size_t MaxEncodedSize(size_t count);
+
+ private:
+  // Return `state` as the receiver will see it. If `state` plays a spline
+  // that's not in the table, return its current value held constant.
+  SplineState WireState(const SplineState& state) const;
+  uint32_t SplineId(const CompactSpline* spline) const;
+
+  const CompactSpline* const* splines_;
+  int num_splines_;
+
+  // Wire id of each spline in `splines_`.
+  std::unordered_map<const CompactSpline*, uint32_t> ids_;
+};
+
+}  // namespace motive
+
+#endif  // MOTIVE_UTIL_REPLICATION_H_
@@ -0,0 +1,214 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_UTIL_SNAPSHOT_H_
+#define MOTIVE_UTIL_SNAPSHOT_H_
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+namespace motive {
+
+/// @class MotiveSnapshot
+/// @brief The state of every Motivator in a MotiveEngine, in one flat buffer.
+///
+/// Filled by MotiveEngine::Snapshot() and read by MotiveEngine::Restore().
+/// The buffer is kept when the snapshot is overwritten, so once it has grown
+/// to fit the engine, taking more snapshots doesn't allocate.
+class MotiveSnapshot {
+ public:
+  MotiveSnapshot() : size_(0) {}
+
+  /// Bytes of state held.
+  size_t Size() const { return size_; }
+
+  /// Forget the state, but keep the buffer.
+  void Clear() { size_ = 0; }
+
+  /// Grow the buffer to `size` bytes now, instead of in the first Snapshot().
+  void Reserve(size_t size) {
+    if (size > buffer_.size()) buffer_.resize(size);
+  }
+
+ private:
+  friend class MotiveStateArchive;
+
+  std::vector<uint8_t> buffer_;
+
+  // Bytes of `buffer_` in use.
+  size_t size_;
+};
+
+/// @class MotiveStateArchive
+/// @brief Saves a processor's state to a MotiveSnapshot, or reads it back.
+///
+/// MotiveProcessor::ArchiveState() passes the same arrays and values, in the
+/// same order, whatever the mode, so that one function saves, verifies and
+/// restores the state.
+///
+/// Everything passed is copied with memcpy, so it must not own memory or
+/// have virtual functions. Pointers are copied as they are, so whatever they
+/// point to must outlive the snapshot.
+class MotiveStateArchive {
+ public:
+  enum Mode {
+    /// Append the state to the snapshot.
+    kSave,
+
+    /// Check that the layout of the snapshot matches, without changing
+    /// anything.
+    kVerify,
+
+    /// Overwrite the state with the snapshot's.
+    kRestore,
+  };
+
+  /// Save to the end of `snapshot`.
+  explicit MotiveStateArchive(MotiveSnapshot* snapshot)
+      : mode_(kSave),
+        snapshot_(snapshot),
+        read_(nullptr),
+        read_size_(0),
+        offset_(0),
+        ok_(true) {}
+
+  /// Verify or restore from the start of `snapshot`.
+  MotiveStateArchive(Mode mode, const MotiveSnapshot& snapshot)
+      : mode_(mode),
+        snapshot_(nullptr),
+        read_(snapshot.buffer_.data()),
+        read_size_(snapshot.size_),
+        offset_(0),
+        ok_(true) {
+    assert(mode != kSave);
+  }
+
+  Mode mode() const { return mode_; }
+  bool saving() const { return mode_ == kSave; }
+  bool restoring() const { return mode_ == kRestore; }
+
+  /// False if the snapshot's layout didn't match, or it was too short.
+  /// Once false, the archive reads and writes nothing more.
+  bool ok() const { return ok_; }
+
+  /// True if every byte of the snapshot has been read.
+  bool AtEnd() const { return offset_ == read_size_; }
+
+  /// State held in `size` raw bytes.
+  void Bytes(void* bytes, size_t size) {
+    if (mode_ == kSave) {
+      Write(bytes, size);
+      return;
+    }
+    const uint8_t* saved = Read(size);
+    if (saved != nullptr && mode_ == kRestore && size > 0) {
+      memcpy(bytes, saved, size);
+    }
+  }
+
+  /// State held in a single value.
+  template <class T>
+  void Value(T* value) {
+    Bytes(value, sizeof(T));
+  }
+
+  /// State held in an array. When restored, `v` is resized to the length it
+  /// had when saved, so reserve it to avoid allocating.
+  template <class T, class Allocator>
+  void Array(std::vector<T, Allocator>* v) {
+    size_t size = v->size();
+    if (mode_ == kSave) {
+      Write(&size, sizeof(size));
+      Write(v->data(), size * sizeof(T));
+      return;
+    }
+    const uint8_t* saved_size = Read(sizeof(size));
+    if (saved_size == nullptr) return;
+    memcpy(&size, saved_size, sizeof(size));
+    const uint8_t* saved = Read(size * sizeof(T));
+    if (saved == nullptr || mode_ != kRestore) return;
+    v->resize(size);
+    if (size > 0) memcpy(v->data(), saved, size * sizeof(T));
+  }
+
+  /// Structure, such as which Motivator holds which index, held in `size`
+  /// raw bytes. Structure isn't restored: if it differs from when it was
+  /// saved, verifying fails.
+  void LayoutBytes(const void* bytes, size_t size) {
+    if (mode_ == kSave) {
+      Write(bytes, size);
+      return;
+    }
+    const uint8_t* saved = Read(size);
+    if (saved != nullptr && mode_ == kVerify && size > 0 &&
+        memcmp(saved, bytes, size) != 0) {
+      ok_ = false;
+    }
+  }
+
+  /// Structure held in a single value.
+  template <class T>
+  void LayoutValue(const T& value) {
+    LayoutBytes(&value, sizeof(T));
+  }
+
+  /// Structure held in an array.
+  template <class T, class Allocator>
+  void Layout(const std::vector<T, Allocator>& v) {
+    LayoutValue(v.size());
+    if (ok_) LayoutBytes(v.data(), v.size() * sizeof(T));
+  }
+
+ private:
+  void Write(const void* bytes, size_t size) {
+    if (size == 0) return;
+    std::vector<uint8_t>& buffer = snapshot_->buffer_;
+    const size_t end = snapshot_->size_ + size;
+    if (end > buffer.size()) buffer.resize(std::max(end, 2 * buffer.size()));
+    memcpy(buffer.data() + snapshot_->size_, bytes, size);
+    snapshot_->size_ = end;
+  }
+
+  // Return the next `size` bytes of the snapshot, or nullptr if it's too
+  // short.
+  const uint8_t* Read(size_t size) {
+    if (!ok_ || size > read_size_ - offset_) {
+      ok_ = false;
+      return nullptr;
+    }
+    const uint8_t* bytes = read_ + offset_;
+    offset_ += size;
+    return bytes;
+  }
+
+  Mode mode_;
+
+  // Written to when saving.
+  MotiveSnapshot* snapshot_;
+
+  // Read from when verifying or restoring.
+  const uint8_t* read_;
+  size_t read_size_;
+  size_t offset_;
+
+  bool ok_;
+};
+
+}  // namespace motive
+
+#endif  // MOTIVE_UTIL_SNAPSHOT_H_
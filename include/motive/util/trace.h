@@ -0,0 +1,140 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_UTIL_TRACE_H_
+#define MOTIVE_UTIL_TRACE_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace motive {
+
+/// @class MotiveTraceSink
+/// @brief Receives the spans of work done by Motive, for timeline profilers.
+///
+/// Spans are emitted around MotiveEngine::AdvanceFrame(), each processor's
+/// AdvanceFrame() and Defragment(), bulk cubic initialization in
+/// BulkSplineEvaluator, and the rig transform passes.
+///
+/// Spans are emitted on the thread that does the work, so when frames are
+/// advanced on several threads, implementations must be thread safe. Spans
+/// on one thread are properly nested.
+class MotiveTraceSink {
+ public:
+  virtual ~MotiveTraceSink() {}
+
+  /// A span of work called `name`, done by `owner` such as a processor's
+  /// class name, began at `time_ns` on the calling thread. Both strings are
+  /// static, so they may be kept without copying. `time_ns` is from
+  /// TraceTimeNs().
+  virtual void BeginSpan(const char* name, const char* owner,
+                         uint64_t time_ns) = 0;
+
+  /// The most recent span begun on the calling thread ended at `time_ns`.
+  virtual void EndSpan(const char* name, const char* owner,
+                       uint64_t time_ns) = 0;
+};
+
+/// Send spans to `sink`, or stop tracing if `sink` is nullptr. Not owned, so
+/// keep `sink` alive until tracing is stopped and no frame is in flight.
+/// Applies to every MotiveEngine in the process.
+void SetMotiveTraceSink(MotiveTraceSink* sink);
+
+/// Nanoseconds on a monotonic clock. Only differences are meaningful.
+uint64_t TraceTimeNs();
+
+/// @class ChromeTraceWriter
+/// @brief A MotiveTraceSink that records spans in memory, and writes them in
+///        the Chrome trace event format.
+///
+/// Load the file in chrome://tracing or https://ui.perfetto.dev to see each
+/// thread's timeline.
+class ChromeTraceWriter : public MotiveTraceSink {
+ public:
+  ChromeTraceWriter();
+
+  void BeginSpan(const char* name, const char* owner,
+                 uint64_t time_ns) override;
+  void EndSpan(const char* name, const char* owner, uint64_t time_ns) override;
+
+  /// Forget every span recorded so far.
+  void Clear();
+
+  /// Number of begin and end events recorded.
+  size_t NumEvents() const;
+
+  /// Write the recorded spans as Chrome trace JSON to `file_name`.
+  /// Returns false if the file can't be written.
+  bool Write(const char* file_name) const;
+
+ private:
+  struct Event {
+    const char* name;
+    const char* owner;
+    uint64_t time_ns;
+    int thread;
+    bool begin;
+  };
+
+  void Record(const char* name, const char* owner, uint64_t time_ns,
+              bool begin);
+
+  mutable std::mutex mutex_;
+  std::vector<Event> events_;
+
+  /// Threads seen so far. A thread's index is its id in the trace.
+  std::vector<std::thread::id> threads_;
+
+  /// Event times are written relative to this.
+  uint64_t start_ns_;
+};
+
+namespace detail {
+
+// The sink set by SetMotiveTraceSink(), or nullptr when not tracing.
+extern std::atomic<MotiveTraceSink*> g_trace_sink;
+
+}  // namespace detail
+
+/// @class TraceScope
+/// @brief Emit a span for the lifetime of this variable, if tracing.
+///
+/// Costs one atomic load when no sink is set. `name` and `owner` must be
+/// static strings.
+class TraceScope {
+ public:
+  TraceScope(const char* name, const char* owner)
+      : sink_(detail::g_trace_sink.load(std::memory_order_acquire)),
+        name_(name),
+        owner_(owner) {
+    if (sink_ != nullptr) sink_->BeginSpan(name_, owner_, TraceTimeNs());
+  }
+  ~TraceScope() {
+    if (sink_ != nullptr) sink_->EndSpan(name_, owner_, TraceTimeNs());
+  }
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+ private:
+  MotiveTraceSink* sink_;
+  const char* name_;
+  const char* owner_;
+};
+
+}  // namespace motive
+
+#endif  // MOTIVE_UTIL_TRACE_H_
@@ -15,6 +15,10 @@
 #ifndef MOTIVE_VECTOR_MOTIVATOR_H_
 #define MOTIVE_VECTOR_MOTIVATOR_H_
 
+#include <algorithm>
+#include <vector>
+
+#include "motive/math/spline_stream.h"
 #include "motive/motivator.h"
 #include "motive/vector_processor.h"
 
@@ -90,7 +94,12 @@ class MotivatorNf : public Motivator {
   }
 
   // Get array of length `dimensions`.
-  const float* Values() const { return Processor().Values(index_); }
+  const float* Values() const {
+    // Skip the virtual call when the processor's values are contiguous, as
+    // they are for splines. Matrix operations read thousands of these.
+    const float* bulk = Processor().BulkValues();
+    return bulk != nullptr ? bulk + index_ : Processor().Values(index_);
+  }
   void Velocities(float* out) const {
     return Processor().Velocities(index_, Dimensions(), out);
   }
@@ -107,12 +116,34 @@ class MotivatorNf : public Motivator {
     return Processor().Differences(index_, Dimensions(), out);
   }
 
+  /// Write the values blended between the last two fixed steps, for
+  /// rendering between them. Pass MotiveEngine::render_alpha() as `alpha`.
+  /// Like Values(), safe to call while a double-buffered engine advances.
+  /// See MotiveEngine::set_fixed_time_step().
+  void InterpolatedValues(float alpha, float* out) const {
+    Processor().InterpolatedValues(index_, Dimensions(), alpha, out);
+  }
+
+  /// Write the values straight into `output`, for example a network packet
+  /// or a mapped GPU buffer, in its format, whenever the engine advances.
+  /// This saves converting Values() afterwards. The buffer must stay valid
+  /// until a default ValueOutput is set, or the Motivator is reset. It's
+  /// written while the engine advances, so must not be read during
+  /// AdvanceFrame().
+  void SetValueOutput(const ValueOutput& output) {
+    Processor().SetValueOutput(index_, Dimensions(), output);
+  }
+
   /// Returns time remaining until target is reached.
   /// The unit of time is determined by the calling program.
   MotiveTime TargetTime() const {
     return Processor().TargetTime(index_, Dimensions());
   }
 
+  /// Returns true once the Motivator has reached the end of its curve, and
+  /// won't move again until given a new target.
+  bool Finished() const { return Processor().Finished(index_, Dimensions()); }
+
   /// Returns the shape of the current curve.
   MotiveCurveShape MotiveShape() const {
     return Processor().MotiveShape(index_);
@@ -156,6 +187,24 @@ class MotivatorNf : public Motivator {
     Processor().SetSplines(index_, Dimensions(), splines, playback);
   }
 
+  /// Gather the playback state of each dimension: the spline, the position
+  /// along it, the playback rate, and the current cubic, including any blend
+  /// in progress. Values not driven by a spline are described as constant.
+  /// @param states Output array of length Dimensions().
+  void SplineStates(SplineState* states) const {
+    Processor().SplineStates(index_, Dimensions(), states);
+  }
+
+  /// Continue playback exactly from `states`, as gathered by SplineStates(),
+  /// usually on another MotiveEngine. Unlike SetSplines(), any blend in
+  /// progress continues along the same curve instead of restarting. The
+  /// splines are not copied, so must outlive their playback, as with
+  /// SetSplines(). To send states to another process, use SplineStateCodec.
+  /// @param states Array of length Dimensions().
+  void SetSplineStates(const SplineState* states) {
+    Processor().SetSplineStates(index_, Dimensions(), states);
+  }
+
   /// Seek to a specific time in the spline.
   /// @param time The time (in the spline's x-axis) to seek to.
   void SetSplineTime(MotiveTime time) {
@@ -168,6 +217,9 @@ class MotivatorNf : public Motivator {
   ///     1   ==> authored speed
   ///     2   ==> double speed (fast forward)
   void SetSplinePlaybackRate(float playback_rate) {
+    if (processor_->recorder() != nullptr) {
+      processor_->recorder()->RecordSetSplinePlaybackRate(this, playback_rate);
+    }
     Processor().SetSplinePlaybackRate(index_, Dimensions(), playback_rate);
   }
 
@@ -182,6 +234,9 @@ class MotivatorNf : public Motivator {
   /// @param targets The targets that each value should achieve.
   ///                An array of length Dimensions().
   void SetTargets(const MotiveTarget1f* targets) {
+    if (processor_->recorder() != nullptr) {
+      processor_->recorder()->RecordSetTargets(this, Dimensions(), targets);
+    }
     Processor().SetTargets(index_, Dimensions(), targets);
   }
 
@@ -219,6 +274,8 @@ class MotivatorNf : public Motivator {
   }
 
  protected:
+  friend class MotivatorSplineBatch;
+
   MotiveProcessorNf& Processor() {
     return *static_cast<MotiveProcessorNf*>(processor_);
   }
@@ -227,6 +284,61 @@ class MotivatorNf : public Motivator {
   }
 };
 
+/// @class MotivatorSplineBatch
+/// @brief Defers MotivatorNf::SetSpline() calls, and makes them with one call
+///        into each processor.
+///
+/// Useful when a single change, such as blending a crowd to a new animation,
+/// starts splines on many one-dimensional Motivators. Motivators are
+/// remembered by index, so they may be moved, but must not be destroyed
+/// before Flush(). Each Motivator may be added at most once per Flush().
+class MotivatorSplineBatch {
+ public:
+  /// Have `motivator` follow `spline` when Flush() is called.
+  void Add(MotivatorNf* motivator, const CompactSpline* spline) {
+    assert(motivator->Dimensions() == 1 && spline != nullptr);
+    const Entry entry = {&motivator->Processor(), motivator->index_, spline};
+    entries_.push_back(entry);
+  }
+
+  /// Start every spline added since the last Flush(), with `playback`.
+  /// Consecutive Motivators with the same processor are started together.
+  void Flush(const SplinePlayback& playback) {
+    size_t begin = 0;
+    while (begin < entries_.size()) {
+      MotiveProcessorNf* processor = entries_[begin].processor;
+      indices_.clear();
+      splines_.clear();
+      size_t end = begin;
+      for (; end < entries_.size() && entries_[end].processor == processor;
+           ++end) {
+        indices_.push_back(entries_[end].index);
+        splines_.push_back(entries_[end].spline);
+      }
+      processor->SetSplinesAt(indices_.data(),
+                              static_cast<MotiveIndex>(indices_.size()),
+                              splines_.data(), playback);
+      begin = end;
+    }
+    entries_.clear();
+  }
+
+  bool empty() const { return entries_.empty(); }
+
+ private:
+  struct Entry {
+    MotiveProcessorNf* processor;
+    MotiveIndex index;
+    const CompactSpline* spline;
+  };
+
+  std::vector<Entry> entries_;
+
+  // Scratch space for Flush(), held here to avoid reallocating.
+  std::vector<MotiveIndex> indices_;
+  std::vector<const CompactSpline*> splines_;
+};
+
 /// @class MotivatorXfTemplate
 /// @brief Animate a vector of floating-point values.
 ///
@@ -296,7 +408,15 @@ class MotivatorXfTemplate : public MotivatorNf {
   /// Motivator.
   /// Note that the "Vec()" parameter is just a syntactic hack used to access
   /// the correct overloaded function in the processor.
-  Vec Value() const { return C::FromPtr(Processor().Values(index_), Vec()); }
+  Vec Value() const { return C::FromPtr(Values(), Vec()); }
+
+  /// Returns the value blended between the last two fixed steps.
+  /// See MotivatorNf::InterpolatedValues().
+  Vec InterpolatedValue(float alpha) const {
+    float values[kDimensions];
+    InterpolatedValues(alpha, values);
+    return C::FromPtr(values, Vec());
+  }
 
   /// Returns the current rate of change of this motivator. For example,
   /// if this Motivator is being driven by a spline, returns the derivative
@@ -358,6 +478,9 @@ class MotivatorXfTemplate : public MotivatorNf {
   ///          value. If the current value is not included, maintain the
   ///          existing current value.
   void SetTarget(const Target& t) {
+    if (processor_->recorder() != nullptr) {
+      processor_->recorder()->RecordSetTargets(this, kDimensions, t.targets());
+    }
     Processor().SetTargets(index_, kDimensions, t.targets());
   }
 
@@ -377,7 +500,125 @@ class MotivatorXfTemplate : public MotivatorNf {
                                    C::ToPtr(target_velocity), shape);
   }
 
+  /// Drive each of `motivators` towards its target with a single call into
+  /// their processor. Prefer this to calling SetTarget() on each Motivator
+  /// when many Motivators get new targets at once, since the processor can
+  /// then validate and initialize them in bulk.
+  /// @param motivators Array of length `count`. Every Motivator must be valid
+  ///                   and be driven by the same processor. That is, they must
+  ///                   be initialized with the same MotivatorInit type and
+  ///                   MotiveEngine.
+  /// @param targets Array of length `count`. `targets[i]` is the target of
+  ///                `motivators[i]`.
+  static void SetTargetsInBulk(MotivatorXfTemplate* motivators, size_t count,
+                               const Target* targets) {
+    if (count == 0) return;
+
+    // Targets hold nothing but their one-dimensional targets, so `targets` is
+    // already the contiguous array the processor wants.
+    static_assert(sizeof(Target) == kDimensions * sizeof(MotiveTarget1f),
+                  "Target must be an array of MotiveTarget1f");
+    MotiveProcessorNf& processor = motivators[0].Processor();
+    std::vector<MotiveIndex> indices;
+    indices.reserve(count * kDimensions);
+    for (size_t i = 0; i < count; ++i) {
+      assert(&motivators[i].Processor() == &processor);
+      for (MotiveDimension j = 0; j < kDimensions; ++j) {
+        indices.push_back(motivators[i].index_ + j);
+      }
+    }
+    processor.SetTargetsAt(indices.data(),
+                           static_cast<MotiveIndex>(indices.size()),
+                           targets[0].targets());
+  }
+
+  /// Copy the values of `count` Motivators into `out`, in the order of
+  /// `motivators`, with a single call into their processor. Useful for
+  /// syncing the values into an external array of components every frame.
+  /// Unlike processor indices, the order of `motivators` is unaffected by
+  /// Motivators being created and destroyed.
+  /// @param motivators Array of length `count`, all driven by the same
+  ///                   processor. See SetTargetsInBulk().
+  /// @param stride Number of floats between the values of consecutive
+  ///               Motivators in `out`. Must be at least kDimensions.
+  /// @param out The values of `motivators[i]` are written to
+  ///            `out[i * stride]` to `out[i * stride + kDimensions - 1]`.
+  static void ExportValues(const MotivatorXfTemplate* motivators,
+                           size_t count, size_t stride, float* out) {
+    if (count == 0) return;
+    std::vector<MotiveIndex> indices;
+    GatherIndices(motivators, count, &indices);
+    motivators[0].Processor().ExportValues(indices.data(), count, kDimensions,
+                                           stride, out);
+  }
+
+  /// Same as ExportValues(), but for Velocity().
+  static void ExportVelocities(const MotivatorXfTemplate* motivators,
+                               size_t count, size_t stride, float* out) {
+    if (count == 0) return;
+    std::vector<MotiveIndex> indices;
+    GatherIndices(motivators, count, &indices);
+    motivators[0].Processor().ExportVelocities(indices.data(), count,
+                                               kDimensions, stride, out);
+  }
+
+  /// Same as calling SetTargetWithShape() on each of `motivators`, with the
+  /// same `shape`, but with a single call into their processor.
+  /// @param motivators Array of length `count`, all driven by the same
+  ///                   processor. See SetTargetsInBulk().
+  /// @param target_values Array of length `count`.
+  /// @param target_velocities Array of length `count`.
+  static void SetTargetsWithShapeInBulk(MotivatorXfTemplate* motivators,
+                                        size_t count, const Vec* target_values,
+                                        const Vec* target_velocities,
+                                        const MotiveCurveShape& shape) {
+    if (count == 0) return;
+
+    MotiveProcessorNf& processor = motivators[0].Processor();
+    std::vector<MotiveIndex> indices;
+    std::vector<float> values;
+    std::vector<float> velocities;
+    indices.reserve(count * kDimensions);
+    values.reserve(count * kDimensions);
+    velocities.reserve(count * kDimensions);
+    for (size_t i = 0; i < count; ++i) {
+      assert(&motivators[i].Processor() == &processor);
+      const float* value = C::ToPtr(target_values[i]);
+      const float* velocity = C::ToPtr(target_velocities[i]);
+      for (MotiveDimension j = 0; j < kDimensions; ++j) {
+        indices.push_back(motivators[i].index_ + j);
+        values.push_back(value[j]);
+        velocities.push_back(velocity[j]);
+      }
+    }
+    processor.SetTargetsWithShapeAt(indices.data(),
+                                    static_cast<MotiveIndex>(indices.size()),
+                                    values.data(), velocities.data(), shape);
+  }
+
+  /// Returns the most recent MotiveEngine::frame_count() on which Value()
+  /// changed. If Value() might change every frame, returns the largest
+  /// uint32_t instead.
+  uint32_t ChangedFrame() const {
+    const uint32_t* bulk = Processor().BulkChangedFrames();
+    if (bulk == nullptr) return Processor().ChangedFrame(index_, kDimensions);
+    return *std::max_element(bulk + index_, bulk + index_ + kDimensions);
+  }
+
   MotiveDimension Dimensions() const { return kDimensions; }
+
+ private:
+  // Set `indices` to the first index of each of `motivators`.
+  static void GatherIndices(const MotivatorXfTemplate* motivators,
+                            size_t count, std::vector<MotiveIndex>* indices) {
+    const MotiveProcessorNf* processor = &motivators[0].Processor();
+    (void)processor;
+    indices->resize(count);
+    for (size_t i = 0; i < count; ++i) {
+      assert(&motivators[i].Processor() == processor);
+      (*indices)[i] = motivators[i].index_;
+    }
+  }
 };
 
 // These Motivator types use mathfu in their external API.
@@ -386,6 +627,108 @@ typedef MotivatorXfTemplate<MathFuVectorConverter, 2> Motivator2f;
 typedef MotivatorXfTemplate<MathFuVectorConverter, 3> Motivator3f;
 typedef MotivatorXfTemplate<MathFuVectorConverter, 4> Motivator4f;
 
+/// @class MotivatorXfTypedTemplate
+/// @brief A MotivatorXfTemplate whose processor is known to be a `ProcessorT`.
+///
+/// `ProcessorT` is a MotiveProcessorNf whose accessors are final, such as
+/// SplineProcessor. Value(), Velocity(), TargetValue(), etc. call those
+/// accessors directly, instead of through MotiveProcessorNf's virtual
+/// functions, so they can be inlined into the caller. Only initialize these
+/// motivators with the MotivatorInit that creates a `ProcessorT`; use
+/// MotivatorXfTemplate when the processor isn't known at compile time.
+template <class VectorConverter, MotiveDimension kDimensionsParam,
+          class ProcessorT>
+class MotivatorXfTypedTemplate
+    : public MotivatorXfTemplate<VectorConverter, kDimensionsParam> {
+  typedef MotivatorXfTemplate<VectorConverter, kDimensionsParam> Base;
+
+ public:
+  typedef typename Base::C C;
+  typedef typename Base::Vec Vec;
+  typedef typename Base::Target Target;
+  static const MotiveDimension kDimensions = kDimensionsParam;
+
+  MotivatorXfTypedTemplate() {}
+  MotivatorXfTypedTemplate(const MotivatorInit& init, MotiveEngine* engine)
+      : Base(init, engine) {}
+  MotivatorXfTypedTemplate(const MotivatorInit& init, MotiveEngine* engine,
+                           const Target& t)
+      : Base(init, engine, t) {}
+
+  Vec Value() const {
+    return C::FromPtr(TypedProcessor().Values(this->index_), Vec());
+  }
+  Vec Velocity() const {
+    Vec r;
+    TypedProcessor().Velocities(this->index_, kDimensions, C::ToPtr(r));
+    return r;
+  }
+  Vec Direction() const {
+    Vec r;
+    TypedProcessor().Directions(this->index_, kDimensions, C::ToPtr(r));
+    return r;
+  }
+  Vec TargetValue() const {
+    Vec r;
+    TypedProcessor().TargetValues(this->index_, kDimensions, C::ToPtr(r));
+    return r;
+  }
+  Vec TargetVelocity() const {
+    Vec r;
+    TypedProcessor().TargetVelocities(this->index_, kDimensions,
+                                      C::ToPtr(r));
+    return r;
+  }
+  Vec Difference() const {
+    Vec r;
+    TypedProcessor().Differences(this->index_, kDimensions, C::ToPtr(r));
+    return r;
+  }
+
+ private:
+  const ProcessorT& TypedProcessor() const {
+    const ProcessorT* processor =
+        static_cast<const ProcessorT*>(this->processor_);
+    assert(processor->ProcessorT::Type() == processor->Type());
+    return *processor;
+  }
+};
+
+/// @class MotivatorStreamTarget
+/// @brief Lets a SplineStreamer play a long or live curve on a
+///        one-dimensional motivator, such as a Motivator1f.
+///
+/// The motivator keeps its index and its processor's cheap per-frame update,
+/// while the streamer swaps chunks under it. Call SplineStreamer::Update()
+/// after every MotiveEngine::AdvanceFrame().
+class MotivatorStreamTarget : public SplineStreamTarget {
+ public:
+  /// @param motivator Not owned. Must be valid, of dimension 1, and outlive
+  ///                  the streamer that uses this target.
+  explicit MotivatorStreamTarget(MotivatorNf* motivator)
+      : motivator_(motivator) {
+    assert(motivator->Dimensions() == 1);
+  }
+
+  float X() const override {
+    return static_cast<float>(motivator_->SplineTime());
+  }
+
+  float EndX() const override {
+    const CompactSpline* spline = nullptr;
+    motivator_->Splines(&spline);
+    return spline == nullptr ? 0.0f : spline->EndX();
+  }
+
+  void SetSpline(const CompactSpline* spline,
+                 const SplinePlayback& playback) override {
+    motivator_->SetSpline(*spline, playback);
+  }
+
+ private:
+  MotivatorNf* motivator_;
+};
+
 }  // namespace motive
 
 #endif  // MOTIVE_VECTOR_MOTIVATOR_H_
@@ -15,10 +15,60 @@
 #ifndef MOTIVE_VECTOR_PROCESSOR_H_
 #define MOTIVE_VECTOR_PROCESSOR_H_
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "motive/math/float.h"
+#include "motive/math/spline_state.h"
 #include "motive/processor.h"
 
 namespace motive {
 
+/// @class ValueOutput
+/// @brief Destination for a MotivatorNf's values, written in a compact format
+///        whenever its processor advances.
+///
+/// The value of dimension i is written to element i of `data`, typically in
+/// a network packet or a mapped GPU buffer.
+struct ValueOutput {
+  enum Format {
+    /// 32-bit floats, as returned by MotivatorNf::Values().
+    kFloat,
+
+    /// IEEE 754 half-precision floats.
+    kHalf,
+
+    /// Signed normalized 16-bit integers, for values in [-1, 1] such as
+    /// quaternion components. See FloatToSnorm16().
+    kSnorm16,
+
+    /// Unsigned 16-bit integers spanning `ranges[i]`, or, when `ranges` is
+    /// nullptr, the y range of the spline that dimension i is playing, before
+    /// SplinePlayback::y_scale and y_offset. See FloatToUnorm16().
+    kUnorm16InRange,
+  };
+
+  ValueOutput() : data(nullptr), format(kFloat), ranges(nullptr) {}
+  ValueOutput(void* data, Format format, const Range* ranges = nullptr)
+      : data(data), format(format), ranges(ranges) {}
+
+  /// Size of one value, in bytes.
+  size_t ElementSize() const {
+    return format == kFloat ? sizeof(float) : sizeof(uint16_t);
+  }
+
+  /// Where to write the values. Nothing is written when nullptr.
+  void* data;
+
+  /// How to write the values.
+  Format format;
+
+  /// One range per dimension, for kUnorm16InRange. Not owned.
+  const Range* ranges;
+};
+
 /// @class MotiveProcessorNf
 /// @brief Interface for motivator types that drive a single float value.
 ///
@@ -26,6 +76,11 @@ namespace motive {
 /// MotivatorXf.
 class MotiveProcessorNf : public MotiveProcessor {
  public:
+  MotiveProcessorNf()
+      : bulk_values_(nullptr),
+        front_bulk_values_(nullptr),
+        bulk_changed_frames_(nullptr) {}
+
   // Convenience functions for getting a single value. Prefer calling the
   // bulk values, especially when inside a loop. They avoid the virtual
   // function call overhead, and offer more opportunities for optimizations.
@@ -57,6 +112,106 @@ class MotiveProcessorNf : public MotiveProcessor {
   }
 
   virtual const float* Values(MotiveIndex index) const = 0;
+
+  // Write the values at [index, index + dimensions), blended from their
+  // values before the latest fixed step, at `alpha` = 0, to their current
+  // values, at `alpha` = 1. Indices that haven't been through a fixed step
+  // since they were initialized are written as is.
+  // Reads the front buffer when double buffered, like Values().
+  // See MotiveEngine::set_fixed_time_step().
+  void InterpolatedValues(MotiveIndex index, MotiveDimension dimensions,
+                          float alpha, float* out) const {
+    const float* values = Values(index);
+    const MotiveVector<float>& previous_values =
+        ReadFrontBuffer() ? front_previous_values_ : previous_values_;
+    for (MotiveDimension i = 0; i < dimensions; ++i) {
+      const float previous = index + i < previous_values.size()
+                                 ? previous_values[index + i]
+                                 : std::numeric_limits<float>::quiet_NaN();
+      out[i] = std::isnan(previous)
+                   ? values[i]
+                   : previous + alpha * (values[i] - previous);
+    }
+  }
+
+  // Write the values at [index, index + dimensions) to `output` whenever the
+  // processor advances. Pass a default ValueOutput to stop.
+  void SetValueOutput(MotiveIndex index, MotiveDimension dimensions,
+                      const ValueOutput& output) {
+    RemoveValueOutput(index);
+    if (output.data == nullptr) return;
+    IndexedValueOutput entry;
+    entry.index = index;
+    entry.dimensions = dimensions;
+    entry.output = output;
+    value_outputs_.push_back(entry);
+  }
+
+  void WriteOutputs() override {
+    for (auto it = value_outputs_.begin(); it != value_outputs_.end(); ++it) {
+      WriteValueOutput(*it);
+    }
+  }
+
+  // Remember the current values, for InterpolatedValues(). The previous
+  // values are only allocated once the engine takes its first fixed step.
+  void BeginFixedStep() override {
+    const size_t num_indices = NumAllocatedIndices();
+    if (previous_values_.size() < num_indices) {
+      previous_values_.resize(num_indices,
+                              std::numeric_limits<float>::quiet_NaN());
+    }
+    ranges_.clear();
+    ActiveIndexRanges(&ranges_);
+    const float* bulk = BulkValues();
+    for (auto it = ranges_.begin(); it != ranges_.end(); ++it) {
+      for (MotiveIndex index = it->start(); index < it->end();
+           index += Dimensions(index)) {
+        const float* values = bulk != nullptr ? bulk + index : Values(index);
+        std::copy(values, values + Dimensions(index),
+                  previous_values_.begin() + index);
+      }
+    }
+  }
+
+  // The values of every index as one contiguous array, if the derived class
+  // stores them that way, or nullptr otherwise. That is, when non-null,
+  // BulkValues() + index == Values(index). Unlike Values(), this isn't
+  // virtual, so Motivators can read their values without a virtual call.
+  const float* BulkValues() const {
+    return ReadFrontBuffer() ? front_bulk_values_ : bulk_values_;
+  }
+
+  // The ChangedFrame() of every index as one contiguous array, or nullptr if
+  // the derived class doesn't store them that way.
+  const uint32_t* BulkChangedFrames() const { return bulk_changed_frames_; }
+
+  // For every i in [0, count), write the `dimensions` values starting at
+  // `indices[i]` to `out + i * stride`. `stride` is in floats, so that
+  // values can be written straight into an array of structs. Reads the bulk
+  // values directly when possible, so there's no virtual call per index.
+  void ExportValues(const MotiveIndex* indices, size_t count,
+                    MotiveDimension dimensions, size_t stride,
+                    float* out) const {
+    const float* bulk = BulkValues();
+    for (size_t i = 0; i < count; ++i, out += stride) {
+      const float* values = bulk != nullptr ? bulk + indices[i]
+                                            : Values(indices[i]);
+      for (MotiveDimension j = 0; j < dimensions; ++j) {
+        out[j] = values[j];
+      }
+    }
+  }
+
+  // Same as ExportValues(), but for Velocities(). Derived classes can
+  // override this to avoid the virtual call per index.
+  virtual void ExportVelocities(const MotiveIndex* indices, size_t count,
+                                MotiveDimension dimensions, size_t stride,
+                                float* out) const {
+    for (size_t i = 0; i < count; ++i, out += stride) {
+      Velocities(indices[i], dimensions, out);
+    }
+  }
   virtual void Velocities(MotiveIndex index, MotiveDimension dimensions,
                           float* out) const = 0;
   virtual void Directions(MotiveIndex index, MotiveDimension dimensions,
@@ -74,6 +229,24 @@ class MotiveProcessorNf : public MotiveProcessor {
                                 MotiveDimension dimensions) const = 0;
   virtual MotiveTime SplineTime(MotiveIndex /*index*/) const { return 0; }
 
+  // Return true once the values at [index, index + dimensions) have reached
+  // the end of their curves, and won't change until given new targets. The
+  // MotiveEngine reclaims transient Motivators once they're finished.
+  // The default waits for TargetTime() to run out.
+  virtual bool Finished(MotiveIndex index, MotiveDimension dimensions) const {
+    return TargetTime(index, dimensions) <= 0;
+  }
+
+  // Return the most recent MotiveEngine::frame_count() on which any of the
+  // values at [index, index + dimensions) changed. Values that change between
+  // calls to AdvanceFrame() count as changing on the next frame. Dependent
+  // processors can skip recalculating outputs whose inputs haven't changed.
+  // The default assumes the values change on every frame.
+  virtual uint32_t ChangedFrame(MotiveIndex /*index*/,
+                                MotiveDimension /*dimensions*/) const {
+    return std::numeric_limits<uint32_t>::max();
+  }
+
   virtual MotiveCurveShape MotiveShape(MotiveIndex /*index*/) const {
     return MotiveCurveShape();
   }
@@ -86,6 +259,17 @@ class MotiveProcessorNf : public MotiveProcessor {
   virtual void SetTargets(MotiveIndex /*index*/, MotiveDimension /*dimensions*/,
                           const MotiveTarget1f* /*ts*/) {}
 
+  // Set the targets of many indices at once: `indices[i]` is driven to
+  // `ts[i]`. The indices need not be contiguous, but must be distinct. Derived
+  // classes can override this to initialize all the indices in one batch.
+  // The default calls SetTargets() on each index.
+  virtual void SetTargetsAt(const MotiveIndex* indices, MotiveIndex count,
+                            const MotiveTarget1f* ts) {
+    for (MotiveIndex i = 0; i < count; ++i) {
+      SetTargets(indices[i], 1, &ts[i]);
+    }
+  }
+
   // Set the target we want the Motivator to achieve and describe the curve
   // shape it should use to get there.
   virtual void SetTargetWithShape(MotiveIndex /*index*/,
@@ -94,11 +278,34 @@ class MotiveProcessorNf : public MotiveProcessor {
                                   const float* /*target_velocities*/,
                                   const MotiveCurveShape& /*shape*/) {}
 
+  // Same as SetTargetsAt(), but for SetTargetWithShape(). Every index uses the
+  // same `shape`.
+  virtual void SetTargetsWithShapeAt(const MotiveIndex* indices,
+                                     MotiveIndex count,
+                                     const float* target_values,
+                                     const float* target_velocities,
+                                     const MotiveCurveShape& shape) {
+    for (MotiveIndex i = 0; i < count; ++i) {
+      SetTargetWithShape(indices[i], 1, &target_values[i],
+                         &target_velocities[i], shape);
+    }
+  }
+
   // Drive the Motivator by following splines specified in the playback.
   virtual void SetSplines(MotiveIndex /*index*/, MotiveDimension /*dimensions*/,
                           const CompactSpline* /*splines*/,
                           const SplinePlayback& /*playback*/) {}
 
+  // Same as SetTargetsAt(), but for SetSplines(): `indices[i]` follows
+  // `splines[i]`. Every index uses the same `playback`.
+  virtual void SetSplinesAt(const MotiveIndex* indices, MotiveIndex count,
+                            const CompactSpline* const* splines,
+                            const SplinePlayback& playback) {
+    for (MotiveIndex i = 0; i < count; ++i) {
+      SetSplines(indices[i], 1, splines[i], playback);
+    }
+  }
+
   // Gather the splines currently being played back. If dimension is not being
   // driven by a spline, returns nullptr at that dimension.
   virtual void Splines(MotiveIndex /*index*/, MotiveIndex count,
@@ -106,6 +313,24 @@ class MotiveProcessorNf : public MotiveProcessor {
     for (MotiveIndex i = 0; i < count; ++i) splines[i] = nullptr;
   }
 
+  // Gather the playback state of [index, index + dimensions), for
+  // SetSplineStates() to continue on another MotiveEngine. The default
+  // describes each value as held constant.
+  virtual void SplineStates(MotiveIndex index, MotiveDimension dimensions,
+                            SplineState* states) const {
+    const float* values = Values(index);
+    for (MotiveDimension i = 0; i < dimensions; ++i) {
+      states[i] = SplineState();
+      states[i].cubic = CubicCurve(0.0f, 0.0f, 0.0f, values[i]);
+      states[i].cubic_x_end = std::numeric_limits<float>::infinity();
+    }
+  }
+
+  // Continue playback exactly from `states`, which came from SplineStates().
+  virtual void SetSplineStates(MotiveIndex /*index*/,
+                               MotiveDimension /*dimensions*/,
+                               const SplineState* /*states*/) {}
+
   // For each i from 0..dimensions-1, drive the value with with splines[i]
   // when splines[i] != NULL, and with targets[i] otherwise.
   virtual void SetSplinesAndTargets(MotiveIndex /*index*/,
@@ -123,6 +348,164 @@ class MotiveProcessorNf : public MotiveProcessor {
   virtual void SetSplineRepeating(MotiveIndex /*index*/,
                                   MotiveDimension /*dimensions*/,
                                   bool /*repeat*/) {}
+
+ protected:
+  // Derived classes that store their outputs contiguously should call these
+  // whenever the arrays are reallocated. See BulkValues().
+  void SetBulkValues(const float* values, const float* front_values) {
+    bulk_values_ = values;
+    front_bulk_values_ = front_values;
+  }
+  void SetBulkChangedFrames(const uint32_t* changed_frames) {
+    bulk_changed_frames_ = changed_frames;
+  }
+
+  void AddMemoryStats(MemoryStats* stats) const override {
+    MotiveProcessor::AddMemoryStats(stats);
+    stats->AddVector(previous_values_);
+    stats->AddVector(front_previous_values_);
+    stats->AddVector(ranges_);
+    stats->AddVector(value_outputs_);
+  }
+
+  void TrimIndices() override {
+    previous_values_.shrink_to_fit();
+    front_previous_values_.shrink_to_fit();
+    ranges_.shrink_to_fit();
+    value_outputs_.shrink_to_fit();
+  }
+
+  // New Motivators have no previous values to interpolate from.
+  void InitializeBaseIndices(MotiveIndex index,
+                             MotiveDimension dimensions) override {
+    if (previous_values_.empty()) return;
+    std::fill(previous_values_.begin() + index,
+              previous_values_.begin() + index + dimensions,
+              std::numeric_limits<float>::quiet_NaN());
+  }
+  void RemoveBaseIndices(MotiveIndex index,
+                         MotiveDimension /*dimensions*/) override {
+    RemoveValueOutput(index);
+  }
+  void MoveBaseIndices(MotiveIndex old_index, MotiveIndex new_index,
+                       MotiveDimension dimensions) override {
+    if (!previous_values_.empty()) {
+      std::copy(previous_values_.begin() + old_index,
+                previous_values_.begin() + old_index + dimensions,
+                previous_values_.begin() + new_index);
+    }
+    for (auto it = value_outputs_.begin(); it != value_outputs_.end(); ++it) {
+      if (old_index <= it->index && it->index < old_index + dimensions) {
+        it->index = new_index + (it->index - old_index);
+      }
+    }
+  }
+  void SetNumBaseIndices(MotiveIndex num_indices) override {
+    if (previous_values_.empty()) return;
+    previous_values_.resize(num_indices,
+                            std::numeric_limits<float>::quiet_NaN());
+  }
+  void CopyBaseToFrontBuffer(MotiveIndex index,
+                             MotiveDimension dimensions) override {
+    if (previous_values_.empty()) return;
+    front_previous_values_.resize(previous_values_.size());
+    std::copy(previous_values_.begin() + index,
+              previous_values_.begin() + index + dimensions,
+              front_previous_values_.begin() + index);
+  }
+  void UseBaseAllocator(MotiveAllocator* allocator) override {
+    previous_values_ =
+        MotiveVector<float>(MotiveStdAllocator<float>(allocator));
+    front_previous_values_ =
+        MotiveVector<float>(MotiveStdAllocator<float>(allocator));
+    value_outputs_ = MotiveVector<IndexedValueOutput>(
+        MotiveStdAllocator<IndexedValueOutput>(allocator));
+  }
+
+ private:
+  const float* bulk_values_;
+  const float* front_bulk_values_;
+  const uint32_t* bulk_changed_frames_;
+
+  // The values before the latest fixed step, or NaN for indices that haven't
+  // been through one. See InterpolatedValues(). Empty until the first fixed
+  // step.
+  MotiveVector<float> previous_values_;
+
+  // Copy of `previous_values_` that's read by InterpolatedValues() when
+  // double buffered, since BeginFixedStep() writes `previous_values_` while
+  // a frame advances.
+  MotiveVector<float> front_previous_values_;
+
+  // Scratch space for BeginFixedStep(). Held here to avoid reallocating.
+  std::vector<IndexRange> ranges_;
+
+  struct IndexedValueOutput {
+    MotiveIndex index;
+    MotiveDimension dimensions;
+    ValueOutput output;
+  };
+
+  void RemoveValueOutput(MotiveIndex index) {
+    for (auto it = value_outputs_.begin(); it != value_outputs_.end(); ++it) {
+      if (it->index == index) {
+        *it = value_outputs_.back();
+        value_outputs_.pop_back();
+        return;
+      }
+    }
+  }
+
+  void WriteValueOutput(const IndexedValueOutput& entry) const {
+    const ValueOutput& output = entry.output;
+    const float* values = Values(entry.index);
+    switch (output.format) {
+      case ValueOutput::kFloat:
+        std::copy(values, values + entry.dimensions,
+                  static_cast<float*>(output.data));
+        break;
+      case ValueOutput::kHalf: {
+        uint16_t* out = static_cast<uint16_t*>(output.data);
+        for (MotiveDimension i = 0; i < entry.dimensions; ++i) {
+          out[i] = FloatToHalf(values[i]);
+        }
+        break;
+      }
+      case ValueOutput::kSnorm16: {
+        int16_t* out = static_cast<int16_t*>(output.data);
+        for (MotiveDimension i = 0; i < entry.dimensions; ++i) {
+          out[i] = FloatToSnorm16(values[i]);
+        }
+        break;
+      }
+      case ValueOutput::kUnorm16InRange: {
+        uint16_t* out = static_cast<uint16_t*>(output.data);
+        const CompactSpline* splines[kMaxValueOutputDimensions];
+        if (output.ranges == nullptr) {
+          assert(entry.dimensions <= kMaxValueOutputDimensions);
+          Splines(entry.index, entry.dimensions, splines);
+        }
+        for (MotiveDimension i = 0; i < entry.dimensions; ++i) {
+          // Without a spline, there's no range to span, so write 0.
+          const Range range = output.ranges != nullptr
+                                  ? output.ranges[i]
+                                  : splines[i] != nullptr
+                                        ? splines[i]->RangeY()
+                                        : Range(values[i], values[i]);
+          out[i] = FloatToUnorm16(values[i], range);
+        }
+        break;
+      }
+    }
+  }
+
+  // Motivators that take their ranges from their splines can have at most
+  // this many dimensions. Enough for any MotivatorXf.
+  static const MotiveDimension kMaxValueOutputDimensions = 16;
+
+  // Outputs set by SetValueOutput(). Few Motivators have one, so they're
+  // kept in a list rather than per index.
+  MotiveVector<IndexedValueOutput> value_outputs_;
 };
 
 }  // namespace motive
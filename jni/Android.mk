@@ -45,11 +45,17 @@ MOTIVE_SRC_FILES := \
   $(MOTIVE_RELATIVE_DIR)/src/motive/io/flatbuffers.cpp \
   $(MOTIVE_RELATIVE_DIR)/src/motive/math/angle.cpp \
   $(MOTIVE_RELATIVE_DIR)/src/motive/math/bulk_spline_evaluator.cpp \
+  $(MOTIVE_RELATIVE_DIR)/src/motive/math/bulk_spline_evaluator_x86.cpp \
   $(MOTIVE_RELATIVE_DIR)/src/motive/math/compact_spline.cpp \
+  $(MOTIVE_RELATIVE_DIR)/src/motive/math/compact_spline_packing.cpp \
   $(MOTIVE_RELATIVE_DIR)/src/motive/math/curve.cpp \
   $(MOTIVE_RELATIVE_DIR)/src/motive/math/curve_util.cpp \
   $(MOTIVE_RELATIVE_DIR)/src/motive/math/dual_cubic.cpp \
+  $(MOTIVE_RELATIVE_DIR)/src/motive/math/fixed_cubic.cpp \
   $(MOTIVE_RELATIVE_DIR)/src/motive/math/float.cpp \
+  $(MOTIVE_RELATIVE_DIR)/src/motive/math/spline_stream.cpp \
+  $(MOTIVE_RELATIVE_DIR)/src/motive/math/transform_kernels.cpp \
+  $(MOTIVE_RELATIVE_DIR)/src/motive/math/transform_kernels_x86.cpp \
   $(MOTIVE_RELATIVE_DIR)/src/motive/motivator.cpp \
   $(MOTIVE_RELATIVE_DIR)/src/motive/processor/const_processor.cpp \
   $(MOTIVE_RELATIVE_DIR)/src/motive/processor/ease_in_ease_out_processor.cpp \
@@ -58,8 +64,18 @@ MOTIVE_SRC_FILES := \
   $(MOTIVE_RELATIVE_DIR)/src/motive/processor/rig_processor.cpp \
   $(MOTIVE_RELATIVE_DIR)/src/motive/processor/spline_processor.cpp \
   $(MOTIVE_RELATIVE_DIR)/src/motive/processor/spring_processor.cpp \
+  $(MOTIVE_RELATIVE_DIR)/src/motive/pose_database.cpp \
+  $(MOTIVE_RELATIVE_DIR)/src/motive/pose_texture.cpp \
   $(MOTIVE_RELATIVE_DIR)/src/motive/processor.cpp \
+  $(MOTIVE_RELATIVE_DIR)/src/motive/rig_anim_sampler.cpp \
+  $(MOTIVE_RELATIVE_DIR)/src/motive/task_scheduler.cpp \
+  $(MOTIVE_RELATIVE_DIR)/src/motive/thread_pool.cpp \
   $(MOTIVE_RELATIVE_DIR)/src/motive/util/benchmark.cpp \
+  $(MOTIVE_RELATIVE_DIR)/src/motive/util/counters.cpp \
+  $(MOTIVE_RELATIVE_DIR)/src/motive/util/recorder.cpp \
+  $(MOTIVE_RELATIVE_DIR)/src/motive/util/replayer.cpp \
+  $(MOTIVE_RELATIVE_DIR)/src/motive/util/replication.cpp \
+  $(MOTIVE_RELATIVE_DIR)/src/motive/util/trace.cpp \
   $(MOTIVE_RELATIVE_DIR)/src/motive/util/optimizations.cpp \
   $(MOTIVE_RELATIVE_DIR)/src/motive/version.cpp
 
@@ -73,7 +89,8 @@ ifneq ($(MOTIVE_ENABLE_ASSEMBLY),0)
   ifneq (,$(findstring armeabi-v7a,$(TARGET_ARCH_ABI)))
     # Use the .neon extension to compile with NEON support.
     MOTIVE_SRC_FILES += \
-      $(MOTIVE_RELATIVE_DIR)/src/motive/math/bulk_spline_evaluator_neon.s.neon
+      $(MOTIVE_RELATIVE_DIR)/src/motive/math/bulk_spline_evaluator_neon.s.neon \
+      $(MOTIVE_RELATIVE_DIR)/src/motive/math/transform_kernels_neon.cpp.neon
     MOTIVE_CFLAGS += -DMOTIVE_NEON
 
     # Run both NEON and C++ code and compare results.
@@ -81,6 +98,18 @@ ifneq ($(MOTIVE_ENABLE_ASSEMBLY),0)
       MOTIVE_CFLAGS += -DMOTIVE_ASSEMBLY_TEST=Neon
     endif
   endif
+
+  # The SSE4.1 and AVX2 functions in bulk_spline_evaluator_x86.cpp and
+  # transform_kernels_x86.cpp are always compiled on x86, and selected at
+  # runtime.
+  ifneq (,$(findstring x86,$(TARGET_ARCH_ABI)))
+    # Run both SSE4.1 and C++ code and compare results.
+    ifneq ($(MOTIVE_TEST_ASSEMBLY),0)
+      MOTIVE_CFLAGS += -DMOTIVE_ASSEMBLY_TEST=Sse4
+    endif
+  endif
+else
+  MOTIVE_CFLAGS += -DMOTIVE_NO_X86_SIMD
 endif
 
 include $(CLEAR_VARS)
@@ -1,5 +1,7 @@
 #include "anim_data.h"
 
+#include <algorithm>
+#include <atomic>
 #include <queue>
 
 #include "motive/matrix_anim.h"
@@ -15,11 +17,17 @@ static const uint32_t kScaleZBitfield = 1 << motive::kScaleZ;
 static const uint32_t kScaleXyzBitfield =
     kScaleXBitfield | kScaleYBitfield | kScaleZBitfield;
 
+// Keep fitted derivatives slightly inside the derivative tolerance, so that
+// rounding can't push them outside.
+static const float kFitDerivativeMargin = 0.99f;
+
 AnimData::AnimData(const Tolerances& tolerances, bool root_bones_only,
                    fplutil::Logger& log)
     : cur_bone_index_(-1),
       tolerances_(tolerances),
       root_bones_only_(root_bones_only),
+      fit_derivatives_(true),
+      num_threads_(1),
       log_(log) {}
 
 unsigned int AnimData::AllocBone(const char* bone_name, int parent_bone_index) {
@@ -137,33 +145,24 @@ void AnimData::AddCurve(FlatChannelId channel_id, FlatTime time_start,
 void AnimData::PruneNodes(FlatChannelId channel_id) {
   const float tolerance = Tolerance(channel_id);
 
-  // For every node try to prune as many redunant nodes that come after it.
-  // A node is redundant if the spline evaluates to the same value even if
-  // it doesn't exists (note: here "same value" means within `tolerances_`).
+  // For every kept node, skip as many redundant nodes that come after it as
+  // possible. A node is redundant if the spline evaluates to the same value
+  // even if it doesn't exists (note: here "same value" means within
+  // `tolerances_`). Every skipped node is checked against the cubic that
+  // replaces it, so the error never exceeds `tolerances_`.
   Channels& channels = CurChannels();
   Nodes& n = channels[channel_id].nodes;
-  std::vector<bool> prune(n.size(), false);
-  for (size_t i = 0; i < n.size();) {
-    size_t next_i = i + 1;
-    for (size_t j = i + 2; j < n.size(); ++j) {
-      const bool redundant =
-          IntermediateNodesRedundant(&n[i], j - i + 1, tolerance);
-      if (redundant) {
-        prune[j - 1] = true;
-        next_i = j;
-      }
-    }
-    i = next_i;
-  }
-
-  // Compact to remove all pruned nodes.
   size_t write = 0;
-  for (size_t read = 0; read < n.size(); ++read) {
-    if (prune[read]) continue;
+  for (size_t read = 0; read < n.size();) {
     if (write < read) {
       n[write] = n[read];
     }
     write++;
+    if (read + 1 == n.size()) break;
+    FlatDerivative end_derivative = 0.0f;
+    read += RedundantSpan(&n[read], n.size() - read, tolerance,
+                          &end_derivative);
+    n[read].derivative = end_derivative;
   }
   n.resize(write);
 
@@ -178,62 +177,73 @@ void AnimData::PruneNodes(FlatChannelId channel_id) {
   }
 }
 
+void AnimData::PruneNodes(const std::vector<FlatChannelId>& channel_ids) {
+  // Each channel's nodes are independent, and the channels vector itself is
+  // not resized, so channels can be pruned concurrently.
+  ParallelFor(channel_ids.size(),
+              [this, &channel_ids](size_t i) { PruneNodes(channel_ids[i]); });
+}
+
 void AnimData::PruneChannels(bool no_uniform_scale) {
-  for (auto bone = bones_.begin(); bone != bones_.end(); ++bone) {
-    // Iterate from the end to minimize the cost of the erase operations.
-    Channels& channels = bone->channels;
-    for (FlatChannelId ch = static_cast<FlatChannelId>(channels.size() - 1);
-         ch >= 0; ch--) {
-      // Collapse kScaleX,Y,Z into kScaleUniformly.
-      const bool uniform_scale =
-          (!no_uniform_scale && UniformScaleChannels(channels, ch));
-      if (uniform_scale) {
-        log_.Log(fplutil::kLogVerbose,
-                 "  Collapsing scale x, y, z channels %d~%d into"
-                 " one scale-uniformly channel\n",
-                 ch, ch + 2);
-
-        // Ids values are in consecutive order
-        //   scale-X id, scale-Y id, scale-Z id, scale-uniformly id
-        // the same as op values are in consecutive order
-        //   kScaleX, kScaleY, kScaleZ, kScaleUniformly
-        // but with a different initial value.
-        //
-        // So to convert from scale-? id to scale-uniformly id, we add on
-        // the difference kScaleUniformly - kScale?.
-        channels[ch].id +=
-            motive::kScaleUniformly - static_cast<MatrixOpId>(channels[ch].op);
-        channels[ch].op = motive::kScaleUniformly;
-        channels.erase(channels.begin() + (ch + 1),
-                       channels.begin() + (ch + 3));
-      }
+  ParallelFor(bones_.size(), [this, no_uniform_scale](size_t i) {
+    PruneBoneChannels(bones_[i].channels, no_uniform_scale);
+  });
+}
 
-      // Sum together channels that are adjacent, or separated only by
-      // independent ops.
-      const FlatChannelId summable_ch = SummableChannel(channels, ch);
-      if (summable_ch >= 0) {
-        log_.Log(fplutil::kLogVerbose, "  Summing %s channels %d and %d\n",
-                 MatrixOpName(channels[ch].op), ch, summable_ch);
+void AnimData::PruneBoneChannels(Channels& channels,
+                                 bool no_uniform_scale) const {
+  // Iterate from the end to minimize the cost of the erase operations.
+  for (FlatChannelId ch = static_cast<FlatChannelId>(channels.size() - 1);
+       ch >= 0; ch--) {
+    // Collapse kScaleX,Y,Z into kScaleUniformly.
+    const bool uniform_scale =
+        (!no_uniform_scale && UniformScaleChannels(channels, ch));
+    if (uniform_scale) {
+      log_.Log(fplutil::kLogVerbose,
+               "  Collapsing scale x, y, z channels %d~%d into"
+               " one scale-uniformly channel\n",
+               ch, ch + 2);
+
+      // Ids values are in consecutive order
+      //   scale-X id, scale-Y id, scale-Z id, scale-uniformly id
+      // the same as op values are in consecutive order
+      //   kScaleX, kScaleY, kScaleZ, kScaleUniformly
+      // but with a different initial value.
+      //
+      // So to convert from scale-? id to scale-uniformly id, we add on
+      // the difference kScaleUniformly - kScale?.
+      channels[ch].id +=
+          motive::kScaleUniformly - static_cast<MatrixOpId>(channels[ch].op);
+      channels[ch].op = motive::kScaleUniformly;
+      channels.erase(channels.begin() + (ch + 1),
+                     channels.begin() + (ch + 3));
+    }
 
-        SumChannels(channels, ch, summable_ch);
-        channels.erase(channels.begin() + summable_ch);
-      }
+    // Sum together channels that are adjacent, or separated only by
+    // independent ops.
+    const FlatChannelId summable_ch = SummableChannel(channels, ch);
+    if (summable_ch >= 0) {
+      log_.Log(fplutil::kLogVerbose, "  Summing %s channels %d and %d\n",
+               MatrixOpName(channels[ch].op), ch, summable_ch);
 
-      // Remove constant channels that have the default value.
-      // Most of the time these won't be created, but it's possible that
-      // of the collapse operations above (especially summing) will create
-      // this situation.
-      if (channels[ch].nodes.size() == 1 &&
-          IsDefaultValue(channels[ch].op, channels[ch].nodes[0].val)) {
-        log_.Log(fplutil::kLogVerbose, "  Omitting constant %s channel %d\n",
-                 MatrixOpName(channels[ch].op), ch);
-        channels.erase(channels.begin() + ch);
-      }
+      SumChannels(channels, ch, summable_ch);
+      channels.erase(channels.begin() + summable_ch);
     }
 
-    // Ensure that the channels remain in accending order of id.
-    std::sort(channels.begin(), channels.end());
+    // Remove constant channels that have the default value.
+    // Most of the time these won't be created, but it's possible that
+    // of the collapse operations above (especially summing) will create
+    // this situation.
+    if (channels[ch].nodes.size() == 1 &&
+        IsDefaultValue(channels[ch].op, channels[ch].nodes[0].val)) {
+      log_.Log(fplutil::kLogVerbose, "  Omitting constant %s channel %d\n",
+               MatrixOpName(channels[ch].op), ch);
+      channels.erase(channels.begin() + ch);
+    }
   }
+
+  // Ensure that the channels remain in accending order of id.
+  std::sort(channels.begin(), channels.end());
 }
 
 void AnimData::ShiftTime(FlatTime time_offset) {
@@ -563,6 +573,124 @@ BoneIndex AnimData::BoneParent(int bone_idx) const {
                                : static_cast<BoneIndex>(parent_bone_index);
 }
 
+void AnimData::set_num_threads(int num_threads) {
+  if (num_threads == num_threads_) return;
+  num_threads_ = num_threads;
+  thread_pool_.reset(num_threads > 1 ? new MotiveThreadPool(num_threads - 1)
+                                     : nullptr);
+}
+
+void AnimData::ParallelFor(size_t count,
+                           const std::function<void(size_t)>& fn) const {
+  // Don't bother waking workers when there's nothing to run beside us.
+  const size_t num_helpers =
+      thread_pool_ ? std::min(static_cast<size_t>(num_threads_), count) - 1
+                   : 0;
+  if (count == 0 || num_helpers == 0) {
+    for (size_t i = 0; i < count; ++i) fn(i);
+    return;
+  }
+
+  // Each thread, including this one, pulls indices until there are none left.
+  // Results are written to per-index slots, so the order in which indices are
+  // processed does not affect the output.
+  std::atomic<size_t> next(0);
+  auto work = [&next, count, &fn]() {
+    for (size_t i = next++; i < count; i = next++) fn(i);
+  };
+  const MotiveTaskGroupId group = thread_pool_->BeginGroup();
+  for (size_t i = 0; i < num_helpers; ++i) {
+    thread_pool_->Submit(group, work);
+  }
+  work();
+  thread_pool_->Wait(group);
+}
+
+size_t AnimData::RedundantSpan(const SplineNode* n, size_t len,
+                               float tolerance,
+                               FlatDerivative* end_derivative) const {
+  assert(len >= 2);
+
+  // Gallop outwards to bracket the furthest end node, then binary search
+  // within the bracket. Each test costs O(span), so a kept node that skips
+  // k nodes costs O(k log k), instead of the O(k^2) of testing every end.
+  // `good` is always a tested (or trivially) redundant span.
+  size_t good = 1;
+  size_t bad = len;
+  FlatDerivative derivative = 0.0f;
+  *end_derivative = n[1].derivative;
+  for (size_t probe = 2; probe < len; probe = std::min(2 * probe, len - 1)) {
+    if (!SpanRedundant(n, probe + 1, tolerance, &derivative)) {
+      bad = probe;
+      break;
+    }
+    good = probe;
+    *end_derivative = derivative;
+    if (good == len - 1) break;
+  }
+  while (bad - good > 1) {
+    const size_t mid = good + (bad - good) / 2;
+    if (SpanRedundant(n, mid + 1, tolerance, &derivative)) {
+      good = mid;
+      *end_derivative = derivative;
+    } else {
+      bad = mid;
+    }
+  }
+  return good;
+}
+
+bool AnimData::SpanRedundant(const SplineNode* n, size_t len, float tolerance,
+                             FlatDerivative* end_derivative) const {
+  *end_derivative = n[len - 1].derivative;
+  if (IntermediateNodesRedundant(n, len, tolerance)) return true;
+  return fit_derivatives_ && FitEndDerivative(n, len, tolerance,
+                                              end_derivative);
+}
+
+bool AnimData::FitEndDerivative(const SplineNode* n, size_t len,
+                                float tolerance,
+                                FlatDerivative* end_derivative) const {
+  const SplineNode& start = n[0];
+  const SplineNode& end = n[len - 1];
+  const float width = static_cast<float>(end.time - start.time);
+  if (len <= 2 || width <= 0.0f) return false;
+
+  // The cubic is linear in its end derivative d: c(t) = base(t) + g(t) * d,
+  // where `base` is the cubic with an end derivative of zero, and g(t) is the
+  // Hermite basis function for the end derivative. Solve for the d that
+  // minimizes the squared value error at the intermediate nodes.
+  const CubicCurve base(
+      CubicInit(start.val, start.derivative, end.val, 0.0f, width));
+  float numerator = 0.0f;
+  float denominator = 0.0f;
+  for (size_t i = 1; i < len - 1; ++i) {
+    const float t = static_cast<float>(n[i].time - start.time);
+    const float s = t / width;
+    const float g = width * s * s * (s - 1.0f);
+    numerator += g * (n[i].val - base.Evaluate(t));
+    denominator += g * g;
+  }
+  if (denominator <= 0.0f) return false;
+
+  // The fitted derivative replaces the end node's derivative, so it must stay
+  // within the derivative tolerance of the source curve there too.
+  const float max_change =
+      kFitDerivativeMargin * std::tan(tolerances_.derivative_angle);
+  const FlatDerivative fit_derivative =
+      std::min(std::max(numerator / denominator, end.derivative - max_change),
+               end.derivative + max_change);
+
+  // The fit minimizes error, but doesn't guarantee every node is within
+  // tolerance, so check.
+  const CubicCurve c(CubicInit(start.val, start.derivative, end.val,
+                               fit_derivative, width));
+  if (!IntermediateNodesOnCubic(c, n, len, tolerance)) return false;
+
+  *end_derivative = fit_derivative;
+  return true;
+}
+
 bool AnimData::IntermediateNodesRedundant(const SplineNode* n, size_t len,
                                           float tolerance) const {
   // If the start and end nodes occur at the same time and are equal,
@@ -577,7 +705,14 @@ bool AnimData::IntermediateNodesRedundant(const SplineNode* n, size_t len,
   const CubicCurve c(CubicInit(start.val, start.derivative, end.val,
                                end.derivative, cubic_width));
 
+  return IntermediateNodesOnCubic(c, n, len, tolerance);
+}
+
+bool AnimData::IntermediateNodesOnCubic(const CubicCurve& c,
+                                        const SplineNode* n, size_t len,
+                                        float tolerance) const {
   // For each intermediate node, check if the cubic `c` is close.
+  const SplineNode& start = n[0];
   for (size_t i = 1; i < len - 1; ++i) {
     // Evaluate `c` at the time of `mid`.
     const SplineNode& mid = n[i];
@@ -2,6 +2,8 @@
 #define MOTIVE_ANIM_DATA_H_
 
 #include <cmath>
+#include <functional>
+#include <memory>
 #include "anim_generated.h"
 #include "anim_list_generated.h"
 #include "anim_pipeline.h"
@@ -9,6 +11,7 @@
 #include "motive/math/angle.h"
 #include "motive/math/range.h"
 #include "motive/matrix_op.h"
+#include "motive/thread_pool.h"
 
 namespace motive {
 
@@ -64,7 +67,12 @@ class AnimData {
   /// @brief Remove redundant nodes from `channel_id`.
   void PruneNodes(FlatChannelId channel_id);
 
+  /// @brief Remove redundant nodes from every channel in `channel_ids`.
+  ///        The channels are pruned in parallel, on up to `num_threads()`.
+  void PruneNodes(const std::vector<FlatChannelId>& channel_ids);
+
   /// @brief Collapse multiple channels into one, when possible.
+  ///        Bones are processed in parallel, on up to `num_threads()`.
   void PruneChannels(bool no_uniform_scale);
 
   /// @brief Shift all times in all channels by `time_offset`.
@@ -89,6 +97,18 @@ class AnimData {
   /// Could be a negative time.
   FlatTime MinAnimatedTime() const;
 
+  /// @brief If true, PruneNodes() may adjust the derivatives of the nodes it
+  ///        keeps, to fit the nodes it removes. This removes more nodes while
+  ///        staying within the tolerances.
+  bool fit_derivatives() const { return fit_derivatives_; }
+  void set_fit_derivatives(bool fit) { fit_derivatives_ = fit; }
+
+  /// @brief Maximum number of threads to use when pruning and outputting.
+  ///        Results do not depend on the number of threads. The extra
+  ///        threads are started here, and shared by every stage.
+  int num_threads() const { return num_threads_; }
+  void set_num_threads(int num_threads);
+
  protected:
   MOTIVE_DISALLOW_COPY_AND_ASSIGN(AnimData);
 
@@ -194,6 +214,38 @@ class AnimData {
 
   BoneIndex BoneParent(int bone_idx) const;
 
+  /// @brief Collapse the channels of a single bone. See PruneChannels().
+  void PruneBoneChannels(Channels& channels, bool no_uniform_scale) const;
+
+  /// @brief Call `fn` once for every index in [0, `count`), spread over
+  ///        this thread and the workers of `thread_pool_`. `fn` must only write to state owned by
+  ///        its index.
+  void ParallelFor(size_t count, const std::function<void(size_t)>& fn) const;
+
+  /// @brief Returns the largest `k` < `len` found such that the nodes between
+  ///        n[0] and n[k] can be deleted without noticable difference to the
+  ///        curve. Returns 1 if no nodes can be deleted.
+  ///        `end_derivative` is set to the derivative n[k] should take on.
+  size_t RedundantSpan(const SplineNode* n, size_t len, float tolerance,
+                       FlatDerivative* end_derivative) const;
+
+  /// @brief Returns true if all nodes between the first and last in `n` can
+  ///        be deleted, possibly after changing the last node's derivative
+  ///        to `end_derivative`.
+  bool SpanRedundant(const SplineNode* n, size_t len, float tolerance,
+                     FlatDerivative* end_derivative) const;
+
+  /// @brief Least-squares fit the derivative of the last node in `n` to the
+  ///        intermediate nodes. Returns true, and sets `end_derivative`, if
+  ///        the fitted cubic is within tolerance of every intermediate node.
+  bool FitEndDerivative(const SplineNode* n, size_t len, float tolerance,
+                        FlatDerivative* end_derivative) const;
+
+  /// @brief Returns true if every node between the first and last in `n` is
+  ///        within tolerance of `c`. `c` starts at the time of n[0].
+  bool IntermediateNodesOnCubic(const CubicCurve& c, const SplineNode* n,
+                                size_t len, float tolerance) const;
+
   /// @brief Returns true if all nodes between the first and last in `n`
   ///        can be deleted without noticable difference to the curve.
   bool IntermediateNodesRedundant(const SplineNode* n, size_t len,
@@ -214,6 +266,14 @@ class AnimData {
   // Each such bone gets its own animation file.
   bool root_bones_only_;
 
+  // If true, PruneNodes() fits kept node derivatives to the pruned nodes.
+  bool fit_derivatives_;
+
+  // Maximum number of threads used by ParallelFor(), and the workers that
+  // make up the difference. 1 ==> no extra threads, and no pool.
+  int num_threads_;
+  std::unique_ptr<MotiveThreadPool> thread_pool_;
+
   // Information and warnings.
   fplutil::Logger& log_;
 };
@@ -14,12 +14,19 @@
 
 #include "anim_pipeline.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <thread>
 #include <unordered_map>
 
 #include "anim_data.h"
 #include "fbx_common/fbx_common.h"
 #include "flat_anim.h"
 #include "fplutil/file_utils.h"
+#include "motive/thread_pool.h"
 
 namespace motive {
 
@@ -67,6 +74,15 @@ static const float kDefaultDerivativeAngleTolerance = 0.00873f;
 // 10 degrees in radians.
 static const float kDefaultRepeatDerivativeAngleTolerance = 0.1745f;
 
+// Part of the key for cached outputs. Bump whenever the pipeline's output
+// changes for the same input and arguments, so stale cache entries are
+// never reused.
+static const char kAnimPipelineCacheVersion[] = "anim_pipeline 1";
+
+// 64-bit FNV-1a parameters.
+static const uint64_t kFnvOffsetBasis = 14695981039346656037ULL;
+static const uint64_t kFnvPrime = 1099511628211ULL;
+
 Tolerances::Tolerances()
     : scale(kDefaultScaleTolerance),
       rotate(kDefaultRotateTolerance),
@@ -79,19 +95,14 @@ Tolerances::Tolerances()
 ///        FlatBuffer format.
 class FbxAnimParser {
  public:
-  explicit FbxAnimParser(Logger& log)
-      : manager_(nullptr), scene_(nullptr), log_(log) {
-    // The FbxManager is the gateway to the FBX API.
-    manager_ = FbxManager::Create();
+  // `manager` is borrowed, and must outlive this parser.
+  FbxAnimParser(FbxManager* manager, Logger& log)
+      : manager_(manager), scene_(nullptr), log_(log) {
     if (manager_ == nullptr) {
       log_.Log(kLogError, "Unable to create FBX manager.\n");
       return;
     }
 
-    // Initialize with standard IO settings.
-    FbxIOSettings* ios = FbxIOSettings::Create(manager_, IOSROOT);
-    manager_->SetIOSettings(ios);
-
     // Create an FBX scene. This object holds most objects imported/exported
     // from/to files.
     scene_ = FbxScene::Create(manager_, "My Scene");
@@ -102,8 +113,9 @@ class FbxAnimParser {
   }
 
   ~FbxAnimParser() {
-    // Delete the FBX Manager and all objects that it created.
-    if (manager_ != nullptr) manager_->Destroy();
+    // Delete the scene and all objects that it holds. The manager is reused
+    // for the next file.
+    if (scene_ != nullptr) scene_->Destroy(true);
   }
 
   bool Valid() const { return manager_ != nullptr && scene_ != nullptr; }
@@ -422,6 +434,9 @@ class FbxAnimParser {
         {&node->LclScaling, 15, {motive::kScaleX, false}},
         {&node->ScalingPivot, 19, {motive::kTranslateX, true}}};
 
+    // The FBX SDK is not thread safe, so curves are sampled on this thread,
+    // and only pruned in parallel once they've all been gathered.
+    std::vector<FlatChannelId> curve_channels;
     for (size_t i = 0; i < MOTIVE_ARRAY_SIZE(properties); ++i) {
       const AnimProperty& p = properties[i];
 
@@ -482,9 +497,19 @@ class FbxAnimParser {
         FbxAnimCurve* curve = anim_node->GetCurve(channel);
         GatherFlatAnimCurve(channel_id, curve, p.op, span, out);
         assert(out->NumNodes(channel_id) > 0);
+        curve_channels.push_back(channel_id);
       }
     }
 
+    // Remove duplicates.
+    out->PruneNodes(curve_channels);
+
+    // Log the output key points.
+    for (auto it = curve_channels.begin(); it != curve_channels.end(); ++it) {
+      log_.Log(kLogVerbose, "  [channel %d] pruned\n", *it);
+      out->LogChannel(*it);
+    }
+
     // Collapse unnecesary channels, when possible.
     out->PruneChannels(no_uniform_scale);
   }
@@ -540,15 +565,9 @@ class FbxAnimParser {
                  derivatives[kNumIntermediateValues - 1]);
       }
     }
-
-    // Remove duplicates.
-    out->PruneNodes(channel_id);
-
-    // Log the output key points.
-    out->LogChannel(channel_id);
   }
 
-  // Entry point to the FBX SDK.
+  // Entry point to the FBX SDK. Not owned.
   FbxManager* manager_;
 
   // Hold the FBX file data.
@@ -571,16 +590,178 @@ AnimPipelineArgs::AnimPipelineArgs()
       preserve_start_time(false),
       root_bones_only(false),
       no_uniform_scale(false),
+      packed_splines(false),
       axis_system(fplutil::kUnspecifiedAxisSystem),
       distance_unit_scale(-1.0f),
-      debug_time(-1) {}
+      debug_time(-1),
+      num_threads(0),
+      fit_derivatives(true),
+      cache_dir(""),
+      stats_file("") {}
+
+static uint64_t HashBytes(const void* data, size_t size, uint64_t hash) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * kFnvPrime;
+  }
+  return hash;
+}
+
+static bool LoadFileContents(const std::string& file_name, std::string* data) {
+  std::ifstream fin(file_name.c_str(), std::ios::in | std::ios::binary);
+  if (!fin) return false;
+  data->assign(std::istreambuf_iterator<char>(fin),
+               std::istreambuf_iterator<char>());
+  return !fin.bad();
+}
+
+static bool SaveFileContents(const std::string& file_name,
+                             const std::string& data) {
+  const std::string dir = fplutil::DirectoryName(file_name);
+  if (!fplutil::CreateDirectory(dir.c_str())) return false;
+
+  // Write to a temporary file first, so that anyone reading `file_name`
+  // concurrently never sees a partially written file.
+  const std::string temp_file = file_name + ".tmp";
+  {
+    std::ofstream fout(temp_file.c_str(), std::ios::out | std::ios::binary);
+    if (!fout) return false;
+    fout.write(data.data(), static_cast<std::streamsize>(data.size()));
+    if (!fout) return false;
+  }
+  std::remove(file_name.c_str());
+  return std::rename(temp_file.c_str(), file_name.c_str()) == 0;
+}
+
+// Return the cache key for `args`, or the empty string if the input file
+// can't be read. The key covers the input file's contents, the pipeline
+// version, and every argument that affects the output file.
+static std::string CacheKey(const AnimPipelineArgs& args) {
+  std::string fbx_data;
+  if (!LoadFileContents(args.fbx_file, &fbx_data)) return std::string();
+
+  // The anim name is stored in the output, and comes from the output file.
+  const std::string anim_name = fplutil::RemoveDirectoryFromName(
+      fplutil::RemoveExtensionFromName(args.output_file));
+
+  // Hex floats so that the key changes with every bit of the tolerances.
+  char options[512];
+  snprintf(options, sizeof(options),
+           "%s|%a|%a|%a|%a|%a|%d|%d|%d|%d|%d|%d|%d|%a|%d|",
+           kAnimPipelineCacheVersion, args.tolerances.scale,
+           args.tolerances.rotate, args.tolerances.translate,
+           args.tolerances.derivative_angle,
+           args.tolerances.repeat_derivative_angle, args.repeat_preference,
+           args.stagger_end_times, args.preserve_start_time,
+           args.root_bones_only, args.no_uniform_scale, args.packed_splines,
+           args.axis_system, args.distance_unit_scale, args.fit_derivatives);
+
+  uint64_t hash = kFnvOffsetBasis;
+  hash = HashBytes(options, strlen(options), hash);
+  hash = HashBytes(anim_name.data(), anim_name.size(), hash);
+  hash = HashBytes(fbx_data.data(), fbx_data.size(), hash);
+
+  char key[17];
+  snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(hash));
+  return std::string(key);
+}
+
+// Extension of cached stats files.
+static const char kStatsExtension[] = "stats.json";
+
+// If `key` is in the cache, copy it to the output file and return true.
+static bool CopyFromCache(const AnimPipelineArgs& args, const std::string& key,
+                          fplutil::Logger& log) {
+  // If stats were requested, they must have been cached too.
+  std::string stats;
+  if (!args.stats_file.empty()) {
+    const std::string cached_stats =
+        args.cache_dir + "/" + key + "." + kStatsExtension;
+    if (!LoadFileContents(cached_stats, &stats)) return false;
+  }
+
+  // The output extension depends on the output type, so check for each.
+  const char* const kExtensions[] = {RigAnimFbExtension(),
+                                     AnimListFbExtension()};
+  for (size_t i = 0; i < MOTIVE_ARRAY_SIZE(kExtensions); ++i) {
+    const std::string cached_file =
+        args.cache_dir + "/" + key + "." + kExtensions[i];
+    std::string data;
+    if (!LoadFileContents(cached_file, &data)) continue;
+
+    if (!args.stats_file.empty() &&
+        !SaveFileContents(args.stats_file, stats)) {
+      log.Log(kLogError, "Could not write %s\n", args.stats_file.c_str());
+      return false;
+    }
+
+    const std::string output_file =
+        fplutil::RemoveExtensionFromName(args.output_file) + "." +
+        kExtensions[i];
+    if (!SaveFileContents(output_file, data)) {
+      log.Log(kLogError, "Could not write %s\n", output_file.c_str());
+      return false;
+    }
+    log.Log(kLogImportant, "  %s (cached)\n",
+            fplutil::RemoveDirectoryFromName(output_file).c_str());
+    return true;
+  }
+  return false;
+}
+
+// Copy the freshly written `output_file` into the cache under `key`.
+static void CopyToCache(const AnimPipelineArgs& args, const std::string& key,
+                        const std::string& output_file, fplutil::Logger& log) {
+  std::string data;
+  const std::string cached_file =
+      args.cache_dir + "/" + key + "." + fplutil::FileExtension(output_file);
+  if (!LoadFileContents(output_file, &data) ||
+      !SaveFileContents(cached_file, data)) {
+    log.Log(kLogWarning, "Could not add %s to cache %s\n",
+            output_file.c_str(), args.cache_dir.c_str());
+  }
+
+  if (args.stats_file.empty()) return;
+  const std::string cached_stats =
+      args.cache_dir + "/" + key + "." + kStatsExtension;
+  if (!LoadFileContents(args.stats_file, &data) ||
+      !SaveFileContents(cached_stats, data)) {
+    log.Log(kLogWarning, "Could not add %s to cache %s\n",
+            args.stats_file.c_str(), args.cache_dir.c_str());
+  }
+}
+
+AnimPipelineContext::AnimPipelineContext() : manager_(FbxManager::Create()) {
+  // Initialize with standard IO settings.
+  if (manager_ != nullptr) {
+    FbxIOSettings* ios = FbxIOSettings::Create(manager_, IOSROOT);
+    manager_->SetIOSettings(ios);
+  }
+}
+
+AnimPipelineContext::~AnimPipelineContext() {
+  // Delete the FBX Manager and all objects that it created.
+  if (manager_ != nullptr) manager_->Destroy();
+}
 
 int RunAnimPipeline(const AnimPipelineArgs& args, fplutil::Logger& log) {
+  AnimPipelineContext context;
+  return RunAnimPipeline(args, &context, log);
+}
+
+int RunAnimPipeline(const AnimPipelineArgs& args, AnimPipelineContext* context,
+                    fplutil::Logger& log) {
   // Update the amount of information we're dumping.
   log.set_level(args.log_level);
 
+  // Skip the conversion entirely if neither the input nor the arguments have
+  // changed since the output was cached.
+  const bool use_cache = !args.cache_dir.empty() && args.debug_time < 0;
+  const std::string cache_key = use_cache ? CacheKey(args) : std::string();
+  if (!cache_key.empty() && CopyFromCache(args, cache_key, log)) return 0;
+
   // Load the FBX file.
-  motive::FbxAnimParser pipe(log);
+  motive::FbxAnimParser pipe(context->manager(), log);
   const bool load_status = pipe.Load(args.fbx_file.c_str(), args.axis_system,
                                      args.distance_unit_scale);
   if (!load_status) return 1;
@@ -592,7 +773,13 @@ int RunAnimPipeline(const AnimPipelineArgs& args, fplutil::Logger& log) {
   }
 
   // Gather data into a format conducive to our FlatBuffer format.
-  motive::FlatAnim anim(args.tolerances, args.root_bones_only, log);
+  motive::FlatAnim anim(args.tolerances, args.root_bones_only,
+                        args.packed_splines, log);
+  anim.set_num_threads(
+      args.num_threads > 0
+          ? args.num_threads
+          : std::max(static_cast<int>(std::thread::hardware_concurrency()), 1));
+  anim.set_fit_derivatives(args.fit_derivatives);
   pipe.GatherFlatAnim(args.no_uniform_scale, &anim);
 
   // We want the animation to start from tick 0.
@@ -607,13 +794,71 @@ int RunAnimPipeline(const AnimPipelineArgs& args, fplutil::Logger& log) {
 
   // Output gathered data to a binary FlatBuffer.
   anim.LogAllChannels();
-  const bool output_status =
-      anim.OutputFlatBuffer(args.output_file, args.repeat_preference);
+  std::string output_file;
+  const bool output_status = anim.OutputFlatBuffer(
+      args.output_file, args.repeat_preference, &output_file);
 
   if (!output_status) return 1;
 
+  // Report the runtime cost of the animation, for tools to flag clips that
+  // are expensive to play back.
+  if (!args.stats_file.empty()) {
+    const std::string anim_name = fplutil::RemoveDirectoryFromName(
+        fplutil::RemoveExtensionFromName(output_file));
+    if (!anim.OutputStats(args.stats_file, anim_name)) return 1;
+  }
+
+  // Remember the output for next time.
+  if (!cache_key.empty()) {
+    CopyToCache(args, cache_key, output_file, log);
+  }
+
   // Success.
   return 0;
 }
 
+int RunAnimPipelineBatch(const std::vector<AnimPipelineArgs>& batch,
+                         int num_workers, fplutil::Logger& log) {
+  const int num_files = static_cast<int>(batch.size());
+  num_workers = std::max(std::min(num_workers, num_files), 1);
+
+  // Each worker converts files, one after the other, until there are none
+  // left. The FBX SDK is only thread safe across managers, so every worker
+  // gets its own context, and its own logger since the log level is a
+  // per-file option.
+  std::atomic<int> next(0);
+  std::vector<int> results(batch.size(), 0);
+  auto convert = [&batch, &next, &results, num_files, num_workers]() {
+    AnimPipelineContext context;
+    fplutil::Logger worker_log;
+    for (int i = next++; i < num_files; i = next++) {
+      // Don't oversubscribe the cores when converting several files at once.
+      AnimPipelineArgs args = batch[i];
+      if (args.num_threads <= 0 && num_workers > 1) {
+        args.num_threads = 1;
+      }
+      results[i] = RunAnimPipeline(args, &context, worker_log);
+    }
+  };
+
+  MotiveThreadPool pool(num_workers - 1);
+  const MotiveTaskGroupId group = pool.BeginGroup();
+  for (int i = 0; i < num_workers - 1; ++i) {
+    pool.Submit(group, convert);
+  }
+  convert();
+  pool.Wait(group);
+
+  // Report failures in manifest order.
+  int num_failures = 0;
+  for (int i = 0; i < num_files; ++i) {
+    if (results[i] == 0) continue;
+    log.Log(kLogError, "Failed to convert %s\n", batch[i].fbx_file.c_str());
+    num_failures++;
+  }
+  log.Log(kLogImportant, "Converted %d of %d files.\n",
+          num_files - num_failures, num_files);
+  return num_failures == 0 ? 0 : 1;
+}
+
 }  // namespace motive
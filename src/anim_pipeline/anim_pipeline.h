@@ -16,7 +16,9 @@
 #define MOTIVE_ANIM_PIPELINE_H_
 
 #include <string>
+#include <vector>
 #include "fbx_common/fbx_common.h"
+#include "motive/common.h"
 
 namespace motive {
 
@@ -56,13 +58,50 @@ struct AnimPipelineArgs {
   bool preserve_start_time;  /// Don't shift channels to start at time 0.
   bool root_bones_only;      /// Output bone that has path of animation only.
   bool no_uniform_scale;     /// If true, never collapse scale channels.
+  bool packed_splines;       /// Output splines with variable bit-rate nodes.
   fplutil::AxisSystem axis_system;  /// Which axes are up, front, left.
   float distance_unit_scale;        /// This number of cm is set to one unit.
   int debug_time;  /// If >0 output animation state at this time.
+  int num_threads;  /// Threads used to prune and output. 0 ==> one per core.
+  bool fit_derivatives;  /// Refit node derivatives to remove more nodes.
+  std::string cache_dir;  /// If not empty, reuse outputs cached here.
+  std::string stats_file;  /// If not empty, write runtime-cost JSON here.
 };
 
+/// @class AnimPipelineContext
+/// @brief FBX SDK state that can be shared by several conversions.
+///
+/// Creating the FbxManager is expensive relative to converting a small clip,
+/// so reuse one context when converting many files. A context must only be
+/// used by one thread at a time.
+class AnimPipelineContext {
+ public:
+  AnimPipelineContext();
+  ~AnimPipelineContext();
+
+  FbxManager* manager() const { return manager_; }
+
+ private:
+  MOTIVE_DISALLOW_COPY_AND_ASSIGN(AnimPipelineContext);
+
+  FbxManager* manager_;
+};
+
+/// @brief Convert one file, as specified by `args`, with a new context.
+/// @return 0 on success, non-zero on failure.
 int RunAnimPipeline(const AnimPipelineArgs& args, fplutil::Logger& log);
 
+/// @brief Convert one file, as specified by `args`, reusing `context`.
+/// @return 0 on success, non-zero on failure.
+int RunAnimPipeline(const AnimPipelineArgs& args, AnimPipelineContext* context,
+                    fplutil::Logger& log);
+
+/// @brief Convert every file in `batch` on up to `num_workers` threads.
+///        Each worker has its own AnimPipelineContext.
+/// @return 0 if every file converted successfully, non-zero otherwise.
+int RunAnimPipelineBatch(const std::vector<AnimPipelineArgs>& batch,
+                         int num_workers, fplutil::Logger& log);
+
 }  // namespace motive
 
 #endif  // MOTIVE_ANIM_PIPELINE_H_
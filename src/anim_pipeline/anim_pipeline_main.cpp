@@ -14,6 +14,11 @@
 
 #include "anim_pipeline.h"
 
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <thread>
+
 #include "anim_generated.h"
 #include "fplutil/file_utils.h"
 #include "motive/math/angle.h"
@@ -34,10 +39,27 @@ static void LogUsage(fplutil::Logger* log) {
       "                     [-at DERIVATIVE_TOLERANCE] [--repeat|--norepeat]\n"
       "                     [--stagger] [--start] [-a AXES]\n"
       "                     [-u (unit)|(scale)] [--roots] [--debug_time TIME]\n"
+      "                     [-j THREADS] [--nofit] [--cache DIR]\n"
+      "                     [--stats STATS_FILE]\n"
       "                     FBX_FILE\n"
+      "       anim_pipeline --batch [-w WORKERS] [OPTIONS] MANIFEST_FILE\n"
       "\n"
       "Pipeline to convert FBX animations into FlatBuffer animations.\n"
       "Outputs a .motiveanim file with the same base name as FBX_FILE.\n\n"
+      "Batch mode:\n"
+      "  --batch MANIFEST_FILE\n"
+      "                convert every file listed in MANIFEST_FILE in this\n"
+      "                one process. Each line of MANIFEST_FILE holds the\n"
+      "                options and FBX_FILE for one conversion, in the same\n"
+      "                format as the command line, e.g.\n"
+      "                    -o out/walk.motiveanim --repeat walk.fbx\n"
+      "                Put paths with spaces in double quotes. Blank lines\n"
+      "                and lines starting with '#' are ignored. OPTIONS\n"
+      "                given on the command line apply to every line, and\n"
+      "                can be overridden per line.\n"
+      "  -w, --workers WORKERS\n"
+      "                number of files to convert at the same time.\n"
+      "                If unspecified, use one worker per processor core.\n\n"
       "Options:\n"
       "  -v, --verbose output all informative messages\n"
       "  -d, --details output important informative messages\n"
@@ -117,11 +139,35 @@ static void LogUsage(fplutil::Logger* log) {
       "                Each mesh gets its animation file.\n"
       "                Useful for pulling just the path data from an\n"
       "                animation.\n"
+      "  --nofit\n"
+      "                keep the source derivatives at every output node.\n"
+      "                By default, derivatives are refit to the source curve\n"
+      "                so that fewer nodes are needed.\n"
+      "  --packed\n"
+      "                pack spline nodes into the fewest bits that stay\n"
+      "                within the tolerances. Smaller files, but must be\n"
+      "                expanded when loaded.\n"
       "  --debug_time TIME\n"
       "                output the local transforms for each bone in\n"
       "                the animation at TIME, in ms, and then exit.\n"
       "                Useful for debugging situations where the\n"
-      "                runtime doesn't match source data.\n");
+      "                runtime doesn't match source data.\n"
+      "  --cache DIR\n"
+      "                keep a copy of every output in DIR, keyed by a hash\n"
+      "                of the FBX file's contents, the pipeline version,\n"
+      "                and the options that affect the output. When the\n"
+      "                same conversion is requested again, the output is\n"
+      "                copied from DIR instead of being converted.\n"
+      "  --stats STATS_FILE\n"
+      "                write a JSON summary of the animation's runtime cost\n"
+      "                to STATS_FILE: node and op counts, channels per bone,\n"
+      "                average segment length, and the cubic re-inits per\n"
+      "                second needed to play it back at normal speed.\n"
+      "  -j, --threads THREADS\n"
+      "                maximum number of threads used to prune and output\n"
+      "                the animation curves. The output does not depend on\n"
+      "                the number of threads.\n"
+      "                If unspecified, use one thread per processor core.\n");
 }
 
 static bool ParseAnimPipelineArgs(int argc, char** argv, fplutil::Logger& log,
@@ -232,6 +278,12 @@ static bool ParseAnimPipelineArgs(int argc, char** argv, fplutil::Logger& log,
     } else if (arg == "--nouniformscale") {
       args->no_uniform_scale = true;
 
+    } else if (arg == "--nofit") {
+      args->fit_derivatives = false;
+
+    } else if (arg == "--packed") {
+      args->packed_splines = true;
+
     } else if (arg == "--stagger" || arg == "--stagger_end_times") {
       args->stagger_end_times = true;
 
@@ -278,6 +330,34 @@ static bool ParseAnimPipelineArgs(int argc, char** argv, fplutil::Logger& log,
         valid_args = false;
       }
 
+    } else if (arg == "--cache") {
+      if (i + 1 < argc - 1) {
+        args->cache_dir = std::string(argv[i + 1]);
+        i++;
+      } else {
+        valid_args = false;
+      }
+
+    } else if (arg == "--stats") {
+      if (i + 1 < argc - 1) {
+        args->stats_file = std::string(argv[i + 1]);
+        i++;
+      } else {
+        valid_args = false;
+      }
+
+    } else if (arg == "-j" || arg == "--threads") {
+      if (i + 1 < argc - 1) {
+        args->num_threads = atoi(argv[i + 1]);
+        if (args->num_threads <= 0) {
+          log.Log(kLogError, "threads must be > 0.");
+          valid_args = false;
+        }
+        i++;
+      } else {
+        valid_args = false;
+      }
+
     } else {
       log.Log(kLogError, "Unknown parameter: %s\n", arg.c_str());
       valid_args = false;
@@ -291,9 +371,109 @@ static bool ParseAnimPipelineArgs(int argc, char** argv, fplutil::Logger& log,
   return valid_args;
 }
 
+// Split `line` on whitespace. Double quotes group words into one token.
+static bool TokenizeManifestLine(const std::string& line,
+                                 std::vector<std::string>* tokens) {
+  std::string token;
+  bool in_token = false;
+  bool in_quotes = false;
+  for (auto c = line.begin(); c != line.end(); ++c) {
+    if (*c == '"') {
+      in_quotes = !in_quotes;
+      in_token = true;
+    } else if (!in_quotes && isspace(static_cast<unsigned char>(*c))) {
+      if (in_token) tokens->push_back(token);
+      token.clear();
+      in_token = false;
+    } else {
+      token += *c;
+      in_token = true;
+    }
+  }
+  if (in_token) tokens->push_back(token);
+  return !in_quotes;
+}
+
+static bool ParseBatchArgs(int argc, char** argv, fplutil::Logger& log,
+                           std::vector<motive::AnimPipelineArgs>* batch,
+                           int* num_workers) {
+  // `argv` is "anim_pipeline --batch [-w WORKERS] [OPTIONS] MANIFEST_FILE".
+  if (argc < 3 || argv[argc - 1][0] == '-') {
+    LogUsage(&log);
+    return false;
+  }
+  const char* manifest_file = argv[argc - 1];
+
+  // Pull out the worker count. Every other option is a default for the
+  // manifest lines.
+  *num_workers =
+      std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+  std::vector<std::string> default_tokens;
+  for (int i = 2; i < argc - 1; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "-w" || arg == "--workers") {
+      *num_workers = i + 1 < argc - 1 ? atoi(argv[i + 1]) : 0;
+      if (*num_workers <= 0) {
+        log.Log(kLogError, "workers must be > 0.\n");
+        LogUsage(&log);
+        return false;
+      }
+      i++;
+    } else {
+      default_tokens.push_back(arg);
+    }
+  }
+
+  std::ifstream manifest(manifest_file);
+  if (!manifest) {
+    log.Log(kLogError, "Unable to open manifest %s\n", manifest_file);
+    return false;
+  }
+
+  // Parse each line as if it were its own command line.
+  bool valid_args = true;
+  std::string line;
+  for (int line_number = 1; std::getline(manifest, line); ++line_number) {
+    const size_t first = line.find_first_not_of(" \t\r");
+    if (first == std::string::npos || line[first] == '#') continue;
+
+    std::vector<std::string> tokens(1, argv[0]);
+    tokens.insert(tokens.end(), default_tokens.begin(), default_tokens.end());
+    if (!TokenizeManifestLine(line, &tokens)) {
+      log.Log(kLogError, "%s:%d: unmatched quote\n", manifest_file,
+              line_number);
+      valid_args = false;
+      continue;
+    }
+
+    std::vector<char*> line_argv;
+    line_argv.reserve(tokens.size());
+    for (auto t = tokens.begin(); t != tokens.end(); ++t) {
+      line_argv.push_back(&(*t)[0]);
+    }
+    motive::AnimPipelineArgs args;
+    if (!ParseAnimPipelineArgs(static_cast<int>(line_argv.size()),
+                               line_argv.data(), log, &args)) {
+      log.Log(kLogError, "%s:%d: invalid arguments\n", manifest_file,
+              line_number);
+      valid_args = false;
+      continue;
+    }
+    batch->push_back(args);
+  }
+  return valid_args;
+}
+
 int main(int argc, char** argv) {
   fplutil::Logger log;
 
+  if (argc > 1 && std::string(argv[1]) == "--batch") {
+    std::vector<motive::AnimPipelineArgs> batch;
+    int num_workers = 1;
+    if (!ParseBatchArgs(argc, argv, log, &batch, &num_workers)) return 1;
+    return motive::RunAnimPipelineBatch(batch, num_workers, log);
+  }
+
   motive::AnimPipelineArgs args;
   if (!ParseAnimPipelineArgs(argc, argv, log, &args)) return 1;
 
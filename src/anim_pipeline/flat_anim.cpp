@@ -1,9 +1,12 @@
 #include "flat_anim.h"
 
+#include <algorithm>
+#include <cstdio>
 #include <sstream>
 #include "anim_generated.h"
 #include "anim_list_generated.h"
 #include "fplutil/file_utils.h"
+#include "motive/math/compact_spline_packing.h"
 
 namespace motive {
 
@@ -51,7 +54,8 @@ void FlatAnim::LogAllChannels() const {
 }
 
 bool FlatAnim::OutputFlatBuffer(const std::string& suggested_output_file,
-                                RepeatPreference repeat_preference) const {
+                                RepeatPreference repeat_preference,
+                                std::string* output_file_written) const {
   const std::string anim_name = fplutil::RemoveDirectoryFromName(
       fplutil::RemoveExtensionFromName(suggested_output_file));
 
@@ -90,9 +94,89 @@ bool FlatAnim::OutputFlatBuffer(const std::string& suggested_output_file,
   // Log summary.
   log_.Log(fplutil::kLogImportant, "  %s (%d bytes)\n",
            fplutil::RemoveDirectoryFromName(output_file).c_str(), NumBytes());
+  if (output_file_written != nullptr) {
+    *output_file_written = output_file;
+  }
   return true;
 }
 
+bool FlatAnim::OutputStats(const std::string& stats_file,
+                           const std::string& anim_name) const {
+  FILE* file = fopen(stats_file.c_str(), "w");
+  if (file == nullptr) {
+    log_.Log(fplutil::kLogError, "Could not open %s for writing\n",
+             stats_file.c_str());
+    return false;
+  }
+
+  // Every spline segment requires a cubic to be re-initialized when playback
+  // crosses into it, so segments per second of playback is the main runtime
+  // cost of a channel. Constant channels cost nothing after initialization.
+  size_t num_nodes = 0;
+  size_t num_segments = 0;
+  size_t num_constant_ops = 0;
+  size_t num_animated_ops = 0;
+  size_t max_channels_per_bone = 0;
+  double total_segment_time = 0.0;
+  double reinits_per_second = 0.0;
+  for (auto bone = bones_.begin(); bone != bones_.end(); ++bone) {
+    const Channels& channels = bone->channels;
+    max_channels_per_bone = std::max(max_channels_per_bone, channels.size());
+    for (auto c = channels.begin(); c != channels.end(); ++c) {
+      const Nodes& n = c->nodes;
+      num_nodes += n.size();
+      if (n.size() <= 1) {
+        num_constant_ops++;
+        continue;
+      }
+      num_animated_ops++;
+      num_segments += n.size() - 1;
+      const FlatTime duration = n.back().time - n.front().time;
+      total_segment_time += duration;
+      if (duration > 0) {
+        reinits_per_second += 1000.0 * (n.size() - 1) / duration;
+      }
+    }
+  }
+  const double average_segment_time =
+      num_segments == 0 ? 0.0 : total_segment_time / num_segments;
+
+  fprintf(file, "{\n  \"anim\": ");
+  OutputJsonString(file, anim_name.c_str());
+  fprintf(file,
+          ",\n"
+          "  \"duration_ms\": %d,\n"
+          "  \"bytes\": %d,\n"
+          "  \"bones\": %d,\n"
+          "  \"total_nodes\": %d,\n"
+          "  \"constant_ops\": %d,\n"
+          "  \"animated_ops\": %d,\n"
+          "  \"average_segment_ms\": %.3f,\n"
+          "  \"cubic_reinits_per_second\": %.3f,\n"
+          "  \"max_channels_per_bone\": %d,\n"
+          "  \"channels_per_bone\": [",
+          MaxAnimatedTime() - MinAnimatedTime(), NumBytes(),
+          static_cast<int>(bones_.size()), static_cast<int>(num_nodes),
+          static_cast<int>(num_constant_ops),
+          static_cast<int>(num_animated_ops), average_segment_time,
+          reinits_per_second, static_cast<int>(max_channels_per_bone));
+  for (size_t bone_idx = 0; bone_idx < bones_.size(); ++bone_idx) {
+    const Bone& bone = bones_[bone_idx];
+    int num_animated = 0;
+    for (auto c = bone.channels.begin(); c != bone.channels.end(); ++c) {
+      if (c->nodes.size() > 1) num_animated++;
+    }
+    fprintf(file, "%s\n    {\"bone\": ", bone_idx == 0 ? "" : ",");
+    OutputJsonString(file, BoneBaseName(bone.name));
+    fprintf(file, ", \"channels\": %d, \"animated\": %d}",
+            static_cast<int>(bone.channels.size()), num_animated);
+  }
+  fprintf(file, "\n  ]\n}\n");
+  const bool ok = ferror(file) == 0;
+  fclose(file);
+  return ok;
+}
+
 int FlatAnim::CreateFlatBuffer(flatbuffers::FlatBufferBuilder& fbb,
                                RepeatPreference repeat_preference,
                                const std::string& anim_name) const {
@@ -167,6 +251,24 @@ flatbuffers::Offset<RigAnimFb> FlatAnim::CreateRigAnimFbFromBoneRange(
   matrix_anims.reserve(num_bones);
   bone_names.reserve(num_bones);
   bone_parents.reserve(num_bones);
+
+  // Creating the splines is independent for every channel, so it can be done
+  // in parallel. The splines are then written to `fbb` in channel order on
+  // this thread, so the output does not depend on the number of threads.
+  std::vector<const Channel*> spline_channels;
+  for (BoneIndex bone_idx = bone_range.start(); bone_idx < bone_range.end();
+       ++bone_idx) {
+    const Channels& channels = bones_[bone_idx].channels;
+    for (auto c = channels.begin(); c != channels.end(); ++c) {
+      if (c->nodes.size() > 1) spline_channels.push_back(&*c);
+    }
+  }
+  std::vector<CompactSpline*> splines(spline_channels.size(), nullptr);
+  ParallelFor(spline_channels.size(), [&spline_channels, &splines](size_t i) {
+    splines[i] = CreateCompactSpline(*spline_channels[i]);
+  });
+  auto spline = splines.begin();
+
   for (BoneIndex bone_idx = bone_range.start(); bone_idx < bone_range.end();
        ++bone_idx) {
     const Bone& bone = bones_[bone_idx];
@@ -194,9 +296,16 @@ flatbuffers::Offset<RigAnimFb> FlatAnim::CreateRigAnimFbFromBoneRange(
         }
 
         // Output spline MatrixOp.
-        CompactSpline* s = CreateCompactSpline(*c);
-        value = CreateSplineFlatBuffer(fbb, *s).Union();
-        value_type = motive::MatrixOpValueFb_CompactSplineFb;
+        assert(spline != splines.end());
+        CompactSpline* s = *spline++;
+        if (packed_splines_) {
+          value = CreatePackedSplineFlatBuffer(fbb, *s, ToleranceForOp(c->op))
+                      .Union();
+          value_type = motive::MatrixOpValueFb_CompactSplinePackedFb;
+        } else {
+          value = CreateSplineFlatBuffer(fbb, *s).Union();
+          value_type = motive::MatrixOpValueFb_CompactSplineFb;
+        }
         CompactSpline::Destroy(s);
       }
 
@@ -237,12 +346,46 @@ flatbuffers::Offset<motive::CompactSplineFb> FlatAnim::CreateSplineFlatBuffer(
   return spline_fb;
 }
 
+flatbuffers::Offset<motive::CompactSplinePackedFb>
+FlatAnim::CreatePackedSplineFlatBuffer(flatbuffers::FlatBufferBuilder& fbb,
+                                       const CompactSpline& s,
+                                       float tolerance) {
+  const CompactSplinePacking packing =
+      CompactSplinePacking::ForTolerance(s, tolerance);
+  std::vector<uint8_t> bits(packing.PackedSize(s.num_nodes()), 0);
+  PackCompactSplineNodes(s, packing, bits.data());
+  auto bits_fb = fbb.CreateVector(bits);
+
+  auto spline_fb = motive::CreateCompactSplinePackedFb(
+      fbb, s.y_range().start(), s.y_range().end(), s.x_granularity(),
+      s.num_nodes(), static_cast<uint8_t>(packing.x_bits),
+      static_cast<uint8_t>(packing.y_bits),
+      static_cast<uint8_t>(packing.angle_bits), bits_fb);
+
+  return spline_fb;
+}
+
 const char* FlatAnim::BoneBaseName(const std::string& name) {
   const size_t colon = name.find_last_of(':');
   const size_t base_idx = colon == std::string::npos ? 0 : colon + 1;
   return &name[base_idx];
 }
 
+void FlatAnim::OutputJsonString(FILE* file, const char* s) {
+  fputc('"', file);
+  for (; *s != '\0'; ++s) {
+    const unsigned char c = static_cast<unsigned char>(*s);
+    if (c == '"' || c == '\\') {
+      fprintf(file, "\\%c", c);
+    } else if (c < 0x20) {
+      fprintf(file, "\\u%04x", c);
+    } else {
+      fputc(c, file);
+    }
+  }
+  fputc('"', file);
+}
+
 Range FlatAnim::SplineYRange(const Channel& ch) {
   // Find extreme values for nodes.
   Range y_range(Range::Empty());
@@ -11,11 +11,22 @@ namespace motive {
 class FlatAnim : public AnimData {
  public:
   FlatAnim(const Tolerances& tolerances, bool root_bones_only,
-           fplutil::Logger& log)
-      : AnimData(tolerances, root_bones_only, log) {}
+           bool packed_splines, fplutil::Logger& log)
+      : AnimData(tolerances, root_bones_only, log),
+        packed_splines_(packed_splines) {}
 
+  /// @brief Write the animation to `suggested_output_file`, with its
+  ///        extension replaced to match the output type. If `output_file`
+  ///        is not null, it's set to the file name that was actually written.
   bool OutputFlatBuffer(const std::string& suggested_output_file,
-                        RepeatPreference repeat_preference) const;
+                        RepeatPreference repeat_preference,
+                        std::string* output_file = nullptr) const;
+
+  /// @brief Write a JSON summary of the animation's runtime cost to
+  ///        `stats_file`: node and op counts, segment lengths, and the number
+  ///        of cubic re-inits per second at normal playback speed.
+  bool OutputStats(const std::string& stats_file,
+                   const std::string& anim_name) const;
 
   void LogChannel(FlatChannelId channel_id) const;
   void LogAllChannels() const;
@@ -32,10 +43,18 @@ class FlatAnim : public AnimData {
       const BoneRange& bone_range, const std::string& anim_name) const;
   // Remove the namespacing from the bone name.
   static const char* BoneBaseName(const std::string& name);
+  // Write `s` to `file` as a quoted JSON string.
+  static void OutputJsonString(FILE* file, const char* s);
   static Range SplineYRange(const Channel& ch);
   static CompactSpline* CreateCompactSpline(const Channel& ch);
   static flatbuffers::Offset<motive::CompactSplineFb> CreateSplineFlatBuffer(
       flatbuffers::FlatBufferBuilder& fbb, const CompactSpline& s);
+  static flatbuffers::Offset<motive::CompactSplinePackedFb>
+  CreatePackedSplineFlatBuffer(flatbuffers::FlatBufferBuilder& fbb,
+                               const CompactSpline& s, float tolerance);
+
+  // If true, output splines as CompactSplinePackedFb.
+  bool packed_splines_;
 };
 
 }  // namespace motive
@@ -12,14 +12,27 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+// Usage: benchmarker [--json FILE] [--csv FILE]
+//        benchmarker --compare BASELINE_CSV CANDIDATE_CSV
+//                    [--alpha A] [--min_slowdown S]
+//
+// --json and --csv write the samples of the final report to FILE. --compare
+// diffs two runs written with --csv, and exits with status 1 if any benchmark
+// is significantly slower, so that it can gate changes in continuous
+// integration.
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <vector>
 #include "motive/common.h"
 #include "motive/engine.h"
 #include "motive/math/angle.h"
 #include "motive/math/curve.h"
 #include "motive/math/compact_spline.h"
-#include "motive/init.h"
+#include "motive/matrix_init.h"
+#include "motive/matrix_motivator.h"
+#include "motive/spline_init.h"
 #include "motive/util/benchmark.h"
 
 using motive::CompactSpline;
@@ -43,6 +56,11 @@ static const SplineInit kRotateInit(kAngleRange);
 static const SplineInit kTranslateInit;
 static const int kNumBenchmarkIds = 10;
 
+// Defaults for --compare. Only slowdowns of more than 5% that are significant
+// at the 1% level count as regressions.
+static const double kDefaultAlpha = 0.01;
+static const double kDefaultMinSlowdown = 0.05;
+
 struct SplineNode {
   float x;
   float y;
@@ -128,7 +146,16 @@ class MotiveBenchmarker {
     }
   }
 
-  void Run() {
+  // Returns false if `json_file` or `csv_file` could not be written.
+  bool Run(const char* json_file, const char* csv_file) {
+    char value[32];
+    snprintf(value, sizeof(value), "%d", static_cast<int>(kNumMatrices));
+    motive::SetBenchmarkConfig("num_matrices", value);
+    snprintf(value, sizeof(value), "%d", kNumIterationsPerReport);
+    motive::SetBenchmarkConfig("iterations_per_report", value);
+    motive::SetBenchmarkConfig("delta_time", "1");
+
+    bool ok = true;
     for (int i = 0; i < kNumReports; ++i) {
       // Advance the engine many times, gathering benchmark information on
       // each iteration.
@@ -136,10 +163,20 @@ class MotiveBenchmarker {
         engine_.AdvanceFrame(1);
       }
 
-      // Output benchmark statistics and empty the stats counter.
+      // Output benchmark statistics and empty the stats counter. The files
+      // get the final report, once it has warmed up.
       motive::OutputBenchmarks();
+      if (i == kNumReports - 1) {
+        if (json_file != nullptr) {
+          ok &= motive::WriteBenchmarks(json_file, motive::kBenchmarkJson);
+        }
+        if (csv_file != nullptr) {
+          ok &= motive::WriteBenchmarks(csv_file, motive::kBenchmarkCsv);
+        }
+      }
       motive::ClearBenchmarks();
     }
+    return ok;
   }
 
  private:
@@ -165,9 +202,62 @@ class MotiveBenchmarker {
   MatrixMotivator4f matrices_[kNumMatrices];
 };
 
-int main() {
+static int Usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [--json FILE] [--csv FILE] [--counters]\n"
+          "       %s --compare BASELINE_CSV CANDIDATE_CSV [--alpha A]"
+          " [--min_slowdown S]\n",
+          program, program);
+  return 2;
+}
+
+int main(int argc, char** argv) {
+  const char* json_file = nullptr;
+  const char* csv_file = nullptr;
+  const char* baseline_file = nullptr;
+  const char* candidate_file = nullptr;
+  double alpha = kDefaultAlpha;
+  double min_slowdown = kDefaultMinSlowdown;
+  bool counters = false;
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "--json") == 0 && has_value) {
+      json_file = argv[++i];
+    } else if (strcmp(argv[i], "--csv") == 0 && has_value) {
+      csv_file = argv[++i];
+    } else if (strcmp(argv[i], "--compare") == 0 && i + 2 < argc) {
+      baseline_file = argv[++i];
+      candidate_file = argv[++i];
+    } else if (strcmp(argv[i], "--alpha") == 0 && has_value) {
+      alpha = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--min_slowdown") == 0 && has_value) {
+      min_slowdown = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--counters") == 0) {
+      counters = true;
+    } else {
+      return Usage(argv[0]);
+    }
+  }
+
+  if (baseline_file != nullptr) {
+    const int regressions = motive::CompareBenchmarks(
+        baseline_file, candidate_file, alpha, min_slowdown);
+    if (regressions < 0) {
+      fprintf(stderr, "Could not read '%s' or '%s'.\n", baseline_file,
+              candidate_file);
+      return 2;
+    }
+    return regressions > 0 ? 1 : 0;
+  }
+
   motive::InitBenchmarks(kNumBenchmarkIds);
+  if (counters && !motive::EnableBenchmarkCounters()) {
+    fprintf(stderr, "Hardware counters are unavailable; timing only.\n");
+  }
   MotiveBenchmarker benchmarker;
-  benchmarker.Run();
+  if (!benchmarker.Run(json_file, csv_file)) {
+    fprintf(stderr, "Could not write benchmark results.\n");
+    return 2;
+  }
   return 0;
 }
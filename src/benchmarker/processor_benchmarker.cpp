@@ -0,0 +1,457 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the per-frame cost of every MotiveProcessor, at several population
+// sizes and under several patterns of churn, so that regressions and scaling
+// cliffs are easy to spot. Results are in nanoseconds per motivator per frame.
+//
+// Usage: processor_benchmarker [--max_population N] [PROCESSOR...]
+// where PROCESSOR is one of the names in kProcessorNames. By default, every
+// processor is run.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include "motive/common.h"
+#include "motive/const_init.h"
+#include "motive/ease_in_ease_out_init.h"
+#include "motive/engine.h"
+#include "motive/math/angle.h"
+#include "motive/math/compact_spline.h"
+#include "motive/matrix_init.h"
+#include "motive/matrix_motivator.h"
+#include "motive/overshoot_init.h"
+#include "motive/rig_anim.h"
+#include "motive/rig_init.h"
+#include "motive/rig_motivator.h"
+#include "motive/spline_init.h"
+#include "motive/spring_init.h"
+#include "motive/sqt_init.h"
+#include "motive/vector_motivator.h"
+
+using motive::BoneIndex;
+using motive::CompactSpline;
+using motive::ConstInit1f;
+using motive::EaseInEaseOutInit1f;
+using motive::MatrixInit;
+using motive::MatrixMotivator4f;
+using motive::MatrixOperationInit;
+using motive::MotiveCurveShape;
+using motive::MotiveEngine;
+using motive::MotiveTime;
+using motive::Motivator1f;
+using motive::MotivatorInit;
+using motive::OvershootInit;
+using motive::Range;
+using motive::RigAnim;
+using motive::RigInit;
+using motive::RigMotivator;
+using motive::SplineInit;
+using motive::SplinePlayback;
+using motive::SpringInit1f;
+using motive::SqtInit;
+
+static const MotiveTime kDeltaTime = 16;
+
+// Every population is run for about this many motivator-frames, within the
+// frame limits below, so that small populations still get enough samples.
+static const double kMotivatorFramesPerRun = 2e7;
+static const int kMinFrames = 10;
+static const int kMaxFrames = 20000;
+
+// Frames run before timing starts, so that every motivator has settled into
+// its steady state.
+static const int kWarmUpFrames = 5;
+
+// Spawn storms and mass retargets happen once every this many frames.
+static const int kChurnPeriod = 10;
+
+static const size_t kPopulations[] = {100, 1000, 10000, 100000, 1000000};
+
+// Bones in each of the rig benchmark's rigs. Kept small, so that a million
+// rigs still fit in memory.
+static const BoneIndex kRigBones = 4;
+
+enum Churn {
+  // Motivators are created once, and then only advanced.
+  kSteady,
+
+  // Every kChurnPeriod frames, half of the motivators are destroyed and
+  // created again, as when a crowd spawns.
+  kSpawnStorm,
+
+  // Every kChurnPeriod frames, every motivator is given a new target.
+  kMassRetarget,
+
+  kNumChurns
+};
+
+static const char* const kChurnNames[] = {"steady", "spawn_storm",
+                                          "mass_retarget"};
+
+// A population of motivators of one processor type.
+class ProcessorPopulation {
+ public:
+  virtual ~ProcessorPopulation() {}
+
+  // Resize to `count` motivators, all initialized on `engine`.
+  virtual void Spawn(MotiveEngine* engine, size_t count) = 0;
+
+  // Destroy and reinitialize motivators [begin, end).
+  virtual void Respawn(size_t begin, size_t end) = 0;
+
+  // Give every motivator a new target. `phase` varies the target each time.
+  virtual void Retarget(int phase) = 0;
+};
+
+// A repeating curve from 0 to 1 and back over a second, for the
+// spline-driven processors.
+static void CreateLoopSpline(CompactSpline* spline) {
+  spline->Init(Range(0.0f, 1.0f),
+               CompactSpline::RecommendXGranularity(1000.0f));
+  spline->AddNode(0.0f, 0.0f, 0.0f);
+  spline->AddNode(500.0f, 1.0f, 0.0f);
+  spline->AddNode(1000.0f, 0.0f, 0.0f);
+}
+
+// Alternate targets between 0 and 1, and vary their timing a little, so that
+// not every motivator settles on the same frame.
+static float TargetValue(int phase) { return (phase & 1) ? 0.0f : 1.0f; }
+static MotiveTime TargetTime(size_t i) {
+  return static_cast<MotiveTime>(200 + (i % 7) * 50);
+}
+
+// Motivator1fs of a vector processor, created from `init_`.
+class VectorPopulation : public ProcessorPopulation {
+ public:
+  enum TargetStyle { kPlaySpline, kTarget, kTargetShape };
+
+  VectorPopulation(const MotivatorInit& init, TargetStyle style,
+                   const CompactSpline* spline)
+      : engine_(nullptr), init_(init), style_(style), spline_(spline) {}
+
+  void Spawn(MotiveEngine* engine, size_t count) override {
+    engine_ = engine;
+    motivators_.resize(count);
+    Respawn(0, count);
+  }
+
+  void Respawn(size_t begin, size_t end) override {
+    for (size_t i = begin; i < end; ++i) {
+      Motivator1f& m = motivators_[i];
+      m.Invalidate();
+      m.Initialize(init_, engine_);
+      if (style_ == kPlaySpline) {
+        m.SetSpline(*spline_, SplinePlayback(0.0f, true));
+      } else {
+        SetTarget(i, 0);
+      }
+    }
+  }
+
+  void Retarget(int phase) override {
+    for (size_t i = 0; i < motivators_.size(); ++i) {
+      SetTarget(i, phase);
+    }
+  }
+
+ private:
+  void SetTarget(size_t i, int phase) {
+    Motivator1f& m = motivators_[i];
+    const float value = TargetValue(phase);
+    if (style_ == kTargetShape) {
+      const MotiveCurveShape shape(1.0f, static_cast<float>(TargetTime(i)),
+                                   0.5f);
+      m.SetTargetWithShape(value, 0.0f, shape);
+    } else {
+      m.SetTarget(motive::Target1f(value, 0.0f, TargetTime(i)));
+    }
+  }
+
+  MotiveEngine* engine_;
+  const MotivatorInit& init_;
+  TargetStyle style_;
+  const CompactSpline* spline_;
+  std::vector<Motivator1f> motivators_;
+};
+
+// MatrixMotivator4fs of the matrix processor or, if `sqt` is true, the SQT
+// processor. Each is a spline-driven rotation above a targeted translation.
+class MatrixPopulation : public ProcessorPopulation {
+ public:
+  MatrixPopulation(const std::vector<MatrixOperationInit>& ops, bool sqt)
+      : engine_(nullptr), ops_(ops), sqt_(sqt) {}
+
+  void Spawn(MotiveEngine* engine, size_t count) override {
+    engine_ = engine;
+    motivators_.resize(count);
+    Respawn(0, count);
+  }
+
+  void Respawn(size_t begin, size_t end) override {
+    for (size_t i = begin; i < end; ++i) {
+      MatrixMotivator4f& m = motivators_[i];
+      m.Invalidate();
+      if (sqt_) {
+        m.Initialize(SqtInit(ops_), engine_);
+      } else {
+        m.Initialize(MatrixInit(ops_), engine_);
+      }
+      m.SetRepeating(true);
+    }
+  }
+
+  void Retarget(int phase) override {
+    const float value = TargetValue(phase);
+    for (size_t i = 0; i < motivators_.size(); ++i) {
+      motivators_[i].SetChildTarget1f(
+          1, motive::Target1f(value, 0.0f, TargetTime(i)));
+    }
+  }
+
+ private:
+  MotiveEngine* engine_;
+  const std::vector<MatrixOperationInit>& ops_;
+  bool sqt_;
+  std::vector<MatrixMotivator4f> motivators_;
+};
+
+// RigMotivators playing `anim`. Retargeting blends into the same animation
+// again, which is what a crowd changing animation state costs.
+class RigPopulation : public ProcessorPopulation {
+ public:
+  explicit RigPopulation(const RigAnim& anim)
+      : engine_(nullptr),
+        anim_(anim),
+        init_(anim, anim.bone_parents(), anim.NumBones()) {}
+
+  void Spawn(MotiveEngine* engine, size_t count) override {
+    engine_ = engine;
+    motivators_.resize(count);
+    Respawn(0, count);
+  }
+
+  void Respawn(size_t begin, size_t end) override {
+    for (size_t i = begin; i < end; ++i) {
+      RigMotivator& m = motivators_[i];
+      m.Invalidate();
+      m.Initialize(init_, engine_);
+      m.BlendToAnim(anim_, SplinePlayback(0.0f, true));
+    }
+  }
+
+  void Retarget(int /*phase*/) override {
+    const SplinePlayback playback(0.0f, true, 1.0f, 100.0f);
+    for (size_t i = 0; i < motivators_.size(); ++i) {
+      motivators_[i].BlendToAnim(anim_, playback);
+    }
+  }
+
+ private:
+  MotiveEngine* engine_;
+  const RigAnim& anim_;
+  RigInit init_;
+  std::vector<RigMotivator> motivators_;
+};
+
+enum ProcessorKind {
+  kSplineProcessor,
+  kOvershootProcessor,
+  kSpringProcessor,
+  kEaseInEaseOutProcessor,
+  kConstProcessor,
+  kMatrixProcessor,
+  kSqtProcessor,
+  kRigProcessor,
+  kNumProcessorKinds
+};
+
+static const char* const kProcessorNames[] = {
+    "spline", "overshoot", "spring", "ease_in_ease_out",
+    "const",  "matrix",    "sqt",    "rig"};
+
+// Owns the inits and curves that every population is created from.
+class ProcessorBenchmarker {
+ public:
+  ProcessorBenchmarker()
+      : rotate_init_(motive::kAngleRange),
+        const_init_(0.5f, 0.0f),
+        ease_init_(0.0f, 0.0f) {
+    SplineInit::Register();
+    OvershootInit::Register();
+    motive::SpringInit::Register();
+    motive::EaseInEaseOutInit::Register();
+    motive::ConstInit::Register();
+    MatrixInit::Register();
+    SqtInit::Register();
+    RigInit::Register();
+
+    CreateLoopSpline(&spline_);
+
+    overshoot_init_.set_range(Range(-1.0f, 2.0f));
+    overshoot_init_.set_max_velocity(0.01f);
+    overshoot_init_.set_max_delta(1.0f);
+    overshoot_init_.at_target().max_difference = 0.001f;
+    overshoot_init_.at_target().max_velocity = 0.00001f;
+    overshoot_init_.set_accel_per_difference(0.00032f);
+    overshoot_init_.set_wrong_direction_multiplier(4.0f);
+    overshoot_init_.set_max_delta_time(10);
+
+    ops_.emplace_back(0, motive::kRotateAboutY, rotate_init_, spline_);
+    ops_.emplace_back(1, motive::kTranslateX, translate_init_, 0.0f);
+    ops_.emplace_back(2, motive::kTranslateY, 1.0f);
+
+    // A chain of bones, each with the same ops.
+    rig_anim_.Init("benchmark", kRigBones, false);
+    for (BoneIndex i = 0; i < kRigBones; ++i) {
+      rig_anim_
+          .InitMatrixAnim(i, i == 0 ? motive::kInvalidBoneIdx : i - 1, "")
+          .ops() = ops_;
+    }
+  }
+
+  ProcessorPopulation* CreatePopulation(ProcessorKind kind) const {
+    switch (kind) {
+      case kSplineProcessor:
+        return new VectorPopulation(spline_init_,
+                                    VectorPopulation::kPlaySpline, &spline_);
+      case kOvershootProcessor:
+        return new VectorPopulation(overshoot_init_, VectorPopulation::kTarget,
+                                    nullptr);
+      case kSpringProcessor:
+        return new VectorPopulation(spring_init_,
+                                    VectorPopulation::kTargetShape, nullptr);
+      case kEaseInEaseOutProcessor:
+        return new VectorPopulation(ease_init_, VectorPopulation::kTargetShape,
+                                    nullptr);
+      case kConstProcessor:
+        return new VectorPopulation(const_init_, VectorPopulation::kTarget,
+                                    nullptr);
+      case kMatrixProcessor:
+        return new MatrixPopulation(ops_, false);
+      case kSqtProcessor:
+        return new MatrixPopulation(ops_, true);
+      case kRigProcessor:
+        return new RigPopulation(rig_anim_);
+      default:
+        assert(false);
+        return nullptr;
+    }
+  }
+
+  // Run `kind` with `population` motivators under `churn`, and print the
+  // mean and worst frame cost.
+  void Run(ProcessorKind kind, size_t population, Churn churn) const {
+    const int frames_for_population = static_cast<int>(
+        kMotivatorFramesPerRun / static_cast<double>(population));
+    const int num_frames =
+        std::max(kMinFrames, std::min(kMaxFrames, frames_for_population));
+
+    // The engine must outlive the motivators, which are destroyed first.
+    MotiveEngine engine;
+    std::unique_ptr<ProcessorPopulation> motivators(CreatePopulation(kind));
+    motivators->Spawn(&engine, population);
+    for (int frame = 0; frame < kWarmUpFrames; ++frame) {
+      engine.AdvanceFrame(kDeltaTime);
+    }
+
+    // Churn is applied inside the timed region, since its cost is what
+    // spawn storms and mass retargets are measuring.
+    typedef std::chrono::steady_clock Clock;
+    double total_ns = 0.0;
+    double worst_ns = 0.0;
+    for (int frame = 0; frame < num_frames; ++frame) {
+      const Clock::time_point start = Clock::now();
+      if (frame % kChurnPeriod == 0) {
+        if (churn == kSpawnStorm) {
+          motivators->Respawn(0, population / 2);
+        } else if (churn == kMassRetarget) {
+          motivators->Retarget(frame / kChurnPeriod);
+        }
+      }
+      engine.AdvanceFrame(kDeltaTime);
+      const double ns = static_cast<double>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                               start)
+              .count());
+      total_ns += ns;
+      worst_ns = std::max(worst_ns, ns);
+    }
+
+    const double count = static_cast<double>(population);
+    printf("%-17s %10zu %-14s %8d %14.2f %14.2f\n", kProcessorNames[kind],
+           population, kChurnNames[churn], num_frames,
+           total_ns / (count * num_frames), worst_ns / count);
+    fflush(stdout);
+  }
+
+ private:
+  CompactSpline spline_;
+  SplineInit spline_init_;
+  SplineInit rotate_init_;
+  SplineInit translate_init_;
+  OvershootInit overshoot_init_;
+  SpringInit1f spring_init_;
+  ConstInit1f const_init_;
+  EaseInEaseOutInit1f ease_init_;
+  std::vector<MatrixOperationInit> ops_;
+  RigAnim rig_anim_;
+};
+
+int main(int argc, char** argv) {
+  size_t max_population = kPopulations[MOTIVE_ARRAY_SIZE(kPopulations) - 1];
+  bool run_kind[kNumProcessorKinds];
+  bool any_kind_named = false;
+  std::fill(run_kind, run_kind + kNumProcessorKinds, false);
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--max_population") == 0 && i + 1 < argc) {
+      max_population = static_cast<size_t>(atol(argv[++i]));
+      continue;
+    }
+    bool found = false;
+    for (int kind = 0; kind < kNumProcessorKinds; ++kind) {
+      if (strcmp(argv[i], kProcessorNames[kind]) == 0) {
+        run_kind[kind] = true;
+        found = true;
+      }
+    }
+    if (!found) {
+      fprintf(stderr,
+              "Usage: %s [--max_population N] [PROCESSOR...]\n"
+              "Unknown argument '%s'.\n",
+              argv[0], argv[i]);
+      return 1;
+    }
+    any_kind_named = true;
+  }
+
+  const ProcessorBenchmarker benchmarker;
+  printf("%-17s %10s %-14s %8s %14s %14s\n", "processor", "population",
+         "churn", "frames", "mean_ns", "worst_frame_ns");
+  for (int kind = 0; kind < kNumProcessorKinds; ++kind) {
+    if (any_kind_named && !run_kind[kind]) continue;
+    for (size_t i = 0; i < MOTIVE_ARRAY_SIZE(kPopulations); ++i) {
+      if (kPopulations[i] > max_population) break;
+      for (int churn = 0; churn < kNumChurns; ++churn) {
+        benchmarker.Run(static_cast<ProcessorKind>(kind), kPopulations[i],
+                        static_cast<Churn>(churn));
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,164 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Replays a session recorded by MotiveRecorder, headless and as fast as
+// possible, and measures what each frame costs: the recorded calls made
+// between frames, plus advancing the engine.
+//
+// Usage: replay_benchmarker [--OPTION VALUE]... RECORDING [ANIM_FILE]...
+// The ANIM_FILEs are the .motiveanim files that the recorded rigs played.
+// Options are listed in PrintUsage().
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "motive/anim_table.h"
+#include "motive/const_init.h"
+#include "motive/ease_in_ease_out_init.h"
+#include "motive/engine.h"
+#include "motive/matrix_init.h"
+#include "motive/overshoot_init.h"
+#include "motive/rig_init.h"
+#include "motive/spline_init.h"
+#include "motive/spring_init.h"
+#include "motive/sqt_init.h"
+#include "motive/util/replayer.h"
+
+using motive::AnimTable;
+using motive::MotiveEngine;
+using motive::MotiveReplayer;
+
+static void PrintUsage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [--OPTION VALUE]... RECORDING [ANIM_FILE]...\n"
+          "Options:\n"
+          "  --repeat N   replay the recording N times (default 1)\n"
+          "  --threads N  threads used by AdvanceFrame() (default 1)\n",
+          program);
+}
+
+static const char* LoadFile(const char* file_name, std::string* scratch_buf) {
+  std::ifstream file(file_name, std::ios::binary);
+  if (!file) return nullptr;
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  *scratch_buf = contents.str();
+  return scratch_buf->c_str();
+}
+
+// The nearest-rank percentile of `sorted`, which must not be empty.
+static double Percentile(const std::vector<double>& sorted, double percent) {
+  const size_t rank = static_cast<size_t>(percent / 100.0 * sorted.size());
+  return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+int main(int argc, char** argv) {
+  int repeat = 1;
+  int num_threads = 1;
+  const char* recording = nullptr;
+  AnimTable::TableFileNames anim_files;
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "--", 2) != 0) {
+      if (recording == nullptr) {
+        recording = argv[i];
+      } else {
+        // Each animation is its own object, so rigs may have any skeleton.
+        anim_files.push_back(AnimTable::ListFileNames(1, argv[i]));
+      }
+      continue;
+    }
+    if (i + 1 >= argc) {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+    if (strcmp(argv[i], "--repeat") == 0) {
+      repeat = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--threads") == 0) {
+      num_threads = atoi(argv[++i]);
+    } else {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+  }
+  if (recording == nullptr || repeat < 1) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  AnimTable table;
+  if (!anim_files.empty() &&
+      !table.InitFromAnimFileNames(anim_files, LoadFile)) {
+    fprintf(stderr, "Could not load the animations.\n");
+    return 1;
+  }
+
+  motive::SplineInit::Register();
+  motive::OvershootInit::Register();
+  motive::SpringInit::Register();
+  motive::EaseInEaseOutInit::Register();
+  motive::ConstInit::Register();
+  motive::MatrixInit::Register();
+  motive::SqtInit::Register();
+  motive::RigInit::Register();
+
+  MotiveEngine engine;
+  engine.set_num_threads(num_threads);
+  MotiveReplayer replayer(&engine);
+  for (int object = 0; object < table.NumObjects(); ++object) {
+    replayer.AddAnim(table.Query(object, 0));
+  }
+  if (!replayer.Load(recording)) {
+    fprintf(stderr, "Could not read the recording '%s'.\n", recording);
+    return 1;
+  }
+
+  // Time every frame of every repetition.
+  typedef std::chrono::steady_clock Clock;
+  std::vector<double> frame_ms;
+  frame_ms.reserve(static_cast<size_t>(replayer.NumFrames()) * repeat);
+  double total_ms = 0.0;
+  for (int r = 0; r < repeat; ++r) {
+    replayer.Rewind();
+    for (;;) {
+      const Clock::time_point start = Clock::now();
+      if (!replayer.ReplayFrame()) break;
+      const double ms =
+          std::chrono::duration<double, std::milli>(Clock::now() - start)
+              .count();
+      frame_ms.push_back(ms);
+      total_ms += ms;
+    }
+  }
+  if (frame_ms.empty()) {
+    fprintf(stderr, "The recording '%s' has no calls.\n", recording);
+    return 1;
+  }
+  std::sort(frame_ms.begin(), frame_ms.end());
+
+  printf("frames %d, repeats %d, threads %d, skipped calls %d\n",
+         replayer.NumFrames(), repeat, num_threads,
+         replayer.num_skipped_calls());
+  printf("frame ms: mean %.3f, p50 %.3f, p95 %.3f, p99 %.3f, max %.3f\n",
+         total_ms / frame_ms.size(), Percentile(frame_ms, 50.0),
+         Percentile(frame_ms, 95.0), Percentile(frame_ms, 99.0),
+         frame_ms.back());
+  printf("total ms %.3f\n", total_ms);
+  return 0;
+}
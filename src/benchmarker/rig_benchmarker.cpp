@@ -0,0 +1,576 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Simulates a crowd of RigMotivators playing and cross-blending real
+// .motiveanim clips, and measures what it costs per frame: issuing the blends,
+// advancing the engine, and reading every rig's global transforms.
+//
+// With `--mode memory`, it instead counts the heap allocations made while
+// loading the animations, spawning the crowd, playing it steadily, and tearing
+// it down, and fails if steady playback allocates at all.
+//
+// Usage: rig_benchmarker [--OPTION VALUE]... ANIM_FILE...
+// The ANIM_FILEs are loaded into object 0 of an AnimTable, and must share a
+// skeleton. Options are listed in PrintUsage(). `--scenario FILE` reads more
+// options from FILE, one `OPTION VALUE` pair per line, with '#' comments.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "motive/anim_table.h"
+#include "motive/engine.h"
+#include "motive/matrix_init.h"
+#include "motive/rig_anim.h"
+#include "motive/rig_init.h"
+#include "motive/rig_motivator.h"
+#include "motive/spline_init.h"
+#include "motive/sqt_init.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+using motive::AnimTable;
+using motive::MotiveEngine;
+using motive::MotiveTime;
+using motive::RigAnim;
+using motive::RigInit;
+using motive::RigMotivator;
+using motive::SplinePlayback;
+
+// The most animations a rig blends between at once.
+static const int kMaxLayers = 8;
+
+// Frames played in memory mode before steady playback is measured, so that
+// buffers that grow on the first frames have reached their final size.
+static const int kWarmUpFrames = 10;
+
+// Every heap allocation in the program goes through the global operator new
+// and delete below, which keep these totals. Each block is prefixed with its
+// size, so that frees can be counted in bytes.
+struct HeapCounters {
+  std::atomic<int64_t> allocations;
+  std::atomic<int64_t> frees;
+  std::atomic<int64_t> allocated_bytes;
+  std::atomic<int64_t> live_bytes;
+  std::atomic<int64_t> peak_live_bytes;
+};
+static HeapCounters g_heap;
+
+// Keeps the blocks returned by operator new aligned for any type.
+static const size_t kHeapHeaderSize = 16;
+
+static void* CountedAllocate(size_t size) {
+  void* raw = malloc(size + kHeapHeaderSize);
+  if (raw == nullptr) return nullptr;
+  *static_cast<size_t*>(raw) = size;
+
+  const std::memory_order relaxed = std::memory_order_relaxed;
+  const int64_t bytes = static_cast<int64_t>(size);
+  g_heap.allocations.fetch_add(1, relaxed);
+  g_heap.allocated_bytes.fetch_add(bytes, relaxed);
+  const int64_t live = g_heap.live_bytes.fetch_add(bytes, relaxed) + bytes;
+  int64_t peak = g_heap.peak_live_bytes.load(relaxed);
+  while (live > peak &&
+         !g_heap.peak_live_bytes.compare_exchange_weak(peak, live, relaxed)) {
+  }
+  return static_cast<uint8_t*>(raw) + kHeapHeaderSize;
+}
+
+static void CountedFree(void* p) {
+  if (p == nullptr) return;
+  void* raw = static_cast<uint8_t*>(p) - kHeapHeaderSize;
+  const int64_t bytes = static_cast<int64_t>(*static_cast<size_t*>(raw));
+  g_heap.frees.fetch_add(1, std::memory_order_relaxed);
+  g_heap.live_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+  free(raw);
+}
+
+void* operator new(size_t size) {
+  void* p = CountedAllocate(size);
+  if (p == nullptr) abort();
+  return p;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return CountedAllocate(size);
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return CountedAllocate(size);
+}
+void operator delete(void* p) noexcept { CountedFree(p); }
+void operator delete[](void* p) noexcept { CountedFree(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+  CountedFree(p);
+}
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+  CountedFree(p);
+}
+
+// Peak resident set size of the process so far, in kilobytes, or 0 if the
+// platform doesn't report it.
+static long PeakRssKb() {
+#if defined(__unix__) || defined(__APPLE__)
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+  return usage.ru_maxrss / 1024;  // Bytes on macOS.
+#else
+  return usage.ru_maxrss;
+#endif
+#else
+  return 0;
+#endif
+}
+
+// Reports the heap activity from its construction until Report().
+class HeapPhase {
+ public:
+  explicit HeapPhase(const char* name)
+      : name_(name),
+        allocations_(g_heap.allocations.load()),
+        frees_(g_heap.frees.load()),
+        allocated_bytes_(g_heap.allocated_bytes.load()),
+        live_bytes_(g_heap.live_bytes.load()) {
+    g_heap.peak_live_bytes.store(live_bytes_);
+  }
+
+  // Print the phase's totals, and return the number of allocations made.
+  int64_t Report() const {
+    const int64_t allocations = g_heap.allocations.load() - allocations_;
+    const double kb = 1.0 / 1024.0;
+    printf("%-9s allocations %lld, frees %lld, allocated KB %.1f, "
+           "live KB %+.1f, peak live KB %.1f, peak RSS KB %ld\n",
+           name_, static_cast<long long>(allocations),
+           static_cast<long long>(g_heap.frees.load() - frees_),
+           (g_heap.allocated_bytes.load() - allocated_bytes_) * kb,
+           (g_heap.live_bytes.load() - live_bytes_) * kb,
+           g_heap.peak_live_bytes.load() * kb, PeakRssKb());
+    return allocations;
+  }
+
+ private:
+  const char* name_;
+  int64_t allocations_;
+  int64_t frees_;
+  int64_t allocated_bytes_;
+  int64_t live_bytes_;
+};
+
+struct Scenario {
+  Scenario()
+      : memory_mode(false),
+        num_rigs(1000),
+        num_frames(600),
+        delta_time(16),
+        blend_interval(2000),
+        blend_time(250),
+        layers(1),
+        rate_variance(0.0f),
+        seed(1) {}
+
+  // Count heap allocations instead of timing frames.
+  bool memory_mode;
+
+  // Number of rigs in the crowd.
+  int num_rigs;
+
+  // Number of frames timed, each advancing by `delta_time` milliseconds.
+  int num_frames;
+  MotiveTime delta_time;
+
+  // Average milliseconds between blends, per rig. Each rig's interval varies
+  // uniformly between half and one and a half times this. 0 never blends.
+  MotiveTime blend_interval;
+
+  // Milliseconds over which each blend happens.
+  MotiveTime blend_time;
+
+  // Number of animations each blend plays at once, with random weights.
+  int layers;
+
+  // Playback rates vary uniformly over 1 +/- `rate_variance`.
+  float rate_variance;
+
+  unsigned int seed;
+};
+
+static void PrintUsage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [--OPTION VALUE]... ANIM_FILE...\n"
+          "Options:\n"
+          "  --rigs N            rigs in the crowd (default 1000)\n"
+          "  --frames N          frames to time (default 600)\n"
+          "  --delta_time MS     time per frame (default 16)\n"
+          "  --blend_interval MS average time between blends, per rig;\n"
+          "                      0 never blends (default 2000)\n"
+          "  --blend_time MS     length of each blend (default 250)\n"
+          "  --layers N          animations per blend, up to %d (default 1)\n"
+          "  --rate_variance V   playback rates vary over 1 +/- V "
+          "(default 0)\n"
+          "  --seed S            random seed (default 1)\n"
+          "  --mode time|memory  time frames, or count heap allocations\n"
+          "                      (default time)\n"
+          "  --scenario FILE     read OPTION VALUE lines from FILE\n",
+          program, kMaxLayers);
+}
+
+static bool ReadScenarioFile(const char* file_name, Scenario* scenario);
+
+// Set the option named `key`, without its leading "--", to `value`.
+static bool SetOption(const std::string& key, const std::string& value,
+                      Scenario* s) {
+  const char* v = value.c_str();
+  if (key == "rigs") {
+    s->num_rigs = atoi(v);
+  } else if (key == "frames") {
+    s->num_frames = atoi(v);
+  } else if (key == "delta_time") {
+    s->delta_time = atoi(v);
+  } else if (key == "blend_interval") {
+    s->blend_interval = atoi(v);
+  } else if (key == "blend_time") {
+    s->blend_time = atoi(v);
+  } else if (key == "layers") {
+    s->layers = atoi(v);
+  } else if (key == "rate_variance") {
+    s->rate_variance = static_cast<float>(atof(v));
+  } else if (key == "seed") {
+    s->seed = static_cast<unsigned int>(strtoul(v, nullptr, 10));
+  } else if (key == "mode") {
+    if (value != "time" && value != "memory") {
+      fprintf(stderr, "Unknown mode '%s'.\n", v);
+      return false;
+    }
+    s->memory_mode = value == "memory";
+  } else if (key == "scenario") {
+    return ReadScenarioFile(v, s);
+  } else {
+    fprintf(stderr, "Unknown option '%s'.\n", key.c_str());
+    return false;
+  }
+  return true;
+}
+
+static bool ReadScenarioFile(const char* file_name, Scenario* scenario) {
+  std::ifstream file(file_name);
+  if (!file) {
+    fprintf(stderr, "Could not open scenario '%s'.\n", file_name);
+    return false;
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream tokens(line);
+    std::string key;
+    std::string value;
+    if (!(tokens >> key)) continue;
+    if (!(tokens >> value)) {
+      fprintf(stderr, "Option '%s' in '%s' has no value.\n", key.c_str(),
+              file_name);
+      return false;
+    }
+    if (key.compare(0, 2, "--") == 0) key = key.substr(2);
+    if (!SetOption(key, value, scenario)) return false;
+  }
+  return true;
+}
+
+static const char* LoadFile(const char* file_name, std::string* scratch_buf) {
+  std::ifstream file(file_name, std::ios::binary);
+  if (!file) return nullptr;
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  *scratch_buf = contents.str();
+  return scratch_buf->c_str();
+}
+
+// Files read by PreloadFiles(), so that memory mode can load the animations
+// without counting the file reads.
+static std::map<std::string, std::string> g_preloaded_files;
+
+static bool PreloadFiles(const AnimTable::ListFileNames& file_names) {
+  for (size_t i = 0; i < file_names.size(); ++i) {
+    std::string* contents = &g_preloaded_files[file_names[i]];
+    if (LoadFile(file_names[i].c_str(), contents) == nullptr) return false;
+  }
+  return true;
+}
+
+static const char* LoadPreloadedFile(const char* file_name,
+                                     std::string* /*scratch_buf*/) {
+  const auto it = g_preloaded_files.find(file_name);
+  return it == g_preloaded_files.end() ? nullptr : it->second.c_str();
+}
+
+// The nearest-rank percentile of `sorted`, which must not be empty.
+static double Percentile(const std::vector<double>& sorted, double percent) {
+  const size_t rank = static_cast<size_t>(percent / 100.0 * sorted.size());
+  return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+class RigBenchmarker {
+ public:
+  RigBenchmarker(const Scenario& scenario, const AnimTable& table)
+      : scenario_(scenario),
+        table_(table),
+        random_(scenario.seed),
+        num_blends_(0) {
+    motive::SplineInit::Register();
+    motive::MatrixInit::Register();
+    motive::SqtInit::Register();
+    RigInit::Register();
+  }
+
+  void Run() {
+    Spawn();
+    MotiveTime time = 0;
+
+    // Each frame, start any blends that are due, advance the engine, and read
+    // every rig's global transforms, as rendering would.
+    typedef std::chrono::steady_clock Clock;
+    std::vector<double> blend_ms(scenario_.num_frames);
+    std::vector<double> frame_ms(scenario_.num_frames);
+    float checksum = 0.0f;
+    for (int frame = 0; frame < scenario_.num_frames; ++frame) {
+      const Clock::time_point start = Clock::now();
+      for (int i = 0; i < scenario_.num_rigs; ++i) {
+        if (scenario_.blend_interval > 0 && next_blend_times_[i] <= time) {
+          Blend(&rigs_[i], scenario_.blend_time);
+          next_blend_times_[i] = NextBlendTime(time);
+        }
+      }
+      const Clock::time_point blended = Clock::now();
+      engine_.AdvanceFrame(scenario_.delta_time);
+      for (int i = 0; i < scenario_.num_rigs; ++i) {
+        checksum += rigs_[i].GlobalTransforms()[0](0, 3);
+      }
+      const Clock::time_point end = Clock::now();
+      time += scenario_.delta_time;
+
+      blend_ms[frame] = Milliseconds(blended - start);
+      frame_ms[frame] = Milliseconds(end - start);
+    }
+
+    Report(table_.DefiningAnim(0).NumBones(), frame_ms, blend_ms, checksum);
+  }
+
+  // Count the heap allocations made while spawning the crowd, playing its
+  // first frames, and then playing it steadily, without blending. Returns the
+  // number made during steady playback. The crowd is destroyed along with
+  // the RigBenchmarker.
+  int64_t MeasureMemory() {
+    HeapPhase spawn("spawn");
+    Spawn();
+    spawn.Report();
+
+    HeapPhase warm_up("warm-up");
+    for (int frame = 0; frame < kWarmUpFrames; ++frame) {
+      engine_.AdvanceFrame(scenario_.delta_time);
+    }
+    warm_up.Report();
+
+    HeapPhase steady("steady");
+    float checksum = 0.0f;
+    for (int frame = 0; frame < scenario_.num_frames; ++frame) {
+      engine_.AdvanceFrame(scenario_.delta_time);
+      for (int i = 0; i < scenario_.num_rigs; ++i) {
+        checksum += rigs_[i].GlobalTransforms()[0](0, 3);
+      }
+    }
+    const int64_t steady_allocations = steady.Report();
+    printf("rigs %d, bones %d, steady frames %d, checksum %g\n",
+           scenario_.num_rigs, table_.DefiningAnim(0).NumBones(),
+           scenario_.num_frames, checksum);
+    return steady_allocations;
+  }
+
+ private:
+  // Initialize every rig, and start it playing.
+  void Spawn() {
+    const RigAnim& defining_anim = table_.DefiningAnim(0);
+    const RigInit init(defining_anim, defining_anim.bone_parents(),
+                       defining_anim.NumBones());
+    rigs_.resize(scenario_.num_rigs);
+    next_blend_times_.resize(scenario_.num_rigs);
+    for (int i = 0; i < scenario_.num_rigs; ++i) {
+      rigs_[i].Initialize(init, &engine_);
+      Blend(&rigs_[i], 0);
+      next_blend_times_[i] = NextBlendTime(0);
+    }
+    num_blends_ = 0;
+  }
+
+  template <class Duration>
+  static double Milliseconds(const Duration& d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+  }
+
+  float Uniform(float min, float max) {
+    return std::uniform_real_distribution<float>(min, max)(random_);
+  }
+
+  MotiveTime NextBlendTime(MotiveTime time) {
+    const float interval = static_cast<float>(scenario_.blend_interval);
+    return time + static_cast<MotiveTime>(Uniform(0.5f, 1.5f) * interval);
+  }
+
+  // Blend `rig` to `scenario_.layers` random animations, each at a random
+  // time, rate and weight.
+  void Blend(RigMotivator* rig, MotiveTime blend_time) {
+    const RigAnim* anims[kMaxLayers];
+    SplinePlayback playbacks[kMaxLayers];
+    float weights[kMaxLayers];
+    const int num_anims = table_.NumAnims(0);
+    float total_weight = 0.0f;
+    for (int i = 0; i < scenario_.layers; ++i) {
+      anims[i] = table_.Query(0, std::uniform_int_distribution<int>(
+                                     0, num_anims - 1)(random_));
+      const float rate = 1.0f + Uniform(-scenario_.rate_variance,
+                                        scenario_.rate_variance);
+      const float start_x =
+          Uniform(0.0f, static_cast<float>(anims[i]->end_time()));
+      playbacks[i] = SplinePlayback(start_x, true, rate,
+                                    static_cast<float>(blend_time));
+      weights[i] = Uniform(0.1f, 1.0f);
+      total_weight += weights[i];
+    }
+    for (int i = 0; i < scenario_.layers; ++i) {
+      weights[i] /= total_weight;
+    }
+    rig->BlendToAnims(anims, playbacks, weights, scenario_.layers);
+    num_blends_++;
+  }
+
+  void Report(int num_bones, std::vector<double> frame_ms,
+              std::vector<double> blend_ms, float checksum) const {
+    double total_ms = 0.0;
+    double total_blend_ms = 0.0;
+    for (size_t i = 0; i < frame_ms.size(); ++i) {
+      total_ms += frame_ms[i];
+      total_blend_ms += blend_ms[i];
+    }
+    std::sort(frame_ms.begin(), frame_ms.end());
+
+    const double frames = static_cast<double>(scenario_.num_frames);
+    const double rigs = static_cast<double>(scenario_.num_rigs);
+    const double ns_per_ms = 1e6;
+    printf("rigs %d, bones %d, anims %d, layers %d, blend_interval %dms, "
+           "rate_variance %.2f\n",
+           scenario_.num_rigs, num_bones, table_.NumAnims(0), scenario_.layers,
+           static_cast<int>(scenario_.blend_interval),
+           scenario_.rate_variance);
+    printf("frame ms: mean %.3f, p50 %.3f, p95 %.3f, p99 %.3f, max %.3f\n",
+           total_ms / frames, Percentile(frame_ms, 50.0),
+           Percentile(frame_ms, 95.0), Percentile(frame_ms, 99.0),
+           frame_ms.back());
+    printf("ns per rig per frame %.1f (blending %.1f), ns per bone per frame "
+           "%.2f\n",
+           total_ms * ns_per_ms / (rigs * frames),
+           total_blend_ms * ns_per_ms / (rigs * frames),
+           total_ms * ns_per_ms / (rigs * num_bones * frames));
+    printf("blends started %d (%.1f per frame), checksum %g\n", num_blends_,
+           num_blends_ / frames, checksum);
+  }
+
+  const Scenario& scenario_;
+  const AnimTable& table_;
+  MotiveEngine engine_;
+
+  // Destroyed before `engine_`, which they're removed from.
+  std::vector<RigMotivator> rigs_;
+  std::mt19937 random_;
+  std::vector<MotiveTime> next_blend_times_;
+  int num_blends_;
+};
+
+// Count the heap allocations of each phase of a rig's life. Returns the
+// process's exit status, which is 1 if steady playback allocated.
+static int MeasureMemory(const Scenario& scenario,
+                         const AnimTable::ListFileNames& anim_files) {
+  if (!PreloadFiles(anim_files)) {
+    fprintf(stderr, "Could not read the animations.\n");
+    return 1;
+  }
+
+  HeapPhase load("load");
+  std::unique_ptr<AnimTable> table(new AnimTable());
+  if (!table->InitFromAnimFileNames(anim_files, LoadPreloadedFile)) {
+    fprintf(stderr, "Could not load the animations.\n");
+    return 1;
+  }
+  load.Report();
+
+  std::unique_ptr<RigBenchmarker> benchmarker(
+      new RigBenchmarker(scenario, *table));
+  const int64_t steady_allocations = benchmarker->MeasureMemory();
+
+  HeapPhase teardown("teardown");
+  benchmarker.reset();
+  table.reset();
+  teardown.Report();
+
+  if (steady_allocations != 0) {
+    fprintf(stderr, "Steady playback made %lld heap allocations.\n",
+            static_cast<long long>(steady_allocations));
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  Scenario scenario;
+  AnimTable::ListFileNames anim_files;
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "--", 2) != 0) {
+      anim_files.push_back(argv[i]);
+      continue;
+    }
+    const char* key = argv[i] + 2;
+    if (i + 1 >= argc || !SetOption(key, argv[++i], &scenario)) {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+  }
+  if (anim_files.empty() || scenario.num_rigs <= 0 ||
+      scenario.num_frames <= 0 || scenario.layers < 1 ||
+      scenario.layers > kMaxLayers) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  if (scenario.memory_mode) return MeasureMemory(scenario, anim_files);
+
+  AnimTable table;
+  if (!table.InitFromAnimFileNames(anim_files, LoadFile)) {
+    fprintf(stderr, "Could not load the animations.\n");
+    return 1;
+  }
+
+  RigBenchmarker benchmarker(scenario, table);
+  benchmarker.Run();
+  return 0;
+}
@@ -11,12 +11,16 @@
 // WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 // See the License for the specific language governing permissions and
 // limitations under the License.
+#include <string.h>
+#include <algorithm>
 #include <map>
 
+#include "anim_bundle_generated.h"
 #include "anim_generated.h"
 #include "anim_table_generated.h"
 #include "motive/anim_table.h"
 #include "motive/io/flatbuffers.h"
+#include "motive/rig_init.h"
 
 namespace motive {
 
@@ -29,6 +33,9 @@ class TableDescriberInterface {
   virtual int NumAnims(int object) const = 0;
   virtual const char* SourceFileName(int object, int anim_idx) const = 0;
   virtual const RigAnimFb* SourceRigAnimFb(int object, int anim_idx) const = 0;
+  virtual int SourceBundleAnim(int /*object*/, int /*anim_idx*/) const {
+    return -1;
+  }
 };
 
 static int AnimListLen(const AnimListFb* list) {
@@ -162,53 +169,384 @@ class ListFileNamesDescriber : public TableDescriberInterface {
   const AnimTable::ListFileNames* list_names_;
 };
 
+const AnimTable::AnimHandle AnimTable::kInvalidAnimHandle;
+
+AnimTable::AnimTable()
+    : num_unique_anims_(0),
+      shared_spline_bytes_(0),
+      load_fn_(nullptr),
+      buffer_load_fn_(nullptr),
+      bundle_(nullptr),
+      reference_bundle_(false),
+      trust_files_(false),
+      anims_remaining_(0),
+      load_success_(true),
+      task_scheduler_(nullptr),
+      async_in_flight_(false),
+      async_group_(0),
+      residency_budget_(0),
+      resident_bytes_(0) {}
+
 AnimTable::~AnimTable() {
+  WaitForLoad();
   for (size_t i = 0; i < anims_.size(); ++i) {
     delete anims_[i];
     anims_[i] = nullptr;
   }
+  for (auto it = retired_anims_.begin(); it != retired_anims_.end(); ++it) {
+    delete *it;
+  }
+
+  // The anims may have referenced the buffers, so release them afterwards.
+  for (auto it = buffers_.begin(); it != buffers_.end(); ++it) {
+    if (it->release != nullptr) it->release(it->data, it->size, it->context);
+  }
 }
 
 bool AnimTable::InitFromFlatBuffers(const AnimTableFb& table_fb,
                                     LoadFn* load_fn) {
   AnimTableFbDescriber describer(table_fb);
-  return Load(&describer, load_fn);
+  return Load(&describer, load_fn, nullptr);
 }
 
 bool AnimTable::InitFromFlatBuffers(const AnimListFb& list_fb,
                                     LoadFn* load_fn) {
   AnimListFbDescriber describer(list_fb);
-  return Load(&describer, load_fn);
+  return Load(&describer, load_fn, nullptr);
 }
 
 bool AnimTable::InitFromAnimFileNames(const TableFileNames& table_names,
                                       LoadFn* load_fn) {
   TableFileNamesDescriber describer(table_names);
-  return Load(&describer, load_fn);
+  return Load(&describer, load_fn, nullptr);
 }
 
 bool AnimTable::InitFromAnimFileNames(const ListFileNames& list_names,
                                       LoadFn* load_fn) {
   ListFileNamesDescriber describer(list_names);
-  return Load(&describer, load_fn);
+  return Load(&describer, load_fn, nullptr);
 }
 
-bool AnimTable::Load(TableDescriberInterface* describer, LoadFn* load_fn) {
-  std::string scratch_buf;
-  bool success = true;
+bool AnimTable::InitFromFlatBuffersInPlace(const AnimTableFb& table_fb,
+                                           BufferLoadFn* load_fn) {
+  AnimTableFbDescriber describer(table_fb);
+  return Load(&describer, nullptr, load_fn);
+}
+
+bool AnimTable::InitFromFlatBuffersInPlace(const AnimListFb& list_fb,
+                                           BufferLoadFn* load_fn) {
+  AnimListFbDescriber describer(list_fb);
+  return Load(&describer, nullptr, load_fn);
+}
+
+bool AnimTable::InitFromAnimFileNamesInPlace(const TableFileNames& table_names,
+                                             BufferLoadFn* load_fn) {
+  TableFileNamesDescriber describer(table_names);
+  return Load(&describer, nullptr, load_fn);
+}
+
+bool AnimTable::InitFromAnimFileNamesInPlace(const ListFileNames& list_names,
+                                             BufferLoadFn* load_fn) {
+  ListFileNamesDescriber describer(list_names);
+  return Load(&describer, nullptr, load_fn);
+}
+
+void AnimTable::InitFromFlatBuffersAsync(const AnimTableFb& table_fb,
+                                         LoadFn* load_fn,
+                                         const LoadCallback& callback) {
+  AnimTableFbDescriber describer(table_fb);
+  LoadAsync(&describer, load_fn, callback);
+}
+
+void AnimTable::InitFromFlatBuffersAsync(const AnimListFb& list_fb,
+                                         LoadFn* load_fn,
+                                         const LoadCallback& callback) {
+  AnimListFbDescriber describer(list_fb);
+  LoadAsync(&describer, load_fn, callback);
+}
+
+void AnimTable::InitFromAnimFileNamesAsync(const TableFileNames& table_names,
+                                           LoadFn* load_fn,
+                                           const LoadCallback& callback) {
+  TableFileNamesDescriber describer(table_names);
+  LoadAsync(&describer, load_fn, callback);
+}
+
+void AnimTable::InitFromAnimFileNamesAsync(const ListFileNames& list_names,
+                                           LoadFn* load_fn,
+                                           const LoadCallback& callback) {
+  ListFileNamesDescriber describer(list_names);
+  LoadAsync(&describer, load_fn, callback);
+}
+
+bool AnimTable::Load(TableDescriberInterface* describer, LoadFn* load_fn,
+                     BufferLoadFn* buffer_load_fn) {
+  WaitForLoad();
+  PlanLoad(describer, load_fn, buffer_load_fn, LoadCallback());
+  if (residency_budget_ == 0) {
+    LoadPendingAnims();
+  } else {
+    LoadResidentAnims();
+  }
+  pending_.clear();
+  return load_success_;
+}
+
+// Marks an empty slot in AnimBundleListFb.anims.
+static const uint16_t kInvalidBundleAnim = 0xFFFF;
+
+class AnimBundleFbDescriber : public TableDescriberInterface {
+ public:
+  explicit AnimBundleFbDescriber(const AnimBundleFb& bundle)
+      : bundle_(&bundle) {}
+  virtual int NumObjects() const {
+    return static_cast<int>(flatbuffers::VectorLength(bundle_->objects()));
+  }
+  virtual int NumAnims(int object) const {
+    return static_cast<int>(flatbuffers::VectorLength(List(object)->anims()));
+  }
+  virtual const char* SourceFileName(int object, int anim_idx) const {
+    const int bundle_anim = SourceBundleAnim(object, anim_idx);
+    if (bundle_anim < 0) return nullptr;
+    const uint32_t name = bundle_->anims()->Get(bundle_anim)->name();
+    return bundle_->strings()->Get(name)->c_str();
+  }
+  virtual const RigAnimFb* SourceRigAnimFb(int /*object*/,
+                                           int /*anim_idx*/) const {
+    return nullptr;
+  }
+  virtual int SourceBundleAnim(int object, int anim_idx) const {
+    const uint16_t bundle_anim = List(object)->anims()->Get(anim_idx);
+    return bundle_anim == kInvalidBundleAnim ? -1 : bundle_anim;
+  }
+
+ protected:
+  const AnimBundleListFb* List(int object) const {
+    return bundle_->objects()->Get(object);
+  }
+
+  const AnimBundleFb* bundle_;
+};
+
+bool AnimTable::InitFromBundle(const AnimBundleFb& bundle) {
+  AnimBundleFbDescriber describer(bundle);
+  bundle_ = &bundle;
+  reference_bundle_ = false;
+  const bool success = Load(&describer, nullptr, nullptr);
+  bundle_ = nullptr;
+  return success;
+}
+
+bool AnimTable::InitFromBundleInPlace(const AnimBuffer& buffer) {
+  // Keep the buffer, even if it's rejected, so that it's released as usual.
+  {
+    std::lock_guard<std::mutex> lock(load_mutex_);
+    buffers_.push_back(buffer);
+  }
+  const bool valid =
+      trust_files_ ? CheckAnimBundleChecksum(buffer.data, buffer.size)
+                   : VerifyAnimBundleFlatBuffer(buffer.data, buffer.size);
+  if (!valid) return false;
+
+  const AnimBundleFb& bundle = *GetAnimBundleFb(buffer.data);
+  AnimBundleFbDescriber describer(bundle);
+  bundle_ = &bundle;
+  reference_bundle_ = true;
+  const bool success = Load(&describer, nullptr, nullptr);
+  bundle_ = nullptr;
+  return success;
+}
+
+const RigAnim* AnimTable::ReloadAnim(const char* anim_name, LoadFn* load_fn,
+                                     const RigAnim** old_anim) {
+  assert(residency_budget_ == 0);
+  WaitForLoad();
+  auto map_entry = name_map_.find(anim_name);
+  if (map_entry == name_map_.end()) return nullptr;
+  const AnimIndex idx = map_entry->second;
+
+  load_fn_ = load_fn;
+  buffer_load_fn_ = nullptr;
+  RigAnim* anim = LoadAnim(anim_name, nullptr, -1);
+  if (anim == nullptr) return nullptr;
+
+  // Rigs of every object that uses the animation must be able to play it.
+  bool matches = true;
+  for (size_t object = 0; object < indices_.size() && matches; ++object) {
+    const AnimList& list = indices_[object];
+    if (std::find(list.begin(), list.end(), idx) == list.end()) continue;
+    const RigAnim& defining_anim = defining_anims_[object];
+    matches = defining_anim.NumBones() <= 1 || anim->NumBones() == 1 ||
+              RigInit::MatchesHierarchy(*anim, defining_anim);
+  }
+
+  // The new animation's splines are already in `spline_pool_`, so it's
+  // retired along with the old one, rather than freed.
+  RigAnim* replaced = matches ? anims_[idx] : anim;
+  if (matches) anims_[idx] = anim;
+  if (replaced != nullptr) {
+    retired_anims_.push_back(replaced);
+    num_unique_anims_--;
+  }
+  if (old_anim != nullptr) *old_anim = matches ? replaced : nullptr;
+  return matches ? anim : nullptr;
+}
+
+void AnimTable::LoadResidentAnims() {
+  // Only reloadable files may be evicted. Embedded animations are loaded now
+  // and pinned forever.
+  assert(buffer_load_fn_ == nullptr);
+  residency_.resize(anims_.size());
+  lazy_names_.resize(anims_.size());
+  for (auto it = pending_.begin(); it != pending_.end(); ++it) {
+    if (it->embedded_fb == nullptr && it->bundle_anim < 0) {
+      lazy_names_[it->index] = it->name;
+      continue;
+    }
+    RigAnim* anim =
+        LoadAnim(it->name.c_str(), it->embedded_fb, it->bundle_anim);
+    anims_[it->index] = anim;
+    residency_[it->index].pins = 1;
+    residency_[it->index].bytes = AnimBytes(anim);
+    resident_bytes_ += residency_[it->index].bytes;
+  }
+
+  // Defining anims need every animation of the object, so bring in one object
+  // at a time, and let the rest be evicted down to the budget afterwards.
+  for (int object = 0; object < NumObjects(); ++object) {
+    if (IsObjectLoaded(object)) continue;
+    const int num_anims = NumAnims(object);
+    for (int anim_idx = 0; anim_idx < num_anims; ++anim_idx) {
+      if (CalculateIndex(object, anim_idx) == kInvalidAnimIndex) continue;
+      if (Acquire(object, anim_idx) == nullptr) load_success_ = false;
+    }
+    FinishObject(object);
+    for (int anim_idx = 0; anim_idx < num_anims; ++anim_idx) {
+      Release(object, anim_idx);
+    }
+  }
+}
+
+const RigAnim* AnimTable::Acquire(int object, int anim_idx) {
+  const AnimIndex idx = CalculateIndex(object, anim_idx);
+  if (idx == kInvalidAnimIndex || residency_budget_ == 0 ||
+      idx >= residency_.size()) {
+    return idx == kInvalidAnimIndex ? nullptr : anims_[idx];
+  }
+
+  Residency& residency = residency_[idx];
+  if (anims_[idx] == nullptr) {
+    // Files that fail to load are not retried.
+    if (lazy_names_[idx].empty()) return nullptr;
+    RigAnim* anim = LoadAnim(lazy_names_[idx].c_str(), nullptr, -1);
+    if (anim == nullptr) {
+      lazy_names_[idx].clear();
+      return nullptr;
+    }
+    anims_[idx] = anim;
+    residency.bytes = AnimBytes(anim);
+    resident_bytes_ += residency.bytes;
+  } else if (residency.pins == 0) {
+    lru_.erase(residency.lru);
+  }
+  residency.pins++;
+
+  // The new animation is pinned, so it's the others that make room for it.
+  EvictToBudget();
+  return anims_[idx];
+}
+
+void AnimTable::Release(int object, int anim_idx) {
+  const AnimIndex idx = CalculateIndex(object, anim_idx);
+  if (idx == kInvalidAnimIndex || idx >= residency_.size() ||
+      anims_[idx] == nullptr) {
+    return;
+  }
+
+  Residency& residency = residency_[idx];
+  assert(residency.pins > 0);
+  if (--residency.pins > 0) return;
+
+  // Most recently used animations are at the back.
+  residency.lru = lru_.insert(lru_.end(), idx);
+  EvictToBudget();
+}
+
+size_t AnimTable::AnimBytes(const RigAnim* anim) {
+  if (anim == nullptr) return 0;
+  MemoryStats stats;
+  stats.live_bytes += sizeof(RigAnim);
+  anim->AddMemoryStats(&stats);
+  return stats.TotalBytes();
+}
+
+void AnimTable::EvictToBudget() {
+  while (resident_bytes_ > residency_budget_ && !lru_.empty()) {
+    const AnimIndex idx = lru_.front();
+    lru_.pop_front();
+    delete anims_[idx];
+    anims_[idx] = nullptr;
+    resident_bytes_ -= residency_[idx].bytes;
+    residency_[idx].bytes = 0;
+    num_unique_anims_--;
+  }
+}
+
+void AnimTable::LoadAsync(TableDescriberInterface* describer, LoadFn* load_fn,
+                          const LoadCallback& callback) {
+  assert(residency_budget_ == 0);
+  WaitForLoad();
+  PlanLoad(describer, load_fn, nullptr, callback);
+  if (pending_.empty()) return;
+
+  // The describer only lives until we return, but PlanLoad() has copied out
+  // everything that the background load needs.
+  async_in_flight_ = true;
+  if (task_scheduler_ != nullptr) {
+    async_group_ = task_scheduler_->BeginGroup();
+    task_scheduler_->Submit(async_group_, [this]() { LoadPendingAnims(); });
+  } else {
+    async_thread_ = std::thread([this]() { LoadPendingAnims(); });
+  }
+}
+
+bool AnimTable::WaitForLoad() {
+  if (async_in_flight_) {
+    if (async_thread_.joinable()) {
+      async_thread_.join();
+    } else {
+      task_scheduler_->Wait(async_group_);
+    }
+    async_in_flight_ = false;
+    pending_.clear();
+  }
+  return load_success_;
+}
+
+void AnimTable::PlanLoad(TableDescriberInterface* describer, LoadFn* load_fn,
+                         BufferLoadFn* buffer_load_fn,
+                         const LoadCallback& callback) {
+  assert(pending_.empty());
+  load_fn_ = load_fn;
+  buffer_load_fn_ = buffer_load_fn;
+  load_callback_ = callback;
+  load_success_ = true;
 
   // An AnimTable is a list-of-lists. The outside list is indexed by object.
   // Loop through each object (e.g. character type).
   const int num_objects = describer->NumObjects();
   indices_.resize(num_objects);
   defining_anims_.resize(num_objects);
+  object_pending_.reset(new std::atomic<int>[num_objects]);
+  const size_t first_pending_index = anims_.size();
   for (int object = 0; object < num_objects; ++object) {
     const int num_anims = describer->NumAnims(object);
     indices_[object].resize(num_anims);
+    int num_pending = 0;
 
     // The inside list is animations for the given object.
-    // Loop through all animations, loading animations or referencing animations
-    // that have already been loaded.
+    // Loop through all animations, planning to load animations or referencing
+    // animations that have already been loaded or planned.
     AnimList& list = indices_[object];
     for (int anim_idx = 0; anim_idx < num_anims; ++anim_idx) {
       // Initialize this anim_idx to point to no data.
@@ -222,41 +560,303 @@ bool AnimTable::Load(TableDescriberInterface* describer, LoadFn* load_fn) {
       // Case 1: source data is empty.
       if (anim_name == nullptr || anim_name[0] == '\0') continue;
 
-      // Case 2: source data has already been processed.
+      // Case 2: source data has already been processed, or will be by an
+      // earlier entry of this load.
+      AnimIndex idx = kInvalidAnimIndex;
       auto existing = name_map_.find(anim_name);
       if (existing != name_map_.end()) {
-        list[anim_idx] = existing->second;
-        continue;
+        idx = existing->second;
+      } else {
+        // Case 3: plan to load source data. Insert index into name map so
+        // that we only load this anim once.
+        idx = static_cast<AnimIndex>(anims_.size());
+        anims_.push_back(nullptr);
+        name_map_.insert(NameToIndex(anim_name, idx));
+
+        PendingAnim pending;
+        pending.name = anim_name;
+        pending.embedded_fb = anim_fb;
+        pending.bundle_anim = describer->SourceBundleAnim(object, anim_idx);
+        pending.index = idx;
+        pending_.push_back(pending);
+      }
+      list[anim_idx] = idx;
+
+      // Count each animation that is still to be decoded once per object.
+      // Planned animations are appended to `anims_` in the order of
+      // `pending_`.
+      if (idx < first_pending_index) continue;
+      std::vector<int>& objects = pending_[idx - first_pending_index].objects;
+      if (objects.empty() || objects.back() != object) {
+        objects.push_back(object);
+        num_pending++;
       }
+    }
+
+    // The extra count is dropped by FinishObject(), once the defining anim
+    // has been calculated.
+    object_pending_[object].store(num_pending + 1);
+    if (num_pending == 0) FinishObject(object);
+  }
+  anims_remaining_ = static_cast<int>(pending_.size());
 
-      // Case 3: load source data.
-      if (anim_fb == nullptr) {
-        const char* anim_buf = load_fn(anim_name, &scratch_buf);
-        anim_fb = anim_buf == nullptr ? nullptr : GetRigAnimFb(anim_buf);
+  // Every name is known now, so FindAnim() works while animations load.
+  BuildNameHash();
+  if (pending_.empty() && load_callback_) load_callback_(true);
+}
+
+static size_t PowerOfTwoAtLeast(size_t n) {
+  size_t power = 1;
+  while (power < n) power *= 2;
+  return power;
+}
+
+void AnimTable::BuildNameHash() {
+  std::vector<NameSlot> names;
+  names.reserve(name_map_.size());
+  for (auto it = name_map_.begin(); it != name_map_.end(); ++it) {
+    NameSlot name;
+    name.hash = AnimName(it->first.c_str()).hash();
+    name.index = it->second;
+    names.push_back(name);
+  }
+
+  // Distinct names with the same 64-bit hash can't be told apart without a
+  // string compare, so leave all of them out. FindAnim() then misses them,
+  // instead of returning the wrong animation.
+  std::sort(names.begin(), names.end(),
+            [](const NameSlot& a, const NameSlot& b) {
+              return a.hash < b.hash;
+            });
+  size_t num_unique = 0;
+  for (size_t i = 0; i < names.size();) {
+    size_t end = i + 1;
+    while (end < names.size() && names[end].hash == names[i].hash) ++end;
+    if (end == i + 1) names[num_unique++] = names[i];
+    i = end;
+  }
+  names.resize(num_unique);
+
+  // About four names per bucket keeps the seeds small. If some bucket finds
+  // no seed, there are too few free slots, so try again with more.
+  const size_t num_buckets = PowerOfTwoAtLeast((names.size() + 3) / 4);
+  size_t num_slots = PowerOfTwoAtLeast(names.size());
+  while (!BuildNameHash(names, num_buckets, num_slots)) {
+    num_slots *= 2;
+  }
+}
+
+bool AnimTable::BuildNameHash(const std::vector<NameSlot>& names,
+                              size_t num_buckets, size_t num_slots) {
+  static const uint32_t kMaxSeed = 1 << 12;
+  name_seeds_.assign(num_buckets, 0);
+  name_slots_.assign(num_slots, NameSlot());
+  if (names.empty()) {
+    name_slots_.clear();
+    return true;
+  }
 
-        // Error loading file. Keep loading but return false.
-        if (anim_fb == nullptr) {
-          success = false;
-          continue;
+  // Place the fullest buckets first, while there are many free slots.
+  std::vector<std::vector<const NameSlot*>> buckets(num_buckets);
+  for (auto it = names.begin(); it != names.end(); ++it) {
+    buckets[it->hash & (num_buckets - 1)].push_back(&*it);
+  }
+  std::vector<size_t> order(num_buckets);
+  for (size_t i = 0; i < num_buckets; ++i) order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&buckets](size_t a, size_t b) {
+    return buckets[a].size() > buckets[b].size();
+  });
+
+  std::vector<size_t> slots;
+  for (auto b = order.begin(); b != order.end() && !buckets[*b].empty(); ++b) {
+    const std::vector<const NameSlot*>& bucket = buckets[*b];
+    uint32_t seed = 0;
+    for (; seed < kMaxSeed; ++seed) {
+      slots.clear();
+      for (auto it = bucket.begin(); it != bucket.end(); ++it) {
+        const size_t slot = NameSlotIndex((*it)->hash, seed, num_slots);
+        if (name_slots_[slot].index != kInvalidAnimIndex ||
+            std::find(slots.begin(), slots.end(), slot) != slots.end()) {
+          break;
         }
+        slots.push_back(slot);
       }
+      if (slots.size() == bucket.size()) break;
+    }
+    if (seed == kMaxSeed) return false;
+
+    name_seeds_[*b] = seed;
+    for (size_t i = 0; i < bucket.size(); ++i) {
+      name_slots_[slots[i]] = *bucket[i];
+    }
+  }
+  return true;
+}
 
-      // Create RigAnim from FlatBuffer.
-      const AnimIndex new_idx = static_cast<AnimIndex>(anims_.size());
-      RigAnim* anim = new RigAnim();
-      RigAnimFromFlatBuffers(*anim_fb, anim);
-      anims_.push_back(anim);
+void AnimTable::LoadPendingAnims() {
+  const int count = static_cast<int>(pending_.size());
+  const MotiveRangeTask load_range = [this](int begin, int end) {
+    for (int i = begin; i < end; ++i) LoadPendingAnim(i);
+  };
+  if (task_scheduler_ != nullptr) {
+    task_scheduler_->ParallelFor(count, 1, load_range);
+  } else {
+    load_range(0, count);
+  }
+}
 
-      // Insert index into name map so that we only load this anim once.
-      name_map_.insert(NameToIndex(anim_name, new_idx));
-      list[anim_idx] = new_idx;
+RigAnim* AnimTable::LoadAnim(const char* anim_name, const RigAnimFb* anim_fb,
+                             int bundle_anim) {
+  // Bundles hold already-decoded animations.
+  if (bundle_anim >= 0) {
+    RigAnim* anim = new RigAnim();
+    if (!RigAnimFromFlatBuffers(*bundle_, bundle_anim, anim,
+                                reference_bundle_)) {
+      delete anim;
+      return nullptr;
     }
+    std::lock_guard<std::mutex> lock(load_mutex_);
+    if (residency_budget_ == 0) ShareSplines(anim);
+    num_unique_anims_++;
+    return anim;
   }
 
+  // Load source data. Data in a buffer that we keep can be referenced
+  // directly instead of copied.
+  std::string scratch_buf;
+  bool reference_buf = false;
+  if (anim_fb == nullptr) {
+    const char* anim_buf = nullptr;
+    size_t anim_size = 0;
+    if (buffer_load_fn_ != nullptr) {
+      AnimBuffer buffer;
+      if (buffer_load_fn_(anim_name, &buffer) && buffer.data != nullptr) {
+        std::lock_guard<std::mutex> lock(load_mutex_);
+        buffers_.push_back(buffer);
+        anim_buf = buffer.data;
+        anim_size = buffer.size;
+        reference_buf = true;
+      }
+    } else {
+      anim_buf = load_fn_(anim_name, &scratch_buf);
+      if (anim_buf != nullptr && anim_buf == scratch_buf.c_str()) {
+        anim_size = scratch_buf.size();
+      }
+    }
+
+    // Reject malformed files, unless they're trusted or of unknown size.
+    if (anim_buf != nullptr && !trust_files_ && anim_size != 0 &&
+        !VerifyRigAnimFlatBuffer(anim_buf, anim_size)) {
+      anim_buf = nullptr;
+    }
+    anim_fb = anim_buf == nullptr ? nullptr : GetRigAnimFb(anim_buf);
+  }
+
+  if (anim_fb == nullptr) return nullptr;
+
+  // Create RigAnim from FlatBuffer. Evicted animations would free splines
+  // that other animations point at, so only share when nothing is evicted.
+  // Unshared animations are decoded into one block, which is quicker to
+  // load and to evict.
+  RigAnim* anim = new RigAnim();
+  const bool decoded =
+      residency_budget_ == 0
+          ? RigAnimFromFlatBuffers(*anim_fb, anim, reference_buf)
+          : RigAnimFromFlatBuffersContiguous(*anim_fb, anim, reference_buf);
+  if (!decoded) {
+    delete anim;
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> lock(load_mutex_);
+  if (residency_budget_ == 0) ShareSplines(anim);
+  num_unique_anims_++;
+  return anim;
+}
+
+void AnimTable::LoadPendingAnim(size_t pending_idx) {
+  const PendingAnim& pending = pending_[pending_idx];
+  RigAnim* anim =
+      LoadAnim(pending.name.c_str(), pending.embedded_fb, pending.bundle_anim);
+  if (anim != nullptr) {
+    anims_[pending.index] = anim;
+  } else {
+    // Error loading file. Keep loading but return false.
+    load_success_ = false;
+  }
+
+  // The last animation of an object to be decoded completes the object.
+  for (auto it = pending.objects.begin(); it != pending.objects.end(); ++it) {
+    if (object_pending_[*it].fetch_sub(1, std::memory_order_acq_rel) == 2) {
+      FinishObject(*it);
+    }
+  }
+
+  if (anims_remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1 &&
+      load_callback_) {
+    load_callback_(load_success_);
+  }
+}
+
+void AnimTable::FinishObject(int object) {
   // Now that all animations have been loaded, calculate defining animation,
   // which is the union of all the animations on an object.
-  CalculateDefiningAnims();
-  return success;
+  CalculateDefiningAnim(object);
+  object_pending_[object].store(0, std::memory_order_release);
+}
+
+// Hash everything that affects the curve of `s`.
+static size_t SplineHash(const CompactSpline& s) {
+  // FNV-1a, over the y-range, x-granularity, and quantized nodes.
+  uint32_t hash = 2166136261u;
+  const float header[] = {s.y_range().start(), s.y_range().end(),
+                          s.x_granularity()};
+  const uint8_t* bytes[] = {reinterpret_cast<const uint8_t*>(header),
+                            reinterpret_cast<const uint8_t*>(s.nodes())};
+  const size_t sizes[] = {sizeof(header),
+                          s.num_nodes() * sizeof(s.nodes()[0])};
+  for (size_t i = 0; i < MOTIVE_ARRAY_SIZE(bytes); ++i) {
+    for (size_t j = 0; j < sizes[i]; ++j) {
+      hash = (hash ^ bytes[i][j]) * 16777619u;
+    }
+  }
+  return hash;
+}
+
+static bool SplinesEqual(const CompactSpline& a, const CompactSpline& b) {
+  return a.y_range().start() == b.y_range().start() &&
+         a.y_range().end() == b.y_range().end() &&
+         a.x_granularity() == b.x_granularity() &&
+         a.num_nodes() == b.num_nodes() &&
+         memcmp(a.nodes(), b.nodes(), a.num_nodes() * sizeof(a.nodes()[0])) ==
+             0;
+}
+
+void AnimTable::ShareSplines(RigAnim* anim) {
+  for (BoneIndex j = 0; j < anim->NumBones(); ++j) {
+    MatrixAnim& matrix_anim = anim->Anim(j);
+    const std::vector<MatrixOperationInit>& ops = matrix_anim.ops();
+    for (size_t i = 0; i < ops.size(); ++i) {
+      if (ops[i].union_type != MatrixOperationInit::kUnionSpline) continue;
+      const CompactSpline* spline = ops[i].spline;
+
+      // Use the spline already in the pool, if there's an identical one.
+      const size_t hash = SplineHash(*spline);
+      const CompactSpline* shared = nullptr;
+      const auto candidates = spline_pool_.equal_range(hash);
+      for (auto it = candidates.first; it != candidates.second; ++it) {
+        if (it->second == spline || SplinesEqual(*it->second, *spline)) {
+          shared = it->second;
+          break;
+        }
+      }
+
+      if (shared == nullptr) {
+        spline_pool_.insert(std::make_pair(hash, spline));
+      } else if (shared != spline) {
+        shared_spline_bytes_ += matrix_anim.ShareSpline(spline, shared);
+      }
+    }
+  }
 }
 
 static const RigAnim* FindCompleteRig(const RigAnim** anims, size_t num_anims) {
@@ -350,32 +950,66 @@ static void CreateDefiningAnim(const RigAnim** anims, size_t num_anims,
   }
 }
 
-size_t AnimTable::MaxAnimIndex() const {
-  size_t max_anim_idx = 0;
-  for (size_t i = 0; i < indices_.size(); ++i) {
-    max_anim_idx = std::max(max_anim_idx, indices_[i].size());
+MemoryStats AnimTable::GetMemoryStats() const {
+  MemoryStats stats;
+  for (auto it = anims_.begin(); it != anims_.end(); ++it) {
+    if (*it == nullptr) continue;
+    stats.live_bytes += sizeof(RigAnim);
+    (*it)->AddMemoryStats(&stats);
+  }
+  for (auto it = retired_anims_.begin(); it != retired_anims_.end(); ++it) {
+    stats.live_bytes += sizeof(RigAnim);
+    (*it)->AddMemoryStats(&stats);
+  }
+  stats.AddVector(anims_);
+  stats.AddVector(retired_anims_);
+  stats.AddVector(buffers_);
+  stats.AddVector(pending_);
+  stats.AddVector(residency_);
+  stats.AddVector(lazy_names_);
+  for (auto it = lazy_names_.begin(); it != lazy_names_.end(); ++it) {
+    stats.live_bytes += it->capacity();
+  }
+  stats.live_bytes += lru_.size() * (sizeof(AnimIndex) + 2 * sizeof(void*));
+  stats.AddVector(defining_anims_);
+  for (auto it = defining_anims_.begin(); it != defining_anims_.end(); ++it) {
+    it->AddMemoryStats(&stats);
+  }
+  stats.AddVector(indices_);
+  for (auto it = indices_.begin(); it != indices_.end(); ++it) {
+    stats.AddVector(*it);
+  }
+
+  // Estimate the hash maps as one node, holding the entry and a next
+  // pointer, per entry, plus one pointer per bucket.
+  for (auto it = name_map_.begin(); it != name_map_.end(); ++it) {
+    stats.live_bytes += sizeof(*it) + sizeof(void*) + it->first.capacity();
   }
-  return max_anim_idx;
+  stats.live_bytes += name_map_.bucket_count() * sizeof(void*);
+  stats.AddVector(name_seeds_);
+  stats.AddVector(name_slots_);
+  stats.live_bytes +=
+      spline_pool_.size() * (sizeof(*spline_pool_.begin()) + sizeof(void*)) +
+      spline_pool_.bucket_count() * sizeof(void*);
+  return stats;
 }
 
 size_t AnimTable::GatherObjectAnims(int object, const RigAnim** anims) const {
   const AnimList& list = indices_[object];
   size_t num_anims = 0;
   for (size_t j = 0; j < list.size(); ++j) {
-    if (list[j] == kInvalidAnimIndex) continue;
+    if (list[j] == kInvalidAnimIndex || anims_[list[j]] == nullptr) continue;
     anims[num_anims++] = anims_[list[j]];
   }
   return num_anims;
 }
 
-void AnimTable::CalculateDefiningAnims() {
-  std::vector<const RigAnim*> anims(MaxAnimIndex());
-  for (int object = 0; object < NumObjects(); ++object) {
-    const size_t num_anims = GatherObjectAnims(object, &anims[0]);
-    if (num_anims == 0) continue;
+void AnimTable::CalculateDefiningAnim(int object) {
+  std::vector<const RigAnim*> anims(indices_[object].size());
+  const size_t num_anims = GatherObjectAnims(object, anims.data());
+  if (num_anims == 0) return;
 
-    CreateDefiningAnim(&anims[0], num_anims, &defining_anims_[object]);
-  }
+  CreateDefiningAnim(anims.data(), num_anims, &defining_anims_[object]);
 }
 
 }  // namespace motive
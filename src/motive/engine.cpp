@@ -12,76 +12,775 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <assert.h>
+#include <algorithm>
+#include <functional>
+#include <thread>
+
 #include "motive/engine.h"
+#include "motive/math/transform_kernels.h"
+#include "motive/motivator.h"
 #include "motive/processor.h"
+#include "motive/rig_init.h"
+#include "motive/rig_motivator.h"
+#include "motive/rig_processor.h"
+#include "motive/util/trace.h"
+#include "motive/vector_processor.h"
 #include "motive/version.h"
 #include "motive/util/benchmark.h"
 
 namespace motive {
 
 // static
-MotiveEngine::FunctionMap MotiveEngine::function_map_;
+MotiveEngine::FunctionArray MotiveEngine::factories_;
 
 // static
 void MotiveEngine::RegisterProcessorFactory(
-    MotivatorType type, const MotiveProcessorFunctions& fns) {
-  function_map_.insert(FunctionPair(type, fns));
+    MotivatorTypeInfo* type, const MotiveProcessorFunctions& fns) {
+  // Registering again keeps the first factory, as before ids were assigned.
+  if (type->id != kMotivatorTypeIdInvalid) return;
+  type->id = static_cast<int>(factories_.size());
+  factories_.push_back(fns);
 }
 
 // Prevent the version string from being stripped from the binary by keeping
 // a reference to it here.
-MotiveEngine::MotiveEngine() : version_(&Version()) {}
+MotiveEngine::MotiveEngine()
+    : num_threads_(1),
+      task_scheduler_(nullptr),
+      optimization_(BestProcessorOptimization()),
+      transform_kernels_(TransformKernelsFor(optimization_)),
+      allocator_(nullptr),
+      recorder_(nullptr),
+      frame_count_(0),
+      fixed_time_step_(0),
+      fixed_time_remainder_(0),
+      auto_trim_frames_(0),
+      double_buffered_(false),
+      async_in_flight_(false),
+      async_group_(0),
+      order_dirty_(false),
+      version_(&Version()) {
+  // The first frame counts only the work done since this engine was created.
+  ReadMotiveCounters(&counters_at_last_frame_);
+}
 
 void MotiveEngine::Reset() {
-  for (ProcessorMap::iterator it = mapped_processors_.begin();
-       it != mapped_processors_.end(); ++it) {
+  // Processors cannot be destroyed while they're advancing.
+  WaitForFrame();
+
+  // Release the transients through the table, so that their handles go
+  // stale.
+  transients_.DestroyIf([](const MotivatorNf&) { return true; });
+
+  for (size_t id = 0; id < processors_.size(); ++id) {
+    if (processors_[id] == nullptr) continue;
+
     // Get the factory for each processor. Factory must exist since it is what
     // created the processor in the first place.
-    const MotiveProcessorFunctions& fns = function_map_.find(it->first)->second;
+    const MotiveProcessorFunctions& fns = factories_[id];
 
     // Destroy each processor in turn.
-    fns.destroy(it->second);
-    it->second = nullptr;
+    fns.destroy(processors_[id]);
+    processors_[id] = nullptr;
+  }
+
+  // Remove all elements from the array. Their processors have all been
+  // destroyed.
+  processors_.clear();
+  sorted_processors_.clear();
+  static_processors_.clear();
+  dependency_counts_.clear();
+  ordered_processors_.clear();
+  tier_ends_.clear();
+  late_dependencies_.clear();
+  order_dirty_ = false;
+  events_.clear();
+  frame_events_.clear();
+
+  // Queued commands refer to Motivators that have now been reset.
+  commands_.Drain(&drained_commands_);
+  drained_commands_.clear();
+}
+
+void MotiveEngine::GetMemoryStats(
+    std::map<MotivatorType, MemoryStats>* stats) const {
+  for (auto it = processors_.begin(); it != processors_.end(); ++it) {
+    if (*it == nullptr) continue;
+    MemoryStats processor_stats;
+    (*it)->AddMemoryStats(&processor_stats);
+    (*stats)[(*it)->Type()] = processor_stats;
   }
+}
+
+void MotiveEngine::Snapshot(MotiveSnapshot* snapshot) {
+  // Publishing the frame also defragments double-buffered processors.
+  WaitForFrame();
+  if (double_buffered_) UpdateFrontBuffers();
+
+  snapshot->Clear();
+  MotiveStateArchive archive(snapshot);
+  ArchiveProcessors(&archive);
+}
+
+bool MotiveEngine::Restore(const MotiveSnapshot& snapshot) {
+  WaitForFrame();
 
-  // Remove all elements from the map. Their processors have all been destroyed.
-  mapped_processors_.clear();
+  // Check every processor before changing any, so that a failed restore
+  // leaves the engine as it was.
+  MotiveStateArchive verify(MotiveStateArchive::kVerify, snapshot);
+  ArchiveProcessors(&verify);
+  if (!verify.ok() || !verify.AtEnd()) return false;
+
+  MotiveStateArchive restore(MotiveStateArchive::kRestore, snapshot);
+  ArchiveProcessors(&restore);
+  assert(restore.ok());
+  UpdateFrontBuffers();
+  return true;
 }
 
-MotiveProcessor* MotiveEngine::Processor(MotivatorType type) {
-  // If processor already exists, return it.
-  ProcessorMap::iterator it = mapped_processors_.find(type);
-  if (it != mapped_processors_.end()) return it->second;
+void MotiveEngine::ArchiveProcessors(MotiveStateArchive* archive) {
+  archive->LayoutValue(processors_.size());
+  for (ProcessorArray::iterator it = processors_.begin();
+       it != processors_.end() && archive->ok(); ++it) {
+    archive->LayoutValue(*it == nullptr ? kMotivatorTypeInvalid
+                                        : (*it)->Type());
+    if (*it != nullptr) (*it)->ArchiveState(archive);
+  }
+}
+
+bool MotiveEngine::Reserve(MotivatorType type, int count) {
+  MotiveProcessor* processor = Processor(type);
+  if (processor == nullptr) return false;
+  processor->Reserve(static_cast<MotiveIndex>(count));
+  return true;
+}
+
+void MotiveEngine::ReorderIndices() {
+  WaitForFrame();
+
+  // Parents advance after their children, so reorder them first, and rank
+  // the children in the order of their parents. Static processors never
+  // advance, and have no children.
+  if (order_dirty_) OrderProcessors();
+  std::vector<MotiveProcessor*> processors(ordered_processors_.rbegin(),
+                                           ordered_processors_.rend());
+  processors.insert(processors.end(), static_processors_.begin(),
+                    static_processors_.end());
+
+  MotiveProcessor::MotivatorRanks ranks;
+  std::vector<const Motivator*> children;
+  for (size_t i = 0; i < processors.size(); ++i) {
+    processors[i]->ReorderIndices(ranks);
+    children.clear();
+    processors[i]->AppendChildMotivators(&children);
+    for (size_t j = 0; j < children.size(); ++j) {
+      ranks.insert(std::make_pair(children[j], ranks.size()));
+    }
+  }
+}
+
+void MotiveEngine::Trim() {
+  WaitForFrame();
+  for (auto it = processors_.begin(); it != processors_.end(); ++it) {
+    if (*it != nullptr) (*it)->Trim();
+  }
+  events_.shrink_to_fit();
+  frame_events_.shrink_to_fit();
+}
+
+void MotiveEngine::SuspendMotivators(const Motivator* const* motivators,
+                                     size_t count) {
+  SetSuspended(motivators, count, true);
+}
+
+void MotiveEngine::ResumeMotivators(const Motivator* const* motivators,
+                                    size_t count) {
+  SetSuspended(motivators, count, false);
+}
+
+void MotiveEngine::SetSuspended(const Motivator* const* motivators,
+                                size_t count, bool suspended) {
+  WaitForFrame();
+
+  // Walk down from `motivators` to the splines at the bottom, so that a rig
+  // suspends its bones, and they suspend their splines.
+  std::vector<const Motivator*> pending(motivators, motivators + count);
+  while (!pending.empty()) {
+    const Motivator* motivator = pending.back();
+    pending.pop_back();
+    if (motivator == nullptr || !motivator->Valid()) continue;
+
+    MotiveProcessor* processor = motivator->processor_;
+    processor->SetSuspended(motivator->index_, suspended);
+    processor->AppendChildMotivatorsOf(motivator->index_, &pending);
+  }
+}
+
+bool MotiveEngine::SetDefragmentBudget(MotivatorType type, int max_moves,
+                                       int max_microseconds) {
+  MotiveProcessor* processor = Processor(type);
+  if (processor == nullptr) return false;
+  processor->SetDefragmentBudget(max_moves, max_microseconds);
+  return true;
+}
 
+int MotiveEngine::ReplaceRigAnim(const RigAnim& old_anim,
+                                 const RigAnim& new_anim,
+                                 MotiveTime blend_time) {
+  // Don't create a processor just to find that nothing plays `old_anim`.
+  MotiveProcessor* processor = FindProcessor(RigInit::kType);
+  if (processor == nullptr) return 0;
+  return static_cast<RigProcessor*>(processor)
+      ->ReplaceAnim(old_anim, new_anim, blend_time);
+}
+
+void MotiveEngine::set_allocator(MotiveAllocator* allocator) {
+  // Processors hold memory from the allocator they were created with.
+  assert(processors_.empty());
+  allocator_ = allocator;
+}
+
+void MotiveEngine::set_optimization(ProcessorOptimization optimization) {
+  // Processors read the kernels while they advance.
+  WaitForFrame();
+  optimization_ = optimization;
+  transform_kernels_ = TransformKernelsFor(optimization);
+}
+
+MotiveProcessor* MotiveEngine::CreateProcessor(MotivatorType type) {
   // Look up the processor-creation-function in the registry.
-  const auto function_pair = function_map_.find(type);
-  if (function_pair == function_map_.end()) return nullptr;
-  const MotiveProcessorFunctions& fns = function_pair->second;
+  if (type == kMotivatorTypeInvalid) return nullptr;
+  const int id = type->id;
+  if (id == kMotivatorTypeIdInvalid) return nullptr;
+  assert(0 <= id && id < static_cast<int>(factories_.size()));
+  const MotiveProcessorFunctions& fns = factories_[id];
 
   // Remember processor for next time. We only want at most one processor per
   // type in an engine
   ProcessorDetails details;
   details.processor = fns.create();
   details.processor->SetEngine(this);
+  details.processor->SetAllocator(allocator());
   details.processor->RegisterBenchmarks();
-  mapped_processors_.insert(ProcessorPair(type, details.processor));
-  sorted_processors_.insert(details);
+  details.processor->SetDoubleBuffered(double_buffered_);
+  details.processor->SetRecorder(recorder_);
+  if (id >= static_cast<int>(processors_.size())) {
+    processors_.resize(id + 1, nullptr);
+  }
+  processors_[id] = details.processor;
+
+  // Static processors have nothing to do in AdvanceFrame(), so don't pay for
+  // visiting them every frame.
+  if (details.processor->IsStatic()) {
+    static_processors_.push_back(details.processor);
+  } else {
+    sorted_processors_.insert(details);
+    order_dirty_ = true;
+  }
 
   return details.processor;
 }
 
+const MotiveProcessor* MotiveEngine::RegisterDependency(
+    MotiveProcessor* dependent, const Motivator& dependency) {
+  const MotiveProcessor* processor = dependency.Processor();
+  if (processor == nullptr) return nullptr;
+
+  // Only the first registration changes the graph.
+  int& count = dependency_counts_[Dependency(dependent, processor)];
+  if (count++ == 0) {
+    order_dirty_ = true;
+  }
+  return processor;
+}
+
+void MotiveEngine::UnregisterDependency(MotiveProcessor* dependent,
+                                        const MotiveProcessor* dependency) {
+  if (dependency == nullptr) return;
+
+  const DependencyCounts::iterator it =
+      dependency_counts_.find(Dependency(dependent, dependency));
+  assert(it != dependency_counts_.end() && it->second > 0);
+  if (--it->second == 0) {
+    dependency_counts_.erase(it);
+    order_dirty_ = true;
+  }
+}
+
+void MotiveEngine::OrderProcessors() {
+  // Processors waiting to be ordered, in priority order.
+  std::vector<MotiveProcessor*> pending;
+  for (ProcessorSet::iterator it = sorted_processors_.begin();
+       it != sorted_processors_.end(); ++it) {
+    pending.push_back(it->processor);
+  }
+  const auto depends_on = [this](MotiveProcessor* dependent,
+                                 const MotiveProcessor* dependency) {
+    return dependent != dependency &&
+           dependency_counts_.count(Dependency(dependent, dependency)) != 0;
+  };
+
+  // Take the first pending processor, in priority order, that doesn't depend
+  // on any other pending processor. Each goes in the tier after the last
+  // processor it must follow: any of lower priority, and any it depends on.
+  // When every pending processor waits on another, they're in a cycle, so
+  // break it at the one of lowest priority.
+  std::vector<MotiveProcessor*> order;
+  std::vector<size_t> tiers;
+  while (!pending.empty()) {
+    auto next = std::find_if(
+        pending.begin(), pending.end(), [&](MotiveProcessor* p) {
+          return std::none_of(
+              pending.begin(), pending.end(),
+              [&](MotiveProcessor* q) { return depends_on(p, q); });
+        });
+    if (next == pending.end()) next = pending.begin();
+    MotiveProcessor* p = *next;
+    pending.erase(next);
+
+    size_t tier = 0;
+    for (size_t i = 0; i < order.size(); ++i) {
+      if (order[i]->Priority() < p->Priority() || depends_on(p, order[i])) {
+        tier = std::max(tier, tiers[i] + 1);
+      }
+    }
+    order.push_back(p);
+    tiers.push_back(tier);
+  }
+
+  // Gather each tier together. Within a tier, keep the order chosen above.
+  ordered_processors_.clear();
+  tier_ends_.clear();
+  for (size_t tier = 0; ordered_processors_.size() < order.size(); ++tier) {
+    for (size_t i = 0; i < order.size(); ++i) {
+      if (tiers[i] == tier) ordered_processors_.push_back(order[i]);
+    }
+    if (tier_ends_.empty() || tier_ends_.back() < ordered_processors_.size()) {
+      tier_ends_.push_back(ordered_processors_.size());
+    }
+  }
+
+  // Dependencies broken to order a cycle are resolved after the main pass.
+  // Static processors never advance, so are never late.
+  late_dependencies_.clear();
+  for (auto it = dependency_counts_.begin(); it != dependency_counts_.end();
+       ++it) {
+    const Dependency& d = it->first;
+    const auto dependent = std::find(order.begin(), order.end(), d.first);
+    const auto dependency = std::find(order.begin(), order.end(), d.second);
+    if (dependent == order.end() || dependency == order.end()) continue;
+    if (tiers[dependency - order.begin()] >= tiers[dependent - order.begin()]) {
+      late_dependencies_.push_back(d);
+    }
+  }
+  order_dirty_ = false;
+}
+
+void MotiveEngine::UpdateLateDependencies() {
+  if (late_dependencies_.empty()) return;
+
+  // First pass: dependents of late processors recalculate the items that read
+  // the late processors.
+  changed_.clear();
+  for (auto it = late_dependencies_.begin(); it != late_dependencies_.end();
+       ++it) {
+    if (it->first->UpdateDependents(it->second)) {
+      changed_.push_back(it->first);
+    }
+  }
+
+  // Further passes: anything downstream of a recalculated processor has
+  // already advanced with its old outputs, so let it catch up too. Each pass
+  // only visits dependents of processors that changed in the previous pass.
+  // Cycles in the dependency graph can never fully settle, so we stop after
+  // giving every processor a chance to propagate its changes.
+  const size_t max_passes = processors_.size();
+  for (size_t pass = 0; pass < max_passes && !changed_.empty(); ++pass) {
+    next_changed_.clear();
+    for (auto it = dependency_counts_.begin(); it != dependency_counts_.end();
+         ++it) {
+      const Dependency& d = it->first;
+      if (std::find(changed_.begin(), changed_.end(), d.second) ==
+          changed_.end()) {
+        continue;
+      }
+      if (d.first->UpdateDependents(d.second) &&
+          std::find(next_changed_.begin(), next_changed_.end(), d.first) ==
+              next_changed_.end()) {
+        next_changed_.push_back(d.first);
+      }
+    }
+    changed_.swap(next_changed_);
+  }
+}
+
 void MotiveEngine::AdvanceFrame(MotiveTime delta_time) {
+  // Processors read the live outputs of their children, even when double
+  // buffered.
+  const MotiveProcessor::AdvancingScope advancing;
+  const TraceScope trace("AdvanceFrame", "MotiveEngine");
+
+  // Frames started by AdvanceFrameAsync() applied their commands, and were
+  // recorded, when they started.
+  if (!async_in_flight_) {
+    ApplyCommands();
+    if (recorder_ != nullptr) recorder_->RecordAdvanceFrame(delta_time);
+  }
+
+  if (fixed_time_step_ <= 0) {
+    AdvanceProcessors(delta_time);
+    ++frame_count_;
+  } else {
+    // Each step is a frame of its own, so that changed frames and update
+    // divisors still see every step. Events accumulate in the processors,
+    // and are gathered once below.
+    fixed_time_remainder_ += delta_time;
+    while (fixed_time_remainder_ >= fixed_time_step_) {
+      fixed_time_remainder_ -= fixed_time_step_;
+      for (ProcessorSet::iterator it = sorted_processors_.begin();
+           it != sorted_processors_.end(); ++it) {
+        it->processor->BeginFixedStep();
+      }
+      AdvanceProcessors(fixed_time_step_);
+      ++frame_count_;
+    }
+  }
+  TakeEvents();
+  TakeCounters();
+  if (!async_in_flight_) {
+    ReclaimTransients();
+    AutoTrim();
+  }
+}
+
+// static
+void MotiveEngine::AdvanceFrames(MotiveEngine* const* engines, size_t count,
+                                 MotiveTime delta_time,
+                                 MotiveTaskScheduler* scheduler) {
+  if (scheduler == nullptr) {
+    for (size_t i = 0; i < count; ++i) engines[i]->AdvanceFrame(delta_time);
+    return;
+  }
+
+  // A few engines per task keeps the scheduling overhead low when each
+  // engine has only a modest amount of work.
+  static const int kMinEnginesPerTask = 4;
+  scheduler->ParallelFor(static_cast<int>(count), kMinEnginesPerTask,
+                         [engines, delta_time](int begin, int end) {
+                           for (int i = begin; i < end; ++i) {
+                             assert(!engines[i]->async_in_flight_);
+                             engines[i]->AdvanceFrame(delta_time);
+                           }
+                         });
+}
+
+void MotiveEngine::AdvanceProcessors(MotiveTime delta_time) {
   // Advance the simulation in each processor.
-  // TODO: At some point, we'll want to do several passes. An item in
-  // processor A might depend on the output of an item in processor B,
-  // which might in turn depend on the output of a *different* item in
-  // processor A. In this case, we have to do two passes. For now, just
-  // assume that one pass is sufficient.
+  // An item in processor A might depend on the output of an item in processor
+  // B, which might in turn depend on the output of a *different* item in
+  // processor A. Processors are advanced in an order that satisfies every
+  // registered dependency that isn't part of such a cycle. The rest are
+  // resolved by UpdateLateDependencies(), which recalculates only the
+  // affected items after the main pass.
+  if (order_dirty_) OrderProcessors();
+  if (task_scheduler_ == nullptr && num_threads_ <= 1) {
+    for (auto it = ordered_processors_.begin();
+         it != ordered_processors_.end(); ++it) {
+      AdvanceProcessor(*it, delta_time);
+    }
+    UpdateLateDependencies();
+    return;
+  }
+
+  // Processors in the same tier never depend on each other, so each tier can
+  // be advanced concurrently. Tiers are run in order, and AdvanceTier()
+  // returns only once its whole tier has finished.
+  size_t tier_begin = 0;
+  for (auto it = tier_ends_.begin(); it != tier_ends_.end(); ++it) {
+    tier_.assign(ordered_processors_.begin() + tier_begin,
+                 ordered_processors_.begin() + *it);
+    AdvanceTier(delta_time);
+    tier_begin = *it;
+  }
+  UpdateLateDependencies();
+}
+
+// static
+void MotiveEngine::AdvanceProcessor(MotiveProcessor* processor,
+                                    MotiveTime delta_time) {
+  const motive::Benchmark b(processor->benchmark_id_for_advance_frame());
+  const TraceScope trace("AdvanceFrame", processor->Type()->name);
+  processor->AdvanceFrame(delta_time);
+  processor->WriteOutputs();
+}
+
+MotiveHandle MotiveEngine::CreateTransient(const MotivatorInit& init,
+                                           MotiveDimension dimensions,
+                                           const MotiveTarget1f* targets) {
+  WaitForFrame();
+  const MotiveHandle handle = transients_.Create();
+  transients_.Get(handle)->InitializeWithTargets(init, this, dimensions,
+                                                 targets);
+  return handle;
+}
+
+void MotiveEngine::ReclaimTransients() {
+  transients_.DestroyIf(
+      [](const MotivatorNf& motivator) { return motivator.Finished(); });
+}
+
+void MotiveEngine::AutoTrim() {
+  if (auto_trim_frames_ == 0) return;
+  for (auto it = processors_.begin(); it != processors_.end(); ++it) {
+    if (*it != nullptr) (*it)->TrimIfUnderused(auto_trim_frames_);
+  }
+}
+
+// The Motivator that `command` is called on.
+static const Motivator* CommandMotivator(const MotiveCommand& command) {
+  if (command.type == MotiveCommand::kSetTargets) return command.vector;
+  return command.rig;
+}
+
+static bool SamePlayback(const SplinePlayback& a, const SplinePlayback& b) {
+  return a.start_x == b.start_x && a.blend_x == b.blend_x &&
+         a.playback_rate == b.playback_rate && a.y_offset == b.y_offset &&
+         a.y_scale == b.y_scale && a.repeat == b.repeat;
+}
+
+void MotiveEngine::ApplyCommands() {
+  commands_.Drain(&drained_commands_);
+  if (drained_commands_.empty()) return;
+
+  // Drop commands on Motivators that have been invalidated since they were
+  // pushed.
+  std::vector<MotiveCommand>& commands = drained_commands_;
+  commands.erase(std::remove_if(commands.begin(), commands.end(),
+                                [](const MotiveCommand& c) {
+                                  return CommandMotivator(c)->processor_ ==
+                                         nullptr;
+                                }),
+                 commands.end());
+
+  // Sort by processor, so each processor gets its commands together, and
+  // then by index. The sort is stable, so the commands on each Motivator
+  // stay in the order they were pushed.
+  std::stable_sort(commands.begin(), commands.end(),
+                   [](const MotiveCommand& a, const MotiveCommand& b) {
+                     const Motivator* ma = CommandMotivator(a);
+                     const Motivator* mb = CommandMotivator(b);
+                     if (ma->processor_ != mb->processor_) {
+                       return std::less<const MotiveProcessor*>()(
+                           ma->processor_, mb->processor_);
+                     }
+                     return ma->index_ < mb->index_;
+                   });
+
+  std::vector<MotiveIndex>& indices = command_indices_;
+  std::vector<MotiveTarget1f>& targets = command_targets_;
+  for (size_t begin = 0; begin < commands.size();) {
+    const MotiveCommand& first = commands[begin];
+    MotiveProcessor* processor = CommandMotivator(first)->processor_;
+
+    // Commands of the same type on the same processor are applied in one
+    // call, unless a Motivator has a second command, which must wait for
+    // its first.
+    size_t end = begin + 1;
+    while (first.type != MotiveCommand::kSetPlaybackRate &&
+           end < commands.size()) {
+      const MotiveCommand& c = commands[end];
+      const Motivator* motivator = CommandMotivator(c);
+      if (c.type != first.type || motivator->processor_ != processor ||
+          motivator == CommandMotivator(commands[end - 1])) {
+        break;
+      }
+      if (c.type == MotiveCommand::kBlendToAnim &&
+          (c.anim != first.anim || !SamePlayback(c.playback, first.playback))) {
+        break;
+      }
+      ++end;
+    }
+
+    switch (first.type) {
+      case MotiveCommand::kSetTargets: {
+        indices.clear();
+        targets.clear();
+        for (size_t i = begin; i < end; ++i) {
+          const MotiveCommand& c = commands[i];
+          assert(c.dimensions == c.vector->Dimensions());
+          if (recorder_ != nullptr) {
+            recorder_->RecordSetTargets(c.vector, c.dimensions, c.targets);
+          }
+          const MotiveIndex index =
+              static_cast<const Motivator*>(c.vector)->index_;
+          for (MotiveDimension d = 0; d < c.dimensions; ++d) {
+            indices.push_back(index + d);
+            targets.push_back(c.targets[d]);
+          }
+        }
+        static_cast<MotiveProcessorNf*>(processor)->SetTargetsAt(
+            indices.data(), static_cast<MotiveIndex>(indices.size()),
+            targets.data());
+        break;
+      }
+
+      // Same as RigMotivator::BlendToAnimInBulk(), but without allocating.
+      case MotiveCommand::kBlendToAnim: {
+        indices.clear();
+        for (size_t i = begin; i < end; ++i) {
+          const RigMotivator* rig = commands[i].rig;
+          if (recorder_ != nullptr) {
+            recorder_->RecordBlendToAnim(rig, *first.anim, first.playback);
+          }
+          indices.push_back(static_cast<const Motivator*>(rig)->index_);
+        }
+        const MotiveRecorder::NestedScope nested(recorder_);
+        static_cast<RigProcessor*>(processor)->BlendToAnimAt(
+            indices.data(), static_cast<MotiveIndex>(indices.size()),
+            *first.anim, first.playback);
+        break;
+      }
+
+      case MotiveCommand::kSetPlaybackRate:
+        if (recorder_ != nullptr) {
+          recorder_->RecordSetPlaybackRate(first.rig, first.playback_rate);
+        }
+        static_cast<RigProcessor*>(processor)->SetPlaybackRate(
+            static_cast<const Motivator*>(first.rig)->index_,
+            first.playback_rate);
+        break;
+    }
+    begin = end;
+  }
+  drained_commands_.clear();
+}
+
+void MotiveEngine::TakeEvents() {
+  frame_events_.clear();
   for (ProcessorSet::iterator it = sorted_processors_.begin();
        it != sorted_processors_.end(); ++it) {
-    const motive::Benchmark b(it->processor->benchmark_id_for_advance_frame());
-    it->processor->AdvanceFrame(delta_time);
+    it->processor->TakeEvents(&frame_events_);
   }
+
+  // Frames in flight are published by WaitForFrame(), along with their
+  // events.
+  if (!async_in_flight_) {
+    events_.swap(frame_events_);
+  }
+}
+
+void MotiveEngine::TakeCounters() {
+  MotiveCounters now;
+  ReadMotiveCounters(&now);
+  frame_counters_ = now - counters_at_last_frame_;
+  counters_at_last_frame_ = now;
+}
+
+void MotiveEngine::set_num_threads(int num_threads) {
+  // The frame in flight may be running on the old pool.
+  WaitForFrame();
+  if (num_threads == num_threads_) return;
+  num_threads_ = num_threads;
+  thread_pool_.reset(num_threads > 1 ? new MotiveThreadPool(num_threads - 1)
+                                     : nullptr);
+}
+
+void MotiveEngine::set_double_buffered(bool double_buffered) {
+  WaitForFrame();
+  double_buffered_ = double_buffered;
+  for (ProcessorSet::iterator it = sorted_processors_.begin();
+       it != sorted_processors_.end(); ++it) {
+    it->processor->SetDoubleBuffered(double_buffered);
+  }
+  for (auto it = static_processors_.begin(); it != static_processors_.end();
+       ++it) {
+    (*it)->SetDoubleBuffered(double_buffered);
+  }
+}
+
+void MotiveEngine::set_recorder(MotiveRecorder* recorder) {
+  WaitForFrame();
+  recorder_ = recorder;
+  for (ProcessorSet::iterator it = sorted_processors_.begin();
+       it != sorted_processors_.end(); ++it) {
+    it->processor->SetRecorder(recorder);
+  }
+  for (auto it = static_processors_.begin(); it != static_processors_.end();
+       ++it) {
+    (*it)->SetRecorder(recorder);
+  }
+}
+
+void MotiveEngine::AdvanceFrameAsync(MotiveTime delta_time) {
+  assert(double_buffered_);
+
+  // Publish the previous frame. This also defragments every processor, so
+  // that the processors' own calls to Defragment() in AdvanceFrame() have
+  // nothing to move while the frame is in flight.
+  if (async_in_flight_) {
+    WaitForFrame();
+  } else {
+    UpdateFrontBuffers();
+  }
+
+  // Commands are applied here, while no frame is in flight, and recorded
+  // before the frame that follows them.
+  ApplyCommands();
+  if (recorder_ != nullptr) {
+    recorder_->RecordAdvanceFrame(delta_time);
+  }
+
+  async_in_flight_ = true;
+  if (task_scheduler_ != nullptr) {
+    async_group_ = task_scheduler_->BeginGroup();
+    task_scheduler_->Submit(async_group_,
+                            [this, delta_time]() { AdvanceFrame(delta_time); });
+  } else {
+    async_thread_ =
+        std::thread([this, delta_time]() { AdvanceFrame(delta_time); });
+  }
+}
+
+void MotiveEngine::WaitForFrame() {
+  if (!async_in_flight_) return;
+
+  if (async_thread_.joinable()) {
+    async_thread_.join();
+  } else {
+    task_scheduler_->Wait(async_group_);
+  }
+  async_in_flight_ = false;
+  events_.swap(frame_events_);
+  ReclaimTransients();
+  UpdateFrontBuffers();
+  AutoTrim();
+}
+
+void MotiveEngine::UpdateFrontBuffers() {
+  for (ProcessorSet::iterator it = sorted_processors_.begin();
+       it != sorted_processors_.end(); ++it) {
+    it->processor->UpdateFrontBuffer();
+  }
+  for (auto it = static_processors_.begin(); it != static_processors_.end();
+       ++it) {
+    (*it)->UpdateFrontBuffer();
+  }
+}
+
+void MotiveEngine::AdvanceTier(MotiveTime delta_time) {
+  MotiveTaskScheduler* scheduler =
+      task_scheduler_ != nullptr ? task_scheduler_ : thread_pool_.get();
+
+  // One processor per task. Processors with a lot of work will further split
+  // it with ParallelFor().
+  scheduler->ParallelFor(
+      static_cast<int>(tier_.size()), 1, [this, delta_time](int begin, int end) {
+        const MotiveProcessor::AdvancingScope advancing;
+        for (int i = begin; i < end; ++i) {
+          AdvanceProcessor(tier_[i], delta_time);
+        }
+      });
 }
 
 }  // namespace motive
@@ -13,10 +13,18 @@
 // limitations under the License.
 #include "motive/io/flatbuffers.h"
 
+#include <string.h>
+#include <map>
+#include <unordered_map>
+
+#include "anim_bundle_generated.h"
 #include "anim_generated.h"
 #include "anim_table_generated.h"
+#include "motive/anim_table.h"
+#include "motive/math/compact_spline_packing.h"
 #include "motive/overshoot_init.h"
 #include "motive/matrix_anim.h"
+#include "motive/preset_table.h"
 #include "motive/rig_anim.h"
 #include "motive_generated.h"
 
@@ -72,7 +80,90 @@ void Settled1fFromFlatBuffers(const Settled1fParameters& params,
   settled->max_difference = params.max_difference();
 }
 
-void MatrixAnimFromFlatBuffers(const MatrixAnimFb& params, MatrixAnim* anim) {
+void PresetTableFromFlatBuffers(const MotivatorPresetsFb& params,
+                                PresetTable* table) {
+  const auto presets = params.presets();
+  for (size_t i = 0; i < flatbuffers::VectorLength(presets); ++i) {
+    const MotivatorPresetFb* preset =
+        presets->Get(static_cast<flatbuffers::uoffset_t>(i));
+    const std::string name =
+        preset->name() == nullptr ? std::string() : preset->name()->str();
+    if (preset->parameters() == nullptr) continue;
+
+    switch (preset->parameters_type()) {
+      case MotivatorPresetParametersFb_OvershootParameters: {
+        OvershootInit init;
+        OvershootInitFromFlatBuffers(
+            *reinterpret_cast<const OvershootParameters*>(
+                preset->parameters()),
+            &init);
+        table->AddOvershoot(name, init);
+        break;
+      }
+
+      case MotivatorPresetParametersFb_SplineParameters: {
+        SplineInit init;
+        SplineInitFromFlatBuffers(
+            *reinterpret_cast<const SplineParameters*>(preset->parameters()),
+            &init);
+        table->AddSpline(name, init);
+        break;
+      }
+
+      default:
+        break;
+    }
+  }
+}
+
+bool VerifyMotivatorPresetsFlatBuffer(const void* data, size_t size) {
+  flatbuffers::Verifier verifier(static_cast<const uint8_t*>(data), size);
+  return VerifyMotivatorPresetsFbBuffer(verifier);
+}
+
+bool PresetTableFromFlatBuffers(const void* data, size_t size, bool verify,
+                                PresetTable* table) {
+  if (verify && !VerifyMotivatorPresetsFlatBuffer(data, size)) return false;
+  PresetTableFromFlatBuffers(*GetMotivatorPresetsFb(data), table);
+  return true;
+}
+
+// Splines can point directly at the serialized nodes only if the layouts match.
+static_assert(sizeof(CompactSplineNodeFb) == sizeof(detail::CompactSplineNode),
+              "CompactSplineNodeFb must match CompactSplineNode");
+
+// Create a spline for `s` that can hold `max_nodes`, in the block reserved by
+// `rig` if there's room.
+static CompactSpline* NewSpline(CompactSplineIndex max_nodes, RigAnim* rig,
+                                MatrixAnim::Spline* s) {
+  void* buffer = rig == nullptr ? nullptr : rig->AllocateSpline(max_nodes);
+  s->owned = buffer == nullptr;
+  s->spline = buffer == nullptr
+                  ? CompactSpline::Create(max_nodes)
+                  : CompactSpline::CreateInPlace(max_nodes, buffer);
+  return s->spline;
+}
+
+// Same as NewSpline(), but for a spline that reads its nodes from `nodes`.
+static CompactSpline* NewSplineView(const Range& y_range, float x_granularity,
+                                    const detail::CompactSplineNode* nodes,
+                                    CompactSplineIndex num_nodes, RigAnim* rig,
+                                    MatrixAnim::Spline* s) {
+  void* buffer = rig == nullptr ? nullptr : rig->AllocateSpline(0);
+  s->owned = buffer == nullptr;
+  s->spline = buffer == nullptr
+                  ? CompactSpline::CreateView(y_range, x_granularity, nodes,
+                                              num_nodes)
+                  : CompactSpline::CreateViewInPlace(y_range, x_granularity,
+                                                     nodes, num_nodes, buffer);
+  return s->spline;
+}
+
+// Decode `params` into `anim`. Splines are created in the block reserved by
+// `rig`, if it's not nullptr. Returns false if a packed spline can't be
+// expanded, in which case its operation is left without a spline.
+static bool DecodeMatrixAnim(const MatrixAnimFb& params, MatrixAnim* anim,
+                             bool reference_params, RigAnim* rig) {
   std::vector<MatrixOperationInit>& ops = anim->ops();
   ops.clear();
   ops.reserve(params.ops()->size());
@@ -86,7 +177,8 @@ void MatrixAnimFromFlatBuffers(const MatrixAnimFb& params, MatrixAnim* anim) {
   int num_splines = 0;
   for (auto op = params.ops()->begin(); op != params.ops()->end(); ++op) {
     if (op->value_type() == MatrixOpValueFb_CompactSplineFb ||
-        op->value_type() == MatrixOpValueFb_CompactSplineFloatFb) {
+        op->value_type() == MatrixOpValueFb_CompactSplineFloatFb ||
+        op->value_type() == MatrixOpValueFb_CompactSplinePackedFb) {
       num_splines++;
     }
   }
@@ -96,6 +188,7 @@ void MatrixAnimFromFlatBuffers(const MatrixAnimFb& params, MatrixAnim* anim) {
 
   // Loop through each op, adding to the MatrixAnim ops.
   int spline_idx = 0;
+  bool valid = true;
   for (auto op = params.ops()->begin(); op != params.ops()->end(); ++op) {
     const MatrixOperationType op_type =
         static_cast<MatrixOperationType>(op->type());
@@ -121,19 +214,25 @@ void MatrixAnimFromFlatBuffers(const MatrixAnimFb& params, MatrixAnim* anim) {
         if (spline_fb) {
           const CompactSplineIndex num_spline_nodes =
               static_cast<CompactSplineIndex>(spline_fb->nodes()->size());
-          s.spline = CompactSpline::Create(num_spline_nodes);
-
-          // Copy the spline data into s.spline.
-          // TODO: modify CompactSpline so we can just point at spline data
-          //       instead of copying it.
           const Range y_range(spline_fb->y_range_start(),
                               spline_fb->y_range_end());
-          s.spline->Init(y_range, spline_fb->x_granularity());
-          for (auto n = spline_fb->nodes()->begin();
-               n != spline_fb->nodes()->end(); ++n) {
-            s.spline->AddNodeVerbatim(n->x(), n->y(), n->angle());
+
+          if (reference_params) {
+            // Point s.spline at the node data inside the FlatBuffer.
+            NewSplineView(y_range, spline_fb->x_granularity(),
+                          reinterpret_cast<const detail::CompactSplineNode*>(
+                              spline_fb->nodes()->data()),
+                          num_spline_nodes, rig, &s);
+          } else {
+            // Copy the spline data into s.spline.
+            NewSpline(num_spline_nodes, rig, &s);
+            s.spline->Init(y_range, spline_fb->x_granularity());
+            for (auto n = spline_fb->nodes()->begin();
+                 n != spline_fb->nodes()->end(); ++n) {
+              s.spline->AddNodeVerbatim(n->x(), n->y(), n->angle());
+            }
+            assert(s.spline->num_nodes() == s.spline->max_nodes());
           }
-          assert(s.spline->num_nodes() == s.spline->max_nodes());
           ops.emplace_back(op->id(), op_type, s.init, *s.spline);
         } else {
           ops.emplace_back(op->id(), op_type, s.init);
@@ -153,7 +252,7 @@ void MatrixAnimFromFlatBuffers(const MatrixAnimFb& params, MatrixAnim* anim) {
         if (spline_fb) {
           const CompactSplineIndex num_spline_nodes =
               static_cast<CompactSplineIndex>(spline_fb->nodes()->size());
-          s.spline = CompactSpline::Create(num_spline_nodes);
+          NewSpline(num_spline_nodes, rig, &s);
 
           // n->time() is in seconds, but CompactSplines work in milliseconds.
           const float end_x = spline_fb->nodes()->end()->time() * 1000.f;
@@ -189,6 +288,41 @@ void MatrixAnimFromFlatBuffers(const MatrixAnimFb& params, MatrixAnim* anim) {
         break;
       }
 
+      case MatrixOpValueFb_CompactSplinePackedFb: {
+        const CompactSplinePackedFb* spline_fb =
+            reinterpret_cast<const CompactSplinePackedFb*>(op->value());
+        MatrixAnim::Spline& s = splines[spline_idx++];
+
+        // Hold `init` data in structures that won't disappear, since these are
+        // referenced by pointer.
+        const Range& op_range = RangeOfOp(op_type);
+        s.init = SplineInit(op_range);
+
+        if (spline_fb && spline_fb->bits()) {
+          const CompactSplineIndex num_spline_nodes = spline_fb->num_nodes();
+          NewSpline(num_spline_nodes, rig, &s);
+
+          // Expand the packed nodes into s.spline.
+          const Range y_range(spline_fb->y_range_start(),
+                              spline_fb->y_range_end());
+          s.spline->Init(y_range, spline_fb->x_granularity());
+          const CompactSplinePacking packing(spline_fb->x_bits(),
+                                             spline_fb->y_bits(),
+                                             spline_fb->angle_bits());
+          if (UnpackCompactSplineNodes(spline_fb->bits()->data(),
+                                       spline_fb->bits()->size(),
+                                       num_spline_nodes, packing, s.spline)) {
+            ops.emplace_back(op->id(), op_type, s.init, *s.spline);
+          } else {
+            ops.emplace_back(op->id(), op_type, s.init);
+            valid = false;
+          }
+        } else {
+          ops.emplace_back(op->id(), op_type, s.init);
+        }
+        break;
+      }
+
       case MatrixOpValueFb_ConstantOpFb: {
         const ConstantOpFb* const_fb =
             reinterpret_cast<const ConstantOpFb*>(op->value());
@@ -200,6 +334,7 @@ void MatrixAnimFromFlatBuffers(const MatrixAnimFb& params, MatrixAnim* anim) {
         assert(false);  // Invalid FlatBuffer data.
     }
   }
+  return valid;
 }
 
 // Maximum duration of any of the splines.
@@ -214,7 +349,63 @@ static MotiveTime EndTime(const std::vector<MatrixOperationInit>& ops) {
   return end_time;
 }
 
-void RigAnimFromFlatBuffers(const RigAnimFb& params, RigAnim* anim) {
+bool MatrixAnimFromFlatBuffers(const MatrixAnimFb& params, MatrixAnim* anim,
+                               bool reference_params) {
+  return DecodeMatrixAnim(params, anim, reference_params, nullptr);
+}
+
+// Add the number of splines, spline nodes, and name characters in `params`
+// to the totals.
+static void CountRigAnimStorage(const RigAnimFb& params, int* num_splines,
+                                size_t* num_nodes, size_t* name_chars) {
+  const auto names = params.bone_names();
+  for (flatbuffers::uoffset_t i = 0; i < flatbuffers::VectorLength(names);
+       ++i) {
+    *name_chars += names->Get(i)->size() + 1;
+  }
+
+  const auto matrix_anims = params.matrix_anims();
+  for (flatbuffers::uoffset_t i = 0;
+       i < flatbuffers::VectorLength(matrix_anims); ++i) {
+    const auto ops = matrix_anims->Get(i)->ops();
+    for (auto op = ops->begin(); op != ops->end(); ++op) {
+      switch (op->value_type()) {
+        case MatrixOpValueFb_CompactSplineFb: {
+          const auto spline_fb =
+              reinterpret_cast<const CompactSplineFb*>(op->value());
+          *num_splines += 1;
+          if (spline_fb == nullptr) break;
+          *num_nodes += flatbuffers::VectorLength(spline_fb->nodes());
+          break;
+        }
+        case MatrixOpValueFb_CompactSplineFloatFb: {
+          const auto spline_fb =
+              reinterpret_cast<const CompactSplineFloatFb*>(op->value());
+          *num_splines += 1;
+          if (spline_fb == nullptr) break;
+          *num_nodes += flatbuffers::VectorLength(spline_fb->nodes());
+          break;
+        }
+        case MatrixOpValueFb_CompactSplinePackedFb: {
+          const auto spline_fb =
+              reinterpret_cast<const CompactSplinePackedFb*>(op->value());
+          *num_splines += 1;
+          if (spline_fb == nullptr) break;
+          *num_nodes += spline_fb->num_nodes();
+          break;
+        }
+        default:
+          break;
+      }
+    }
+  }
+}
+
+// Decode `params` into `anim`. If `contiguous`, the splines and bone names
+// are first sized, and then placed in one block owned by `anim`. Returns false
+// if any packed spline can't be expanded.
+static bool DecodeRigAnim(const RigAnimFb& params, RigAnim* anim,
+                          bool reference_params, bool contiguous) {
   const size_t num_bones = flatbuffers::VectorLength(params.matrix_anims());
   const auto names = params.bone_names();
   const auto parents = params.bone_parents();
@@ -226,12 +417,27 @@ void RigAnimFromFlatBuffers(const RigAnimFb& params, RigAnim* anim) {
   anim->Init(anim_name, static_cast<motive::BoneIndex>(num_bones),
              record_names);
 
+  RigAnim* rig = nullptr;
+  if (contiguous) {
+    int num_splines = 0;
+    size_t num_nodes = 0;
+    size_t name_chars = 0;
+    CountRigAnimStorage(params, &num_splines, &num_nodes, &name_chars);
+
+    // Views keep their nodes in `params`.
+    anim->Reserve(num_splines, reference_params ? 0 : num_nodes,
+                  record_names ? name_chars : 0);
+    rig = anim;
+  }
+
   MotiveTime end_time = 0;
+  bool valid = true;
   for (BoneIndex i = 0; i < num_bones; ++i) {
     const BoneIndex parent = parents->Get(i);
     const char* name = record_names ? names->Get(i)->c_str() : "";
     MatrixAnim& m = anim->InitMatrixAnim(i, parent, name);
-    MatrixAnimFromFlatBuffers(*params.matrix_anims()->Get(i), &m);
+    valid &= DecodeMatrixAnim(*params.matrix_anims()->Get(i), &m,
+                              reference_params, rig);
     end_time = std::max(end_time, EndTime(m.ops()));
   }
 
@@ -239,6 +445,441 @@ void RigAnimFromFlatBuffers(const RigAnimFb& params, RigAnim* anim) {
   anim->set_end_time(params.repeat() ? std::numeric_limits<MotiveTime>::max()
                                      : end_time);
   anim->set_repeat(params.repeat() != 0);
+  return valid;
+}
+
+bool RigAnimFromFlatBuffers(const RigAnimFb& params, RigAnim* anim,
+                            bool reference_params) {
+  return DecodeRigAnim(params, anim, reference_params, false);
+}
+
+bool RigAnimFromFlatBuffersContiguous(const RigAnimFb& params, RigAnim* anim,
+                                      bool reference_params) {
+  return DecodeRigAnim(params, anim, reference_params, true);
+}
+
+// Splines in an AnimBundleFb start on cache line boundaries.
+static const size_t kBundleSplineAlignment = 64;
+
+// Marks an empty slot in AnimBundleListFb.anims.
+static const uint16_t kInvalidBundleAnim = 0xFFFF;
+
+static const char* BundleString(const AnimBundleFb& bundle, uint32_t index) {
+  const auto strings = bundle.strings();
+  return index < flatbuffers::VectorLength(strings)
+             ? strings->Get(index)->c_str()
+             : "";
+}
+
+// Return a new spline holding `spline_fb`, or nullptr if its packed nodes
+// can't be expanded.
+static CompactSpline* SplineFromBundle(const AnimBundleFb& bundle,
+                                       const AnimBundleSplineFb& spline_fb,
+                                       bool reference_params) {
+  const uint8_t* data = bundle.spline_data()->data() + spline_fb.offset();
+  const CompactSplineIndex num_nodes = spline_fb.num_nodes();
+  const Range y_range(spline_fb.y_range_start(), spline_fb.y_range_end());
+
+  // Expand packed nodes.
+  if (bundle.compression() == AnimBundleCompressionFb_kPacked) {
+    CompactSpline* spline = CompactSpline::Create(num_nodes);
+    spline->Init(y_range, spline_fb.x_granularity());
+    const CompactSplinePacking packing(
+        spline_fb.x_bits(), spline_fb.y_bits(), spline_fb.angle_bits());
+    if (!UnpackCompactSplineNodes(data, spline_fb.size(), num_nodes, packing,
+                                  spline)) {
+      CompactSpline::Destroy(spline);
+      return nullptr;
+    }
+    return spline;
+  }
+
+  // Point at, or copy, the nodes in the bundle.
+  const detail::CompactSplineNode* nodes =
+      reinterpret_cast<const detail::CompactSplineNode*>(data);
+  if (reference_params) {
+    return CompactSpline::CreateView(y_range, spline_fb.x_granularity(), nodes,
+                                     num_nodes);
+  }
+  CompactSpline* spline = CompactSpline::Create(num_nodes);
+  spline->Init(y_range, spline_fb.x_granularity());
+  for (CompactSplineIndex i = 0; i < num_nodes; ++i) {
+    spline->AddNodeVerbatim(nodes[i].x(), nodes[i].y(), nodes[i].angle());
+  }
+  return spline;
+}
+
+// Check that every packed spline in `params` has a valid packing and enough
+// bits for its nodes, which the FlatBuffers verifier can't know about.
+static bool VerifyPackedSplines(const RigAnimFb& params) {
+  const auto matrix_anims = params.matrix_anims();
+  const size_t num_bones = flatbuffers::VectorLength(matrix_anims);
+  for (flatbuffers::uoffset_t i = 0; i < num_bones; ++i) {
+    const auto ops = matrix_anims->Get(i)->ops();
+    const size_t num_ops = flatbuffers::VectorLength(ops);
+    for (flatbuffers::uoffset_t j = 0; j < num_ops; ++j) {
+      const MatrixOpFb& op = *ops->Get(j);
+      if (op.value_type() != MatrixOpValueFb_CompactSplinePackedFb) continue;
+      const CompactSplinePackedFb* spline_fb =
+          reinterpret_cast<const CompactSplinePackedFb*>(op.value());
+      if (spline_fb == nullptr || spline_fb->bits() == nullptr) continue;
+      const CompactSplinePacking packing(spline_fb->x_bits(),
+                                         spline_fb->y_bits(),
+                                         spline_fb->angle_bits());
+      if (!packing.Valid() || spline_fb->bits()->size() <
+                                  packing.PackedSize(spline_fb->num_nodes())) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool VerifyRigAnimFlatBuffer(const void* data, size_t size) {
+  flatbuffers::Verifier verifier(static_cast<const uint8_t*>(data), size);
+  return VerifyRigAnimFbBuffer(verifier) &&
+         VerifyPackedSplines(*GetRigAnimFb(data));
+}
+
+bool RigAnimFromFlatBuffers(const void* data, size_t size, bool verify,
+                            RigAnim* anim, bool reference_params) {
+  if (verify && !VerifyRigAnimFlatBuffer(data, size)) return false;
+  return RigAnimFromFlatBuffers(*GetRigAnimFb(data), anim, reference_params);
+}
+
+bool RigAnimFromFlatBuffers(const AnimBundleFb& bundle, size_t anim_idx,
+                            RigAnim* anim, bool reference_params) {
+  const AnimBundleAnimFb& anim_fb = *bundle.anims()->Get(
+      static_cast<flatbuffers::uoffset_t>(anim_idx));
+  const auto parents = anim_fb.bone_parents();
+  const auto names = anim_fb.bone_names();
+  const auto op_counts = anim_fb.bone_op_counts();
+  const auto sqt_bones = anim_fb.sqt_bones();
+  const auto ops = anim_fb.ops();
+  const auto splines_fb = anim_fb.splines();
+  const size_t num_bones = flatbuffers::VectorLength(parents);
+  const bool record_names = flatbuffers::VectorLength(names) == num_bones;
+  assert(flatbuffers::VectorLength(op_counts) == num_bones);
+
+  anim->Init(BundleString(bundle, anim_fb.name()),
+             static_cast<BoneIndex>(num_bones), record_names);
+
+  MotiveTime end_time = 0;
+  bool valid = true;
+  flatbuffers::uoffset_t first_op = 0;
+  for (BoneIndex i = 0; i < num_bones; ++i) {
+    const char* name = record_names ? BundleString(bundle, names->Get(i)) : "";
+    MatrixAnim& m = anim->InitMatrixAnim(i, parents->Get(i), name);
+    if (i < flatbuffers::VectorLength(sqt_bones) && sqt_bones->Get(i) != 0) {
+      m.SetSqtAnim();
+    }
+
+    // Count the splines of this bone, to construct them all at once.
+    const flatbuffers::uoffset_t end_op = first_op + op_counts->Get(i);
+    int num_splines = 0;
+    for (flatbuffers::uoffset_t j = first_op; j < end_op; ++j) {
+      if (ops->Get(j)->spline() >= 0) num_splines++;
+    }
+    MatrixAnim::Spline* splines = m.Construct(num_splines);
+
+    std::vector<MatrixOperationInit>& bone_ops = m.ops();
+    bone_ops.reserve(end_op - first_op);
+    int spline_idx = 0;
+    for (flatbuffers::uoffset_t j = first_op; j < end_op; ++j) {
+      const AnimBundleOpFb& op = *ops->Get(j);
+      const MatrixOperationType op_type =
+          static_cast<MatrixOperationType>(op.type());
+      if (op.spline() < 0) {
+        bone_ops.emplace_back(op.id(), op_type, op.value());
+        continue;
+      }
+
+      // Hold `init` data in structures that won't disappear, since these are
+      // referenced by pointer.
+      MatrixAnim::Spline& s = splines[spline_idx++];
+      s.init = SplineInit(RangeOfOp(op_type));
+      const AnimBundleSplineFb& spline_fb = *splines_fb->Get(op.spline());
+      if (spline_fb.num_nodes() == 0) {
+        bone_ops.emplace_back(op.id(), op_type, s.init);
+        continue;
+      }
+      s.spline = SplineFromBundle(bundle, spline_fb, reference_params);
+      if (s.spline == nullptr) {
+        bone_ops.emplace_back(op.id(), op_type, s.init);
+        valid = false;
+        continue;
+      }
+      bone_ops.emplace_back(op.id(), op_type, s.init, *s.spline);
+    }
+    first_op = end_op;
+    end_time = std::max(end_time, EndTime(m.ops()));
+  }
+
+  // Set animation-wide values.
+  anim->set_end_time(anim_fb.repeat() ? std::numeric_limits<MotiveTime>::max()
+                                      : end_time);
+  anim->set_repeat(anim_fb.repeat());
+  return valid;
+}
+
+namespace {
+
+// Gathers the shared parts of an AnimBundleFb while its animations are
+// written.
+class AnimBundleWriter {
+ public:
+  AnimBundleWriter(float pack_y_tolerance, flatbuffers::FlatBufferBuilder* fbb)
+      : pack_y_tolerance_(pack_y_tolerance), fbb_(fbb) {}
+
+  flatbuffers::Offset<AnimBundleAnimFb> WriteAnim(const RigAnim& anim) {
+    std::vector<uint8_t> parents(anim.bone_parents(),
+                                 anim.bone_parents() + anim.NumBones());
+    std::vector<uint32_t> names;
+    std::vector<uint16_t> op_counts;
+    std::vector<uint8_t> sqt_bones;
+    std::vector<AnimBundleOpFb> ops;
+    std::vector<AnimBundleSplineFb> splines;
+    for (BoneIndex i = 0; i < anim.NumBones(); ++i) {
+      const MatrixAnim& m = anim.Anim(i);
+      names.push_back(String(anim.BoneName(i)));
+      op_counts.push_back(static_cast<uint16_t>(m.ops().size()));
+      sqt_bones.push_back(m.IsSqtAnim() ? 1 : 0);
+      for (auto op = m.ops().begin(); op != m.ops().end(); ++op) {
+        const MatrixOperationTypeFb type =
+            static_cast<MatrixOperationTypeFb>(op->type);
+        const int8_t id = static_cast<int8_t>(op->id);
+        if (op->union_type == MatrixOperationInit::kUnionSpline ||
+            op->union_type == MatrixOperationInit::kUnionEmpty) {
+          const CompactSpline* spline =
+              op->union_type == MatrixOperationInit::kUnionSpline ? op->spline
+                                                                  : nullptr;
+          ops.push_back(AnimBundleOpFb(
+              0.0f, static_cast<int16_t>(splines.size()), id, type));
+          splines.push_back(Spline(spline));
+        } else {
+          ops.push_back(AnimBundleOpFb(op->StartValue(), -1, id, type));
+        }
+      }
+    }
+
+    return CreateAnimBundleAnimFb(
+        *fbb_, String(anim.anim_name()), anim.repeat(),
+        fbb_->CreateVector(parents), fbb_->CreateVector(names),
+        fbb_->CreateVector(op_counts), fbb_->CreateVector(sqt_bones),
+        fbb_->CreateVectorOfStructs(ops), fbb_->CreateVectorOfStructs(splines));
+  }
+
+  flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<
+      flatbuffers::String>>>
+  WriteStrings() {
+    return fbb_->CreateVectorOfStrings(strings_);
+  }
+
+  flatbuffers::Offset<flatbuffers::Vector<uint8_t>> WriteSplineData() {
+    // Align the start of the data, so that every block is aligned too.
+    fbb_->PreAlign(spline_data_.size(), kBundleSplineAlignment);
+    return fbb_->CreateVector(spline_data_);
+  }
+
+  AnimBundleCompressionFb compression() const {
+    return pack_y_tolerance_ > 0.0f ? AnimBundleCompressionFb_kPacked
+                                    : AnimBundleCompressionFb_kUncompressed;
+  }
+
+ private:
+  uint32_t String(const std::string& s) {
+    auto it = string_indices_.find(s);
+    if (it != string_indices_.end()) return it->second;
+    const uint32_t index = static_cast<uint32_t>(strings_.size());
+    strings_.push_back(s);
+    string_indices_.insert(std::make_pair(s, index));
+    return index;
+  }
+
+  // Write the nodes of `spline` into their own block, unless an earlier op
+  // already has.
+  AnimBundleSplineFb Spline(const CompactSpline* spline) {
+    if (spline == nullptr) return AnimBundleSplineFb();
+    auto it = blocks_.find(spline);
+    if (it != blocks_.end()) return it->second;
+
+    const size_t offset =
+        (spline_data_.size() + kBundleSplineAlignment - 1) /
+        kBundleSplineAlignment * kBundleSplineAlignment;
+    CompactSplinePacking packing(0, 0, 0);
+    size_t size = spline->num_nodes() * sizeof(detail::CompactSplineNode);
+    if (compression() == AnimBundleCompressionFb_kPacked) {
+      packing = CompactSplinePacking::ForTolerance(*spline, pack_y_tolerance_);
+      size = packing.PackedSize(spline->num_nodes());
+      spline_data_.resize(offset + size);
+      PackCompactSplineNodes(*spline, packing, &spline_data_[offset]);
+    } else {
+      spline_data_.resize(offset + size);
+      memcpy(&spline_data_[offset], spline->nodes(), size);
+    }
+
+    const AnimBundleSplineFb block(
+        spline->y_range().start(), spline->y_range().end(),
+        spline->x_granularity(), static_cast<uint32_t>(offset),
+        static_cast<uint32_t>(size), spline->num_nodes(),
+        static_cast<uint8_t>(packing.x_bits),
+        static_cast<uint8_t>(packing.y_bits),
+        static_cast<uint8_t>(packing.angle_bits));
+    blocks_.insert(std::make_pair(spline, block));
+    return block;
+  }
+
+  float pack_y_tolerance_;
+  flatbuffers::FlatBufferBuilder* fbb_;
+  std::vector<std::string> strings_;
+  std::unordered_map<std::string, uint32_t> string_indices_;
+  std::unordered_map<const CompactSpline*, AnimBundleSplineFb> blocks_;
+  std::vector<uint8_t> spline_data_;
+};
+
+}  // namespace
+
+void AnimTableToFlatBuffers(const AnimTable& table, float pack_y_tolerance,
+                            flatbuffers::FlatBufferBuilder* fbb) {
+  AnimBundleWriter writer(pack_y_tolerance, fbb);
+
+  // Number each unique animation, in the order that it's first referenced.
+  std::map<const RigAnim*, uint16_t> anim_indices;
+  std::vector<flatbuffers::Offset<AnimBundleAnimFb>> anims;
+  std::vector<flatbuffers::Offset<AnimBundleListFb>> lists;
+  for (int object = 0; object < table.NumObjects(); ++object) {
+    std::vector<uint16_t> list;
+    for (int anim_idx = 0; anim_idx < table.NumAnims(object); ++anim_idx) {
+      const RigAnim* anim = table.Query(object, anim_idx);
+      if (anim == nullptr) {
+        list.push_back(kInvalidBundleAnim);
+        continue;
+      }
+      auto it = anim_indices.find(anim);
+      if (it == anim_indices.end()) {
+        const uint16_t index = static_cast<uint16_t>(anims.size());
+        assert(index != kInvalidBundleAnim);
+        it = anim_indices.insert(std::make_pair(anim, index)).first;
+        anims.push_back(writer.WriteAnim(*anim));
+      }
+      list.push_back(it->second);
+    }
+    lists.push_back(CreateAnimBundleListFb(*fbb, fbb->CreateVector(list)));
+  }
+
+  const auto lists_fb = fbb->CreateVector(lists);
+  const auto anims_fb = fbb->CreateVector(anims);
+  const auto strings_fb = writer.WriteStrings();
+  const auto spline_data_fb = writer.WriteSplineData();
+  const AnimBundleChecksumFb no_checksum(0);
+  FinishAnimBundleFbBuffer(
+      *fbb, CreateAnimBundleFb(*fbb, lists_fb, anims_fb, strings_fb,
+                               writer.compression(), spline_data_fb,
+                               &no_checksum));
+
+  // Now that every other byte is final, fill in the checksum.
+  uint8_t* buf = fbb->GetBufferPointer();
+  const uint32_t checksum = AnimBundleChecksum(buf, fbb->GetSize());
+  const uint8_t* checksum_fb =
+      reinterpret_cast<const uint8_t*>(GetAnimBundleFb(buf)->checksum());
+  flatbuffers::WriteScalar(buf + (checksum_fb - buf), checksum);
+}
+
+// Check the indices that the FlatBuffers verifier can't know about.
+static bool VerifyBundleAnim(const AnimBundleFb& bundle,
+                             const AnimBundleAnimFb& anim_fb) {
+  const size_t num_strings = flatbuffers::VectorLength(bundle.strings());
+  const size_t data_size = flatbuffers::VectorLength(bundle.spline_data());
+  const auto names = anim_fb.bone_names();
+  const auto op_counts = anim_fb.bone_op_counts();
+  const auto ops = anim_fb.ops();
+  const auto splines = anim_fb.splines();
+  const size_t num_bones = flatbuffers::VectorLength(anim_fb.bone_parents());
+  const size_t num_splines = flatbuffers::VectorLength(splines);
+  if (num_bones > kMaxNumBones ||
+      flatbuffers::VectorLength(op_counts) != num_bones) {
+    return false;
+  }
+
+  size_t num_ops = 0;
+  for (size_t i = 0; i < num_bones; ++i) {
+    num_ops += op_counts->Get(static_cast<flatbuffers::uoffset_t>(i));
+  }
+  if (num_ops != flatbuffers::VectorLength(ops)) return false;
+  for (flatbuffers::uoffset_t i = 0; i < num_ops; ++i) {
+    const int spline = ops->Get(i)->spline();
+    if (spline >= static_cast<int>(num_splines)) return false;
+  }
+
+  const bool packed =
+      bundle.compression() == AnimBundleCompressionFb_kPacked;
+  for (flatbuffers::uoffset_t i = 0; i < num_splines; ++i) {
+    const AnimBundleSplineFb& s = *splines->Get(i);
+    if (s.num_nodes() == 0) continue;
+    if (s.offset() > data_size || s.size() > data_size - s.offset()) {
+      return false;
+    }
+    const CompactSplinePacking packing(s.x_bits(), s.y_bits(), s.angle_bits());
+    if (packed && !packing.Valid()) return false;
+    const size_t expected_size =
+        packed ? packing.PackedSize(s.num_nodes())
+               : s.num_nodes() * sizeof(detail::CompactSplineNode);
+    if (s.size() != expected_size) return false;
+  }
+  return true;
+}
+
+bool VerifyAnimBundleFlatBuffer(const void* data, size_t size) {
+  flatbuffers::Verifier verifier(static_cast<const uint8_t*>(data), size);
+  if (!VerifyAnimBundleFbBuffer(verifier)) return false;
+
+  const AnimBundleFb& bundle = *GetAnimBundleFb(data);
+  const size_t num_anims = flatbuffers::VectorLength(bundle.anims());
+  for (flatbuffers::uoffset_t i = 0; i < num_anims; ++i) {
+    if (!VerifyBundleAnim(bundle, *bundle.anims()->Get(i))) return false;
+  }
+  const size_t num_objects = flatbuffers::VectorLength(bundle.objects());
+  for (flatbuffers::uoffset_t i = 0; i < num_objects; ++i) {
+    const auto list = bundle.objects()->Get(i)->anims();
+    const size_t list_len = flatbuffers::VectorLength(list);
+    for (flatbuffers::uoffset_t j = 0; j < list_len; ++j) {
+      const uint16_t anim = list->Get(j);
+      if (anim != kInvalidBundleAnim && anim >= num_anims) return false;
+    }
+  }
+  return true;
+}
+
+uint32_t AnimBundleChecksum(const void* data, size_t size) {
+  // FNV-1a over 32-bit words, which is several times faster than over bytes
+  // and still catches any single corrupt byte.
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  const AnimBundleFb& bundle = *GetAnimBundleFb(data);
+  const size_t checksum_offset =
+      bundle.checksum() == nullptr
+          ? size
+          : reinterpret_cast<const uint8_t*>(bundle.checksum()) - bytes;
+
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < size; i += sizeof(uint32_t)) {
+    uint32_t word = 0;
+    if (i != checksum_offset) {
+      memcpy(&word, bytes + i, std::min(sizeof(word), size - i));
+    }
+    hash = (hash ^ word) * 16777619u;
+  }
+  return hash;
+}
+
+bool CheckAnimBundleChecksum(const void* data, size_t size) {
+  if (size < sizeof(flatbuffers::uoffset_t) +
+                 flatbuffers::FlatBufferBuilder::kFileIdentifierLength ||
+      !AnimBundleFbBufferHasIdentifier(data)) {
+    return false;
+  }
+  const AnimBundleFb& bundle = *GetAnimBundleFb(data);
+  return bundle.checksum() != nullptr &&
+         bundle.checksum()->value() == AnimBundleChecksum(data, size);
 }
 
 }  // namespace motive
@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <string>
 #include <sstream>
 #include <vector>
@@ -19,6 +20,8 @@
 #include "motive/math/bulk_spline_evaluator.h"
 #include "motive/math/dual_cubic.h"
 #include "motive/util/benchmark.h"
+#include "motive/util/counters.h"
+#include "motive/util/trace.h"
 
 using mathfu::Lerp;
 
@@ -26,8 +29,10 @@ namespace motive {
 
 // These functions are implemented in assembly language.
 extern "C" void UpdateCubicXsAndGetMask_Neon(const float& delta_x,
-                                             const float* x_ends, int num_xs,
-                                             float* xs, uint8_t* masks);
+                                             const float* x_ends,
+                                             const float* playback_rates,
+                                             int num_xs, float* xs,
+                                             uint8_t* masks);
 
 // y_range pointer is of type BulkSplineEvaluator::YRange (not used here because
 // it's private, and extern "C" functions cannot be friends).
@@ -35,14 +40,316 @@ extern "C" void EvaluateCubics_Neon(const CubicCurve* curves, const float* xs,
                                     const void* y_ranges, int num_curves,
                                     float* ys);
 
+// These functions are implemented with intrinsics, in
+// bulk_spline_evaluator_x86.cpp. Each is compiled for its own instruction set.
+void UpdateCubicXsAndGetMask_Sse4(const float& delta_x, const float* x_ends,
+                                  const float* playback_rates, int num_xs,
+                                  float* xs, uint8_t* masks);
+void UpdateCubicXsAndGetMask_Avx2(const float& delta_x, const float* x_ends,
+                                  const float* playback_rates, int num_xs,
+                                  float* xs, uint8_t* masks);
+void EvaluateCubics_Sse4(const CubicCurve* curves, const float* xs,
+                         const void* y_ranges, int num_curves, float* ys);
+void EvaluateCubics_Avx2(const CubicCurve* curves, const float* xs,
+                         const void* y_ranges, int num_curves, float* ys);
+void EvaluateSeparateCubics_Sse4(const float* const* coefficients,
+                                 const float* xs, int num_curves, float* ys);
+void EvaluateSeparateCubics_Avx2(const float* const* coefficients,
+                                 const float* xs, int num_curves, float* ys);
+void NormalizeYs_Sse4(const void* y_ranges, int num_ys, float* ys);
+void NormalizeYs_Avx2(const void* y_ranges, int num_ys, float* ys);
+
+// These functions are implemented with intrinsics, in
+// bulk_spline_evaluator_wasm.cpp.
+void UpdateCubicXsAndGetMask_Wasm(const float& delta_x, const float* x_ends,
+                                  const float* playback_rates, int num_xs,
+                                  float* xs, uint8_t* masks);
+void EvaluateCubics_Wasm(const CubicCurve* curves, const float* xs,
+                         const void* y_ranges, int num_curves, float* ys);
+void EvaluateSeparateCubics_Wasm(const float* const* coefficients,
+                                 const float* xs, int num_curves, float* ys);
+void NormalizeYs_Wasm(const void* y_ranges, int num_ys, float* ys);
+
+const BulkSplineEvaluator::Kernels* BulkSplineEvaluator::KernelsFor(
+    ProcessorOptimization optimization) {
+#if defined(MOTIVE_NEON)
+  static const Kernels kNeonKernels = {UpdateCubicXsAndGetMask_Neon,
+                                       EvaluateCubics_Neon, nullptr,
+                                       nullptr, 4};
+#endif  // defined(MOTIVE_NEON)
+#if defined(MOTIVE_X86_SIMD)
+  static const Kernels kSse4Kernels = {UpdateCubicXsAndGetMask_Sse4,
+                                       EvaluateCubics_Sse4,
+                                       EvaluateSeparateCubics_Sse4,
+                                       NormalizeYs_Sse4, 1};
+  static const Kernels kAvx2Kernels = {UpdateCubicXsAndGetMask_Avx2,
+                                       EvaluateCubics_Avx2,
+                                       EvaluateSeparateCubics_Avx2,
+                                       NormalizeYs_Avx2, 1};
+#endif  // defined(MOTIVE_X86_SIMD)
+#if defined(MOTIVE_WASM_SIMD)
+  static const Kernels kWasmKernels = {UpdateCubicXsAndGetMask_Wasm,
+                                       EvaluateCubics_Wasm,
+                                       EvaluateSeparateCubics_Wasm,
+                                       NormalizeYs_Wasm, 1};
+#endif  // defined(MOTIVE_WASM_SIMD)
+
+  switch (optimization) {
+#if defined(MOTIVE_NEON)
+    case kNeonOptimizations:
+      return &kNeonKernels;
+#endif  // defined(MOTIVE_NEON)
+
+#if defined(MOTIVE_WASM_SIMD)
+    case kWasmSimdOptimizations:
+      return &kWasmKernels;
+#endif  // defined(MOTIVE_WASM_SIMD)
+
+#if defined(MOTIVE_X86_SIMD)
+    // There are no 512-bit functions yet.
+    case kAvx512Optimizations:
+    case kAvx2Optimizations:
+      return &kAvx2Kernels;
+
+    case kSse41Optimizations:
+      return &kSse4Kernels;
+#endif  // defined(MOTIVE_X86_SIMD)
+
+    // SSE2 through SSSE3 have no functions of their own.
+    default:
+      return nullptr;
+  }
+}
+
+// The NEON functions process four indices at a time and have no tail
+// handling, so they're only used when explicitly requested.
+static ProcessorOptimization DefaultOptimization() {
+  const ProcessorOptimization best = BestProcessorOptimization();
+  return best == kNeonOptimizations ? kNoOptimizations : best;
+}
+
+// Round `num_indices` up to a multiple of kCoefficientPadding.
+static size_t PaddedCoefficients(const BulkSplineEvaluator::Index num_indices) {
+  const size_t padding = BulkSplineEvaluator::kCoefficientPadding;
+  return (static_cast<size_t>(num_indices) + padding - 1) / padding * padding;
+}
+
+BulkSplineEvaluator::BulkSplineEvaluator()
+    : frame_(0),
+      num_active_indices_(-1),
+      num_divided_(0),
+      optimization_(DefaultOptimization()),
+      kernels_(KernelsFor(optimization_)),
+      coefficient_layout_(kInterleavedCoefficients) {
+  // The assembly test compares functions that read interleaved cubics.
+#if !defined(MOTIVE_ASSEMBLY_TEST)
+  if (kernels_ != nullptr && kernels_->evaluate_separate_cubics != nullptr) {
+    coefficient_layout_ = kSeparateCoefficients;
+  }
+#endif  // !defined(MOTIVE_ASSEMBLY_TEST)
+}
+
+void BulkSplineEvaluator::SetAllocator(MotiveAllocator* allocator) {
+  assert(NumIndices() == 0);
+  sources_ = MotiveVector<Source>(MotiveStdAllocator<Source>(allocator));
+  y_ranges_ = MotiveVector<YRange>(MotiveStdAllocator<YRange>(allocator));
+  cubic_xs_ = MotiveVector<float>(MotiveStdAllocator<float>(allocator));
+  cubic_x_ends_ = MotiveVector<float>(MotiveStdAllocator<float>(allocator));
+  playback_rates_ = MotiveVector<float>(MotiveStdAllocator<float>(allocator));
+  cubics_ =
+      MotiveVector<CubicCurve>(MotiveStdAllocator<CubicCurve>(allocator));
+  for (int j = 0; j < CubicCurve::kNumCoeff; ++j) {
+    coefficients_[j] =
+        MotiveVector<float>(MotiveStdAllocator<float>(allocator));
+  }
+  fixed_cubics_ =
+      MotiveVector<FixedCubic>(MotiveStdAllocator<FixedCubic>(allocator));
+  fixed_playback_rates_ =
+      MotiveVector<int32_t>(MotiveStdAllocator<int32_t>(allocator));
+  ys_ = MotiveVector<float>(MotiveStdAllocator<float>(allocator));
+  scratch_ = MotiveVector<Index>(MotiveStdAllocator<Index>(allocator));
+  divided_counts_ = MotiveVector<Index>(MotiveStdAllocator<Index>(allocator));
+}
+
+void BulkSplineEvaluator::set_optimization(
+    ProcessorOptimization optimization) {
+  optimization_ = optimization;
+  kernels_ = KernelsFor(optimization);
+}
+
+void BulkSplineEvaluator::set_coefficient_layout(CoefficientLayout layout) {
+  if (layout == coefficient_layout_) return;
+
+  // Every layout can read and write CubicCurves, so convert through them.
+  // The fixed-point layout also needs the current x of each index.
+  const Index num_indices = NumIndices();
+  std::vector<CubicCurve> cubics(num_indices);
+  for (Index i = 0; i < num_indices; ++i) {
+    cubics[i] = Cubic(i);
+    cubic_xs_[i] = CubicX(i);
+  }
+
+  // Free the old layout's arrays, keeping their allocator.
+  MotiveVector<CubicCurve>(cubics_.get_allocator()).swap(cubics_);
+  for (int j = 0; j < CubicCurve::kNumCoeff; ++j) {
+    MotiveVector<float>(coefficients_[j].get_allocator())
+        .swap(coefficients_[j]);
+  }
+  MotiveVector<FixedCubic>(fixed_cubics_.get_allocator()).swap(fixed_cubics_);
+  MotiveVector<int32_t>(fixed_playback_rates_.get_allocator())
+      .swap(fixed_playback_rates_);
+  coefficient_layout_ = layout;
+
+  ResizeCoefficients(num_indices);
+  for (Index i = 0; i < num_indices; ++i) {
+    SetCubic(i, cubics[i]);
+  }
+  if (layout == kFixedPointCoefficients) {
+    for (Index i = 0; i < num_indices; ++i) {
+      fixed_playback_rates_[i] = FixedCubic::PlaybackRate(playback_rates_[i]);
+    }
+  }
+}
+
+void BulkSplineEvaluator::ResizeCoefficients(const Index num_indices) {
+  switch (coefficient_layout_) {
+    case kInterleavedCoefficients:
+      cubics_.resize(num_indices);
+      break;
+
+    case kSeparateCoefficients:
+      for (int j = 0; j < CubicCurve::kNumCoeff; ++j) {
+        coefficients_[j].resize(PaddedCoefficients(num_indices), 0.0f);
+      }
+      break;
+
+    case kFixedPointCoefficients:
+      fixed_cubics_.resize(num_indices);
+      fixed_playback_rates_.resize(num_indices,
+                                   FixedCubic::PlaybackRate(1.0f));
+      break;
+  }
+}
+
 void BulkSplineEvaluator::SetNumIndices(const Index num_indices) {
+  const bool shrinking = num_indices < NumIndices();
   sources_.resize(num_indices);
   y_ranges_.resize(num_indices);
   cubic_xs_.resize(num_indices, 0.0f);
   cubic_x_ends_.resize(num_indices, 0.0f);
-  cubics_.resize(num_indices);
+  playback_rates_.resize(num_indices, 1.0f);
+  ResizeCoefficients(num_indices);
   ys_.resize(num_indices, 0.0f);
   scratch_.resize(num_indices, 0);
+
+  // New indices have no update divisors, but removed ones may have had.
+  if (shrinking) {
+    CountDividedIndices();
+  } else {
+    divided_counts_.resize(
+        (num_indices + kIndicesPerShard - 1) / kIndicesPerShard, 0);
+  }
+}
+
+void BulkSplineEvaluator::CountDividedIndices() {
+  const Index num_indices = NumIndices();
+  divided_counts_.assign(
+      (num_indices + kIndicesPerShard - 1) / kIndicesPerShard, 0);
+  num_divided_ = 0;
+  for (Index i = 0; i < num_indices; ++i) {
+    if (Divided(i)) {
+      divided_counts_[i / kIndicesPerShard]++;
+      num_divided_++;
+    }
+  }
+}
+
+void BulkSplineEvaluator::Reserve(const Index num_indices) {
+  sources_.reserve(num_indices);
+  y_ranges_.reserve(num_indices);
+  cubic_xs_.reserve(num_indices);
+  cubic_x_ends_.reserve(num_indices);
+  playback_rates_.reserve(num_indices);
+  switch (coefficient_layout_) {
+    case kInterleavedCoefficients:
+      cubics_.reserve(num_indices);
+      break;
+
+    case kSeparateCoefficients:
+      for (int j = 0; j < CubicCurve::kNumCoeff; ++j) {
+        coefficients_[j].reserve(PaddedCoefficients(num_indices));
+      }
+      break;
+
+    case kFixedPointCoefficients:
+      fixed_cubics_.reserve(num_indices);
+      fixed_playback_rates_.reserve(num_indices);
+      break;
+  }
+  ys_.reserve(num_indices);
+  scratch_.reserve(num_indices);
+  divided_counts_.reserve((num_indices + kIndicesPerShard - 1) /
+                          kIndicesPerShard);
+}
+
+void BulkSplineEvaluator::ShrinkToFit() {
+  sources_.shrink_to_fit();
+  y_ranges_.shrink_to_fit();
+  cubic_xs_.shrink_to_fit();
+  cubic_x_ends_.shrink_to_fit();
+  playback_rates_.shrink_to_fit();
+  cubics_.shrink_to_fit();
+  for (int j = 0; j < CubicCurve::kNumCoeff; ++j) {
+    coefficients_[j].shrink_to_fit();
+  }
+  fixed_cubics_.shrink_to_fit();
+  fixed_playback_rates_.shrink_to_fit();
+  ys_.shrink_to_fit();
+  scratch_.shrink_to_fit();
+  divided_counts_.shrink_to_fit();
+}
+
+void BulkSplineEvaluator::AddMemoryStats(MemoryStats* stats) const {
+  stats->AddVector(sources_);
+  stats->AddVector(y_ranges_);
+  stats->AddVector(cubic_xs_);
+  stats->AddVector(cubic_x_ends_);
+  stats->AddVector(playback_rates_);
+  stats->AddVector(cubics_);
+  for (int j = 0; j < CubicCurve::kNumCoeff; ++j) {
+    stats->AddVector(coefficients_[j]);
+  }
+  stats->AddVector(fixed_cubics_);
+  stats->AddVector(fixed_playback_rates_);
+  stats->AddVector(ys_);
+  stats->AddVector(scratch_);
+  stats->AddVector(divided_counts_);
+}
+
+void BulkSplineEvaluator::ArchiveState(MotiveStateArchive* archive) {
+  archive->LayoutValue(coefficient_layout_);
+  archive->Array(&sources_);
+  archive->Array(&y_ranges_);
+  archive->Array(&cubic_xs_);
+  archive->Array(&cubic_x_ends_);
+  archive->Array(&playback_rates_);
+  switch (coefficient_layout_) {
+    case kInterleavedCoefficients:
+      archive->Array(&cubics_);
+      break;
+    case kSeparateCoefficients:
+      for (int j = 0; j < CubicCurve::kNumCoeff; ++j) {
+        archive->Array(&coefficients_[j]);
+      }
+      break;
+    case kFixedPointCoefficients:
+      archive->Array(&fixed_cubics_);
+      archive->Array(&fixed_playback_rates_);
+      break;
+  }
+  archive->Array(&ys_);
+  archive->Value(&frame_);
+  if (archive->restoring()) CountDividedIndices();
 }
 
 void BulkSplineEvaluator::MoveIndices(
@@ -50,13 +357,33 @@ void BulkSplineEvaluator::MoveIndices(
   for (Index i = 0; i < count; ++i) {
     const Index old_i = old_index + i;
     const Index new_i = new_index + i;
+    if (Divided(new_i)) {
+      divided_counts_[new_i / kIndicesPerShard]--;
+      num_divided_--;
+    }
     sources_[new_i] = sources_[old_i];
+    if (Divided(new_i)) {
+      divided_counts_[new_i / kIndicesPerShard]++;
+      num_divided_++;
+    }
     y_ranges_[new_i] = y_ranges_[old_i];
     cubic_xs_[new_i] = cubic_xs_[old_i];
     cubic_x_ends_[new_i] = cubic_x_ends_[old_i];
-    cubics_[new_i] = cubics_[old_i];
+    playback_rates_[new_i] = playback_rates_[old_i];
+    if (coefficient_layout_ == kFixedPointCoefficients) {
+      // Copy verbatim, since converting through a CubicCurve would round.
+      fixed_cubics_[new_i] = fixed_cubics_[old_i];
+      fixed_playback_rates_[new_i] = fixed_playback_rates_[old_i];
+    } else {
+      SetCubic(new_i, Cubic(old_i));
+    }
     ys_[new_i] = ys_[old_i];
   }
+
+  // The moved indices have new neighbours.
+  for (Index i = 0; i < count; ++i) {
+    UpdateSharedXKeys(new_index + i);
+  }
 }
 
 void BulkSplineEvaluator::SetYRanges(const Index index, const Index count,
@@ -119,9 +446,10 @@ CubicInit BulkSplineEvaluator::CalculateBlendInit(
                    blend_width);
 }
 
-void BulkSplineEvaluator::BlendToSpline(const Index index,
-                                        const CompactSpline& spline,
-                                        const SplinePlayback& playback) {
+CubicInit BulkSplineEvaluator::BlendToSpline(const Index index,
+                                             const CompactSpline& spline,
+                                             const SplinePlayback& playback,
+                                             float* cubic_start_x) {
   // Calculate the spline that transitions from the current curve state
   // to the target spline's state.
   // Transition spline runs from x=0-->playback.blend_time.
@@ -134,44 +462,126 @@ void BulkSplineEvaluator::BlendToSpline(const Index index,
   float blend_start_x = 0.0f;
   const CompactSplineIndex blend_start_index = spline.IndexForXAllowingRepeat(
       playback.start_x, kInvalidSplineIndex, playback.repeat, &blend_start_x);
-  const float cubic_start_x = blend_start_x - spline.NodeX(blend_start_index);
+  *cubic_start_x = blend_start_x - spline.NodeX(blend_start_index);
 
   Source& s = sources_[index];
-  s.rate = playback.playback_rate;
+  SetPlaybackRate(index, playback.playback_rate);
   s.y_offset = playback.y_offset;
   s.y_scale = playback.y_scale;
   s.spline = &spline;
   s.x_index = blend_start_index;
   s.repeat = playback.repeat;
-  cubic_xs_[index] = cubic_start_x;
+  UpdateSharedXKeys(index);
+  cubic_xs_[index] = *cubic_start_x;
   cubic_x_ends_[index] =
-      cubic_start_x + playback.blend_x * playback.playback_rate;
-  cubics_[index].Init(blend_init);
-  cubics_[index].ShiftRight(cubic_start_x);
+      *cubic_start_x + playback.blend_x * playback.playback_rate;
+  return blend_init;
 }
 
 void BulkSplineEvaluator::JumpToSpline(const Index index,
                                        const CompactSpline& spline,
                                        const SplinePlayback& playback) {
   Source& s = sources_[index];
-  s.rate = playback.playback_rate;
+  SetPlaybackRate(index, playback.playback_rate);
   s.y_offset = playback.y_offset;
   s.y_scale = playback.y_scale;
   s.spline = &spline;
   s.x_index = kInvalidSplineIndex;
   s.repeat = playback.repeat;
-  InitCubic(index, playback.start_x);
+  UpdateSharedXKeys(index);
+}
+
+void BulkSplineEvaluator::SetPlaybackRate(const Index index,
+                                          const float playback_rate) {
+  playback_rates_[index] = playback_rate;
+  if (coefficient_layout_ == kFixedPointCoefficients) {
+    fixed_playback_rates_[index] = FixedCubic::PlaybackRate(playback_rate);
+  }
+}
+
+void BulkSplineEvaluator::UpdateSharedXKeys(const Index index) {
+  const Index end = std::min(index + 2, NumIndices());
+  for (Index i = std::max(index, 1); i < end; ++i) {
+    const CompactSpline* spline = sources_[i].spline;
+    const CompactSpline* prev_spline = sources_[i - 1].spline;
+    sources_[i].shares_x_keys = spline != nullptr && prev_spline != nullptr &&
+                                spline->SharesXKeys(*prev_spline);
+  }
 }
 
+namespace {
+
+// The blend cubics started by SetSplines(), gathered in struct-of-arrays
+// format so that they can be solved together, as in InitCubics().
+struct CubicBlendBatch {
+  static const size_t kSize = 64;
+
+  CubicBlendBatch() : count(0) {}
+
+  void Add(BulkSplineEvaluator::Index index, const CubicInit& init,
+           float shift_x) {
+    indices[count] = index;
+    start_y[count] = init.start_y;
+    start_derivative[count] = init.start_derivative;
+    end_y[count] = init.end_y;
+    end_derivative[count] = init.end_derivative;
+    width_x[count] = init.width_x;
+    cubic_start_x[count] = shift_x;
+    ++count;
+  }
+
+  // Fill in `c`, exactly as CubicCurve(init) would.
+  void Solve() {
+    float* const coefficients[] = {c[0], c[1], c[2], c[3]};
+    InitCubicCoefficients(start_y, start_derivative, end_y, end_derivative,
+                          width_x, count, coefficients);
+  }
+
+  size_t count;
+  BulkSplineEvaluator::Index indices[kSize];
+  float start_y[kSize];
+  float start_derivative[kSize];
+  float end_y[kSize];
+  float end_derivative[kSize];
+  float width_x[kSize];
+  float cubic_start_x[kSize];
+  float c[CubicCurve::kNumCoeff][kSize];
+};
+
+}  // namespace
+
 void BulkSplineEvaluator::SetSplines(
     const Index index, const Index count, const CompactSpline* splines,
     const SplinePlayback& playback) {
+  if (count <= 0) return;
+
+  // Gather the indices that jump straight to their new spline, so that their
+  // cubics can be initialized together. The slots of `scratch_` for indices
+  // [index, index + count) are free to use here.
+  Index* indices_to_init = &scratch_[index];
+  size_t num_to_init = 0;
+  Index end = index + count;
+
+  // Likewise, gather the blends, and solve their cubics a batch at a time.
+  CubicBlendBatch blends;
+  auto set_blend_cubics = [this, &blends]() {
+    blends.Solve();
+    for (size_t i = 0; i < blends.count; ++i) {
+      CubicCurve c(blends.c[3][i], blends.c[2][i], blends.c[1][i],
+                   blends.c[0][i]);
+      c.ShiftRight(blends.cubic_start_x[i]);
+      SetCubic(blends.indices[i], c);
+    }
+    blends.count = 0;
+  };
+
   const CompactSpline* spline = splines;
   for (Index i = index; i < index + count; ++i, spline = spline->Next()) {
     // `splines` should specify `count` splines, but gracefully handle the
     // case when it doesn't.
     if (spline == nullptr) {
       ClearSplines(i, count - i + index);
+      end = i;
       break;
     }
 
@@ -181,14 +591,108 @@ void BulkSplineEvaluator::SetSplines(
     const Source& s = sources_[i];
     const bool should_blend = s.spline != nullptr && playback.blend_x > 0.0f;
     if (should_blend) {
-      BlendToSpline(i, *spline, playback);
+      float cubic_start_x = 0.0f;
+      const CubicInit blend_init =
+          BlendToSpline(i, *spline, playback, &cubic_start_x);
+      blends.Add(i, blend_init, cubic_start_x);
+      if (blends.count == CubicBlendBatch::kSize) set_blend_cubics();
     } else {
       JumpToSpline(i, *spline, playback);
+      indices_to_init[num_to_init++] = i;
     }
+  }
 
-    // Update the results.
-    // TODO OPT: Evaluate these in bulk.
-    EvaluateIndex(i);
+  // Update the results.
+  set_blend_cubics();
+  InitCubics(indices_to_init, num_to_init, &playback.start_x);
+  if (index < end) {
+    EvaluateCubics(index, end);
+  }
+}
+
+void BulkSplineEvaluator::SetSplinesAt(const Index* indices,
+                                       size_t num_indices,
+                                       const CompactSpline* const* splines,
+                                       const SplinePlayback& playback) {
+  if (num_indices == 0) return;
+  const TraceScope trace("SetSplinesAt", "BulkSplineEvaluator");
+
+  // As in SetSplines(), gather the indices that jump straight to their new
+  // spline, and the blends. `indices` has no duplicates, so there are no more
+  // indices to init than there are slots in `scratch_`.
+  Index* indices_to_init = scratch_.data();
+  size_t num_to_init = 0;
+  CubicBlendBatch blends;
+  auto set_blend_cubics = [this, &blends]() {
+    blends.Solve();
+    for (size_t i = 0; i < blends.count; ++i) {
+      CubicCurve c(blends.c[3][i], blends.c[2][i], blends.c[1][i],
+                   blends.c[0][i]);
+      c.ShiftRight(blends.cubic_start_x[i]);
+      SetCubic(blends.indices[i], c);
+    }
+    blends.count = 0;
+  };
+
+  Index begin = indices[0];
+  Index end = indices[0] + 1;
+  for (size_t i = 0; i < num_indices; ++i) {
+    const Index index = indices[i];
+    assert(splines[i] != nullptr);
+    begin = std::min(begin, index);
+    end = std::max(end, index + 1);
+
+    const bool should_blend =
+        sources_[index].spline != nullptr && playback.blend_x > 0.0f;
+    if (should_blend) {
+      float cubic_start_x = 0.0f;
+      const CubicInit blend_init =
+          BlendToSpline(index, *splines[i], playback, &cubic_start_x);
+      blends.Add(index, blend_init, cubic_start_x);
+      if (blends.count == CubicBlendBatch::kSize) set_blend_cubics();
+    } else {
+      JumpToSpline(index, *splines[i], playback);
+      indices_to_init[num_to_init++] = index;
+    }
+  }
+
+  // Update the results, as in JumpToSplines().
+  set_blend_cubics();
+  InitCubics(indices_to_init, num_to_init, &playback.start_x);
+  if (static_cast<size_t>(end - begin) == num_indices) {
+    EvaluateCubics(begin, end);
+  } else {
+    for (size_t i = 0; i < num_indices; ++i) {
+      EvaluateIndex(indices[i]);
+    }
+  }
+}
+
+void BulkSplineEvaluator::JumpToSplines(const Index* indices,
+                                        size_t num_indices,
+                                        const CompactSpline* const* splines,
+                                        const SplinePlayback& playback) {
+  if (num_indices == 0) return;
+  const TraceScope trace("JumpToSplines", "BulkSplineEvaluator");
+
+  Index begin = indices[0];
+  Index end = indices[0] + 1;
+  for (size_t i = 0; i < num_indices; ++i) {
+    JumpToSpline(indices[i], *splines[i], playback);
+    begin = std::min(begin, indices[i]);
+    end = std::max(end, indices[i] + 1);
+  }
+
+  // Update the results. When the indices cover a whole range, evaluate them
+  // together. Otherwise, leave the indices in between untouched, since they
+  // may not be due this frame.
+  InitCubics(indices, num_indices, &playback.start_x);
+  if (static_cast<size_t>(end - begin) == num_indices) {
+    EvaluateCubics(begin, end);
+  } else {
+    for (size_t i = 0; i < num_indices; ++i) {
+      EvaluateIndex(indices[i]);
+    }
   }
 }
 
@@ -202,24 +706,75 @@ void BulkSplineEvaluator::Splines(const Index index, const Index count,
 void BulkSplineEvaluator::ClearSplines(const Index index, const Index count) {
   for (Index i = index; i < index + count; ++i) {
     sources_[i].spline = nullptr;
-    cubics_[i] = CubicCurve(0.0f, 0.0f, 0.0f, cubic_xs_[i]);
+    sources_[i].shares_x_keys = false;
+    const CubicCurve constant(0.0f, 0.0f, 0.0f, CubicX(i));
     cubic_xs_[i] = 0.0f;
     cubic_x_ends_[i] = std::numeric_limits<float>::infinity();
+    SetCubic(i, constant);
+  }
+  if (index + count < NumIndices()) {
+    sources_[index + count].shares_x_keys = false;
   }
 }
 
+void BulkSplineEvaluator::GetSplineState(const Index index,
+                                         SplineState* state) const {
+  const Source& s = sources_[index];
+  state->spline = s.spline;
+  state->cubic = Cubic(index);
+  state->cubic_x = CubicX(index);
+  state->cubic_x_end = cubic_x_ends_[index];
+  state->playback_rate = playback_rates_[index];
+  state->y_offset = s.y_offset;
+  state->y_scale = s.y_scale;
+  state->x_index = s.x_index;
+  state->repeat = s.repeat;
+}
+
+void BulkSplineEvaluator::SetSplineState(const Index index,
+                                         const SplineState& state) {
+  Source& s = sources_[index];
+  s.spline = state.spline;
+  s.x_index = state.spline == nullptr ? kInvalidSplineIndex : state.x_index;
+  s.y_offset = state.y_offset;
+  s.y_scale = state.y_scale;
+  s.repeat = state.repeat;
+  SetPlaybackRate(index, state.playback_rate);
+  UpdateSharedXKeys(index);
+
+  // With kFixedPointCoefficients, SetCubic() reads the x values.
+  cubic_xs_[index] = state.cubic_x;
+  cubic_x_ends_[index] = state.cubic_x_end;
+  SetCubic(index, state.cubic);
+  EvaluateIndex(index);
+}
+
 void BulkSplineEvaluator::SetXs(const Index index, const Index count,
                                 const float x) {
+  if (count <= 0) return;
+
+  Index* indices_to_init = &scratch_[index];
+  for (Index i = 0; i < count; ++i) {
+    indices_to_init[i] = index + i;
+  }
+  InitCubics(indices_to_init, count, &x);
+  EvaluateCubics(index, index + count);
+}
+
+void BulkSplineEvaluator::AdvanceXs(const Index index, const Index count,
+                                    const float delta_x) {
+  if (count <= 0) return;
+
   for (Index i = index; i < index + count; ++i) {
-    InitCubic(i, x);
-    EvaluateIndex(i);
+    InitCubic(i, X(i) + delta_x * PlaybackRate(i));
   }
+  EvaluateCubics(index, index + count);
 }
 
 void BulkSplineEvaluator::SetPlaybackRates(const Index index, const Index count,
                                            float playback_rate) {
   for (Index i = index; i < index + count; ++i) {
-    sources_[i].rate = playback_rate;
+    SetPlaybackRate(i, playback_rate);
   }
 }
 
@@ -230,30 +785,55 @@ void BulkSplineEvaluator::SetRepeating(const Index index, const Index count,
   }
 }
 
+void BulkSplineEvaluator::SetUpdateDivisors(
+    const Index index, const Index count, const MotiveUpdateDivisor& divisor) {
+  const int change = divisor.EveryFrame() ? -1 : 1;
+  for (Index i = index; i < index + count; ++i) {
+    if (Divided(i) != (change > 0)) {
+      divided_counts_[i / kIndicesPerShard] += change;
+      num_divided_ += change;
+    }
+    sources_[i].update_divisor = divisor;
+  }
+}
+
 void BulkSplineEvaluator::UpdateCubicXsAndGetMask_C(const float delta_x,
+                                                    const Index begin,
+                                                    const Index end,
                                                     uint8_t* masks) {
-  const int num_xs = NumIndices();
-  const float* x_ends = &cubic_x_ends_.front();
-  float* xs = &cubic_xs_.front();
+  const int num_xs = end - begin;
+  const float* x_ends = &cubic_x_ends_[begin];
+  const float* rates = &playback_rates_[begin];
+  float* xs = &cubic_xs_[begin];
 
   for (int i = 0; i < num_xs; ++i) {
-    xs[i] += delta_x * sources_[i].rate;
-    masks[i] = xs[i] > x_ends[i] ? 0xFF : 0x00;
+    const float step = delta_x * rates[i];
+    xs[i] += step;
+    masks[i] = xs[i] > x_ends[i] ? 0xFF : xs[i] + step > x_ends[i] ? 0x01 : 0;
   }
 }
 
-// For each non-zero mask[i], append 'i' to 'indices'.
-// Returns: final length of indices.
+// For each mask[i] of 0xFF, append 'first_index + i' to 'indices'. For each
+// mask[i] of 0x01, prepend it to the indices that end at '*rollovers'.
+// Returns: number of indices appended to 'indices'.
 // TODO OPT: Add assembly version if generated code is poor.
 static size_t ConvertMaskToIndices(const uint8_t* mask, size_t length,
-                                   BulkSplineEvaluator::Index* indices) {
+                                   BulkSplineEvaluator::Index first_index,
+                                   BulkSplineEvaluator::Index* indices,
+                                   BulkSplineEvaluator::Index** rollovers) {
   size_t num_indices = 0;
+  BulkSplineEvaluator::Index* rollover = *rollovers;
   for (size_t i = 0; i < length; ++i) {
-    indices[num_indices] = static_cast<uint16_t>(i);
-    if (mask[i] != 0) {
+    const BulkSplineEvaluator::Index index =
+        first_index + static_cast<BulkSplineEvaluator::Index>(i);
+    indices[num_indices] = index;
+    if (mask[i] == 0xFF) {
       num_indices++;
+    } else if (mask[i] != 0) {
+      *--rollover = index;
     }
   }
+  *rollovers = rollover;
   return num_indices;
 }
 
@@ -261,97 +841,406 @@ static size_t ConvertMaskToIndices(const uint8_t* mask, size_t length,
 // into a list of indices. This algorithm is best for many SIMD implementations,
 // since they have trouble converting masks into indices.
 size_t BulkSplineEvaluator::UpdateCubicXs_TwoSteps(const float delta_x,
-                                                   Index* indices_to_init) {
-  // Use last half of 'indices_to_init' as a scratch buffer for 'mask'.
-  // Must be the last half since we read 'mask' to write 'indices_to_init'
-  // in ConvertMaskToIndices().
-  const Index num_indices = NumIndices();
-  uint8_t* mask = reinterpret_cast<uint8_t*>(&indices_to_init[num_indices / 2]);
-
-  // Add delta_x to each of the cubic_xs_.
-  // Set mask[i] to 0xFF if the cubic has gone past the end of its array.
-  UpdateCubicXsAndGetMask(delta_x, mask);
-
-  // Get indices that are true 0xFF in the mask array.
-  return ConvertMaskToIndices(mask, num_indices, indices_to_init);
+                                                   const Index begin,
+                                                   const Index end,
+                                                   Index* indices_to_init,
+                                                   size_t* num_rollovers) {
+  // Masks are gathered a shard at a time, on the stack, since the front and
+  // back of 'indices_to_init' both fill up. Every chunk but the last is a
+  // whole number of kernel groups, so each one starts on a group boundary
+  // if 'begin' does.
+  uint8_t masks[kIndicesPerShard];
+  Index* rollovers_end = indices_to_init + (end - begin);
+  Index* rollovers = rollovers_end;
+  size_t num_to_init = 0;
+  for (Index chunk = begin; chunk < end; chunk += kIndicesPerShard) {
+    const Index chunk_end = std::min(chunk + kIndicesPerShard, end);
+
+    // Add delta_x to each of the cubic_xs_. Set masks[i] to 0xFF if the cubic
+    // has gone past the end of its array, and to 0x01 if it will next frame.
+    UpdateCubicXsAndGetMask(delta_x, chunk, chunk_end, masks);
+    num_to_init +=
+        ConvertMaskToIndices(masks, chunk_end - chunk, chunk,
+                             indices_to_init + num_to_init, &rollovers);
+  }
+  *num_rollovers = rollovers_end - rollovers;
+  return num_to_init;
 }
 
 // Record the indices, as we go along, for every index we need to re-init.
 // This algorithm is fastest when we process indices serially.
 size_t BulkSplineEvaluator::UpdateCubicXs_OneStep(const float delta_x,
-                                                  Index* indices_to_init) {
-  const Index num_indices = NumIndices();
+                                                  const Index begin,
+                                                  const Index end,
+                                                  Index* indices_to_init,
+                                                  size_t* num_rollovers) {
+  Index* rollovers_end = indices_to_init + (end - begin);
+  Index* rollovers = rollovers_end;
   size_t num_to_init = 0;
 
-  for (Index i = 0; i < num_indices; ++i) {
+  for (Index i = begin; i < end; ++i) {
     // Increment each cubic x value by delta_x.
-    cubic_xs_[i] += delta_x * sources_[i].rate;
+    const float step = delta_x * playback_rates_[i];
+    cubic_xs_[i] += step;
 
     // When x has gone past the end of the cubic, it should be reinitialized.
+    // When it will next frame, its next segment is worth prefetching.
     if (cubic_xs_[i] > cubic_x_ends_[i]) {
       indices_to_init[num_to_init++] = i;
+    } else if (cubic_xs_[i] + step > cubic_x_ends_[i]) {
+      *--rollovers = i;
     }
   }
+  *num_rollovers = rollovers_end - rollovers;
   return num_to_init;
 }
 
-void BulkSplineEvaluator::InitCubic(const Index index, const float start_x) {
-  // Do nothing if the requested index has no spline.
-  Source& s = sources_[index];
-  if (s.spline == nullptr) return;
+// Same as UpdateCubicXs_OneStep(), but in fixed-point. Fixed-point x's are
+// only compared inside FixedCubic::Advance(), so there are no rollovers.
+size_t BulkSplineEvaluator::UpdateFixedXs(const float delta_x,
+                                          const Index begin, const Index end,
+                                          Index* indices_to_init,
+                                          size_t* num_rollovers) {
+  *num_rollovers = 0;
+  const int64_t fixed_delta_x = FixedCubic::DeltaX(delta_x);
+  size_t num_to_init = 0;
+  for (Index i = begin; i < end; ++i) {
+    if (fixed_cubics_[i].Advance(fixed_delta_x, fixed_playback_rates_[i])) {
+      indices_to_init[num_to_init++] = i;
+    }
+  }
+  return num_to_init;
+}
 
-  // Get the spline index for start_x.
-  float new_start_x = 0.0f;
-  const CompactSplineIndex x_index = s.spline->IndexForXAllowingRepeat(
-      start_x, s.x_index + 1, s.repeat, &new_start_x);
+void BulkSplineEvaluator::InitCubic(const Index index, const float start_x) {
+  InitCubics(&index, 1, &start_x);
+}
 
-  // Update the x values for the new index.
-  const Range x_range = s.spline->RangeX(x_index);
-  cubic_xs_[index] = new_start_x - x_range.start();
+namespace {
+
+// Inputs and outputs of InitCubics(), in struct-of-arrays format so that the
+// coefficients can be solved in a single loop that the compiler vectorizes.
+struct CubicInitBatch {
+  static const size_t kSize = 64;
+
+  BulkSplineEvaluator::Index indices[kSize];
+  float start_y[kSize];
+  float start_derivative[kSize];
+  float end_y[kSize];
+  float end_derivative[kSize];
+  float width_x[kSize];
+  float y_scale[kSize];
+  float y_offset[kSize];
+  float c[CubicCurve::kNumCoeff][kSize];
+
+  // Same math as CubicCurve::Init() followed by ScaleUp() and ShiftUp(),
+  // operation for operation, so the results are identical.
+  void Solve(size_t count) {
+    float* const coefficients[] = {c[0], c[1], c[2], c[3]};
+    InitCubicCoefficients(start_y, start_derivative, end_y, end_derivative,
+                          width_x, count, coefficients);
+    for (size_t i = 0; i < count; ++i) {
+      c[0][i] = c[0][i] * y_scale[i] + y_offset[i];
+      c[1][i] *= y_scale[i];
+      c[2][i] *= y_scale[i];
+      c[3][i] *= y_scale[i];
+    }
+  }
+};
+
+}  // namespace
+
+void BulkSplineEvaluator::InitCubics(const Index* indices, size_t num_indices,
+                                     const float* start_x) {
+  CountEvent(kCounterCubicInits, num_indices);
+  CubicInitBatch batch;
+
+  // The segment lookup for the last index, so that the next index can reuse
+  // it if its spline has the same x keys.
+  struct Lookup {
+    Index index;
+    float x;
+    CompactSplineIndex guess;
+    bool repeat;
+    CompactSplineIndex x_index;
+    float start_x;
+    Range x_range;
+  };
+  Lookup last = {-1, 0.0f, 0, false, 0, 0.0f, Range()};
+
+  size_t first = 0;
+  while (first < num_indices) {
+    // Start fetching the nodes of the whole batch, so that the lookups below
+    // don't each wait on their own cache miss.
+    const size_t num_left = num_indices - first;
+    PrefetchNextSegments(&indices[first], num_left < CubicInitBatch::kSize
+                                              ? num_left
+                                              : CubicInitBatch::kSize);
+
+    // Look up the new segment of each spline. This pass is branchy, since it
+    // searches the spline nodes.
+    size_t count = 0;
+    for (; first < num_indices && count < CubicInitBatch::kSize; ++first) {
+      // Do nothing if the requested index has no spline.
+      const Index index = indices[first];
+      Source& s = sources_[index];
+      if (s.spline == nullptr) continue;
+
+      // Get the spline index for start_x. If the previous index has the same
+      // x keys and was at the same spot, it has already done the search.
+      const float x = start_x == nullptr ? X(index) : *start_x;
+      const bool reuse_lookup = s.shares_x_keys && last.index == index - 1 &&
+                                last.x == x && last.guess == s.x_index &&
+                                last.repeat == s.repeat;
+      if (!reuse_lookup) {
+        last.x = x;
+        last.guess = s.x_index;
+        last.repeat = s.repeat;
+        last.x_index = s.spline->IndexForXAllowingRepeat(
+            x, s.x_index + 1, s.repeat, &last.start_x);
+        last.x_range = s.spline->RangeX(last.x_index);
+      }
+      last.index = index;
+      const CompactSplineIndex x_index = last.x_index;
+      const Range& x_range = last.x_range;
+
+      // Update the x values for the new index.
+      cubic_xs_[index] = last.start_x - x_range.start();
+
+      // TODO OPT: Exit early if s.x_index == x_index, since we've already
+      //   initialized the cubic. This is tricky, since if we're blending then
+      //   the index might match, but the cubic curve will not mach. We should
+      //   refactor to detect that case, so we can skip over the
+      //   CreateCubicInit() call.
+      s.x_index = x_index;
+      cubic_x_ends_[index] = x_range.Length();
+
+      const CubicInit init = s.spline->CreateCubicInit(x_index);
+      batch.indices[count] = index;
+      batch.start_y[count] = init.start_y;
+      batch.start_derivative[count] = init.start_derivative;
+      batch.end_y[count] = init.end_y;
+      batch.end_derivative[count] = init.end_derivative;
+      batch.width_x[count] = init.width_x;
+      batch.y_scale[count] = s.y_scale;
+      batch.y_offset[count] = s.y_offset;
+      ++count;
+    }
 
-  // TODO OPT: Exit early if s.x_index == x_index, since we've already
-  //   initialized the cubic. This is tricky, since if we're blending then the
-  //   index might match, but the cubic curve will not mach. We should refactor
-  //   to detect that case, so we can skip over the CreateCubicInit() call.
-  s.x_index = x_index;
+    // Initialize the cubics to interpolate the new spline segments.
+    batch.Solve(count);
+    for (size_t i = 0; i < count; ++i) {
+      SetCubic(batch.indices[i],
+               CubicCurve(batch.c[3][i], batch.c[2][i], batch.c[1][i],
+                          batch.c[0][i]));
+    }
+  }
+}
 
-  // Initialize the cubic to interpolate the new spline segment.
-  cubic_x_ends_[index] = x_range.Length();
-  CubicCurve& c = cubics_[index];
-  const CubicInit init = s.spline->CreateCubicInit(x_index);
-  c.Init(init);
+void BulkSplineEvaluator::PrefetchNextSegments(const Index* indices,
+                                               size_t num_indices) const {
+  // The node pointer is read from the spline itself, so fetch all the
+  // splines first, and then all their nodes.
+  for (size_t i = 0; i < num_indices; ++i) {
+    MOTIVE_PREFETCH(sources_[indices[i]].spline);
+  }
+  for (size_t i = 0; i < num_indices; ++i) {
+    const Source& s = sources_[indices[i]];
+    if (s.spline == nullptr || OutsideSpline(s.x_index)) continue;
+
+    // The next segment spans the two nodes after the current segment's
+    // start node. Channels have no array of whole nodes to fetch from.
+    const detail::CompactSplineNode* nodes = s.spline->nodes();
+    if (nodes == nullptr) continue;
+    const CompactSplineIndex last = s.spline->LastNodeIndex();
+    MOTIVE_PREFETCH(&nodes[std::min<CompactSplineIndex>(s.x_index + 1, last)]);
+    MOTIVE_PREFETCH(&nodes[std::min<CompactSplineIndex>(s.x_index + 2, last)]);
+  }
+}
 
-  c.ScaleUp(s.y_scale);
-  c.ShiftUp(s.y_offset);
+void BulkSplineEvaluator::SetCubic(const Index index, const CubicCurve& cubic) {
+  if (coefficient_layout_ == kInterleavedCoefficients) {
+    cubics_[index] = cubic;
+    return;
+  }
+  if (coefficient_layout_ == kFixedPointCoefficients) {
+    fixed_cubics_[index].Init(cubic, cubic_xs_[index], cubic_x_ends_[index]);
+    return;
+  }
+  for (int j = 0; j < CubicCurve::kNumCoeff; ++j) {
+    coefficients_[j][index] = cubic.Coeff(j);
+  }
 }
 
 void BulkSplineEvaluator::EvaluateIndex(const Index index) {
   // Evaluate the cubic spline.
-  CubicCurve& c = cubics_[index];
-  ys_[index] = c.Evaluate(cubic_xs_[index]);
+  if (coefficient_layout_ == kFixedPointCoefficients) {
+    ys_[index] = fixed_cubics_[index].Evaluate();
+    return;
+  }
+  ys_[index] = Cubic(index).Evaluate(cubic_xs_[index]);
 }
 
-void BulkSplineEvaluator::EvaluateCubics_C() {
-  for (Index index = 0; index < NumIndices(); ++index) {
+void BulkSplineEvaluator::EvaluateCubics_C(const Index begin,
+                                           const Index end) {
+  for (Index index = begin; index < end; ++index) {
     EvaluateIndex(index);
   }
 }
 
+void BulkSplineEvaluator::EvaluateFixedCubics(const Index begin,
+                                              const Index end) {
+  for (Index index = begin; index < end; ++index) {
+    ys_[index] = fixed_cubics_[index].Evaluate();
+  }
+}
+
+void BulkSplineEvaluator::NormalizeYs_C(const Index index, const Index count,
+                                        float* ys) const {
+  for (Index i = 0; i < count; ++i) {
+    ys[i] = NormalizeY(index + i, ys[i]);
+  }
+}
+
+void BulkSplineEvaluator::NormalizeYs(const Index index, const Index count,
+                                      float* ys) const {
+  if (kernels_ != nullptr && kernels_->normalize_ys != nullptr) {
+    kernels_->normalize_ys(&y_ranges_[index], count, ys);
+  } else {
+    NormalizeYs_C(index, count, ys);
+  }
+}
+
 void BulkSplineEvaluator::AdvanceFrame(const float delta_x) {
+  AdvanceFrameShards(delta_x, 0, NumShards());
+  ++frame_;
+}
+
+// Same as the bulk path in AdvanceFrameShards(), but only reinitialize and
+// evaluate the indices that are due this frame.
+void BulkSplineEvaluator::AdvanceDividedIndices(const float delta_x,
+                                                const Index begin,
+                                                const Index end) {
+  const bool fixed_point = coefficient_layout_ == kFixedPointCoefficients;
+  const int64_t fixed_delta_x = FixedCubic::DeltaX(delta_x);
+  for (Index i = begin; i < end; ++i) {
+    // Time flows every frame, so that we catch up on the next due frame.
+    bool past_end;
+    if (fixed_point) {
+      past_end =
+          fixed_cubics_[i].Advance(fixed_delta_x, fixed_playback_rates_[i]);
+    } else {
+      cubic_xs_[i] += delta_x * playback_rates_[i];
+      past_end = cubic_xs_[i] > cubic_x_ends_[i];
+    }
+    if (!sources_[i].update_divisor.Due(frame_)) continue;
+
+    if (past_end) {
+      InitCubic(i, X(i));
+    }
+    EvaluateIndex(i);
+  }
+}
+
+// Advance a range of indices that have update divisors mixed in with
+// ordinary ones. Runs of ordinary indices still take the bulk path.
+void BulkSplineEvaluator::AdvanceMixedIndices(const float delta_x,
+                                              const Index begin,
+                                              const Index end) {
+  Index run_begin = begin;
+  while (run_begin < end) {
+    const bool divided = Divided(run_begin);
+    Index run_end = run_begin + 1;
+    while (run_end < end && Divided(run_end) == divided) ++run_end;
+    if (divided) {
+      AdvanceDividedIndices(delta_x, run_begin, run_end);
+    } else {
+      AdvanceUndividedIndices(delta_x, run_begin, run_end);
+    }
+    run_begin = run_end;
+  }
+}
+
+// Advance a run of indices without update divisors. Only whole groups of
+// KernelGroupSize() indices take the bulk path, so that the kernels never
+// touch the indices on either side of the run. The indices before the first
+// group and after the last are advanced one at a time, by the divided path,
+// for which every one of them is due.
+void BulkSplineEvaluator::AdvanceUndividedIndices(const float delta_x,
+                                                  const Index begin,
+                                                  const Index end) {
+  const Index group_size = KernelGroupSize();
+  const Index bulk_begin =
+      std::min((begin + group_size - 1) / group_size * group_size, end);
+  const Index bulk_end = std::max(bulk_begin, end / group_size * group_size);
+  AdvanceDividedIndices(delta_x, begin, bulk_begin);
+  if (bulk_begin < bulk_end) {
+    AdvanceIndices(delta_x, bulk_begin, bulk_end);
+  }
+  AdvanceDividedIndices(delta_x, bulk_end, end);
+}
+
+void BulkSplineEvaluator::AdvanceFrameShards(const float delta_x,
+                                             const Index first_shard,
+                                             const Index end_shard) {
+  const Index begin = first_shard * kIndicesPerShard;
+  const Index end =
+      std::min(end_shard * kIndicesPerShard, NumActiveIndices());
+  if (begin >= end) return;
+
+  // `end` needn't be a multiple of the kernels' group size, and the indices
+  // after it are suspended, so bulk ranges go through
+  // AdvanceUndividedIndices(), which keeps the kernels out of them.
+  if (num_divided_ == 0) {
+    AdvanceUndividedIndices(delta_x, begin, end);
+    return;
+  }
+
+  // Only shards that hold indices with update divisors are split up.
+  // Consecutive shards without any are advanced together, in bulk.
+  Index bulk_begin = begin;
+  for (Index shard = first_shard; shard * kIndicesPerShard < end; ++shard) {
+    if (divided_counts_[shard] == 0) continue;
+    const Index shard_begin = shard * kIndicesPerShard;
+    const Index shard_end = std::min(shard_begin + kIndicesPerShard, end);
+    if (bulk_begin < shard_begin) {
+      AdvanceUndividedIndices(delta_x, bulk_begin, shard_begin);
+    }
+    AdvanceMixedIndices(delta_x, shard_begin, shard_end);
+    bulk_begin = shard_end;
+  }
+  if (bulk_begin < end) {
+    AdvanceUndividedIndices(delta_x, bulk_begin, end);
+  }
+}
+
+void BulkSplineEvaluator::AdvanceIndices(const float delta_x,
+                                         const Index begin, const Index end) {
   // Add 'delta_x' to 'cubic_xs'.
-  // Gather a list of indices that are now beyond the end of the cubic.
-  Index* indices_to_init = scratch_.size() == 0 ? nullptr : &scratch_.front();
-  const size_t num_to_init = UpdateCubicXs(delta_x, indices_to_init);
+  // Gather a list of indices that are now beyond the end of the cubic, and
+  // of those that will be next frame.
+  // Each index only ever touches its own slot of 'scratch_', so shards can
+  // run concurrently without sharing a buffer.
+  Index* indices_to_init = &scratch_[begin];
+  size_t num_rollovers = 0;
+  const size_t num_to_init = UpdateCubicXs(delta_x, begin, end,
+                                           indices_to_init, &num_rollovers);
 
   // Reinitialize indices that have traversed beyond the end of their cubic.
-  for (size_t i = 0; i < num_to_init; ++i) {
-    const Index index = indices_to_init[i];
-    InitCubic(index, X(index));
+  {
+    const TraceScope trace("InitCubics", "BulkSplineEvaluator");
+    InitCubics(indices_to_init, num_to_init, nullptr);
   }
 
+  // Frames are usually the same length, so the indices that will pass the
+  // ends of their cubics next frame are known now. Start fetching their next
+  // segments, so that the fetches overlap with the evaluation below.
+  PrefetchNextSegments(indices_to_init + (end - begin) - num_rollovers,
+                       num_rollovers);
+
   // Update 'ys_' array. Also might affect the constant coefficients of
   // 'cubics_', if we're adjusting for modular arithmetic.
-  EvaluateCubics();
+  EvaluateCubics(begin, end);
 }
 
 bool BulkSplineEvaluator::Valid(const Index index) const {
@@ -359,7 +1248,7 @@ bool BulkSplineEvaluator::Valid(const Index index) const {
          sources_[index].spline != nullptr;
 }
 
-// Form the assembly function name by appending "_Neon", "_SSD2", or whatever
+// Form the assembly function name by appending "_Neon", "_Sse4", or whatever
 // MOTIVE_ASSEMBLY_TEST is defined to be.
 #define MOTIVE_TOKEN_PASTE_NESTED(a, b) a##b
 #define MOTIVE_TOKEN_PASTE(a, b) MOTIVE_TOKEN_PASTE_NESTED(a, b)
@@ -369,98 +1258,136 @@ bool BulkSplineEvaluator::Valid(const Index index) const {
 // These inline functions are used to redirect calls to the C or assembly
 // versions, or to run both versions and compare the output.
 inline void BulkSplineEvaluator::UpdateCubicXsAndGetMask(const float delta_x,
+                                                         const Index begin,
+                                                         const Index end,
                                                          uint8_t* masks) {
 #if defined(MOTIVE_ASSEMBLY_TEST)
-  const int num_xs = NumIndices();
-  std::vector<float> xs_assembly(cubic_xs_);
+  const int num_xs = end - begin;
+  std::vector<float> xs_assembly(cubic_xs_.begin() + begin,
+                                 cubic_xs_.begin() + end);
   std::vector<uint8_t> masks_assembly(num_xs);
 
-  UpdateCubicXsAndGetMask_C(delta_x, masks);
+  UpdateCubicXsAndGetMask_C(delta_x, begin, end, masks);
   MOTIVE_ASSEMBLY_FUNCTION_NAME(UpdateCubicXsAndGetMask_)(
-      delta_x, &cubic_x_ends_.front(), num_xs, &xs_assembly.front(),
-      &masks_assembly.front());
+      delta_x, &cubic_x_ends_[begin], &playback_rates_[begin], num_xs,
+      &xs_assembly.front(), &masks_assembly.front());
 
+  // The NEON function doesn't mark the indices that will pass the ends of
+  // their cubics next frame, which only costs their prefetches.
   for (int i = 0; i < num_xs; ++i) {
-    assert(cubic_xs_[i] == xs_assembly[i]);
-    assert(masks[i] == masks_assembly[i]);
+    assert(cubic_xs_[begin + i] == xs_assembly[i]);
+    assert((masks[i] == 0xFF) == (masks_assembly[i] == 0xFF));
   }
 
 #else  // not defined(MOTIVE_ASSEMBLY_TEST)
 
-#if defined(MOTIVE_NEON)
-  if (optimization_ == kNeonOptimizations) {
-    UpdateCubicXsAndGetMask_Neon(delta_x, &cubic_x_ends_.front(),
-                                  NumIndices(), &cubic_xs_.front(), masks);
-  } else
-#endif
-  {
-    UpdateCubicXsAndGetMask_C(delta_x, masks);
+  if (kernels_ != nullptr) {
+    kernels_->update_cubic_xs_and_get_mask(
+        delta_x, &cubic_x_ends_[begin], &playback_rates_[begin], end - begin,
+        &cubic_xs_[begin], masks);
+  } else {
+    UpdateCubicXsAndGetMask_C(delta_x, begin, end, masks);
   }
 
 #endif  // not defined(MOTIVE_ASSEMBLY_TEST)
 }
 
 inline size_t BulkSplineEvaluator::UpdateCubicXs(const float delta_x,
-                                                 Index* indices_to_init) {
+                                                 const Index begin,
+                                                 const Index end,
+                                                 Index* indices_to_init,
+                                                 size_t* num_rollovers) {
+  if (coefficient_layout_ == kFixedPointCoefficients) {
+    return UpdateFixedXs(delta_x, begin, end, indices_to_init, num_rollovers);
+  }
+
 #if defined(MOTIVE_ASSEMBLY_TEST)
-  std::vector<float> xs_original(cubic_xs_);
-  std::vector<Index> indices_one(NumIndices());
+  const size_t num_indices = end - begin;
+  std::vector<float> xs_original(cubic_xs_.begin() + begin,
+                                 cubic_xs_.begin() + end);
+  std::vector<Index> indices_one(num_indices);
 
-  const size_t num_one = UpdateCubicXs_OneStep(delta_x, &indices_one.front());
-  std::vector<float> xs_one(cubic_xs_);
+  size_t num_rollovers_one = 0;
+  const size_t num_one = UpdateCubicXs_OneStep(
+      delta_x, begin, end, &indices_one.front(), &num_rollovers_one);
+  std::vector<float> xs_one(cubic_xs_.begin() + begin,
+                            cubic_xs_.begin() + end);
 
-  cubic_xs_ = xs_original;
-  const size_t num_two = UpdateCubicXs_TwoSteps(delta_x, indices_to_init);
+  std::copy(xs_original.begin(), xs_original.end(), cubic_xs_.begin() + begin);
+  const size_t num_two = UpdateCubicXs_TwoSteps(delta_x, begin, end,
+                                                indices_to_init, num_rollovers);
 
   assert(num_two == num_one);
+  assert(*num_rollovers == num_rollovers_one);
   for (size_t i = 0; i < num_two; ++i) {
     assert(indices_to_init[i] == indices_one[i]);
   }
-  for (int i = 0; i < NumIndices(); ++i) {
-    assert(cubic_xs_[i] == xs_one[i]);
+  for (size_t i = num_indices - *num_rollovers; i < num_indices; ++i) {
+    assert(indices_to_init[i] == indices_one[i]);
+  }
+  for (int i = begin; i < end; ++i) {
+    assert(cubic_xs_[i] == xs_one[i - begin]);
   }
   return num_two;
 
 #else  // not defined(MOTIVE_ASSEMBLY_TEST)
 
-#if defined(MOTIVE_NEON)
-  if (optimization_ == kNeonOptimizations) {
-    return UpdateCubicXs_TwoSteps(delta_x, indices_to_init);
-  } else
-#endif
-  {
-    return UpdateCubicXs_OneStep(delta_x, indices_to_init);
+  if (kernels_ != nullptr) {
+    return UpdateCubicXs_TwoSteps(delta_x, begin, end, indices_to_init,
+                                  num_rollovers);
+  } else {
+    return UpdateCubicXs_OneStep(delta_x, begin, end, indices_to_init,
+                                 num_rollovers);
   }
 
 #endif  // not defined(MOTIVE_ASSEMBLY_TEST)
 }
 
-inline void BulkSplineEvaluator::EvaluateCubics() {
+inline void BulkSplineEvaluator::EvaluateCubics(const Index begin,
+                                                const Index end) {
+  if (coefficient_layout_ == kFixedPointCoefficients) {
+    EvaluateFixedCubics(begin, end);
+    return;
+  }
+
+  if (coefficient_layout_ == kSeparateCoefficients) {
+    if (kernels_ != nullptr && kernels_->evaluate_separate_cubics != nullptr) {
+      const float* coefficients[CubicCurve::kNumCoeff];
+      for (int j = 0; j < CubicCurve::kNumCoeff; ++j) {
+        coefficients[j] = &coefficients_[j][begin];
+      }
+      kernels_->evaluate_separate_cubics(coefficients, &cubic_xs_[begin],
+                                         end - begin, &ys_[begin]);
+    } else {
+      EvaluateCubics_C(begin, end);
+    }
+    return;
+  }
+
 #if defined(MOTIVE_ASSEMBLY_TEST)
-  std::vector<float> ys_assembly(NumIndices());
-  std::vector<CubicCurve> cubics_assembly(cubics_);
+  const int num_cubics = end - begin;
+  std::vector<float> ys_assembly(num_cubics);
+  std::vector<CubicCurve> cubics_assembly(cubics_.begin() + begin,
+                                          cubics_.begin() + end);
 
   MOTIVE_ASSEMBLY_FUNCTION_NAME(EvaluateCubics_)(
-      &cubics_assembly.front(), &cubic_xs_.front(), &y_ranges_.front(),
-      NumIndices(), &ys_assembly.front());
-  EvaluateCubics_C();
+      &cubics_assembly.front(), &cubic_xs_[begin], &y_ranges_[begin],
+      num_cubics, &ys_assembly.front());
+  EvaluateCubics_C(begin, end);
 
-  for (int i = 0; i < NumIndices(); ++i) {
-    assert(ys_assembly[i] == ys_[i]);
+  for (int i = 0; i < num_cubics; ++i) {
+    assert(ys_assembly[i] == ys_[begin + i]);
   }
-  for (int i = 0; i < NumIndices(); ++i) {
-    assert(cubics_assembly[i] == cubics_[i]);
+  for (int i = 0; i < num_cubics; ++i) {
+    assert(cubics_assembly[i] == cubics_[begin + i]);
   }
 #else  // not defined(MOTIVE_ASSEMBLY_TEST)
 
-#if defined(MOTIVE_NEON)
-  if (optimization_ == kNeonOptimizations) {
-    EvaluateCubics_Neon(&cubics_.front(), &cubic_xs_.front(),
-                        &y_ranges_.front(), NumIndices(), &ys_.front());
-  } else
-#endif
-  {
-      EvaluateCubics_C();
+  if (kernels_ != nullptr) {
+    kernels_->evaluate_cubics(&cubics_[begin], &cubic_xs_[begin],
+                              &y_ranges_[begin], end - begin, &ys_[begin]);
+  } else {
+    EvaluateCubics_C(begin, end);
   }
 
 #endif  // not defined(MOTIVE_ASSEMBLY_TEST)
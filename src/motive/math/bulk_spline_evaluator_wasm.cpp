@@ -0,0 +1,193 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include "motive/math/curve.h"
+#include "motive/math/range.h"
+#include "motive/util/optimizations.h"
+
+#if defined(MOTIVE_WASM_SIMD)
+
+#include <wasm_simd128.h>
+
+namespace motive {
+
+// The kernels below read the coefficients of four cubics at a time.
+static_assert(sizeof(CubicCurve) == CubicCurve::kNumCoeff * sizeof(float),
+              "CubicCurve must be tightly packed");
+
+// The y_ranges passed to NormalizeYs_Wasm() are BulkSplineEvaluator::YRanges,
+// which are private, but hold just one Range.
+static_assert(sizeof(Range) == 2 * sizeof(float),
+              "Range must hold only its start and end");
+
+// Operations are performed in the same order as in the C++ versions. WASM
+// SIMD has no fused multiply-add, so the results match bit-for-bit. This lets
+// MOTIVE_ASSEMBLY_TEST compare them exactly.
+
+static inline void UpdateCubicXsAndGetMask_Scalar(
+    const float delta_x, const float* x_ends, const float* playback_rates,
+    int begin, int end, float* xs, uint8_t* masks) {
+  for (int i = begin; i < end; ++i) {
+    const float step = delta_x * playback_rates[i];
+    xs[i] += step;
+    masks[i] = xs[i] > x_ends[i] ? 0xFF : xs[i] + step > x_ends[i] ? 0x01 : 0;
+  }
+}
+
+static inline void EvaluateCubics_Scalar(const CubicCurve* cubics,
+                                         const float* xs, int begin, int end,
+                                         float* ys) {
+  for (int i = begin; i < end; ++i) {
+    ys[i] = cubics[i].Evaluate(xs[i]);
+  }
+}
+
+static inline void EvaluateSeparateCubics_Scalar(
+    const float* const* coefficients, const float* xs, int begin, int end,
+    float* ys) {
+  for (int i = begin; i < end; ++i) {
+    const float x = xs[i];
+    ys[i] = ((coefficients[3][i] * x + coefficients[2][i]) * x +
+             coefficients[1][i]) * x + coefficients[0][i];
+  }
+}
+
+static inline void NormalizeYs_Scalar(const Range* ranges, int begin, int end,
+                                      float* ys) {
+  for (int i = begin; i < end; ++i) {
+    const Range& r = ranges[i];
+    ys[i] = r.Valid() ? r.NormalizeCloseValue(ys[i]) : ys[i];
+  }
+}
+
+void UpdateCubicXsAndGetMask_Wasm(const float& delta_x, const float* x_ends,
+                                  const float* playback_rates, int num_xs,
+                                  float* xs, uint8_t* masks) {
+  const v128_t delta = wasm_f32x4_splat(delta_x);
+  const v128_t one = wasm_i32x4_splat(1);
+  int i = 0;
+  for (; i + 4 <= num_xs; i += 4) {
+    // xs[i] += delta_x * playback_rates[i]
+    const v128_t step =
+        wasm_f32x4_mul(delta, wasm_v128_load(&playback_rates[i]));
+    const v128_t x = wasm_f32x4_add(wasm_v128_load(&xs[i]), step);
+    wasm_v128_store(&xs[i], x);
+
+    // 0xFFFFFFFF past the end, 0x00000001 past it after another step, or
+    // 0x00000000 per lane, saturated down to one byte per lane.
+    const v128_t x_end = wasm_v128_load(&x_ends[i]);
+    const v128_t next = wasm_f32x4_gt(wasm_f32x4_add(x, step), x_end);
+    const v128_t mask32 =
+        wasm_v128_or(wasm_f32x4_gt(x, x_end), wasm_v128_and(next, one));
+    const v128_t mask16 = wasm_i16x8_narrow_i32x4(mask32, mask32);
+    const v128_t mask8 = wasm_i8x16_narrow_i16x8(mask16, mask16);
+    const int32_t packed = wasm_i32x4_extract_lane(mask8, 0);
+    memcpy(&masks[i], &packed, sizeof(packed));
+  }
+  UpdateCubicXsAndGetMask_Scalar(delta_x, x_ends, playback_rates, i, num_xs,
+                                 xs, masks);
+}
+
+void EvaluateCubics_Wasm(const CubicCurve* cubics, const float* xs,
+                         const void* /*y_ranges*/, int num_cubics, float* ys) {
+  const float* coeffs = reinterpret_cast<const float*>(cubics);
+  int i = 0;
+  for (; i + 4 <= num_cubics; i += 4) {
+    // Deinterleave the coefficients so that each one gets a register.
+    const float* c = &coeffs[i * CubicCurve::kNumCoeff];
+    const v128_t r0 = wasm_v128_load(c);
+    const v128_t r1 = wasm_v128_load(c + 4);
+    const v128_t r2 = wasm_v128_load(c + 8);
+    const v128_t r3 = wasm_v128_load(c + 12);
+    const v128_t t0 = wasm_i32x4_shuffle(r0, r1, 0, 4, 1, 5);
+    const v128_t t1 = wasm_i32x4_shuffle(r0, r1, 2, 6, 3, 7);
+    const v128_t t2 = wasm_i32x4_shuffle(r2, r3, 0, 4, 1, 5);
+    const v128_t t3 = wasm_i32x4_shuffle(r2, r3, 2, 6, 3, 7);
+    const v128_t c0 = wasm_i32x4_shuffle(t0, t2, 0, 1, 4, 5);
+    const v128_t c1 = wasm_i32x4_shuffle(t0, t2, 2, 3, 6, 7);
+    const v128_t c2 = wasm_i32x4_shuffle(t1, t3, 0, 1, 4, 5);
+    const v128_t c3 = wasm_i32x4_shuffle(t1, t3, 2, 3, 6, 7);
+
+    // y = ((c3*x + c2)*x + c1)*x + c0
+    const v128_t x = wasm_v128_load(&xs[i]);
+    v128_t y = wasm_f32x4_add(wasm_f32x4_mul(c3, x), c2);
+    y = wasm_f32x4_add(wasm_f32x4_mul(y, x), c1);
+    y = wasm_f32x4_add(wasm_f32x4_mul(y, x), c0);
+    wasm_v128_store(&ys[i], y);
+  }
+  EvaluateCubics_Scalar(cubics, xs, i, num_cubics, ys);
+}
+
+// Same as above, but with each coefficient in its own array. No transpose is
+// necessary.
+void EvaluateSeparateCubics_Wasm(const float* const* coefficients,
+                                 const float* xs, int num_cubics, float* ys) {
+  const float* c0 = coefficients[0];
+  const float* c1 = coefficients[1];
+  const float* c2 = coefficients[2];
+  const float* c3 = coefficients[3];
+  int i = 0;
+  for (; i + 4 <= num_cubics; i += 4) {
+    // y = ((c3*x + c2)*x + c1)*x + c0
+    const v128_t x = wasm_v128_load(&xs[i]);
+    v128_t y = wasm_f32x4_add(wasm_f32x4_mul(wasm_v128_load(&c3[i]), x),
+                              wasm_v128_load(&c2[i]));
+    y = wasm_f32x4_add(wasm_f32x4_mul(y, x), wasm_v128_load(&c1[i]));
+    y = wasm_f32x4_add(wasm_f32x4_mul(y, x), wasm_v128_load(&c0[i]));
+    wasm_v128_store(&ys[i], y);
+  }
+  EvaluateSeparateCubics_Scalar(coefficients, xs, i, num_cubics, ys);
+}
+
+void NormalizeYs_Wasm(const void* y_ranges, int num_ys, float* ys) {
+  const Range* ranges = static_cast<const Range*>(y_ranges);
+  const float* bounds = static_cast<const float*>(y_ranges);
+  int i = 0;
+  for (; i + 4 <= num_ys; i += 4) {
+    // Deinterleave the starts and ends of four ranges.
+    const v128_t r01 = wasm_v128_load(&bounds[2 * i]);
+    const v128_t r23 = wasm_v128_load(&bounds[2 * i + 4]);
+    const v128_t start = wasm_i32x4_shuffle(r01, r23, 0, 2, 4, 6);
+    const v128_t end = wasm_i32x4_shuffle(r01, r23, 1, 3, 5, 7);
+    const v128_t length = wasm_f32x4_sub(end, start);
+
+    // Move y one length towards its range, as the first pass of
+    // Range::NormalizeCloseValue() does. Invalid ranges leave y alone.
+    const v128_t y = wasm_v128_load(&ys[i]);
+    const v128_t valid = wasm_f32x4_le(start, end);
+    const v128_t below = wasm_v128_and(valid, wasm_f32x4_le(y, start));
+    const v128_t above = wasm_v128_and(valid, wasm_f32x4_gt(y, end));
+    v128_t adjusted = wasm_v128_bitselect(wasm_f32x4_add(y, length), y, below);
+    adjusted =
+        wasm_v128_bitselect(wasm_f32x4_sub(y, length), adjusted, above);
+
+    // The rare y that was more than one length away takes the C++ path, for
+    // all four lanes.
+    const v128_t outside = wasm_v128_and(
+        valid, wasm_v128_or(wasm_f32x4_le(adjusted, start),
+                            wasm_f32x4_gt(adjusted, end)));
+    if (wasm_v128_any_true(outside)) {
+      NormalizeYs_Scalar(ranges, i, i + 4, ys);
+    } else {
+      wasm_v128_store(&ys[i], adjusted);
+    }
+  }
+  NormalizeYs_Scalar(ranges, i, num_ys, ys);
+}
+
+}  // namespace motive
+
+#endif  // defined(MOTIVE_WASM_SIMD)
@@ -0,0 +1,328 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include "motive/math/curve.h"
+#include "motive/math/range.h"
+#include "motive/util/optimizations.h"
+
+#if defined(MOTIVE_X86_SIMD)
+
+#include <immintrin.h>
+
+// Compile each kernel for its own instruction set, so that the rest of the
+// library can still run on processors without it. Functions are only called
+// once BestProcessorOptimization() has confirmed support.
+#if defined(__GNUC__) || defined(__clang__)
+#define MOTIVE_TARGET(isa) __attribute__((target(isa)))
+#else
+#define MOTIVE_TARGET(isa)
+#endif
+
+namespace motive {
+
+// The kernels below read the coefficients of four cubics at a time.
+static_assert(sizeof(CubicCurve) == CubicCurve::kNumCoeff * sizeof(float),
+              "CubicCurve must be tightly packed");
+
+// The y_ranges passed to the NormalizeYs functions are
+// BulkSplineEvaluator::YRanges, which are private, but hold just one Range.
+static_assert(sizeof(Range) == 2 * sizeof(float),
+              "Range must hold only its start and end");
+
+// Operations are performed in the same order as in the C++ versions, and
+// without fused multiply-adds, so the results match bit-for-bit. This lets
+// MOTIVE_ASSEMBLY_TEST compare them exactly.
+
+static inline void UpdateCubicXsAndGetMask_Scalar(
+    const float delta_x, const float* x_ends, const float* playback_rates,
+    int begin, int end, float* xs, uint8_t* masks) {
+  for (int i = begin; i < end; ++i) {
+    const float step = delta_x * playback_rates[i];
+    xs[i] += step;
+    masks[i] = xs[i] > x_ends[i] ? 0xFF : xs[i] + step > x_ends[i] ? 0x01 : 0;
+  }
+}
+
+static inline void EvaluateCubics_Scalar(const CubicCurve* cubics,
+                                         const float* xs, int begin, int end,
+                                         float* ys) {
+  for (int i = begin; i < end; ++i) {
+    ys[i] = cubics[i].Evaluate(xs[i]);
+  }
+}
+
+static inline void EvaluateSeparateCubics_Scalar(
+    const float* const* coefficients, const float* xs, int begin, int end,
+    float* ys) {
+  for (int i = begin; i < end; ++i) {
+    const float x = xs[i];
+    ys[i] = ((coefficients[3][i] * x + coefficients[2][i]) * x +
+             coefficients[1][i]) * x + coefficients[0][i];
+  }
+}
+
+static inline void NormalizeYs_Scalar(const Range* ranges, int begin, int end,
+                                      float* ys) {
+  for (int i = begin; i < end; ++i) {
+    const Range& r = ranges[i];
+    ys[i] = r.Valid() ? r.NormalizeCloseValue(ys[i]) : ys[i];
+  }
+}
+
+MOTIVE_TARGET("sse4.1")
+void UpdateCubicXsAndGetMask_Sse4(const float& delta_x, const float* x_ends,
+                                  const float* playback_rates, int num_xs,
+                                  float* xs, uint8_t* masks) {
+  const __m128 delta = _mm_set1_ps(delta_x);
+  const __m128i one = _mm_set1_epi32(1);
+  int i = 0;
+  for (; i + 4 <= num_xs; i += 4) {
+    // xs[i] += delta_x * playback_rates[i]
+    const __m128 step = _mm_mul_ps(delta, _mm_loadu_ps(&playback_rates[i]));
+    const __m128 x = _mm_add_ps(_mm_loadu_ps(&xs[i]), step);
+    _mm_storeu_ps(&xs[i], x);
+
+    // 0xFFFFFFFF past the end, 0x00000001 past it after another step, or
+    // 0x00000000 per lane, saturated down to one byte per lane.
+    const __m128 x_end = _mm_loadu_ps(&x_ends[i]);
+    const __m128i past = _mm_castps_si128(_mm_cmpgt_ps(x, x_end));
+    const __m128i next =
+        _mm_castps_si128(_mm_cmpgt_ps(_mm_add_ps(x, step), x_end));
+    const __m128i mask32 = _mm_or_si128(past, _mm_and_si128(next, one));
+    const __m128i mask16 = _mm_packs_epi32(mask32, mask32);
+    const __m128i mask8 = _mm_packs_epi16(mask16, mask16);
+    const int32_t packed = _mm_cvtsi128_si32(mask8);
+    memcpy(&masks[i], &packed, sizeof(packed));
+  }
+  UpdateCubicXsAndGetMask_Scalar(delta_x, x_ends, playback_rates, i, num_xs,
+                                 xs, masks);
+}
+
+MOTIVE_TARGET("sse4.1")
+void EvaluateCubics_Sse4(const CubicCurve* cubics, const float* xs,
+                         const void* /*y_ranges*/, int num_cubics, float* ys) {
+  const float* coeffs = reinterpret_cast<const float*>(cubics);
+  int i = 0;
+  for (; i + 4 <= num_cubics; i += 4) {
+    // Deinterleave the coefficients so that each one gets a register.
+    const float* c = &coeffs[i * CubicCurve::kNumCoeff];
+    __m128 c0 = _mm_loadu_ps(c);
+    __m128 c1 = _mm_loadu_ps(c + 4);
+    __m128 c2 = _mm_loadu_ps(c + 8);
+    __m128 c3 = _mm_loadu_ps(c + 12);
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+    // y = ((c3*x + c2)*x + c1)*x + c0
+    const __m128 x = _mm_loadu_ps(&xs[i]);
+    __m128 y = _mm_add_ps(_mm_mul_ps(c3, x), c2);
+    y = _mm_add_ps(_mm_mul_ps(y, x), c1);
+    y = _mm_add_ps(_mm_mul_ps(y, x), c0);
+    _mm_storeu_ps(&ys[i], y);
+  }
+  EvaluateCubics_Scalar(cubics, xs, i, num_cubics, ys);
+}
+
+// Same as above, but with each coefficient in its own array. No transpose is
+// necessary.
+MOTIVE_TARGET("sse4.1")
+void EvaluateSeparateCubics_Sse4(const float* const* coefficients,
+                                 const float* xs, int num_cubics, float* ys) {
+  const float* c0 = coefficients[0];
+  const float* c1 = coefficients[1];
+  const float* c2 = coefficients[2];
+  const float* c3 = coefficients[3];
+  int i = 0;
+  for (; i + 4 <= num_cubics; i += 4) {
+    // y = ((c3*x + c2)*x + c1)*x + c0
+    const __m128 x = _mm_loadu_ps(&xs[i]);
+    __m128 y = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&c3[i]), x),
+                          _mm_loadu_ps(&c2[i]));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_loadu_ps(&c1[i]));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_loadu_ps(&c0[i]));
+    _mm_storeu_ps(&ys[i], y);
+  }
+  EvaluateSeparateCubics_Scalar(coefficients, xs, i, num_cubics, ys);
+}
+
+MOTIVE_TARGET("sse4.1")
+void NormalizeYs_Sse4(const void* y_ranges, int num_ys, float* ys) {
+  const Range* ranges = static_cast<const Range*>(y_ranges);
+  const float* bounds = static_cast<const float*>(y_ranges);
+  int i = 0;
+  for (; i + 4 <= num_ys; i += 4) {
+    // Deinterleave the starts and ends of four ranges.
+    const __m128 r01 = _mm_loadu_ps(&bounds[2 * i]);
+    const __m128 r23 = _mm_loadu_ps(&bounds[2 * i + 4]);
+    const __m128 start = _mm_shuffle_ps(r01, r23, _MM_SHUFFLE(2, 0, 2, 0));
+    const __m128 end = _mm_shuffle_ps(r01, r23, _MM_SHUFFLE(3, 1, 3, 1));
+    const __m128 length = _mm_sub_ps(end, start);
+
+    // Move y one length towards its range, as the first pass of
+    // Range::NormalizeCloseValue() does. Invalid ranges leave y alone.
+    const __m128 y = _mm_loadu_ps(&ys[i]);
+    const __m128 valid = _mm_cmple_ps(start, end);
+    const __m128 below = _mm_and_ps(valid, _mm_cmple_ps(y, start));
+    const __m128 above = _mm_and_ps(valid, _mm_cmpgt_ps(y, end));
+    __m128 adjusted = _mm_blendv_ps(y, _mm_add_ps(y, length), below);
+    adjusted = _mm_blendv_ps(adjusted, _mm_sub_ps(y, length), above);
+
+    // The rare y that was more than one length away takes the C++ path, for
+    // all four lanes.
+    const __m128 outside = _mm_and_ps(
+        valid, _mm_or_ps(_mm_cmple_ps(adjusted, start),
+                         _mm_cmpgt_ps(adjusted, end)));
+    if (_mm_movemask_ps(outside) != 0) {
+      NormalizeYs_Scalar(ranges, i, i + 4, ys);
+    } else {
+      _mm_storeu_ps(&ys[i], adjusted);
+    }
+  }
+  NormalizeYs_Scalar(ranges, i, num_ys, ys);
+}
+
+MOTIVE_TARGET("avx2")
+void UpdateCubicXsAndGetMask_Avx2(const float& delta_x, const float* x_ends,
+                                  const float* playback_rates, int num_xs,
+                                  float* xs, uint8_t* masks) {
+  const __m256 delta = _mm256_set1_ps(delta_x);
+  const __m256i one = _mm256_set1_epi32(1);
+  int i = 0;
+  for (; i + 8 <= num_xs; i += 8) {
+    // xs[i] += delta_x * playback_rates[i]
+    const __m256 step =
+        _mm256_mul_ps(delta, _mm256_loadu_ps(&playback_rates[i]));
+    const __m256 x = _mm256_add_ps(_mm256_loadu_ps(&xs[i]), step);
+    _mm256_storeu_ps(&xs[i], x);
+
+    // 0xFFFFFFFF past the end, 0x00000001 past it after another step, or
+    // 0x00000000 per lane, saturated down to one byte per lane.
+    const __m256 x_end = _mm256_loadu_ps(&x_ends[i]);
+    const __m256i past =
+        _mm256_castps_si256(_mm256_cmp_ps(x, x_end, _CMP_GT_OQ));
+    const __m256i next = _mm256_castps_si256(
+        _mm256_cmp_ps(_mm256_add_ps(x, step), x_end, _CMP_GT_OQ));
+    const __m256i mask32 = _mm256_or_si256(past, _mm256_and_si256(next, one));
+    const __m128i mask16 = _mm_packs_epi32(_mm256_castsi256_si128(mask32),
+                                           _mm256_extracti128_si256(mask32, 1));
+    const __m128i mask8 = _mm_packs_epi16(mask16, mask16);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(&masks[i]), mask8);
+  }
+  UpdateCubicXsAndGetMask_Scalar(delta_x, x_ends, playback_rates, i, num_xs,
+                                 xs, masks);
+}
+
+MOTIVE_TARGET("avx2")
+void EvaluateCubics_Avx2(const CubicCurve* cubics, const float* xs,
+                         const void* /*y_ranges*/, int num_cubics, float* ys) {
+  const float* coeffs = reinterpret_cast<const float*>(cubics);
+  int i = 0;
+  for (; i + 8 <= num_cubics; i += 8) {
+    // Load cubics i..i+3 into the low lanes and i+4..i+7 into the high lanes.
+    const float* c = &coeffs[i * CubicCurve::kNumCoeff];
+    const __m256 r0 = _mm256_insertf128_ps(
+        _mm256_castps128_ps256(_mm_loadu_ps(c)), _mm_loadu_ps(c + 16), 1);
+    const __m256 r1 = _mm256_insertf128_ps(
+        _mm256_castps128_ps256(_mm_loadu_ps(c + 4)), _mm_loadu_ps(c + 20), 1);
+    const __m256 r2 = _mm256_insertf128_ps(
+        _mm256_castps128_ps256(_mm_loadu_ps(c + 8)), _mm_loadu_ps(c + 24), 1);
+    const __m256 r3 = _mm256_insertf128_ps(
+        _mm256_castps128_ps256(_mm_loadu_ps(c + 12)), _mm_loadu_ps(c + 28), 1);
+
+    // Transpose each 128-bit lane so that each coefficient gets a register.
+    const __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+    const __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+    const __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+    const __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+    const __m256 c0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    const __m256 c1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    const __m256 c2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    const __m256 c3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+
+    // y = ((c3*x + c2)*x + c1)*x + c0
+    const __m256 x = _mm256_loadu_ps(&xs[i]);
+    __m256 y = _mm256_add_ps(_mm256_mul_ps(c3, x), c2);
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), c1);
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), c0);
+    _mm256_storeu_ps(&ys[i], y);
+  }
+  EvaluateCubics_Scalar(cubics, xs, i, num_cubics, ys);
+}
+
+// Same as above, but with each coefficient in its own array. No transpose is
+// necessary.
+MOTIVE_TARGET("avx2")
+void EvaluateSeparateCubics_Avx2(const float* const* coefficients,
+                                 const float* xs, int num_cubics, float* ys) {
+  const float* c0 = coefficients[0];
+  const float* c1 = coefficients[1];
+  const float* c2 = coefficients[2];
+  const float* c3 = coefficients[3];
+  int i = 0;
+  for (; i + 8 <= num_cubics; i += 8) {
+    // y = ((c3*x + c2)*x + c1)*x + c0
+    const __m256 x = _mm256_loadu_ps(&xs[i]);
+    __m256 y = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(&c3[i]), x),
+                             _mm256_loadu_ps(&c2[i]));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_loadu_ps(&c1[i]));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_loadu_ps(&c0[i]));
+    _mm256_storeu_ps(&ys[i], y);
+  }
+  EvaluateSeparateCubics_Scalar(coefficients, xs, i, num_cubics, ys);
+}
+
+// Same as NormalizeYs_Sse4(), eight at a time.
+MOTIVE_TARGET("avx2")
+void NormalizeYs_Avx2(const void* y_ranges, int num_ys, float* ys) {
+  const Range* ranges = static_cast<const Range*>(y_ranges);
+  const float* bounds = static_cast<const float*>(y_ranges);
+  int i = 0;
+  for (; i + 8 <= num_ys; i += 8) {
+    // Shuffling within each 128-bit lane gives the starts in the order
+    // 0, 1, 4, 5, 2, 3, 6, 7, so swap the middle pairs back.
+    const __m256 r0 = _mm256_loadu_ps(&bounds[2 * i]);
+    const __m256 r1 = _mm256_loadu_ps(&bounds[2 * i + 8]);
+    const __m256 start = _mm256_castpd_ps(_mm256_permute4x64_pd(
+        _mm256_castps_pd(_mm256_shuffle_ps(r0, r1, _MM_SHUFFLE(2, 0, 2, 0))),
+        _MM_SHUFFLE(3, 1, 2, 0)));
+    const __m256 end = _mm256_castpd_ps(_mm256_permute4x64_pd(
+        _mm256_castps_pd(_mm256_shuffle_ps(r0, r1, _MM_SHUFFLE(3, 1, 3, 1))),
+        _MM_SHUFFLE(3, 1, 2, 0)));
+    const __m256 length = _mm256_sub_ps(end, start);
+
+    const __m256 y = _mm256_loadu_ps(&ys[i]);
+    const __m256 valid = _mm256_cmp_ps(start, end, _CMP_LE_OQ);
+    const __m256 below =
+        _mm256_and_ps(valid, _mm256_cmp_ps(y, start, _CMP_LE_OQ));
+    const __m256 above =
+        _mm256_and_ps(valid, _mm256_cmp_ps(y, end, _CMP_GT_OQ));
+    __m256 adjusted = _mm256_blendv_ps(y, _mm256_add_ps(y, length), below);
+    adjusted = _mm256_blendv_ps(adjusted, _mm256_sub_ps(y, length), above);
+
+    const __m256 outside = _mm256_and_ps(
+        valid, _mm256_or_ps(_mm256_cmp_ps(adjusted, start, _CMP_LE_OQ),
+                            _mm256_cmp_ps(adjusted, end, _CMP_GT_OQ)));
+    if (_mm256_movemask_ps(outside) != 0) {
+      NormalizeYs_Scalar(ranges, i, i + 8, ys);
+    } else {
+      _mm256_storeu_ps(&ys[i], adjusted);
+    }
+  }
+  NormalizeYs_Scalar(ranges, i, num_ys, ys);
+}
+
+}  // namespace motive
+
+#endif  // defined(MOTIVE_X86_SIMD)
@@ -17,10 +17,13 @@
 #include <vector>
 #include "motive/math/bulk_spline_evaluator.h"
 #include "motive/math/dual_cubic.h"
+#include "motive/task_scheduler.h"
+#include "motive/util/counters.h"
 
 namespace motive {
 
 using mathfu::Lerp;
+using detail::CompactSplineChannelNode;
 using detail::CompactSplineNode;
 
 // static constants
@@ -38,6 +41,9 @@ const float CompactSplineNode::kAngleScale =
     static_cast<float>(-M_PI / static_cast<double>(kMinAngle));
 static const float kYRangeBufferPercent = 1.05f;
 
+// Minimum number of splines baked by each task of BakeYs().
+static const int kMinSplinesPerBakeTask = 16;
+
 // YsBulkOutput records the evaluated y and derivative values into 2D arrays.
 // Arrays are of length num_points * num_splines.
 class YsBulkOutput : public CompactSpline::BulkOutput {
@@ -119,9 +125,28 @@ void CompactSpline::InitFromSpline(const CompactSpline& spline) {
                       delta_x, max_nodes_, &out);
 }
 
+void CompactSpline::InitView(const Range& y_range, const float x_granularity,
+                             const CompactSplineNode* nodes,
+                             CompactSplineIndex num_nodes) {
+  assert(nodes != nullptr || num_nodes == 0);
+  Init(y_range, x_granularity);
+  external_ = nodes;
+  num_nodes_ = num_nodes;
+
+  // Same spacing check as AddNodeVerbatim(), but over all the nodes at once.
+  if (num_nodes < 2) return;
+  const CompactSplineXGrain step =
+      static_cast<CompactSplineXGrain>(nodes[1].x() - nodes[0].x());
+  for (CompactSplineIndex i = 2; i < num_nodes; ++i) {
+    if (nodes[i].x() - nodes[i - 1].x() != step) return;
+  }
+  uniform_x_step_ = step;
+}
+
 void CompactSpline::AddNode(const float x, const float y,
                             const float derivative,
                             const CompactSplineAddMethod method) {
+  assert(!IsView());
   const CompactSplineNode new_node(x, y, derivative, x_granularity_, y_range_);
 
   // Precondition: Nodes must come *after* or *at* the last node.
@@ -139,7 +164,7 @@ void CompactSpline::AddNode(const float x, const float y,
     // a discontinuity, but for any more, the middle points will just take up
     // space, so remove it.
     const bool already_ends_in_discontinuity =
-        num_nodes_ >= 2 && Back().x() == nodes_[num_nodes_ - 2].x();
+        num_nodes_ >= 2 && Back().x() == QuantizedX(num_nodes_ - 2);
     if (already_ends_in_discontinuity) num_nodes_--;
   }
 
@@ -147,7 +172,7 @@ void CompactSpline::AddNode(const float x, const float y,
   const bool add_middle_node =
       !discontinuity && method == kEnsureCubicWellBehaved && num_nodes_ != 0;
   if (add_middle_node) {
-    const CompactSplineNode& last_node = Back();
+    const CompactSplineNode last_node = Back();
     const CubicInit init = CreateCubicInit(last_node, new_node);
     const CubicCurve curve(init);
 
@@ -192,14 +217,14 @@ float CompactSpline::NodeX(const CompactSplineIndex index) const {
   if (index == kAfterSplineIndex) return EndX();
   if (index == kBeforeSplineIndex) return 0.0f;
   assert(index < num_nodes_);
-  return nodes_[index].X(x_granularity_);
+  return Node(index).X(x_granularity_);
 }
 
 float CompactSpline::NodeY(const CompactSplineIndex index) const {
   if (index == kAfterSplineIndex) return EndY();
   if (index == kBeforeSplineIndex) return StartY();
   assert(index < num_nodes_);
-  return nodes_[index].Y(y_range_);
+  return Node(index).Y(y_range_);
 }
 
 float CompactSpline::CalculatedSlowly(const float x,
@@ -220,6 +245,64 @@ float CompactSpline::CalculatedSlowly(const float x,
   return CurveValue<CubicCurve>(cubic, cubic_x, value_type);
 }
 
+float CompactSplineCursor::Calculated(float x, CurveValueType value_type) {
+  if (!SegmentContainsX(x)) Seek(x);
+
+  // The curve is flat outside the bounds, so all derivatives outside the
+  // bounds are 0.
+  if (OutsideSpline(index_)) {
+    return value_type == kCurveValue ? cubic_.Evaluate(0.0f) : 0.0f;
+  }
+  return CurveValue<CubicCurve>(cubic_, x - start_x_, value_type);
+}
+
+void CompactSplineCursor::Ys(float start_x, float delta_x, size_t num_points,
+                             float* ys, float* derivatives) {
+  float x = start_x;
+  for (size_t i = 0; i < num_points; ++i, x += delta_x) {
+    ys[i] = Calculated(x, kCurveValue);
+    if (derivatives != nullptr) {
+      derivatives[i] = Calculated(x, kCurveDerivative);
+    }
+  }
+}
+
+bool CompactSplineCursor::SegmentContainsX(float x) const {
+  if (index_ == kInvalidSplineIndex) return false;
+
+  // Like IndexForX(), the end of the spline belongs to the last segment.
+  if (index_ == kAfterSplineIndex) return x > start_x_;
+  if (index_ == spline_->LastSegmentIndex()) {
+    return start_x_ <= x && x <= end_x_;
+  }
+  return start_x_ <= x && x < end_x_;
+}
+
+void CompactSplineCursor::Seek(float x) {
+  assert(spline_ != nullptr);
+
+  // IndexForX() checks its guess before searching, so guess the adjacent
+  // segment in the direction of `x`.
+  CompactSplineIndex guess = 0;
+  if (!OutsideSpline(index_)) {
+    guess = x >= end_x_ ? index_ + 1 : index_ > 0 ? index_ - 1 : 0;
+  }
+  index_ = spline_->IndexForX(x, guess);
+
+  if (index_ == kBeforeSplineIndex) {
+    start_x_ = -std::numeric_limits<float>::infinity();
+    end_x_ = spline_->StartX();
+  } else if (index_ == kAfterSplineIndex) {
+    start_x_ = spline_->EndX();
+    end_x_ = std::numeric_limits<float>::infinity();
+  } else {
+    const Range range = spline_->RangeX(index_);
+    start_x_ = range.start();
+    end_x_ = range.end();
+  }
+  cubic_.Init(spline_->CreateCubicInit(index_));
+}
+
 void CompactSpline::Ys(const float start_x, const float delta_x,
                        const size_t num_points, float* ys,
                        float* derivatives) const {
@@ -258,6 +341,66 @@ void CompactSpline::BulkYs(const CompactSpline* const splines,
   BulkEvaluate(splines, num_splines, start_x, delta_x, num_points, &output);
 }
 
+// static
+void CompactSpline::BakeYs(const CompactSpline* const* splines,
+                           size_t num_splines, float start_x, float delta_x,
+                           size_t num_points, float* ys, float* derivatives,
+                           MotiveTaskScheduler* scheduler) {
+  const auto bake = [=](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      const size_t offset = i * num_points;
+      splines[i]->BakeYs(start_x, delta_x, num_points, ys + offset,
+                         derivatives == nullptr ? nullptr
+                                                : derivatives + offset);
+    }
+  };
+  if (scheduler == nullptr) {
+    bake(0, static_cast<int>(num_splines));
+  } else {
+    scheduler->ParallelFor(static_cast<int>(num_splines),
+                           kMinSplinesPerBakeTask, bake);
+  }
+}
+
+void CompactSpline::BakeYs(float start_x, float delta_x, size_t num_points,
+                           float* ys, float* derivatives) const {
+  assert(delta_x >= 0.0f && num_nodes_ > 0);
+
+  // The current segment. Found with IndexForX() at the first point inside
+  // the spline, then stepped forward as x passes the end of each segment.
+  CompactSplineIndex index = kInvalidSplineIndex;
+  float segment_start_x = 0.0f;
+  float segment_end_x = 0.0f;
+  CubicCurve cubic;
+  const auto start_segment = [&](CompactSplineIndex i) {
+    index = i;
+    segment_start_x = NodeX(i);
+    segment_end_x = NodeX(i + 1);
+    cubic.Init(CreateCubicInit(i));
+  };
+
+  for (size_t n = 0; n < num_points; ++n) {
+    // Same bounds as IndexForX(): the last node is part of the last segment.
+    const float x = start_x + n * delta_x;
+    const int quantized_x = CompactSplineNode::QuantizeX(x, x_granularity_);
+    const bool before = quantized_x < Front().x();
+    if (before || quantized_x > Back().x() || num_nodes_ < 2) {
+      ys[n] = before ? StartY() : EndY();
+      if (derivatives != nullptr) derivatives[n] = 0.0f;
+      continue;
+    }
+
+    if (index == kInvalidSplineIndex) start_segment(IndexForX(x, 0));
+    while (x >= segment_end_x && index < LastSegmentIndex()) {
+      start_segment(static_cast<CompactSplineIndex>(index + 1));
+    }
+
+    const float cubic_x = x - segment_start_x;
+    ys[n] = cubic.Evaluate(cubic_x);
+    if (derivatives != nullptr) derivatives[n] = cubic.Derivative(cubic_x);
+  }
+}
+
 Range CompactSpline::RangeX(const CompactSplineIndex index) const {
   if (index == kBeforeSplineIndex)
     // Return 0.0f for the start of the range instead of -inf.
@@ -268,8 +411,8 @@ Range CompactSpline::RangeX(const CompactSplineIndex index) const {
   if (index == kAfterSplineIndex)
     return Range(EndX(), std::numeric_limits<float>::infinity());
 
-  return Range(nodes_[index].X(x_granularity_),
-               nodes_[index + 1].X(x_granularity_));
+  return Range(Node(index).X(x_granularity_),
+               Node(index + 1).X(x_granularity_));
 }
 
 CompactSplineIndex CompactSpline::IndexForX(
@@ -294,19 +437,100 @@ CompactSplineIndex CompactSpline::IndexForX(
   // width.
   const CompactSplineXGrain compact_x =
       static_cast<CompactSplineXGrain>(quantized_x);
+
+  // When the nodes are evenly spaced, the index follows directly from `x`.
+  // We're strictly before the last node here, so the index is always valid.
+  if (uniform_x_step_ != 0) {
+    const CompactSplineIndex index = static_cast<CompactSplineIndex>(
+        (compact_x - Front().x()) / uniform_x_step_);
+    assert(IndexContainsX(compact_x, index));
+    return index;
+  }
+
   if (IndexContainsX(compact_x, guess_index) && guess_index < LastNodeIndex()) {
     const CompactSplineIndex next_index = guess_index + 1;
-    if (WidthX(nodes_[guess_index], nodes_[next_index]) > 0.f) {
+    if (WidthX(Node(guess_index), Node(next_index)) > 0.f) {
       return guess_index;
     }
   }
 
   // Search for it, if the initial guess fails.
+  CountEvent(kCounterIndexForXSearches);
   const CompactSplineIndex index = BinarySearchIndexForX(compact_x);
   assert(IndexContainsX(compact_x, index));
   return index;
 }
 
+bool CompactSpline::SharesXKeys(const CompactSpline& rhs) const {
+  if (&rhs == this) return true;
+  if (num_nodes_ != rhs.num_nodes_ || x_granularity_ != rhs.x_granularity_)
+    return false;
+
+  // Channels created together hold a single copy of their x keys.
+  if (IsChannel() && rhs.IsChannel() && external_ == rhs.external_)
+    return true;
+  if (num_nodes_ == 0) return true;
+
+  // Evenly spaced nodes only need their first node and spacing compared.
+  if (uniform_x_step_ != 0 || rhs.uniform_x_step_ != 0) {
+    return uniform_x_step_ == rhs.uniform_x_step_ &&
+           Front().x() == rhs.Front().x();
+  }
+
+  for (CompactSplineIndex i = 0; i < num_nodes_; ++i) {
+    if (QuantizedX(i) != rhs.QuantizedX(i)) return false;
+  }
+  return true;
+}
+
+// static
+bool CompactSpline::CanCreateChannels(const CompactSpline* const* splines,
+                                      int num_splines) {
+  if (num_splines <= 0 || num_splines > std::numeric_limits<uint8_t>::max())
+    return false;
+  for (int i = 1; i < num_splines; ++i) {
+    if (!splines[i]->SharesXKeys(*splines[0])) return false;
+  }
+  return true;
+}
+
+// static
+CompactSpline* CompactSpline::CreateChannelsInPlace(
+    const CompactSpline* const* splines, int num_splines, void* buffer) {
+  assert(CanCreateChannels(splines, num_splines));
+  const CompactSpline& first = *splines[0];
+  const CompactSplineIndex num_nodes = first.num_nodes_;
+
+  // The channel headers come first, followed by the shared x keys, and then
+  // the y and angle of each channel, node by node.
+  uint8_t* b = static_cast<uint8_t*>(buffer);
+  CompactSplineXGrain* xs =
+      reinterpret_cast<CompactSplineXGrain*>(b + num_splines * Size(0));
+  CompactSplineChannelNode* channel_nodes =
+      reinterpret_cast<CompactSplineChannelNode*>(xs + num_nodes);
+  for (CompactSplineIndex i = 0; i < num_nodes; ++i) {
+    xs[i] = first.QuantizedX(i);
+    for (int c = 0; c < num_splines; ++c) {
+      const CompactSplineNode n = splines[c]->Node(i);
+      CompactSplineChannelNode& channel_node =
+          channel_nodes[i * num_splines + c];
+      channel_node.y = n.y();
+      channel_node.angle = n.angle();
+    }
+  }
+
+  for (int c = 0; c < num_splines; ++c) {
+    CompactSpline* channel = CreateInPlace(0, b + c * Size(0));
+    channel->Init(splines[c]->y_range_, first.x_granularity_);
+    channel->num_nodes_ = num_nodes;
+    channel->uniform_x_step_ = first.uniform_x_step_;
+    channel->channel_ = static_cast<uint8_t>(c);
+    channel->num_channels_ = static_cast<uint8_t>(num_splines);
+    channel->external_ = xs;
+  }
+  return static_cast<CompactSpline*>(buffer);
+}
+
 CompactSplineIndex CompactSpline::IndexForXAllowingRepeat(
     const float x, const CompactSplineIndex guess_index,
     const bool repeat, float* final_x) const {
@@ -341,52 +565,64 @@ CompactSplineIndex CompactSpline::ClampIndex(const CompactSplineIndex index,
 
 bool CompactSpline::IndexContainsX(const CompactSplineXGrain compact_x,
                                    const CompactSplineIndex index) const {
-  return index < LastNodeIndex() && nodes_[index].x() <= compact_x &&
-         compact_x <= nodes_[index + 1].x();
-}
-
-static inline bool CompareSplineNodeX(const CompactSplineXGrain compact_x,
-                                      const CompactSplineNode& n) {
-  return compact_x < n.x();
+  return index < LastNodeIndex() && QuantizedX(index) <= compact_x &&
+         compact_x <= QuantizedX(index + 1);
 }
 
 CompactSplineIndex CompactSpline::BinarySearchIndexForX(
     const CompactSplineXGrain compact_x) const {
-  // Binary search nodes by x.
-  // TODO OPT: avoid the pointer arithmetic (which is expensive on ARM since it
-  // requires an integer division) by searching with indices instead of
-  // iterators.
-  //     int low = 0;
-  //     int hi = max_hi;
-  //     while (low + 1 < hi) {
-  //       const int mid = (low + hi) / 2;
-  //
-  //       if (compact_x < nodes_[mid].x()) {
-  //         hi = mid;
-  //       } else {
-  //         low = mid;
-  //       }
-  //     }
-  const auto upper_it = std::upper_bound(nodes_, &nodes_[num_nodes_], compact_x,
-                                         CompareSplineNodeX);
-  const int low = static_cast<int>(upper_it - nodes_) - 1;
+  // Binary search nodes by x. Search with indices instead of iterators, since
+  // channels don't hold an array of whole nodes, and since the pointer
+  // arithmetic is expensive on ARM (it requires an integer division).
+  // The caller has checked that `compact_x` is before the last node.
+  int low = 0;
+  int hi = LastNodeIndex();
+  while (low + 1 < hi) {
+    const int mid = (low + hi) / 2;
+    if (compact_x < QuantizedX(static_cast<CompactSplineIndex>(mid))) {
+      hi = mid;
+    } else {
+      low = mid;
+    }
+  }
   assert(0 <= low && low < LastNodeIndex());
 
   // We return the lower index: x is in the segment bt 'index' and 'index' + 1.
   return static_cast<CompactSplineIndex>(low);
 }
 
+void CompactSpline::AddMemoryStats(MemoryStats* stats) const {
+  // Views read their nodes from memory that they don't own, except for
+  // channels, which own their share. The first channel counts the x keys.
+  if (IsChannel()) {
+    const size_t node_bytes =
+        num_nodes_ * sizeof(CompactSplineChannelNode) +
+        (channel_ == 0 ? num_nodes_ * sizeof(CompactSplineXGrain) : 0);
+    stats->live_bytes += kBaseSize + node_bytes;
+    stats->spline_header_bytes += kBaseSize;
+    stats->spline_node_bytes += node_bytes;
+    return;
+  }
+  const size_t node_bytes =
+      IsView() ? 0 : num_nodes_ * sizeof(CompactSplineNode);
+  const size_t total_bytes = Size(max_nodes_);
+  stats->live_bytes += kBaseSize + node_bytes;
+  stats->slack_bytes += total_bytes - kBaseSize - node_bytes;
+  stats->spline_header_bytes += kBaseSize;
+  stats->spline_node_bytes += node_bytes;
+}
+
 CubicInit CompactSpline::CreateCubicInit(const CompactSplineIndex index) const {
   // Handle case where we are outside of the interpolatable range.
   if (OutsideSpline(index)) {
-    const CompactSplineNode& n = index == kBeforeSplineIndex ? Front() : Back();
+    const CompactSplineNode n = index == kBeforeSplineIndex ? Front() : Back();
     const float constant_y = n.Y(y_range_);
     return CubicInit(constant_y, 0.0f, constant_y, 0.0f, 1.0f);
   }
 
   // Interpolate between the nodes at 'index' and 'index' + 1.
   assert(index + 1 < num_nodes_);
-  return CreateCubicInit(nodes_[index], nodes_[index + 1]);
+  return CreateCubicInit(Node(index), Node(index + 1));
 }
 
 CubicInit CompactSpline::CreateCubicInit(const CompactSplineNode& s,
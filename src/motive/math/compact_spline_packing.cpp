@@ -0,0 +1,200 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "motive/math/compact_spline_packing.h"
+
+#include <math.h>
+#include <algorithm>
+
+#include "motive/math/angle.h"
+
+namespace motive {
+
+// Angles are in (-pi/2, pi/2), so the angle field only ever holds values
+// within +-kAngleOffset. Shift them to be unsigned before requantizing.
+static const int kAngleOffset = 1 << 14;
+static const int kMaxAngle = 2 * kAngleOffset;
+static const int kMaxY = (1 << CompactSplinePacking::kMaxBits) - 1;
+
+// The cubic Hermite basis function for a derivative, w * t * (1 - t)^2, peaks
+// at w * 4/27. Both ends of a segment contribute.
+static const float kDerivativeToYError = 8.0f / 27.0f;
+
+// Number of levels that fit in `bits`, minus one.
+static int MaxLevel(int bits) { return (1 << bits) - 1; }
+
+// Map `value` in [0, max_value] to [0, MaxLevel(bits)], rounding to nearest.
+static uint32_t Requantize(int value, int max_value, int bits) {
+  const int64_t level = MaxLevel(bits);
+  return static_cast<uint32_t>((value * level + max_value / 2) / max_value);
+}
+
+// Inverse of Requantize().
+static int Dequantize(uint32_t q, int max_value, int bits) {
+  const int64_t level = MaxLevel(bits);
+  return static_cast<int>((q * static_cast<int64_t>(max_value) + level / 2) /
+                          level);
+}
+
+// Smallest width, up to kMaxBits, whose rounding error over `length` is at
+// most `max_error`.
+static int BitsForError(float length, float max_error) {
+  for (int bits = 1; bits < CompactSplinePacking::kMaxBits; ++bits) {
+    if (length <= 2.0f * max_error * MaxLevel(bits)) return bits;
+  }
+  return CompactSplinePacking::kMaxBits;
+}
+
+// Smallest width that holds `value`.
+static int BitsForValue(uint32_t value) {
+  int bits = 1;
+  while (bits < CompactSplinePacking::kMaxBits && (value >> bits) != 0) {
+    ++bits;
+  }
+  return bits;
+}
+
+// Appends values of arbitrary width to a byte stream, least-significant bit
+// first.
+class BitWriter {
+ public:
+  explicit BitWriter(uint8_t* bits) : bits_(bits), num_bits_(0) {}
+
+  void Write(uint32_t value, int width) {
+    for (int i = 0; i < width; ++i, ++num_bits_) {
+      uint8_t& byte = bits_[num_bits_ / 8];
+      const uint8_t mask = static_cast<uint8_t>(1 << (num_bits_ % 8));
+      byte = static_cast<uint8_t>((value >> i) & 1 ? (byte | mask)
+                                                   : (byte & ~mask));
+    }
+  }
+
+ private:
+  uint8_t* bits_;
+  size_t num_bits_;
+};
+
+// Reads values written by BitWriter.
+class BitReader {
+ public:
+  BitReader(const uint8_t* bits, size_t num_bytes)
+      : bits_(bits), num_bytes_(num_bytes), num_bits_(0) {}
+
+  bool CanRead(size_t num_bits) const {
+    return num_bits_ + num_bits <= num_bytes_ * 8;
+  }
+
+  uint32_t Read(int width) {
+    uint32_t value = 0;
+    for (int i = 0; i < width; ++i, ++num_bits_) {
+      const uint8_t byte = bits_[num_bits_ / 8];
+      value |= static_cast<uint32_t>((byte >> (num_bits_ % 8)) & 1) << i;
+    }
+    return value;
+  }
+
+ private:
+  const uint8_t* bits_;
+  size_t num_bytes_;
+  size_t num_bits_;
+};
+
+// static
+CompactSplinePacking CompactSplinePacking::ForTolerance(
+    const CompactSpline& spline, float y_tolerance) {
+  const detail::CompactSplineNode* nodes = spline.nodes();
+  assert(!spline.IsChannel());
+
+  // x is lossless, so it needs enough bits for the largest difference. The
+  // first node is relative to 0, rather than to another node, so it affects
+  // the bit width but not the widest segment.
+  CompactSplineXGrain max_delta_x = 0;
+  CompactSplineXGrain max_width = 0;
+  float max_derivative = 0.0f;
+  for (CompactSplineIndex i = 0; i < spline.num_nodes(); ++i) {
+    const CompactSplineXGrain prev_x = i == 0 ? 0 : nodes[i - 1].x();
+    const CompactSplineXGrain delta_x =
+        static_cast<CompactSplineXGrain>(nodes[i].x() - prev_x);
+    max_delta_x = std::max(max_delta_x, delta_x);
+    if (i > 0) {
+      max_width = std::max(max_width, delta_x);
+    }
+    max_derivative = std::max(max_derivative, fabs(nodes[i].Derivative()));
+  }
+
+  // Half the tolerance for the y values themselves.
+  const float y_error = 0.5f * y_tolerance;
+  const int y_bits = BitsForError(spline.y_range().Length(), y_error);
+
+  // The other half for the derivatives. Near derivative s, a change of da in
+  // angle changes the derivative by (1 + s^2) da.
+  const float max_width_x = max_width * spline.x_granularity();
+  const float derivative_error =
+      max_width_x > 0.0f ? y_error / (kDerivativeToYError * max_width_x)
+                         : y_error;
+  const float angle_error =
+      derivative_error / (1.0f + max_derivative * max_derivative);
+  const int angle_bits = BitsForError(kPi, angle_error);
+
+  return CompactSplinePacking(BitsForValue(max_delta_x), y_bits, angle_bits);
+}
+
+void PackCompactSplineNodes(const CompactSpline& spline,
+                            const CompactSplinePacking& packing,
+                            uint8_t* bits) {
+  assert(packing.Valid());
+  BitWriter writer(bits);
+  const detail::CompactSplineNode* nodes = spline.nodes();
+  assert(!spline.IsChannel());
+  CompactSplineXGrain prev_x = 0;
+  for (CompactSplineIndex i = 0; i < spline.num_nodes(); ++i) {
+    const detail::CompactSplineNode& n = nodes[i];
+    assert(-kAngleOffset <= n.angle() && n.angle() <= kAngleOffset);
+    const uint32_t delta_x = static_cast<uint32_t>(n.x() - prev_x);
+    assert(BitsForValue(delta_x) <= packing.x_bits);
+    writer.Write(delta_x, packing.x_bits);
+    writer.Write(Requantize(n.y(), kMaxY, packing.y_bits), packing.y_bits);
+    writer.Write(Requantize(n.angle() + kAngleOffset, kMaxAngle,
+                            packing.angle_bits),
+                 packing.angle_bits);
+    prev_x = n.x();
+  }
+}
+
+bool UnpackCompactSplineNodes(const uint8_t* bits, size_t num_bytes,
+                              CompactSplineIndex num_nodes,
+                              const CompactSplinePacking& packing,
+                              CompactSpline* spline) {
+  if (!packing.Valid()) return false;
+  if (spline->num_nodes() + num_nodes > spline->max_nodes()) return false;
+
+  BitReader reader(bits, num_bytes);
+  if (!reader.CanRead(static_cast<size_t>(num_nodes) * packing.BitsPerNode()))
+    return false;
+
+  CompactSplineXGrain x = 0;
+  for (CompactSplineIndex i = 0; i < num_nodes; ++i) {
+    x = static_cast<CompactSplineXGrain>(x + reader.Read(packing.x_bits));
+    const CompactSplineYRung y = static_cast<CompactSplineYRung>(
+        Dequantize(reader.Read(packing.y_bits), kMaxY, packing.y_bits));
+    const CompactSplineAngle angle = static_cast<CompactSplineAngle>(
+        Dequantize(reader.Read(packing.angle_bits), kMaxAngle,
+                   packing.angle_bits) -
+        kAngleOffset);
+    spline->AddNodeVerbatim(x, y, angle);
+  }
+  return true;
+}
+
+}  // namespace motive
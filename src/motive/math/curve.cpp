@@ -316,6 +316,30 @@ void CubicCurve::Init(const CubicInit& init) {
           one_over_w_sq * (init.end_derivative + init.start_derivative);
 }
 
+// Same math as CubicCurve::Init(), operation for operation, so the results
+// are identical.
+void InitCubicCoefficients(const float* start_y, const float* start_derivative,
+                           const float* end_y, const float* end_derivative,
+                           const float* width_x, size_t count,
+                           float* const* coefficients) {
+  float* c0 = coefficients[0];
+  float* c1 = coefficients[1];
+  float* c2 = coefficients[2];
+  float* c3 = coefficients[3];
+  for (size_t i = 0; i < count; ++i) {
+    const float w = width_x[i];
+    const float one_over_w = w > 0.f ? (1.0f / w) : 1.f;
+    const float one_over_w_sq = one_over_w * one_over_w;
+    const float one_over_w_cubed = one_over_w_sq * one_over_w;
+    c0[i] = start_y[i];
+    c1[i] = w > 0.f ? start_derivative[i] : 0.f;
+    c2[i] = 3.0f * one_over_w_sq * (end_y[i] - start_y[i]) -
+            one_over_w * (end_derivative[i] + 2.0f * start_derivative[i]);
+    c3[i] = 2.0f * one_over_w_cubed * (start_y[i] - end_y[i]) +
+            one_over_w_sq * (end_derivative[i] + start_derivative[i]);
+  }
+}
+
 void CubicCurve::ShiftLeft(const float x_shift) {
   // Early out optimization.
   if (x_shift == 0.0f) return;
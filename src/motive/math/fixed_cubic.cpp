@@ -0,0 +1,78 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "motive/math/fixed_cubic.h"
+
+namespace motive {
+
+// std::min() and std::max() take their arguments by reference, so the
+// constants need definitions.
+const int FixedCubic::kTBits;
+const int FixedCubic::kCoefficientBits;
+const int FixedCubic::kDeltaXBits;
+const int FixedCubic::kPlaybackRateBits;
+const int FixedCubic::kMinXShift;
+const int FixedCubic::kMaxXShift;
+
+// Round `f` to the nearest int32_t, saturating at the limits.
+static int32_t RoundToInt32(const float f) {
+  const double rounded = std::floor(static_cast<double>(f) + 0.5);
+  if (rounded >= std::numeric_limits<int32_t>::max()) {
+    return std::numeric_limits<int32_t>::max();
+  }
+  if (rounded <= std::numeric_limits<int32_t>::min()) {
+    return std::numeric_limits<int32_t>::min();
+  }
+  return static_cast<int32_t>(rounded);
+}
+
+void FixedCubic::Init(const CubicCurve& cubic, float x, float width_x) {
+  // The smallest power of two wider than the curve, so that t <= 1.
+  x_shift_ = std::max(kMinXShift,
+                      std::min(ExponentAsInt(width_x) + 1, kMaxXShift));
+
+  // Scale the coefficients from x to t. Scaling by a power of two is exact.
+  float c[CubicCurve::kNumCoeff];
+  float max_c = 0.0f;
+  for (int k = 0; k < CubicCurve::kNumCoeff; ++k) {
+    c[k] = cubic.Coeff(k) * ExponentFromInt(k * x_shift_);
+    max_c = std::max(max_c, std::fabs(c[k]));
+  }
+
+  // max_c < 2^(ExponentAsInt(max_c) + 1), so this y_shift keeps every
+  // coefficient under 2^kCoefficientBits. When max_c is zero, y_shift is
+  // clamped to the largest power of two that a float can hold.
+  const int y_shift = std::min(kCoefficientBits - 1 - ExponentAsInt(max_c),
+                               kMaxInvertableExponent);
+  const float y_scale = ExponentFromInt(y_shift);
+  for (int k = 0; k < CubicCurve::kNumCoeff; ++k) {
+    c_[k] = RoundToInt32(c[k] * y_scale);
+  }
+  y_unit_ = ExponentFromInt(-y_shift);
+
+  const float t_scale = ExponentFromInt(kTBits - x_shift_);
+  t_ = RoundToInt32(x * t_scale);
+  t_end_ = RoundToInt32(width_x * t_scale);
+}
+
+CubicCurve FixedCubic::ToCubic() const {
+  float c[CubicCurve::kNumCoeff];
+  for (int k = 0; k < CubicCurve::kNumCoeff; ++k) {
+    c[k] = static_cast<float>(c_[k]) * y_unit_ *
+           ExponentFromInt(-k * x_shift_);
+  }
+  return CubicCurve(c);
+}
+
+}  // namespace motive
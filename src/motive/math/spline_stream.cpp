@@ -0,0 +1,346 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "motive/math/spline_stream.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace motive {
+
+void CreateSplineChunks(const UncompressedNode* nodes, size_t num_nodes,
+                        size_t nodes_per_chunk,
+                        std::vector<CompactSpline*>* chunks,
+                        std::vector<float>* start_xs) {
+  // Consecutive chunks share a node, so each chunk advances by one less.
+  assert(nodes_per_chunk >= 2 && nodes_per_chunk <= kMaxSplineIndex);
+  std::vector<UncompressedNode> chunk_nodes(nodes_per_chunk);
+  for (size_t first = 0; first + 1 < num_nodes;
+       first += nodes_per_chunk - 1) {
+    const size_t count = std::min(nodes_per_chunk, num_nodes - first);
+    const float start_x = nodes[first].x;
+    for (size_t i = 0; i < count; ++i) {
+      chunk_nodes[i] = nodes[first + i];
+      chunk_nodes[i].x -= start_x;
+    }
+    chunks->push_back(CompactSpline::CreateFromNodes(&chunk_nodes[0], count));
+    start_xs->push_back(start_x);
+  }
+}
+
+LiveSplineChunkSource::LiveSplineChunkSource(size_t nodes_per_chunk,
+                                             int max_chunks)
+    : nodes_per_chunk_(nodes_per_chunk),
+      max_chunks_(static_cast<size_t>(max_chunks)),
+      first_resident_(0) {
+  assert(nodes_per_chunk >= 2 && nodes_per_chunk <= kMaxSplineIndex);
+  assert(max_chunks >= 1);
+  pending_.reserve(nodes_per_chunk);
+}
+
+LiveSplineChunkSource::~LiveSplineChunkSource() {
+  for (auto it = resident_.begin(); it != resident_.end(); ++it) {
+    CompactSpline::Destroy(it->spline);
+  }
+}
+
+void LiveSplineChunkSource::AddNode(const UncompressedNode& node) {
+  assert(pending_.empty() || node.x >= pending_.back().x);
+  pending_.push_back(node);
+  if (pending_.size() >= nodes_per_chunk_) SealChunk();
+}
+
+void LiveSplineChunkSource::Flush() {
+  if (pending_.size() >= 2) SealChunk();
+}
+
+void LiveSplineChunkSource::Prefetch(int chunk) {
+  ResidentChunk* resident = Resident(chunk);
+  if (resident != nullptr) resident->held = true;
+}
+
+const CompactSpline* LiveSplineChunkSource::Chunk(int chunk) {
+  ResidentChunk* resident = Resident(chunk);
+  return resident == nullptr ? nullptr : resident->spline;
+}
+
+void LiveSplineChunkSource::Evict(int chunk) {
+  ResidentChunk* resident = Resident(chunk);
+  if (resident == nullptr) return;
+  resident->held = false;
+  DropOldChunks();
+}
+
+LiveSplineChunkSource::ResidentChunk* LiveSplineChunkSource::Resident(
+    int chunk) {
+  const int i = chunk - first_resident_;
+  if (i < 0 || i >= static_cast<int>(resident_.size())) return nullptr;
+  return &resident_[i];
+}
+
+void LiveSplineChunkSource::SealChunk() {
+  // Chunks start at x = 0, like those from CreateSplineChunks().
+  const UncompressedNode last = pending_.back();
+  const float start_x = pending_[0].x;
+  for (size_t i = 0; i < pending_.size(); ++i) {
+    pending_[i].x -= start_x;
+  }
+  ResidentChunk resident;
+  resident.spline =
+      CompactSpline::CreateFromNodes(&pending_[0], pending_.size());
+  resident.held = false;
+  resident_.push_back(resident);
+  start_xs_.push_back(start_x);
+
+  // The last node of this chunk is the first node of the next.
+  pending_.clear();
+  pending_.push_back(last);
+  DropOldChunks();
+}
+
+void LiveSplineChunkSource::DropOldChunks() {
+  // Chunks are played in order, so only the oldest chunks can be dropped.
+  while (resident_.size() > max_chunks_ && !resident_.front().held) {
+    CompactSpline::Destroy(resident_.front().spline);
+    resident_.pop_front();
+    first_resident_++;
+  }
+}
+
+SplineStreamer::SplineStreamer()
+    : target_(nullptr),
+      source_(nullptr),
+      chunk_(0),
+      playing_chunk_(-1),
+      prefetched_chunk_(-1),
+      pending_x_(0.0f),
+      starved_(false),
+      held_at_end_(false) {}
+
+void SplineStreamer::Start(BulkSplineEvaluator* evaluator,
+                           BulkSplineEvaluator::Index index,
+                           SplineChunkSource* source,
+                           const SplinePlayback& playback) {
+  Stop();
+  evaluator_target_ = BulkSplineStreamTarget(evaluator, index);
+  Start(&evaluator_target_, source, playback);
+}
+
+void SplineStreamer::Start(SplineStreamTarget* target,
+                           SplineChunkSource* source,
+                           const SplinePlayback& playback) {
+  Stop();
+  target_ = target;
+  source_ = source;
+  playback_ = playback;
+  chunk_ = ChunkForX(playback.start_x);
+  source_->Prefetch(chunk_);
+  EnterChunk(playback.start_x - source_->ChunkStartX(chunk_),
+             playback.blend_x);
+}
+
+void SplineStreamer::Update() {
+  if (source_ == nullptr) return;
+
+  // Waiting for a chunk. If we're holding at the end of the previous chunk,
+  // the evaluator has kept advancing x past its end, so pick up where
+  // playback would have been, and blend there from the held value.
+  if (starved_) {
+    if (source_->Chunk(chunk_) == nullptr) return;
+    const float start_x =
+        playing_chunk_ < 0 ? pending_x_ : target_->X() - target_->EndX();
+    EnterChunk(start_x, playback_.blend_x);
+    return;
+  }
+
+  // Still inside the current chunk.
+  const float overshoot_x = target_->X() - target_->EndX();
+  if (overshoot_x < 0.0f) return;
+
+  int next = chunk_ + 1;
+  if (next >= source_->NumChunks()) {
+    if (!playback_.repeat) {
+      held_at_end_ = true;
+      return;
+    }
+    next = 0;
+  }
+
+  // A growing source may have added `next` after we entered this chunk, so
+  // it hasn't been prefetched yet.
+  if (next != prefetched_chunk_) source_->Prefetch(next);
+
+  // The end of this chunk is the start of the next, so no blend is needed.
+  // Unless we've been holding at the end while the source grew, in which case
+  // playback jumps ahead.
+  const bool was_held = held_at_end_;
+  held_at_end_ = false;
+  chunk_ = next;
+  EnterChunk(overshoot_x, was_held ? playback_.blend_x : 0.0f);
+}
+
+void SplineStreamer::Stop() {
+  if (source_ == nullptr) return;
+  if (playing_chunk_ >= 0) source_->Evict(playing_chunk_);
+  if (chunk_ != playing_chunk_) source_->Evict(chunk_);
+  if (prefetched_chunk_ >= 0 && prefetched_chunk_ != chunk_ &&
+      prefetched_chunk_ != playing_chunk_) {
+    source_->Evict(prefetched_chunk_);
+  }
+  source_ = nullptr;
+  playing_chunk_ = -1;
+  prefetched_chunk_ = -1;
+  starved_ = false;
+  held_at_end_ = false;
+}
+
+float SplineStreamer::X() const {
+  if (source_ == nullptr) return 0.0f;
+  const float chunk_x =
+      starved_ ? pending_x_
+               : std::min(target_->X(), target_->EndX());
+  return source_->ChunkStartX(chunk_) + chunk_x;
+}
+
+void SplineStreamer::EnterChunk(float start_x, float blend_x) {
+  const CompactSpline* spline = source_->Chunk(chunk_);
+  starved_ = spline == nullptr;
+  if (starved_) {
+    // Keep playing the previous chunk, if any, which holds at its end: the
+    // start of `chunk_`.
+    pending_x_ = playing_chunk_ < 0 ? start_x : 0.0f;
+    return;
+  }
+
+  SplinePlayback playback = playback_;
+  playback.start_x = start_x;
+  playback.blend_x = blend_x;
+  playback.repeat = false;
+  target_->SetSpline(spline, playback);
+
+  // The evaluator no longer references the previous chunk.
+  if (playing_chunk_ >= 0 && playing_chunk_ != chunk_) {
+    source_->Evict(playing_chunk_);
+  }
+  playing_chunk_ = chunk_;
+
+  // Playback only moves forward from here, so start loading the next chunk.
+  const int next = NextChunk();
+  prefetched_chunk_ = next >= 0 && next != chunk_ ? next : -1;
+  if (prefetched_chunk_ >= 0) source_->Prefetch(prefetched_chunk_);
+}
+
+int SplineStreamer::NextChunk() const {
+  const int next = chunk_ + 1;
+  if (next < source_->NumChunks()) return next;
+  return playback_.repeat ? 0 : -1;
+}
+
+int SplineStreamer::ChunkForX(float x) const {
+  // The last chunk whose start is at or before `x`.
+  int chunk = 0;
+  for (int i = 1; i < source_->NumChunks(); ++i) {
+    if (source_->ChunkStartX(i) > x) break;
+    chunk = i;
+  }
+  return chunk;
+}
+
+RingSpline::RingSpline(CompactSplineIndex num_nodes, float x_step,
+                       const Range& y_range, MotiveAllocator* allocator)
+    : spline_(nullptr),
+      allocator_(allocator),
+      x_step_(x_step),
+      newest_y_(0.0f),
+      num_ring_nodes_(num_nodes),
+      grains_per_step_(0),
+      num_added_(0) {
+  assert(num_nodes >= 1 && num_nodes < kMaxSplineIndex && x_step > 0.0f);
+
+  // Nodes are a whole number of x grains apart, so that they're exactly
+  // evenly spaced. One extra node, a copy of the first, closes the ring, so
+  // that the spline repeats exactly every period().
+  grains_per_step_ = static_cast<CompactSplineXGrain>(
+      detail::CompactSplineNode::MaxX() / num_nodes);
+  spline_ = CompactSpline::Create(num_nodes + 1, allocator);
+  spline_->Init(y_range, x_step / grains_per_step_);
+}
+
+RingSpline::~RingSpline() { CompactSpline::Destroy(spline_, allocator_); }
+
+void RingSpline::AddNode(float y, float derivative) {
+  const float clamped_y = spline_->y_range().Clamp(y);
+  if (num_added_ == 0) {
+    // Fill the ring with the first node, so that playback can start anywhere.
+    detail::CompactSplineNode node;
+    node.SetY(clamped_y, spline_->y_range());
+    node.SetDerivative(derivative);
+    for (CompactSplineIndex i = 0; i <= num_ring_nodes_; ++i) {
+      spline_->AddNodeVerbatim(
+          static_cast<CompactSplineXGrain>(i * grains_per_step_), node.y(),
+          node.angle());
+    }
+  } else {
+    // Overwrite the oldest node, and the copy of the first that closes the
+    // ring, if that's the one.
+    const CompactSplineIndex slot =
+        static_cast<CompactSplineIndex>(num_added_ % num_ring_nodes_);
+    spline_->SetNode(slot, clamped_y, derivative);
+    if (slot == 0) spline_->SetNode(num_ring_nodes_, clamped_y, derivative);
+  }
+  newest_y_ = clamped_y;
+  num_added_++;
+}
+
+void RingSpline::AddValue(float y) {
+  const float derivative =
+      num_added_ == 0 ? 0.0f
+                      : (spline_->y_range().Clamp(y) - newest_y_) / x_step_;
+  AddNode(y, derivative);
+}
+
+float RingSpline::NewestX() const {
+  if (num_added_ == 0) return 0.0f;
+  return ((num_added_ - 1) % num_ring_nodes_) * x_step_;
+}
+
+float RingSpline::WrapX(float x) const {
+  const float wrapped = std::fmod(x, period());
+  return wrapped < 0.0f ? wrapped + period() : wrapped;
+}
+
+SplinePlayback RingSplineClock::Start(const RingSpline& ring, float blend_x) {
+  lag_ = latency_;
+  playback_rate_ = 1.0f;
+  num_added_ = ring.num_added();
+  return SplinePlayback(ring.WrapX(ring.NewestX() - latency_), true,
+                        playback_rate_, blend_x);
+}
+
+float RingSplineClock::Update(const RingSpline& ring, float delta_x) {
+  lag_ += static_cast<float>(ring.num_added() - num_added_) * ring.x_step() -
+          delta_x * playback_rate_;
+  num_added_ = ring.num_added();
+
+  // Correct any drift from the latency over about a latency's worth of x.
+  float rate = 1.0f + (lag_ - latency_) / latency_;
+
+  // Don't pass the most recent node, assuming that the next frame is as long
+  // as this one.
+  if (delta_x > 0.0f) rate = std::min(rate, lag_ / delta_x);
+  playback_rate_ = std::max(0.0f, std::min(rate, max_rate_));
+  return playback_rate_;
+}
+
+}  // namespace motive
@@ -0,0 +1,227 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "motive/math/transform_kernels.h"
+
+#include <assert.h>
+#include <cmath>
+#include <vector>
+
+namespace motive {
+
+// These functions are implemented with intrinsics, in
+// transform_kernels_neon.cpp, transform_kernels_x86.cpp, and
+// transform_kernels_wasm.cpp.
+void MultiplyAffines_Neon(const float* parents, const float* locals,
+                          int count, int stride, float* globals);
+void SqtsToAffines_Neon(float* sqts, int count, int stride, float* affines);
+void MultiplyAffines_Sse4(const float* parents, const float* locals,
+                          int count, int stride, float* globals);
+void SqtsToAffines_Sse4(float* sqts, int count, int stride, float* affines);
+void MultiplyAffines_Avx2(const float* parents, const float* locals,
+                          int count, int stride, float* globals);
+void SqtsToAffines_Avx2(float* sqts, int count, int stride, float* affines);
+void MultiplyAffines_Wasm(const float* parents, const float* locals,
+                          int count, int stride, float* globals);
+void SqtsToAffines_Wasm(float* sqts, int count, int stride, float* affines);
+
+const TransformKernels* TransformKernelsFor(
+    ProcessorOptimization optimization) {
+#if defined(MOTIVE_NEON)
+  static const TransformKernels kNeonKernels = {MultiplyAffines_Neon,
+                                                SqtsToAffines_Neon};
+#endif  // defined(MOTIVE_NEON)
+#if defined(MOTIVE_X86_SIMD)
+  static const TransformKernels kSse4Kernels = {MultiplyAffines_Sse4,
+                                                SqtsToAffines_Sse4};
+  static const TransformKernels kAvx2Kernels = {MultiplyAffines_Avx2,
+                                                SqtsToAffines_Avx2};
+#endif  // defined(MOTIVE_X86_SIMD)
+#if defined(MOTIVE_WASM_SIMD)
+  static const TransformKernels kWasmKernels = {MultiplyAffines_Wasm,
+                                                SqtsToAffines_Wasm};
+#endif  // defined(MOTIVE_WASM_SIMD)
+
+  switch (optimization) {
+#if defined(MOTIVE_NEON)
+    case kNeonOptimizations:
+      return &kNeonKernels;
+#endif  // defined(MOTIVE_NEON)
+
+#if defined(MOTIVE_WASM_SIMD)
+    case kWasmSimdOptimizations:
+      return &kWasmKernels;
+#endif  // defined(MOTIVE_WASM_SIMD)
+
+#if defined(MOTIVE_X86_SIMD)
+    // There are no 512-bit functions yet.
+    case kAvx512Optimizations:
+    case kAvx2Optimizations:
+      return &kAvx2Kernels;
+
+    case kSse41Optimizations:
+      return &kSse4Kernels;
+#endif  // defined(MOTIVE_X86_SIMD)
+
+    // SSE2 through SSSE3 have no functions of their own.
+    default:
+      return nullptr;
+  }
+}
+
+void MultiplyAffines_C(const float* parents, const float* locals, int count,
+                       int stride, float* globals) {
+  for (int r = 0; r < 3; ++r) {
+    const float* p0 = &parents[(r * 4) * stride];
+    const float* p1 = &parents[(r * 4 + 1) * stride];
+    const float* p2 = &parents[(r * 4 + 2) * stride];
+    const float* p3 = &parents[(r * 4 + 3) * stride];
+    for (int c = 0; c < 4; ++c) {
+      const float* l0 = &locals[c * stride];
+      const float* l1 = &locals[(4 + c) * stride];
+      const float* l2 = &locals[(8 + c) * stride];
+      float* g = &globals[(r * 4 + c) * stride];
+      // The bottom row of `local` is (0, 0, 0, 1), so only the translation
+      // column picks up the parent's translation.
+      if (c == 3) {
+        for (int j = 0; j < count; ++j) {
+          g[j] = p0[j] * l0[j] + p1[j] * l1[j] + p2[j] * l2[j] + p3[j];
+        }
+      } else {
+        for (int j = 0; j < count; ++j) {
+          g[j] = p0[j] * l0[j] + p1[j] * l1[j] + p2[j] * l2[j];
+        }
+      }
+    }
+  }
+}
+
+void SqtsToAffines_C(float* sqts, int count, int stride, float* affines) {
+  float* w = &sqts[kSqtRotationW * stride];
+  float* x = &sqts[kSqtRotationX * stride];
+  float* y = &sqts[kSqtRotationY * stride];
+  float* z = &sqts[kSqtRotationZ * stride];
+
+  // Normalize the quaternions, as quat::Normalize() does.
+  for (int j = 0; j < count; ++j) {
+    const float scale =
+        1.0f / std::sqrt(w[j] * w[j] + (x[j] * x[j] + y[j] * y[j] +
+                                        z[j] * z[j]));
+    w[j] *= scale;
+    x[j] *= scale;
+    y[j] *= scale;
+    z[j] *= scale;
+  }
+
+  // Convert to rotation matrices, as quat::ToMatrix() does, and scale each
+  // column.
+  const float* sx = &sqts[kSqtScaleX * stride];
+  const float* sy = &sqts[kSqtScaleY * stride];
+  const float* sz = &sqts[kSqtScaleZ * stride];
+  float* m[kNumAffineElements];
+  for (int k = 0; k < kNumAffineElements; ++k) {
+    m[k] = &affines[k * stride];
+  }
+  for (int j = 0; j < count; ++j) {
+    const float x2 = x[j] * x[j];
+    const float y2 = y[j] * y[j];
+    const float z2 = z[j] * z[j];
+    const float wx = w[j] * x[j];
+    const float wy = w[j] * y[j];
+    const float wz = w[j] * z[j];
+    const float xz = x[j] * z[j];
+    const float yz = y[j] * z[j];
+    const float xy = x[j] * y[j];
+    m[0][j] = (1.0f - 2.0f * (y2 + z2)) * sx[j];
+    m[1][j] = (2.0f * (xy - wz)) * sy[j];
+    m[2][j] = (2.0f * (wy + xz)) * sz[j];
+    m[3][j] = sqts[kSqtTranslationX * stride + j];
+    m[4][j] = (2.0f * (xy + wz)) * sx[j];
+    m[5][j] = (1.0f - 2.0f * (x2 + z2)) * sy[j];
+    m[6][j] = (2.0f * (yz - wx)) * sz[j];
+    m[7][j] = sqts[kSqtTranslationY * stride + j];
+    m[8][j] = (2.0f * (xz - wy)) * sx[j];
+    m[9][j] = (2.0f * (wx + yz)) * sy[j];
+    m[10][j] = (1.0f - 2.0f * (x2 + y2)) * sz[j];
+    m[11][j] = sqts[kSqtTranslationZ * stride + j];
+  }
+}
+
+// Form the assembly function name by appending "_Neon", "_Sse4", or whatever
+// MOTIVE_ASSEMBLY_TEST is defined to be.
+#define MOTIVE_TOKEN_PASTE_NESTED(a, b) a##b
+#define MOTIVE_TOKEN_PASTE(a, b) MOTIVE_TOKEN_PASTE_NESTED(a, b)
+#define MOTIVE_ASSEMBLY_FUNCTION_NAME(name) \
+  MOTIVE_TOKEN_PASTE(name, MOTIVE_ASSEMBLY_TEST)
+
+void MultiplyAffines(const TransformKernels* kernels, const float* parents,
+                     const float* locals, int count, int stride,
+                     float* globals) {
+#if defined(MOTIVE_ASSEMBLY_TEST)
+  (void)kernels;
+  std::vector<float> globals_assembly(kNumAffineElements * stride);
+  MOTIVE_ASSEMBLY_FUNCTION_NAME(MultiplyAffines_)(
+      parents, locals, count, stride, &globals_assembly.front());
+  MultiplyAffines_C(parents, locals, count, stride, globals);
+
+  for (int k = 0; k < kNumAffineElements; ++k) {
+    for (int j = 0; j < count; ++j) {
+      assert(globals[k * stride + j] == globals_assembly[k * stride + j]);
+    }
+  }
+
+#else  // not defined(MOTIVE_ASSEMBLY_TEST)
+
+  if (kernels != nullptr) {
+    kernels->multiply_affines(parents, locals, count, stride, globals);
+  } else {
+    MultiplyAffines_C(parents, locals, count, stride, globals);
+  }
+
+#endif  // not defined(MOTIVE_ASSEMBLY_TEST)
+}
+
+void SqtsToAffines(const TransformKernels* kernels, float* sqts, int count,
+                   int stride, float* affines) {
+#if defined(MOTIVE_ASSEMBLY_TEST)
+  (void)kernels;
+  std::vector<float> sqts_assembly(sqts, sqts + kNumSqtElements * stride);
+  std::vector<float> affines_assembly(kNumAffineElements * stride);
+  MOTIVE_ASSEMBLY_FUNCTION_NAME(SqtsToAffines_)(
+      &sqts_assembly.front(), count, stride, &affines_assembly.front());
+  SqtsToAffines_C(sqts, count, stride, affines);
+
+  for (int k = 0; k < kNumSqtElements; ++k) {
+    for (int j = 0; j < count; ++j) {
+      assert(sqts[k * stride + j] == sqts_assembly[k * stride + j]);
+    }
+  }
+  for (int k = 0; k < kNumAffineElements; ++k) {
+    for (int j = 0; j < count; ++j) {
+      assert(affines[k * stride + j] == affines_assembly[k * stride + j]);
+    }
+  }
+
+#else  // not defined(MOTIVE_ASSEMBLY_TEST)
+
+  if (kernels != nullptr) {
+    kernels->sqts_to_affines(sqts, count, stride, affines);
+  } else {
+    SqtsToAffines_C(sqts, count, stride, affines);
+  }
+
+#endif  // not defined(MOTIVE_ASSEMBLY_TEST)
+}
+
+}  // namespace motive
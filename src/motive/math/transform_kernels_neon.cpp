@@ -0,0 +1,134 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "motive/math/transform_kernels.h"
+
+#if defined(MOTIVE_NEON)
+
+#include <arm_neon.h>
+#include <cmath>
+
+namespace motive {
+
+// Operations are performed in the same order as in the C++ versions, so the
+// results match bit-for-bit. This lets MOTIVE_ASSEMBLY_TEST compare them
+// exactly. Multiplies and adds are issued separately, since vmlaq_f32() may
+// be fused on some targets. The transforms left over after the last full
+// register are passed to the C++ versions.
+
+void MultiplyAffines_Neon(const float* parents, const float* locals,
+                          int count, int stride, float* globals) {
+  int j = 0;
+  for (; j + 4 <= count; j += 4) {
+    for (int r = 0; r < 3; ++r) {
+      const float32x4_t p0 = vld1q_f32(&parents[(r * 4) * stride + j]);
+      const float32x4_t p1 = vld1q_f32(&parents[(r * 4 + 1) * stride + j]);
+      const float32x4_t p2 = vld1q_f32(&parents[(r * 4 + 2) * stride + j]);
+      for (int c = 0; c < 4; ++c) {
+        const float32x4_t l0 = vld1q_f32(&locals[c * stride + j]);
+        const float32x4_t l1 = vld1q_f32(&locals[(4 + c) * stride + j]);
+        const float32x4_t l2 = vld1q_f32(&locals[(8 + c) * stride + j]);
+        float32x4_t g = vaddq_f32(
+            vaddq_f32(vmulq_f32(p0, l0), vmulq_f32(p1, l1)),
+            vmulq_f32(p2, l2));
+        if (c == 3) {
+          g = vaddq_f32(g, vld1q_f32(&parents[(r * 4 + 3) * stride + j]));
+        }
+        vst1q_f32(&globals[(r * 4 + c) * stride + j], g);
+      }
+    }
+  }
+  MultiplyAffines_C(parents + j, locals + j, count - j, stride, globals + j);
+}
+
+// 1 / sqrt(length_squared), correctly rounded, as the C++ version computes
+// it. ARMv7 NEON only has reciprocal square root estimates, which don't match,
+// so each lane is computed with VFP instead.
+static inline float32x4_t ReciprocalLength(float32x4_t length_squared) {
+#if defined(__aarch64__)
+  return vdivq_f32(vdupq_n_f32(1.0f), vsqrtq_f32(length_squared));
+#else
+  float lanes[4];
+  vst1q_f32(lanes, length_squared);
+  for (int i = 0; i < 4; ++i) {
+    lanes[i] = 1.0f / std::sqrt(lanes[i]);
+  }
+  return vld1q_f32(lanes);
+#endif  // defined(__aarch64__)
+}
+
+void SqtsToAffines_Neon(float* sqts, int count, int stride, float* affines) {
+  const float32x4_t one = vdupq_n_f32(1.0f);
+  const float32x4_t two = vdupq_n_f32(2.0f);
+  int j = 0;
+  for (; j + 4 <= count; j += 4) {
+    // Normalize the quaternions.
+    float32x4_t w = vld1q_f32(&sqts[kSqtRotationW * stride + j]);
+    float32x4_t x = vld1q_f32(&sqts[kSqtRotationX * stride + j]);
+    float32x4_t y = vld1q_f32(&sqts[kSqtRotationY * stride + j]);
+    float32x4_t z = vld1q_f32(&sqts[kSqtRotationZ * stride + j]);
+    const float32x4_t length_squared = vaddq_f32(
+        vmulq_f32(w, w),
+        vaddq_f32(vaddq_f32(vmulq_f32(x, x), vmulq_f32(y, y)),
+                  vmulq_f32(z, z)));
+    const float32x4_t scale = ReciprocalLength(length_squared);
+    w = vmulq_f32(w, scale);
+    x = vmulq_f32(x, scale);
+    y = vmulq_f32(y, scale);
+    z = vmulq_f32(z, scale);
+    vst1q_f32(&sqts[kSqtRotationW * stride + j], w);
+    vst1q_f32(&sqts[kSqtRotationX * stride + j], x);
+    vst1q_f32(&sqts[kSqtRotationY * stride + j], y);
+    vst1q_f32(&sqts[kSqtRotationZ * stride + j], z);
+
+    // Convert to rotation matrices, and scale each column.
+    const float32x4_t x2 = vmulq_f32(x, x);
+    const float32x4_t y2 = vmulq_f32(y, y);
+    const float32x4_t z2 = vmulq_f32(z, z);
+    const float32x4_t wx = vmulq_f32(w, x);
+    const float32x4_t wy = vmulq_f32(w, y);
+    const float32x4_t wz = vmulq_f32(w, z);
+    const float32x4_t xz = vmulq_f32(x, z);
+    const float32x4_t yz = vmulq_f32(y, z);
+    const float32x4_t xy = vmulq_f32(x, y);
+    const float32x4_t sx = vld1q_f32(&sqts[kSqtScaleX * stride + j]);
+    const float32x4_t sy = vld1q_f32(&sqts[kSqtScaleY * stride + j]);
+    const float32x4_t sz = vld1q_f32(&sqts[kSqtScaleZ * stride + j]);
+    float* m = &affines[j];
+    vst1q_f32(&m[0 * stride],
+              vmulq_f32(vsubq_f32(one, vmulq_f32(two, vaddq_f32(y2, z2))),
+                        sx));
+    vst1q_f32(&m[1 * stride], vmulq_f32(vmulq_f32(two, vsubq_f32(xy, wz)), sy));
+    vst1q_f32(&m[2 * stride], vmulq_f32(vmulq_f32(two, vaddq_f32(wy, xz)), sz));
+    vst1q_f32(&m[3 * stride], vld1q_f32(&sqts[kSqtTranslationX * stride + j]));
+    vst1q_f32(&m[4 * stride], vmulq_f32(vmulq_f32(two, vaddq_f32(xy, wz)), sx));
+    vst1q_f32(&m[5 * stride],
+              vmulq_f32(vsubq_f32(one, vmulq_f32(two, vaddq_f32(x2, z2))),
+                        sy));
+    vst1q_f32(&m[6 * stride], vmulq_f32(vmulq_f32(two, vsubq_f32(yz, wx)), sz));
+    vst1q_f32(&m[7 * stride], vld1q_f32(&sqts[kSqtTranslationY * stride + j]));
+    vst1q_f32(&m[8 * stride], vmulq_f32(vmulq_f32(two, vsubq_f32(xz, wy)), sx));
+    vst1q_f32(&m[9 * stride], vmulq_f32(vmulq_f32(two, vaddq_f32(wx, yz)), sy));
+    vst1q_f32(&m[10 * stride],
+              vmulq_f32(vsubq_f32(one, vmulq_f32(two, vaddq_f32(x2, y2))),
+                        sz));
+    vst1q_f32(&m[11 * stride],
+              vld1q_f32(&sqts[kSqtTranslationZ * stride + j]));
+  }
+  SqtsToAffines_C(sqts + j, count - j, stride, affines + j);
+}
+
+}  // namespace motive
+
+#endif  // defined(MOTIVE_NEON)
@@ -0,0 +1,139 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "motive/math/transform_kernels.h"
+
+#if defined(MOTIVE_WASM_SIMD)
+
+#include <wasm_simd128.h>
+
+namespace motive {
+
+// Operations are performed in the same order as in the C++ versions. WASM
+// SIMD has no fused multiply-add, and its square root and divide are
+// correctly rounded, so the results match bit-for-bit. This lets
+// MOTIVE_ASSEMBLY_TEST compare them exactly. The transforms left over after
+// the last full register are passed to the C++ versions.
+
+void MultiplyAffines_Wasm(const float* parents, const float* locals,
+                          int count, int stride, float* globals) {
+  int j = 0;
+  for (; j + 4 <= count; j += 4) {
+    for (int r = 0; r < 3; ++r) {
+      const v128_t p0 = wasm_v128_load(&parents[(r * 4) * stride + j]);
+      const v128_t p1 = wasm_v128_load(&parents[(r * 4 + 1) * stride + j]);
+      const v128_t p2 = wasm_v128_load(&parents[(r * 4 + 2) * stride + j]);
+      for (int c = 0; c < 4; ++c) {
+        const v128_t l0 = wasm_v128_load(&locals[c * stride + j]);
+        const v128_t l1 = wasm_v128_load(&locals[(4 + c) * stride + j]);
+        const v128_t l2 = wasm_v128_load(&locals[(8 + c) * stride + j]);
+        v128_t g = wasm_f32x4_add(wasm_f32x4_add(wasm_f32x4_mul(p0, l0),
+                                                 wasm_f32x4_mul(p1, l1)),
+                                  wasm_f32x4_mul(p2, l2));
+        if (c == 3) {
+          g = wasm_f32x4_add(
+              g, wasm_v128_load(&parents[(r * 4 + 3) * stride + j]));
+        }
+        wasm_v128_store(&globals[(r * 4 + c) * stride + j], g);
+      }
+    }
+  }
+  MultiplyAffines_C(parents + j, locals + j, count - j, stride, globals + j);
+}
+
+void SqtsToAffines_Wasm(float* sqts, int count, int stride, float* affines) {
+  const v128_t one = wasm_f32x4_splat(1.0f);
+  const v128_t two = wasm_f32x4_splat(2.0f);
+  int j = 0;
+  for (; j + 4 <= count; j += 4) {
+    // Normalize the quaternions.
+    v128_t w = wasm_v128_load(&sqts[kSqtRotationW * stride + j]);
+    v128_t x = wasm_v128_load(&sqts[kSqtRotationX * stride + j]);
+    v128_t y = wasm_v128_load(&sqts[kSqtRotationY * stride + j]);
+    v128_t z = wasm_v128_load(&sqts[kSqtRotationZ * stride + j]);
+    const v128_t length_squared = wasm_f32x4_add(
+        wasm_f32x4_mul(w, w),
+        wasm_f32x4_add(wasm_f32x4_add(wasm_f32x4_mul(x, x),
+                                      wasm_f32x4_mul(y, y)),
+                       wasm_f32x4_mul(z, z)));
+    const v128_t scale = wasm_f32x4_div(one, wasm_f32x4_sqrt(length_squared));
+    w = wasm_f32x4_mul(w, scale);
+    x = wasm_f32x4_mul(x, scale);
+    y = wasm_f32x4_mul(y, scale);
+    z = wasm_f32x4_mul(z, scale);
+    wasm_v128_store(&sqts[kSqtRotationW * stride + j], w);
+    wasm_v128_store(&sqts[kSqtRotationX * stride + j], x);
+    wasm_v128_store(&sqts[kSqtRotationY * stride + j], y);
+    wasm_v128_store(&sqts[kSqtRotationZ * stride + j], z);
+
+    // Convert to rotation matrices, and scale each column.
+    const v128_t x2 = wasm_f32x4_mul(x, x);
+    const v128_t y2 = wasm_f32x4_mul(y, y);
+    const v128_t z2 = wasm_f32x4_mul(z, z);
+    const v128_t wx = wasm_f32x4_mul(w, x);
+    const v128_t wy = wasm_f32x4_mul(w, y);
+    const v128_t wz = wasm_f32x4_mul(w, z);
+    const v128_t xz = wasm_f32x4_mul(x, z);
+    const v128_t yz = wasm_f32x4_mul(y, z);
+    const v128_t xy = wasm_f32x4_mul(x, y);
+    const v128_t sx = wasm_v128_load(&sqts[kSqtScaleX * stride + j]);
+    const v128_t sy = wasm_v128_load(&sqts[kSqtScaleY * stride + j]);
+    const v128_t sz = wasm_v128_load(&sqts[kSqtScaleZ * stride + j]);
+    float* m = &affines[j];
+    wasm_v128_store(
+        &m[0 * stride],
+        wasm_f32x4_mul(
+            wasm_f32x4_sub(one, wasm_f32x4_mul(two, wasm_f32x4_add(y2, z2))),
+            sx));
+    wasm_v128_store(&m[1 * stride],
+                    wasm_f32x4_mul(wasm_f32x4_mul(two, wasm_f32x4_sub(xy, wz)),
+                                   sy));
+    wasm_v128_store(&m[2 * stride],
+                    wasm_f32x4_mul(wasm_f32x4_mul(two, wasm_f32x4_add(wy, xz)),
+                                   sz));
+    wasm_v128_store(&m[3 * stride],
+                    wasm_v128_load(&sqts[kSqtTranslationX * stride + j]));
+    wasm_v128_store(&m[4 * stride],
+                    wasm_f32x4_mul(wasm_f32x4_mul(two, wasm_f32x4_add(xy, wz)),
+                                   sx));
+    wasm_v128_store(
+        &m[5 * stride],
+        wasm_f32x4_mul(
+            wasm_f32x4_sub(one, wasm_f32x4_mul(two, wasm_f32x4_add(x2, z2))),
+            sy));
+    wasm_v128_store(&m[6 * stride],
+                    wasm_f32x4_mul(wasm_f32x4_mul(two, wasm_f32x4_sub(yz, wx)),
+                                   sz));
+    wasm_v128_store(&m[7 * stride],
+                    wasm_v128_load(&sqts[kSqtTranslationY * stride + j]));
+    wasm_v128_store(&m[8 * stride],
+                    wasm_f32x4_mul(wasm_f32x4_mul(two, wasm_f32x4_sub(xz, wy)),
+                                   sx));
+    wasm_v128_store(&m[9 * stride],
+                    wasm_f32x4_mul(wasm_f32x4_mul(two, wasm_f32x4_add(wx, yz)),
+                                   sy));
+    wasm_v128_store(
+        &m[10 * stride],
+        wasm_f32x4_mul(
+            wasm_f32x4_sub(one, wasm_f32x4_mul(two, wasm_f32x4_add(x2, y2))),
+            sz));
+    wasm_v128_store(&m[11 * stride],
+                    wasm_v128_load(&sqts[kSqtTranslationZ * stride + j]));
+  }
+  SqtsToAffines_C(sqts + j, count - j, stride, affines + j);
+}
+
+}  // namespace motive
+
+#endif  // defined(MOTIVE_WASM_SIMD)
@@ -0,0 +1,242 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "motive/math/transform_kernels.h"
+
+#if defined(MOTIVE_X86_SIMD)
+
+#include <immintrin.h>
+
+// Compile each kernel for its own instruction set, so that the rest of the
+// library can still run on processors without it. Functions are only called
+// once BestProcessorOptimization() has confirmed support.
+#if defined(__GNUC__) || defined(__clang__)
+#define MOTIVE_TARGET(isa) __attribute__((target(isa)))
+#else
+#define MOTIVE_TARGET(isa)
+#endif
+
+namespace motive {
+
+// Operations are performed in the same order as in the C++ versions, and
+// without fused multiply-adds, so the results match bit-for-bit. This lets
+// MOTIVE_ASSEMBLY_TEST compare them exactly. The transforms left over after
+// the last full register are passed to the C++ versions.
+
+MOTIVE_TARGET("sse4.1")
+void MultiplyAffines_Sse4(const float* parents, const float* locals,
+                          int count, int stride, float* globals) {
+  int j = 0;
+  for (; j + 4 <= count; j += 4) {
+    for (int r = 0; r < 3; ++r) {
+      const __m128 p0 = _mm_loadu_ps(&parents[(r * 4) * stride + j]);
+      const __m128 p1 = _mm_loadu_ps(&parents[(r * 4 + 1) * stride + j]);
+      const __m128 p2 = _mm_loadu_ps(&parents[(r * 4 + 2) * stride + j]);
+      for (int c = 0; c < 4; ++c) {
+        const __m128 l0 = _mm_loadu_ps(&locals[c * stride + j]);
+        const __m128 l1 = _mm_loadu_ps(&locals[(4 + c) * stride + j]);
+        const __m128 l2 = _mm_loadu_ps(&locals[(8 + c) * stride + j]);
+        __m128 g = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p0, l0),
+                                         _mm_mul_ps(p1, l1)),
+                              _mm_mul_ps(p2, l2));
+        if (c == 3) {
+          g = _mm_add_ps(g, _mm_loadu_ps(&parents[(r * 4 + 3) * stride + j]));
+        }
+        _mm_storeu_ps(&globals[(r * 4 + c) * stride + j], g);
+      }
+    }
+  }
+  MultiplyAffines_C(parents + j, locals + j, count - j, stride, globals + j);
+}
+
+MOTIVE_TARGET("sse4.1")
+void SqtsToAffines_Sse4(float* sqts, int count, int stride, float* affines) {
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 two = _mm_set1_ps(2.0f);
+  int j = 0;
+  for (; j + 4 <= count; j += 4) {
+    // Normalize the quaternions.
+    __m128 w = _mm_loadu_ps(&sqts[kSqtRotationW * stride + j]);
+    __m128 x = _mm_loadu_ps(&sqts[kSqtRotationX * stride + j]);
+    __m128 y = _mm_loadu_ps(&sqts[kSqtRotationY * stride + j]);
+    __m128 z = _mm_loadu_ps(&sqts[kSqtRotationZ * stride + j]);
+    const __m128 length_squared = _mm_add_ps(
+        _mm_mul_ps(w, w),
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)),
+                   _mm_mul_ps(z, z)));
+    const __m128 scale = _mm_div_ps(one, _mm_sqrt_ps(length_squared));
+    w = _mm_mul_ps(w, scale);
+    x = _mm_mul_ps(x, scale);
+    y = _mm_mul_ps(y, scale);
+    z = _mm_mul_ps(z, scale);
+    _mm_storeu_ps(&sqts[kSqtRotationW * stride + j], w);
+    _mm_storeu_ps(&sqts[kSqtRotationX * stride + j], x);
+    _mm_storeu_ps(&sqts[kSqtRotationY * stride + j], y);
+    _mm_storeu_ps(&sqts[kSqtRotationZ * stride + j], z);
+
+    // Convert to rotation matrices, and scale each column.
+    const __m128 x2 = _mm_mul_ps(x, x);
+    const __m128 y2 = _mm_mul_ps(y, y);
+    const __m128 z2 = _mm_mul_ps(z, z);
+    const __m128 wx = _mm_mul_ps(w, x);
+    const __m128 wy = _mm_mul_ps(w, y);
+    const __m128 wz = _mm_mul_ps(w, z);
+    const __m128 xz = _mm_mul_ps(x, z);
+    const __m128 yz = _mm_mul_ps(y, z);
+    const __m128 xy = _mm_mul_ps(x, y);
+    const __m128 sx = _mm_loadu_ps(&sqts[kSqtScaleX * stride + j]);
+    const __m128 sy = _mm_loadu_ps(&sqts[kSqtScaleY * stride + j]);
+    const __m128 sz = _mm_loadu_ps(&sqts[kSqtScaleZ * stride + j]);
+    float* m = &affines[j];
+    _mm_storeu_ps(
+        &m[0 * stride],
+        _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(y2, z2))), sx));
+    _mm_storeu_ps(&m[1 * stride],
+                  _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy));
+    _mm_storeu_ps(&m[2 * stride],
+                  _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(wy, xz)), sz));
+    _mm_storeu_ps(&m[3 * stride],
+                  _mm_loadu_ps(&sqts[kSqtTranslationX * stride + j]));
+    _mm_storeu_ps(&m[4 * stride],
+                  _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx));
+    _mm_storeu_ps(
+        &m[5 * stride],
+        _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(x2, z2))), sy));
+    _mm_storeu_ps(&m[6 * stride],
+                  _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz));
+    _mm_storeu_ps(&m[7 * stride],
+                  _mm_loadu_ps(&sqts[kSqtTranslationY * stride + j]));
+    _mm_storeu_ps(&m[8 * stride],
+                  _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx));
+    _mm_storeu_ps(&m[9 * stride],
+                  _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(wx, yz)), sy));
+    _mm_storeu_ps(
+        &m[10 * stride],
+        _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(x2, y2))), sz));
+    _mm_storeu_ps(&m[11 * stride],
+                  _mm_loadu_ps(&sqts[kSqtTranslationZ * stride + j]));
+  }
+  SqtsToAffines_C(sqts + j, count - j, stride, affines + j);
+}
+
+MOTIVE_TARGET("avx2")
+void MultiplyAffines_Avx2(const float* parents, const float* locals,
+                          int count, int stride, float* globals) {
+  int j = 0;
+  for (; j + 8 <= count; j += 8) {
+    for (int r = 0; r < 3; ++r) {
+      const __m256 p0 = _mm256_loadu_ps(&parents[(r * 4) * stride + j]);
+      const __m256 p1 = _mm256_loadu_ps(&parents[(r * 4 + 1) * stride + j]);
+      const __m256 p2 = _mm256_loadu_ps(&parents[(r * 4 + 2) * stride + j]);
+      for (int c = 0; c < 4; ++c) {
+        const __m256 l0 = _mm256_loadu_ps(&locals[c * stride + j]);
+        const __m256 l1 = _mm256_loadu_ps(&locals[(4 + c) * stride + j]);
+        const __m256 l2 = _mm256_loadu_ps(&locals[(8 + c) * stride + j]);
+        __m256 g = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(p0, l0),
+                                               _mm256_mul_ps(p1, l1)),
+                                 _mm256_mul_ps(p2, l2));
+        if (c == 3) {
+          g = _mm256_add_ps(
+              g, _mm256_loadu_ps(&parents[(r * 4 + 3) * stride + j]));
+        }
+        _mm256_storeu_ps(&globals[(r * 4 + c) * stride + j], g);
+      }
+    }
+  }
+  MultiplyAffines_Sse4(parents + j, locals + j, count - j, stride,
+                       globals + j);
+}
+
+MOTIVE_TARGET("avx2")
+void SqtsToAffines_Avx2(float* sqts, int count, int stride, float* affines) {
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 two = _mm256_set1_ps(2.0f);
+  int j = 0;
+  for (; j + 8 <= count; j += 8) {
+    // Normalize the quaternions.
+    __m256 w = _mm256_loadu_ps(&sqts[kSqtRotationW * stride + j]);
+    __m256 x = _mm256_loadu_ps(&sqts[kSqtRotationX * stride + j]);
+    __m256 y = _mm256_loadu_ps(&sqts[kSqtRotationY * stride + j]);
+    __m256 z = _mm256_loadu_ps(&sqts[kSqtRotationZ * stride + j]);
+    const __m256 length_squared = _mm256_add_ps(
+        _mm256_mul_ps(w, w),
+        _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)),
+                      _mm256_mul_ps(z, z)));
+    const __m256 scale = _mm256_div_ps(one, _mm256_sqrt_ps(length_squared));
+    w = _mm256_mul_ps(w, scale);
+    x = _mm256_mul_ps(x, scale);
+    y = _mm256_mul_ps(y, scale);
+    z = _mm256_mul_ps(z, scale);
+    _mm256_storeu_ps(&sqts[kSqtRotationW * stride + j], w);
+    _mm256_storeu_ps(&sqts[kSqtRotationX * stride + j], x);
+    _mm256_storeu_ps(&sqts[kSqtRotationY * stride + j], y);
+    _mm256_storeu_ps(&sqts[kSqtRotationZ * stride + j], z);
+
+    // Convert to rotation matrices, and scale each column.
+    const __m256 x2 = _mm256_mul_ps(x, x);
+    const __m256 y2 = _mm256_mul_ps(y, y);
+    const __m256 z2 = _mm256_mul_ps(z, z);
+    const __m256 wx = _mm256_mul_ps(w, x);
+    const __m256 wy = _mm256_mul_ps(w, y);
+    const __m256 wz = _mm256_mul_ps(w, z);
+    const __m256 xz = _mm256_mul_ps(x, z);
+    const __m256 yz = _mm256_mul_ps(y, z);
+    const __m256 xy = _mm256_mul_ps(x, y);
+    const __m256 sx = _mm256_loadu_ps(&sqts[kSqtScaleX * stride + j]);
+    const __m256 sy = _mm256_loadu_ps(&sqts[kSqtScaleY * stride + j]);
+    const __m256 sz = _mm256_loadu_ps(&sqts[kSqtScaleZ * stride + j]);
+    float* m = &affines[j];
+    _mm256_storeu_ps(
+        &m[0 * stride],
+        _mm256_mul_ps(
+            _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(y2, z2))), sx));
+    _mm256_storeu_ps(&m[1 * stride],
+                     _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xy, wz)),
+                                   sy));
+    _mm256_storeu_ps(&m[2 * stride],
+                     _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(wy, xz)),
+                                   sz));
+    _mm256_storeu_ps(&m[3 * stride],
+                     _mm256_loadu_ps(&sqts[kSqtTranslationX * stride + j]));
+    _mm256_storeu_ps(&m[4 * stride],
+                     _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xy, wz)),
+                                   sx));
+    _mm256_storeu_ps(
+        &m[5 * stride],
+        _mm256_mul_ps(
+            _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(x2, z2))), sy));
+    _mm256_storeu_ps(&m[6 * stride],
+                     _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(yz, wx)),
+                                   sz));
+    _mm256_storeu_ps(&m[7 * stride],
+                     _mm256_loadu_ps(&sqts[kSqtTranslationY * stride + j]));
+    _mm256_storeu_ps(&m[8 * stride],
+                     _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xz, wy)),
+                                   sx));
+    _mm256_storeu_ps(&m[9 * stride],
+                     _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(wx, yz)),
+                                   sy));
+    _mm256_storeu_ps(
+        &m[10 * stride],
+        _mm256_mul_ps(
+            _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(x2, y2))), sz));
+    _mm256_storeu_ps(&m[11 * stride],
+                     _mm256_loadu_ps(&sqts[kSqtTranslationZ * stride + j]));
+  }
+  SqtsToAffines_Sse4(sqts + j, count - j, stride, affines + j);
+}
+
+}  // namespace motive
+
+#endif  // defined(MOTIVE_X86_SIMD)
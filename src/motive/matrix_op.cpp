@@ -65,4 +65,272 @@ const char* MatrixOpName(const motive::MatrixOperationType op) {
   return kMatrixOpNames[op];
 }
 
+// Apply the operations `kTypes` to `m`, one after the other, reading their
+// values from consecutive elements of `ops`.
+template <MatrixOperationType... kTypes>
+struct MatrixOperationSequence;
+
+template <>
+struct MatrixOperationSequence<> {
+  static void Apply(const MatrixOperation* /*ops*/,
+                    MatrixOperation::ResultColumns* /*m*/) {}
+};
+
+template <MatrixOperationType kType, MatrixOperationType... kRest>
+struct MatrixOperationSequence<kType, kRest...> {
+  static void Apply(const MatrixOperation* ops,
+                    MatrixOperation::ResultColumns* m) {
+    assert(ops->Type() == kType);
+    MatrixOperation::ApplyOperation<kType>(ops->Value(), m);
+    MatrixOperationSequence<kRest...>::Apply(ops + 1, m);
+  }
+};
+
+// Offset of float `r` of column `c` of the first of `count` matrices, in the
+// structure-of-arrays order of a MatrixOperation::BatchKernel. The same float
+// of the other matrices follows it.
+static inline size_t ColumnOffset(size_t count, int c, int r) {
+  return (4 * c + r) * count;
+}
+
+// Offset of component `axis` of the scale of the first of `count` matrices.
+static inline size_t ScaleOffset(size_t count, int axis) {
+  return (16 + axis) * count;
+}
+
+// Same as MatrixOperation::RotateAboutAxis(), on columns `c0` and `c1` of
+// every matrix in `results`.
+static void RotateBatch(const float* angles, size_t count, int c0, int c1,
+                        float* results) {
+  float* a[4];
+  float* b[4];
+  for (int r = 0; r < 4; ++r) {
+    a[r] = results + ColumnOffset(count, c0, r);
+    b[r] = results + ColumnOffset(count, c1, r);
+  }
+  for (size_t j = 0; j < count; ++j) {
+    const float s = sinf(angles[j]);
+    const float c = cosf(angles[j]);
+    for (int r = 0; r < 4; ++r) {
+      const float a_r = a[r][j];
+      const float b_r = b[r][j];
+      a[r][j] = c * a_r + s * b_r;
+      b[r][j] = c * b_r - s * a_r;
+    }
+  }
+}
+
+// Translate every matrix in `results` along its column `axis`.
+static void TranslateBatch(const float* values, size_t count, int axis,
+                           float* results) {
+  for (int r = 0; r < 4; ++r) {
+    const float* along = results + ColumnOffset(count, axis, r);
+    float* translation = results + ColumnOffset(count, 3, r);
+    for (size_t j = 0; j < count; ++j) {
+      translation[j] += values[j] * along[j];
+    }
+  }
+}
+
+// Scale column `axis`, and scale component `axis`, of every matrix in
+// `results`.
+static void ScaleBatch(const float* values, size_t count, int axis,
+                       float* results) {
+  for (int r = 0; r < 4; ++r) {
+    float* column = results + ColumnOffset(count, axis, r);
+    for (size_t j = 0; j < count; ++j) {
+      column[j] *= values[j];
+    }
+  }
+  float* scale = results + ScaleOffset(count, axis);
+  for (size_t j = 0; j < count; ++j) {
+    scale[j] *= values[j];
+  }
+}
+
+// Same as MatrixOperation::ApplyOperation<kType>(), on every matrix in
+// `results`. Since the type is known at compile time, the switch compiles
+// away.
+template <MatrixOperationType kType>
+static void ApplyBatchOperation(const float* values, size_t count,
+                                float* results) {
+  switch (kType) {
+    case kRotateAboutX:
+      RotateBatch(values, count, 1, 2, results);
+      break;
+    case kRotateAboutY:
+      RotateBatch(values, count, 2, 0, results);
+      break;
+    case kRotateAboutZ:
+      RotateBatch(values, count, 0, 1, results);
+      break;
+    case kTranslateX:
+      TranslateBatch(values, count, 0, results);
+      break;
+    case kTranslateY:
+      TranslateBatch(values, count, 1, results);
+      break;
+    case kTranslateZ:
+      TranslateBatch(values, count, 2, results);
+      break;
+    case kScaleX:
+      ScaleBatch(values, count, 0, results);
+      break;
+    case kScaleY:
+      ScaleBatch(values, count, 1, results);
+      break;
+    case kScaleZ:
+      ScaleBatch(values, count, 2, results);
+      break;
+    case kScaleUniformly:
+      ScaleBatch(values, count, 0, results);
+      ScaleBatch(values, count, 1, results);
+      ScaleBatch(values, count, 2, results);
+      break;
+    default:
+      // All other operations, including quaternions, are not supported.
+      assert(false);
+  }
+}
+
+// Apply the operations `kTypes` to each of `count` matrices in `results`,
+// reading their values from the structure-of-arrays `values`. Each operation
+// is applied to every matrix before moving on to the next operation, so the
+// inner loops run over matrices and have no branches.
+template <MatrixOperationType... kTypes>
+struct MatrixOperationBatch;
+
+template <>
+struct MatrixOperationBatch<> {
+  static void Apply(const float* /*values*/, size_t /*count*/,
+                    float* /*results*/) {}
+};
+
+template <MatrixOperationType kType, MatrixOperationType... kRest>
+struct MatrixOperationBatch<kType, kRest...> {
+  static void Apply(const float* values, size_t count, float* results) {
+    ApplyBatchOperation<kType>(values, count, results);
+    MatrixOperationBatch<kRest...>::Apply(values + count, count, results);
+  }
+};
+
+// MatrixOperation::Kernel for the sequence of operations `kTypes`.
+template <MatrixOperationType... kTypes>
+static void CalculateSequence(const MatrixOperation* ops, size_t num_ops,
+                              MatrixOperation::ResultColumns* m) {
+  assert(num_ops == sizeof...(kTypes));
+  (void)num_ops;
+  MatrixOperationSequence<kTypes...>::Apply(ops, m);
+}
+
+// MatrixOperation::BatchKernel for the sequence of operations `kTypes`.
+template <MatrixOperationType... kTypes>
+static void CalculateSequenceBatch(const float* values, size_t count,
+                                   float* results) {
+  MatrixOperationBatch<kTypes...>::Apply(values, count, results);
+}
+
+// static
+void MatrixOperation::ScatterResult(const ResultColumns& m, size_t j,
+                                    size_t count, float* results) {
+  const mathfu::vec4* columns[] = {&m.c0, &m.c1, &m.c2, &m.c3};
+  for (int c = 0; c < 4; ++c) {
+    for (int r = 0; r < 4; ++r) {
+      results[ColumnOffset(count, c, r) + j] = (*columns[c])[r];
+    }
+  }
+  for (int axis = 0; axis < 3; ++axis) {
+    results[ScaleOffset(count, axis) + j] = m.scale[axis];
+  }
+}
+
+// static
+void MatrixOperation::GatherResult(const float* results, size_t j,
+                                   size_t count, ResultColumns* m) {
+  mathfu::vec4* columns[] = {&m->c0, &m->c1, &m->c2, &m->c3};
+  for (int c = 0; c < 4; ++c) {
+    for (int r = 0; r < 4; ++r) {
+      (*columns[c])[r] = results[ColumnOffset(count, c, r) + j];
+    }
+  }
+  for (int axis = 0; axis < 3; ++axis) {
+    m->scale[axis] = results[ScaleOffset(count, axis) + j];
+  }
+}
+
+// The longest sequence of operations with a specialized kernel.
+static const size_t kMaxKernelOps = 10;
+
+struct MatrixOperationKernel {
+  size_t num_ops;
+  MatrixOperationType types[kMaxKernelOps];
+  MatrixOperation::Kernel kernel;
+  MatrixOperation::BatchKernel batch_kernel;
+};
+
+template <MatrixOperationType... kTypes>
+static MatrixOperationKernel MakeKernel() {
+  static_assert(sizeof...(kTypes) <= kMaxKernelOps, "Increase kMaxKernelOps");
+  const MatrixOperationKernel kernel = {
+      sizeof...(kTypes), {kTypes...}, &CalculateSequence<kTypes...>,
+      &CalculateSequenceBatch<kTypes...>};
+  return kernel;
+}
+
+// Common sequences of operations. Animations exported by the anim_pipeline
+// translate, rotate in Euler order, then scale, with default channels
+// removed. Leading constant operations are folded by MatrixData, so the
+// sequences that remain after a constant translation are included too.
+static const MatrixOperationKernel kKernels[] = {
+    MakeKernel<>(),
+    MakeKernel<kTranslateX, kTranslateY, kTranslateZ>(),
+    MakeKernel<kRotateAboutX>(),
+    MakeKernel<kRotateAboutY>(),
+    MakeKernel<kRotateAboutZ>(),
+    MakeKernel<kRotateAboutZ, kRotateAboutY, kRotateAboutX>(),
+    MakeKernel<kTranslateX, kTranslateY, kTranslateZ, kRotateAboutY>(),
+    MakeKernel<kTranslateX, kTranslateY, kTranslateZ, kRotateAboutZ,
+               kRotateAboutY, kRotateAboutX>(),
+    MakeKernel<kTranslateX, kTranslateY, kTranslateZ, kRotateAboutX,
+               kRotateAboutY, kRotateAboutZ>(),
+    MakeKernel<kTranslateX, kTranslateY, kTranslateZ, kScaleUniformly>(),
+    MakeKernel<kTranslateX, kTranslateY, kTranslateZ, kScaleX, kScaleY,
+               kScaleZ>(),
+    MakeKernel<kTranslateX, kTranslateY, kTranslateZ, kRotateAboutY,
+               kScaleUniformly>(),
+    MakeKernel<kTranslateX, kTranslateY, kTranslateZ, kRotateAboutZ,
+               kRotateAboutY, kRotateAboutX, kScaleUniformly>(),
+    MakeKernel<kTranslateX, kTranslateY, kTranslateZ, kRotateAboutZ,
+               kRotateAboutY, kRotateAboutX, kScaleX, kScaleY, kScaleZ>(),
+    MakeKernel<kScaleUniformly>(),
+    MakeKernel<kScaleX, kScaleY, kScaleZ>(),
+    MakeKernel<kRotateAboutY, kScaleUniformly>(),
+    MakeKernel<kRotateAboutZ, kRotateAboutY, kRotateAboutX, kScaleUniformly>(),
+    MakeKernel<kRotateAboutZ, kRotateAboutY, kRotateAboutX, kScaleX, kScaleY,
+               kScaleZ>(),
+};
+
+// static
+MatrixOperation::Kernel MatrixOperation::FindKernel(const MatrixOperation* ops,
+                                                    size_t num_ops) {
+  for (size_t k = 0; k < MOTIVE_ARRAY_SIZE(kKernels); ++k) {
+    const MatrixOperationKernel& kernel = kKernels[k];
+    if (kernel.num_ops != num_ops) continue;
+
+    size_t i = 0;
+    while (i < num_ops && ops[i].Type() == kernel.types[i]) ++i;
+    if (i == num_ops) return kernel.kernel;
+  }
+  return &MatrixOperation::ApplyOperations;
+}
+
+// static
+MatrixOperation::BatchKernel MatrixOperation::FindBatchKernel(
+    MatrixOperation::Kernel kernel) {
+  for (size_t k = 0; k < MOTIVE_ARRAY_SIZE(kKernels); ++k) {
+    if (kKernels[k].kernel == kernel) return kKernels[k].batch_kernel;
+  }
+  return nullptr;
+}
+
 }  // namespace motive
@@ -27,7 +27,13 @@ void Motivator::InitializeWithDimension(const MotivatorInit& init,
   // one processor per type. Get that processor.
   MotiveProcessor* processor = engine->Processor(init.type());
 
-  // Register and initialize ourselves with the MotiveProcessor.
+  // Register and initialize ourselves with the MotiveProcessor. Any child
+  // Motivators that the processor initializes are not recorded.
+  MotiveRecorder* recorder = engine->recorder();
+  if (recorder != nullptr) {
+    recorder->RecordInitialize(this, init, dimensions);
+  }
+  const MotiveRecorder::NestedScope nested(recorder);
   processor->InitializeMotivator(init, engine, this, dimensions);
 }
 
@@ -0,0 +1,299 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "motive/pose_database.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+
+#include "motive/anim_table.h"
+#include "motive/rig_anim_sampler.h"
+#include "motive/util/trace.h"
+
+namespace motive {
+
+// Features whose standard deviation is below this are the same in every
+// pose, so are ignored.
+static const float kMinFeatureDeviation = 1e-6f;
+
+// Write the position of each of `bones` in `globals` to `positions`.
+static void BonePositions(const mathfu::AffineTransform* globals,
+                          const std::vector<BoneIndex>& bones,
+                          float* positions) {
+  for (size_t i = 0; i < bones.size(); ++i) {
+    // An AffineTransform stores the rows of its 3x4 matrix as columns, so
+    // the translation is its last row.
+    const mathfu::AffineTransform& g = globals[bones[i]];
+    for (int r = 0; r < 3; ++r) {
+      *positions++ = g(3, r);
+    }
+  }
+}
+
+// Write the features of a pose to `features`, from the positions of its bones
+// and the positions `delta_time` earlier.
+static void FeaturesFromPositions(const float* positions,
+                                  const float* previous_positions,
+                                  int num_bones, float delta_time,
+                                  float* features) {
+  const float inverse_time = delta_time > 0.0f ? 1.0f / delta_time : 0.0f;
+  for (int i = 0; i < num_bones; ++i) {
+    for (int r = 0; r < 3; ++r) {
+      const float position = positions[3 * i + r];
+      features[PoseDatabase::kFeaturesPerBone * i + r] = position;
+      features[PoseDatabase::kFeaturesPerBone * i + 3 + r] =
+          (position - previous_positions[3 * i + r]) * inverse_time;
+    }
+  }
+}
+
+void PoseDatabase::Clear() {
+  num_poses_ = 0;
+  num_features_ = 0;
+  clips_.clear();
+  bones_.clear();
+  features_.clear();
+  block_mins_.clear();
+  block_maxes_.clear();
+  feature_means_.clear();
+  feature_scales_.clear();
+  pose_clips_.clear();
+}
+
+bool PoseDatabase::Build(const AnimTable& table, int object,
+                         const int* anim_indices, int count, float pose_time,
+                         const BoneIndex* bones, int num_bones) {
+  assert(pose_time > 0.0f);
+  const TraceScope trace("Build", "PoseDatabase");
+  Clear();
+  if (num_bones > kMaxFeatureBones) return false;
+  const BoneIndex num_rig_bones = table.DefiningAnim(object).NumBones();
+  for (int i = 0; i < num_bones; ++i) {
+    if (bones[i] >= num_rig_bones) return false;
+  }
+  bones_.assign(bones, bones + num_bones);
+  num_features_ = num_bones * kFeaturesPerBone;
+
+  // Lay out the clips, one after another.
+  clips_.resize(count);
+  for (int i = 0; i < count; ++i) {
+    const RigAnim* anim = table.Query(object, anim_indices[i]);
+    if (anim == nullptr || anim->NumBones() != num_rig_bones) {
+      Clear();
+      return false;
+    }
+    Clip& clip = clips_[i];
+    const float duration = static_cast<float>(anim->end_time());
+    clip.anim = anim;
+    clip.first_pose = num_poses_;
+    clip.num_poses = static_cast<int>(std::ceil(duration / pose_time)) + 1;
+    clip.pose_time =
+        clip.num_poses > 1 ? duration / (clip.num_poses - 1) : 0.0f;
+    num_poses_ += clip.num_poses;
+    pose_clips_.insert(pose_clips_.end(), clip.num_poses, i);
+  }
+
+  // Sample the features of every pose, one clip per task. Velocities are the
+  // difference from the previous pose, or from the next one for the first
+  // pose of a clip.
+  std::vector<float> features(static_cast<size_t>(num_poses_) *
+                              num_features_);
+  const auto sample = [&](int begin, int end) {
+    std::vector<mathfu::AffineTransform,
+                mathfu::simd_allocator<mathfu::AffineTransform>>
+        transforms(num_rig_bones);
+    std::vector<float> positions(3 * num_bones);
+    std::vector<float> previous_positions(3 * num_bones);
+    for (int i = begin; i < end; ++i) {
+      RigAnimSampler sampler(*clips_[i].anim);
+      const Clip& clip = clips_[i];
+      for (int pose = 0; pose < clip.num_poses; ++pose) {
+        sampler.GlobalTransforms(pose * clip.pose_time, false,
+                                 transforms.data());
+        BonePositions(transforms.data(), bones_, positions.data());
+        float* out = &features[(clip.first_pose + pose) * num_features_];
+        FeaturesFromPositions(positions.data(),
+                              pose == 0 ? positions.data()
+                                        : previous_positions.data(),
+                              num_bones, clip.pose_time, out);
+        if (pose == 1) {
+          // Now that the second pose is known, give its velocity to the first.
+          float* first = out - num_features_;
+          for (int j = 0; j < num_bones; ++j) {
+            for (int r = 3; r < kFeaturesPerBone; ++r) {
+              first[j * kFeaturesPerBone + r] = out[j * kFeaturesPerBone + r];
+            }
+          }
+        }
+        positions.swap(previous_positions);
+      }
+    }
+  };
+  MotiveTaskScheduler* scheduler = table.task_scheduler();
+  if (scheduler == nullptr) {
+    sample(0, count);
+  } else {
+    scheduler->ParallelFor(count, 1, sample);
+  }
+
+  // Scale each feature by its standard deviation, so that positions and
+  // velocities are equally important, whatever their units.
+  feature_means_.assign(num_features_, 0.0f);
+  feature_scales_.assign(num_features_, 0.0f);
+  for (int f = 0; f < num_features_; ++f) {
+    double sum = 0.0;
+    double sum_squares = 0.0;
+    for (int p = 0; p < num_poses_; ++p) {
+      const double value = features[p * num_features_ + f];
+      sum += value;
+      sum_squares += value * value;
+    }
+    const double mean = num_poses_ > 0 ? sum / num_poses_ : 0.0;
+    const double variance =
+        num_poses_ > 0 ? std::max(0.0, sum_squares / num_poses_ - mean * mean)
+                       : 0.0;
+    const float deviation = static_cast<float>(std::sqrt(variance));
+    feature_means_[f] = static_cast<float>(mean);
+    feature_scales_[f] =
+        deviation > kMinFeatureDeviation ? 1.0f / deviation : 0.0f;
+  }
+
+  // Transpose into blocks, and find the bounds of each block.
+  const int num_blocks = (num_poses_ + kPosesPerBlock - 1) / kPosesPerBlock;
+  features_.assign(
+      static_cast<size_t>(num_blocks) * num_features_ * kPosesPerBlock,
+      std::numeric_limits<float>::infinity());
+  block_mins_.assign(static_cast<size_t>(num_blocks) * num_features_,
+                     std::numeric_limits<float>::infinity());
+  block_maxes_.assign(static_cast<size_t>(num_blocks) * num_features_,
+                      -std::numeric_limits<float>::infinity());
+  for (int p = 0; p < num_poses_; ++p) {
+    const int block = p / kPosesPerBlock;
+    for (int f = 0; f < num_features_; ++f) {
+      const float value = (features[p * num_features_ + f] -
+                           feature_means_[f]) * feature_scales_[f];
+      features_[(block * num_features_ + f) * kPosesPerBlock +
+                p % kPosesPerBlock] = value;
+      float& block_min = block_mins_[block * num_features_ + f];
+      float& block_max = block_maxes_[block * num_features_ + f];
+      block_min = std::min(block_min, value);
+      block_max = std::max(block_max, value);
+    }
+  }
+  return true;
+}
+
+void PoseDatabase::ComputeFeatures(
+    const mathfu::AffineTransform* globals,
+    const mathfu::AffineTransform* previous_globals, float delta_time,
+    float* features) const {
+  float positions[3 * kMaxFeatureBones];
+  float previous_positions[3 * kMaxFeatureBones];
+  BonePositions(globals, bones_, positions);
+  BonePositions(previous_globals, bones_, previous_positions);
+  FeaturesFromPositions(positions, previous_positions,
+                        static_cast<int>(bones_.size()), delta_time, features);
+}
+
+float PoseDatabase::BlockBound(const float* query, int block) const {
+  const float* mins = &block_mins_[block * num_features_];
+  const float* maxes = &block_maxes_[block * num_features_];
+  float bound = 0.0f;
+  for (int f = 0; f < num_features_; ++f) {
+    const float nearest = std::min(std::max(query[f], mins[f]), maxes[f]);
+    const float difference = query[f] - nearest;
+    bound += difference * difference;
+  }
+  return bound;
+}
+
+void PoseDatabase::SearchBlock(const float* query, int block,
+                               PoseMatch* match) const {
+  // Accumulate the distances of all the block's poses together, one feature
+  // at a time, so that the inner loop vectorizes.
+  float distances[kPosesPerBlock] = {0.0f};
+  const float* values = &features_[block * num_features_ * kPosesPerBlock];
+  for (int f = 0; f < num_features_; ++f) {
+    const float q = query[f];
+    for (int p = 0; p < kPosesPerBlock; ++p) {
+      const float difference = values[p] - q;
+      distances[p] += difference * difference;
+    }
+    values += kPosesPerBlock;
+  }
+
+  for (int p = 0; p < kPosesPerBlock; ++p) {
+    if (distances[p] < match->distance) {
+      match->distance = distances[p];
+      match->pose = block * kPosesPerBlock + p;
+    }
+  }
+}
+
+bool PoseDatabase::Search(const float* features, PoseMatch* match) const {
+  *match = PoseMatch();
+  if (num_poses_ == 0) return false;
+
+  float query[kFeaturesPerBone * kMaxFeatureBones];
+  for (int f = 0; f < num_features_; ++f) {
+    query[f] = (features[f] - feature_means_[f]) * feature_scales_[f];
+  }
+
+  // Search the block that's most likely to hold the match first, so that
+  // most of the others can then be skipped by their bounds alone.
+  const int num_blocks = (num_poses_ + kPosesPerBlock - 1) / kPosesPerBlock;
+  int first_block = 0;
+  float first_bound = std::numeric_limits<float>::infinity();
+  for (int b = 0; b < num_blocks; ++b) {
+    const float bound = BlockBound(query, b);
+    if (bound < first_bound) {
+      first_bound = bound;
+      first_block = b;
+    }
+  }
+  SearchBlock(query, first_block, match);
+  for (int b = 0; b < num_blocks; ++b) {
+    if (b != first_block && BlockBound(query, b) < match->distance) {
+      SearchBlock(query, b, match);
+    }
+  }
+
+  const Clip& clip = clips_[pose_clips_[match->pose]];
+  match->clip = pose_clips_[match->pose];
+  match->time = (match->pose - clip.first_pose) * clip.pose_time;
+  return true;
+}
+
+SplinePlayback PoseDatabase::Playback(const PoseMatch& match,
+                                      float blend_time) const {
+  const RigAnim& anim = Anim(match);
+  return SplinePlayback(match.time, anim.repeat(), 1.0f, blend_time);
+}
+
+void PoseDatabase::PoseFeatures(int pose, float* features) const {
+  assert(0 <= pose && pose < num_poses_);
+  const int block = pose / kPosesPerBlock;
+  const float* values = &features_[block * num_features_ * kPosesPerBlock +
+                                   pose % kPosesPerBlock];
+  for (int f = 0; f < num_features_; ++f) {
+    // Features that are the same in every pose were scaled to zero.
+    features[f] = feature_scales_[f] == 0.0f
+                      ? feature_means_[f]
+                      : values[f * kPosesPerBlock] / feature_scales_[f] +
+                            feature_means_[f];
+  }
+}
+
+}  // namespace motive
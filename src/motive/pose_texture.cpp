@@ -0,0 +1,366 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "motive/pose_texture.h"
+
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "motive/anim_table.h"
+#include "motive/math/float.h"
+#include "motive/rig_anim_sampler.h"
+#include "motive/util/trace.h"
+
+namespace motive {
+
+// Identifies files written by PoseTexture::Serialize(). "MPT1".
+static const uint32_t kPoseTextureMagic = 0x3154504D;
+
+// Elements per bone in each row: three texels of four.
+static const int kElementsPerBone = 12;
+
+static void WriteUint(uint32_t value, std::vector<uint8_t>* out) {
+  for (size_t i = 0; i < sizeof(value); ++i) {
+    out->push_back(static_cast<uint8_t>(value >> (8 * i)));
+  }
+}
+
+static void WriteFloat(float value, std::vector<uint8_t>* out) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  WriteUint(bits, out);
+}
+
+namespace {
+
+// Reads little endian fields, and remembers if it ran out of data.
+class BufferReader {
+ public:
+  BufferReader(const uint8_t* data, size_t size)
+      : data_(data), size_(size), offset_(0), ok_(true) {}
+
+  uint32_t Uint() {
+    if (!ok_ || sizeof(uint32_t) > size_ - offset_) {
+      ok_ = false;
+      return 0;
+    }
+    uint32_t value = 0;
+    for (size_t i = 0; i < sizeof(uint32_t); ++i) {
+      value |= static_cast<uint32_t>(data_[offset_ + i]) << (8 * i);
+    }
+    offset_ += sizeof(uint32_t);
+    return value;
+  }
+
+  float Float() {
+    const uint32_t bits = Uint();
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  // Return `size` bytes, or nullptr if there aren't that many left.
+  const uint8_t* Bytes(size_t size) {
+    if (!ok_ || size > size_ - offset_) {
+      ok_ = false;
+      return nullptr;
+    }
+    const uint8_t* bytes = data_ + offset_;
+    offset_ += size;
+    return bytes;
+  }
+
+  bool ok() const { return ok_; }
+
+ private:
+  const uint8_t* data_;
+  size_t size_;
+  size_t offset_;
+  bool ok_;
+};
+
+}  // namespace
+
+PoseTexture::PoseTexture() { Clear(); }
+
+void PoseTexture::Clear() {
+  format_ = kFloat;
+  num_bones_ = 0;
+  num_frames_ = 0;
+  clips_.clear();
+  clip_indices_.clear();
+  for (int c = 0; c < 4; ++c) {
+    dequantize_offset_[c] = 0.0f;
+    dequantize_scale_[c] = 1.0f;
+  }
+  data_.clear();
+}
+
+void PoseTexture::BuildClipIndices() {
+  clip_indices_.clear();
+  for (size_t i = 0; i < clips_.size(); ++i) {
+    // If an animation is baked twice, find its first clip.
+    clip_indices_.insert(std::make_pair(clips_[i].name, static_cast<int>(i)));
+  }
+}
+
+bool PoseTexture::Bake(const AnimTable& table, int object,
+                       const int* anim_indices, int count, float frame_time,
+                       Format format,
+                       const mathfu::AffineTransform* inverse_bind_pose) {
+  assert(frame_time > 0.0f);
+  const TraceScope trace("Bake", "PoseTexture");
+  Clear();
+  format_ = format;
+  num_bones_ = table.DefiningAnim(object).NumBones();
+
+  // Lay out the clips, one after another.
+  std::vector<const RigAnim*> anims(count);
+  clips_.resize(count);
+  for (int i = 0; i < count; ++i) {
+    const RigAnim* anim = table.Query(object, anim_indices[i]);
+    if (anim == nullptr || anim->NumBones() != num_bones_) {
+      Clear();
+      return false;
+    }
+    anims[i] = anim;
+    Clip& clip = clips_[i];
+    clip.name = anim->anim_name();
+    clip.duration = static_cast<float>(anim->end_time());
+    clip.first_frame = static_cast<uint32_t>(num_frames_);
+    clip.num_frames =
+        static_cast<uint32_t>(std::ceil(clip.duration / frame_time)) + 1;
+    num_frames_ += clip.num_frames;
+  }
+  BuildClipIndices();
+
+  // Sample every frame as floats, one clip per task.
+  const size_t row_size = static_cast<size_t>(num_bones_) * kElementsPerBone;
+  std::vector<float> values(row_size * num_frames_);
+  const auto bake = [&](int begin, int end) {
+    std::vector<mathfu::AffineTransform,
+                mathfu::simd_allocator<mathfu::AffineTransform>>
+        transforms(num_bones_);
+    for (int i = begin; i < end; ++i) {
+      RigAnimSampler sampler(*anims[i]);
+      const Clip& clip = clips_[i];
+      const float step =
+          clip.num_frames > 1 ? clip.duration / (clip.num_frames - 1) : 0.0f;
+      for (uint32_t frame = 0; frame < clip.num_frames; ++frame) {
+        sampler.GlobalTransforms(frame * step, false, transforms.data());
+        float* out = &values[(clip.first_frame + frame) * row_size];
+        for (int bone = 0; bone < num_bones_; ++bone) {
+          // Rows of the 3x4 matrix, as in SkinningOutput::kAffineFloat. An
+          // AffineTransform stores the rows of its 3x4 matrix as columns.
+          const mathfu::AffineTransform& g = transforms[bone];
+          for (int r = 0; r < 3; ++r) {
+            for (int c = 0; c < 4; ++c) {
+              if (inverse_bind_pose == nullptr) {
+                *out++ = g(c, r);
+                continue;
+              }
+              const mathfu::AffineTransform& b = inverse_bind_pose[bone];
+              *out++ = g(0, r) * b(c, 0) + g(1, r) * b(c, 1) +
+                       g(2, r) * b(c, 2) + (c == 3 ? g(3, r) : 0.0f);
+            }
+          }
+        }
+      }
+    }
+  };
+  MotiveTaskScheduler* scheduler = table.task_scheduler();
+  if (scheduler == nullptr) {
+    bake(0, count);
+  } else {
+    scheduler->ParallelFor(count, 1, bake);
+  }
+
+  Encode(values);
+  return true;
+}
+
+void PoseTexture::Encode(const std::vector<float>& values) {
+  const size_t num_values = values.size();
+  data_.resize(num_values * ElementSize());
+  switch (format_) {
+    case kFloat:
+      if (num_values > 0) memcpy(data_.data(), values.data(), data_.size());
+      break;
+
+    case kHalf: {
+      uint16_t* out = reinterpret_cast<uint16_t*>(data_.data());
+      for (size_t i = 0; i < num_values; ++i) out[i] = FloatToHalf(values[i]);
+      break;
+    }
+
+    case kQuantized: {
+      // Each element of a texel gets its own range, so the translations
+      // don't cost the rotations their precision.
+      float min_value[4];
+      float max_value[4];
+      for (int c = 0; c < 4; ++c) {
+        min_value[c] = std::numeric_limits<float>::infinity();
+        max_value[c] = -std::numeric_limits<float>::infinity();
+      }
+      for (size_t i = 0; i < num_values; ++i) {
+        const int c = static_cast<int>(i % 4);
+        min_value[c] = std::min(min_value[c], values[i]);
+        max_value[c] = std::max(max_value[c], values[i]);
+      }
+      for (int c = 0; c < 4; ++c) {
+        const bool empty = min_value[c] > max_value[c];
+        dequantize_offset_[c] = empty ? 0.0f : min_value[c];
+        dequantize_scale_[c] = empty ? 1.0f : max_value[c] - min_value[c];
+      }
+
+      uint16_t* out = reinterpret_cast<uint16_t*>(data_.data());
+      for (size_t i = 0; i < num_values; ++i) {
+        const int c = static_cast<int>(i % 4);
+        const float scale = dequantize_scale_[c];
+        const float q =
+            scale > 0.0f ? (values[i] - dequantize_offset_[c]) / scale : 0.0f;
+        out[i] = static_cast<uint16_t>(q * 65535.0f + 0.5f);
+      }
+      break;
+    }
+  }
+}
+
+void PoseTexture::Serialize(std::vector<uint8_t>* out) const {
+  WriteUint(kPoseTextureMagic, out);
+  WriteUint(static_cast<uint32_t>(format_), out);
+  WriteUint(static_cast<uint32_t>(num_bones_), out);
+  WriteUint(static_cast<uint32_t>(num_frames_), out);
+  for (int c = 0; c < 4; ++c) {
+    WriteFloat(dequantize_offset_[c], out);
+    WriteFloat(dequantize_scale_[c], out);
+  }
+  WriteUint(static_cast<uint32_t>(clips_.size()), out);
+  for (auto it = clips_.begin(); it != clips_.end(); ++it) {
+    WriteUint(static_cast<uint32_t>(it->name.size()), out);
+    out->insert(out->end(), it->name.begin(), it->name.end());
+    WriteUint(it->first_frame, out);
+    WriteUint(it->num_frames, out);
+    WriteFloat(it->duration, out);
+  }
+  out->insert(out->end(), data_.begin(), data_.end());
+}
+
+bool PoseTexture::InitFromBuffer(const uint8_t* data, size_t size) {
+  Clear();
+  BufferReader reader(data, size);
+  const uint32_t magic = reader.Uint();
+  const uint32_t format = reader.Uint();
+  const uint32_t num_bones = reader.Uint();
+  const uint32_t num_frames = reader.Uint();
+  if (magic != kPoseTextureMagic || format > kQuantized ||
+      num_bones > kMaxNumBones) {
+    return false;
+  }
+  format_ = static_cast<Format>(format);
+  num_bones_ = static_cast<int>(num_bones);
+  num_frames_ = static_cast<int>(num_frames);
+  for (int c = 0; c < 4; ++c) {
+    dequantize_offset_[c] = reader.Float();
+    dequantize_scale_[c] = reader.Float();
+  }
+
+  // Each clip takes at least 16 bytes, which bounds the allocation.
+  const uint32_t num_clips = reader.Uint();
+  if (!reader.ok() || num_clips > size / 16) {
+    Clear();
+    return false;
+  }
+  clips_.resize(num_clips);
+  uint64_t expected_first_frame = 0;
+  for (uint32_t i = 0; i < num_clips && reader.ok(); ++i) {
+    Clip& clip = clips_[i];
+    const uint32_t name_size = reader.Uint();
+    const uint8_t* name = reader.Bytes(name_size);
+    if (name == nullptr) break;
+    clip.name.assign(reinterpret_cast<const char*>(name), name_size);
+    clip.first_frame = reader.Uint();
+    clip.num_frames = reader.Uint();
+    clip.duration = reader.Float();
+
+    // Clips are laid out back to back, and must fit in the texture.
+    if (clip.first_frame != expected_first_frame) {
+      Clear();
+      return false;
+    }
+    expected_first_frame += clip.num_frames;
+  }
+  if (!reader.ok() || expected_first_frame != num_frames) {
+    Clear();
+    return false;
+  }
+
+  const uint8_t* texels = reader.Bytes(DataSize());
+  if (texels == nullptr) {
+    Clear();
+    return false;
+  }
+  data_.assign(texels, texels + DataSize());
+  BuildClipIndices();
+  return true;
+}
+
+int PoseTexture::ClipIndex(const std::string& name) const {
+  const auto it = clip_indices_.find(name);
+  return it == clip_indices_.end() ? -1 : it->second;
+}
+
+float PoseTexture::FrameForTime(int clip_index, float time,
+                                bool repeat) const {
+  assert(0 <= clip_index && clip_index < static_cast<int>(clips_.size()));
+  const Clip& clip = clips_[clip_index];
+  if (clip.num_frames <= 1 || clip.duration <= 0.0f) return 0.0f;
+
+  if (repeat) {
+    time = std::fmod(time, clip.duration);
+    if (time < 0.0f) time += clip.duration;
+  } else {
+    time = std::max(0.0f, std::min(time, clip.duration));
+  }
+  const float last_frame = static_cast<float>(clip.num_frames - 1);
+  return std::min(time * last_frame / clip.duration, last_frame);
+}
+
+bool PoseTexture::Locate(const RigGpuPlayback& playback,
+                         PoseTextureSample* sample) const {
+  if (playback.anim == nullptr) return false;
+  const int clip = ClipIndex(playback.anim->anim_name());
+  if (clip < 0) return false;
+  sample->clip = clip;
+  sample->frame = FrameForTime(clip, playback.time, playback.repeat);
+  sample->blend = playback.blend;
+
+  const int previous_clip =
+      playback.previous_anim == nullptr
+          ? -1
+          : ClipIndex(playback.previous_anim->anim_name());
+  sample->previous_clip = previous_clip;
+  if (previous_clip < 0) {
+    sample->previous_frame = 0.0f;
+    sample->blend = 1.0f;
+  } else {
+    sample->previous_frame = FrameForTime(
+        previous_clip, playback.previous_time, playback.previous_repeat);
+  }
+  return true;
+}
+
+}  // namespace motive
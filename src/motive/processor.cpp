@@ -12,9 +12,18 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <tuple>
+
 #include "motive/processor.h"
 #include "motive/motivator.h"
 #include "motive/util/benchmark.h"
+#include "motive/util/counters.h"
+#include "motive/util/recorder.h"
+#include "motive/util/trace.h"
 
 namespace motive {
 
@@ -65,6 +74,7 @@ void MotiveProcessor::InitializeMotivator(const MotivatorInit& init,
                                           Motivator* motivator,
                                           MotiveDimension dimensions) {
   const motive::Benchmark b(benchmark_id_for_init());
+  const PublishScope publish(this);
 
   // Assign an 'index' to reference the new Motivator. All interactions between
   // the Motivator and MotiveProcessor use this 'index' to identify the data.
@@ -72,6 +82,12 @@ void MotiveProcessor::InitializeMotivator(const MotivatorInit& init,
 
   // Call the MotiveProcessor-specific initialization routine.
   InitializeIndices(init, index, dimensions, engine);
+
+  // New Motivators should be readable immediately, not only after the next
+  // frame has been published.
+  if (double_buffered_) {
+    CopyToFrontBufferBase(index, dimensions);
+  }
 }
 
 void MotiveProcessor::CloneMotivator(Motivator* dst, MotiveIndex src) {
@@ -82,14 +98,23 @@ void MotiveProcessor::CloneMotivator(Motivator* dst, MotiveIndex src) {
   }
 
   const motive::Benchmark b(benchmark_id_for_init());
+  const PublishScope publish(this);
 
   // Assign an 'index' to reference the new Motivator. All interactions between
   // the Motivator and MotiveProcessor use this 'index' to identify the data.
   const MotiveDimension dimensions = Dimensions(src);
   const MotiveIndex dst_index = AllocateMotivatorIndices(dst, dimensions);
+  if (recorder_ != nullptr) {
+    recorder_->RecordClone(dst, motivators_[src]);
+  }
 
-  // Call the MotiveProcessor-specific cloning routine.
+  // Call the MotiveProcessor-specific cloning routine. Any child Motivators
+  // it clones are not recorded.
+  const MotiveRecorder::NestedScope nested(recorder_);
   CloneIndices(dst_index, src, dimensions, Engine());
+  if (double_buffered_) {
+    CopyToFrontBufferBase(dst_index, dimensions);
+  }
 }
 
 // Don't notify derived classes. Useful in the destructor, since derived classes
@@ -104,6 +129,13 @@ void MotiveProcessor::RemoveMotivatorWithoutNotifying(MotiveIndex index) {
     motivators_[index + i] = nullptr;
   }
 
+  // Freed indices are never suspended.
+  if (suspended_[index] != 0) {
+    std::fill(suspended_.begin() + index,
+              suspended_.begin() + index + dimensions, 0);
+    num_suspended_ -= dimensions;
+  }
+
   // Recycle 'index'. It will be used in the next allocation, or back-filled in
   // the next call to Defragment().
   index_allocator_.Free(index);
@@ -111,14 +143,25 @@ void MotiveProcessor::RemoveMotivatorWithoutNotifying(MotiveIndex index) {
 
 void MotiveProcessor::RemoveMotivator(MotiveIndex index) {
   assert(ValidMotivatorIndex(index));
+  if (recorder_ != nullptr) {
+    recorder_->RecordRemove(motivators_[index]);
+  }
 
   // Call the MotiveProcessor-specific remove routine.
   RemoveIndices(index, Dimensions(index));
+  RemoveBaseIndices(index, Dimensions(index));
 
   // Need this version since the destructor can't call the pure virtual
   // RemoveIndex() above.
   RemoveMotivatorWithoutNotifying(index);
 
+  // Static processors are never advanced, so they don't get the chance to
+  // defragment during AdvanceFrame(). Double-buffered processors are instead
+  // defragmented when the frame is published, in UpdateFrontBuffer().
+  if (IsStatic() && !double_buffered_) {
+    Defragment();
+  }
+
   VerifyInternalState();
 }
 
@@ -130,6 +173,9 @@ void MotiveProcessor::TransferMotivator(MotiveIndex index,
   // allowed to reference 'index'.
   Motivator* old_motivator = motivators_[index];
   old_motivator->Reset();
+  if (recorder_ != nullptr) {
+    recorder_->RecordTransfer(old_motivator, new_motivator);
+  }
 
   // Set up new_motivator to reference 'index'.
   new_motivator->Init(this, index);
@@ -149,6 +195,218 @@ void MotiveProcessor::SetEngine(MotiveEngine* engine) {
   }
 }
 
+void MotiveProcessor::Defragment() {
+  const TraceScope trace("Defragment", Type()->name);
+  if (defragment_max_moves_ < 0 && defragment_max_microseconds_ < 0) {
+    index_allocator_.Defragment();
+    if (num_suspended_ > 0) PartitionSuspended();
+    return;
+  }
+
+  // Always allow one move under a time limit, so that progress is made.
+  typedef std::chrono::steady_clock Clock;
+  typedef std::chrono::microseconds Microseconds;
+  const Clock::time_point start = Clock::now();
+  int num_moves = 0;
+  index_allocator_.DefragmentWhile([this, start, &num_moves]() {
+    if (defragment_max_moves_ >= 0 && num_moves >= defragment_max_moves_) {
+      return false;
+    }
+    if (defragment_max_microseconds_ >= 0 && num_moves > 0) {
+      const Microseconds elapsed =
+          std::chrono::duration_cast<Microseconds>(Clock::now() - start);
+      if (elapsed.count() >= defragment_max_microseconds_) return false;
+    }
+    ++num_moves;
+    return true;
+  });
+  if (num_suspended_ > 0) PartitionSuspended();
+}
+
+void MotiveProcessor::PartitionSuspended() {
+  // Most frames, nothing has been suspended, resumed or allocated since the
+  // last partition, so the suspended indices are already at the end.
+  const MotiveIndex num_indices = index_allocator_.num_indices();
+  const MotiveIndex num_active = num_indices - num_suspended_;
+  bool partitioned = true;
+  for (MotiveIndex i = num_active; i < num_indices && partitioned; ++i) {
+    partitioned = suspended_[i] != 0;
+  }
+  if (partitioned) return;
+
+  // Keep the order within each partition, so that ReorderIndices() holds.
+  // Reorder() moves every index, and ignores the defragment budget, so it's
+  // only worth calling when the suspended set changes.
+  index_allocator_.Defragment();
+  std::vector<MotiveIndex> order;
+  for (int pass = 0; pass < 2; ++pass) {
+    const uint8_t suspended = pass == 0 ? 0 : 1;
+    for (MotiveIndex index = 0; index < index_allocator_.num_indices();
+         index += Dimensions(index)) {
+      if (suspended_[index] == suspended) order.push_back(index);
+    }
+  }
+  index_allocator_.Reorder(order);
+}
+
+void MotiveProcessor::SetSuspended(MotiveIndex index, bool suspended) {
+  assert(ValidMotivatorIndex(index));
+  if (Suspended(index) == suspended) return;
+
+  const MotiveDimension dimensions = Dimensions(index);
+  std::fill(suspended_.begin() + index,
+            suspended_.begin() + index + dimensions, suspended ? 1 : 0);
+  if (suspended) {
+    num_suspended_ += dimensions;
+    SuspendIndices(index, dimensions);
+  } else {
+    num_suspended_ -= dimensions;
+    ResumeIndices(index, dimensions);
+  }
+}
+
+void MotiveProcessor::AppendChildMotivators(
+    std::vector<const Motivator*>* children) const {
+  for (MotiveIndex index = 0; index < index_allocator_.num_indices();
+       index += Dimensions(index)) {
+    if (motivators_[index] != nullptr) AppendChildMotivatorsOf(index, children);
+  }
+}
+
+void MotiveProcessor::ReorderIndices(const MotivatorRanks& ranks) {
+  const TraceScope trace("ReorderIndices", Type()->name);
+  index_allocator_.Defragment();
+
+  // Sort the blocks of indices by rank, then by source, then by index.
+  // Suspended indices stay after the others. See PartitionSuspended().
+  typedef std::tuple<uint8_t, size_t, const void*, MotiveIndex> Key;
+  std::vector<Key> keys;
+  for (MotiveIndex index = 0; index < index_allocator_.num_indices();
+       index += Dimensions(index)) {
+    const auto it = ranks.find(motivators_[index]);
+    const size_t rank = it == ranks.end()
+                            ? std::numeric_limits<size_t>::max()
+                            : it->second;
+    keys.push_back(Key(suspended_[index], rank, IndexSource(index), index));
+  }
+  std::sort(keys.begin(), keys.end(), [](const Key& a, const Key& b) {
+    if (std::get<0>(a) != std::get<0>(b)) {
+      return std::get<0>(a) < std::get<0>(b);
+    }
+    if (std::get<1>(a) != std::get<1>(b)) {
+      return std::get<1>(a) < std::get<1>(b);
+    }
+    if (std::get<2>(a) != std::get<2>(b)) {
+      return std::less<const void*>()(std::get<2>(a), std::get<2>(b));
+    }
+    return std::get<3>(a) < std::get<3>(b);
+  });
+
+  std::vector<MotiveIndex> order(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    order[i] = std::get<3>(keys[i]);
+  }
+  index_allocator_.Reorder(order);
+}
+
+void MotiveProcessor::Reserve(MotiveIndex count) {
+  index_allocator_.Reserve(count);
+  motivators_.reserve(count);
+  suspended_.reserve(count);
+  ReserveIndices(count);
+}
+
+void MotiveProcessor::Trim() {
+  const TraceScope trace("Trim", Type()->name);
+  const PublishScope publish(this);
+  index_allocator_.Defragment();
+  if (num_suspended_ > 0) PartitionSuspended();
+  if (double_buffered_) {
+    CopyToFrontBufferBase(0, index_allocator_.num_indices());
+  }
+
+  motivators_.shrink_to_fit();
+  suspended_.shrink_to_fit();
+  events_.shrink_to_fit();
+  index_allocator_.ShrinkToFit();
+  TrimIndices();
+  underused_frames_ = 0;
+}
+
+bool MotiveProcessor::TrimIfUnderused(uint32_t frames) {
+  // Trimming only once the arrays are well below capacity, and have stayed
+  // there, keeps populations that rise and fall from reallocating each time.
+  if (4 * static_cast<size_t>(index_allocator_.num_indices()) >=
+      motivators_.capacity()) {
+    underused_frames_ = 0;
+    return false;
+  }
+  if (++underused_frames_ < frames) return false;
+  Trim();
+  return true;
+}
+
+void MotiveProcessor::AddMemoryStats(MemoryStats* stats) const {
+  stats->AddVector(motivators_);
+  stats->AddVector(suspended_);
+  stats->AddVector(events_);
+  index_allocator_.AddMemoryStats(stats);
+}
+
+void MotiveProcessor::ArchiveState(MotiveStateArchive* archive) {
+  // Fill the holes left by removed Motivators first, so that the next
+  // AdvanceFrame() doesn't move indices and invalidate the snapshot.
+  // Double-buffered processors are defragmented by UpdateFrontBuffer().
+  if (archive->saving() && !double_buffered_) Defragment();
+  archive->Layout(motivators_);
+  archive->Layout(suspended_);
+}
+
+void MotiveProcessor::SetAllocator(MotiveAllocator* allocator) {
+  assert(index_allocator_.num_indices() == 0);
+  allocator_ = allocator;
+  motivators_ =
+      MotiveVector<Motivator*>(MotiveStdAllocator<Motivator*>(allocator));
+  suspended_ = MotiveVector<uint8_t>(MotiveStdAllocator<uint8_t>(allocator));
+  UseBaseAllocator(allocator);
+  UseAllocator(allocator);
+}
+
+thread_local bool MotiveProcessor::advancing_ = false;
+
+void MotiveProcessor::SetDoubleBuffered(bool double_buffered) {
+  double_buffered_ = double_buffered;
+  UpdateFrontBuffer();
+}
+
+void MotiveProcessor::UpdateFrontBuffer() {
+  if (!double_buffered_) return;
+  const PublishScope publish(this);
+  Defragment();
+  CopyToFrontBufferBase(0, index_allocator_.num_indices());
+}
+
+void MotiveProcessor::CopyToFrontBufferBase(MotiveIndex index,
+                                            MotiveDimension dimensions) {
+  CopyBaseToFrontBuffer(index, dimensions);
+  CopyToFrontBuffer(index, dimensions);
+}
+
+void MotiveProcessor::TakeEvents(std::vector<MotiveEvent>* events) {
+  events->insert(events->end(), events_.begin(), events_.end());
+  events_.clear();
+}
+
+void MotiveProcessor::PushEvent(MotiveIndex index, MotiveEventType type) {
+  assert(ValidIndex(index));
+  events_.push_back(MotiveEvent(motivators_[index], type));
+}
+
+MotiveIndex MotiveProcessor::MotivatorIndex(MotiveIndex index) const {
+  assert(ValidIndex(index));
+  return motivators_[index]->index_;
+}
+
 bool MotiveProcessor::IsMotivatorIndex(MotiveIndex index) const {
   return motivators_[index] != nullptr &&
          (index == 0 || motivators_[index - 1] != motivators_[index]);
@@ -176,6 +434,7 @@ MotiveIndex MotiveProcessor::AllocateMotivatorIndices(
   for (MotiveDimension i = 0; i < dimensions; ++i) {
     motivators_[index + i] = motivator;
   }
+  InitializeBaseIndices(index, dimensions);
 
   // Initialize the motivator to point at our MotiveProcessor.
   motivator->Init(this, index);
@@ -186,28 +445,36 @@ MotiveIndex MotiveProcessor::AllocateMotivatorIndices(
 void MotiveProcessor::SetNumIndicesBase(MotiveIndex num_indices) {
   // When the size decreases, we don't bother reallocating the size of the
   // 'motivators_' vector. We want to avoid reallocating as much as possible,
-  // so we let it grow to its high-water mark.
-  //
-  // TODO: Ideally, we should reserve approximately the right amount of storage
-  // for motivators_. That would require adding a user-defined initialization
-  // parameter.
+  // so we let it grow to its high-water mark. Call Reserve() to start it at
+  // the right size.
   motivators_.resize(num_indices);
+  suspended_.resize(num_indices, 0);
 
-  // Call derived class.
+  // Call derived classes.
+  SetNumBaseIndices(num_indices);
   SetNumIndices(num_indices);
 }
 
 void MotiveProcessor::MoveIndexRangeBase(const IndexRange& source,
                                          MotiveIndex target) {
+  CountEvent(kCounterDefragmentMoves);
+  const PublishScope publish(this);
+
   // Reinitialize the motivators to point to the new index.
   const MotiveIndex index_diff = target - source.start();
   for (MotiveIndex i = source.start(); i < source.end(); i += Dimensions(i)) {
     motivators_[i]->Init(this, i + index_diff);
   }
 
-  // Tell derivated class about the move.
+  // Tell derivated classes about the move.
+  MoveBaseIndices(source.start(), target, source.Length());
   MoveIndices(source.start(), target, source.Length());
 
+  // The Motivators now read from `target`, so keep the front buffer in sync.
+  if (double_buffered_) {
+    CopyToFrontBufferBase(target, source.Length());
+  }
+
   // Reinitialize the motivator pointers.
   for (MotiveIndex i = source.start(); i < source.end(); ++i) {
     // Assert we're moving something valid onto something invalid.
@@ -216,13 +483,33 @@ void MotiveProcessor::MoveIndexRangeBase(const IndexRange& source,
     // Move our internal data too.
     motivators_[i + index_diff] = motivators_[i];
     motivators_[i] = nullptr;
+    suspended_[i + index_diff] = suspended_[i];
+    suspended_[i] = 0;
   }
 }
 
+MotiveProcessor::PublishScope::PublishScope(MotiveProcessor* processor)
+    : processor_(processor) {
+  if (processor_->publish_depth_++ > 0) return;
+  processor_->publish_sequence_.store(
+      processor_->publish_sequence_.load(std::memory_order_relaxed) + 1,
+      std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+MotiveProcessor::PublishScope::~PublishScope() {
+  if (--processor_->publish_depth_ > 0) return;
+  processor_->publish_sequence_.store(
+      processor_->publish_sequence_.load(std::memory_order_relaxed) + 1,
+      std::memory_order_release);
+}
+
 void MotiveProcessor::RegisterBenchmarks() {
-  const std::string class_name(*Type());
-  benchmark_id_for_advance_frame_ =
-      motive::RegisterBenchmark((class_name + "::AdvanceFrame").c_str());
+  const std::string class_name(Type()->name);
+  if (!IsStatic()) {
+    benchmark_id_for_advance_frame_ =
+        motive::RegisterBenchmark((class_name + "::AdvanceFrame").c_str());
+  }
   benchmark_id_for_init_ =
       motive::RegisterBenchmark((class_name + "::Init").c_str());
 }
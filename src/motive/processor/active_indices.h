@@ -0,0 +1,85 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_ACTIVE_INDICES_H_
+#define MOTIVE_ACTIVE_INDICES_H_
+
+#include <vector>
+
+#include "motive/common.h"
+#include "motive/util/allocator.h"
+#include "motive/util/memory_stats.h"
+
+namespace motive {
+
+// Indices of a processor that haven't yet settled, so that AdvanceFrame()
+// can skip the rest. Each index's data holds an `awake` flag that's true
+// while the index is in the list.
+//
+// AdvanceFrame() removes settled indices itself, by compacting indices() in
+// place and clearing their `awake` flags. The list is unordered, so after
+// indices are moved or removed, call Invalidate() and the list is rebuilt
+// from the flags by the next Gather().
+class ActiveIndices {
+ public:
+  ActiveIndices() : dirty_(false) {}
+
+  // Add `index`, whose data is `d`, to the list, unless it's already there.
+  template <class T>
+  void Wake(MotiveIndex index, T* d) {
+    if (d->awake) return;
+    d->awake = true;
+    indices_.push_back(index);
+  }
+
+  // Rebuild the list from the `awake` flags of `data`, if Invalidate() has
+  // been called since it was last built.
+  template <class Vector>
+  void Gather(const Vector& data) {
+    if (!dirty_) return;
+    indices_.clear();
+    for (size_t i = 0; i < data.size(); ++i) {
+      if (data[i].awake) {
+        indices_.push_back(static_cast<MotiveIndex>(i));
+      }
+    }
+    dirty_ = false;
+  }
+
+  void Invalidate() { dirty_ = true; }
+
+  MotiveVector<MotiveIndex>& indices() { return indices_; }
+
+  // Hold the list in `allocator`. Call while the list is empty.
+  void SetAllocator(MotiveAllocator* allocator) {
+    indices_ =
+        MotiveVector<MotiveIndex>(MotiveStdAllocator<MotiveIndex>(allocator));
+  }
+
+  void Reserve(MotiveIndex count) { indices_.reserve(count); }
+  void ShrinkToFit() { indices_.shrink_to_fit(); }
+  void AddMemoryStats(MemoryStats* stats) const {
+    stats->AddVector(indices_);
+  }
+
+ private:
+  MotiveVector<MotiveIndex> indices_;
+
+  // True if indices have moved since `indices_` was gathered.
+  bool dirty_;
+};
+
+}  // namespace motive
+
+#endif  // MOTIVE_ACTIVE_INDICES_H_
@@ -12,6 +12,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+
 #include "motive/const_init.h"
 #include "motive/math/curve_util.h"
 #include "motive/processor/const_data.h"
@@ -50,17 +52,80 @@ class ConstMotiveProcessor : public SimpleProcessorTemplate<ConstData> {
  public:
   virtual ~ConstMotiveProcessor() {}
 
-  virtual void AdvanceFrame(MotiveTime /*delta_time*/) {
-    Defragment();
-  }
+  // Never called, since we're static.
+  virtual void AdvanceFrame(MotiveTime /*delta_time*/) {}
 
   virtual MotivatorType Type() const { return ConstInit::kType; }
   virtual int Priority() const { return 1; }
+  virtual bool IsStatic() const { return true; }
 
   virtual MotiveCurveShape MotiveShape(MotiveIndex /*index*/) const {
     //TODO(jsanmiya): Find a way to store this shape.
     return MotiveCurveShape();
   }
+
+  // Values only change when they're initialized.
+  virtual uint32_t ChangedFrame(MotiveIndex index,
+                                MotiveDimension dimensions) const {
+    return *std::max_element(changed_frames_.begin() + index,
+                             changed_frames_.begin() + index + dimensions);
+  }
+
+ protected:
+  virtual void InitializeIndices(const MotivatorInit& init, MotiveIndex index,
+                                 MotiveDimension dimensions,
+                                 MotiveEngine* engine) {
+    SimpleProcessorTemplate<ConstData>::InitializeIndices(init, index,
+                                                          dimensions, engine);
+    std::fill(changed_frames_.begin() + index,
+              changed_frames_.begin() + index + dimensions,
+              Engine()->frame_count());
+  }
+
+  virtual void MoveIndices(MotiveIndex old_index, MotiveIndex new_index,
+                           MotiveDimension dimensions) {
+    SimpleProcessorTemplate<ConstData>::MoveIndices(old_index, new_index,
+                                                    dimensions);
+    for (MotiveDimension i = 0; i < dimensions; ++i) {
+      changed_frames_[new_index + i] = changed_frames_[old_index + i];
+    }
+  }
+
+  virtual void UseAllocator(MotiveAllocator* allocator) {
+    changed_frames_ =
+        MotiveVector<uint32_t>(MotiveStdAllocator<uint32_t>(allocator));
+  }
+
+  virtual void SetNumIndices(MotiveIndex num_indices) {
+    SimpleProcessorTemplate<ConstData>::SetNumIndices(num_indices);
+    changed_frames_.resize(num_indices);
+  }
+
+  virtual void ReserveIndices(MotiveIndex count) {
+    SimpleProcessorTemplate<ConstData>::ReserveIndices(count);
+    changed_frames_.reserve(count);
+  }
+
+  virtual void TrimIndices() {
+    SimpleProcessorTemplate<ConstData>::TrimIndices();
+    changed_frames_.shrink_to_fit();
+  }
+
+  virtual void AddMemoryStats(MemoryStats* stats) const {
+    SimpleProcessorTemplate<ConstData>::AddMemoryStats(stats);
+    stats->AddVector(changed_frames_);
+  }
+
+  virtual void ArchiveState(MotiveStateArchive* archive) {
+    SimpleProcessorTemplate<ConstData>::ArchiveState(archive);
+    if (archive->restoring()) {
+      std::fill(changed_frames_.begin(), changed_frames_.end(),
+                Engine()->frame_count());
+    }
+  }
+
+  // The frame on which each value was initialized.
+  MotiveVector<uint32_t> changed_frames_;
 };
 
 MOTIVE_INSTANCE(ConstInit, ConstMotiveProcessor);
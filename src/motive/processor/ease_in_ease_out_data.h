@@ -21,9 +21,37 @@
 
 namespace motive {
 
+// A curve shape, and the second derivatives of the curves it makes, which
+// are shared by every index that was given the shape.
+struct EaseInEaseOutShape {
+  explicit EaseInEaseOutShape(
+      const MotiveCurveShape& shape = MotiveCurveShape())
+      : shape(shape),
+        start_second_derivative_abs(0.0f),
+        end_second_derivative_abs(0.0f) {
+    CalculateSecondDerivativesFromTypicalCurve(
+        shape.typical_delta_value, shape.typical_total_time, shape.bias,
+        &start_second_derivative_abs, &end_second_derivative_abs);
+  }
+
+  MotiveCurveShape shape;
+  float start_second_derivative_abs;
+  float end_second_derivative_abs;
+};
+
+struct SameEaseInEaseOutShape {
+  bool operator()(const EaseInEaseOutShape& a,
+                  const EaseInEaseOutShape& b) const {
+    return a.shape.typical_delta_value == b.shape.typical_delta_value &&
+           a.shape.typical_total_time == b.shape.typical_total_time &&
+           a.shape.bias == b.shape.bias;
+  }
+};
+
 struct EaseInEaseOutData {
   EaseInEaseOutData()
-      : q_start_time(0.0f), target_time(0.0f), elapsed_time(0.0f) {}
+      : shape_id(0), q_start_time(0.0f), target_time(0.0f),
+        elapsed_time(0.0f) {}
 
   // Create a straight line with the start value and derivative for q.
   EaseInEaseOutData(const SimpleInit& init, MotiveIndex current_dimension)
@@ -32,6 +60,7 @@ struct EaseInEaseOutData {
                 init.start_values[current_dimension],
                 init.start_derivatives[current_dimension], 0.0f)),
             0.0f)),
+        shape_id(0),
         q_start_time(0.0f),
         target_time(0.0f),
         elapsed_time(0.0f) {}
@@ -39,9 +68,10 @@ struct EaseInEaseOutData {
   // Currently active curve.
   QuadraticEaseInEaseOut q;
 
-  // Shape that holds the bias, typical y-distance that should be traveled, and
+  // ID of the shape in the processor's table of EaseInEaseOutShapes. The
+  // shape holds the bias, typical y-distance that should be traveled, and
   // typical time it takes to travel typical delta value.
-  MotiveCurveShape shape;
+  uint32_t shape_id;
 
   // Time at which we started on current curve.
   float q_start_time;
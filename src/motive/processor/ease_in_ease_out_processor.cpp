@@ -15,6 +15,7 @@
 #include "motive/ease_in_ease_out_init.h"
 #include "motive/math/curve_util.h"
 #include "motive/processor/ease_in_ease_out_data.h"
+#include "motive/processor/parameter_table.h"
 #include "motive/simple_processor_template.h"
 
 namespace motive {
@@ -86,16 +87,11 @@ class EaseInEaseOutMotiveProcessor
             std::fabs(target_velocity) > kDerivativeEpsilon;
         if (ends_with_nonzero_derivative) {
           // Create curve to hit target value with zero derivative.
-          float start_second_derivative_abs = 0.0f;
-          float end_second_derivative_abs = 0.0f;
-          CalculateSecondDerivativesFromTypicalCurve(
-              d.shape.typical_delta_value, d.shape.typical_total_time,
-              d.shape.bias, &start_second_derivative_abs,
-              &end_second_derivative_abs);
+          const EaseInEaseOutShape& s = shapes_[d.shape_id];
           d.q = CalculateQuadraticEaseInEaseOut(
-              target_value, target_velocity, start_second_derivative_abs,
-              target_value, 0.0f, end_second_derivative_abs,
-              d.shape.typical_delta_value, d.shape.typical_total_time);
+              target_value, target_velocity, s.start_second_derivative_abs,
+              target_value, 0.0f, s.end_second_derivative_abs,
+              s.shape.typical_delta_value, s.shape.typical_total_time);
         } else {
           // Curve is a flat line at target_value.
           d.q = QuadraticEaseInEaseOut(QuadraticCurve(0.0f, 0.0f, target_value),
@@ -113,32 +109,84 @@ class EaseInEaseOutMotiveProcessor
                                   const float* target_values,
                                   const float* target_velocities,
                                   const MotiveCurveShape& shape) {
+    target_indices_.resize(dimensions);
     for (MotiveDimension i = 0; i < dimensions; ++i) {
-      int processor_index = index + i;
-      EaseInEaseOutData& d = Data(processor_index);
-
-      // Initialize curve to go from current to target.
-      float start_second_derivative_abs = 0.0f;
-      float end_second_derivative_abs = 0.0f;
-      CalculateSecondDerivativesFromTypicalCurve(
-          shape.typical_delta_value, shape.typical_total_time, shape.bias,
-          &start_second_derivative_abs, &end_second_derivative_abs);
+      target_indices_[i] = index + i;
+    }
+    SetTargetsWithShapeAt(target_indices_.data(), dimensions, target_values,
+                          target_velocities, shape);
+  }
+
+  virtual void SetTargetsWithShapeAt(const MotiveIndex* indices,
+                                     MotiveIndex count,
+                                     const float* target_values,
+                                     const float* target_velocities,
+                                     const MotiveCurveShape& shape) {
+    // Every curve has the same shape, so only look it up, and calculate its
+    // second derivatives, once.
+    const uint32_t shape_id = shapes_.Acquire(EaseInEaseOutShape(shape), count);
+    const EaseInEaseOutShape& s = shapes_[shape_id];
+
+    // Initialize each curve to go from current to target. The current value
+    // and velocity are read directly, instead of through virtual calls.
+    for (MotiveIndex i = 0; i < count; ++i) {
+      const MotiveIndex index = indices[i];
+      EaseInEaseOutData& d = Data(index);
+      const float velocity = SimpleVelocity(d, values_[index]);
       d.q = CalculateQuadraticEaseInEaseOut(
-          Value(processor_index),  Velocity(processor_index),
-          start_second_derivative_abs, target_values[i], target_velocities[i],
-          end_second_derivative_abs, shape.typical_delta_value,
-          shape.typical_total_time);
+          values_[index], velocity, s.start_second_derivative_abs,
+          target_values[i], target_velocities[i], s.end_second_derivative_abs,
+          shape.typical_delta_value, shape.typical_total_time);
       d.target_time = d.q.total_x();
       d.q_start_time = 0.0f;
       d.elapsed_time = 0.0f;
-      d.shape = shape;
+      shapes_.Release(d.shape_id);
+      d.shape_id = shape_id;
     }
   }
 
   virtual MotiveCurveShape MotiveShape(MotiveIndex index) const {
     const EaseInEaseOutData& d = Data(index);
-    return d.shape;
+    return shapes_[d.shape_id].shape;
+  }
+
+ protected:
+  virtual void UseAllocator(MotiveAllocator* allocator) {
+    shapes_.SetAllocator(allocator);
+    target_indices_ =
+        MotiveVector<MotiveIndex>(MotiveStdAllocator<MotiveIndex>(allocator));
+  }
+
+  virtual void RemoveIndices(MotiveIndex index, MotiveDimension dimensions) {
+    for (MotiveIndex i = index; i < index + dimensions; ++i) {
+      shapes_.Release(Data(i).shape_id);
+    }
+    SimpleProcessorTemplate<EaseInEaseOutData>::RemoveIndices(index,
+                                                              dimensions);
   }
+
+  virtual void TrimIndices() {
+    SimpleProcessorTemplate<EaseInEaseOutData>::TrimIndices();
+    shapes_.ShrinkToFit();
+  }
+
+  virtual void AddMemoryStats(MemoryStats* stats) const {
+    SimpleProcessorTemplate<EaseInEaseOutData>::AddMemoryStats(stats);
+    shapes_.AddMemoryStats(stats);
+  }
+
+  virtual void ArchiveState(MotiveStateArchive* archive) {
+    SimpleProcessorTemplate<EaseInEaseOutData>::ArchiveState(archive);
+    shapes_.Archive(archive);
+  }
+
+  // Distinct shapes of the indices, referred to by
+  // EaseInEaseOutData::shape_id.
+  ParameterTable<EaseInEaseOutShape, SameEaseInEaseOutShape> shapes_;
+
+  // Scratch space for SetTargetWithShape(). Held here to avoid reallocating
+  // on every call.
+  MotiveVector<MotiveIndex> target_indices_;
 };
 
 MOTIVE_INSTANCE(EaseInEaseOutInit, EaseInEaseOutMotiveProcessor);
@@ -0,0 +1,151 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_MATRIX_BLEND_PLAN_H_
+#define MOTIVE_MATRIX_BLEND_PLAN_H_
+
+#include <unordered_map>
+#include <vector>
+
+#include "motive/matrix_op.h"
+
+namespace motive {
+
+// How BlendToOps() merges a matrix's ops with new ones. Depends only on the
+// IDs of the old and new ops, so when many matrices with the same ops blend
+// to the same new ops, one plan serves them all.
+struct MatrixBlendPlan {
+  enum Step : uint8_t {
+    // Blend the next old op to the next new op, which has the same ID.
+    kBlend,
+
+    // Blend the next old op to its default value.
+    kBlendToDefault,
+
+    // Insert the next new op before the next old op.
+    kInsert,
+  };
+
+  // Work out the steps that merge the ops in `old_ids`, which must already
+  // be set, with `new_ops`. Both are in order of ascending IDs.
+  void Build(const std::vector<MatrixOperationInit>& new_ops) {
+    new_ids.resize(new_ops.size());
+    for (size_t i = 0; i < new_ops.size(); ++i) {
+      new_ids[i] = new_ops[i].id;
+    }
+    steps.clear();
+
+    // Scan through the old and new IDs trying to match them. If they don't
+    // match, handle whichever is lower since it cannot possibly have a match
+    // in the other list.
+    size_t old_idx = 0;
+    size_t new_idx = 0;
+    while (old_idx < old_ids.size() && new_idx < new_ids.size()) {
+      if (old_ids[old_idx] == new_ids[new_idx]) {
+        steps.push_back(kBlend);
+        ++old_idx;
+        ++new_idx;
+      } else if (old_ids[old_idx] < new_ids[new_idx]) {
+        steps.push_back(kBlendToDefault);
+        ++old_idx;
+      } else {
+        steps.push_back(kInsert);
+        ++new_idx;
+      }
+    }
+
+    // Remaining old ops blend to default, and remaining new ops are appended.
+    steps.insert(steps.end(), old_ids.size() - old_idx, kBlendToDefault);
+    steps.insert(steps.end(), new_ids.size() - new_idx, kInsert);
+  }
+
+  // True if the plan was built for `new_ops`, or ops with the same IDs.
+  bool MatchesNewOps(const std::vector<MatrixOperationInit>& new_ops) const {
+    if (new_ids.size() != new_ops.size()) return false;
+    for (size_t i = 0; i < new_ops.size(); ++i) {
+      if (new_ops[i].id != new_ids[i]) return false;
+    }
+    return true;
+  }
+
+  // IDs of the old ops the plan was made for.
+  std::vector<MatrixOpId> old_ids;
+
+  // IDs of the new ops the plan was made for.
+  std::vector<MatrixOpId> new_ids;
+
+  std::vector<Step> steps;
+};
+
+// Keeps the plans made by BlendToOps(), keyed by the new ops, so that blends
+// between clips that have been blended between before skip the merge.
+//
+// The new ops are usually a bone's ops in a RigAnim, so a plan is found by
+// the clip being blended to, and the layout of the ops being blended from.
+// The layout isn't keyed by the clip being blended from, since ops that
+// blend to default stay until the next blend, so it's checked against the
+// plan's IDs instead. The new ops' IDs are checked too, in case a clip is
+// freed and another one reuses its memory. Plans only hold IDs, so values
+// that differ between such ops are never stale.
+class MatrixBlendPlanCache {
+ public:
+  MatrixBlendPlanCache() : num_plans_(0) {}
+
+  // Return a plan that blends the ops of `data` to `new_ops`. `data` must
+  // have MatchesPlan() and PlanBlendToOps(), like MatrixData and SqtData.
+  // The plan is valid until the next call.
+  template <class DataT>
+  const MatrixBlendPlan& Find(const DataT& data,
+                             const std::vector<MatrixOperationInit>& new_ops) {
+    // Forget everything if the clips keep changing, rather than growing
+    // forever.
+    if (num_plans_ >= kMaxPlans) Clear();
+
+    std::vector<MatrixBlendPlan>& plans = plans_[&new_ops];
+    for (size_t i = 0; i < plans.size(); ++i) {
+      if (data.MatchesPlan(plans[i]) && plans[i].MatchesNewOps(new_ops)) {
+        return plans[i];
+      }
+    }
+
+    // Replace the last plan if there are already too many layouts, since the
+    // earlier ones are more likely to be reused.
+    if (plans.size() < kMaxPlansPerOps) {
+      plans.resize(plans.size() + 1);
+      num_plans_++;
+    }
+    MatrixBlendPlan& plan = plans.back();
+    data.PlanBlendToOps(new_ops, &plan);
+    return plan;
+  }
+
+  void Clear() {
+    plans_.clear();
+    num_plans_ = 0;
+  }
+
+ private:
+  // Most plans kept for each list of new ops, and in total.
+  static const size_t kMaxPlansPerOps = 8;
+  static const size_t kMaxPlans = 4096;
+
+  std::unordered_map<const std::vector<MatrixOperationInit>*,
+                     std::vector<MatrixBlendPlan>>
+      plans_;
+  size_t num_plans_;
+};
+
+}  // namespace motive
+
+#endif  // MOTIVE_MATRIX_BLEND_PLAN_H_
@@ -15,17 +15,36 @@
 #ifndef MOTIVE_MATRIX_DATA_H_
 #define MOTIVE_MATRIX_DATA_H_
 
+#include <algorithm>
+#include <vector>
+
 #include "mathfu/constants.h"
 #include "motive/engine.h"
 #include "motive/matrix_init.h"
 #include "motive/matrix_op.h"
+#include "motive/processor/matrix_blend_plan.h"
+#include "motive/processor/playback_watch.h"
 
 namespace motive {
 
 // Hold a series of matrix operations, and their resultant matrix.
 class MatrixData {
  public:
-  MatrixData() : result_matrix_(mathfu::mat4::Identity()), ops_(0) {}
+  MatrixData()
+      : result_transform_(mathfu::AffineTransform::Identity()),
+        num_folded_ops_(0),
+        kernel_(&MatrixOperation::ApplyOperations),
+        stale_frame_(0),
+        changed_frame_(0) {}
+
+  // Hold the ops and dependencies in `allocator`. Call while there are no
+  // ops.
+  void SetAllocator(MotiveAllocator* allocator) {
+    ops_ = MotiveVector<MatrixOperation>(
+        MotiveStdAllocator<MatrixOperation>(allocator));
+    dependencies_ = MotiveVector<const MotiveProcessor*>(
+        MotiveStdAllocator<const MotiveProcessor*>(allocator));
+  }
 
   void Initialize(const MatrixInit& init, MotiveEngine* engine) {
     const std::vector<MatrixOperationInit>& ops = init.ops();
@@ -36,71 +55,189 @@ class MatrixData {
       assert(!QuaternionOp(ops[i].type));
       ops_.emplace_back(ops[i], engine);
     }
+    FoldConstantOps();
 
     // Initialize the result matrix to the default value. This ensures that
     // RigMotivators can initialize their transforms to the default pose of the
     // defining animation.
     UpdateResultMatrix();
+    changed_frame_ = engine->frame_count();
   }
 
   void Reset() {
-    result_matrix_ = mathfu::mat4::Identity();
+    result_transform_ = mathfu::AffineTransform::Identity();
     ops_.resize(0);
+    folded_ = MatrixOperation::ResultColumns();
+    num_folded_ops_ = 0;
+    kernel_ = &MatrixOperation::ApplyOperations;
+    stale_frame_ = 0;
+    changed_frame_ = 0;
+    update_divisor_ = MotiveUpdateDivisor();
+    playback_watch_ = PlaybackWatch();
   }
 
-  void UpdateResultMatrix() {
-    result_matrix_ = MatrixOperation::CalculateResultMatrix(
-        ops_.data(), ops_.size(), &scale_);
+  // Tell `engine` that `processor` reads the processor of every child
+  // motivator. Any earlier registrations must already be unregistered.
+  void RegisterDependencies(MotiveProcessor* processor, MotiveEngine* engine) {
+    dependencies_.clear();
+    for (size_t i = 0; i < ops_.size(); ++i) {
+      const Motivator1f* child = ops_[i].ValueMotivator();
+      if (child == nullptr) continue;
+      dependencies_.push_back(engine->RegisterDependency(processor, *child));
+    }
+  }
+
+  void UnregisterDependencies(MotiveProcessor* processor,
+                              MotiveEngine* engine) {
+    for (size_t i = 0; i < dependencies_.size(); ++i) {
+      engine->UnregisterDependency(processor, dependencies_[i]);
+    }
+    dependencies_.clear();
   }
 
-  void BlendToOps(const std::vector<MatrixOperationInit>& new_ops,
-                  const motive::SplinePlayback& playback,
-                  MotiveEngine* engine) {
-    // Ops are always stored in order of ascending IDs. Scan through the old
-    // and new ops trying to match IDs.
-    int old_idx = 0;
-    int new_idx = 0;
-    const int num_new_ops = static_cast<int>(new_ops.size());
+  // Return true if any child motivator is driven by `processor`.
+  bool DependsOn(const MotiveProcessor* processor) const {
+    return std::find(dependencies_.begin(), dependencies_.end(), processor) !=
+           dependencies_.end();
+  }
 
-    while (old_idx < ops_.size() && new_idx < num_new_ops) {
-      MatrixOperation& old_op = ops_[old_idx];
-      const MatrixOperationInit& new_op = new_ops[new_idx];
+  // Precompute the leading run of constant ops into `folded_`, so that only
+  // the remaining ops are evaluated every frame. Must be called whenever an op
+  // starts or stops being driven by a motivator, or a constant op's value
+  // changes.
+  // Only the leading run can be folded without changing the result. Ops
+  // are applied in order, so continuing from `folded_` performs exactly the
+  // same arithmetic as starting from the identity.
+  void FoldConstantOps() {
+    size_t num_folded = 0;
+    while (num_folded < ops_.size() &&
+           ops_[num_folded].ValueMotivator() == nullptr) {
+      ++num_folded;
+    }
+    num_folded_ops_ = num_folded;
+    folded_ = MatrixOperation::ResultColumns();
+    MatrixOperation::ApplyOperations(ops_.data(), num_folded_ops_, &folded_);
+    kernel_ = MatrixOperation::FindKernel(ops_.data() + num_folded_ops_,
+                                          num_live_ops());
+    stale_frame_ = 0;
+  }
 
-      // Quaternion ops must use the SqtMotiveProcessor.
-      assert(!QuaternionOp(new_op.type));
-
-      // Ops are blendable if they have identical IDs. If not, handle whichever
-      // has the lower ID since it cannot possibly have a Blendable op in the
-      // other list.
-      if (old_op.Blendable(new_op)) {
-        old_op.BlendToOp(new_op, playback, engine);
-        ++old_idx;
-        ++new_idx;
-      } else if (old_op.Id() < new_op.id) {
-        // Old ops blend to default.
-        old_op.BlendToDefault(static_cast<MotiveTime>(playback.blend_x));
-        ++old_idx;
-      } else {
-        // New ops are inserted in order. `old_idx` points to the old op with
-        // the next highest ID compared to `new_op`, meaning it also provides
-        // the correct insertion point.
-        ops_.emplace(ops_.begin() + old_idx, new_op, playback, engine);
-        ++new_idx;
-        // Advance `old_idx` so it still points to the same `old_op` now that
-        // one has been inserted before it.
-        ++old_idx;
+  // Return true if the result matrix may be out of date. That is, if any
+  // child motivator has changed since the last call to MarkUpdated(), or the
+  // ops themselves have changed.
+  bool NeedsUpdate() const {
+    if (stale_frame_ == 0) return true;
+    for (size_t i = num_folded_ops_; i < ops_.size(); ++i) {
+      const Motivator1f* child = ops_[i].ValueMotivator();
+      if (child != nullptr && child->ChangedFrame() >= stale_frame_) {
+        return true;
       }
     }
+    return false;
+  }
+
+  // Record that the result matrix was recalculated on `frame`, after every
+  // child motivator was advanced.
+  void MarkUpdated(uint32_t frame) {
+    CountEvent(kCounterMatricesRecomputed);
+    stale_frame_ = frame + 1;
+    changed_frame_ = frame;
+  }
+
+  // The most recent frame on which the result matrix was recalculated.
+  uint32_t changed_frame() const { return changed_frame_; }
+
+  void UpdateResultMatrix() {
+    MatrixOperation::ResultColumns m = folded_;
+    kernel_(ops_.data() + num_folded_ops_, num_live_ops(), &m);
+    SetResult(m);
+  }
+
+  // Write the value of each op that isn't folded into `values`, `stride`
+  // floats apart. Used to gather the values of many matrices for a
+  // MatrixOperation::BatchKernel, which should start from folded_ops().
+  void GatherValues(float* values, size_t stride) const {
+    for (size_t i = num_folded_ops_; i < ops_.size(); ++i) {
+      values[(i - num_folded_ops_) * stride] = ops_[i].Value();
+    }
+  }
+
+  // The result of the leading constant ops.
+  const MatrixOperation::ResultColumns& folded_ops() const { return folded_; }
+
+  // Set the result matrix and scale, as calculated by a kernel.
+  void SetResult(const MatrixOperation::ResultColumns& result) {
+    result_transform_ = result.Affine();
+    scale_ = result.scale;
+  }
+
+  MatrixOperation::Kernel kernel() const { return kernel_; }
+
+  // True if `plan` was made by PlanBlendToOps() for ops with the same IDs as
+  // ours, so BlendToOps() can follow it.
+  bool MatchesPlan(const MatrixBlendPlan& plan) const {
+    if (plan.old_ids.size() != ops_.size()) return false;
+    for (size_t i = 0; i < ops_.size(); ++i) {
+      if (ops_[i].Id() != plan.old_ids[i]) return false;
+    }
+    return true;
+  }
+
+  // Work out how BlendToOps() merges our ops with `new_ops`.
+  void PlanBlendToOps(const std::vector<MatrixOperationInit>& new_ops,
+                      MatrixBlendPlan* plan) const {
+    plan->old_ids.resize(ops_.size());
+    for (size_t i = 0; i < ops_.size(); ++i) {
+      plan->old_ids[i] = ops_[i].Id();
+    }
+
+    // Quaternion ops must use the SqtMotiveProcessor.
+    for (size_t i = 0; i < new_ops.size(); ++i) {
+      assert(!QuaternionOp(new_ops[i].type));
+    }
+    plan->Build(new_ops);
+  }
+
+  // Blend to `new_ops` by following `plan`, which must match our ops. New
+  // splines are added to `spline_batch`, if it's not nullptr, so the caller
+  // must flush it before reading the ops' motivators.
+  void BlendToOps(const MatrixBlendPlan& plan,
+                  const std::vector<MatrixOperationInit>& new_ops,
+                  const motive::SplinePlayback& playback, MotiveEngine* engine,
+                  MotivatorSplineBatch* spline_batch) {
+    assert(MatchesPlan(plan));
+    const MotiveTime blend_time = static_cast<MotiveTime>(playback.blend_x);
+    size_t old_idx = 0;
+    size_t new_idx = 0;
+    for (auto it = plan.steps.begin(); it != plan.steps.end(); ++it) {
+      switch (*it) {
+        case MatrixBlendPlan::kBlend:
+          ops_[old_idx++].BlendToOp(new_ops[new_idx++], playback, engine,
+                                    spline_batch);
+          break;
 
-    // Fill out remaining old ops by blending them to default.
-    int num_ops = ops_.size();
-    while (old_idx < num_ops) {
-      ops_[old_idx++].BlendToDefault(static_cast<MotiveTime>(playback.blend_x));
+        case MatrixBlendPlan::kBlendToDefault:
+          ops_[old_idx++].BlendToDefault(blend_time);
+          break;
+
+        case MatrixBlendPlan::kInsert:
+          // Ops stay in order of ascending IDs. Advance `old_idx` so it still
+          // points to the same old op now that one has been inserted before
+          // it.
+          ops_.emplace(ops_.begin() + old_idx, new_ops[new_idx++], playback,
+                       engine, spline_batch);
+          ++old_idx;
+          break;
+      }
     }
 
-    // Fill out remaining new ops by inserting them.
-    while (new_idx < num_new_ops) {
-      ops_.emplace_back(new_ops[new_idx++], playback, engine);
+    // The sequence of operation types may have changed, and constant ops may
+    // now be driven by motivators or vice versa.
+    FoldConstantOps();
+
+    // Newly inserted ops should be evaluated on the same frames as the others.
+    if (!update_divisor_.EveryFrame()) {
+      SetUpdateDivisor(update_divisor_);
     }
   }
 
@@ -116,6 +253,19 @@ class MatrixData {
     }
   }
 
+  // Evaluate the result matrix, and the child motivators, only on the frames
+  // where `divisor` is due.
+  void SetUpdateDivisor(const MotiveUpdateDivisor& divisor) {
+    update_divisor_ = divisor;
+    for (int i = 0, num_ops = ops_.size(); i < num_ops; ++i) {
+      ops_[i].SetUpdateDivisor(divisor);
+    }
+  }
+
+  const MotiveUpdateDivisor& update_divisor() const { return update_divisor_; }
+
+  PlaybackWatch& playback_watch() { return playback_watch_; }
+
   MotiveTime TimeRemaining() const {
     MotiveTime time = 0;
     for (int i = 0, num_ops = ops_.size(); i < num_ops; ++i) {
@@ -135,39 +285,91 @@ class MatrixData {
     return ops_[child_index];
   }
 
-  const mathfu::mat4& result_matrix() const { return result_matrix_; }
+  const mathfu::AffineTransform& result_transform() const {
+    return result_transform_;
+  }
 
   mathfu::vec3 result_translation() const {
-    return result_matrix_.TranslationVector3D();
+    // Column `r` of an AffineTransform is row `r` of the 3x4 matrix.
+    return mathfu::vec3(result_transform_(3, 0), result_transform_(3, 1),
+                        result_transform_(3, 2));
   }
 
   mathfu::quat result_rotation() const {
     // Extract the rotation matrix from the upper-left 3x3 of the result matrix
     // and remove the pre-computed scale from it.
     const mathfu::vec3 inv_scale = mathfu::kOnes3f / scale_;
+    const mathfu::AffineTransform& m = result_transform_;
     const mathfu::mat3 rot(
-        result_matrix_(0, 0) * inv_scale.x, result_matrix_(1, 0) * inv_scale.x,
-        result_matrix_(2, 0) * inv_scale.x, result_matrix_(0, 1) * inv_scale.y,
-        result_matrix_(1, 1) * inv_scale.y, result_matrix_(2, 1) * inv_scale.y,
-        result_matrix_(0, 2) * inv_scale.z, result_matrix_(1, 2) * inv_scale.z,
-        result_matrix_(2, 2) * inv_scale.z);
+        m(0, 0) * inv_scale.x, m(0, 1) * inv_scale.x, m(0, 2) * inv_scale.x,
+        m(1, 0) * inv_scale.y, m(1, 1) * inv_scale.y, m(1, 2) * inv_scale.y,
+        m(2, 0) * inv_scale.z, m(2, 1) * inv_scale.z, m(2, 2) * inv_scale.z);
     return mathfu::quat::FromMatrix(rot);
   }
 
   mathfu::vec3 result_scale() const { return scale_; }
 
+  // Save, verify or restore the result matrix and the constant ops. The
+  // update divisor is treated as structure, since the processor groups
+  // matrices by it. When restoring, the result counts as changed on `frame`.
+  void ArchiveState(MotiveStateArchive* archive, uint32_t frame) {
+    archive->LayoutValue(ops_.size());
+    archive->LayoutValue(num_folded_ops_);
+    archive->LayoutValue(kernel_);
+    archive->LayoutValue(update_divisor_);
+    if (!archive->ok()) return;
+    for (auto it = ops_.begin(); it != ops_.end(); ++it) {
+      it->ArchiveState(archive);
+    }
+    archive->Value(&result_transform_);
+    archive->Value(&scale_);
+    archive->Value(&folded_);
+    archive->Value(&stale_frame_);
+    archive->Value(&playback_watch_);
+    if (archive->restoring()) changed_frame_ = frame;
+  }
+
   int num_ops() const { return ops_.size(); }
 
+  // The number of ops that are evaluated every frame.
+  size_t num_live_ops() const { return ops_.size() - num_folded_ops_; }
+
  private:
   /// Result of the most recent matrix update.
-  mathfu::mat4 result_matrix_;
+  mathfu::AffineTransform result_transform_;
 
   // The pre-extracted scale components to make result_rotation() and
   // result_scale() faster.
   mathfu::vec3 scale_;
 
   /// Matrix operations to perform.
-  std::vector<MatrixOperation> ops_;
+  MotiveVector<MatrixOperation> ops_;
+
+  /// Result of the leading `num_folded_ops_` ops in `ops_`, which are all
+  /// constant.
+  MatrixOperation::ResultColumns folded_;
+  size_t num_folded_ops_;
+
+  /// Calculates the result matrix from the ops after `num_folded_ops_`.
+  /// Specialized for the sequence of operation types in those ops, when that
+  /// sequence is a common one.
+  MatrixOperation::Kernel kernel_;
+
+  /// Child motivators that changed on or after this frame are not reflected in
+  /// the result matrix. 0 if the result matrix must be recalculated.
+  uint32_t stale_frame_;
+
+  /// The most recent frame on which the result matrix was recalculated.
+  uint32_t changed_frame_;
+
+  /// Processors of the child motivators, as registered with the engine.
+  MotiveVector<const MotiveProcessor*> dependencies_;
+
+  /// The frames on which the result matrix is evaluated.
+  MotiveUpdateDivisor update_divisor_;
+
+  /// Reports the end of the animation started by BlendToOps().
+  PlaybackWatch playback_watch_;
 };
 
 }  // namespace motive
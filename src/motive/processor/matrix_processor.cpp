@@ -12,6 +12,9 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <map>
+#include <vector>
+
 #include "motive/matrix_processor.h"
 #include "mathfu/constants.h"
 #include "motive/engine.h"
@@ -22,10 +25,47 @@
 
 namespace motive {
 
+// Matrices that share a specialized kernel, and hence the sequence of
+// operation types after their folded constant ops. Their operation values are
+// gathered into one contiguous array so that the kernel can process them all
+// in one loop.
+struct MatrixPool {
+  explicit MatrixPool(MotiveAllocator* allocator)
+      : batch_kernel(nullptr),
+        num_ops(0),
+        indices(MotiveStdAllocator<MotiveIndex>(allocator)),
+        needs_update(MotiveStdAllocator<uint8_t>(allocator)),
+        active(MotiveStdAllocator<MotiveIndex>(allocator)),
+        values(MotiveStdAllocator<float>(allocator)),
+        results(MotiveStdAllocator<float>(allocator)) {}
+
+  MatrixOperation::BatchKernel batch_kernel;
+  size_t num_ops;
+
+  // Indices of the matrices in this pool.
+  MotiveVector<MotiveIndex> indices;
+
+  // Per frame, whether each matrix in `indices` needs to be recalculated.
+  // Parallel to `indices`.
+  MotiveVector<uint8_t> needs_update;
+
+  // Per frame, the indices of the matrices that need to be recalculated.
+  MotiveVector<MotiveIndex> active;
+
+  // Operation values, in structure-of-arrays order. The value of operation
+  // `i` for the matrix `active[j]` is `values[i * active.size() + j]`.
+  MotiveVector<float> values;
+
+  // Output of `batch_kernel`, which starts from each matrix's folded constant
+  // ops. In structure-of-arrays order, so that each float of the matrices of
+  // `active` is contiguous. See MatrixOperation::BatchKernel.
+  MotiveVector<float> results;
+};
+
 // See comments on MatrixInit for details on this class.
 class MatrixMotiveProcessor : public MatrixProcessor4f {
  public:
-  MatrixMotiveProcessor() : time_(0) {}
+  MatrixMotiveProcessor() : pools_dirty_(true), time_(0) {}
 
   virtual ~MatrixMotiveProcessor() {
     RemoveIndices(0, NumIndices());
@@ -33,24 +73,106 @@ class MatrixMotiveProcessor : public MatrixProcessor4f {
 
   virtual void AdvanceFrame(MotiveTime delta_time) {
     Defragment();
-
-    // Process the series of matrix operations for each index.
-    const MotiveIndex num_indices = NumIndices();
-    for (MotiveIndex index = 0; index < num_indices; ++index) {
-      MatrixData& d = Data(index);
-      d.UpdateResultMatrix();
+    if (pools_dirty_) UpdatePools();
+
+    // Process the pooled matrices in bulk, skipping those whose child
+    // motivators haven't changed. Each matrix is independent, so split them
+    // across tasks when the engine has a task scheduler.
+    const uint32_t frame = Engine()->frame_count();
+    for (size_t p = 0; p < pools_.size(); ++p) {
+      MatrixPool& pool = pools_[p];
+      const int num_indices = static_cast<int>(pool.indices.size());
+      Engine()->ParallelFor(
+          num_indices, kMinIndicesPerTask, [this, &pool](int begin, int end) {
+            for (int j = begin; j < end; ++j) {
+              pool.needs_update[j] = Data(pool.indices[j]).NeedsUpdate();
+            }
+          });
+
+      pool.active.clear();
+      for (int j = 0; j < num_indices; ++j) {
+        if (pool.needs_update[j]) pool.active.push_back(pool.indices[j]);
+      }
+      const int count = static_cast<int>(pool.active.size());
+      if (count == 0) continue;
+      pool.values.resize(pool.num_ops * count);
+      pool.results.resize(MatrixOperation::kResultFloats * count);
+
+      Engine()->ParallelFor(
+          count, kMinIndicesPerTask, [this, &pool, count](int begin, int end) {
+            for (int j = begin; j < end; ++j) {
+              const MatrixData& d = Data(pool.active[j]);
+              d.GatherValues(&pool.values[j], count);
+              MatrixOperation::ScatterResult(d.folded_ops(), j, count,
+                                             pool.results.data());
+            }
+          });
+      pool.batch_kernel(pool.values.data(), count, pool.results.data());
+      for (int j = 0; j < count; ++j) {
+        MatrixOperation::ResultColumns result;
+        MatrixOperation::GatherResult(pool.results.data(), j, count, &result);
+        MatrixData& d = Data(pool.active[j]);
+        d.SetResult(result);
+        d.MarkUpdated(frame);
+      }
     }
 
+    // Process the series of matrix operations for the remaining indices
+    // one at a time.
+    const int num_unpooled = static_cast<int>(unpooled_.size());
+    Engine()->ParallelFor(
+        num_unpooled, kMinIndicesPerTask, [this, frame](int begin, int end) {
+          for (int i = begin; i < end; ++i) {
+            MatrixData& d = Data(unpooled_[i]);
+            if (!d.update_divisor().Due(frame) || !d.NeedsUpdate()) continue;
+            d.UpdateResultMatrix();
+            d.MarkUpdated(frame);
+          }
+        });
+
     // Update our global time. It shouldn't matter if this wraps
     // around, since we only calculate times relative to it.
     time_ += delta_time;
+
+    // Report the animations that have ended. Their end is estimated when they
+    // start, so their children are only checked once they're due.
+    live_ranges_.clear();
+    ActiveIndexRanges(&live_ranges_);
+    for (auto it = live_ranges_.begin(); it != live_ranges_.end(); ++it) {
+      for (MotiveIndex index = it->start(); index < it->end(); ++index) {
+        MatrixData& d = Data(index);
+        if (d.playback_watch().Ended(time_, d)) {
+          PushEvent(index, kMotiveEventPlaybackEnded);
+        }
+      }
+    }
   }
 
   virtual MotivatorType Type() const { return MatrixInit::kType; }
   virtual int Priority() const { return 2; }
 
-  virtual const mathfu::mat4& Value(MotiveIndex index) const {
-    return Data(index).result_matrix();
+  bool UpdateDependents(const MotiveProcessor* dependency) override {
+    // Only recalculate the matrices whose children are driven by `dependency`.
+    // The children may have changed after this frame's AdvanceFrame(), so
+    // NeedsUpdate() can't tell whether they're up to date.
+    bool updated = false;
+    const uint32_t frame = Engine()->frame_count();
+    const MotiveIndex num_indices = NumIndices();
+    for (MotiveIndex index = 0; index < num_indices; ++index) {
+      MatrixData& d = data_[index];
+      if (d.DependsOn(dependency)) {
+        d.UpdateResultMatrix();
+        d.MarkUpdated(frame);
+        updated = true;
+      }
+    }
+    return updated;
+  }
+
+  const mathfu::AffineTransform& AffineValue(
+      MotiveIndex index) const override {
+    return ReadFrontBuffer() ? front_transforms_[index]
+                             : Data(index).result_transform();
   }
 
   virtual void Value(MotiveIndex index, mathfu::vec3* translation,
@@ -93,17 +215,53 @@ class MatrixMotiveProcessor : public MatrixProcessor4f {
     for (MotiveChildIndex i = 0; i < count; ++i) {
       d.Op(child_index + i).SetValue1f(values[i]);
     }
+    d.FoldConstantOps();
   }
 
   virtual void BlendToOps(MotiveIndex index,
                           const std::vector<MatrixOperationInit>& ops,
                           const motive::SplinePlayback& playback) {
+    BlendToOpsAt(&index, 1, ops, playback);
+  }
+
+  virtual void BlendToOpsAt(const MotiveIndex* indices, MotiveIndex count,
+                            const std::vector<MatrixOperationInit>& ops,
+                            const motive::SplinePlayback& playback) {
     assert(Engine());
-    Data(index).BlendToOps(ops, playback, Engine());
+
+    // Merge each matrix's ops with `ops`, reusing the plan from earlier
+    // blends of the same layout of old ops to `ops`. The child splines are
+    // collected, and started together once every matrix has been merged.
+    for (MotiveIndex i = 0; i < count; ++i) {
+      CountEvent(kCounterMatrixBlends);
+      MatrixData& d = Data(indices[i]);
+      d.UnregisterDependencies(this, Engine());
+      d.BlendToOps(blend_plans_.Find(d, ops), ops, playback, Engine(),
+                   &spline_batch_);
+    }
+    spline_batch_.Flush(playback);
+
+    // Playback can only be tracked once the splines have started.
+    for (MotiveIndex i = 0; i < count; ++i) {
+      MatrixData& d = Data(indices[i]);
+      d.RegisterDependencies(this, Engine());
+      d.playback_watch().Start(time_, d.TimeRemaining(),
+                               playback.playback_rate);
+    }
+    pools_dirty_ = true;
   }
 
   virtual void SetPlaybackRate(MotiveIndex index, float playback_rate) {
-    Data(index).SetPlaybackRate(playback_rate);
+    MatrixData& d = Data(index);
+    d.SetPlaybackRate(playback_rate);
+    d.playback_watch().SetPlaybackRate(time_, d.TimeRemaining(),
+                                       playback_rate);
+  }
+
+  virtual void SetUpdateDivisor(MotiveIndex index,
+                                const MotiveUpdateDivisor& divisor) {
+    Data(index).SetUpdateDivisor(divisor);
+    pools_dirty_ = true;
   }
 
   virtual void SetRepeating(MotiveIndex index, bool repeat) {
@@ -114,6 +272,10 @@ class MatrixMotiveProcessor : public MatrixProcessor4f {
     return Data(index).TimeRemaining();
   }
 
+  uint32_t ChangedFrame(MotiveIndex index) const override {
+    return Data(index).changed_frame();
+  }
+
  protected:
   MotiveIndex NumIndices() const {
     return static_cast<MotiveIndex>(data_.size());
@@ -124,12 +286,14 @@ class MatrixMotiveProcessor : public MatrixProcessor4f {
                                  MotiveEngine* engine) {
     RemoveIndices(index, dimensions);
 
-    // TODO OPT: Create only one MatrixData that holds `dimensions` matrices,
-    //           so that we can process in bulk.
+    // Matrices are processed in bulk by grouping them into pools with the
+    // same sequence of operations. See UpdatePools().
     auto init_params = static_cast<const MatrixInit&>(init);
     for (MotiveIndex i = index; i < index + dimensions; ++i) {
       data_[i].Initialize(init_params, engine);
+      data_[i].RegisterDependencies(this, engine);
     }
+    pools_dirty_ = true;
   }
 
   bool SupportsCloning() override { return true; }
@@ -138,8 +302,12 @@ class MatrixMotiveProcessor : public MatrixProcessor4f {
                     MotiveDimension dimensions,
                     MotiveEngine* /*engine*/) override {
     for (MotiveIndex i = 0; i < dimensions; ++i) {
-      Data(dest + i) = Data(src + i);
+      MatrixData& d = Data(dest + i);
+      d.UnregisterDependencies(this, Engine());
+      d = Data(src + i);
+      d.RegisterDependencies(this, Engine());
     }
+    pools_dirty_ = true;
   }
 
   virtual void RemoveIndices(MotiveIndex index, MotiveDimension dimensions) {
@@ -147,8 +315,10 @@ class MatrixMotiveProcessor : public MatrixProcessor4f {
     // function, so just reset the MatrixData states to empty instead of erasing
     // them.
     for (MotiveIndex i = index; i < index + dimensions; ++i) {
+      data_[i].UnregisterDependencies(this, Engine());
       data_[i].Reset();
     }
+    pools_dirty_ = true;
   }
 
   virtual void MoveIndices(MotiveIndex old_index, MotiveIndex new_index,
@@ -159,6 +329,27 @@ class MatrixMotiveProcessor : public MatrixProcessor4f {
       using std::swap;
       swap(data_[new_i], data_[old_i]);
     }
+    pools_dirty_ = true;
+  }
+
+  void AppendChildMotivatorsOf(
+      MotiveIndex index,
+      std::vector<const Motivator*>* children) const override {
+    const MatrixData& d = Data(index);
+    for (int j = 0; j < d.num_ops(); ++j) {
+      const Motivator1f* child = d.Op(j).ValueMotivator();
+      if (child != nullptr) children->push_back(child);
+    }
+  }
+
+  virtual void UseAllocator(MotiveAllocator* allocator) {
+    data_ = MotiveVector<MatrixData>(MotiveStdAllocator<MatrixData>(allocator));
+    pools_ =
+        MotiveVector<MatrixPool>(MotiveStdAllocator<MatrixPool>(allocator));
+    unpooled_ =
+        MotiveVector<MotiveIndex>(MotiveStdAllocator<MotiveIndex>(allocator));
+    front_transforms_ = MotiveVector<mathfu::AffineTransform>(
+        MotiveStdAllocator<mathfu::AffineTransform>(allocator));
   }
 
   virtual void SetNumIndices(MotiveIndex num_indices) {
@@ -168,8 +359,102 @@ class MatrixMotiveProcessor : public MatrixProcessor4f {
       RemoveIndices(num_indices, old_num_indices - num_indices);
     }
 
-    // Default-inserts new empty MatrixDatas.
+    // Default-inserts new empty MatrixDatas, whose ops are then held in our
+    // allocator.
     data_.resize(num_indices);
+    for (MotiveIndex i = old_num_indices; i < num_indices; ++i) {
+      data_[i].SetAllocator(Allocator());
+    }
+    pools_dirty_ = true;
+  }
+
+  virtual void ReserveIndices(MotiveIndex count) {
+    data_.reserve(count);
+    unpooled_.reserve(count);
+    if (double_buffered()) front_transforms_.reserve(count);
+  }
+
+  virtual void TrimIndices() {
+    data_.shrink_to_fit();
+    unpooled_.shrink_to_fit();
+    front_transforms_.shrink_to_fit();
+  }
+
+  virtual void AddMemoryStats(MemoryStats* stats) const {
+    MatrixProcessor4f::AddMemoryStats(stats);
+    stats->AddVector(data_);
+    stats->AddVector(pools_);
+    for (auto p = pools_.begin(); p != pools_.end(); ++p) {
+      stats->AddVector(p->indices);
+      stats->AddVector(p->needs_update);
+      stats->AddVector(p->active);
+      stats->AddVector(p->values);
+      stats->AddVector(p->results);
+    }
+    stats->AddVector(unpooled_);
+    stats->AddVector(front_transforms_);
+  }
+
+  virtual void ArchiveState(MotiveStateArchive* archive) {
+    MatrixProcessor4f::ArchiveState(archive);
+    const uint32_t frame = Engine()->frame_count();
+    for (auto it = data_.begin(); it != data_.end() && archive->ok(); ++it) {
+      it->ArchiveState(archive, frame);
+    }
+    archive->Value(&time_);
+  }
+
+  virtual void CopyToFrontBuffer(MotiveIndex index,
+                                 MotiveDimension dimensions) {
+    front_transforms_.resize(data_.size());
+    for (MotiveIndex i = index; i < index + dimensions; ++i) {
+      front_transforms_[i] = data_[i].result_transform();
+    }
+  }
+
+  // Group the matrices that are updated every frame by their kernel. The
+  // matrices without a specialized kernel, or that are updated only on some
+  // frames, are processed one at a time. Unused indices, left by a budgeted
+  // Defragment(), are in neither.
+  void UpdatePools() {
+    pools_.clear();
+    unpooled_.clear();
+    live_ranges_.clear();
+    ActiveIndexRanges(&live_ranges_);
+    std::map<MatrixOperation::Kernel, size_t> pool_for_kernel;
+    for (auto range = live_ranges_.begin(); range != live_ranges_.end();
+         ++range) {
+      for (MotiveIndex index = range->start(); index < range->end(); ++index) {
+        AddToPool(index, &pool_for_kernel);
+      }
+    }
+
+    for (size_t p = 0; p < pools_.size(); ++p) {
+      pools_[p].needs_update.resize(pools_[p].indices.size());
+    }
+    pools_dirty_ = false;
+  }
+
+  // Add `index` to the pool for its kernel, or to `unpooled_`.
+  void AddToPool(MotiveIndex index,
+                 std::map<MatrixOperation::Kernel, size_t>* pool_for_kernel) {
+    const MatrixData& d = data_[index];
+    const MatrixOperation::BatchKernel batch_kernel =
+        MatrixOperation::FindBatchKernel(d.kernel());
+    if (batch_kernel == nullptr || !d.update_divisor().EveryFrame()) {
+      unpooled_.push_back(index);
+      return;
+    }
+
+    auto it = pool_for_kernel->find(d.kernel());
+    if (it == pool_for_kernel->end()) {
+      it = pool_for_kernel->insert(std::make_pair(d.kernel(), pools_.size()))
+               .first;
+      pools_.push_back(MatrixPool(Allocator()));
+      pools_.back().batch_kernel = batch_kernel;
+      pools_.back().num_ops = d.num_live_ops();
+    }
+    pools_[it->second].indices.push_back(index);
   }
 
   const MatrixData& Data(MotiveIndex index) const {
@@ -182,7 +467,31 @@ class MatrixMotiveProcessor : public MatrixProcessor4f {
     return data_[index];
   }
 
-  std::vector<MatrixData> data_;
+  MotiveVector<MatrixData> data_;
+
+  // Matrices grouped by kernel, for bulk processing. Rebuilt whenever the
+  // indices or the kernel of any matrix might have changed.
+  MotiveVector<MatrixPool> pools_;
+
+  // Matrices that are not in any of `pools_`.
+  MotiveVector<MotiveIndex> unpooled_;
+
+  // True when `pools_` and `unpooled_` need to be rebuilt.
+  bool pools_dirty_;
+
+  // Scratch space for the ranges of indices in use, held here to avoid
+  // reallocating.
+  std::vector<IndexRange> live_ranges_;
+
+  // Plans for merging ops in BlendToOpsAt(), kept between blends.
+  MatrixBlendPlanCache blend_plans_;
+
+  // Scratch space for BlendToOpsAt(), held here to avoid reallocating.
+  MotivatorSplineBatch spline_batch_;
+
+  // Copy of each result transform that's read by AffineValue() when double
+  // buffered.
+  MotiveVector<mathfu::AffineTransform> front_transforms_;
   MotiveTime time_;
 };
 
@@ -21,10 +21,14 @@
 namespace motive {
 
 struct OvershootData {
-  void Initialize(const OvershootInit& init_param) {
+  OvershootData()
+      : velocity(0.0f), target_value(0.0f), init_index(0), awake(false) {}
+
+  void Initialize(uint32_t init_index_param) {
     velocity = 0.0f;
     target_value = 0.0f;
-    init = init_param;
+    init_index = init_index_param;
+    awake = false;
   }
 
   // The rate of change of value. Returned when Motivator::Velocity() called.
@@ -33,8 +37,14 @@ struct OvershootData {
   // What we are striving to hit. Returned when Motivator::TargetValue() called.
   float target_value;
 
-  // Keep a local copy of the init params.
-  OvershootInit init;
+  // Index of the init params in the processor's table of distinct params.
+  // Indices with the same params share them, rather than each keeping a
+  // copy.
+  uint32_t init_index;
+
+  // True if this index is in the processor's list of active indices.
+  // Settled indices are put to sleep until their target changes.
+  bool awake;
 };
 
 }  // namespace motive
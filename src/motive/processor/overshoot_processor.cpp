@@ -14,32 +14,181 @@
 
 #include "motive/engine.h"
 #include "motive/overshoot_init.h"
+#include "motive/processor/active_indices.h"
 #include "motive/processor/overshoot_data.h"
+#include "motive/processor/parameter_table.h"
+#include "motive/processor/soa_batch.h"
 
 namespace motive {
 
+// Simulates a batch of overshoot indices at once. Each step of the integration
+// runs across the batch, with selects instead of branches.
+//
+// Indices whose `max_delta_time` needs fewer iteration steps than others in
+// the batch are masked out of the extra steps. The arithmetic is the same, in
+// the same order, as simulating each index on its own, so the results are
+// bit-identical to it.
+class OvershootBatch : public SoaBatch<MotiveIndex> {
+ public:
+  // Queue `index` to be simulated by Advance().
+  void Add(MotiveIndex index, const OvershootData& d,
+           const OvershootInit& init, float value) {
+    assert(init.max_delta_time() > 0);
+    const int j = AddKey(index);
+    value_[j] = value;
+    velocity_[j] = d.velocity;
+    target_[j] = d.target_value;
+    accel_per_difference_[j] = init.accel_per_difference();
+    wrong_direction_multiplier_[j] = init.wrong_direction_multiplier();
+    max_velocity_[j] = init.max_velocity();
+    max_delta_[j] = init.max_delta();
+    settled_difference_[j] = init.at_target().max_difference;
+    settled_velocity_[j] = init.at_target().max_velocity;
+    range_start_[j] = init.range().start();
+    range_end_[j] = init.range().end();
+    modular_[j] = init.modular();
+    max_delta_time_[j] = init.max_delta_time();
+  }
+
+  // Advance every queued index by `delta_time`, in steps of at most its
+  // `max_delta_time`, and write the results to `data` and `values`.
+  void Advance(MotiveTime delta_time, OvershootData* data, float* values) {
+    const int count = size();
+    MotiveTime max_steps = 0;
+    for (int j = 0; j < count; ++j) {
+      const MotiveTime steps =
+          (delta_time + max_delta_time_[j] - 1) / max_delta_time_[j];
+      max_steps = std::max(max_steps, steps);
+    }
+
+    for (MotiveTime step = 0; step < max_steps; ++step) {
+      for (int j = 0; j < count; ++j) {
+        const MotiveTime time_remaining =
+            delta_time - step * max_delta_time_[j];
+        const bool active = time_remaining > 0;
+        const float dt =
+            static_cast<float>(std::min(time_remaining, max_delta_time_[j]));
+        const float length = range_end_[j] - range_start_[j];
+
+        // Increment our current velocity.
+        // If we're moving in the wrong direction (i.e. away from the target),
+        // increase the acceleration. This results in us moving towards the
+        // target for longer time than we move away from the target, or
+        // equivalently, aggressively initiating our movement towards the
+        // target, which feels good.
+        const float diff = Normalize(j, target_[j] - value_[j], length);
+        const bool wrong_direction = velocity_[j] * diff < 0.0f;
+        const float wrong_direction_multiplier =
+            wrong_direction ? wrong_direction_multiplier_[j] : 1.0f;
+        const float acceleration =
+            diff * accel_per_difference_[j] * wrong_direction_multiplier;
+        const float velocity_unclamped = velocity_[j] + dt * acceleration;
+        // Always ensure the velocity remains within the valid limits, and stop
+        // once we're close to the target and almost stopped.
+        const float velocity_clamped = mathfu::Clamp(
+            velocity_unclamped, -max_velocity_[j], max_velocity_[j]);
+        const bool should_snap =
+            fabs(diff) <= settled_difference_[j] &&
+            fabs(velocity_clamped) <= settled_velocity_[j];
+        const float velocity = should_snap ? 0.0f : velocity_clamped;
+
+        // Move by at most `max_delta`, staying within the range. Snap to the
+        // target value when we've stopped moving.
+        const float delta =
+            mathfu::Clamp(dt * velocity, -max_delta_[j], max_delta_[j]);
+        const float value_unclamped = Normalize(j, value_[j] + delta, length);
+        const float value_clamped =
+            mathfu::Clamp(value_unclamped, range_start_[j], range_end_[j]);
+        const float value = velocity == 0.0f ? target_[j] : value_clamped;
+
+        // Indices that have already taken all of their steps keep their state.
+
+        velocity_[j] = active ? velocity : velocity_[j];
+        value_[j] = active ? value : value_[j];
+      }
+    }
+
+    for (int j = 0; j < count; ++j) {
+      const MotiveIndex i = key(j);
+      data[i].velocity = velocity_[j];
+      values[i] = value_[j];
+    }
+    Clear();
+  }
+
+ private:
+  // Same as Range::Normalize() when lane `j` is modular. Returns `x`
+  // otherwise.
+  float Normalize(int j, float x, float length) const {
+    const float adjustment =
+        x <= range_start_[j] ? length : x > range_end_[j] ? -length : 0.0f;
+    return modular_[j] ? x + adjustment : x;
+  }
+
+  float value_[kSize];
+  float velocity_[kSize];
+  float target_[kSize];
+  float accel_per_difference_[kSize];
+  float wrong_direction_multiplier_[kSize];
+  float max_velocity_[kSize];
+  float max_delta_[kSize];
+  float settled_difference_[kSize];
+  float settled_velocity_[kSize];
+  float range_start_[kSize];
+  float range_end_[kSize];
+  bool modular_[kSize];
+  MotiveTime max_delta_time_[kSize];
+};
+
+struct SameOvershootParams {
+  bool operator()(const OvershootInit& a, const OvershootInit& b) const {
+    return a.SameParameters(b);
+  }
+};
+
 class OvershootMotiveProcessor : public MotiveProcessorNf {
  public:
+  OvershootMotiveProcessor() {}
   virtual ~OvershootMotiveProcessor() {}
 
   virtual void AdvanceFrame(MotiveTime delta_time) {
     Defragment();
+    active_indices_.Gather(data_);
 
-    // Loop through every motivator one at a time.
+    // Simulate the awake motivators in batches.
+    // Motivators that have settled on their target are dropped from the list,
+    // in place, and stay asleep until SetTargets() wakes them.
     // TODO: change this to a closed-form equation.
-    // TODO OPT: reorder data and then optimize with SIMD to process in groups
-    // of 4 floating-point or 8 fixed-point values.
-    for (size_t i = 0; i < data_.size(); ++i) {
-      OvershootData& d = data_[i];
-      for (MotiveTime time_remaining = delta_time; time_remaining > 0;) {
-        MotiveTime dt = std::min(time_remaining, d.init.max_delta_time());
-
-        d.velocity = CalculateVelocity(dt, d, values_[i]);
-        values_[i] = CalculateValue(dt, d, values_[i]);
-
-        time_remaining -= dt;
+    MotiveVector<MotiveIndex>& active = active_indices_.indices();
+    const size_t num_indices = active.size();
+    size_t num_active = 0;
+    OvershootBatch batch;
+    for (size_t k = 0; k < num_indices; k += OvershootBatch::kSize) {
+      const size_t end = std::min(k + OvershootBatch::kSize, num_indices);
+      for (size_t b = k; b < end; ++b) {
+        const MotiveIndex i = active[b];
+        const OvershootData& d = data_[i];
+        batch.Add(i, d, inits_[d.init_index], values_[i]);
+      }
+      batch.Advance(delta_time, data_.data(), values_.data());
+
+      for (size_t b = k; b < end; ++b) {
+        // Once snapped to the target, further frames can't change anything.
+        const MotiveIndex i = active[b];
+        OvershootData& d = data_[i];
+        const bool settled =
+            d.velocity == 0.0f && values_[i] == d.target_value;
+        if (settled) {
+          d.awake = false;
+          if (MotivatorSettled(i)) {
+            PushEvent(MotivatorIndex(i), kMotiveEventTargetReached);
+          }
+        } else {
+          active[num_active++] = i;
+        }
       }
     }
+    active.resize(num_active);
   }
 
   virtual MotivatorType Type() const { return OvershootInit::kType; }
@@ -47,7 +196,7 @@ class OvershootMotiveProcessor : public MotiveProcessorNf {
 
   // Accessors to allow the user to get and set simluation values.
   virtual const float* Values(MotiveIndex index) const {
-    return &values_[index];
+    return ReadFrontBuffer() ? &front_values_[index] : &values_[index];
   }
 
   virtual void Velocities(MotiveIndex index, MotiveDimension dimensions,
@@ -86,6 +235,14 @@ class OvershootMotiveProcessor : public MotiveProcessorNf {
     return -1;
   }
 
+  // Overshoot has no target time, but stops once it has settled.
+  bool Finished(MotiveIndex index, MotiveDimension dimensions) const override {
+    for (MotiveDimension i = 0; i < dimensions; ++i) {
+      if (data_[index + i].awake) return false;
+    }
+    return true;
+  }
+
   virtual void SetTargets(MotiveIndex index, MotiveDimension dimensions,
                           const MotiveTarget1f* ts) {
     const MotiveTarget1f* t = ts;
@@ -106,6 +263,7 @@ class OvershootMotiveProcessor : public MotiveProcessorNf {
       if (target != nullptr) {
         d.target_value = target->value;
       }
+      active_indices_.Wake(i, &data_[i]);
     }
   }
 
@@ -113,14 +271,22 @@ class OvershootMotiveProcessor : public MotiveProcessorNf {
   virtual void InitializeIndices(const MotivatorInit& init, MotiveIndex index,
                                  MotiveDimension dimensions,
                                  MotiveEngine* /*engine*/) {
+    const uint32_t init_index =
+        inits_.Acquire(static_cast<const OvershootInit&>(init), dimensions);
     for (MotiveIndex i = index; i < index + dimensions; ++i) {
-      Data(i).Initialize(static_cast<const OvershootInit&>(init));
+      Data(i).Initialize(init_index);
       values_[i] = 0.0f;
+      active_indices_.Wake(i, &data_[i]);
     }
   }
 
   virtual void RemoveIndices(MotiveIndex index, MotiveDimension dimensions) {
-    InitializeIndices(OvershootInit(), index, dimensions, nullptr);
+    for (MotiveIndex i = index; i < index + dimensions; ++i) {
+      inits_.Release(data_[i].init_index);
+      data_[i].Initialize(0);
+      values_[i] = 0.0f;
+    }
+    active_indices_.Invalidate();
   }
 
   virtual void MoveIndices(MotiveIndex old_index, MotiveIndex new_index,
@@ -131,11 +297,62 @@ class OvershootMotiveProcessor : public MotiveProcessorNf {
       data_[new_i] = data_[old_i];
       values_[new_i] = values_[old_i];
     }
+    active_indices_.Invalidate();
+  }
+
+  virtual void UseAllocator(MotiveAllocator* allocator) {
+    data_ = MotiveVector<OvershootData>(
+        MotiveStdAllocator<OvershootData>(allocator));
+    values_ = MotiveVector<float>(MotiveStdAllocator<float>(allocator));
+    front_values_ = MotiveVector<float>(MotiveStdAllocator<float>(allocator));
+    inits_.SetAllocator(allocator);
+    active_indices_.SetAllocator(allocator);
   }
 
   virtual void SetNumIndices(MotiveIndex num_indices) {
     data_.resize(num_indices);
     values_.resize(num_indices);
+    active_indices_.Invalidate();
+  }
+
+  virtual void ReserveIndices(MotiveIndex count) {
+    data_.reserve(count);
+    values_.reserve(count);
+    active_indices_.Reserve(count);
+    if (double_buffered()) front_values_.reserve(count);
+  }
+
+  virtual void TrimIndices() {
+    MotiveProcessorNf::TrimIndices();
+    data_.shrink_to_fit();
+    values_.shrink_to_fit();
+    active_indices_.ShrinkToFit();
+    inits_.ShrinkToFit();
+    front_values_.shrink_to_fit();
+  }
+
+  virtual void AddMemoryStats(MemoryStats* stats) const {
+    MotiveProcessorNf::AddMemoryStats(stats);
+    stats->AddVector(data_);
+    inits_.AddMemoryStats(stats);
+    stats->AddVector(values_);
+    stats->AddVector(front_values_);
+    active_indices_.AddMemoryStats(stats);
+  }
+
+  virtual void ArchiveState(MotiveStateArchive* archive) {
+    MotiveProcessorNf::ArchiveState(archive);
+    archive->Array(&data_);
+    inits_.Archive(archive);
+    archive->Array(&values_);
+    if (archive->restoring()) active_indices_.Invalidate();
+  }
+
+  virtual void CopyToFrontBuffer(MotiveIndex index,
+                                 MotiveDimension dimensions) {
+    front_values_.resize(values_.size());
+    std::copy(values_.begin() + index, values_.begin() + index + dimensions,
+              front_values_.begin() + index);
   }
 
   const OvershootData& Data(MotiveIndex index) const {
@@ -148,49 +365,34 @@ class OvershootMotiveProcessor : public MotiveProcessorNf {
     return data_[index];
   }
 
-  float CalculateVelocity(MotiveTime delta_time, const OvershootData& d,
-                          float current_value) const {
-    // Increment our current velocity.
-    // If we're moving in the wrong direction (i.e. away from the target),
-    // increase the acceleration. This results in us moving towards the target
-    // for longer time than we move away from the target, or equivalently,
-    // aggressively initiating our movement towards the target, which feels
-    // good.
-    const float diff = Normalize(d, d.target_value - current_value);
-    const bool wrong_direction = d.velocity * diff < 0.0f;
-    const float wrong_direction_multiplier =
-        wrong_direction ? d.init.wrong_direction_multiplier() : 1.0f;
-    const float acceleration =
-        diff * d.init.accel_per_difference() * wrong_direction_multiplier;
-    const float velocity_unclamped = d.velocity + delta_time * acceleration;
-
-    // Always ensure the velocity remains within the valid limits.
-    const float velocity = d.init.ClampVelocity(velocity_unclamped);
-
-    // If we're far from facing the target, use the velocity calculated above.
-    const bool should_snap = d.init.AtTarget(diff, velocity);
-    if (should_snap) return 0.0f;
+  float Normalize(const OvershootData& d, float diff) const {
+    const OvershootInit& init = inits_[d.init_index];
+    return init.modular() ? init.range().Normalize(diff) : diff;
+  }
 
-    return velocity;
+  // Return true if every dimension of the Motivator at `index` is asleep.
+  bool MotivatorSettled(MotiveIndex index) const {
+    const MotiveIndex first = MotivatorIndex(index);
+    const MotiveIndex end = first + Dimensions(first);
+    for (MotiveIndex i = first; i < end; ++i) {
+      if (data_[i].awake) return false;
+    }
+    return true;
   }
 
-  float CalculateValue(MotiveTime delta_time, const OvershootData& d,
-                       float current_value) const {
-    // Snap to the target value when we've stopped moving.
-    if (d.velocity == 0.0f) return d.target_value;
+  MotiveVector<OvershootData> data_;
+  MotiveVector<float> values_;
 
-    const float delta = d.init.ClampDelta(delta_time * d.velocity);
-    const float value_unclamped = Normalize(d, current_value + delta);
-    const float value = d.init.range().Clamp(value_unclamped);
-    return value;
-  }
+  // Distinct init params of the indices, referred to by
+  // OvershootData::init_index.
+  ParameterTable<OvershootInit, SameOvershootParams> inits_;
 
-  float Normalize(const OvershootData& d, float diff) const {
-    return d.init.modular() ? d.init.range().Normalize(diff) : diff;
-  }
+  // Copy of `values_` that's read by Values() when double buffered.
+  MotiveVector<float> front_values_;
 
-  std::vector<OvershootData> data_;
-  std::vector<float> values_;
+  // Indices that have not yet settled on their target. Only these indices are
+  // processed in AdvanceFrame().
+  ActiveIndices active_indices_;
 };
 
 MOTIVE_INSTANCE(OvershootInit, OvershootMotiveProcessor);
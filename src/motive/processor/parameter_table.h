@@ -0,0 +1,122 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_PARAMETER_TABLE_H_
+#define MOTIVE_PARAMETER_TABLE_H_
+
+#include <assert.h>
+#include <stdint.h>
+#include <vector>
+
+#include "motive/util/allocator.h"
+#include "motive/util/memory_stats.h"
+#include "motive/util/snapshot.h"
+
+namespace motive {
+
+// Distinct parameters of a processor's indices, so that each index stores a
+// small ID instead of its own copy. Thousands of Motivators usually share a
+// few sets of parameters, which then stay in cache while the processor
+// streams through the indices' dynamic state.
+//
+// `T` must be trivially copyable, and `SameFn` must return true when two
+// `T`s are interchangeable. ID 0 holds a default `T`, for indices that
+// haven't been given parameters. It's never replaced, so it needs no
+// reference counting.
+template <class T, class SameFn>
+class ParameterTable {
+ public:
+  ParameterTable() : params_(1), refs_(1, 0), last_(0) {}
+
+  // Return the ID of parameters the same as `params`, adding them if they're
+  // new, and count `count` more references to them. Motivators are usually
+  // initialized from a few presets, often many in a row from the same one,
+  // so the last match is checked first.
+  uint32_t Acquire(const T& params, uint32_t count = 1) {
+    const SameFn same;
+    uint32_t id = last_;
+    if (!same(params_[id], params)) {
+      uint32_t unused = 0;
+      for (id = 0; id < params_.size(); ++id) {
+        if (same(params_[id], params)) break;
+        if (unused == 0 && id != 0 && refs_[id] == 0) unused = id;
+      }
+
+      // Replace parameters that no index refers to anymore, so that the
+      // table only grows with the number of distinct parameters in use.
+      if (id == params_.size()) {
+        if (unused == 0) {
+          params_.push_back(params);
+          refs_.push_back(0);
+        } else {
+          id = unused;
+          params_[id] = params;
+        }
+      }
+      last_ = id;
+    }
+    if (id != 0) refs_[id] += count;
+    return id;
+  }
+
+  // Drop `count` references to the parameters with ID `id`.
+  void Release(uint32_t id, uint32_t count = 1) {
+    if (id == 0) return;
+    assert(refs_[id] >= count);
+    refs_[id] -= count;
+  }
+
+  const T& operator[](uint32_t id) const {
+    assert(id < params_.size());
+    return params_[id];
+  }
+
+  // Hold the table in `allocator`. Call before any parameters are acquired.
+  void SetAllocator(MotiveAllocator* allocator) {
+    params_ = MotiveVector<T>(1, T(), MotiveStdAllocator<T>(allocator));
+    refs_ = MotiveVector<uint32_t>(1, 0,
+                                   MotiveStdAllocator<uint32_t>(allocator));
+    last_ = 0;
+  }
+
+  void ShrinkToFit() {
+    params_.shrink_to_fit();
+    refs_.shrink_to_fit();
+  }
+
+  void AddMemoryStats(MemoryStats* stats) const {
+    stats->AddVector(params_);
+    stats->AddVector(refs_);
+  }
+
+  void Archive(MotiveStateArchive* archive) {
+    archive->Array(&params_);
+    archive->Array(&refs_);
+    if (archive->restoring()) last_ = 0;
+  }
+
+ private:
+  MotiveVector<T> params_;
+
+  // Number of references to each element of `params_`. Not counted for
+  // element 0.
+  MotiveVector<uint32_t> refs_;
+
+  // The ID most recently returned by Acquire().
+  uint32_t last_;
+};
+
+}  // namespace motive
+
+#endif  // MOTIVE_PARAMETER_TABLE_H_
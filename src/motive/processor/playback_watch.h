@@ -0,0 +1,83 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_PLAYBACK_WATCH_H_
+#define MOTIVE_PLAYBACK_WATCH_H_
+
+#include "motive/common.h"
+
+namespace motive {
+
+// Watches for the end of an animation, so that processors can push
+// kMotiveEventPlaybackEnded without scanning every child's TimeRemaining()
+// every frame.
+//
+// TimeRemaining() is in the animation's time, so it's converted to the
+// processor's time with the playback rate to estimate when the animation
+// ends. The estimate is only a hint, since each child may play at its own
+// rate. Once it's due, Ended() checks TimeRemaining() itself, and waits some
+// more if the animation hasn't actually ended.
+class PlaybackWatch {
+ public:
+  PlaybackWatch()
+      : end_time_(kMotiveTimeEndless), playback_rate_(1.0f), watching_(false) {}
+
+  // Start watching an animation that has `remaining` animation time left at
+  // processor time `time`.
+  void Start(MotiveTime time, MotiveTime remaining, float playback_rate) {
+    playback_rate_ = playback_rate;
+    watching_ = true;
+    Estimate(time, remaining);
+  }
+
+  // Update the estimate when the playback rate changes.
+  void SetPlaybackRate(MotiveTime time, MotiveTime remaining,
+                       float playback_rate) {
+    playback_rate_ = playback_rate;
+    if (watching_) Estimate(time, remaining);
+  }
+
+  // Return true exactly once, on the first call at or after which
+  // `data.TimeRemaining()` is 0. `time` is the current processor time.
+  template <class Data>
+  bool Ended(MotiveTime time, const Data& data) {
+    if (!watching_ || end_time_ == kMotiveTimeEndless || time < end_time_) {
+      return false;
+    }
+    const MotiveTime remaining = data.TimeRemaining();
+    if (remaining > 0) {
+      Estimate(time, remaining);
+      return false;
+    }
+    watching_ = false;
+    return true;
+  }
+
+ private:
+  void Estimate(MotiveTime time, MotiveTime remaining) {
+    end_time_ =
+        remaining == kMotiveTimeEndless || playback_rate_ <= 0.0f
+            ? kMotiveTimeEndless
+            : time + static_cast<MotiveTime>(remaining / playback_rate_);
+  }
+
+  // Processor time at which we next check TimeRemaining().
+  MotiveTime end_time_;
+  float playback_rate_;
+  bool watching_;
+};
+
+}  // namespace motive
+
+#endif  // MOTIVE_PLAYBACK_WATCH_H_
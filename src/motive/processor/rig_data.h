@@ -15,17 +15,27 @@
 #ifndef MOTIVE_RIG_DATA_H_
 #define MOTIVE_RIG_DATA_H_
 
+#include <algorithm>
+#include <cmath>
 #include <iomanip>
 #include <sstream>
+#include <tuple>
+#include <utility>
 
 #include "mathfu/constants.h"
 #include "motive/engine.h"
 #include "motive/math/angle.h"
 #include "motive/math/bulk_spline_evaluator.h"
+#include "motive/math/float.h"
+#include "motive/math/transform_kernels.h"
 #include "motive/matrix_init.h"
 #include "motive/matrix_motivator.h"
+#include "motive/processor/playback_watch.h"
+#include "motive/processor/soa_batch.h"
 #include "motive/rig_anim.h"
+#include "motive/rig_anim_sampler.h"
 #include "motive/rig_init.h"
+#include "motive/rig_processor.h"
 #include "motive/sqt_init.h"
 
 namespace motive {
@@ -33,18 +43,187 @@ namespace motive {
 // static
 static const std::vector<MatrixOperationInit> kEmptyOps;
 
+// Minimum number of bones in a level of the hierarchy, calculated by each task
+// when a rig is split across a MotiveTaskScheduler. Most levels are smaller
+// than this, so usually only very wide rigs are split.
+static const int kMinBonesPerTask = 32;
+
+// Multiplies a batch of parent global transforms by child local transforms,
+// with the engine's SIMD MultiplyAffines() where it has one.
+// Only the top three rows of each product are calculated, since the bottom row
+// of an affine transform is always (0, 0, 0, 1).
+class AffineTransformBatch : public SoaBatch<int> {
+ public:
+  explicit AffineTransformBatch(const TransformKernels* kernels)
+      : kernels_(kernels) {}
+
+  // Queue `parent` * `local` to be written to `out[bone]` by Flush().
+  void Add(int bone, const mathfu::AffineTransform& parent,
+           const mathfu::AffineTransform& local,
+           mathfu::AffineTransform* out) {
+    const int j = AddKey(bone);
+    for (int r = 0; r < 3; ++r) {
+      for (int k = 0; k < 4; ++k) {
+        // Column `r` of an AffineTransform is row `r` of the 3x4 matrix.
+        parent_[r * 4 + k][j] = parent(k, r);
+      }
+    }
+    for (int k = 0; k < 3; ++k) {
+      for (int c = 0; c < 4; ++c) {
+        local_[k * 4 + c][j] = local(c, k);
+      }
+    }
+    if (full()) {
+      Flush(out);
+    }
+  }
+
+  // Multiply every queued pair and write the products to `out`.
+  void Flush(mathfu::AffineTransform* out) {
+    const int count = size();
+    if (count == 0) return;
+    MultiplyAffines(kernels_, parent_[0], local_[0], count, kSize, global_[0]);
+    for (int j = 0; j < count; ++j) {
+      out[key(j)] = mathfu::AffineTransform(
+          mathfu::vec4(global_[0][j], global_[1][j], global_[2][j],
+                       global_[3][j]),
+          mathfu::vec4(global_[4][j], global_[5][j], global_[6][j],
+                       global_[7][j]),
+          mathfu::vec4(global_[8][j], global_[9][j], global_[10][j],
+                       global_[11][j]));
+    }
+    Clear();
+  }
+
+ private:
+  const TransformKernels* kernels_;
+  float parent_[kNumAffineElements][kSize];
+  float local_[kNumAffineElements][kSize];
+  float global_[kNumAffineElements][kSize];
+};
+
+// Translation, rotation, and scale components of a set of transforms, stored
+// structure-of-arrays style so that each component can be processed in one
+// linear pass. Component `c` of every transform is in Values(c), where `c` is
+// a SqtElement, so that the whole set can be passed to SqtsToAffines().
+class SqtScratchpad {
+ public:
+  explicit SqtScratchpad(MotiveAllocator* allocator)
+      : size_(0), values_(MotiveStdAllocator<float>(allocator)) {}
+
+  void Resize(int size) {
+    size_ = size;
+    values_.resize(kNumSqtElements * size);
+  }
+
+  void Set(int i, const mathfu::vec3& translation,
+           const mathfu::vec4& rotation, const mathfu::vec3& scale) {
+    Values(kSqtTranslationX)[i] = translation.x;
+    Values(kSqtTranslationY)[i] = translation.y;
+    Values(kSqtTranslationZ)[i] = translation.z;
+    Values(kSqtRotationW)[i] = rotation.w;
+    Values(kSqtRotationX)[i] = rotation.x;
+    Values(kSqtRotationY)[i] = rotation.y;
+    Values(kSqtRotationZ)[i] = rotation.z;
+    Values(kSqtScaleX)[i] = scale.x;
+    Values(kSqtScaleY)[i] = scale.y;
+    Values(kSqtScaleZ)[i] = scale.z;
+  }
+
+  float* Values(int c) { return values_.data() + c * size_; }
+  const float* Values(int c) const { return values_.data() + c * size_; }
+
+  void ArchiveState(MotiveStateArchive* archive) {
+    archive->LayoutValue(size_);
+    archive->Array(&values_);
+  }
+
+ private:
+  int size_;
+  MotiveVector<float> values_;
+};
+
+// Identifies rigs whose global transforms are interchangeable, because they
+// have the same hierarchy and are playing the same animation at the same
+// (quantized) time. See RigData::InstanceKey().
+struct RigInstanceKey {
+  bool operator<(const RigInstanceKey& rhs) const {
+    return std::tie(defining_anim, anim, root_motion_bone, playback_rate,
+                    repeat, divisor, phase, lod, time_quantum,
+                    quantized_time) <
+           std::tie(rhs.defining_anim, rhs.anim, rhs.root_motion_bone,
+                    rhs.playback_rate, rhs.repeat, rhs.divisor, rhs.phase,
+                    rhs.lod, rhs.time_quantum, rhs.quantized_time);
+  }
+
+  const RigAnim* defining_anim;
+  const RigAnim* anim;
+  BoneIndex root_motion_bone;
+  float playback_rate;
+  bool repeat;
+  int divisor;
+  int phase;
+  int lod;
+  MotiveTime time_quantum;
+  int64_t quantized_time;
+};
+
 class RigData {
  public:
-  explicit RigData(const RigInit& init, MotiveTime start_time)
-      : defining_anim_(&init.defining_anim()),
+  // Every array is held in `allocator`.
+  RigData(const RigInit& init, MotiveTime start_time,
+          MotiveAllocator* allocator)
+      : motivators_(MotiveStdAllocator<MatrixMotivator4f>(allocator)),
+        dependencies_(MotiveStdAllocator<const MotiveProcessor*>(allocator)),
+        global_transforms_(
+            MotiveStdAllocator<mathfu::AffineTransform>(allocator)),
+        bones_by_level_(MotiveStdAllocator<BoneIndex>(allocator)),
+        level_starts_(MotiveStdAllocator<int>(allocator)),
+        bone_needed_(MotiveStdAllocator<bool>(allocator)),
+        front_global_transforms_(
+            MotiveStdAllocator<mathfu::AffineTransform>(allocator)),
+        weights_(MotiveStdAllocator<float>(allocator)),
+        anim_sqts_(allocator),
+        blended_sqts_(allocator),
+        blended_affines_(MotiveStdAllocator<float>(allocator)),
+        rotation_weights_(MotiveStdAllocator<float>(allocator)),
+        additive_motivators_(MotiveStdAllocator<MatrixMotivator4f>(allocator)),
+        additive_weights_(MotiveStdAllocator<float>(allocator)),
+        additive_references_(allocator),
+        additive_bone_weights_(MotiveStdAllocator<float>(allocator)),
+        defining_anim_(&init.defining_anim()),
         current_anim_(nullptr),
+        blend_anims_(MotiveStdAllocator<const RigAnim*>(allocator)),
         root_motion_bone_(init.root_motion_bone()),
         root_motion_transform_(mathfu::AffineTransform::Identity()),
-        end_time_(start_time) {
+        end_time_(start_time),
+        instance_anim_(nullptr),
+        anim_time_(0.f),
+        playback_rate_(1.f),
+        repeat_(false),
+        blend_time_(0),
+        time_since_blend_(0),
+        previous_anim_(nullptr),
+        previous_anim_time_(0.f),
+        previous_playback_rate_(1.f),
+        previous_repeat_(false),
+        gpu_playback_(false),
+        lod_(0),
+        lod_bone_needed_(MotiveStdAllocator<MotiveVector<bool>>(allocator)),
+        lod_bind_transforms_(
+            MotiveStdAllocator<mathfu::AffineTransform>(allocator)),
+        instance_time_quantum_(0),
+        lazy_(false),
+        dirty_(false),
+        stale_frame_(0),
+        bone_changed_(MotiveStdAllocator<uint8_t>(allocator)) {
     const BoneIndex num_bones = defining_anim_->NumBones();
 
     motivators_.resize(num_bones);
     global_transforms_.resize(num_bones);
+    InitializeLods(init.lods());
+    SetBoneMask(init.bone_mask().data(),
+                static_cast<int>(init.bone_mask().size()), nullptr);
 
     // Initialize global transforms to default pose.
     // These will get overridden the first time AdvanceFrame() is called, but
@@ -56,6 +235,22 @@ class RigData {
 
   void BlendToAnim(const RigAnim& anim, const motive::SplinePlayback& playback,
                    MotiveEngine* engine, MotiveTime start_time) {
+    BeginBlendToAnim(anim, playback, engine, start_time);
+    for (BoneIndex i = 0; i < NumBones(); ++i) {
+      if (!BoneNeeded(i)) continue;
+      motivators_[i].BlendToOps(anim.Anim(i).ops(), playback);
+    }
+    EndBlendToAnim();
+  }
+
+  // The start of BlendToAnim(), split out so that the bones of many rigs can
+  // be blended together. Afterwards, the BoneMotivator() of every bone that's
+  // BoneNeeded() is valid, and must be blended to the ops of the same bone of
+  // `anim` before EndBlendToAnim() is called.
+  void BeginBlendToAnim(const RigAnim& anim,
+                        const motive::SplinePlayback& playback,
+                        MotiveEngine* engine, MotiveTime start_time) {
+    MarkStale();
     end_time_ = start_time + anim.end_time();
 
     // When animation has only one bone, or mesh has only one bone,
@@ -72,23 +267,50 @@ class RigData {
     weights_.resize(1, 1.f);
     motivators_.resize(defining_num_bones);
 
-    // Update the motivators to blend to our new values.
+    // Ensure there are motivators to blend to our new values.
     for (BoneIndex i = 0; i < defining_num_bones; ++i) {
+      if (!BoneNeeded(i)) continue;
       MatrixMotivator4f& motivator = motivators_[i];
-      const MatrixAnim& matrix_anim = anim.Anim(i);
       if (!motivator.Valid()) {
-        InitializeMotivator(&motivator, matrix_anim.IsSqtAnim(), engine);
+        InitializeMotivator(&motivator, anim.Anim(i).IsSqtAnim(), engine);
       }
-      motivator.BlendToOps(matrix_anim.ops(), playback);
     }
 
     // Remember the currently playing animation, for debugging purposes.
     current_anim_ = &anim;
+    blend_anims_.clear();
+
+    // The animation being blended out, for GPU playback. Only the most
+    // recent one is kept.
+    previous_anim_ = instance_anim_;
+    previous_anim_time_ = anim_time_;
+    previous_playback_rate_ = playback_rate_;
+    previous_repeat_ = repeat_;
+
+    // Track the playback so that rigs playing the same animation can share
+    // their transforms.
+    instance_anim_ = &anim;
+    anim_time_ = playback.start_x;
+    playback_rate_ = playback.playback_rate;
+    repeat_ = playback.repeat;
+    blend_time_ = static_cast<MotiveTime>(playback.blend_x);
+    time_since_blend_ = 0;
+  }
+
+  void EndBlendToAnim() {
+    // Newly created bones should be evaluated on the same frames as the rig.
+    if (!update_divisor_.EveryFrame()) {
+      SetUpdateDivisor(update_divisor_);
+    }
   }
 
+  // The motivator of bone `i` of the current animation.
+  MatrixMotivator4f& BoneMotivator(BoneIndex i) { return motivators_[i]; }
+
   void BlendToAnims(const RigAnim** anims, const SplinePlayback* playbacks,
                     const float* weights, int count, MotiveEngine* engine,
                     MotiveTime start_time) {
+    MarkStale();
     const int old_count = weights_.size();
     weights_.resize(count);
 
@@ -128,6 +350,7 @@ class RigData {
 
       // Update all Motivators.
       for (BoneIndex j = 0; j < defining_num_bones; ++j) {
+        if (!BoneNeeded(j)) continue;
         const int index = base_index + j;
         const MatrixAnim& matrix_anim = anim.Anim(j);
         MatrixMotivator4f& motivator = motivators_[index];
@@ -160,11 +383,334 @@ class RigData {
     if (count > 0) {
       current_anim_ = anims[0];
     }
+    blend_anims_.assign(anims, anims + count);
+
+    // Blended rigs are never instanced, even once they collapse back to a
+    // single animation, since their playback time is no longer tracked.
+    instance_anim_ = nullptr;
+    previous_anim_ = nullptr;
+
+    // Newly created bones should be evaluated on the same frames as the rig.
+    if (!update_divisor_.EveryFrame()) {
+      SetUpdateDivisor(update_divisor_);
+    }
+  }
+
+  /// Return the index of the only animation that still contributes to the
+  /// blend, or -1 if there is more than one. An animation stops contributing
+  /// once its weight is zero and it has finished playing.
+  int SoleActiveAnim() const {
+    const int num_anims = weights_.size();
+    if (num_anims <= 1) return -1;
+
+    int active = -1;
+    for (int i = 0; i < num_anims; ++i) {
+      if (weights_[i] > 0.f) {
+        if (active >= 0) return -1;
+        active = i;
+      } else if (ChildTimeRemaining(i) > 0) {
+        // A zero weight animation may be given a weight again later.
+        return -1;
+      }
+    }
+    return active;
+  }
+
+  /// Release the motivators of every animation but `anim_index`, which becomes
+  /// the only animation. The rig then goes back to the cheaper unblended
+  /// evaluation path.
+  void CollapseToAnim(int anim_index) {
+    assert(0 <= anim_index && anim_index < static_cast<int>(weights_.size()));
+    MarkStale();
+    const int defining_num_bones = NumBones();
+    if (anim_index != 0) {
+      const int base_index = BaseBoneIndex(anim_index);
+      for (BoneIndex i = 0; i < defining_num_bones; ++i) {
+        motivators_[i] = std::move(motivators_[base_index + i]);
+      }
+    }
+    motivators_.resize(defining_num_bones);
+    weights_.resize(1);
+    weights_[0] = 1.f;
+
+    assert(blend_anims_.size() > static_cast<size_t>(anim_index));
+    current_anim_ = blend_anims_[anim_index];
+    blend_anims_.clear();
+  }
+
+  /// Replace the additive layers with `layers`. Each layer's reference pose
+  /// is sampled and inverted here, once, so that BlendLocalTransforms() only
+  /// has to combine it with the layer's current transform.
+  void SetAdditiveLayers(const RigAdditiveLayer* layers, int count,
+                         MotiveEngine* engine) {
+    MarkStale();
+    const int num_bones = NumBones();
+    additive_motivators_.resize(num_bones * count);
+    additive_weights_.resize(count);
+    additive_references_.Resize(num_bones * count);
+
+    RigAnimSampler sampler;
+    std::vector<mathfu::AffineTransform,
+                mathfu::simd_allocator<mathfu::AffineTransform>>
+        reference(num_bones);
+    for (int l = 0; l < count; ++l) {
+      const RigAdditiveLayer& layer = layers[l];
+      const RigAnim& reference_anim = layer.reference_anim != nullptr
+                                          ? *layer.reference_anim
+                                          : *layer.anim;
+      assert(RigInit::MatchesHierarchy(*layer.anim, *defining_anim_));
+      assert(RigInit::MatchesHierarchy(reference_anim, *defining_anim_));
+      additive_weights_[l] = layer.weight;
+      sampler.Init(reference_anim);
+      sampler.LocalTransforms(layer.reference_time, false, reference.data());
+
+      const int base_index = BaseBoneIndex(l);
+      for (BoneIndex i = 0; i < num_bones; ++i) {
+        MatrixMotivator4f& motivator = additive_motivators_[base_index + i];
+        if (!BoneNeeded(i)) {
+          motivator.Invalidate();
+        } else {
+          const MatrixAnim& matrix_anim = layer.anim->Anim(i);
+          if (!motivator.Valid()) {
+            InitializeMotivator(&motivator, matrix_anim.IsSqtAnim(), engine);
+          }
+          motivator.BlendToOps(matrix_anim.ops(), layer.playback);
+        }
+
+        // Split the reference transform into translation, rotation and
+        // scale, as MatrixData does, and store their inverses.
+        const mathfu::AffineTransform& m = reference[i];
+        const mathfu::vec3 scale(
+            mathfu::vec3(m(0, 0), m(0, 1), m(0, 2)).Length(),
+            mathfu::vec3(m(1, 0), m(1, 1), m(1, 2)).Length(),
+            mathfu::vec3(m(2, 0), m(2, 1), m(2, 2)).Length());
+        const mathfu::vec3 inv_scale = mathfu::kOnes3f / scale;
+        const mathfu::mat3 rot(m(0, 0) * inv_scale.x, m(0, 1) * inv_scale.x,
+                               m(0, 2) * inv_scale.x, m(1, 0) * inv_scale.y,
+                               m(1, 1) * inv_scale.y, m(1, 2) * inv_scale.y,
+                               m(2, 0) * inv_scale.z, m(2, 1) * inv_scale.z,
+                               m(2, 2) * inv_scale.z);
+        const mathfu::quat rotation = mathfu::quat::FromMatrix(rot);
+        additive_references_.Set(
+            base_index + i, -mathfu::vec3(m(3, 0), m(3, 1), m(3, 2)),
+            mathfu::vec4(-rotation.vector(), rotation.scalar()), inv_scale);
+      }
+    }
+
+    // Newly created bones should be evaluated on the same frames as the rig.
+    if (!update_divisor_.EveryFrame()) {
+      SetUpdateDivisor(update_divisor_);
+    }
   }
 
   const RigAnim* current_anim() const { return current_anim_; }
 
+  /// Returns true if `anim` was passed to the most recent BlendToAnim(), and
+  /// sets `playback` to pick it up again from where it's up to.
+  bool CurrentPlayback(const RigAnim* anim, SplinePlayback* playback) const {
+    if (anim == nullptr || instance_anim_ != anim) return false;
+    *playback = SplinePlayback(anim_time_, repeat_, playback_rate_);
+    return true;
+  }
+
+  /// Only evaluate the `count` bones in `bones`, and their ancestors. Other
+  /// bones have their motivators released and keep their last global
+  /// transforms. If `count` is 0, every bone is evaluated.
+  /// Bones that are no longer masked out are given motivators again. When a
+  /// single animation is playing, these pick up the animation at its current
+  /// time, otherwise they hold the default pose until the next blend.
+  void SetBoneMask(const BoneIndex* bones, int count, MotiveEngine* engine) {
+    MarkStale();
+    const int num_bones = NumBones();
+    bone_needed_.clear();
+    if (count > 0) {
+      const BoneIndex* parents = defining_anim_->bone_parents();
+      bone_needed_.resize(num_bones, false);
+      for (int k = 0; k < count; ++k) {
+        assert(0 <= bones[k] && bones[k] < num_bones);
+        for (BoneIndex i = bones[k]; i != kInvalidBoneIdx && !bone_needed_[i];
+             i = parents[i]) {
+          bone_needed_[i] = true;
+        }
+      }
+    }
+    CalculateBoneLevels();
+    UpdateBoneMotivators(engine);
+  }
+
+  /// True if bone `i` has motivators.
+  bool BoneNeeded(BoneIndex i) const {
+    return BoneCalculated(i) && !LodCulled(i);
+  }
+
+  /// True if bone `i`'s global transform is calculated, either from its
+  /// motivators or, if it's culled by the level of detail, from its parent.
+  bool BoneCalculated(BoneIndex i) const {
+    return !gpu_playback_ && (bone_needed_.empty() || bone_needed_[i]);
+  }
+
+  /// True if bone `i` has no motivators at the current level of detail, and
+  /// follows its parent.
+  bool LodCulled(BoneIndex i) const {
+    return lod_ > 0 && !lod_bone_needed_[lod_ - 1][i];
+  }
+
+  /// Switch to level of detail `lod`. See RigInit::lods(). The bone levels
+  /// don't change, so only motivators are released or initialized.
+  void SetLod(int lod, MotiveEngine* engine) {
+    assert(0 <= lod && lod <= static_cast<int>(lod_bone_needed_.size()));
+    if (lod == lod_) return;
+    MarkStale();
+    lod_ = lod;
+    UpdateBoneMotivators(engine);
+  }
+
+  int lod() const { return lod_; }
+
+  /// When `gpu`, release every bone's motivator and only track the playback
+  /// state. See RigMotivator::SetGpuPlayback().
+  void SetGpuPlayback(bool gpu, MotiveEngine* engine) {
+    MarkStale();
+    gpu_playback_ = gpu;
+    CalculateBoneLevels();
+    UpdateBoneMotivators(engine);
+  }
+
+  bool gpu_playback() const { return gpu_playback_; }
+
+  bool GpuPlayback(RigGpuPlayback* playback) const {
+    if (!gpu_playback_) return false;
+    playback->anim = instance_anim_;
+    playback->time = anim_time_;
+    playback->repeat = repeat_;
+    const bool blending =
+        previous_anim_ != nullptr && time_since_blend_ < blend_time_;
+    playback->previous_anim = blending ? previous_anim_ : nullptr;
+    playback->previous_time = previous_anim_time_;
+    playback->previous_repeat = previous_repeat_;
+    playback->blend = blending ? static_cast<float>(time_since_blend_) /
+                                     static_cast<float>(blend_time_)
+                               : 1.f;
+    return true;
+  }
+
+  /// Release the motivators of bones that aren't needed, and give needed
+  /// bones that have none a new one.
+  void UpdateBoneMotivators(MotiveEngine* engine) {
+    const int num_bones = NumBones();
+    const int num_anims = weights_.size();
+    const bool playing = engine != nullptr && current_anim_ != nullptr;
+    for (int j = 0; j < num_anims; ++j) {
+      const int base_index = BaseBoneIndex(j);
+      for (BoneIndex i = 0; i < num_bones; ++i) {
+        MatrixMotivator4f& motivator = motivators_[base_index + i];
+        if (!BoneNeeded(i)) {
+          motivator.Invalidate();
+          continue;
+        }
+        if (motivator.Valid() || !playing) continue;
+        InitializeMotivator(&motivator,
+                            defining_anim_->Anim(i).IsSqtAnim(), engine);
+        if (instance_anim_ != nullptr) {
+          motivator.BlendToOps(
+              instance_anim_->Anim(i).ops(),
+              SplinePlayback(anim_time_, repeat_, playback_rate_));
+        }
+      }
+    }
+
+    // Additive layers only get their bones back from the next call to
+    // SetAdditiveLayers(). Until then, those bones have no delta.
+    for (size_t k = 0; k < additive_motivators_.size(); ++k) {
+      if (!BoneNeeded(static_cast<BoneIndex>(k % num_bones))) {
+        additive_motivators_[k].Invalidate();
+      }
+    }
+
+    // Newly created bones should be evaluated on the same frames as the rig.
+    if (!update_divisor_.EveryFrame()) {
+      SetUpdateDivisor(update_divisor_);
+    }
+  }
+
+  /// Share global transforms with other rigs whose playback time, rounded down
+  /// to a multiple of `time_quantum`, matches. 0 disables sharing.
+  void SetInstanceTimeQuantum(MotiveTime time_quantum) {
+    assert(time_quantum >= 0);
+    instance_time_quantum_ = time_quantum;
+  }
+
+  /// Keep track of the current animation's playback time.
+  void AdvanceAnimTime(MotiveTime delta_time) {
+    anim_time_ += static_cast<float>(delta_time) * playback_rate_;
+    previous_anim_time_ +=
+        static_cast<float>(delta_time) * previous_playback_rate_;
+    time_since_blend_ = std::min(time_since_blend_ + delta_time, blend_time_);
+  }
+
+  /// Return true if this rig may share its global transforms, and if so set
+  /// `key` to a value that's equal for every rig it may share them with.
+  /// Rigs are only shared once they've finished blending into a single
+  /// animation, and only if they evaluate every bone and have no additive
+  /// layers.
+  bool InstanceKey(RigInstanceKey* key) const {
+    if (instance_time_quantum_ <= 0 || instance_anim_ == nullptr ||
+        gpu_playback_ || !additive_weights_.empty() ||
+        time_since_blend_ < blend_time_ || !bone_needed_.empty()) {
+      return false;
+    }
+
+    // Once non-repeating animations end, they all hold their last pose.
+    const float end_time = static_cast<float>(instance_anim_->end_time());
+    float time = anim_time_;
+    if (repeat_ && end_time > 0.f) {
+      time = std::fmod(time, end_time);
+      if (time < 0.f) time += end_time;
+    } else {
+      time = std::max(0.f, std::min(time, end_time));
+    }
+
+    key->defining_anim = defining_anim_;
+    key->anim = instance_anim_;
+    key->root_motion_bone = root_motion_bone_;
+    key->playback_rate = playback_rate_;
+    key->repeat = repeat_;
+    key->divisor = update_divisor_.divisor;
+    key->phase = update_divisor_.phase;
+    key->lod = lod_;
+    key->time_quantum = instance_time_quantum_;
+    key->quantized_time = static_cast<int64_t>(
+        std::floor(time / static_cast<float>(instance_time_quantum_)));
+    return true;
+  }
+
+  /// Overwrite this rig's transforms with those of `instance`, which has the
+  /// same defining animation.
+  void CopyTransformsFrom(const RigData& instance) {
+    assert(instance.defining_anim_ == defining_anim_);
+    global_transforms_ = instance.global_transforms_;
+    front_global_transforms_ = instance.front_global_transforms_;
+    root_motion_transform_ = instance.root_motion_transform_;
+    MarkStale();
+  }
+
+  // Append the valid bone Motivators, in bone order, then those of the
+  // additive layers.
+  void AppendMotivators(std::vector<const Motivator*>* motivators) const {
+    for (size_t i = 0; i < motivators_.size(); ++i) {
+      if (motivators_[i].Valid()) motivators->push_back(&motivators_[i]);
+    }
+    for (size_t i = 0; i < additive_motivators_.size(); ++i) {
+      if (additive_motivators_[i].Valid()) {
+        motivators->push_back(&additive_motivators_[i]);
+      }
+    }
+  }
+
   void SetPlaybackRate(float playback_rate) {
+    playback_rate_ = playback_rate;
+    previous_playback_rate_ = playback_rate;
+
     // Update the motivators to have the new playback rate.
     // TODO: Do this in bulk.
     for (size_t i = 0; i < motivators_.size(); ++i) {
@@ -175,7 +721,8 @@ class RigData {
   void SetPlaybackRates(const float* playback_rates, int count) {
     // Update the motivators to have the new playback rate.
     const int defining_num_bones = NumBones();
-    for (int i = 0; i < count; ++i) {
+    const int num_anims = std::min(count, static_cast<int>(weights_.size()));
+    for (int i = 0; i < num_anims; ++i) {
       const int base_index = BaseBoneIndex(i);
       const float playback_rate = playback_rates[i];
       for (BoneIndex j = 0; j < defining_num_bones; ++j) {
@@ -201,15 +748,42 @@ class RigData {
   }
 
   void SetRepeating(bool repeat) {
+    repeat_ = repeat;
     for (size_t i = 0; i < motivators_.size(); ++i) {
       motivators_[i].SetRepeating(repeat);
     }
   }
 
+  // Evaluate the global transforms, and every bone's motivator, only on the
+  // frames where `divisor` is due.
+  void SetUpdateDivisor(const MotiveUpdateDivisor& divisor) {
+    update_divisor_ = divisor;
+    for (size_t i = 0; i < motivators_.size(); ++i) {
+      if (!motivators_[i].Valid()) continue;
+      motivators_[i].SetUpdateDivisor(divisor.divisor, divisor.phase);
+    }
+    for (size_t i = 0; i < additive_motivators_.size(); ++i) {
+      if (!additive_motivators_[i].Valid()) continue;
+      additive_motivators_[i].SetUpdateDivisor(divisor.divisor, divisor.phase);
+    }
+  }
+
+  const MotiveUpdateDivisor& update_divisor() const { return update_divisor_; }
+
+  PlaybackWatch& playback_watch() { return playback_watch_; }
+
   MotiveTime TimeRemaining() const {
     if (end_time_ == kMotiveTimeEndless) {
       return kMotiveTimeEndless;
     }
+    // Without motivators, the time remaining follows from the playback time.
+    if (gpu_playback_) {
+      if (instance_anim_ == nullptr) return 0;
+      if (repeat_) return kMotiveTimeEndless;
+      return std::max(static_cast<MotiveTime>(instance_anim_->end_time() -
+                                              anim_time_),
+                      static_cast<MotiveTime>(0));
+    }
     MotiveTime time = 0;
     for (size_t i = 0; i < motivators_.size(); ++i) {
       time = std::max(time, motivators_[i].TimeRemaining());
@@ -230,21 +804,189 @@ class RigData {
     return time;
   }
 
-  void UpdateGlobalTransforms() {
-    // Only do a weighted average if there's more than one animation.
-    if (weights_.size() <= 1) {
+  // Tell `engine` that `processor` reads the processor of every bone's
+  // motivator. Any earlier registrations must already be unregistered.
+  void RegisterDependencies(MotiveProcessor* processor, MotiveEngine* engine) {
+    dependencies_.clear();
+    for (size_t i = 0; i < motivators_.size(); ++i) {
+      if (!motivators_[i].Valid()) continue;
+      dependencies_.push_back(
+          engine->RegisterDependency(processor, motivators_[i]));
+    }
+    for (size_t i = 0; i < additive_motivators_.size(); ++i) {
+      if (!additive_motivators_[i].Valid()) continue;
+      dependencies_.push_back(
+          engine->RegisterDependency(processor, additive_motivators_[i]));
+    }
+  }
+
+  void UnregisterDependencies(MotiveProcessor* processor,
+                              MotiveEngine* engine) {
+    for (size_t i = 0; i < dependencies_.size(); ++i) {
+      engine->UnregisterDependency(processor, dependencies_[i]);
+    }
+    dependencies_.clear();
+  }
+
+  // Return true if any bone's motivator is driven by `processor`.
+  bool DependsOn(const MotiveProcessor* processor) const {
+    return std::find(dependencies_.begin(), dependencies_.end(), processor) !=
+           dependencies_.end();
+  }
+
+  // If `engine` is specified, large rigs are split across its task
+  // scheduler.
+  // Bones whose motivators, and ancestors' motivators, haven't changed since
+  // the last call are skipped, when `engine` is specified.
+  void UpdateGlobalTransforms(const MotiveEngine* engine = nullptr) {
+    CountEvent(kCounterRigTransformUpdates);
+    // Only do a weighted average if there's more than one animation, or
+    // additive layers to apply.
+    if (weights_.size() <= 1 && additive_weights_.empty()) {
+      const uint8_t* changed =
+          engine != nullptr && stale_frame_ != 0 ? FindChangedBones() : nullptr;
       CalculateGlobalTransforms(global_transforms_.data(),
-                                &root_motion_transform_);
+                                &root_motion_transform_, changed, engine);
+      stale_frame_ = engine != nullptr ? engine->frame_count() + 1 : 0;
     } else {
       CalculateBlendedGlobalTransforms(global_transforms_.data(),
-                                       &root_motion_transform_);
+                                       &root_motion_transform_, engine);
+      stale_frame_ = 0;
+    }
+    WriteSkinningOutput(global_transforms_.data());
+  }
+
+  /// Recalculate every bone on the next call to UpdateGlobalTransforms(),
+  /// whether or not its motivators have changed.
+  void MarkStale() { stale_frame_ = 0; }
+
+  void SetSkinningOutput(const SkinningOutput& output) {
+    assert(output.data == nullptr || output.stride >= output.MatrixSize());
+    skinning_output_ = output;
+  }
+
+  bool HasSkinningOutput() const { return skinning_output_.data != nullptr; }
+
+  /// Write the skinning matrices for `global_transforms`, which are either
+  /// this rig's or those of a rig it shares transforms with.
+  void WriteSkinningOutput(
+      const mathfu::AffineTransform* global_transforms) const {
+    const SkinningOutput& output = skinning_output_;
+    if (output.data == nullptr) return;
+
+    uint8_t* dest = static_cast<uint8_t*>(output.data);
+    const int num_bones = NumBones();
+    for (int i = 0; i < num_bones; ++i, dest += output.stride) {
+      // Rows of the 3x4 skinning matrix. An AffineTransform stores the rows
+      // of its 3x4 matrix as columns.
+      float rows[3][4];
+      const mathfu::AffineTransform& g = global_transforms[i];
+      if (output.inverse_bind_pose == nullptr) {
+        for (int r = 0; r < 3; ++r) {
+          for (int c = 0; c < 4; ++c) rows[r][c] = g(c, r);
+        }
+      } else {
+        const mathfu::AffineTransform& b = output.inverse_bind_pose[i];
+        for (int r = 0; r < 3; ++r) {
+          for (int c = 0; c < 4; ++c) {
+            rows[r][c] = g(0, r) * b(c, 0) + g(1, r) * b(c, 1) +
+                         g(2, r) * b(c, 2) + (c == 3 ? g(3, r) : 0.f);
+          }
+        }
+      }
+
+      switch (output.format) {
+        case SkinningOutput::kAffineFloat: {
+          float* out = reinterpret_cast<float*>(dest);
+          for (int r = 0; r < 3; ++r) {
+            for (int c = 0; c < 4; ++c) *out++ = rows[r][c];
+          }
+          break;
+        }
+        case SkinningOutput::kMatrixFloat: {
+          float* out = reinterpret_cast<float*>(dest);
+          for (int c = 0; c < 4; ++c) {
+            for (int r = 0; r < 3; ++r) *out++ = rows[r][c];
+            *out++ = c == 3 ? 1.f : 0.f;
+          }
+          break;
+        }
+        case SkinningOutput::kAffineHalf: {
+          uint16_t* out = reinterpret_cast<uint16_t*>(dest);
+          for (int r = 0; r < 3; ++r) {
+            for (int c = 0; c < 4; ++c) *out++ = FloatToHalf(rows[r][c]);
+          }
+          break;
+        }
+        case SkinningOutput::kMatrixHalf: {
+          uint16_t* out = reinterpret_cast<uint16_t*>(dest);
+          for (int c = 0; c < 4; ++c) {
+            for (int r = 0; r < 3; ++r) *out++ = FloatToHalf(rows[r][c]);
+            *out++ = FloatToHalf(c == 3 ? 1.f : 0.f);
+          }
+          break;
+        }
+      }
     }
   }
 
+  /// When `lazy`, AdvanceFrame() only marks the global transforms as dirty,
+  /// and they're calculated the next time they're read.
+  void SetLazy(bool lazy) { lazy_ = lazy; }
+  bool lazy() const { return lazy_; }
+  void MarkDirty() { dirty_ = true; }
+
+  /// Calculate the global transforms if they've been marked dirty.
+  void ResolveDirty(const MotiveEngine* engine) {
+    if (!dirty_) return;
+    UpdateGlobalTransforms(engine);
+    dirty_ = false;
+  }
+
   const mathfu::AffineTransform* GlobalTransforms() const {
     return global_transforms_.data();
   }
 
+  /// Copy of GlobalTransforms() as of the last call to CopyToFrontBuffer().
+  const mathfu::AffineTransform* FrontGlobalTransforms() const {
+    return front_global_transforms_.data();
+  }
+
+  void CopyToFrontBuffer() { front_global_transforms_ = global_transforms_; }
+
+  // Save, verify or restore the playback state, blend weights and global
+  // transforms. The bones' motivators are archived by their own processors,
+  // so only which motivators there are is checked here.
+  void ArchiveState(MotiveStateArchive* archive) {
+    archive->LayoutValue(defining_anim_);
+    archive->LayoutValue(motivators_.size());
+    archive->LayoutValue(additive_motivators_.size());
+    archive->LayoutValue(lod_);
+    archive->LayoutValue(update_divisor_);
+    if (!archive->ok()) return;
+    archive->Array(&weights_);
+    archive->Array(&additive_weights_);
+    additive_references_.ArchiveState(archive);
+    archive->Array(&global_transforms_);
+    archive->Value(&root_motion_transform_);
+    archive->Value(&current_anim_);
+    archive->Array(&blend_anims_);
+    archive->Value(&instance_anim_);
+    archive->Value(&anim_time_);
+    archive->Value(&playback_rate_);
+    archive->Value(&repeat_);
+    archive->Value(&blend_time_);
+    archive->Value(&time_since_blend_);
+    archive->Value(&previous_anim_);
+    archive->Value(&previous_anim_time_);
+    archive->Value(&previous_playback_rate_);
+    archive->Value(&previous_repeat_);
+    archive->Value(&end_time_);
+    archive->Value(&playback_watch_);
+    archive->Value(&dirty_);
+    archive->Value(&stale_frame_);
+  }
+
   const mathfu::AffineTransform& RootMotionTransform() const {
     return root_motion_transform_;
   }
@@ -261,6 +1003,15 @@ class RigData {
     int k = 0;
     const int defining_num_bones = NumBones();
     for (BoneIndex i = 0; i < defining_num_bones; ++i) {
+      if (!motivators_[i].Valid()) {
+        // Masked out bones hold their default values.
+        const std::vector<MatrixOperationInit>& ops =
+            defining_anim_->Anim(i).ops();
+        for (size_t j = 0; j < ops.size(); ++j) {
+          (*values)[k++] = OperationDefaultValue(ops[j].type);
+        }
+        continue;
+      }
       const MotiveChildIndex num_children = motivators_[i].NumChildren();
       for (MotiveChildIndex j = 0; j < num_children; ++j) {
         (*values)[k++] = motivators_[i].ChildValue1f(j);
@@ -321,8 +1072,14 @@ class RigData {
       const char* bone_name = defining_anim_->BoneName(idx);
       oss << bone_name << std::endl;
 
+      // Masked out bones have no local transform.
+      if (!motivators_[idx].Valid()) {
+        oss << "  (masked)" << std::endl << std::endl;
+        continue;
+      }
+
       // Output the bone's matrix.
-      const mathfu::mat4& m = motivators_[idx].Value();
+      const mathfu::mat4 m = motivators_[idx].Value();
       for (int row = 0; row < 3; ++row) {
         oss << "  (" << std::setw(7) << m(row, 0) << std::setw(7) << m(row, 1)
             << std::setw(7) << m(row, 2) << std::setw(7) << m(row, 3) << ')'
@@ -350,141 +1107,380 @@ class RigData {
   }
 
  private:
-  /// Traverse hierarchy, converting local transforms from `motivators_` into
-  /// global transforms. The `parents` are layed out such that the parent
-  /// always come before the child.
-  // TODO OPT: optimize `parents` layout so that we can parallelize this call.
-  void CalculateGlobalTransforms(
-      mathfu::AffineTransform* out,
-      mathfu::AffineTransform* root_motion_transform) const {
+  /// Group the bones by their depth in the hierarchy. Every bone in a level
+  /// has its parent in an earlier level, so the bones of a level can be
+  /// calculated in any order, or concurrently.
+  void CalculateBoneLevels() {
     const BoneIndex* parents = defining_anim_->bone_parents();
     const int num_bones = NumBones();
+    std::vector<int> depths(num_bones);
+    int num_levels = 0;
     for (int i = 0; i < num_bones; ++i) {
-      // TODO: Return an AffineTransform from the MatrixMotivator.
-      const MatrixMotivator4f& motivator = motivators_[i];
-      const mathfu::mat4& local_transform =
-          motivator.Valid() ? motivator.Value() : mathfu::mat4::Identity();
       const int parent_idx = parents[i];
+      assert(parent_idx == kInvalidBoneIdx || parent_idx < i);
+      depths[i] = parent_idx == kInvalidBoneIdx ? 0 : depths[parent_idx] + 1;
+      num_levels = std::max(num_levels, depths[i] + 1);
+    }
 
-      // Root motion bone transforms are stored separately and treated as the
-      // identity transform when computing child bone transforms.
-      if (i == root_motion_bone_) {
-        *root_motion_transform =
-            mathfu::mat4::ToAffineTransform(local_transform);
-        // The root motion bone shouldn't have a parent index, but if for some
-        // reason it does, respect the transform of that bone.
-        if (parent_idx == kInvalidBoneIdx) {
-          out[i] = mathfu::AffineTransform::Identity();
-        } else {
-          assert(i > parent_idx);
-          out[i] = out[parent_idx];
+    // Counting sort by depth. Stable, so bones within a level stay in index
+    // order. Masked out bones are left out entirely, but bones culled by the
+    // level of detail are kept, so that switching level doesn't change them.
+    level_starts_.assign(num_levels + 1, 0);
+    int num_needed = 0;
+    for (int i = 0; i < num_bones; ++i) {
+      if (!BoneCalculated(i)) continue;
+      level_starts_[depths[i] + 1]++;
+      num_needed++;
+    }
+    for (int level = 1; level <= num_levels; ++level) {
+      level_starts_[level] += level_starts_[level - 1];
+    }
+    std::vector<int> next(level_starts_.begin(), level_starts_.end() - 1);
+    bones_by_level_.resize(num_needed);
+    for (int i = 0; i < num_bones; ++i) {
+      if (!BoneCalculated(i)) continue;
+      bones_by_level_[next[depths[i]]++] = static_cast<BoneIndex>(i);
+    }
+  }
+
+  /// Traverse hierarchy, converting local transforms from `motivators_` into
+  /// global transforms.
+  /// Bones for which `changed` is 0 are skipped. If `changed` is nullptr,
+  /// every bone is calculated.
+  void CalculateGlobalTransforms(mathfu::AffineTransform* out,
+                                 mathfu::AffineTransform* root_motion_transform,
+                                 const uint8_t* changed,
+                                 const MotiveEngine* engine) const {
+    CalculateTransformsByLevel(
+        [this](int i) -> mathfu::AffineTransform {
+          const MatrixMotivator4f& motivator = motivators_[i];
+          if (motivator.Valid()) return motivator.AffineValue();
+          return LodCulled(i) ? lod_bind_transforms_[i]
+                              : mathfu::AffineTransform::Identity();
+        },
+        out, root_motion_transform, changed, engine);
+  }
+
+  /// Mark, in `bone_changed_`, the bones whose motivator or any ancestor's
+  /// motivator has changed since the global transforms were last calculated.
+  /// Only valid for the single animation path.
+  const uint8_t* FindChangedBones() {
+    const BoneIndex* parents = defining_anim_->bone_parents();
+    bone_changed_.resize(NumBones());
+    for (size_t k = 0; k < bones_by_level_.size(); ++k) {
+      const int i = bones_by_level_[k];
+      const int parent_idx = parents[i];
+      const MatrixMotivator4f& motivator = motivators_[i];
+      bone_changed_[i] =
+          (motivator.Valid() && motivator.ChangedFrame() >= stale_frame_) ||
+          (parent_idx != kInvalidBoneIdx && bone_changed_[parent_idx]);
+    }
+    return bone_changed_.data();
+  }
+
+  void CalculateBlendedGlobalTransforms(
+      mathfu::AffineTransform* out,
+      mathfu::AffineTransform* root_motion_transform,
+      const MotiveEngine* engine) {
+    BlendLocalTransforms();
+
+    // Convert every bone at once, normalizing the blended rotations.
+    const int num_bones = NumBones();
+    blended_affines_.resize(kNumAffineElements * num_bones);
+    SqtsToAffines(engine != nullptr ? engine->transform_kernels() : nullptr,
+                  blended_sqts_.Values(0), num_bones, num_bones,
+                  blended_affines_.data());
+    CalculateTransformsByLevel(
+        [this, num_bones](int i) -> mathfu::AffineTransform {
+          if (LodCulled(i)) return lod_bind_transforms_[i];
+          const float* m = &blended_affines_[i];
+          return mathfu::AffineTransform(
+              mathfu::vec4(m[0], m[num_bones], m[2 * num_bones],
+                           m[3 * num_bones]),
+              mathfu::vec4(m[4 * num_bones], m[5 * num_bones],
+                           m[6 * num_bones], m[7 * num_bones]),
+              mathfu::vec4(m[8 * num_bones], m[9 * num_bones],
+                           m[10 * num_bones], m[11 * num_bones]));
+        },
+        out, root_motion_transform, nullptr, engine);
+  }
+
+  /// Calculate the global transform of every bone, one level of the hierarchy
+  /// at a time. `local_transform_fn(i)` returns the local transform of bone
+  /// `i`. Bones for which `changed` is 0 keep their current global transform.
+  /// Large levels are split across `engine`'s task scheduler, if any.
+  template <class LocalTransformFn>
+  void CalculateTransformsByLevel(
+      const LocalTransformFn& local_transform_fn, mathfu::AffineTransform* out,
+      mathfu::AffineTransform* root_motion_transform, const uint8_t* changed,
+      const MotiveEngine* engine) const {
+    const TransformKernels* kernels =
+        engine != nullptr ? engine->transform_kernels() : nullptr;
+    const int num_levels = static_cast<int>(level_starts_.size()) - 1;
+    for (int level = 0; level < num_levels; ++level) {
+      const int level_start = level_starts_[level];
+      const int level_size = level_starts_[level + 1] - level_start;
+      const auto calculate = [&](int begin, int end) {
+        const BoneIndex* parents = defining_anim_->bone_parents();
+        AffineTransformBatch batch(kernels);
+        for (int k = level_start + begin; k < level_start + end; ++k) {
+          const int i = bones_by_level_[k];
+          if (changed != nullptr && !changed[i]) continue;
+          const int parent_idx = parents[i];
+          if (i == root_motion_bone_ || parent_idx == kInvalidBoneIdx) {
+            SetRootTransform(i, local_transform_fn(i), out,
+                             root_motion_transform);
+          } else {
+            assert(i > parent_idx);
+            batch.Add(i, out[parent_idx], local_transform_fn(i), out);
+          }
         }
-      } else if (parent_idx == kInvalidBoneIdx) {
-        out[i] = mathfu::mat4::ToAffineTransform(local_transform);
+        batch.Flush(out);
+      };
+      if (engine == nullptr) {
+        calculate(0, level_size);
       } else {
-        assert(i > parent_idx);
-        out[i] = mathfu::mat4::ToAffineTransform(
-            mathfu::mat4::FromAffineTransform(out[parent_idx]) *
-            local_transform);
+        engine->ParallelFor(level_size, kMinBonesPerTask, calculate);
       }
     }
   }
 
-  void CalculateBlendedGlobalTransforms(
+  /// Set the global transform of bone `i`, which is either the root motion bone
+  /// or has no parent. Other bones are calculated by an AffineTransformBatch.
+  void SetRootTransform(
+      int i, const mathfu::AffineTransform& local_transform,
       mathfu::AffineTransform* out,
       mathfu::AffineTransform* root_motion_transform) const {
     const BoneIndex* parents = defining_anim_->bone_parents();
+    const int parent_idx = parents[i];
+
+    // Root motion bone transforms are stored separately and treated as the
+    // identity transform when computing child bone transforms.
+    if (i == root_motion_bone_) {
+      *root_motion_transform = local_transform;
+      // The root motion bone shouldn't have a parent index, but if for some
+      // reason it does, respect the transform of that bone.
+      if (parent_idx == kInvalidBoneIdx) {
+        out[i] = mathfu::AffineTransform::Identity();
+      } else {
+        assert(i > parent_idx);
+        out[i] = out[parent_idx];
+      }
+    } else {
+      assert(parent_idx == kInvalidBoneIdx);
+      out[i] = local_transform;
+    }
+  }
+
+  /// Weighted average of every bone's transform in every running animation,
+  /// plus the additive layers, written to `blended_sqts_`.
+  void BlendLocalTransforms() {
     const int num_bones = NumBones();
-    const int num_anims = weights_.size();
+    const int num_motivators = static_cast<int>(motivators_.size());
+    const int num_additive = static_cast<int>(additive_motivators_.size());
+
+    // Gather the position, rotation, and scale of every motivator, in the
+    // order they're stored, followed by those of the additive layers.
+    anim_sqts_.Resize(num_motivators + num_additive);
+    for (int k = 0; k < num_motivators; ++k) {
+      GatherSqt(motivators_[k], k);
+    }
+    additive_bone_weights_.resize(num_additive);
+    for (int k = 0; k < num_additive; ++k) {
+      const MatrixMotivator4f& motivator = additive_motivators_[k];
+      GatherSqt(motivator, num_motivators + k);
+      additive_bone_weights_[k] =
+          motivator.Valid() ? additive_weights_[k / num_bones] : 0.f;
+    }
 
-    // For each bone...
-    for (int i = 0; i < num_bones; ++i) {
-      // TODO(b/111070174) use a scratchpad instead of a local gather SQT to
-      // make iteration less "jumpy", and just go through all motivators
-      // linearly.
-
-      // Gather the position, rotation, and scale.
-      mathfu::vec3 bone_position(0, 0, 0);
-      mathfu::quat bone_rotation(0, 0, 0, 0);
-      mathfu::vec3 bone_scale(0, 0, 0);
-
-      // The quaternions q and -q represent the same orientation (but not the
-      // same rotation). Since this matrix is simply an orientation, ensure that
-      // all quaternions are in the same 4-dimensional hemisphere, else their
-      // weighted average is incorrect. For example, .5q + .5(-q) should be
-      // either q or -q, not 0.
-      mathfu::quat first_quat;
-
-      // For each animation...
+    // Additive layers may be set before any animation is played, in which
+    // case the default pose, in `motivators_`, has all the weight.
+    static const float kDefaultPoseWeight = 1.f;
+    const int num_anims = weights_.empty() ? 1 : weights_.size();
+    const float* anim_weights =
+        weights_.empty() ? &kDefaultPoseWeight : weights_.data();
+
+    // The quaternions q and -q represent the same orientation (but not the
+    // same rotation). Since this matrix is simply an orientation, ensure that
+    // all quaternions are in the same 4-dimensional hemisphere as the first
+    // animation's, else their weighted average is incorrect. For example,
+    // .5q + .5(-q) should be either q or -q, not 0.
+    rotation_weights_.resize(num_motivators);
+    const float* rotation_x = anim_sqts_.Values(kSqtRotationX);
+    const float* rotation_y = anim_sqts_.Values(kSqtRotationY);
+    const float* rotation_z = anim_sqts_.Values(kSqtRotationZ);
+    const float* rotation_w = anim_sqts_.Values(kSqtRotationW);
+    for (int j = 0; j < num_anims; ++j) {
+      const int base = BaseBoneIndex(j);
+      const float weight = anim_weights[j];
+      for (int i = 0; i < num_bones; ++i) {
+        const int k = base + i;
+        const float dot =
+            rotation_x[i] * rotation_x[k] + rotation_y[i] * rotation_y[k] +
+            rotation_z[i] * rotation_z[k] + rotation_w[i] * rotation_w[k];
+        rotation_weights_[k] = dot < 0.f ? -weight : weight;
+      }
+    }
+
+    // Weighted sum of each component. Since the weights are normalized to sum
+    // to 1 at all times, only the rotation needs to be normalized, which
+    // SqtsToAffines() does.
+    blended_sqts_.Resize(num_bones);
+    for (int c = 0; c < kNumSqtElements; ++c) {
+      const bool rotation = kSqtRotationW <= c && c <= kSqtRotationZ;
+      const float* samples = anim_sqts_.Values(c);
+      float* blended = blended_sqts_.Values(c);
+      std::fill(blended, blended + num_bones, 0.f);
       for (int j = 0; j < num_anims; ++j) {
-        const MatrixMotivator4f& motivator = motivators_[i + j * num_bones];
-        const float weight = weights_[j];
-        float rotation_weight = weight;
-
-        // Get the SQT for the bone.
-        mathfu::vec3 position = DefaultOpsTranslation();
-        mathfu::vec4 rotation_vec(OperationDefaultValue(kQuaternionX),
-                                  OperationDefaultValue(kQuaternionY),
-                                  OperationDefaultValue(kQuaternionZ),
-                                  OperationDefaultValue(kQuaternionW));
-        mathfu::vec3 scale = DefaultOpsScale();
-        if (motivator.Valid()) {
-          motivator.Value(&position, &rotation_vec, &scale);
-        }
-        mathfu::quat rotation(rotation_vec.w, rotation_vec.xyz());
-
-        // Check if the quaternion needs to be flipped, then scale the
-        // individual components because using the quaternion * operator
-        // re-normalizes the quaternion (which is undesirable).
-        if (j == 0) {
-          first_quat = rotation;
-        } else if (mathfu::quat::DotProduct(first_quat, rotation) < 0.f) {
-          rotation_weight *= -1.f;
+        const int base = BaseBoneIndex(j);
+        const float weight = anim_weights[j];
+        const float* anim_samples = samples + base;
+        if (rotation) {
+          const float* rotation_weights = &rotation_weights_[base];
+          for (int i = 0; i < num_bones; ++i) {
+            blended[i] += anim_samples[i] * rotation_weights[i];
+          }
+        } else {
+          for (int i = 0; i < num_bones; ++i) {
+            blended[i] += anim_samples[i] * weight;
+          }
         }
-        rotation.set_scalar(rotation.scalar() * rotation_weight);
-        rotation.set_vector(rotation.vector() * rotation_weight);
-
-        // Gather the components.
-        bone_position += position * weight;
-        bone_rotation += rotation;
-        bone_scale += scale * weight;
       }
+    }
 
-      // Since the weights are normalized to sum to 1 at all times, only the
-      // rotation needs to be normalized.
-      bone_rotation.Normalize();
+    AddAdditiveLayers(num_motivators);
+  }
 
-      // Multiply this bone's transform by the parent transform (if it exists).
-      const mathfu::mat4 local_transform = mathfu::mat4::Transform(
-          bone_position, bone_rotation.ToMatrix(), bone_scale);
-      const int parent_idx = parents[i];
+  /// Write the transform of `motivator`, or the default transform if it's
+  /// invalid, to `anim_sqts_` at `k`.
+  void GatherSqt(const MatrixMotivator4f& motivator, int k) {
+    mathfu::vec3 position = DefaultOpsTranslation();
+    mathfu::vec4 rotation(OperationDefaultValue(kQuaternionX),
+                          OperationDefaultValue(kQuaternionY),
+                          OperationDefaultValue(kQuaternionZ),
+                          OperationDefaultValue(kQuaternionW));
+    mathfu::vec3 scale = DefaultOpsScale();
+    if (motivator.Valid()) {
+      motivator.Value(&position, &rotation, &scale);
+    }
+    anim_sqts_.Set(k, position, rotation, scale);
+  }
 
-      // Root motion bone transforms are stored separately and treated as the
-      // identity transform when computing child bone transforms.
-      if (i == root_motion_bone_) {
-        *root_motion_transform =
-            mathfu::mat4::ToAffineTransform(local_transform);
-        if (parent_idx == kInvalidBoneIdx) {
-          out[i] = mathfu::AffineTransform::Identity();
-        } else {
-          assert(i > parent_idx);
-          out[i] = out[parent_idx];
+  /// Apply each additive layer's difference from its reference pose to
+  /// `blended_sqts_`. The layers' transforms are in `anim_sqts_`, starting at
+  /// `num_motivators`.
+  void AddAdditiveLayers(int num_motivators) {
+    const int num_bones = NumBones();
+    const int num_layers = additive_weights_.size();
+    float* blended_w = blended_sqts_.Values(kSqtRotationW);
+    float* blended_x = blended_sqts_.Values(kSqtRotationX);
+    float* blended_y = blended_sqts_.Values(kSqtRotationY);
+    float* blended_z = blended_sqts_.Values(kSqtRotationZ);
+    for (int l = 0; l < num_layers; ++l) {
+      const int base = BaseBoneIndex(l);
+      const int sample_base = num_motivators + base;
+      const float* weights = &additive_bone_weights_[base];
+
+      // Translations are offset by the layer's translation from the
+      // reference, which is stored negated.
+      for (int c = kSqtTranslationX; c <= kSqtTranslationZ; ++c) {
+        const float* samples = anim_sqts_.Values(c) + sample_base;
+        const float* references = additive_references_.Values(c) + base;
+        float* blended = blended_sqts_.Values(c);
+        for (int i = 0; i < num_bones; ++i) {
+          blended[i] += weights[i] * (samples[i] + references[i]);
         }
-      } else {
-        if (parent_idx == kInvalidBoneIdx) {
-          out[i] = mathfu::mat4::ToAffineTransform(local_transform);
-        } else {
-          assert(i > parent_idx);
-          out[i] = mathfu::mat4::ToAffineTransform(
-              mathfu::mat4::FromAffineTransform(out[parent_idx]) *
-              local_transform);
+      }
+
+      // Scales are multiplied by the layer's ratio to the reference, which is
+      // stored inverted.
+      for (int c = kSqtScaleX; c <= kSqtScaleZ; ++c) {
+        const float* samples = anim_sqts_.Values(c) + sample_base;
+        const float* references = additive_references_.Values(c) + base;
+        float* blended = blended_sqts_.Values(c);
+        for (int i = 0; i < num_bones; ++i) {
+          blended[i] *= 1.f + weights[i] * (samples[i] * references[i] - 1.f);
         }
       }
+
+      // Rotations are turned by the layer's rotation from the reference,
+      // which is stored conjugated. The delta is blended in from the identity
+      // along the shorter arc. The result is left unnormalized, since
+      // SqtsToAffines() normalizes it.
+      const float* sample_w = anim_sqts_.Values(kSqtRotationW) + sample_base;
+      const float* sample_x = anim_sqts_.Values(kSqtRotationX) + sample_base;
+      const float* sample_y = anim_sqts_.Values(kSqtRotationY) + sample_base;
+      const float* sample_z = anim_sqts_.Values(kSqtRotationZ) + sample_base;
+      const float* reference_w =
+          additive_references_.Values(kSqtRotationW) + base;
+      const float* reference_x =
+          additive_references_.Values(kSqtRotationX) + base;
+      const float* reference_y =
+          additive_references_.Values(kSqtRotationY) + base;
+      const float* reference_z =
+          additive_references_.Values(kSqtRotationZ) + base;
+      for (int i = 0; i < num_bones; ++i) {
+        const float rw = reference_w[i];
+        const float rx = reference_x[i];
+        const float ry = reference_y[i];
+        const float rz = reference_z[i];
+        const float sw = sample_w[i];
+        const float sx = sample_x[i];
+        const float sy = sample_y[i];
+        const float sz = sample_z[i];
+        float dw = rw * sw - rx * sx - ry * sy - rz * sz;
+        float dx = rw * sx + rx * sw + ry * sz - rz * sy;
+        float dy = rw * sy - rx * sz + ry * sw + rz * sx;
+        float dz = rw * sz + rx * sy - ry * sx + rz * sw;
+        const float weight = dw < 0.f ? -weights[i] : weights[i];
+        dw = 1.f - weights[i] + weight * dw;
+        dx *= weight;
+        dy *= weight;
+        dz *= weight;
+
+        const float bw = blended_w[i];
+        const float bx = blended_x[i];
+        const float by = blended_y[i];
+        const float bz = blended_z[i];
+        blended_w[i] = bw * dw - bx * dx - by * dy - bz * dz;
+        blended_x[i] = bw * dx + bx * dw + by * dz - bz * dy;
+        blended_y[i] = bw * dy - bx * dz + by * dw + bz * dx;
+        blended_z[i] = bw * dz + bx * dy - by * dx + bz * dw;
+      }
     }
   }
 
   int BaseBoneIndex(int anim_index) const { return anim_index * NumBones(); }
 
+  /// Find the bones evaluated at each level of detail, and the transforms of
+  /// the bones that are culled. Everything a level switch needs is allocated
+  /// here, so that SetLod() doesn't allocate.
+  void InitializeLods(const std::vector<std::vector<BoneIndex>>& lods) {
+    if (lods.empty()) return;
+    const BoneIndex* parents = defining_anim_->bone_parents();
+    const int num_bones = NumBones();
+    lod_bone_needed_.resize(
+        lods.size(),
+        MotiveVector<bool>(
+            MotiveStdAllocator<bool>(lod_bone_needed_.get_allocator())));
+    for (size_t l = 0; l < lods.size(); ++l) {
+      MotiveVector<bool>& needed = lod_bone_needed_[l];
+      needed.assign(num_bones, false);
+      for (size_t k = 0; k < lods[l].size(); ++k) {
+        assert(lods[l][k] < num_bones);
+        for (BoneIndex i = lods[l][k]; i != kInvalidBoneIdx && !needed[i];
+             i = parents[i]) {
+          needed[i] = true;
+        }
+      }
+    }
+
+    // Culled bones keep their offset from their parent in the default pose.
+    lod_bind_transforms_.resize(num_bones);
+    RigAnimSampler sampler(*defining_anim_);
+    sampler.LocalTransforms(0.f, false, lod_bind_transforms_.data());
+  }
+
   // Initializes `motivator` so that it can drive an an animation. `sqt_anim`
   // Determines whether or not `motivator` is driving an SQT-based animation
   // or a Euler-Matrix-based animation.
@@ -497,35 +1493,133 @@ class RigData {
     }
   }
 
-  // TODO(b/111070174): decide if array-of-structs is better. It's faster for
-  // calculating transforms but significantly uglier for adding/removing
-  // animations and makes updating playback rates require a stride-based
-  // approach. Alternatively, add a scratchpad of SQTs with the struct-of-arrays
-  // approach to optimize calculating global transforms.
-
   // Motivators for all the current animations stored struct-of-arrays style.
   // For a defining animation with N bones an animations A and B, the
   // motivators are stored in the following order (Bone_X^Y means "bone X's
   // motivator in animation Y"):
   //   Bone_1^A, Bone_2^A, ..., Bone_N^A, Bone_1^B, Bone_2^B, ..., Bone_N^B.
-  std::vector<MatrixMotivator4f, mathfu::simd_allocator<MatrixMotivator4f>>
-      motivators_;
-  std::vector<mathfu::AffineTransform,
-              mathfu::simd_allocator<mathfu::AffineTransform>>
-      global_transforms_;
+  MotiveVector<MatrixMotivator4f> motivators_;
+
+  /// Processors of the bones' motivators, as registered with the engine.
+  MotiveVector<const MotiveProcessor*> dependencies_;
+
+  MotiveVector<mathfu::AffineTransform> global_transforms_;
+
+  /// Bones sorted by depth in the hierarchy. Level `l` runs from
+  /// bones_by_level_[level_starts_[l]] up to, but not including,
+  /// bones_by_level_[level_starts_[l + 1]].
+  MotiveVector<BoneIndex> bones_by_level_;
+  MotiveVector<int> level_starts_;
+
+  /// Bones that are evaluated, which are the masked bones and their ancestors.
+  /// Empty if every bone is evaluated.
+  MotiveVector<bool> bone_needed_;
+
+  /// Read by the processor instead of `global_transforms_` when the processor
+  /// is double buffered.
+  MotiveVector<mathfu::AffineTransform> front_global_transforms_;
 
   // The list of weights per running animation, normalized to sum to 1.
-  std::vector<float> weights_;
+  MotiveVector<float> weights_;
+
+  /// Scratchpads used when blending more than one animation. `anim_sqts_`
+  /// holds the transform of every motivator, in the same order as
+  /// `motivators_`, and `blended_sqts_` holds their weighted average per bone.
+  SqtScratchpad anim_sqts_;
+  SqtScratchpad blended_sqts_;
+
+  /// Local transform of every bone, converted from `blended_sqts_`, as
+  /// written by SqtsToAffines().
+  MotiveVector<float> blended_affines_;
+
+  /// The weight of each motivator's rotation, negated when its quaternion is
+  /// in the opposite hemisphere to the first animation's.
+  MotiveVector<float> rotation_weights_;
+
+  /// Motivators of the additive layers, stored layer by layer in the same
+  /// order as `motivators_`. See SetAdditiveLayers().
+  MotiveVector<MatrixMotivator4f> additive_motivators_;
+
+  /// Weight of each additive layer. Unlike `weights_`, not normalized.
+  MotiveVector<float> additive_weights_;
+
+  /// Inverse of each additive layer's reference pose, in the same order as
+  /// `additive_motivators_`: translations negated, rotations conjugated and
+  /// scales inverted.
+  SqtScratchpad additive_references_;
+
+  /// The weight of each additive motivator, or 0 if it's invalid.
+  MotiveVector<float> additive_bone_weights_;
 
   const RigAnim* defining_anim_;
   const RigAnim* current_anim_;
 
+  /// The animations passed to the most recent BlendToAnims(), parallel to
+  /// `weights_`. Empty once a single animation is playing.
+  MotiveVector<const RigAnim*> blend_anims_;
+
   // The root motion bone and it's most recent transform.
   BoneIndex root_motion_bone_;
   mathfu::AffineTransform root_motion_transform_;
 
   /// Time that the animation is expected to complete.
   MotiveTime end_time_;
+
+  /// The frames on which the global transforms are evaluated.
+  MotiveUpdateDivisor update_divisor_;
+
+  /// Reports the end of the animations started by BlendToAnim() and
+  /// BlendToAnims().
+  PlaybackWatch playback_watch_;
+
+  /// The animation passed to the most recent BlendToAnim(), or nullptr if
+  /// BlendToAnims() has been called since.
+  const RigAnim* instance_anim_;
+
+  /// Playback state of `instance_anim_`, used to find rigs that can share
+  /// their global transforms. `anim_time_` is in the animation's time.
+  float anim_time_;
+  float playback_rate_;
+  bool repeat_;
+  MotiveTime blend_time_;
+  MotiveTime time_since_blend_;
+
+  /// Playback state of the animation that `instance_anim_` replaced, which is
+  /// blended out over `blend_time_`. Only read in GPU playback.
+  const RigAnim* previous_anim_;
+  float previous_anim_time_;
+  float previous_playback_rate_;
+  bool previous_repeat_;
+
+  /// If true, no bones are evaluated. See SetGpuPlayback().
+  bool gpu_playback_;
+
+  /// The current level of detail, and the bones evaluated at each level
+  /// above 0. See RigInit::lods().
+  int lod_;
+  MotiveVector<MotiveVector<bool>> lod_bone_needed_;
+
+  /// Transform of every bone relative to its parent in the default pose.
+  /// Only set if there are levels of detail.
+  MotiveVector<mathfu::AffineTransform> lod_bind_transforms_;
+
+  /// Rigs are only shared when this is positive. See SetInstanceTimeQuantum().
+  MotiveTime instance_time_quantum_;
+
+  /// Where to write skinning matrices. See SetSkinningOutput().
+  SkinningOutput skinning_output_;
+
+  /// If true, the global transforms are only calculated when read. `dirty_` is
+  /// true when they're out of date.
+  bool lazy_;
+  bool dirty_;
+
+  /// Bone motivators that changed on or after this frame are not reflected in
+  /// the global transforms. 0 if every bone must be recalculated.
+  uint32_t stale_frame_;
+
+  /// Scratch space for FindChangedBones(). Indexed by bone.
+  MotiveVector<uint8_t> bone_changed_;
 };
 
 }  // namespace motive
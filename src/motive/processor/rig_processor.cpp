@@ -12,7 +12,10 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <iomanip>
+#include <map>
+#include <new>
 #include <sstream>
 
 #include "mathfu/constants.h"
@@ -23,9 +26,14 @@
 #include "motive/processor/rig_data.h"
 #include "motive/rig_anim.h"
 #include "motive/rig_processor.h"
+#include "motive/util/trace.h"
 
 namespace motive {
 
+// Each rig updates many bones, so rigs are split far more finely than the
+// kMinIndicesPerTask of processors with one value per index.
+static const int kMinRigsPerTask = 2;
+
 // See comments on RigInit for details on this class.
 class MotiveRigProcessor : public RigProcessor {
  public:
@@ -37,58 +45,347 @@ class MotiveRigProcessor : public RigProcessor {
 
   void AdvanceFrame(MotiveTime delta_time) override {
     Defragment();
+    CollapseFinishedBlends();
+    FindInstances(delta_time);
 
     // Process the series of matrix operations for each index.
-    const MotiveIndex num_indices = NumIndices();
-    for (MotiveIndex index = 0; index < num_indices; ++index) {
-      RigData& d = Data(index);
-      d.UpdateGlobalTransforms();
-    }
+    // Each index is independent, so split them across tasks when the engine
+    // has a task scheduler.
+    const uint32_t frame = Engine()->frame_count();
+    Engine()->ParallelFor(
+        NumActiveIndices(), kMinRigsPerTask,
+        [this, frame](int begin, int end) {
+          const TraceScope trace("UpdateGlobalTransforms", Type()->name);
+          for (MotiveIndex index = begin; index < end; ++index) {
+            // Skip the unused indices left by a budgeted Defragment().
+            RigData* d = data_[index];
+            if (d == nullptr || !d->update_divisor().Due(frame)) continue;
+            if (Leader(index) != index || d->gpu_playback()) continue;
+            if (d->lazy()) {
+              d->MarkDirty();
+              continue;
+            }
+            d->UpdateGlobalTransforms(Engine());
+          }
+        });
+    WriteInstanceSkinningOutputs(frame);
 
     // Update our global time. It shouldn't matter if this wraps
     // around, since we only calculate times relative to it.
     time_ += delta_time;
+
+    // Report the animations that have ended. Their end is estimated when they
+    // start, so their bones are only checked once they're due.
+    const MotiveIndex num_indices = NumIndices();
+    for (MotiveIndex index = 0; index < num_indices; ++index) {
+      RigData* d = data_[index];
+      if (d != nullptr && d->playback_watch().Ended(time_, *d)) {
+        PushEvent(index, kMotiveEventPlaybackEnded);
+      }
+    }
+  }
+
+  // The fastest rate of `playbacks`. Estimating the end with it can only make
+  // the rig's bones be checked early, never late.
+  static float FastestPlaybackRate(const SplinePlayback* playbacks,
+                                   int count) {
+    float fastest = 0.0f;
+    for (int i = 0; i < count; ++i) {
+      fastest = std::max(fastest, playbacks[i].playback_rate);
+    }
+    return fastest;
+  }
+
+  // Return rigs that blended several animations, but now only play one, to
+  // the single animation path. This releases motivators, so it cannot be done
+  // inside the tasks of AdvanceFrame().
+  void CollapseFinishedBlends() {
+    const MotiveIndex num_indices = NumIndices();
+    for (MotiveIndex index = 0; index < num_indices; ++index) {
+      RigData* d = data_[index];
+      if (d == nullptr) continue;
+      const int anim_index = d->SoleActiveAnim();
+      if (anim_index < 0) continue;
+      d->UnregisterDependencies(this, Engine());
+      d->CollapseToAnim(anim_index);
+      d->RegisterDependencies(this, Engine());
+    }
+  }
+
+  // Point each rig at the first rig that can share its global transforms.
+  // Only that rig needs to be updated; the others read its transforms.
+  void FindInstances(MotiveTime delta_time) {
+    const MotiveIndex num_indices = NumIndices();
+    instance_leaders_.resize(num_indices);
+    instance_keys_.clear();
+    for (MotiveIndex index = 0; index < num_indices; ++index) {
+      instance_leaders_[index] = index;
+      RigData* d = data_[index];
+      if (d == nullptr) continue;
+      d->AdvanceAnimTime(delta_time);
+      RigInstanceKey key;
+      if (!d->InstanceKey(&key)) continue;
+      instance_leaders_[index] =
+          instance_keys_.insert(std::make_pair(key, index)).first->second;
+    }
+  }
+
+  // Rigs that share another rig's global transforms still need their own
+  // skinning matrices.
+  void WriteInstanceSkinningOutputs(uint32_t frame) {
+    const MotiveIndex num_indices = NumIndices();
+    for (MotiveIndex index = 0; index < num_indices; ++index) {
+      // Unused indices are their own leaders, so are skipped here.
+      const MotiveIndex leader = Leader(index);
+      if (leader == index) continue;
+      const RigData& d = *data_[index];
+      if (!d.HasSkinningOutput() || !d.update_divisor().Due(frame)) continue;
+      data_[leader]->ResolveDirty(Engine());
+      d.WriteSkinningOutput(data_[leader]->GlobalTransforms());
+    }
+  }
+
+  // Give every rig its own transforms again, so that indices can change.
+  void ResetInstances() {
+    for (MotiveIndex index = 0; index < NumIndices(); ++index) {
+      const MotiveIndex leader = Leader(index);
+      if (leader == index) continue;
+      data_[leader]->ResolveDirty(Engine());
+      data_[index]->CopyTransformsFrom(*data_[leader]);
+    }
+    instance_leaders_.clear();
+    front_instance_leaders_.clear();
+  }
+
+  // Index of the rig whose transforms `index` reads.
+  MotiveIndex Leader(MotiveIndex index) const {
+    return index < static_cast<MotiveIndex>(instance_leaders_.size())
+               ? instance_leaders_[index]
+               : index;
+  }
+
+  MotiveIndex FrontLeader(MotiveIndex index) const {
+    return index < static_cast<MotiveIndex>(front_instance_leaders_.size())
+               ? front_instance_leaders_[index]
+               : index;
+  }
+
+  bool UpdateDependents(const MotiveProcessor* dependency) override {
+    // Only recalculate the rigs whose bones are driven by `dependency`.
+    // The bones may have changed after this frame's AdvanceFrame(), so their
+    // changed frames can't tell which bones are up to date.
+    bool updated = false;
+    const MotiveIndex num_indices = NumIndices();
+    for (MotiveIndex index = 0; index < num_indices; ++index) {
+      RigData* d = data_[index];
+      if (d != nullptr && Leader(index) == index && d->DependsOn(dependency)) {
+        d->MarkStale();
+        if (d->lazy()) {
+          d->MarkDirty();
+        } else {
+          d->UpdateGlobalTransforms(Engine());
+        }
+        updated = true;
+      }
+    }
+    return updated;
   }
 
   void BlendToAnim(MotiveIndex index, const RigAnim& anim,
                    const motive::SplinePlayback& playback) override {
-    Data(index).BlendToAnim(anim, playback, Engine(), time_);
+    CountEvent(kCounterRigBlends);
+    RigData& d = Data(index);
+    d.UnregisterDependencies(this, Engine());
+    d.BlendToAnim(anim, playback, Engine(), time_);
+    d.RegisterDependencies(this, Engine());
+    d.playback_watch().Start(time_, d.TimeRemaining(), playback.playback_rate);
+  }
+
+  void BlendToAnimAt(const MotiveIndex* indices, MotiveIndex count,
+                     const RigAnim& anim,
+                     const motive::SplinePlayback& playback) override {
+    BoneIndex num_bones = 0;
+    for (MotiveIndex i = 0; i < count; ++i) {
+      CountEvent(kCounterRigBlends);
+      RigData& d = Data(indices[i]);
+      d.UnregisterDependencies(this, Engine());
+      d.BeginBlendToAnim(anim, playback, Engine(), time_);
+      num_bones = std::max(num_bones, d.NumBones());
+    }
+
+    // Every rig blends bone `j` to the same ops, so blend them together.
+    for (BoneIndex j = 0; j < num_bones; ++j) {
+      bone_motivators_.clear();
+      for (MotiveIndex i = 0; i < count; ++i) {
+        RigData& d = Data(indices[i]);
+        if (j < d.NumBones() && d.BoneNeeded(j)) {
+          bone_motivators_.push_back(&d.BoneMotivator(j));
+        }
+      }
+      MatrixMotivator4f::BlendToOpsInBulk(bone_motivators_.data(),
+                                          bone_motivators_.size(),
+                                          anim.Anim(j).ops(), playback);
+    }
+
+    for (MotiveIndex i = 0; i < count; ++i) {
+      RigData& d = Data(indices[i]);
+      d.EndBlendToAnim();
+      d.RegisterDependencies(this, Engine());
+      d.playback_watch().Start(time_, d.TimeRemaining(),
+                               playback.playback_rate);
+    }
+  }
+
+  int ReplaceAnim(const RigAnim& old_anim, const RigAnim& new_anim,
+                  MotiveTime blend_time) override {
+    int num_replaced = 0;
+    const MotiveIndex num_indices = NumIndices();
+    for (MotiveIndex index = 0; index < num_indices; ++index) {
+      SplinePlayback playback;
+      if (data_[index] == nullptr ||
+          !data_[index]->CurrentPlayback(&old_anim, &playback)) {
+        continue;
+      }
+      playback.blend_x = static_cast<float>(blend_time);
+      BlendToAnim(index, new_anim, playback);
+      num_replaced++;
+    }
+    return num_replaced;
   }
 
   void BlendToAnims(MotiveIndex index, const RigAnim** anims,
                     const SplinePlayback* playbacks, const float* weights,
                     int count) override {
-    Data(index).BlendToAnims(anims, playbacks, weights, count, Engine(), time_);
+    CountEvent(kCounterRigBlends);
+    RigData& d = Data(index);
+    d.UnregisterDependencies(this, Engine());
+    d.BlendToAnims(anims, playbacks, weights, count, Engine(), time_);
+    d.RegisterDependencies(this, Engine());
+    d.playback_watch().Start(time_, d.TimeRemaining(),
+                             FastestPlaybackRate(playbacks, count));
   }
 
   void SetPlaybackRate(MotiveIndex index, float playback_rate) override {
-    Data(index).SetPlaybackRate(playback_rate);
+    RigData& d = Data(index);
+    d.SetPlaybackRate(playback_rate);
+    d.playback_watch().SetPlaybackRate(time_, d.TimeRemaining(),
+                                       playback_rate);
+  }
+
+  void SetUpdateDivisor(MotiveIndex index,
+                        const MotiveUpdateDivisor& divisor) override {
+    Data(index).SetUpdateDivisor(divisor);
   }
 
   void SetPlaybackRates(MotiveIndex index, const float* playback_rates,
                         int count) {
-    Data(index).SetPlaybackRates(playback_rates, count);
+    RigData& d = Data(index);
+    d.SetPlaybackRates(playback_rates, count);
+    const float fastest =
+        count > 0 ? *std::max_element(playback_rates, playback_rates + count)
+                  : 0.0f;
+    d.playback_watch().SetPlaybackRate(time_, d.TimeRemaining(), fastest);
   }
 
   void SetWeights(MotiveIndex index, const float* weights, int count) {
     Data(index).SetWeights(weights, count);
   }
 
+  void SetAdditiveLayers(MotiveIndex index, const RigAdditiveLayer* layers,
+                         int count) override {
+    RigData& d = Data(index);
+    d.UnregisterDependencies(this, Engine());
+    d.SetAdditiveLayers(layers, count, Engine());
+    d.RegisterDependencies(this, Engine());
+  }
+
   void SetRepeating(MotiveIndex index, bool repeat) {
     Data(index).SetRepeating(repeat);
   }
 
+  void SetInstanceTimeQuantum(MotiveIndex index,
+                              MotiveTime time_quantum) override {
+    Data(index).SetInstanceTimeQuantum(time_quantum);
+  }
+
+  void SetSkinningOutput(MotiveIndex index,
+                         const SkinningOutput& output) override {
+    Data(index).SetSkinningOutput(output);
+  }
+
+  void SetLazy(MotiveIndex index, bool lazy) override {
+    Data(index).SetLazy(lazy);
+  }
+
+  void ResolveDirty(const MotiveIndex* indices, int count) override {
+    // Several rigs may share one instance, which must only be resolved once.
+    dirty_leaders_.clear();
+    for (int i = 0; i < count; ++i) {
+      dirty_leaders_.push_back(Leader(indices[i]));
+    }
+    std::sort(dirty_leaders_.begin(), dirty_leaders_.end());
+    dirty_leaders_.erase(
+        std::unique(dirty_leaders_.begin(), dirty_leaders_.end()),
+        dirty_leaders_.end());
+    Engine()->ParallelFor(static_cast<int>(dirty_leaders_.size()),
+                          kMinRigsPerTask, [this](int begin, int end) {
+                            for (int i = begin; i < end; ++i) {
+                              Data(dirty_leaders_[i]).ResolveDirty(Engine());
+                            }
+                          });
+  }
+
+  void SetBoneMask(MotiveIndex index, const BoneIndex* bones,
+                   int count) override {
+    RigData& d = Data(index);
+    d.UnregisterDependencies(this, Engine());
+    d.SetBoneMask(bones, count, Engine());
+    d.RegisterDependencies(this, Engine());
+  }
+
+  void SetLod(MotiveIndex index, int lod) override {
+    RigData& d = Data(index);
+    d.UnregisterDependencies(this, Engine());
+    d.SetLod(lod, Engine());
+    d.RegisterDependencies(this, Engine());
+  }
+
+  void SetGpuPlayback(MotiveIndex index, bool gpu) override {
+    RigData& d = Data(index);
+    d.UnregisterDependencies(this, Engine());
+    d.SetGpuPlayback(gpu, Engine());
+    d.RegisterDependencies(this, Engine());
+  }
+
+  bool GpuPlayback(MotiveIndex index,
+                   RigGpuPlayback* playback) const override {
+    return Data(index).GpuPlayback(playback);
+  }
+
   MotivatorType Type() const override { return RigInit::kType; }
   int Priority() const override { return 3; }
 
   const mathfu::AffineTransform* GlobalTransforms(
       MotiveIndex index) const override {
-    return Data(index).GlobalTransforms();
+    if (ReadFrontBuffer()) {
+      return Data(FrontLeader(index)).FrontGlobalTransforms();
+    }
+
+    // Lazy rigs are calculated on first access. `data_` holds pointers, so
+    // the rig can be updated even though this function is const.
+    RigData* d = data_[Leader(index)];
+    d->ResolveDirty(Engine());
+    return d->GlobalTransforms();
   }
 
   const mathfu::AffineTransform& RootMotionTransform(
       MotiveIndex index) const override {
-    return Data(index).RootMotionTransform();
+    if (ReadFrontBuffer()) {
+      return Data(FrontLeader(index)).RootMotionTransform();
+    }
+    RigData* d = data_[Leader(index)];
+    d->ResolveDirty(Engine());
+    return d->RootMotionTransform();
   }
 
   MotiveTime TimeRemaining(MotiveIndex index) const override {
@@ -133,20 +430,25 @@ class MotiveRigProcessor : public RigProcessor {
     RemoveIndices(index, dimensions);
     auto rig_init = static_cast<const RigInit&>(init);
     for (MotiveIndex i = index; i < index + dimensions; ++i) {
-      data_[i] = new RigData(rig_init, time_);
+      void* memory = Allocator()->Allocate(sizeof(RigData), alignof(RigData));
+      data_[i] = new (memory) RigData(rig_init, time_, Allocator());
     }
   }
 
   void RemoveIndices(MotiveIndex index, MotiveDimension dimensions) override {
+    ResetInstances();
     for (MotiveIndex i = index; i < index + dimensions; ++i) {
       if (data_[i] == nullptr) continue;
-      delete data_[i];
+      data_[i]->UnregisterDependencies(this, Engine());
+      data_[i]->~RigData();
+      Allocator()->Free(data_[i]);
       data_[i] = nullptr;
     }
   }
 
   void MoveIndices(MotiveIndex old_index, MotiveIndex new_index,
                    MotiveDimension dimensions) override {
+    ResetInstances();
     MotiveIndex old_i = old_index;
     MotiveIndex new_i = new_index;
     for (MotiveDimension i = 0; i < dimensions; ++i, ++new_i, ++old_i) {
@@ -155,6 +457,24 @@ class MotiveRigProcessor : public RigProcessor {
     }
   }
 
+  void AppendChildMotivatorsOf(
+      MotiveIndex index,
+      std::vector<const Motivator*>* children) const override {
+    if (data_[index] != nullptr) data_[index]->AppendMotivators(children);
+  }
+
+  void UseAllocator(MotiveAllocator* allocator) override {
+    data_ = MotiveVector<RigData*>(MotiveStdAllocator<RigData*>(allocator));
+    bone_motivators_ = MotiveVector<MatrixMotivator4f*>(
+        MotiveStdAllocator<MatrixMotivator4f*>(allocator));
+    instance_leaders_ =
+        MotiveVector<MotiveIndex>(MotiveStdAllocator<MotiveIndex>(allocator));
+    front_instance_leaders_ =
+        MotiveVector<MotiveIndex>(MotiveStdAllocator<MotiveIndex>(allocator));
+    dirty_leaders_ =
+        MotiveVector<MotiveIndex>(MotiveStdAllocator<MotiveIndex>(allocator));
+  }
+
   void SetNumIndices(MotiveIndex num_indices) override {
     // Ensure old items are deleted.
     const MotiveIndex old_num_indices = NumIndices();
@@ -166,6 +486,51 @@ class MotiveRigProcessor : public RigProcessor {
     data_.resize(num_indices, nullptr);
   }
 
+  void ReserveIndices(MotiveIndex count) override {
+    data_.reserve(count);
+    instance_leaders_.reserve(count);
+    dirty_leaders_.reserve(count);
+    if (double_buffered()) front_instance_leaders_.reserve(count);
+  }
+
+  void TrimIndices() override {
+    data_.shrink_to_fit();
+    instance_leaders_.shrink_to_fit();
+    dirty_leaders_.shrink_to_fit();
+    front_instance_leaders_.shrink_to_fit();
+  }
+
+  void AddMemoryStats(MemoryStats* stats) const override {
+    RigProcessor::AddMemoryStats(stats);
+    stats->AddVector(data_);
+    stats->AddVector(instance_leaders_);
+    stats->AddVector(front_instance_leaders_);
+    stats->AddVector(dirty_leaders_);
+  }
+
+  void ArchiveState(MotiveStateArchive* archive) override {
+    RigProcessor::ArchiveState(archive);
+    archive->Layout(data_);
+    for (auto it = data_.begin(); it != data_.end() && archive->ok(); ++it) {
+      if (*it != nullptr) (*it)->ArchiveState(archive);
+    }
+    archive->Array(&instance_leaders_);
+    archive->Value(&time_);
+  }
+
+  void CopyToFrontBuffer(MotiveIndex index,
+                         MotiveDimension dimensions) override {
+    front_instance_leaders_.resize(NumIndices());
+    for (MotiveIndex i = index; i < index + dimensions; ++i) {
+      front_instance_leaders_[i] = Leader(i);
+      if (data_[i] == nullptr || Leader(i) != i) continue;
+      // The front buffer is read while the next frame advances, so lazy rigs
+      // can't wait until they're read.
+      data_[i]->ResolveDirty(Engine());
+      data_[i]->CopyToFrontBuffer();
+    }
+  }
+
   const RigData& Data(MotiveIndex index) const {
     assert(ValidIndex(index));
     return *data_[index];
@@ -176,8 +541,21 @@ class MotiveRigProcessor : public RigProcessor {
     return *data_[index];
   }
 
-  std::vector<RigData*> data_;
+  MotiveVector<RigData*> data_;
+
+  // Scratch space for BlendToAnimAt(), held here to avoid reallocating.
+  MotiveVector<MatrixMotivator4f*> bone_motivators_;
   MotiveTime time_;
+
+  // For each index, the index of the rig whose global transforms it shares.
+  // Rebuilt every frame by FindInstances(). `front_instance_leaders_` is the
+  // copy read along with the front buffers.
+  MotiveVector<MotiveIndex> instance_leaders_;
+  MotiveVector<MotiveIndex> front_instance_leaders_;
+  std::map<RigInstanceKey, MotiveIndex> instance_keys_;
+
+  // Scratch space for ResolveDirty().
+  MotiveVector<MotiveIndex> dirty_leaders_;
 };
 
 MOTIVE_INSTANCE(RigInit, MotiveRigProcessor);
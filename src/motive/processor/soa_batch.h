@@ -0,0 +1,59 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MOTIVE_SOA_BATCH_H_
+#define MOTIVE_SOA_BATCH_H_
+
+#include <assert.h>
+
+namespace motive {
+
+// Base of the batches that processors gather their indices into, so that the
+// indices can be processed together. A derived batch stores each of its
+// operands as an array of kSize, a structure-of-arrays, and processes them
+// with loops that run across the batch without branches, which the compiler
+// turns into 4- or 8-wide SIMD instructions.
+//
+// `Key` identifies where each result is written back, such as a MotiveIndex.
+template <class Key>
+class SoaBatch {
+ public:
+  static const int kSize = 8;
+
+  SoaBatch() : count_(0) {}
+
+  int size() const { return count_; }
+  bool full() const { return count_ == kSize; }
+
+ protected:
+  // Queue `key`, and return the lane for its operands.
+  int AddKey(const Key& key) {
+    assert(count_ < kSize);
+    keys_[count_] = key;
+    return count_++;
+  }
+
+  const Key& key(int j) const { return keys_[j]; }
+
+  // Empty the batch, once its results have been written back.
+  void Clear() { count_ = 0; }
+
+ private:
+  Key keys_[kSize];
+  int count_;
+};
+
+}  // namespace motive
+
+#endif  // MOTIVE_SOA_BATCH_H_
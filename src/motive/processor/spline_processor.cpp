@@ -12,11 +12,14 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+
 #include "motive/engine.h"
 #include "motive/math/bulk_spline_evaluator.h"
 #include "motive/math/compact_spline.h"
 #include "motive/processor/spline_data.h"
 #include "motive/spline_init.h"
+#include "motive/spline_processor.h"
 
 namespace motive {
 
@@ -24,45 +27,53 @@ namespace motive {
 // that go above or below the supplied nodes.
 static const float kYRangeBufferPercent = 1.2f;
 
-class SplineMotiveProcessor : public MotiveProcessorNf {
+// Minimum number of BulkSplineEvaluator shards advanced by each task when
+// AdvanceFrame() is split across a MotiveTaskScheduler.
+static const int kMinShardsPerTask = 1;
+
+class SplineMotiveProcessor : public SplineProcessor {
  public:
+  SplineMotiveProcessor() : clock_(0) {}
   virtual ~SplineMotiveProcessor() {
     for (auto it = spline_pool_.begin(); it != spline_pool_.end(); ++it) {
-      CompactSpline::Destroy(*it);
+      CompactSpline::Destroy(*it, Allocator());
     }
   }
 
   void AdvanceFrame(MotiveTime delta_time) override {
     Defragment();
-    interpolator_.AdvanceFrame(static_cast<float>(delta_time));
+
+    // Suspended indices are after the active ones, so they're skipped
+    // entirely. They catch up with `clock_` when resumed.
+    const MotiveIndex num_active = NumActiveIndices();
+    interpolator_.SetNumActiveIndices(num_active);
+
+    // Shards are independent, so split them across tasks when the engine has
+    // a task scheduler.
+    const float delta_x = static_cast<float>(delta_time);
+    const uint32_t frame = Engine()->frame_count();
+    interpolator_.SetFrame(frame);
+    Engine()->ParallelFor(
+        interpolator_.NumShards(), kMinShardsPerTask,
+        [this, delta_x, frame, num_active](int begin, int end) {
+          interpolator_.AdvanceFrameShards(delta_x, begin, end);
+          const MotiveIndex kShard = BulkSplineEvaluator::kIndicesPerShard;
+          UpdateChangedFrames(begin * kShard,
+                              std::min(end * kShard, num_active), frame);
+        });
+    clock_ += delta_time;
   }
 
-  MotivatorType Type() const override { return SplineInit::kType; }
   int Priority() const override { return 0; }
 
-  // Accessors to allow the user to get and set simluation values.
-  const float* Values(MotiveIndex index) const override {
-    return interpolator_.Ys(index);
-  }
-  void Velocities(MotiveIndex index, MotiveDimension dimensions,
-                  float* out) const override {
-    return interpolator_.Derivatives(index, dimensions, out);
-  }
-  void Directions(MotiveIndex index, MotiveDimension dimensions,
-                  float* out) const override {
-    return interpolator_.DerivativesWithoutPlayback(index, dimensions, out);
-  }
-  void TargetValues(MotiveIndex index, MotiveDimension dimensions,
-                    float* out) const override {
-    return interpolator_.EndYs(index, dimensions, out);
-  }
-  void TargetVelocities(MotiveIndex index, MotiveDimension dimensions,
+  // Accessors to allow the user to get and set simluation values. The rest
+  // are in SplineProcessor.
+  void ExportVelocities(const MotiveIndex* indices, size_t count,
+                        MotiveDimension dimensions, size_t stride,
                         float* out) const override {
-    return interpolator_.EndDerivatives(index, dimensions, out);
-  }
-  void Differences(MotiveIndex index, MotiveDimension dimensions,
-                   float* out) const override {
-    return interpolator_.YDifferencesToEnd(index, dimensions, out);
+    for (size_t i = 0; i < count; ++i, out += stride) {
+      interpolator_.Derivatives(indices[i], dimensions, out);
+    }
   }
   MotiveTime TargetTime(MotiveIndex index,
                         MotiveDimension dimensions) const override {
@@ -78,12 +89,31 @@ class SplineMotiveProcessor : public MotiveProcessorNf {
   MotiveTime SplineTime(MotiveIndex index) const override {
     return static_cast<MotiveTime>(interpolator_.X(index));
   }
+  uint32_t ChangedFrame(MotiveIndex index,
+                        MotiveDimension dimensions) const override {
+    return *std::max_element(changed_frames_.begin() + index,
+                             changed_frames_.begin() + index + dimensions);
+  }
 
   void SetTargets(MotiveIndex index, MotiveDimension dimensions,
                   const MotiveTarget1f* ts) override {
+    target_indices_.resize(dimensions);
     for (MotiveDimension i = 0; i < dimensions; ++i) {
-      SetTarget(index + i, ts[i]);
+      target_indices_[i] = index + i;
     }
+    SetTargetsAt(target_indices_.data(), dimensions, ts);
+  }
+
+  void SetTargetsAt(const MotiveIndex* indices, MotiveIndex count,
+                    const MotiveTarget1f* ts) override {
+    // Build every spline first, since each starts from the current state of
+    // the interpolator. Then start them all with one batch of cubics.
+    target_splines_.resize(count);
+    for (MotiveIndex i = 0; i < count; ++i) {
+      target_splines_[i] = TargetSpline(indices[i], ts[i]);
+    }
+    interpolator_.JumpToSplines(indices, count, target_splines_.data(),
+                                SplinePlayback());
   }
 
   void SetSplines(MotiveIndex index, MotiveDimension dimensions,
@@ -100,6 +130,15 @@ class SplineMotiveProcessor : public MotiveProcessorNf {
     interpolator_.SetSplines(index, dimensions, splines, playback);
   }
 
+  void SetSplinesAt(const MotiveIndex* indices, MotiveIndex count,
+                    const CompactSpline* const* splines,
+                    const SplinePlayback& playback) override {
+    for (MotiveIndex i = 0; i < count; ++i) {
+      FreeSplineForIndex(indices[i]);
+    }
+    interpolator_.SetSplinesAt(indices, count, splines, playback);
+  }
+
   void SetSplinesAndTargets(MotiveIndex index,
                             MotiveDimension dimensions,
                             const CompactSpline* const* splines,
@@ -123,6 +162,22 @@ class SplineMotiveProcessor : public MotiveProcessorNf {
     interpolator_.Splines(index, dimensions, splines);
   }
 
+  void SplineStates(MotiveIndex index, MotiveDimension dimensions,
+                    SplineState* states) const override {
+    for (MotiveDimension i = 0; i < dimensions; ++i) {
+      interpolator_.GetSplineState(index + i, &states[i]);
+    }
+  }
+
+  void SetSplineStates(MotiveIndex index, MotiveDimension dimensions,
+                       const SplineState* states) override {
+    for (MotiveDimension i = 0; i < dimensions; ++i) {
+      FreeSplineForIndex(index + i);
+      interpolator_.SetSplineState(index + i, states[i]);
+    }
+    MarkChanged(index, dimensions);
+  }
+
   // TODO: Push this loop into BulkSplineInterpolator.
   void SetSplineTime(MotiveIndex index, MotiveDimension dimensions,
                      MotiveTime time) override {
@@ -141,9 +196,21 @@ class SplineMotiveProcessor : public MotiveProcessorNf {
     interpolator_.SetRepeating(index, dimensions, repeat);
   }
 
+  void SetUpdateDivisor(MotiveIndex index,
+                        const MotiveUpdateDivisor& divisor) override {
+    interpolator_.SetUpdateDivisors(index, Dimensions(index), divisor);
+  }
+
  protected:
   // TODO: Change to CreateSplineToTarget()
   void SetTarget(MotiveIndex index, const MotiveTarget1f& t) {
+    SetTargetsAt(&index, 1, &t);
+  }
+
+  // Fill the local spline of `index` with the nodes of `t`, starting from the
+  // current value, and return it.
+  const CompactSpline* TargetSpline(MotiveIndex index,
+                                    const MotiveTarget1f& t) {
     SplineData& d = Data(index);
 
     // If the first node specifies time=0 or there is no valid data in the
@@ -196,10 +263,7 @@ class SplineMotiveProcessor : public MotiveProcessorNf {
                               motive::kAddWithoutModification);
       prev_y = y;
     }
-
-    // Point the interpolator at the spline we just created. Always start our
-    // spline at time 0.
-    interpolator_.SetSplines(index, 1, d.local_spline, SplinePlayback());
+    return d.local_spline;
   }
 
   void InitializeIndices(const MotivatorInit& init, MotiveIndex index,
@@ -207,6 +271,7 @@ class SplineMotiveProcessor : public MotiveProcessorNf {
                          MotiveEngine* /*engine*/) override {
     auto spline_init = static_cast<const SplineInit&>(init);
     interpolator_.SetYRanges(index, dimensions, spline_init.range());
+    MarkChanged(index, dimensions);
   }
 
   bool SupportsCloning() override { return true; }
@@ -222,11 +287,13 @@ class SplineMotiveProcessor : public MotiveProcessorNf {
           Data(index).local_spline = dest_spline;
           return dest_spline;
         });
+    MarkChanged(dst, dimensions);
   }
 
   virtual void RemoveIndices(MotiveIndex index, MotiveDimension dimensions) {
     // Clear reference to this spline.
     interpolator_.ClearSplines(index, dimensions);
+    interpolator_.SetUpdateDivisors(index, dimensions, MotiveUpdateDivisor());
 
     // Return splines to the pool of splines.
     for (MotiveIndex i = index; i < index + dimensions; ++i) {
@@ -242,13 +309,148 @@ class SplineMotiveProcessor : public MotiveProcessorNf {
     MotiveIndex new_i = new_index;
     for (MotiveDimension i = 0; i < dimensions; ++i, ++new_i, ++old_i) {
       data_[new_i] = data_[old_i];
+      previous_ys_[new_i] = previous_ys_[old_i];
+      changed_frames_[new_i] = changed_frames_[old_i];
+      suspend_clocks_[new_i] = suspend_clocks_[old_i];
     }
     interpolator_.MoveIndices(old_index, new_index, dimensions);
   }
 
+  const void* IndexSource(MotiveIndex index) const override {
+    return interpolator_.SourceSpline(index);
+  }
+
+  void SuspendIndices(MotiveIndex index, MotiveDimension dimensions) override {
+    std::fill(suspend_clocks_.begin() + index,
+              suspend_clocks_.begin() + index + dimensions, clock_);
+  }
+
+  // Jump straight to where the splines would be had they kept advancing,
+  // instead of replaying the frames that were skipped.
+  void ResumeIndices(MotiveIndex index, MotiveDimension dimensions) override {
+    const float delta_x = static_cast<float>(clock_ - suspend_clocks_[index]);
+    interpolator_.AdvanceXs(index, dimensions, delta_x);
+  }
+
+  void UseAllocator(MotiveAllocator* allocator) override {
+    interpolator_.SetAllocator(allocator);
+    target_indices_ =
+        MotiveVector<MotiveIndex>(MotiveStdAllocator<MotiveIndex>(allocator));
+    target_splines_ = MotiveVector<const CompactSpline*>(
+        MotiveStdAllocator<const CompactSpline*>(allocator));
+    data_ = MotiveVector<SplineData>(MotiveStdAllocator<SplineData>(allocator));
+    spline_pool_ = MotiveVector<CompactSpline*>(
+        MotiveStdAllocator<CompactSpline*>(allocator));
+    front_ys_ = MotiveVector<float>(MotiveStdAllocator<float>(allocator));
+    previous_ys_ = MotiveVector<float>(MotiveStdAllocator<float>(allocator));
+    changed_frames_ =
+        MotiveVector<uint32_t>(MotiveStdAllocator<uint32_t>(allocator));
+    suspend_clocks_ =
+        MotiveVector<MotiveTime>(MotiveStdAllocator<MotiveTime>(allocator));
+  }
+
   virtual void SetNumIndices(MotiveIndex num_indices) {
     data_.resize(num_indices);
     interpolator_.SetNumIndices(num_indices);
+    previous_ys_.resize(num_indices);
+    changed_frames_.resize(num_indices);
+    suspend_clocks_.resize(num_indices);
+    SetBulkValues(interpolator_.Ys(), front_ys_.data());
+    SetBulkChangedFrames(changed_frames_.data());
+  }
+
+  void ReserveIndices(MotiveIndex count) override {
+    data_.reserve(count);
+    interpolator_.Reserve(count);
+    previous_ys_.reserve(count);
+    changed_frames_.reserve(count);
+    suspend_clocks_.reserve(count);
+    if (double_buffered()) front_ys_.reserve(count);
+    SetBulkValues(interpolator_.Ys(), front_ys_.data());
+    SetBulkChangedFrames(changed_frames_.data());
+  }
+
+  void TrimIndices() override {
+    MotiveProcessorNf::TrimIndices();
+    data_.shrink_to_fit();
+    interpolator_.ShrinkToFit();
+    front_ys_.shrink_to_fit();
+    previous_ys_.shrink_to_fit();
+    changed_frames_.shrink_to_fit();
+    suspend_clocks_.shrink_to_fit();
+    SetBulkValues(interpolator_.Ys(), front_ys_.data());
+    SetBulkChangedFrames(changed_frames_.data());
+  }
+
+  void AddMemoryStats(MemoryStats* stats) const override {
+    MotiveProcessorNf::AddMemoryStats(stats);
+    stats->AddVector(data_);
+    stats->AddVector(front_ys_);
+    stats->AddVector(previous_ys_);
+    stats->AddVector(changed_frames_);
+    stats->AddVector(suspend_clocks_);
+    interpolator_.AddMemoryStats(stats);
+
+    // Local splines are owned by this processor, whether in use or pooled.
+    stats->AddVector(spline_pool_);
+    for (auto it = spline_pool_.begin(); it != spline_pool_.end(); ++it) {
+      (*it)->AddMemoryStats(stats);
+    }
+    for (auto it = data_.begin(); it != data_.end(); ++it) {
+      if (it->local_spline != nullptr) it->local_spline->AddMemoryStats(stats);
+    }
+  }
+
+  void ArchiveState(MotiveStateArchive* archive) override {
+    MotiveProcessorNf::ArchiveState(archive);
+
+    // Which local spline each index holds is structure, but the nodes in
+    // them are state, since SetTarget() refills them in place.
+    archive->Layout(data_);
+    if (!archive->ok()) return;
+    for (auto it = data_.begin(); it != data_.end(); ++it) {
+      CompactSpline* spline = it->local_spline;
+      if (spline != nullptr) archive->Bytes(spline, spline->Size());
+    }
+    interpolator_.ArchiveState(archive);
+    archive->Array(&previous_ys_);
+    archive->Value(&clock_);
+    archive->Array(&suspend_clocks_);
+    if (archive->restoring()) MarkChanged(0, NumIndices());
+  }
+
+  void CopyToFrontBuffer(MotiveIndex index,
+                         MotiveDimension dimensions) override {
+    front_ys_.resize(data_.size());
+    SetBulkValues(interpolator_.Ys(), front_ys_.data());
+    if (dimensions == 0) return;
+    const float* ys = interpolator_.Ys(index);
+    std::copy(ys, ys + dimensions, front_ys_.begin() + index);
+  }
+
+  MotiveIndex NumIndices() const {
+    return static_cast<MotiveIndex>(data_.size());
+  }
+
+  // Record `frame` as the changed frame of every index in [begin, end) whose
+  // value differs from its value on the previous frame. Catches changes made
+  // by the Set functions between frames too.
+  void UpdateChangedFrames(MotiveIndex begin, MotiveIndex end,
+                           uint32_t frame) {
+    const float* ys = interpolator_.Ys(0);
+    for (MotiveIndex i = begin; i < end; ++i) {
+      if (ys[i] == previous_ys_[i]) continue;
+      previous_ys_[i] = ys[i];
+      changed_frames_[i] = frame;
+    }
+  }
+
+  // Conservatively treat [index, index + dimensions) as changed on the
+  // current frame, regardless of their values.
+  void MarkChanged(MotiveIndex index, MotiveDimension dimensions) {
+    std::fill(changed_frames_.begin() + index,
+              changed_frames_.begin() + index + dimensions,
+              Engine()->frame_count());
   }
 
   const SplineData& Data(MotiveIndex index) const {
@@ -275,7 +477,7 @@ class SplineMotiveProcessor : public MotiveProcessorNf {
     }
 
     // Create a spline with enough nodes otherwise.
-    return CompactSpline::Create(max_nodes);
+    return CompactSpline::Create(max_nodes, Allocator());
   }
 
   void FreeSplineForIndex(MotiveIndex index) {
@@ -312,16 +514,27 @@ class SplineMotiveProcessor : public MotiveProcessorNf {
 
   // Hold index-specific data, for example a pointer to the spline allocated
   // from 'spline_pool_'.
-  std::vector<SplineData> data_;
+  MotiveVector<SplineData> data_;
 
   // Holds unused splines. When we need another local spline (because we're
   // supplied with target values but not the actual curve to get there),
   // try to recycle an old one from this pool first.
-  std::vector<CompactSpline*> spline_pool_;
-
-  // Perform the spline evaluation, over time. Indices in 'interpolator_'
-  // are the same as the MotiveIndex values in this class.
-  BulkSplineEvaluator interpolator_;
+  MotiveVector<CompactSpline*> spline_pool_;
+
+  // Scratch space for SetTargets() and SetTargetsAt(). Held here to avoid
+  // reallocating on every call.
+  MotiveVector<MotiveIndex> target_indices_;
+  MotiveVector<const CompactSpline*> target_splines_;
+
+  // The y-values in 'interpolator_' as of the last AdvanceFrame(), and the
+  // frame on which each last changed. See ChangedFrame().
+  MotiveVector<float> previous_ys_;
+  MotiveVector<uint32_t> changed_frames_;
+
+  // Total time passed to AdvanceFrame(), and its value when each suspended
+  // index was suspended. See ResumeIndices().
+  MotiveTime clock_;
+  MotiveVector<MotiveTime> suspend_clocks_;
 };
 
 MOTIVE_INSTANCE(SplineInit, SplineMotiveProcessor);
@@ -25,13 +25,25 @@ namespace motive {
 //                 configurable in MotiveCurveShape.
 static const float kNumSpringIterations = 4.0f;
 
+// A spring is at rest once it's within this fraction of the distance it set
+// out to travel, and moving slower than that over its typical total time.
+static const float kSpringSettledFraction = 1e-4f;
+
 struct SpringData {
-  SpringData() : elapsed_time(0.0f), target_time(0.0f) {}
+  SpringData()
+      : elapsed_time(0.0f),
+        target_time(0.0f),
+        settled_difference(0.0f),
+        settled_velocity(0.0f),
+        awake(false) {}
 
   SpringData(const SimpleInit& init, MotiveIndex current_dimension)
       : q(init.start_values[current_dimension]),
         elapsed_time(0.0f),
-        target_time(q.IterationX(kNumSpringIterations)) {}
+        target_time(q.IterationX(kNumSpringIterations)),
+        settled_difference(0.0f),
+        settled_velocity(0.0f),
+        awake(false) {}
 
   // Currently active curve.
   QuadraticSpring q;
@@ -45,6 +57,16 @@ struct SpringData {
 
   // Time after kNumSpringIterations.
   float target_time;
+
+  // The spring is at rest when it's at most this far from its target, and
+  // moving at most this fast.
+  float settled_difference;
+  float settled_velocity;
+
+  // True if this index is in the processor's list of active indices.
+  // Indices that are at rest on their target are put to sleep until their
+  // target changes.
+  bool awake;
 };
 
 }  // namespace motive
@@ -14,6 +14,8 @@
 
 #include "motive/spring_init.h"
 #include "motive/math/curve_util.h"
+#include "motive/processor/active_indices.h"
+#include "motive/processor/soa_batch.h"
 #include "motive/processor/spring_data.h"
 #include "motive/simple_processor_template.h"
 
@@ -41,24 +43,98 @@ static inline MotiveTime SimpleTargetTime(const SpringData& d) {
   return static_cast<MotiveTime>(d.target_time - d.elapsed_time);
 }
 
+// Evaluates a batch of springs at once. Each spring's Context must already be
+// valid for its elapsed time, so the evaluation is the same closed-form
+// quadratic for every spring. The arithmetic matches
+// QuadraticSpring::EvaluateWithContext() and
+// QuadraticSpring::DerivativeWithContext() exactly.
+class SpringBatch : public SoaBatch<MotiveIndex> {
+ public:
+  // Queue `index` to be evaluated by Flush().
+  void Add(MotiveIndex index, const SpringData& d) {
+    const int j = AddKey(index);
+    x_[j] = d.q.QuadraticX(d.elapsed_time, d.c);
+    coeff_[j] = d.c.coeff;
+    peak_[j] = d.c.peak;
+    target_[j] = d.q.target();
+    settled_difference_[j] = d.settled_difference;
+    settled_velocity_[j] = d.settled_velocity;
+  }
+
+  // Write the value of every queued spring to `values`, and set `at_rest`
+  // for each spring that's close enough to its target, and slow enough, to
+  // stop. Springs at rest are snapped to their target. `at_rest` is parallel
+  // to the order in which springs were added.
+  void Flush(float* values, bool* at_rest) {
+    const int count = size();
+    for (int j = 0; j < count; ++j) {
+      const float value = target_[j] + peak_[j] + coeff_[j] * x_[j] * x_[j];
+      const float velocity = 2.0f * coeff_[j] * x_[j];
+      const bool rest = fabs(value - target_[j]) <= settled_difference_[j] &&
+                        fabs(velocity) <= settled_velocity_[j];
+      value_[j] = rest ? target_[j] : value;
+      at_rest[j] = rest;
+    }
+    for (int j = 0; j < count; ++j) {
+      values[key(j)] = value_[j];
+    }
+    Clear();
+  }
+
+ private:
+  float x_[kSize];
+  float coeff_[kSize];
+  float peak_[kSize];
+  float target_[kSize];
+  float settled_difference_[kSize];
+  float settled_velocity_[kSize];
+  float value_[kSize];
+};
+
 class SpringMotiveProcessor : public SimpleProcessorTemplate<SpringData> {
  public:
+  SpringMotiveProcessor() {}
   virtual ~SpringMotiveProcessor() {}
 
   virtual void AdvanceFrame(MotiveTime delta_time) {
     Defragment();
-
-    // Loop through every motivator, one at a time.
-    // At some point we can write an assembly language function to process
-    // these in parallel.
-    for (size_t i = 0; i < data_.size(); ++i) {
-      SpringData& d = data_[i];
-
-      // Advance the time and then update the current value.
-      d.elapsed_time += static_cast<float>(delta_time);
-      d.q.IncrementContext(d.elapsed_time, &d.c);
-      values_[i] = d.q.EvaluateWithContext(d.elapsed_time, d.c);
+    active_indices_.Gather(data_);
+
+    // Evaluate the awake motivators in batches.
+    // Motivators that are at rest on their target are dropped from the list,
+    // in place, and stay asleep until SetTargetWithShape() wakes them.
+    MotiveVector<MotiveIndex>& active = active_indices_.indices();
+    const size_t num_indices = active.size();
+    size_t num_active = 0;
+    SpringBatch batch;
+    bool at_rest[SpringBatch::kSize];
+    for (size_t k = 0; k < num_indices; k += SpringBatch::kSize) {
+      const size_t end = std::min(k + SpringBatch::kSize, num_indices);
+
+      // Advance the time and the Context. The spring is evaluated in closed
+      // form, so a step that crosses several oscillations jumps straight to
+      // the right portion of the curve instead of walking through them.
+      for (size_t b = k; b < end; ++b) {
+        const MotiveIndex i = active[b];
+        SpringData& d = data_[i];
+        d.elapsed_time += static_cast<float>(delta_time);
+        d.q.IncrementContext(d.elapsed_time, &d.c);
+        batch.Add(i, d);
+      }
+      batch.Flush(values_.data(), at_rest);
+
+      // A spring at rest has snapped to its target, so further frames can't
+      // change anything.
+      for (size_t b = k; b < end; ++b) {
+        const MotiveIndex i = active[b];
+        if (at_rest[b - k]) {
+          data_[i].awake = false;
+        } else {
+          active[num_active++] = i;
+        }
+      }
     }
+    active.resize(num_active);
   }
 
   virtual MotivatorType Type() const { return SpringInit::kType; }
@@ -78,6 +154,34 @@ class SpringMotiveProcessor : public SimpleProcessorTemplate<SpringData> {
                             shape.typical_total_time, shape.bias);
       d.c = d.q.CalculateContext(0.0f);
       d.elapsed_time = 0.0f;
+
+      // Settle relative to the size of the motion, whatever its units.
+      const float distance =
+          std::max(fabs(target_values[i] - Value(processor_index)),
+                   fabs(shape.typical_delta_value));
+      d.settled_difference = kSpringSettledFraction * distance;
+      d.settled_velocity = shape.typical_total_time > 0.0f
+                               ? d.settled_difference / shape.typical_total_time
+                               : 0.0f;
+      active_indices_.Wake(processor_index, &d);
+    }
+  }
+
+  // The time since the spring was last given a target.
+  MotiveTime SplineTime(MotiveIndex index) const override {
+    return static_cast<MotiveTime>(Data(index).elapsed_time);
+  }
+
+  // Seek to `time` since the spring was last given a target. The spring has
+  // a closed form, so this costs the same as one frame, however far we seek.
+  void SetSplineTime(MotiveIndex index, MotiveDimension dimensions,
+                     MotiveTime time) override {
+    for (MotiveIndex i = index; i < index + dimensions; ++i) {
+      SpringData& d = Data(i);
+      d.elapsed_time = static_cast<float>(time);
+      d.c = d.q.CalculateContext(d.elapsed_time);
+      values_[i] = d.q.EvaluateWithContext(d.elapsed_time, d.c);
+      active_indices_.Wake(i, &d);
     }
   }
 
@@ -85,6 +189,63 @@ class SpringMotiveProcessor : public SimpleProcessorTemplate<SpringData> {
     // TODO(jsanmiya): We'll be removing MotiveShape in the next change.
     return MotiveCurveShape();
   }
+
+ protected:
+  virtual void InitializeIndices(const MotivatorInit& init, MotiveIndex index,
+                                 MotiveDimension dimensions,
+                                 MotiveEngine* engine) {
+    SimpleProcessorTemplate<SpringData>::InitializeIndices(init, index,
+                                                           dimensions, engine);
+    for (MotiveIndex i = index; i < index + dimensions; ++i) {
+      active_indices_.Wake(i, &data_[i]);
+    }
+  }
+
+  virtual void RemoveIndices(MotiveIndex index, MotiveDimension dimensions) {
+    SimpleProcessorTemplate<SpringData>::RemoveIndices(index, dimensions);
+    active_indices_.Invalidate();
+  }
+
+  virtual void MoveIndices(MotiveIndex old_index, MotiveIndex new_index,
+                           MotiveDimension dimensions) {
+    SimpleProcessorTemplate<SpringData>::MoveIndices(old_index, new_index,
+                                                     dimensions);
+    active_indices_.Invalidate();
+  }
+
+  virtual void UseAllocator(MotiveAllocator* allocator) {
+    active_indices_.SetAllocator(allocator);
+  }
+
+  virtual void SetNumIndices(MotiveIndex num_indices) {
+    SimpleProcessorTemplate<SpringData>::SetNumIndices(num_indices);
+    active_indices_.Invalidate();
+  }
+
+  virtual void ReserveIndices(MotiveIndex count) {
+    SimpleProcessorTemplate<SpringData>::ReserveIndices(count);
+    active_indices_.Reserve(count);
+  }
+
+  virtual void TrimIndices() {
+    SimpleProcessorTemplate<SpringData>::TrimIndices();
+    active_indices_.ShrinkToFit();
+  }
+
+  virtual void AddMemoryStats(MemoryStats* stats) const {
+    SimpleProcessorTemplate<SpringData>::AddMemoryStats(stats);
+    active_indices_.AddMemoryStats(stats);
+  }
+
+  virtual void ArchiveState(MotiveStateArchive* archive) {
+    SimpleProcessorTemplate<SpringData>::ArchiveState(archive);
+    if (archive->restoring()) active_indices_.Invalidate();
+  }
+
+ private:
+  // Indices that are not yet at rest. Only these indices are processed in
+  // AdvanceFrame().
+  ActiveIndices active_indices_;
 };
 
 MOTIVE_INSTANCE(SpringInit, SpringMotiveProcessor);
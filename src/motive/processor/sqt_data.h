@@ -15,9 +15,14 @@
 #ifndef MOTIVE_SQT_DATA_H_
 #define MOTIVE_SQT_DATA_H_
 
+#include <algorithm>
+#include <vector>
+
 #include "mathfu/constants.h"
 #include "motive/engine.h"
 #include "motive/matrix_op.h"
+#include "motive/processor/matrix_blend_plan.h"
+#include "motive/processor/playback_watch.h"
 #include "motive/sqt_init.h"
 
 namespace motive {
@@ -27,10 +32,24 @@ namespace motive {
 class SqtData {
  public:
   SqtData()
-      : result_matrix_(mathfu::mat4::Identity()),
+      : result_transform_(mathfu::AffineTransform::Identity()),
         rotation_(mathfu::quat::identity),
         scale_(mathfu::kOnes3f),
-        ops_(0) {}
+        folded_translation_(DefaultOpsTranslation()),
+        folded_rotation_(DefaultOpsQuaternion()),
+        folded_scale_(DefaultOpsScale()),
+        stale_frame_(0),
+        changed_frame_(0) {}
+
+  // Hold the ops, live ops, and dependencies in `allocator`. Call while there
+  // are no ops.
+  void SetAllocator(MotiveAllocator* allocator) {
+    ops_ = MotiveVector<MatrixOperation>(
+        MotiveStdAllocator<MatrixOperation>(allocator));
+    live_ops_ = MotiveVector<size_t>(MotiveStdAllocator<size_t>(allocator));
+    dependencies_ = MotiveVector<const MotiveProcessor*>(
+        MotiveStdAllocator<const MotiveProcessor*>(allocator));
+  }
 
   void Initialize(const SqtInit& init, MotiveEngine* engine) {
     const std::vector<MatrixOperationInit>& ops = init.ops();
@@ -41,154 +60,212 @@ class SqtData {
       assert(!RotateOp(ops[i].type));
       ops_.emplace_back(ops[i], engine);
     }
+    FoldConstantOps();
 
     // Initialize the result matrix to the default value. This ensures that
     // RigMotivators can initialize their transforms to the default pose of the
     // defining animation.
     UpdateResultMatrix();
+    changed_frame_ = engine->frame_count();
   }
 
   void Reset() {
     rotation_ = DefaultOpsQuaternion();
     scale_ = DefaultOpsScale();
-    result_matrix_ = mathfu::mat4::Transform(DefaultOpsTranslation(),
-                                             rotation_.ToMatrix(), scale_);
+    result_transform_ =
+        AffineFromSqt(DefaultOpsTranslation(), rotation_.ToMatrix(), scale_);
     ops_.resize(0);
+    FoldConstantOps();
+    changed_frame_ = 0;
+    update_divisor_ = MotiveUpdateDivisor();
+    playback_watch_ = PlaybackWatch();
   }
 
-  void UpdateResultMatrix() {
-    // Ensure the transforms are default to start since the primary reason for
-    // missing ops is when they are constant default values.
-    mathfu::vec3 translation = DefaultOpsTranslation();
-    rotation_ = DefaultOpsQuaternion();
-    scale_ = DefaultOpsScale();
-
+  // Tell `engine` that `processor` reads the processor of every child
+  // motivator. Any earlier registrations must already be unregistered.
+  void RegisterDependencies(MotiveProcessor* processor, MotiveEngine* engine) {
+    dependencies_.clear();
     for (size_t i = 0; i < ops_.size(); ++i) {
-      const MatrixOperation& op = ops_[i];
-      const float value = op.Value();
+      const Motivator1f* child = ops_[i].ValueMotivator();
+      if (child == nullptr) continue;
+      dependencies_.push_back(engine->RegisterDependency(processor, *child));
+    }
+  }
 
-      switch (op.Type()) {
-        case kTranslateX:
-          translation.x = value;
-          break;
+  void UnregisterDependencies(MotiveProcessor* processor,
+                              MotiveEngine* engine) {
+    for (size_t i = 0; i < dependencies_.size(); ++i) {
+      engine->UnregisterDependency(processor, dependencies_[i]);
+    }
+    dependencies_.clear();
+  }
 
-        case kTranslateY:
-          translation.y = value;
-          break;
+  // Return true if any child motivator is driven by `processor`.
+  bool DependsOn(const MotiveProcessor* processor) const {
+    return std::find(dependencies_.begin(), dependencies_.end(), processor) !=
+           dependencies_.end();
+  }
 
-        case kTranslateZ:
-          translation.z = value;
-          break;
+  // Precompute the constant ops into `folded_translation_`,
+  // `folded_rotation_`, and `folded_scale_`, so that only the remaining ops are
+  // evaluated every frame. Must be called whenever an op starts or stops being
+  // driven by a motivator, or a constant op's value changes.
+  // Each op overwrites components of the transform, so a constant op can be
+  // folded unless an earlier animated op writes the same component. Otherwise
+  // the constant would be applied before the animated op instead of after it.
+  void FoldConstantOps() {
+    folded_translation_ = DefaultOpsTranslation();
+    folded_rotation_ = DefaultOpsQuaternion();
+    folded_scale_ = DefaultOpsScale();
+    live_ops_.clear();
+
+    uint32_t live_components = 0;
+    for (size_t i = 0; i < ops_.size(); ++i) {
+      const MatrixOperation& op = ops_[i];
+      const uint32_t components = ComponentsOfOp(op.Type());
+      if (op.ValueMotivator() == nullptr &&
+          (components & live_components) == 0) {
+        ApplyOp(op.Type(), op.Value(), &folded_translation_, &folded_rotation_,
+                &folded_scale_);
+      } else {
+        live_ops_.push_back(i);
+        live_components |= components;
+      }
+    }
+    stale_frame_ = 0;
+  }
 
-        case kScaleX:
-          scale_.x = value;
-          break;
+  // Return true if the result matrix may be out of date. That is, if any
+  // child motivator has changed since the last call to MarkUpdated(), or the
+  // ops themselves have changed.
+  bool NeedsUpdate() const {
+    if (stale_frame_ == 0) return true;
+    for (size_t i = 0; i < live_ops_.size(); ++i) {
+      const Motivator1f* child = ops_[live_ops_[i]].ValueMotivator();
+      if (child != nullptr && child->ChangedFrame() >= stale_frame_) {
+        return true;
+      }
+    }
+    return false;
+  }
 
-        case kScaleY:
-          scale_.y = value;
-          break;
+  // Record that the result matrix was recalculated on `frame`, after every
+  // child motivator was advanced.
+  void MarkUpdated(uint32_t frame) {
+    CountEvent(kCounterMatricesRecomputed);
+    stale_frame_ = frame + 1;
+    changed_frame_ = frame;
+  }
 
-        case kScaleZ:
-          scale_.z = value;
-          break;
+  // The most recent frame on which the result matrix was recalculated.
+  uint32_t changed_frame() const { return changed_frame_; }
 
-        case kScaleUniformly:
-          scale_.x = value;
-          scale_.y = value;
-          scale_.z = value;
-          break;
+  void UpdateResultMatrix() {
+    mathfu::vec3 translation;
+    GatherComponents(&translation, &rotation_, &scale_);
 
-        case kQuaternionW:
-          rotation_.set_scalar(value);
-          break;
+    // Quaternion values may be interpolated and result in a non-unit
+    // quaternion, meaning they must be normalized.
+    rotation_.Normalize();
+    result_transform_ =
+        AffineFromSqt(translation, rotation_.ToMatrix(), scale_);
+  }
 
-        case kQuaternionX: {
-          mathfu::vec3 v = rotation_.vector();
-          v.x = value;
-          rotation_.set_vector(v);
-          break;
-        }
+  // Evaluate the ops into the components of the transform. `rotation` is not
+  // normalized. Used to calculate many transforms at once, which should then
+  // be passed to SetResult().
+  void GatherComponents(mathfu::vec3* translation, mathfu::quat* rotation,
+                        mathfu::vec3* scale) const {
+    // Start from the constant ops. When there are none, these are the default
+    // transforms, since the primary reason for missing ops is when they are
+    // constant default values.
+    *translation = folded_translation_;
+    *rotation = folded_rotation_;
+    *scale = folded_scale_;
+
+    for (size_t i = 0; i < live_ops_.size(); ++i) {
+      const MatrixOperation& op = ops_[live_ops_[i]];
+      ApplyOp(op.Type(), op.Value(), translation, rotation, scale);
+    }
+  }
 
-        case kQuaternionY: {
-          mathfu::vec3 v = rotation_.vector();
-          v.y = value;
-          rotation_.set_vector(v);
-          break;
-        }
+  // Set the result from components calculated outside of
+  // UpdateResultMatrix(). `rotation` must be normalized, and `transform` must
+  // be built from the same components.
+  void SetResult(const mathfu::quat& rotation, const mathfu::vec3& scale,
+                 const mathfu::AffineTransform& transform) {
+    rotation_ = rotation;
+    scale_ = scale;
+    result_transform_ = transform;
+  }
 
-        case kQuaternionZ: {
-          mathfu::vec3 v = rotation_.vector();
-          v.z = value;
-          rotation_.set_vector(v);
-          break;
-        }
+  // True if `plan` was made by PlanBlendToOps() for ops with the same IDs as
+  // ours, so BlendToOps() can follow it.
+  bool MatchesPlan(const MatrixBlendPlan& plan) const {
+    if (plan.old_ids.size() != ops_.size()) return false;
+    for (size_t i = 0; i < ops_.size(); ++i) {
+      if (ops_[i].Id() != plan.old_ids[i]) return false;
+    }
+    return true;
+  }
 
-        default:
-          // All other operations, including RotateAbout, are not supported.
-          assert(false);
-      }
+  // Work out how BlendToOps() merges our ops with `new_ops`.
+  void PlanBlendToOps(const std::vector<MatrixOperationInit>& new_ops,
+                      MatrixBlendPlan* plan) const {
+    plan->old_ids.resize(ops_.size());
+    for (size_t i = 0; i < ops_.size(); ++i) {
+      plan->old_ids[i] = ops_[i].Id();
     }
 
-    // Quaternion values may be interpolated and result in a non-unit
-    // quaternion, meaning they must be normalized.
-    rotation_.Normalize();
-    result_matrix_ =
-        mathfu::mat4::Transform(translation, rotation_.ToMatrix(), scale_);
+    // Rotation ops must use the MatrixMotiveProcessor.
+    for (size_t i = 0; i < new_ops.size(); ++i) {
+      assert(!RotateOp(new_ops[i].type));
+    }
+    plan->Build(new_ops);
   }
 
-  void BlendToOps(const std::vector<MatrixOperationInit>& new_ops,
+  // Blend to `new_ops` by following `plan`, which must match our ops.
+  void BlendToOps(const MatrixBlendPlan& plan,
+                  const std::vector<MatrixOperationInit>& new_ops,
                   const motive::SplinePlayback& playback,
                   MotiveEngine* engine) {
+    assert(MatchesPlan(plan));
+
     // Since q and -q represent the same orientation, the current quaternion
     // values may need to be negated to ensure the blend doesn't wildly change
     // individual component values.
     AlignQuaternionOps(new_ops);
 
-    // Ops are always stored in order of ascending IDs. Scan through the old
-    // and new ops trying to match IDs.
-    int old_idx = 0;
-    int new_idx = 0;
-    const int num_new_ops = static_cast<int>(new_ops.size());
+    const MotiveTime blend_time = static_cast<MotiveTime>(playback.blend_x);
+    size_t old_idx = 0;
+    size_t new_idx = 0;
+    for (auto it = plan.steps.begin(); it != plan.steps.end(); ++it) {
+      switch (*it) {
+        case MatrixBlendPlan::kBlend:
+          ops_[old_idx++].BlendToOp(new_ops[new_idx++], playback, engine);
+          break;
 
-    while (old_idx < ops_.size() && new_idx < num_new_ops) {
-      MatrixOperation& old_op = ops_[old_idx];
-      const MatrixOperationInit& new_op = new_ops[new_idx];
+        case MatrixBlendPlan::kBlendToDefault:
+          ops_[old_idx++].BlendToDefault(blend_time);
+          break;
 
-      // Rotation ops must use the MatrixMotiveProcessor.
-      assert(!RotateOp(new_op.type));
-
-      // Ops are blendable if they have identical IDs. If not, handle whichever
-      // has the lower ID since it cannot possibly have a Blendable op in the
-      // other list.
-      if (old_op.Blendable(new_op)) {
-        old_op.BlendToOp(new_op, playback, engine);
-        ++old_idx;
-        ++new_idx;
-      } else if (old_op.Id() < new_op.id) {
-        // Old ops blend to default.
-        old_op.BlendToDefault(static_cast<MotiveTime>(playback.blend_x));
-        ++old_idx;
-      } else {
-        // New ops are inserted in order. `old_idx` points to the old op with
-        // the next highest ID compared to `new_op`, meaning it also provides
-        // the correct insertion point.
-        ops_.emplace(ops_.begin() + old_idx, new_op, playback, engine);
-        ++new_idx;
-        // Advance `old_idx` so it still points to the same `old_op` now that
-        // one has been inserted before it.
-        ++old_idx;
+        case MatrixBlendPlan::kInsert:
+          // Ops stay in order of ascending IDs. Advance `old_idx` so it still
+          // points to the same old op now that one has been inserted before
+          // it.
+          ops_.emplace(ops_.begin() + old_idx, new_ops[new_idx++], playback,
+                       engine);
+          ++old_idx;
+          break;
       }
     }
 
-    // Fill out remaining old ops by blending them to default.
-    int num_ops = ops_.size();
-    while (old_idx < num_ops) {
-      ops_[old_idx++].BlendToDefault(static_cast<MotiveTime>(playback.blend_x));
-    }
+    // Constant ops may now be driven by motivators or vice versa.
+    FoldConstantOps();
 
-    // Fill out remaining new ops by inserting them.
-    while (new_idx < num_new_ops) {
-      ops_.emplace_back(new_ops[new_idx++], playback, engine);
+    // Newly inserted ops should be evaluated on the same frames as the others.
+    if (!update_divisor_.EveryFrame()) {
+      SetUpdateDivisor(update_divisor_);
     }
   }
 
@@ -204,6 +281,19 @@ class SqtData {
     }
   }
 
+  // Evaluate the result matrix, and the child motivators, only on the frames
+  // where `divisor` is due.
+  void SetUpdateDivisor(const MotiveUpdateDivisor& divisor) {
+    update_divisor_ = divisor;
+    for (int i = 0, num_ops = ops_.size(); i < num_ops; ++i) {
+      ops_[i].SetUpdateDivisor(divisor);
+    }
+  }
+
+  const MotiveUpdateDivisor& update_divisor() const { return update_divisor_; }
+
+  PlaybackWatch& playback_watch() { return playback_watch_; }
+
   MotiveTime TimeRemaining() const {
     MotiveTime time = 0;
     for (int i = 0, num_ops = ops_.size(); i < num_ops; ++i) {
@@ -223,17 +313,166 @@ class SqtData {
     return ops_[child_index];
   }
 
-  const mathfu::mat4& result_matrix() const { return result_matrix_; }
+  const mathfu::AffineTransform& result_transform() const {
+    return result_transform_;
+  }
 
   mathfu::vec3 result_translation() const {
-    return result_matrix_.TranslationVector3D();
+    // Column `r` of an AffineTransform is row `r` of the 3x4 matrix.
+    return mathfu::vec3(result_transform_(3, 0), result_transform_(3, 1),
+                        result_transform_(3, 2));
   }
   mathfu::quat result_rotation() const { return rotation_; }
   mathfu::vec3 result_scale() const { return scale_; }
 
+  // Save, verify or restore the result transform and the constant ops. See
+  // MatrixData::ArchiveState().
+  void ArchiveState(MotiveStateArchive* archive, uint32_t frame) {
+    archive->LayoutValue(ops_.size());
+    archive->Layout(live_ops_);
+    archive->LayoutValue(update_divisor_);
+    if (!archive->ok()) return;
+    for (auto it = ops_.begin(); it != ops_.end(); ++it) {
+      it->ArchiveState(archive);
+    }
+    archive->Value(&result_transform_);
+    archive->Value(&rotation_);
+    archive->Value(&scale_);
+    archive->Value(&folded_translation_);
+    archive->Value(&folded_rotation_);
+    archive->Value(&folded_scale_);
+    archive->Value(&stale_frame_);
+    archive->Value(&playback_watch_);
+    if (archive->restoring()) changed_frame_ = frame;
+  }
+
   int num_ops() const { return ops_.size(); }
 
  private:
+  // Equivalent to mathfu::mat4::Transform(), without the bottom row.
+  static mathfu::AffineTransform AffineFromSqt(const mathfu::vec3& translation,
+                                               const mathfu::mat3& rotation,
+                                               const mathfu::vec3& scale) {
+    return mathfu::AffineTransform(
+        mathfu::vec4(rotation(0, 0) * scale.x, rotation(0, 1) * scale.y,
+                     rotation(0, 2) * scale.z, translation.x),
+        mathfu::vec4(rotation(1, 0) * scale.x, rotation(1, 1) * scale.y,
+                     rotation(1, 2) * scale.z, translation.y),
+        mathfu::vec4(rotation(2, 0) * scale.x, rotation(2, 1) * scale.y,
+                     rotation(2, 2) * scale.z, translation.z));
+  }
+
+  // Components of the transform, as bits returned by ComponentsOfOp().
+  enum Component {
+    kTranslationXBit = 1 << 0,
+    kTranslationYBit = 1 << 1,
+    kTranslationZBit = 1 << 2,
+    kRotationWBit = 1 << 3,
+    kRotationXBit = 1 << 4,
+    kRotationYBit = 1 << 5,
+    kRotationZBit = 1 << 6,
+    kScaleXBit = 1 << 7,
+    kScaleYBit = 1 << 8,
+    kScaleZBit = 1 << 9,
+  };
+
+  // Return the components of the transform that are written by `type`.
+  static uint32_t ComponentsOfOp(MatrixOperationType type) {
+    switch (type) {
+      case kTranslateX:
+        return kTranslationXBit;
+      case kTranslateY:
+        return kTranslationYBit;
+      case kTranslateZ:
+        return kTranslationZBit;
+      case kScaleX:
+        return kScaleXBit;
+      case kScaleY:
+        return kScaleYBit;
+      case kScaleZ:
+        return kScaleZBit;
+      case kScaleUniformly:
+        return kScaleXBit | kScaleYBit | kScaleZBit;
+      case kQuaternionW:
+        return kRotationWBit;
+      case kQuaternionX:
+        return kRotationXBit;
+      case kQuaternionY:
+        return kRotationYBit;
+      case kQuaternionZ:
+        return kRotationZBit;
+      default:
+        return 0;
+    }
+  }
+
+  // Overwrite the components of the transform written by an op of `type`
+  // with `value`.
+  static void ApplyOp(MatrixOperationType type, float value,
+                      mathfu::vec3* translation, mathfu::quat* rotation,
+                      mathfu::vec3* scale) {
+    switch (type) {
+      case kTranslateX:
+        translation->x = value;
+        break;
+
+      case kTranslateY:
+        translation->y = value;
+        break;
+
+      case kTranslateZ:
+        translation->z = value;
+        break;
+
+      case kScaleX:
+        scale->x = value;
+        break;
+
+      case kScaleY:
+        scale->y = value;
+        break;
+
+      case kScaleZ:
+        scale->z = value;
+        break;
+
+      case kScaleUniformly:
+        scale->x = value;
+        scale->y = value;
+        scale->z = value;
+        break;
+
+      case kQuaternionW:
+        rotation->set_scalar(value);
+        break;
+
+      case kQuaternionX: {
+        mathfu::vec3 v = rotation->vector();
+        v.x = value;
+        rotation->set_vector(v);
+        break;
+      }
+
+      case kQuaternionY: {
+        mathfu::vec3 v = rotation->vector();
+        v.y = value;
+        rotation->set_vector(v);
+        break;
+      }
+
+      case kQuaternionZ: {
+        mathfu::vec3 v = rotation->vector();
+        v.z = value;
+        rotation->set_vector(v);
+        break;
+      }
+
+      default:
+        // All other operations, including RotateAbout, are not supported.
+        assert(false);
+    }
+  }
+
   // Ensures that the current quaternion values are close to the initial values
   // in `ops`. This function should be called prior to blending to `ops` to
   // ensure quaternion blends work.
@@ -280,17 +519,42 @@ class SqtData {
   }
 
   /// Result of the most recent matrix update.
-  mathfu::mat4 result_matrix_;
+  mathfu::AffineTransform result_transform_;
 
   // The pre-extracted rotation and scale components to make result_rotation()
   // and result_scale() faster. The translation component is fetched directly
-  // from result_matrix_ and doesn't need to be stored separately.
+  // from result_transform_ and doesn't need to be stored separately.
   mathfu::quat rotation_;
   mathfu::vec3 scale_;
 
   /// Operations representing the individual components of the translation,
   /// quaternion rotation, and scale.
-  std::vector<MatrixOperation> ops_;
+  MotiveVector<MatrixOperation> ops_;
+
+  /// The transform components set by the constant ops that are folded by
+  /// FoldConstantOps().
+  mathfu::vec3 folded_translation_;
+  mathfu::quat folded_rotation_;
+  mathfu::vec3 folded_scale_;
+
+  /// Indices into `ops_` of the ops that are evaluated every frame, in order.
+  MotiveVector<size_t> live_ops_;
+
+  /// Child motivators that changed on or after this frame are not reflected in
+  /// the result matrix. 0 if the result matrix must be recalculated.
+  uint32_t stale_frame_;
+
+  /// The most recent frame on which the result matrix was recalculated.
+  uint32_t changed_frame_;
+
+  /// Processors of the child motivators, as registered with the engine.
+  MotiveVector<const MotiveProcessor*> dependencies_;
+
+  /// The frames on which the result matrix is evaluated.
+  MotiveUpdateDivisor update_divisor_;
+
+  /// Reports the end of the animation started by BlendToOps().
+  PlaybackWatch playback_watch_;
 };
 
 }  // namespace motive
@@ -17,11 +17,73 @@
 #include "motive/engine.h"
 #include "motive/math/angle.h"
 #include "motive/math/bulk_spline_evaluator.h"
+#include "motive/math/transform_kernels.h"
+#include "motive/processor/soa_batch.h"
 #include "motive/processor/sqt_data.h"
 #include "motive/sqt_init.h"
 
 namespace motive {
 
+// Normalizes the quaternions of a batch of SqtData, and converts them and their
+// translations and scales into affine transforms, with the engine's SIMD
+// SqtsToAffines() where it has one.
+// The arithmetic is the same as quat::Normalize() and quat::ToMatrix(), so the
+// results match SqtData::UpdateResultMatrix() to within rounding.
+class SqtBatch : public SoaBatch<SqtData*> {
+ public:
+  explicit SqtBatch(const TransformKernels* kernels) : kernels_(kernels) {}
+
+  // Queue `data` to be updated by Flush().
+  void Add(SqtData* data, uint32_t frame) {
+    const int j = AddKey(data);
+    mathfu::vec3 translation;
+    mathfu::quat rotation;
+    mathfu::vec3 scale;
+    data->GatherComponents(&translation, &rotation, &scale);
+    const mathfu::vec3 v = rotation.vector();
+    sqts_[kSqtTranslationX][j] = translation.x;
+    sqts_[kSqtTranslationY][j] = translation.y;
+    sqts_[kSqtTranslationZ][j] = translation.z;
+    sqts_[kSqtRotationW][j] = rotation.scalar();
+    sqts_[kSqtRotationX][j] = v.x;
+    sqts_[kSqtRotationY][j] = v.y;
+    sqts_[kSqtRotationZ][j] = v.z;
+    sqts_[kSqtScaleX][j] = scale.x;
+    sqts_[kSqtScaleY][j] = scale.y;
+    sqts_[kSqtScaleZ][j] = scale.z;
+    if (full()) {
+      Flush(frame);
+    }
+  }
+
+  // Calculate every queued transform and write it to its SqtData.
+  void Flush(uint32_t frame) {
+    const int count = size();
+    if (count == 0) return;
+    SqtsToAffines(kernels_, sqts_[0], count, kSize, m_[0]);
+
+    for (int j = 0; j < count; ++j) {
+      const mathfu::AffineTransform transform(
+          mathfu::vec4(m_[0][j], m_[1][j], m_[2][j], m_[3][j]),
+          mathfu::vec4(m_[4][j], m_[5][j], m_[6][j], m_[7][j]),
+          mathfu::vec4(m_[8][j], m_[9][j], m_[10][j], m_[11][j]));
+      key(j)->SetResult(
+          mathfu::quat(sqts_[kSqtRotationW][j], sqts_[kSqtRotationX][j],
+                       sqts_[kSqtRotationY][j], sqts_[kSqtRotationZ][j]),
+          mathfu::vec3(sqts_[kSqtScaleX][j], sqts_[kSqtScaleY][j],
+                       sqts_[kSqtScaleZ][j]),
+          transform);
+      key(j)->MarkUpdated(frame);
+    }
+    Clear();
+  }
+
+ private:
+  const TransformKernels* kernels_;
+  float sqts_[kNumSqtElements][kSize];
+  float m_[kNumAffineElements][kSize];
+};
+
 // See comments on SqtInit for details on this class.
 class SqtMotiveProcessor : public MatrixProcessor4f {
  public:
@@ -35,23 +97,60 @@ class SqtMotiveProcessor : public MatrixProcessor4f {
     Defragment();
 
     // Process the translation, quaternion rotation, and scale animations into a
-    // matrix for each index.
-    const MotiveIndex num_indices = NumIndices();
-    for (MotiveIndex index = 0; index < num_indices; ++index) {
-      SqtData& d = Data(index);
-      d.UpdateResultMatrix();
-    }
+    // matrix for each index, several indices at a time.
+    // Each index is independent, so split them across tasks when the engine
+    // has a task scheduler.
+    const uint32_t frame = Engine()->frame_count();
+    Engine()->ParallelFor(
+        NumIndices(), kMinIndicesPerTask, [this, frame](int begin, int end) {
+          SqtBatch batch(Engine()->transform_kernels());
+          for (MotiveIndex index = begin; index < end; ++index) {
+            SqtData& d = Data(index);
+            if (!d.update_divisor().Due(frame) || !d.NeedsUpdate()) continue;
+            batch.Add(&d, frame);
+          }
+          batch.Flush(frame);
+        });
 
     // Update our global time. It shouldn't matter if this wraps
     // around, since we only calculate times relative to it.
     time_ += delta_time;
+
+    // Report the animations that have ended. Their end is estimated when they
+    // start, so their children are only checked once they're due.
+    for (MotiveIndex index = 0; index < NumIndices(); ++index) {
+      SqtData& d = Data(index);
+      if (d.playback_watch().Ended(time_, d)) {
+        PushEvent(index, kMotiveEventPlaybackEnded);
+      }
+    }
   }
 
   virtual MotivatorType Type() const { return SqtInit::kType; }
   virtual int Priority() const { return 2; }
 
-  virtual const mathfu::mat4& Value(MotiveIndex index) const {
-    return Data(index).result_matrix();
+  bool UpdateDependents(const MotiveProcessor* dependency) override {
+    // Only recalculate the matrices whose children are driven by `dependency`.
+    // The children may have changed after this frame's AdvanceFrame(), so
+    // NeedsUpdate() can't tell whether they're up to date.
+    bool updated = false;
+    const uint32_t frame = Engine()->frame_count();
+    const MotiveIndex num_indices = NumIndices();
+    for (MotiveIndex index = 0; index < num_indices; ++index) {
+      SqtData& d = data_[index];
+      if (d.DependsOn(dependency)) {
+        d.UpdateResultMatrix();
+        d.MarkUpdated(frame);
+        updated = true;
+      }
+    }
+    return updated;
+  }
+
+  const mathfu::AffineTransform& AffineValue(
+      MotiveIndex index) const override {
+    return ReadFrontBuffer() ? front_transforms_[index]
+                             : Data(index).result_transform();
   }
 
   virtual void Value(MotiveIndex index, mathfu::vec3* translation,
@@ -94,17 +193,31 @@ class SqtMotiveProcessor : public MatrixProcessor4f {
     for (MotiveChildIndex i = 0; i < count; ++i) {
       d.Op(child_index + i).SetValue1f(values[i]);
     }
+    d.FoldConstantOps();
   }
 
   virtual void BlendToOps(MotiveIndex index,
                           const std::vector<MatrixOperationInit>& ops,
                           const motive::SplinePlayback& playback) {
     assert(Engine());
-    Data(index).BlendToOps(ops, playback, Engine());
+    CountEvent(kCounterMatrixBlends);
+    SqtData& d = Data(index);
+    d.UnregisterDependencies(this, Engine());
+    d.BlendToOps(blend_plans_.Find(d, ops), ops, playback, Engine());
+    d.RegisterDependencies(this, Engine());
+    d.playback_watch().Start(time_, d.TimeRemaining(), playback.playback_rate);
   }
 
   virtual void SetPlaybackRate(MotiveIndex index, float playback_rate) {
-    Data(index).SetPlaybackRate(playback_rate);
+    SqtData& d = Data(index);
+    d.SetPlaybackRate(playback_rate);
+    d.playback_watch().SetPlaybackRate(time_, d.TimeRemaining(),
+                                       playback_rate);
+  }
+
+  virtual void SetUpdateDivisor(MotiveIndex index,
+                                const MotiveUpdateDivisor& divisor) {
+    Data(index).SetUpdateDivisor(divisor);
   }
 
   virtual void SetRepeating(MotiveIndex index, bool repeat) {
@@ -115,6 +228,10 @@ class SqtMotiveProcessor : public MatrixProcessor4f {
     return Data(index).TimeRemaining();
   }
 
+  uint32_t ChangedFrame(MotiveIndex index) const override {
+    return Data(index).changed_frame();
+  }
+
  protected:
   MotiveIndex NumIndices() const {
     return static_cast<MotiveIndex>(data_.size());
@@ -130,6 +247,7 @@ class SqtMotiveProcessor : public MatrixProcessor4f {
     auto init_params = static_cast<const SqtInit&>(init);
     for (MotiveIndex i = index; i < index + dimensions; ++i) {
       data_[i].Initialize(init_params, engine);
+      data_[i].RegisterDependencies(this, engine);
     }
   }
 
@@ -139,7 +257,10 @@ class SqtMotiveProcessor : public MatrixProcessor4f {
                     MotiveDimension dimensions,
                     MotiveEngine* /*engine*/) override {
     for (MotiveIndex i = 0; i < dimensions; ++i) {
-      Data(dest + i) = Data(src + i);
+      SqtData& d = Data(dest + i);
+      d.UnregisterDependencies(this, Engine());
+      d = Data(src + i);
+      d.RegisterDependencies(this, Engine());
     }
   }
 
@@ -148,6 +269,7 @@ class SqtMotiveProcessor : public MatrixProcessor4f {
     // function, so just reset the SqtData states to empty instead of erasing
     // them.
     for (MotiveIndex i = index; i < index + dimensions; ++i) {
+      data_[i].UnregisterDependencies(this, Engine());
       data_[i].Reset();
     }
   }
@@ -162,6 +284,22 @@ class SqtMotiveProcessor : public MatrixProcessor4f {
     }
   }
 
+  void AppendChildMotivatorsOf(
+      MotiveIndex index,
+      std::vector<const Motivator*>* children) const override {
+    const SqtData& d = Data(index);
+    for (int j = 0; j < d.num_ops(); ++j) {
+      const Motivator1f* child = d.Op(j).ValueMotivator();
+      if (child != nullptr) children->push_back(child);
+    }
+  }
+
+  virtual void UseAllocator(MotiveAllocator* allocator) {
+    data_ = MotiveVector<SqtData>(MotiveStdAllocator<SqtData>(allocator));
+    front_transforms_ = MotiveVector<mathfu::AffineTransform>(
+        MotiveStdAllocator<mathfu::AffineTransform>(allocator));
+  }
+
   virtual void SetNumIndices(MotiveIndex num_indices) {
     // Ensure old items are deleted.
     const MotiveIndex old_num_indices = NumIndices();
@@ -169,8 +307,45 @@ class SqtMotiveProcessor : public MatrixProcessor4f {
       RemoveIndices(num_indices, old_num_indices - num_indices);
     }
 
-    // Default-inserts new empty SqtDatas.
+    // Default-inserts new empty SqtDatas, whose ops are then held in our
+    // allocator.
     data_.resize(num_indices);
+    for (MotiveIndex i = old_num_indices; i < num_indices; ++i) {
+      data_[i].SetAllocator(Allocator());
+    }
+  }
+
+  virtual void ReserveIndices(MotiveIndex count) {
+    data_.reserve(count);
+    if (double_buffered()) front_transforms_.reserve(count);
+  }
+
+  virtual void TrimIndices() {
+    data_.shrink_to_fit();
+    front_transforms_.shrink_to_fit();
+  }
+
+  virtual void AddMemoryStats(MemoryStats* stats) const {
+    MatrixProcessor4f::AddMemoryStats(stats);
+    stats->AddVector(data_);
+    stats->AddVector(front_transforms_);
+  }
+
+  virtual void ArchiveState(MotiveStateArchive* archive) {
+    MatrixProcessor4f::ArchiveState(archive);
+    const uint32_t frame = Engine()->frame_count();
+    for (auto it = data_.begin(); it != data_.end() && archive->ok(); ++it) {
+      it->ArchiveState(archive, frame);
+    }
+    archive->Value(&time_);
+  }
+
+  virtual void CopyToFrontBuffer(MotiveIndex index,
+                                 MotiveDimension dimensions) {
+    front_transforms_.resize(data_.size());
+    for (MotiveIndex i = index; i < index + dimensions; ++i) {
+      front_transforms_[i] = data_[i].result_transform();
+    }
   }
 
   const SqtData& Data(MotiveIndex index) const {
@@ -183,8 +358,15 @@ class SqtMotiveProcessor : public MatrixProcessor4f {
     return data_[index];
   }
 
-  std::vector<SqtData> data_;
+  MotiveVector<SqtData> data_;
+
+  // Copy of each result transform that's read by AffineValue() when double
+  // buffered.
+  MotiveVector<mathfu::AffineTransform> front_transforms_;
   MotiveTime time_;
+
+  // Plans for merging ops in BlendToOps(), kept between blends.
+  MatrixBlendPlanCache blend_plans_;
 };
 
 MOTIVE_INSTANCE(SqtInit, SqtMotiveProcessor);
@@ -12,19 +12,28 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <string.h>
 #include <sstream>
+#include <type_traits>
 
 #include "motive/rig_anim.h"
 
 namespace motive {
 
+// Splines carved from the block reserved by RigAnim::Reserve() start on
+// this alignment.
+static const size_t kSplineAlignment =
+    std::alignment_of<CompactSpline>::value;
+
 void RigAnim::Init(const char* anim_name, BoneIndex num_bones,
                    bool record_names) {
   assert(num_bones <= kMaxNumBones);
   anims_.resize(num_bones);
   bone_parents_.resize(num_bones);
   if (record_names) {
-    bone_names_.resize(num_bones);
+    // Unnamed bones all point at the empty string at offset 0.
+    bone_name_chars_.assign(1, '\0');
+    bone_name_offsets_.assign(num_bones, 0);
     if (anim_name != nullptr) {
       anim_name_ = anim_name;
     }
@@ -36,12 +45,36 @@ MatrixAnim& RigAnim::InitMatrixAnim(BoneIndex idx, BoneIndex parent,
   assert(idx < static_cast<int>(anims_.size()));
   assert(parent < idx || parent == kInvalidBoneIdx);
   bone_parents_[idx] = static_cast<uint8_t>(parent);
-  if (bone_names_.size() > 0) {
-    bone_names_[idx] = bone_name;
+  if (bone_name_offsets_.size() > 0 && bone_name != nullptr &&
+      bone_name[0] != '\0') {
+    bone_name_offsets_[idx] = static_cast<uint32_t>(bone_name_chars_.size());
+    bone_name_chars_.insert(bone_name_chars_.end(), bone_name,
+                            bone_name + strlen(bone_name) + 1);
   }
   return anims_[idx];
 }
 
+void RigAnim::Reserve(int num_splines, size_t num_nodes, size_t name_chars) {
+  // Splines already carved from the block would move.
+  assert(spline_block_used_ == 0);
+  spline_block_.resize(
+      num_splines * (CompactSpline::Size(0) + kSplineAlignment) +
+      num_nodes * sizeof(detail::CompactSplineNode));
+  bone_name_chars_.reserve(bone_name_chars_.size() + name_chars);
+}
+
+void* RigAnim::AllocateSpline(CompactSplineIndex max_nodes) {
+  const uintptr_t base = reinterpret_cast<uintptr_t>(spline_block_.data());
+  const size_t offset =
+      ((base + spline_block_used_ + kSplineAlignment - 1) &
+       ~static_cast<uintptr_t>(kSplineAlignment - 1)) -
+      base;
+  const size_t size = CompactSpline::Size(max_nodes);
+  if (offset + size > spline_block_.size()) return nullptr;
+  spline_block_used_ = offset + size;
+  return &spline_block_[offset];
+}
+
 int RigAnim::NumOps() const {
   size_t num_ops = 0;
   for (BoneIndex i = 0; i < NumBones(); ++i) {
@@ -89,6 +122,21 @@ void RigAnim::GetSplinesAndConstants(BoneIndex bone,
   }
 }
 
+void RigAnim::AddMemoryStats(MemoryStats* stats) const {
+  stats->AddVector(anims_);
+  for (auto it = anims_.begin(); it != anims_.end(); ++it) {
+    it->AddMemoryStats(stats);
+  }
+  stats->AddVector(bone_parents_);
+  stats->AddVector(bone_name_chars_);
+  stats->AddVector(bone_name_offsets_);
+
+  // Splines in the block were counted by their MatrixAnims.
+  stats->slack_bytes += spline_block_.size() - spline_block_used_;
+  stats->live_bytes += anim_name_.size();
+  stats->slack_bytes += anim_name_.capacity() - anim_name_.size();
+}
+
 std::string RigAnim::CsvHeaderForDebugging(int line) const {
   std::ostringstream oss;
 
@@ -0,0 +1,215 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "motive/rig_anim_sampler.h"
+
+#include "motive/math/curve.h"
+#include "motive/util/trace.h"
+
+namespace motive {
+
+namespace {
+
+// The segments of the spline ops being sampled, in struct-of-arrays format
+// so that their cubics can be solved together, as in
+// BulkSplineEvaluator::InitCubics().
+struct SegmentBatch {
+  static const size_t kSize = 64;
+
+  SegmentBatch() : count(0) {}
+
+  void Add(int op, const CubicInit& init, float x) {
+    ops[count] = op;
+    start_y[count] = init.start_y;
+    start_derivative[count] = init.start_derivative;
+    end_y[count] = init.end_y;
+    end_derivative[count] = init.end_derivative;
+    width_x[count] = init.width_x;
+    cubic_x[count] = x;
+    ++count;
+  }
+
+  // Solve every cubic, and write its value at `cubic_x` to `values`.
+  void Evaluate(float* values) {
+    float* const coefficients[] = {c[0], c[1], c[2], c[3]};
+    InitCubicCoefficients(start_y, start_derivative, end_y, end_derivative,
+                          width_x, count, coefficients);
+    for (size_t i = 0; i < count; ++i) {
+      const CubicCurve cubic(c[3][i], c[2][i], c[1][i], c[0][i]);
+      values[ops[i]] = cubic.Evaluate(cubic_x[i]);
+    }
+    count = 0;
+  }
+
+  size_t count;
+  int ops[kSize];
+  float start_y[kSize];
+  float start_derivative[kSize];
+  float end_y[kSize];
+  float end_derivative[kSize];
+  float width_x[kSize];
+  float cubic_x[kSize];
+  float c[CubicCurve::kNumCoeff][kSize];
+};
+
+// Overwrite the component of the transform written by an op of `type` with
+// `value`, as SqtData does.
+void ApplySqtOp(MatrixOperationType type, float value,
+                mathfu::vec3* translation, mathfu::quat* rotation,
+                mathfu::vec3* scale) {
+  switch (type) {
+    case kTranslateX:
+      translation->x = value;
+      break;
+    case kTranslateY:
+      translation->y = value;
+      break;
+    case kTranslateZ:
+      translation->z = value;
+      break;
+    case kScaleX:
+      scale->x = value;
+      break;
+    case kScaleY:
+      scale->y = value;
+      break;
+    case kScaleZ:
+      scale->z = value;
+      break;
+    case kScaleUniformly:
+      *scale = mathfu::vec3(value);
+      break;
+    case kQuaternionW:
+      rotation->set_scalar(value);
+      break;
+    case kQuaternionX:
+    case kQuaternionY:
+    case kQuaternionZ: {
+      mathfu::vec3 v = rotation->vector();
+      v[type - kQuaternionX] = value;
+      rotation->set_vector(v);
+      break;
+    }
+    default:
+      // RotateAbout ops can't be mixed with quaternion ops.
+      assert(false);
+  }
+}
+
+}  // namespace
+
+void RigAnimSampler::Init(const RigAnim& anim) {
+  anim_ = &anim;
+  const BoneIndex num_bones = anim.NumBones();
+  ops_.clear();
+  values_.clear();
+  spline_ops_.clear();
+  bone_ops_.resize(num_bones + 1);
+  for (BoneIndex i = 0; i < num_bones; ++i) {
+    bone_ops_[i] = static_cast<int>(ops_.size());
+    const std::vector<MatrixOperationInit>& ops = anim.Anim(i).ops();
+    for (auto it = ops.begin(); it != ops.end(); ++it) {
+      Op op;
+      op.type = it->type;
+      op.spline = it->union_type == MatrixOperationInit::kUnionSpline
+                      ? it->spline
+                      : nullptr;
+      if (op.spline != nullptr) {
+        spline_ops_.push_back(static_cast<int>(ops_.size()));
+      }
+      ops_.push_back(op);
+      values_.push_back(it->StartValue());
+    }
+  }
+  bone_ops_[num_bones] = static_cast<int>(ops_.size());
+  segment_hints_.assign(spline_ops_.size(), 0);
+  local_transforms_.resize(num_bones);
+}
+
+void RigAnimSampler::EvaluateOps(float time, bool repeat) {
+  SegmentBatch batch;
+  for (size_t k = 0; k < spline_ops_.size(); ++k) {
+    const int op = spline_ops_[k];
+    const CompactSpline& spline = *ops_[op].spline;
+    float x = time;
+    const CompactSplineIndex index =
+        spline.IndexForXAllowingRepeat(time, segment_hints_[k], repeat, &x);
+
+    // Splines hold their end values outside of their domain.
+    if (index == kBeforeSplineIndex) {
+      values_[op] = spline.StartY();
+      continue;
+    }
+    if (index == kAfterSplineIndex) {
+      values_[op] = spline.EndY();
+      continue;
+    }
+    segment_hints_[k] = index;
+    batch.Add(op, spline.CreateCubicInit(index), x - spline.NodeX(index));
+    if (batch.count == SegmentBatch::kSize) batch.Evaluate(values_.data());
+  }
+  batch.Evaluate(values_.data());
+}
+
+void RigAnimSampler::LocalTransforms(float time, bool repeat,
+                                     mathfu::AffineTransform* out) {
+  assert(anim_ != nullptr);
+  const TraceScope trace("LocalTransforms", "RigAnimSampler");
+  EvaluateOps(time, repeat);
+
+  const BoneIndex num_bones = anim_->NumBones();
+  for (BoneIndex i = 0; i < num_bones; ++i) {
+    const int begin = bone_ops_[i];
+    const int end = bone_ops_[i + 1];
+    if (anim_->Anim(i).IsSqtAnim()) {
+      mathfu::vec3 translation = DefaultOpsTranslation();
+      mathfu::quat rotation = DefaultOpsQuaternion();
+      mathfu::vec3 scale = DefaultOpsScale();
+      for (int k = begin; k < end; ++k) {
+        ApplySqtOp(ops_[k].type, values_[k], &translation, &rotation, &scale);
+      }
+      rotation.Normalize();
+      out[i] = mathfu::mat4::ToAffineTransform(
+          mathfu::mat4::Transform(translation, rotation.ToMatrix(), scale));
+    } else {
+      MatrixOperation::ResultColumns m;
+      for (int k = begin; k < end; ++k) {
+        MatrixOperation::ApplyOperation(ops_[k].type, values_[k], &m);
+      }
+      out[i] = m.Affine();
+    }
+  }
+}
+
+void RigAnimSampler::GlobalTransforms(float time, bool repeat,
+                                      mathfu::AffineTransform* out) {
+  LocalTransforms(time, repeat, local_transforms_.data());
+
+  // Parents always come before their children.
+  const BoneIndex* parents = anim_->bone_parents();
+  const BoneIndex num_bones = anim_->NumBones();
+  for (BoneIndex i = 0; i < num_bones; ++i) {
+    const BoneIndex parent = parents[i];
+    if (parent == kInvalidBoneIdx) {
+      out[i] = local_transforms_[i];
+      continue;
+    }
+    assert(parent < i);
+    out[i] = mathfu::mat4::ToAffineTransform(
+        mathfu::mat4::FromAffineTransform(out[parent]) *
+        mathfu::mat4::FromAffineTransform(local_transforms_[i]));
+  }
+}
+
+}  // namespace motive
@@ -13,6 +13,9 @@
 // limitations under the License.
 
 #include "motive/rig_init.h"
+
+#include <algorithm>
+
 #include "motive/rig_anim.h"
 
 namespace motive {
@@ -54,4 +57,25 @@ bool RigInit::MatchesHierarchy(const RigAnim& anim_a, const RigAnim& anim_b) {
                           anim_b.bone_parents(), anim_b.NumBones());
 }
 
+// static
+std::vector<BoneIndex> RigInit::CullLeafBones(const BoneIndex* parents,
+                                              BoneIndex num_bones,
+                                              int num_leaf_levels) {
+  // The height of a bone is its distance from its furthest leaf. Children
+  // always come after their parents, so walk backwards.
+  std::vector<int> heights(num_bones, 0);
+  for (int i = num_bones - 1; i >= 0; --i) {
+    const BoneIndex parent = parents[i];
+    if (parent == kInvalidBoneIdx) continue;
+    assert(parent < i);
+    heights[parent] = std::max(heights[parent], heights[i] + 1);
+  }
+
+  std::vector<BoneIndex> bones;
+  for (BoneIndex i = 0; i < num_bones; ++i) {
+    if (heights[i] >= num_leaf_levels) bones.push_back(i);
+  }
+  return bones;
+}
+
 }  // namespace motive
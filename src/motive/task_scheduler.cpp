@@ -0,0 +1,45 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+
+#include "motive/task_scheduler.h"
+
+namespace motive {
+
+void MotiveTaskScheduler::ParallelFor(int count, int min_range_size,
+                                      const MotiveRangeTask& task) {
+  // Split into one range per thread, but never into ranges that are smaller
+  // than requested.
+  const int num_threads = std::max(NumThreads(), 1);
+  const int min_size = std::max(min_range_size, 1);
+  const int range_size =
+      std::max((count + num_threads - 1) / num_threads, min_size);
+  if (range_size >= count) {
+    task(0, count);
+    return;
+  }
+
+  // Keep the first range for the calling thread. It would otherwise sit idle
+  // in Wait().
+  const MotiveTaskGroupId group = BeginGroup();
+  for (int begin = range_size; begin < count; begin += range_size) {
+    const int end = std::min(begin + range_size, count);
+    Submit(group, [&task, begin, end]() { task(begin, end); });
+  }
+  task(0, range_size);
+  Wait(group);
+}
+
+}  // namespace motive
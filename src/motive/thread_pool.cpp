@@ -0,0 +1,102 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "motive/thread_pool.h"
+
+#include <assert.h>
+
+namespace motive {
+
+MotiveThreadPool::MotiveThreadPool(int num_workers) : stopping_(false) {
+  workers_.reserve(num_workers > 0 ? num_workers : 0);
+  for (int i = 0; i < num_workers; ++i) {
+    workers_.push_back(std::thread([this]() { WorkerLoop(); }));
+  }
+}
+
+MotiveThreadPool::~MotiveThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  task_queued_.notify_all();
+  for (auto it = workers_.begin(); it != workers_.end(); ++it) {
+    it->join();
+  }
+
+  // Without workers, nothing else would run the leftover tasks.
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!queue_.empty()) RunTask(&lock);
+}
+
+MotiveTaskGroupId MotiveThreadPool::BeginGroup() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (free_groups_.empty()) {
+    pending_.push_back(0);
+    return static_cast<MotiveTaskGroupId>(pending_.size() - 1);
+  }
+  const MotiveTaskGroupId group = free_groups_.back();
+  free_groups_.pop_back();
+  return group;
+}
+
+void MotiveThreadPool::Submit(MotiveTaskGroupId group,
+                              const MotiveTask& task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    assert(0 <= group && group < static_cast<int>(pending_.size()));
+    pending_[group]++;
+    queue_.push_back(QueuedTask(group, task));
+  }
+  task_queued_.notify_one();
+}
+
+void MotiveThreadPool::Wait(MotiveTaskGroupId group) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (pending_[group] > 0) {
+    // Help with whatever is queued, which is usually our own group's tasks.
+    // Only sleep once the remaining tasks are all running elsewhere.
+    if (!queue_.empty()) {
+      RunTask(&lock);
+    } else {
+      group_finished_.wait(lock);
+    }
+  }
+  free_groups_.push_back(group);
+}
+
+void MotiveThreadPool::WorkerLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    task_queued_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+    if (queue_.empty()) return;
+    RunTask(&lock);
+  }
+}
+
+void MotiveThreadPool::RunTask(std::unique_lock<std::mutex>* lock) {
+  assert(!queue_.empty());
+  const QueuedTask queued = queue_.front();
+  queue_.pop_front();
+
+  lock->unlock();
+  queued.task();
+  lock->lock();
+
+  if (--pending_[queued.group] == 0) {
+    group_finished_.notify_all();
+  }
+}
+
+}  // namespace motive
@@ -14,15 +14,29 @@
 
 #if defined(BENCHMARK_MOTIVE)
 
+#include <algorithm>
 #include <assert.h>
+#include <fstream>
 #include <limits>
 #include <math.h>
 #include <sstream>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <utility>
 #include <vector>
 #include "motive/util/benchmark.h"
 #include "benchmark_common.h" // From mathfu
 
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif  // defined(__linux__)
+
 
 namespace motive {
 
@@ -53,6 +67,10 @@ class SampleAnalyzer {
                  BucketArray* buckets_pointer) const;
   std::string Statistics(double to_usec, int width = kDefaultHistogramWidth,
                          int height = kDefaultHistogramHeight) const;
+  void Sorted(std::vector<T>* sorted) const;
+  static T Percentile(const std::vector<T>& sorted, double percent);
+  const std::vector<T>& samples() const { return samples_; }
+  const std::string& name() const { return name_; }
 
  private:
   // The sampled data. This vector is never shrunk. It will incur some
@@ -176,11 +194,156 @@ std::string SampleAnalyzer<T>::Statistics(double to_usec, int width,
   return s.str();
 }
 
+template<class T>
+void SampleAnalyzer<T>::Sorted(std::vector<T>* sorted) const {
+  *sorted = samples_;
+  std::sort(sorted->begin(), sorted->end());
+}
+
+// The nearest-rank percentile of `sorted`, which must not be empty.
+template<class T>
+T SampleAnalyzer<T>::Percentile(const std::vector<T>& sorted, double percent) {
+  assert(!sorted.empty());
+  const double rank = ceil(percent / 100.0 * sorted.size());
+  const size_t index = rank < 1.0 ? 0 : static_cast<size_t>(rank) - 1;
+  return sorted[std::min(index, sorted.size() - 1)];
+}
 
 // One SampleAnalyzer per id being benchmarked.
 typedef SampleAnalyzer<BenchmarkTime> TimeAnalyzer;
 static std::vector<TimeAnalyzer> gTimes;
 
+// Sums of the hardware counters over each id's samples, when enabled.
+struct CounterTotals {
+  CounterTotals() : num_samples(0) {
+    std::fill(totals, totals + kNumBenchmarkCounters, 0ULL);
+  }
+  unsigned long long totals[kNumBenchmarkCounters];
+  unsigned long long num_samples;
+};
+static std::vector<CounterTotals> gCounterTotals;
+
+// Names of BenchmarkCounter values, used in reports.
+static const char* const kBenchmarkCounterNames[] = {
+    "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses",
+};
+static_assert(sizeof(kBenchmarkCounterNames) /
+                      sizeof(kBenchmarkCounterNames[0]) ==
+                  kNumBenchmarkCounters,
+              "Update kBenchmarkCounterNames when adding a BenchmarkCounter.");
+
+// Set by EnableBenchmarkCounters(). Counters the CPU can't count stay false.
+static bool gCountersEnabled = false;
+static bool gCounterSupported[kNumBenchmarkCounters];
+
+#if defined(__linux__)
+
+// A perf_event group counting the calling thread's user-space events, read
+// with a single system call. Opened on the thread's first read.
+class ThreadCounters {
+ public:
+  ThreadCounters() : num_open_(0) {
+    const int leader = Open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+    if (leader < 0) return;
+    Add(kBenchmarkCycles, leader);
+    Add(kBenchmarkInstructions,
+        Open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, leader));
+    Add(kBenchmarkL1dMisses,
+        Open(PERF_TYPE_HW_CACHE,
+             PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+             leader));
+    Add(kBenchmarkLlcMisses,
+        Open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, leader));
+    Add(kBenchmarkBranchMisses,
+        Open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, leader));
+    ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+
+  ~ThreadCounters() {
+    for (int i = 0; i < num_open_; ++i) {
+      close(fds_[i]);
+    }
+  }
+
+  bool IsOpen(int counter) const {
+    for (int i = 0; i < num_open_; ++i) {
+      if (counters_[i] == counter) return true;
+    }
+    return false;
+  }
+
+  bool Read(unsigned long long* counts) const {
+    if (num_open_ == 0) return false;
+
+    // With PERF_FORMAT_GROUP, the leader reads the number of counters,
+    // followed by each counter in the order it was opened.
+    uint64_t values[kNumBenchmarkCounters + 1];
+    const ssize_t size = static_cast<ssize_t>(sizeof(uint64_t)) *
+                         (num_open_ + 1);
+    if (read(fds_[0], values, sizeof(values)) != size) return false;
+    std::fill(counts, counts + kNumBenchmarkCounters, 0ULL);
+    for (int i = 0; i < num_open_; ++i) {
+      counts[counters_[i]] = values[i + 1];
+    }
+    return true;
+  }
+
+ private:
+  static int Open(uint32_t type, uint64_t config, int group_fd) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = group_fd < 0 ? 1 : 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return static_cast<int>(
+        syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0));
+  }
+
+  void Add(int counter, int fd) {
+    if (fd < 0) return;
+    fds_[num_open_] = fd;
+    counters_[num_open_] = counter;
+    num_open_++;
+  }
+
+  int fds_[kNumBenchmarkCounters];
+  int counters_[kNumBenchmarkCounters];
+  int num_open_;
+};
+
+static const ThreadCounters& GetThreadCounters() {
+  static thread_local ThreadCounters counters;
+  return counters;
+}
+
+bool EnableBenchmarkCounters() {
+  const ThreadCounters& counters = GetThreadCounters();
+  gCountersEnabled = false;
+  for (int i = 0; i < kNumBenchmarkCounters; ++i) {
+    gCounterSupported[i] = counters.IsOpen(i);
+    gCountersEnabled = gCountersEnabled || gCounterSupported[i];
+  }
+  return gCountersEnabled;
+}
+
+bool ReadBenchmarkCounters(unsigned long long* counts) {
+  return gCountersEnabled && GetThreadCounters().Read(counts);
+}
+
+#else  // not defined(__linux__)
+
+bool EnableBenchmarkCounters() { return false; }
+
+bool ReadBenchmarkCounters(unsigned long long* /*counts*/) { return false; }
+
+#endif  // not defined(__linux__)
+
 BenchmarkTime GetBenchmarkTime() { return Timer::GetTicks(); }
 
 void InitBenchmarks(int num_ids) {
@@ -192,14 +355,23 @@ void ClearBenchmarks() {
   for (auto it = gTimes.begin(); it != gTimes.end(); ++it) {
     it->Clear();
   }
+  std::fill(gCounterTotals.begin(), gCounterTotals.end(), CounterTotals());
 }
 
 int RegisterBenchmark(const char* name) {
   const int id = static_cast<int>(gTimes.size());
   gTimes.push_back(TimeAnalyzer(name));
+  gCounterTotals.push_back(CounterTotals());
   return id;
 }
 
+// The mean of `counter` over the samples of benchmark `id`.
+static double MeanCount(size_t id, int counter) {
+  const CounterTotals& t = gCounterTotals[id];
+  return static_cast<double>(t.totals[counter]) /
+         static_cast<double>(t.num_samples);
+}
+
 void OutputBenchmarks() {
   const double to_usec = Timer::tick_period() * kMicrosecondsPerSecond;
   printf("\n");
@@ -207,14 +379,257 @@ void OutputBenchmarks() {
     if (gTimes[i].NumSamples() > 0) {
       printf("%s\n", gTimes[i].Statistics(to_usec).c_str());
     }
+    if (gCounterTotals[i].num_samples > 0) {
+      printf("%s: per sample", gTimes[i].name().c_str());
+      for (int c = 0; c < kNumBenchmarkCounters; ++c) {
+        if (!gCounterSupported[c]) continue;
+        printf(", %s %.0f", kBenchmarkCounterNames[c], MeanCount(i, c));
+      }
+      if (gCounterSupported[kBenchmarkCycles] &&
+          gCounterSupported[kBenchmarkInstructions]) {
+        printf(", IPC %.2f", MeanCount(i, kBenchmarkInstructions) /
+                                 MeanCount(i, kBenchmarkCycles));
+      }
+      printf("\n\n");
+    }
+  }
+}
+
+// Configuration written by WriteBenchmarks(), in the order it was first set.
+static std::vector<std::pair<std::string, std::string>> gConfig;
+
+void SetBenchmarkConfig(const char* key, const char* value) {
+  for (auto it = gConfig.begin(); it != gConfig.end(); ++it) {
+    if (it->first == key) {
+      it->second = value;
+      return;
+    }
+  }
+  gConfig.push_back(std::make_pair(std::string(key), std::string(value)));
+}
+
+static void WriteJsonString(FILE* file, const std::string& s) {
+  fputc('"', file);
+  for (size_t i = 0; i < s.size(); ++i) {
+    const unsigned char c = static_cast<unsigned char>(s[i]);
+    if (c == '"' || c == '\\') {
+      fprintf(file, "\\%c", c);
+    } else if (c < 0x20) {
+      fprintf(file, "\\u%04x", c);
+    } else {
+      fputc(c, file);
+    }
+  }
+  fputc('"', file);
+}
+
+static void WriteBenchmarksJson(FILE* file, double to_usec) {
+  fprintf(file, "{\n  \"config\": {");
+  for (size_t i = 0; i < gConfig.size(); ++i) {
+    fprintf(file, "%s\n    ", i == 0 ? "" : ",");
+    WriteJsonString(file, gConfig[i].first);
+    fprintf(file, ": ");
+    WriteJsonString(file, gConfig[i].second);
+  }
+  fprintf(file, "\n  },\n  \"unit\": \"usec\",\n  \"benchmarks\": [");
+
+  bool first = true;
+  std::vector<BenchmarkTime> sorted;
+  for (size_t i = 0; i < gTimes.size(); ++i) {
+    const TimeAnalyzer& times = gTimes[i];
+    if (times.NumSamples() == 0) continue;
+    times.Sorted(&sorted);
+    const BenchmarkTime avg = times.Average();
+    fprintf(file, "%s\n    {\"name\": ", first ? "" : ",");
+    WriteJsonString(file, times.name());
+    fprintf(file,
+            ", \"samples\": %d, \"average\": %.3f, \"stdev\": %.3f"
+            ", \"min\": %.3f, \"p50\": %.3f, \"p95\": %.3f"
+            ", \"p99\": %.3f, \"max\": %.3f",
+            static_cast<int>(sorted.size()), avg * to_usec,
+            times.StandardDeviation(avg) * to_usec, sorted.front() * to_usec,
+            TimeAnalyzer::Percentile(sorted, 50.0) * to_usec,
+            TimeAnalyzer::Percentile(sorted, 95.0) * to_usec,
+            TimeAnalyzer::Percentile(sorted, 99.0) * to_usec,
+            sorted.back() * to_usec);
+    if (gCounterTotals[i].num_samples > 0) {
+      fprintf(file, ", \"counters\": {");
+      bool first_counter = true;
+      for (int c = 0; c < kNumBenchmarkCounters; ++c) {
+        if (!gCounterSupported[c]) continue;
+        fprintf(file, "%s\"%s\": %.1f", first_counter ? "" : ", ",
+                kBenchmarkCounterNames[c], MeanCount(i, c));
+        first_counter = false;
+      }
+      fprintf(file, "}");
+    }
+    fprintf(file, ",\n     \"values\": [");
+    const std::vector<BenchmarkTime>& samples = times.samples();
+    for (size_t j = 0; j < samples.size(); ++j) {
+      fprintf(file, "%s%.3f", j == 0 ? "" : ", ", samples[j] * to_usec);
+    }
+    fprintf(file, "]}");
+    first = false;
+  }
+  fprintf(file, "\n  ]\n}\n");
+}
+
+static void WriteBenchmarksCsv(FILE* file, double to_usec) {
+  for (size_t i = 0; i < gConfig.size(); ++i) {
+    fprintf(file, "# %s=%s\n", gConfig[i].first.c_str(),
+            gConfig[i].second.c_str());
+  }
+  fprintf(file, "name,usec\n");
+  for (size_t i = 0; i < gTimes.size(); ++i) {
+    const std::vector<BenchmarkTime>& samples = gTimes[i].samples();
+    for (size_t j = 0; j < samples.size(); ++j) {
+      fprintf(file, "%s,%.3f\n", gTimes[i].name().c_str(),
+              samples[j] * to_usec);
+    }
+  }
+}
+
+bool WriteBenchmarks(const char* file_name, BenchmarkFormat format) {
+  FILE* file = fopen(file_name, "w");
+  if (file == nullptr) return false;
+
+  const double to_usec = Timer::tick_period() * kMicrosecondsPerSecond;
+  if (format == kBenchmarkJson) {
+    WriteBenchmarksJson(file, to_usec);
+  } else {
+    WriteBenchmarksCsv(file, to_usec);
   }
+  return fclose(file) == 0;
+}
+
+// Samples of each benchmark in a kBenchmarkCsv file, in the order the
+// benchmarks first appear.
+typedef std::vector<std::pair<std::string, std::vector<double>>> NamedSamples;
+
+static bool ReadBenchmarksCsv(const char* file_name, NamedSamples* runs) {
+  std::ifstream file(file_name);
+  if (!file) return false;
+
+  std::string line;
+  bool header = true;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    if (header) {
+      header = false;
+      continue;
+    }
+    const size_t comma = line.rfind(',');
+    if (comma == std::string::npos) return false;
+    const std::string name = line.substr(0, comma);
+    const double usec = atof(line.c_str() + comma + 1);
+
+    auto it = runs->begin();
+    while (it != runs->end() && it->first != name) ++it;
+    if (it == runs->end()) {
+      runs->push_back(std::make_pair(name, std::vector<double>()));
+      it = runs->end() - 1;
+    }
+    it->second.push_back(usec);
+  }
+  return true;
+}
+
+static double Median(std::vector<double> samples) {
+  assert(!samples.empty());
+  std::sort(samples.begin(), samples.end());
+  const size_t mid = samples.size() / 2;
+  return samples.size() % 2 == 1 ? samples[mid]
+                                 : 0.5 * (samples[mid - 1] + samples[mid]);
+}
+
+// Two-sided p-value of the Mann-Whitney U test that `a` and `b` are drawn from
+// the same distribution. Uses the normal approximation, which is accurate for
+// the hundreds of samples in a typical run. Timing samples are far from
+// normal, so this is more reliable than a t-test.
+static double MannWhitneyP(const std::vector<double>& a,
+                           const std::vector<double>& b) {
+  std::vector<std::pair<double, bool>> ranked;
+  ranked.reserve(a.size() + b.size());
+  for (size_t i = 0; i < a.size(); ++i) {
+    ranked.push_back(std::make_pair(a[i], true));
+  }
+  for (size_t i = 0; i < b.size(); ++i) {
+    ranked.push_back(std::make_pair(b[i], false));
+  }
+  std::sort(ranked.begin(), ranked.end());
+
+  // Sum the ranks of `a`, giving tied values the average of their ranks.
+  double rank_sum_a = 0.0;
+  for (size_t i = 0; i < ranked.size();) {
+    size_t end = i;
+    while (end < ranked.size() && ranked[end].first == ranked[i].first) ++end;
+    const double average_rank = 0.5 * static_cast<double>(i + 1 + end);
+    for (size_t j = i; j < end; ++j) {
+      if (ranked[j].second) rank_sum_a += average_rank;
+    }
+    i = end;
+  }
+
+  const double n1 = static_cast<double>(a.size());
+  const double n2 = static_cast<double>(b.size());
+  const double u = rank_sum_a - 0.5 * n1 * (n1 + 1.0);
+  const double sigma = sqrt(n1 * n2 * (n1 + n2 + 1.0) / 12.0);
+  if (sigma == 0.0) return 1.0;
+  const double z = (u - 0.5 * n1 * n2) / sigma;
+  return erfc(fabs(z) / sqrt(2.0));
+}
+
+int CompareBenchmarks(const char* baseline_file, const char* candidate_file,
+                      double alpha, double min_slowdown) {
+  NamedSamples baseline;
+  NamedSamples candidate;
+  if (!ReadBenchmarksCsv(baseline_file, &baseline) ||
+      !ReadBenchmarksCsv(candidate_file, &candidate)) {
+    return -1;
+  }
+
+  int regressions = 0;
+  printf("%-40s %12s %12s %9s %9s\n", "benchmark", "base_p50_us",
+         "new_p50_us", "change", "p-value");
+  for (auto it = candidate.begin(); it != candidate.end(); ++it) {
+    auto base = baseline.begin();
+    while (base != baseline.end() && base->first != it->first) ++base;
+    if (base == baseline.end()) {
+      printf("%-40s %12s %12.3f    (new)\n", it->first.c_str(), "-",
+             Median(it->second));
+      continue;
+    }
+
+    const double base_median = Median(base->second);
+    const double new_median = Median(it->second);
+    const double change =
+        base_median > 0.0 ? (new_median - base_median) / base_median : 0.0;
+    const double p = MannWhitneyP(base->second, it->second);
+    const bool significant = p < alpha;
+    const bool regression = significant && change > min_slowdown;
+    regressions += regression ? 1 : 0;
+    printf("%-40s %12.3f %12.3f %+8.1f%% %9.2g%s\n", it->first.c_str(),
+           base_median, new_median, 100.0 * change, p,
+           regression ? "  REGRESSION" : significant ? "  significant" : "");
+  }
+  return regressions;
 }
 
 Benchmark::~Benchmark() {
   BenchmarkTime end_time = GetBenchmarkTime();
 
+  unsigned long long end_counts[kNumBenchmarkCounters];
+  const bool has_counts = has_counts_ && ReadBenchmarkCounters(end_counts);
+
   assert(0 <= id_ && id_ < static_cast<int>(gTimes.size()));
   gTimes[id_].Append(end_time - start_time_);
+  if (has_counts) {
+    CounterTotals& t = gCounterTotals[id_];
+    for (int c = 0; c < kNumBenchmarkCounters; ++c) {
+      t.totals[c] += end_counts[c] - start_counts_[c];
+    }
+    t.num_samples++;
+  }
 }
 
 }  // namespace motive
@@ -0,0 +1,85 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "motive/util/counters.h"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace motive {
+
+namespace {
+
+// Every live CounterBlock, and the counts of those whose threads have
+// exited. Never deleted, so it outlives blocks destroyed at process exit.
+struct CounterRegistry {
+  std::mutex mutex;
+  std::vector<const detail::CounterBlock*> blocks;
+  MotiveCounters retired;
+};
+
+CounterRegistry& Registry() {
+  static CounterRegistry* registry = new CounterRegistry();
+  return *registry;
+}
+
+}  // namespace
+
+const char* MotiveCounterName(MotiveCounter counter) {
+  static const char* const kNames[] = {
+      "cubic_inits",   "index_for_x_searches", "defragment_moves",
+      "matrix_blends", "rig_blends",           "matrices_recomputed",
+      "rig_transform_updates",
+  };
+  static_assert(sizeof(kNames) / sizeof(kNames[0]) == kNumMotiveCounters,
+                "Update kNames when adding a MotiveCounter.");
+  return 0 <= counter && counter < kNumMotiveCounters ? kNames[counter]
+                                                        : "unknown";
+}
+
+void ReadMotiveCounters(MotiveCounters* counters) {
+  CounterRegistry& registry = Registry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  *counters = registry.retired;
+  for (size_t b = 0; b < registry.blocks.size(); ++b) {
+    for (int i = 0; i < kNumMotiveCounters; ++i) {
+      counters->counts[i] += registry.blocks[b]->Count(i);
+    }
+  }
+}
+
+namespace detail {
+
+CounterBlock::CounterBlock() {
+  for (int i = 0; i < kNumMotiveCounters; ++i) {
+    counts_[i].store(0, std::memory_order_relaxed);
+  }
+  CounterRegistry& registry = Registry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  registry.blocks.push_back(this);
+}
+
+CounterBlock::~CounterBlock() {
+  CounterRegistry& registry = Registry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  for (int i = 0; i < kNumMotiveCounters; ++i) {
+    registry.retired.counts[i] += Count(i);
+  }
+  registry.blocks.erase(
+      std::find(registry.blocks.begin(), registry.blocks.end(), this));
+}
+
+}  // namespace detail
+}  // namespace motive
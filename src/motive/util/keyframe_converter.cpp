@@ -14,8 +14,11 @@
 
 #include "motive/util/keyframe_converter.h"
 
+#include <algorithm>
 #include <vector>
 
+#include "mathfu/glsl_mappings.h"
+
 namespace motive {
 
 namespace {
@@ -296,6 +299,109 @@ size_t CreateSplinesInPlace(uint8_t* buffer,
   return bytes_used;
 }
 
+// Loads |count| <= 4 floats from |p| into the lanes of a vec4. Unused lanes are
+// zero.
+mathfu::vec4 LoadLanes(const float* p, size_t count) {
+  float lanes[4] = {0.f, 0.f, 0.f, 0.f};
+  for (size_t i = 0; i < count; ++i) {
+    lanes[i] = p[i];
+  }
+  return mathfu::vec4(lanes);
+}
+
+// Number of channels converted for |group|.
+size_t GroupChannelCount(const KeyframeCurveGroup& group) {
+  return group.is_quaternion ? 4 : 3;
+}
+
+// Fills |nodes| with |group|'s spline nodes, channel by channel. Channel i's
+// nodes start at |nodes + i * 2 * group.data.count|. Produces exactly the nodes
+// that AddKeyframeData() would, but processes every channel of a keyframe at
+// once.
+void AddBulkKeyframeNodes(const KeyframeCurveGroup& group,
+                          UncompressedNode* nodes) {
+  const KeyframeData& data = group.data;
+  const size_t channel_count = GroupChannelCount(group);
+  const size_t num_nodes = data.count * 2;
+  const bool cubic = data.interpolation_type == kCubicSpline;
+  const size_t stride = cubic ? channel_count * 3 : channel_count;
+  const mathfu::vec4 ms_per_time_unit(data.ms_per_time_unit);
+
+  mathfu::vec4 previous(0.f);
+  float previous_time = 0.f;
+  for (size_t frame = 0; frame < data.count; ++frame) {
+    const float time =
+        ConvertTimeToMilliseconds(data.times[frame], data.ms_per_time_unit);
+    const float* frame_values = data.values + frame * stride;
+    mathfu::vec4 value =
+        LoadLanes(cubic ? frame_values + channel_count : frame_values,
+                  channel_count);
+
+    // Remove quaternion flips between consecutive keyframes, as in
+    // GetQuaternionValue().
+    const bool check_flip = group.is_quaternion && frame > 0 &&
+                            data.interpolation_type == kLinear;
+    if (check_flip && mathfu::vec4::DotProduct(value, previous) < 0.f) {
+      value = -value;
+    }
+
+    // Compute the values and derivatives of both nodes for every channel.
+    mathfu::vec4 left_value = value;
+    mathfu::vec4 left_derivative(0.f);
+    mathfu::vec4 right_derivative(0.f);
+    switch (data.interpolation_type) {
+      case kLinear: {
+        // The tangent line between this keyframe and the last.
+        const float delta_time = time - previous_time;
+        if (frame > 0 && delta_time > 0.f) {
+          left_derivative = (value - previous) / delta_time;
+        }
+        break;
+      }
+      case kStep:
+        if (frame > 0) left_value = previous;
+        break;
+      case kCubicSpline:
+        left_derivative =
+            LoadLanes(frame_values, channel_count) / ms_per_time_unit;
+        right_derivative =
+            LoadLanes(frame_values + 2 * channel_count, channel_count) /
+            ms_per_time_unit;
+        break;
+    }
+
+    for (size_t channel = 0; channel < channel_count; ++channel) {
+      UncompressedNode* channel_nodes = nodes + channel * num_nodes;
+      UncompressedNode& left_node = channel_nodes[frame * 2];
+      left_node.x = time;
+      left_node.y = left_value[channel];
+      left_node.derivative = left_derivative[channel];
+
+      UncompressedNode& right_node = channel_nodes[frame * 2 + 1];
+      right_node.x = time;
+      right_node.y = value[channel];
+      right_node.derivative = right_derivative[channel];
+
+      // For linear interpolation, the previous right node shares the tangent.
+      if (data.interpolation_type == kLinear && frame > 0) {
+        channel_nodes[frame * 2 - 1].derivative = left_derivative[channel];
+      }
+    }
+    previous = value;
+    previous_time = time;
+  }
+}
+
+// Appends a node to the end of |source|.
+void AddStreamNode(LiveSplineChunkSource* source, float x, float y,
+                   float derivative) {
+  UncompressedNode node;
+  node.x = x;
+  node.y = y;
+  node.derivative = derivative;
+  source->AddNode(node);
+}
+
 }  // namespace
 
 size_t GetRequiredBufferSize(size_t keyframe_count, size_t channel_count,
@@ -405,4 +511,198 @@ void AddQuaternionCurves(MatrixAnim* anim, MatrixAnim::Spline* splines,
   }
 }
 
+// Ring curves have no per-op settings, so share one init.
+static const SplineInit kRingSplineInit;
+
+void AddVector3RingCurves(MatrixAnim* anim, const RingSpline* const* rings,
+                          MatrixOperationType base_type, MatrixOpId base_id) {
+  std::vector<MatrixOperationInit>& ops = anim->ops();
+  for (int i = 0; i < 3; ++i) {
+    const MatrixOperationType type =
+        static_cast<MatrixOperationType>(base_type + i);
+    ops.emplace_back(base_id + i, type, kRingSplineInit, rings[i]->spline());
+  }
+}
+
+void AddQuaternionRingCurves(MatrixAnim* anim, const RingSpline* const* rings,
+                             MatrixOpId base_id) {
+  std::vector<MatrixOperationInit>& ops = anim->ops();
+  for (int i = 0; i < 4; ++i) {
+    const MatrixOperationType type =
+        static_cast<MatrixOperationType>(kQuaternionW + i);
+    ops.emplace_back(base_id + i, type, kRingSplineInit, rings[i]->spline());
+  }
+}
+
+void AddRingQuaternionValue(RingSpline* const* rings, const float* quat,
+                            QuaternionOrder order) {
+  float values[4];
+  float dot = 0.0f;
+  for (int i = 0; i < 4; ++i) {
+    const MatrixOperationType type =
+        static_cast<MatrixOperationType>(kQuaternionW + i);
+    values[i] = quat[IndexForQuaternionComponent(type, order)];
+    dot += values[i] * rings[i]->newest_y();
+  }
+
+  // q and -q are the same rotation. Take the one nearer the previous value.
+  const float sign = dot < 0.0f ? -1.0f : 1.0f;
+  for (int i = 0; i < 4; ++i) {
+    rings[i]->AddValue(sign * values[i]);
+  }
+}
+
+size_t GetRequiredBulkBufferSize(const KeyframeCurveGroup* groups,
+                                 size_t group_count) {
+  size_t size = 0;
+  for (size_t i = 0; i < group_count; ++i) {
+    const KeyframeCurveGroup& group = groups[i];
+    const size_t group_size =
+        GetRequiredBufferSize(group.data.count, GroupChannelCount(group),
+                              group.data.interpolation_type);
+    if (group_size == 0) return 0;
+    size += group_size;
+  }
+  return size;
+}
+
+size_t AddBulkCurves(uint8_t* buffer, const KeyframeCurveGroup* groups,
+                     size_t group_count) {
+  // Allocate scratch nodes once, large enough for the largest group.
+  size_t max_nodes = 0;
+  for (size_t i = 0; i < group_count; ++i) {
+    max_nodes = std::max(max_nodes, GroupChannelCount(groups[i]) * 2 *
+                                        groups[i].data.count);
+  }
+  std::vector<UncompressedNode> nodes(max_nodes);
+
+  uint8_t* iter = buffer;
+  for (size_t i = 0; i < group_count; ++i) {
+    const KeyframeCurveGroup& group = groups[i];
+    const CompactSplineIndex num_nodes = GetRequiredNodeCount(
+        group.data.count, group.data.interpolation_type);
+    assert(num_nodes != kInvalidSplineIndex);
+    AddBulkKeyframeNodes(group, nodes.data());
+
+    // Create splines and operations for each curve, in the same order as
+    // AddVector3Curves() and AddQuaternionCurves().
+    std::vector<MatrixOperationInit>& ops = group.anim->ops();
+    const int channel_count = static_cast<int>(GroupChannelCount(group));
+    for (int c = 0; c < channel_count; ++c) {
+      const MatrixOperationType type = static_cast<MatrixOperationType>(
+          (group.is_quaternion ? kQuaternionW : group.base_type) + c);
+      const int spline_index =
+          group.is_quaternion ? IndexForQuaternionComponent(type, group.order)
+                              : c;
+      MatrixAnim::Spline& spline = group.splines[spline_index];
+      spline.spline = CompactSpline::CreateFromNodesInPlace(
+          &nodes[spline_index * num_nodes], num_nodes, iter);
+      spline.owned = false;
+      iter += spline.spline->Size();
+      ops.emplace_back(group.base_id + c, type, spline.init, *spline.spline);
+    }
+  }
+  return static_cast<size_t>(iter - buffer);
+}
+
+KeyframeStream::KeyframeStream(size_t channel_count, size_t nodes_per_chunk,
+                               int max_chunks)
+    : is_quaternion_(false),
+      order_(kOrderWXYZ),
+      previous_values_(channel_count, 0.f),
+      previous_time_(0.f),
+      has_previous_(false) {
+  for (size_t i = 0; i < channel_count; ++i) {
+    sources_.emplace_back(
+        new LiveSplineChunkSource(nodes_per_chunk, max_chunks));
+  }
+}
+
+KeyframeStream::KeyframeStream(QuaternionOrder order, size_t nodes_per_chunk,
+                               int max_chunks)
+    : KeyframeStream(4, nodes_per_chunk, max_chunks) {
+  is_quaternion_ = true;
+  order_ = order;
+}
+
+void KeyframeStream::AppendKeyframes(const KeyframeData& data) {
+  const size_t channel_count = sources_.size();
+  const bool cubic = data.interpolation_type == kCubicSpline;
+  const size_t stride = cubic ? channel_count * 3 : channel_count;
+  std::vector<float> values(channel_count);
+  for (size_t frame = 0; frame < data.count; ++frame) {
+    const float time =
+        ConvertTimeToMilliseconds(data.times[frame], data.ms_per_time_unit);
+    assert(!has_previous_ || time >= previous_time_);
+    const float* frame_values = data.values + frame * stride;
+    const float* value_start = cubic ? frame_values + channel_count
+                                     : frame_values;
+    values.assign(value_start, value_start + channel_count);
+
+    // Remove quaternion flips against the previous keyframe, which may have
+    // been appended by an earlier call, as in GetQuaternionValue().
+    if (is_quaternion_ && has_previous_ && data.interpolation_type == kLinear) {
+      float dotprod = 0.f;
+      for (size_t i = 0; i < channel_count; ++i) {
+        dotprod += values[i] * previous_values_[i];
+      }
+      if (dotprod < 0.f) {
+        for (size_t i = 0; i < channel_count; ++i) {
+          values[i] = -values[i];
+        }
+      }
+    }
+
+    for (size_t channel = 0; channel < channel_count; ++channel) {
+      LiveSplineChunkSource* source = sources_[channel].get();
+      const size_t index = ValueIndex(channel);
+      const float value = values[index];
+      const float previous = previous_values_[index];
+      switch (data.interpolation_type) {
+        case kLinear: {
+          // The previous right node and this left node share the tangent
+          // between the two keyframes, so the right node is added only now.
+          float tangent = 0.f;
+          if (has_previous_) {
+            const float delta_time = time - previous_time_;
+            tangent = delta_time > 0.f ? (value - previous) / delta_time : 0.f;
+            AddStreamNode(source, previous_time_, previous, tangent);
+          }
+          AddStreamNode(source, time, value, tangent);
+          break;
+        }
+        case kStep:
+          AddStreamNode(source, time, has_previous_ ? previous : value, 0.f);
+          AddStreamNode(source, time, value, 0.f);
+          break;
+        case kCubicSpline:
+          AddStreamNode(source, time, value,
+                        ConvertTangentToMilliseconds(frame_values[index],
+                                                     data.ms_per_time_unit));
+          AddStreamNode(
+              source, time, value,
+              ConvertTangentToMilliseconds(
+                  frame_values[2 * channel_count + index],
+                  data.ms_per_time_unit));
+          break;
+      }
+    }
+    previous_values_.swap(values);
+    previous_time_ = time;
+    has_previous_ = true;
+  }
+}
+
+void KeyframeStream::Flush() {
+  for (size_t i = 0; i < sources_.size(); ++i) {
+    sources_[i]->Flush();
+  }
+}
+
+size_t KeyframeStream::ValueIndex(size_t channel) const {
+  if (!is_quaternion_) return channel;
+  return static_cast<size_t>(IndexForQuaternionComponent(
+      static_cast<MatrixOperationType>(kQuaternionW + channel), order_));
+}
+
 }  // namespace motive
@@ -16,29 +16,149 @@
 
 #if defined(__ANDROID__)
 #include <cpu-features.h>
+#elif defined(__linux__) && defined(__arm__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
 #endif  // defined(__ANDROID__)
 
+#if defined(MOTIVE_X86_SIMD) && defined(_MSC_VER)
+#include <immintrin.h>
+#include <intrin.h>
+#endif  // defined(MOTIVE_X86_SIMD) && defined(_MSC_VER)
+
 namespace motive {
 
-ProcessorOptimization BestProcessorOptimization() {
-// TODO: Add checks for other operating systems.
-#if defined(__ANDROID__)
+#if defined(MOTIVE_X86_SIMD)
+// The x86 kernels are compiled into the library on every OS, so query the
+// CPU directly instead of going through the Android cpu-features library.
+static ProcessorOptimization DetectProcessorOptimization() {
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  const int max_leaf = info[0];
+
+  __cpuid(info, 1);
+  const bool sse2 = (info[3] & (1 << 26)) != 0;
+  const bool sse3 = (info[2] & (1 << 0)) != 0;
+  const bool ssse3 = (info[2] & (1 << 9)) != 0;
+  const bool sse41 = (info[2] & (1 << 19)) != 0;
+  const bool osxsave = (info[2] & (1 << 27)) != 0;
+  const bool avx = (info[2] & (1 << 28)) != 0;
+
+  // Wide registers are only usable if the OS saves them on context switches.
+  // Bits 1 and 2 of XCR0 cover the SSE and AVX state. Bits 5 to 7 cover the
+  // AVX-512 state.
+  const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+  const bool os_avx = avx && (xcr0 & 0x06) == 0x06;
+  const bool os_avx512 = os_avx && (xcr0 & 0xE0) == 0xE0;
+
+  bool avx2 = false;
+  bool avx512 = false;
+  if (max_leaf >= 7) {
+    __cpuidex(info, 7, 0);
+    avx2 = os_avx && (info[1] & (1 << 5)) != 0;
+    avx512 = os_avx512 && (info[1] & (1 << 16)) != 0;
+  }
+#else
+  // These also check that the OS saves the wide registers.
+  __builtin_cpu_init();
+  const bool sse2 = __builtin_cpu_supports("sse2") != 0;
+  const bool sse3 = __builtin_cpu_supports("sse3") != 0;
+  const bool ssse3 = __builtin_cpu_supports("ssse3") != 0;
+  const bool sse41 = __builtin_cpu_supports("sse4.1") != 0;
+  const bool avx2 = __builtin_cpu_supports("avx2") != 0;
+  const bool avx512 = __builtin_cpu_supports("avx512f") != 0;
+#endif  // defined(_MSC_VER)
+
+  return avx512 ? kAvx512Optimizations
+       : avx2 ? kAvx2Optimizations
+       : sse41 ? kSse41Optimizations
+       : ssse3 ? kSsse3Optimizations
+       : sse3 ? kSse3Optimizations
+       : sse2 ? kSse2Optimizations
+       : kNoOptimizations;
+}
+
+#elif defined(__ANDROID__)
+static ProcessorOptimization DetectProcessorOptimization() {
   const uint64_t features = android_getCpuFeatures();
   switch (android_getCpuFamily()) {
     case ANDROID_CPU_FAMILY_ARM:
       return features & ANDROID_CPU_ARM_FEATURE_NEON ? kNeonOptimizations
                                                      : kNoOptimizations;
 
+    // NEON is mandatory on ARMv8.
+    case ANDROID_CPU_FAMILY_ARM64:
+      return kNeonOptimizations;
+
     case ANDROID_CPU_FAMILY_X86:
       return features & ANDROID_CPU_X86_FEATURE_SSSE3 ? kSsse3Optimizations
                                                       : kSse3Optimizations;
 
     default:
-      break;
+      return kNoOptimizations;
   }
-#endif  // defined(__ANDROID__)
+}
 
+#elif defined(__aarch64__) || defined(_M_ARM64)
+// NEON is mandatory on ARMv8, so there's nothing to query.
+static ProcessorOptimization DetectProcessorOptimization() {
+  return kNeonOptimizations;
+}
+
+#elif defined(__APPLE__) && defined(__ARM_NEON__)
+// Every ARMv7 iOS device has NEON, and the compiler only defines __ARM_NEON__
+// when targeting it.
+static ProcessorOptimization DetectProcessorOptimization() {
+  return kNeonOptimizations;
+}
+
+#elif defined(__linux__) && defined(__arm__)
+static ProcessorOptimization DetectProcessorOptimization() {
+  return getauxval(AT_HWCAP) & HWCAP_NEON ? kNeonOptimizations
+                                          : kNoOptimizations;
+}
+
+#elif defined(MOTIVE_WASM_SIMD)
+// The module only loads if the browser supports SIMD.
+static ProcessorOptimization DetectProcessorOptimization() {
+  return kWasmSimdOptimizations;
+}
+
+#else
+static ProcessorOptimization DetectProcessorOptimization() {
   return kNoOptimizations;
 }
+#endif  // defined(MOTIVE_X86_SIMD)
+
+ProcessorOptimization BestProcessorOptimization() {
+  // Querying the CPU can be slow, and the answer never changes.
+  static const ProcessorOptimization best = DetectProcessorOptimization();
+  return best;
+}
+
+const char* ProcessorOptimizationName(ProcessorOptimization optimization) {
+  switch (optimization) {
+    case kNoOptimizations:
+      return "none";
+    case kNeonOptimizations:
+      return "NEON";
+    case kWasmSimdOptimizations:
+      return "WebAssembly SIMD";
+    case kSse2Optimizations:
+      return "SSE2";
+    case kSse3Optimizations:
+      return "SSE3";
+    case kSsse3Optimizations:
+      return "SSSE3";
+    case kSse41Optimizations:
+      return "SSE4.1";
+    case kAvx2Optimizations:
+      return "AVX2";
+    case kAvx512Optimizations:
+      return "AVX-512";
+  }
+  return "unknown";
+}
 
 }  // namespace motive
@@ -0,0 +1,228 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "motive/util/recorder.h"
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "motive/const_init.h"
+#include "motive/ease_in_ease_out_init.h"
+#include "motive/overshoot_init.h"
+#include "motive/rig_anim.h"
+#include "motive/rig_init.h"
+#include "motive/spline_init.h"
+#include "motive/spring_init.h"
+#include "motive/target.h"
+
+namespace motive {
+
+// The format of the log is described in motive/util/replayer.h.
+static const char kRecordingHeader[] = "motive_recording 1\n";
+
+MotiveRecorder::MotiveRecorder() : num_calls_(0), next_id_(0), depth_(0) {}
+
+void MotiveRecorder::Clear() {
+  log_.clear();
+  num_calls_ = 0;
+  ids_.clear();
+  next_id_ = 0;
+}
+
+bool MotiveRecorder::Write(const char* file_name) const {
+  FILE* file = fopen(file_name, "w");
+  if (file == nullptr) return false;
+
+  fputs(kRecordingHeader, file);
+  fwrite(log_.data(), 1, log_.size(), file);
+  return fclose(file) == 0;
+}
+
+int MotiveRecorder::Id(const Motivator* motivator) const {
+  const auto it = ids_.find(motivator);
+  return it == ids_.end() ? -1 : it->second;
+}
+
+void MotiveRecorder::Append(const char* format, ...) {
+  char buffer[256];
+  va_list args;
+  va_start(args, format);
+  const int length = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  assert(0 <= length && length < static_cast<int>(sizeof(buffer)));
+  log_.append(buffer, length);
+}
+
+void MotiveRecorder::AppendPlayback(const SplinePlayback& playback) {
+  Append(" %.9g %.9g %.9g %.9g %.9g %d", playback.start_x, playback.blend_x,
+         playback.playback_rate, playback.y_offset, playback.y_scale,
+         playback.repeat ? 1 : 0);
+}
+
+// Names may hold spaces, so they're prefixed with their length.
+void MotiveRecorder::AppendAnimName(const RigAnim& anim) {
+  const std::string& name = anim.anim_name();
+  Append(" %d:", static_cast<int>(name.size()));
+  log_.append(name);
+}
+
+void MotiveRecorder::RecordInitialize(const Motivator* motivator,
+                                      const MotivatorInit& init,
+                                      MotiveDimension dimensions) {
+  if (depth_ > 0) return;
+
+  const int id = next_id_++;
+  ids_[motivator] = id;
+  Append("Initialize %d %s %d", id, init.type()->name, dimensions);
+
+  const MotivatorType type = init.type();
+  if (type == SplineInit::kType) {
+    const Range& r = static_cast<const SplineInit&>(init).range();
+    Append(" %.9g %.9g", r.start(), r.end());
+  } else if (type == OvershootInit::kType) {
+    const OvershootInit& o = static_cast<const OvershootInit&>(init);
+    Append(" %.9g %.9g %d %.9g %.9g %.9g %.9g %.9g %.9g %d",
+           o.range().start(), o.range().end(), o.modular() ? 1 : 0,
+           o.max_velocity(), o.max_delta(), o.at_target().max_difference,
+           o.at_target().max_velocity, o.accel_per_difference(),
+           o.wrong_direction_multiplier(), o.max_delta_time());
+  } else if (type == SpringInit::kType || type == EaseInEaseOutInit::kType ||
+             type == ConstInit::kType) {
+    const SimpleInit& s = static_cast<const SimpleInit&>(init);
+    const float* arrays[] = {s.start_values, s.start_derivatives};
+    for (size_t a = 0; a < MOTIVE_ARRAY_SIZE(arrays); ++a) {
+      Append(" %d", arrays[a] == nullptr ? 0 : 1);
+      if (arrays[a] == nullptr) continue;
+      for (MotiveDimension i = 0; i < dimensions; ++i) {
+        Append(" %.9g", arrays[a][i]);
+      }
+    }
+  } else if (type == RigInit::kType) {
+    const RigInit& r = static_cast<const RigInit&>(init);
+    Append(" %d %d", r.root_motion_bone(),
+           static_cast<int>(r.bone_mask().size()));
+    for (size_t i = 0; i < r.bone_mask().size(); ++i) {
+      Append(" %d", r.bone_mask()[i]);
+    }
+    AppendAnimName(r.defining_anim());
+  }
+  log_.push_back('\n');
+  num_calls_++;
+}
+
+void MotiveRecorder::RecordRemove(const Motivator* motivator) {
+  const auto it = ids_.find(motivator);
+  if (depth_ > 0 || it == ids_.end()) return;
+
+  Append("Remove %d\n", it->second);
+  ids_.erase(it);
+  num_calls_++;
+}
+
+// Moving a Motivator changes its address, but not its id, so nothing is
+// logged.
+void MotiveRecorder::RecordTransfer(const Motivator* from,
+                                    const Motivator* to) {
+  const auto it = ids_.find(from);
+  if (it == ids_.end()) return;
+
+  const int id = it->second;
+  ids_.erase(it);
+  ids_[to] = id;
+}
+
+void MotiveRecorder::RecordClone(const Motivator* dst, const Motivator* src) {
+  const int src_id = Id(src);
+  if (depth_ > 0 || src_id < 0) return;
+
+  const int id = next_id_++;
+  ids_[dst] = id;
+  Append("Clone %d %d\n", id, src_id);
+  num_calls_++;
+}
+
+void MotiveRecorder::RecordSetTargets(const Motivator* motivator,
+                                      MotiveDimension dimensions,
+                                      const MotiveTarget1f* targets) {
+  const int id = Id(motivator);
+  if (depth_ > 0 || id < 0) return;
+
+  Append("SetTargets %d %d", id, dimensions);
+  for (MotiveDimension i = 0; i < dimensions; ++i) {
+    const MotiveTarget1f& t = targets[i];
+    Append(" %d", t.num_nodes());
+    for (int j = 0; j < t.num_nodes(); ++j) {
+      const MotiveNode1f& n = t.Node(j);
+      Append(" %.9g %.9g %d %d", n.value, n.velocity, n.time, n.direction);
+    }
+  }
+  log_.push_back('\n');
+  num_calls_++;
+}
+
+void MotiveRecorder::RecordSetSplinePlaybackRate(const Motivator* motivator,
+                                                 float playback_rate) {
+  const int id = Id(motivator);
+  if (depth_ > 0 || id < 0) return;
+
+  Append("SetSplinePlaybackRate %d %.9g\n", id, playback_rate);
+  num_calls_++;
+}
+
+void MotiveRecorder::RecordBlendToAnim(const Motivator* motivator,
+                                       const RigAnim& anim,
+                                       const SplinePlayback& playback) {
+  const int id = Id(motivator);
+  if (depth_ > 0 || id < 0) return;
+
+  Append("BlendToAnim %d", id);
+  AppendPlayback(playback);
+  AppendAnimName(anim);
+  log_.push_back('\n');
+  num_calls_++;
+}
+
+void MotiveRecorder::RecordBlendToAnims(const Motivator* motivator,
+                                        const RigAnim** anims,
+                                        const SplinePlayback* playbacks,
+                                        const float* weights, int count) {
+  const int id = Id(motivator);
+  if (depth_ > 0 || id < 0) return;
+
+  Append("BlendToAnims %d %d", id, count);
+  for (int i = 0; i < count; ++i) {
+    Append(" %.9g", weights[i]);
+    AppendPlayback(playbacks[i]);
+    AppendAnimName(*anims[i]);
+  }
+  log_.push_back('\n');
+  num_calls_++;
+}
+
+void MotiveRecorder::RecordSetPlaybackRate(const Motivator* motivator,
+                                           float playback_rate) {
+  const int id = Id(motivator);
+  if (depth_ > 0 || id < 0) return;
+
+  Append("SetPlaybackRate %d %.9g\n", id, playback_rate);
+  num_calls_++;
+}
+
+void MotiveRecorder::RecordAdvanceFrame(MotiveTime delta_time) {
+  Append("AdvanceFrame %d\n", delta_time);
+  num_calls_++;
+}
+
+}  // namespace motive
@@ -0,0 +1,421 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "motive/util/replayer.h"
+
+#include <stdlib.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "motive/const_init.h"
+#include "motive/ease_in_ease_out_init.h"
+#include "motive/engine.h"
+#include "motive/rig_anim.h"
+#include "motive/rig_init.h"
+#include "motive/spline_init.h"
+#include "motive/spring_init.h"
+
+namespace motive {
+
+static const char kRecordingHeader[] = "motive_recording 1";
+
+// Floats are read with strtof(), since streams don't parse "inf", which
+// Range::Full() is recorded as.
+static bool ReadFloat(std::istream& in, float* f) {
+  std::string token;
+  if (!(in >> token)) return false;
+  char* end = nullptr;
+  *f = strtof(token.c_str(), &end);
+  return *end == '\0';
+}
+
+static bool ReadInt(std::istream& in, int* i) {
+  return static_cast<bool>(in >> *i);
+}
+
+// Read a name written by MotiveRecorder::AppendAnimName().
+static bool ReadName(std::istream& in, std::string* name) {
+  int length = 0;
+  char colon = '\0';
+  if (!(in >> length) || !in.get(colon) || colon != ':' || length < 0) {
+    return false;
+  }
+  name->resize(length);
+  return length == 0 || static_cast<bool>(in.read(&(*name)[0], length));
+}
+
+static bool ReadPlayback(std::istream& in, SplinePlayback* playback) {
+  int repeat = 0;
+  if (!ReadFloat(in, &playback->start_x) ||
+      !ReadFloat(in, &playback->blend_x) ||
+      !ReadFloat(in, &playback->playback_rate) ||
+      !ReadFloat(in, &playback->y_offset) ||
+      !ReadFloat(in, &playback->y_scale) || !ReadInt(in, &repeat)) {
+    return false;
+  }
+  playback->repeat = repeat != 0;
+  return true;
+}
+
+// Read a `has_values` flag, followed by `dimensions` floats if it's set.
+static bool ReadOptionalFloats(std::istream& in, MotiveDimension dimensions,
+                               bool* has_values, std::vector<float>* values) {
+  int flag = 0;
+  if (!ReadInt(in, &flag)) return false;
+  *has_values = flag != 0;
+  if (!*has_values) return true;
+
+  values->resize(dimensions);
+  for (MotiveDimension i = 0; i < dimensions; ++i) {
+    if (!ReadFloat(in, &(*values)[i])) return false;
+  }
+  return true;
+}
+
+static bool ReadTarget(std::istream& in, MotiveTarget1f* target) {
+  int num_nodes = 0;
+  if (!ReadInt(in, &num_nodes) || num_nodes < 0 ||
+      num_nodes > MotiveTarget1f::kMaxNodes) {
+    return false;
+  }
+
+  MotiveNode1f nodes[MotiveTarget1f::kMaxNodes];
+  for (int i = 0; i < num_nodes; ++i) {
+    int direction = 0;
+    if (!ReadFloat(in, &nodes[i].value) ||
+        !ReadFloat(in, &nodes[i].velocity) || !ReadInt(in, &nodes[i].time) ||
+        !ReadInt(in, &direction)) {
+      return false;
+    }
+    nodes[i].direction = static_cast<ModularDirection>(direction);
+  }
+
+  switch (num_nodes) {
+    case 0: *target = MotiveTarget1f(); break;
+    case 1: *target = MotiveTarget1f(nodes[0]); break;
+    case 2: *target = MotiveTarget1f(nodes[0], nodes[1]); break;
+    default: *target = MotiveTarget1f(nodes[0], nodes[1], nodes[2]); break;
+  }
+  return true;
+}
+
+// The SimpleInit types, which are all recorded the same way.
+static const MotivatorType* SimpleInitTypes() {
+  static const MotivatorType kTypes[] = {
+      SpringInit::kType, EaseInEaseOutInit::kType, ConstInit::kType,
+      kMotivatorTypeInvalid};
+  return kTypes;
+}
+
+MotiveReplayer::MotiveReplayer(MotiveEngine* engine)
+    : engine_(engine), next_call_(0), num_frames_(0), num_skipped_calls_(0) {}
+
+void MotiveReplayer::AddAnim(const RigAnim* anim) {
+  anims_[anim->anim_name()] = anim;
+}
+
+bool MotiveReplayer::Load(const char* file_name) {
+  std::ifstream file(file_name);
+  if (!file) return false;
+
+  std::string line;
+  if (!std::getline(file, line) || line != kRecordingHeader) return false;
+
+  calls_.clear();
+  num_frames_ = 0;
+  while (std::getline(file, line)) {
+    if (line.empty()) continue;
+    calls_.push_back(Call());
+    if (!Decode(line, &calls_.back())) return false;
+    if (calls_.back().type == kAdvanceFrame) num_frames_++;
+  }
+  Rewind();
+  return true;
+}
+
+bool MotiveReplayer::Decode(const std::string& line, Call* call) const {
+  std::istringstream in(line);
+  std::string name;
+  in >> name;
+  if (name == "AdvanceFrame") {
+    call->type = kAdvanceFrame;
+    return ReadInt(in, &call->delta_time);
+  }
+  if (!ReadInt(in, &call->id)) return false;
+
+  // Find each animation by name. Those that weren't added are nullptr.
+  auto read_anim = [this, &in, call]() -> bool {
+    std::string anim_name;
+    if (!ReadName(in, &anim_name)) return false;
+    const auto it = anims_.find(anim_name);
+    call->anims.push_back(it == anims_.end() ? nullptr : it->second);
+    return true;
+  };
+
+  if (name == "Initialize") {
+    call->type = kInitialize;
+    std::string type_name;
+    int dimensions = 0;
+    if (!(in >> type_name) || !ReadInt(in, &dimensions)) return false;
+    call->dimensions = static_cast<MotiveDimension>(dimensions);
+
+    if (type_name == SplineInit::kType->name) {
+      float start = 0.0f;
+      float end = 0.0f;
+      if (!ReadFloat(in, &start) || !ReadFloat(in, &end)) return false;
+      call->range = Range(start, end);
+      call->init_type = SplineInit::kType;
+    } else if (type_name == OvershootInit::kType->name) {
+      float start = 0.0f;
+      float end = 0.0f;
+      float max_velocity = 0.0f;
+      float max_delta = 0.0f;
+      float accel_per_difference = 0.0f;
+      float wrong_direction_multiplier = 0.0f;
+      int modular = 0;
+      MotiveTime max_delta_time = 0;
+      OvershootInit& o = call->overshoot;
+      if (!ReadFloat(in, &start) || !ReadFloat(in, &end) ||
+          !ReadInt(in, &modular) || !ReadFloat(in, &max_velocity) ||
+          !ReadFloat(in, &max_delta) ||
+          !ReadFloat(in, &o.at_target().max_difference) ||
+          !ReadFloat(in, &o.at_target().max_velocity) ||
+          !ReadFloat(in, &accel_per_difference) ||
+          !ReadFloat(in, &wrong_direction_multiplier) ||
+          !ReadInt(in, &max_delta_time)) {
+        return false;
+      }
+      o.set_range(Range(start, end));
+      o.set_modular(modular != 0);
+      o.set_max_velocity(max_velocity);
+      o.set_max_delta(max_delta);
+      o.set_accel_per_difference(accel_per_difference);
+      o.set_wrong_direction_multiplier(wrong_direction_multiplier);
+      o.set_max_delta_time(max_delta_time);
+      call->init_type = OvershootInit::kType;
+    } else if (type_name == RigInit::kType->name) {
+      int root_motion_bone = 0;
+      int mask_size = 0;
+      if (!ReadInt(in, &root_motion_bone) || !ReadInt(in, &mask_size)) {
+        return false;
+      }
+      call->root_motion_bone = static_cast<BoneIndex>(root_motion_bone);
+      for (int i = 0; i < mask_size; ++i) {
+        int bone = 0;
+        if (!ReadInt(in, &bone)) return false;
+        call->bone_mask.push_back(static_cast<BoneIndex>(bone));
+      }
+      if (!read_anim()) return false;
+      call->init_type = RigInit::kType;
+    } else {
+      for (const MotivatorType* t = SimpleInitTypes(); *t != nullptr; ++t) {
+        if (type_name != (*t)->name) continue;
+        if (!ReadOptionalFloats(in, call->dimensions, &call->has_start_values,
+                                &call->start_values) ||
+            !ReadOptionalFloats(in, call->dimensions,
+                                &call->has_start_derivatives,
+                                &call->start_derivatives)) {
+          return false;
+        }
+        call->init_type = *t;
+      }
+    }
+    // Other types keep an invalid `init_type`, and are skipped.
+    return true;
+  }
+
+  if (name == "Remove") {
+    call->type = kRemove;
+    return true;
+  }
+  if (name == "Clone") {
+    call->type = kClone;
+    return ReadInt(in, &call->source_id);
+  }
+  if (name == "SetTargets") {
+    call->type = kSetTargets;
+    int dimensions = 0;
+    if (!ReadInt(in, &dimensions) || dimensions < 0) return false;
+    call->targets.resize(dimensions);
+    for (int i = 0; i < dimensions; ++i) {
+      if (!ReadTarget(in, &call->targets[i])) return false;
+    }
+    return true;
+  }
+  if (name == "SetSplinePlaybackRate" || name == "SetPlaybackRate") {
+    call->type = name == "SetPlaybackRate" ? kSetPlaybackRate
+                                           : kSetSplinePlaybackRate;
+    return ReadFloat(in, &call->playback_rate);
+  }
+  if (name == "BlendToAnim") {
+    call->type = kBlendToAnim;
+    call->playbacks.resize(1);
+    return ReadPlayback(in, &call->playbacks[0]) && read_anim();
+  }
+  if (name == "BlendToAnims") {
+    call->type = kBlendToAnims;
+    int count = 0;
+    if (!ReadInt(in, &count) || count < 0) return false;
+    call->weights.resize(count);
+    call->playbacks.resize(count);
+    for (int i = 0; i < count; ++i) {
+      if (!ReadFloat(in, &call->weights[i]) ||
+          !ReadPlayback(in, &call->playbacks[i]) || !read_anim()) {
+        return false;
+      }
+    }
+    return true;
+  }
+  return false;
+}
+
+void MotiveReplayer::Rewind() {
+  vectors_.clear();
+  rigs_.clear();
+  next_call_ = 0;
+  num_skipped_calls_ = 0;
+}
+
+bool MotiveReplayer::ReplayFrame() {
+  if (next_call_ >= calls_.size()) return false;
+
+  while (next_call_ < calls_.size()) {
+    const Call& call = calls_[next_call_++];
+    if (!Replay(call)) {
+      num_skipped_calls_++;
+    }
+    if (call.type == kAdvanceFrame) break;
+  }
+  return true;
+}
+
+const MotivatorNf* MotiveReplayer::Vector(int id) const {
+  const auto it = vectors_.find(id);
+  return it == vectors_.end() ? nullptr : &it->second;
+}
+
+const RigMotivator* MotiveReplayer::Rig(int id) const {
+  const auto it = rigs_.find(id);
+  return it == rigs_.end() ? nullptr : &it->second;
+}
+
+bool MotiveReplayer::Initialize(const Call& call) {
+  const MotivatorType type = call.init_type;
+  if (type == SplineInit::kType) {
+    vectors_[call.id].Initialize(SplineInit(call.range), engine_,
+                                 call.dimensions);
+    return true;
+  }
+  if (type == OvershootInit::kType) {
+    vectors_[call.id].Initialize(call.overshoot, engine_, call.dimensions);
+    return true;
+  }
+  if (type == RigInit::kType) {
+    const RigAnim* anim = call.anims[0];
+    if (anim == nullptr) return false;
+    RigInit init(*anim, anim->bone_parents(), anim->NumBones(),
+                 call.root_motion_bone);
+    init.set_bone_mask(call.bone_mask);
+    rigs_[call.id].Initialize(init, engine_);
+    return true;
+  }
+  if (type == kMotivatorTypeInvalid) return false;
+
+  // One of the SimpleInitTypes().
+  const float* values =
+      call.has_start_values ? call.start_values.data() : nullptr;
+  const float* derivatives =
+      call.has_start_derivatives ? call.start_derivatives.data() : nullptr;
+  SimpleInit init(type, values, derivatives);
+  vectors_[call.id].Initialize(init, engine_, call.dimensions);
+  return true;
+}
+
+bool MotiveReplayer::Replay(const Call& call) {
+  if (call.type == kAdvanceFrame) {
+    engine_->AdvanceFrame(call.delta_time);
+    return true;
+  }
+  if (call.type == kInitialize) return Initialize(call);
+
+  const auto vector = vectors_.find(call.id);
+  const auto rig = rigs_.find(call.id);
+  const bool is_vector = vector != vectors_.end() && vector->second.Valid();
+  const bool is_rig = rig != rigs_.end() && rig->second.Valid();
+  switch (call.type) {
+    case kRemove:
+      if (vector != vectors_.end()) {
+        vectors_.erase(vector);
+        return true;
+      }
+      if (rig != rigs_.end()) {
+        rigs_.erase(rig);
+        return true;
+      }
+      return false;
+
+    case kClone: {
+      const auto source_vector = vectors_.find(call.source_id);
+      if (source_vector != vectors_.end()) {
+        vectors_[call.id].CloneFrom(&source_vector->second);
+        return true;
+      }
+      const auto source_rig = rigs_.find(call.source_id);
+      if (source_rig != rigs_.end()) {
+        rigs_[call.id].CloneFrom(&source_rig->second);
+        return true;
+      }
+      return false;
+    }
+
+    case kSetTargets:
+      if (!is_vector || vector->second.Dimensions() !=
+                          static_cast<MotiveDimension>(call.targets.size())) {
+        return false;
+      }
+      vector->second.SetTargets(call.targets.data());
+      return true;
+
+    case kSetSplinePlaybackRate:
+      if (!is_vector) return false;
+      vector->second.SetSplinePlaybackRate(call.playback_rate);
+      return true;
+
+    case kBlendToAnim:
+      if (!is_rig || call.anims[0] == nullptr) return false;
+      rig->second.BlendToAnim(*call.anims[0], call.playbacks[0]);
+      return true;
+
+    case kBlendToAnims:
+      if (!is_rig || std::find(call.anims.begin(), call.anims.end(),
+                               nullptr) != call.anims.end()) {
+        return false;
+      }
+      rig->second.BlendToAnims(const_cast<const RigAnim**>(call.anims.data()),
+                               call.playbacks.data(), call.weights.data(),
+                               static_cast<int>(call.anims.size()));
+      return true;
+
+    case kSetPlaybackRate:
+      if (!is_rig) return false;
+      rig->second.SetPlaybackRate(call.playback_rate);
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+}  // namespace motive
@@ -0,0 +1,220 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "motive/util/replication.h"
+
+#include <string.h>
+#include <limits>
+
+namespace motive {
+
+// Bits of the mask byte that starts each state. Each set bit, except
+// kRepeatBit, is followed by its field, in this order.
+static const uint8_t kSplineBit = 1 << 0;        // uint32 spline id
+static const uint8_t kXIndexBit = 1 << 1;        // uint16 x_index
+static const uint8_t kCubicXBit = 1 << 2;        // float cubic_x
+static const uint8_t kCubicXEndBit = 1 << 3;     // float cubic_x_end
+static const uint8_t kPlaybackRateBit = 1 << 4;  // float playback_rate
+static const uint8_t kYTransformBit = 1 << 5;    // float y_offset, y_scale
+static const uint8_t kRepeatBit = 1 << 6;        // The value of `repeat`.
+static const uint8_t kCubicBit = 1 << 7;         // 4 floats, constant first
+
+static bool SameFloat(float a, float b) {
+  return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+static bool SameCubic(const CubicCurve& a, const CubicCurve& b) {
+  for (int i = 0; i < CubicCurve::kNumCoeff; ++i) {
+    if (!SameFloat(a.Coeff(i), b.Coeff(i))) return false;
+  }
+  return true;
+}
+
+static void WriteUint(uint32_t value, size_t num_bytes,
+                      std::vector<uint8_t>* out) {
+  for (size_t i = 0; i < num_bytes; ++i) {
+    out->push_back(static_cast<uint8_t>(value >> (8 * i)));
+  }
+}
+
+static void WriteFloat(float value, std::vector<uint8_t>* out) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  WriteUint(bits, sizeof(bits), out);
+}
+
+namespace {
+
+// Reads little endian fields, and remembers if it ran out of data.
+class WireReader {
+ public:
+  WireReader(const uint8_t* data, size_t size)
+      : data_(data), size_(size), offset_(0), ok_(true) {}
+
+  uint32_t Uint(size_t num_bytes) {
+    if (!ok_ || num_bytes > size_ - offset_) {
+      ok_ = false;
+      return 0;
+    }
+    uint32_t value = 0;
+    for (size_t i = 0; i < num_bytes; ++i) {
+      value |= static_cast<uint32_t>(data_[offset_ + i]) << (8 * i);
+    }
+    offset_ += num_bytes;
+    return value;
+  }
+
+  float Float() {
+    const uint32_t bits = Uint(sizeof(uint32_t));
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  size_t offset() const { return offset_; }
+  bool ok() const { return ok_; }
+
+ private:
+  const uint8_t* data_;
+  size_t size_;
+  size_t offset_;
+  bool ok_;
+};
+
+}  // namespace
+
+SplineStateCodec::SplineStateCodec(const CompactSpline* const* splines,
+                                   int num_splines)
+    : splines_(splines), num_splines_(num_splines) {
+  for (int i = 0; i < num_splines; ++i) {
+    // If a spline appears twice, send it as its first id.
+    ids_.insert(std::make_pair(splines[i], static_cast<uint32_t>(i)));
+  }
+}
+
+uint32_t SplineStateCodec::SplineId(const CompactSpline* spline) const {
+  if (spline == nullptr) return kNoSpline;
+  const auto it = ids_.find(spline);
+  return it == ids_.end() ? kNoSpline : it->second;
+}
+
+SplineState SplineStateCodec::WireState(const SplineState& state) const {
+  if (state.spline == nullptr || SplineId(state.spline) != kNoSpline) {
+    return state;
+  }
+
+  // Same as BulkSplineEvaluator::ClearSplines(), but at the current value.
+  SplineState constant = state;
+  constant.spline = nullptr;
+  constant.cubic =
+      CubicCurve(0.0f, 0.0f, 0.0f, state.cubic.Evaluate(state.cubic_x));
+  constant.cubic_x = 0.0f;
+  constant.cubic_x_end = std::numeric_limits<float>::infinity();
+  constant.x_index = kInvalidSplineIndex;
+  return constant;
+}
+
+void SplineStateCodec::Encode(const SplineState* states,
+                              const SplineState* previous, size_t count,
+                              std::vector<uint8_t>* out) const {
+  const SplineState kDefault;
+  for (size_t i = 0; i < count; ++i) {
+    const SplineState s = WireState(states[i]);
+    const SplineState p =
+        previous == nullptr ? kDefault : WireState(previous[i]);
+    const uint32_t id = SplineId(s.spline);
+
+    uint8_t mask = s.repeat ? kRepeatBit : 0;
+    if (id != SplineId(p.spline)) mask |= kSplineBit;
+    if (s.x_index != p.x_index) mask |= kXIndexBit;
+    if (!SameFloat(s.cubic_x, p.cubic_x)) mask |= kCubicXBit;
+    if (!SameFloat(s.cubic_x_end, p.cubic_x_end)) mask |= kCubicXEndBit;
+    if (!SameFloat(s.playback_rate, p.playback_rate)) {
+      mask |= kPlaybackRateBit;
+    }
+    if (!SameFloat(s.y_offset, p.y_offset) ||
+        !SameFloat(s.y_scale, p.y_scale)) {
+      mask |= kYTransformBit;
+    }
+    if (!SameCubic(s.cubic, p.cubic)) mask |= kCubicBit;
+
+    out->push_back(mask);
+    if (mask & kSplineBit) WriteUint(id, 4, out);
+    if (mask & kXIndexBit) WriteUint(s.x_index, 2, out);
+    if (mask & kCubicXBit) WriteFloat(s.cubic_x, out);
+    if (mask & kCubicXEndBit) WriteFloat(s.cubic_x_end, out);
+    if (mask & kPlaybackRateBit) WriteFloat(s.playback_rate, out);
+    if (mask & kYTransformBit) {
+      WriteFloat(s.y_offset, out);
+      WriteFloat(s.y_scale, out);
+    }
+    if (mask & kCubicBit) {
+      for (int j = 0; j < CubicCurve::kNumCoeff; ++j) {
+        WriteFloat(s.cubic.Coeff(j), out);
+      }
+    }
+  }
+}
+
+size_t SplineStateCodec::Decode(const uint8_t* data, size_t size,
+                                const SplineState* previous, size_t count,
+                                SplineState* states) const {
+  WireReader reader(data, size);
+  for (size_t i = 0; i < count; ++i) {
+    SplineState s = previous == nullptr ? SplineState() : previous[i];
+    const uint8_t mask = static_cast<uint8_t>(reader.Uint(1));
+    if (mask & kSplineBit) {
+      const uint32_t id = reader.Uint(4);
+      if (id != kNoSpline && id >= static_cast<uint32_t>(num_splines_)) {
+        return 0;
+      }
+      s.spline = id == kNoSpline ? nullptr : splines_[id];
+    }
+    if (mask & kXIndexBit) {
+      s.x_index = static_cast<CompactSplineIndex>(reader.Uint(2));
+    }
+    if (mask & kCubicXBit) s.cubic_x = reader.Float();
+    if (mask & kCubicXEndBit) s.cubic_x_end = reader.Float();
+    if (mask & kPlaybackRateBit) s.playback_rate = reader.Float();
+    if (mask & kYTransformBit) {
+      s.y_offset = reader.Float();
+      s.y_scale = reader.Float();
+    }
+    if (mask & kCubicBit) {
+      float c[CubicCurve::kNumCoeff];
+      for (int j = 0; j < CubicCurve::kNumCoeff; ++j) {
+        c[j] = reader.Float();
+      }
+      s.cubic = CubicCurve(c[3], c[2], c[1], c[0]);
+    }
+    s.repeat = (mask & kRepeatBit) != 0;
+    if (!reader.ok()) return 0;
+
+    // A node past the end of the spline would be read out of bounds.
+    if (s.spline != nullptr && !OutsideSpline(s.x_index) &&
+        s.x_index >= s.spline->num_nodes()) {
+      return 0;
+    }
+    states[i] = s;
+  }
+  return reader.offset();
+}
+
+size_t SplineStateCodec::MaxEncodedSize(size_t count) {
+  // Mask, spline id, x_index, five floats and the cubic.
+  const size_t kMaxStateSize = 1 + 4 + 2 + 5 * 4 + CubicCurve::kNumCoeff * 4;
+  return count * kMaxStateSize;
+}
+
+}  // namespace motive
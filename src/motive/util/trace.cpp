@@ -0,0 +1,106 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "motive/util/trace.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+
+namespace motive {
+
+namespace detail {
+
+std::atomic<MotiveTraceSink*> g_trace_sink(nullptr);
+
+}  // namespace detail
+
+void SetMotiveTraceSink(MotiveTraceSink* sink) {
+  detail::g_trace_sink.store(sink, std::memory_order_release);
+}
+
+uint64_t TraceTimeNs() {
+  typedef std::chrono::steady_clock Clock;
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          Clock::now().time_since_epoch())
+          .count());
+}
+
+ChromeTraceWriter::ChromeTraceWriter() : start_ns_(TraceTimeNs()) {}
+
+void ChromeTraceWriter::BeginSpan(const char* name, const char* owner,
+                                  uint64_t time_ns) {
+  Record(name, owner, time_ns, true);
+}
+
+void ChromeTraceWriter::EndSpan(const char* name, const char* owner,
+                                uint64_t time_ns) {
+  Record(name, owner, time_ns, false);
+}
+
+void ChromeTraceWriter::Record(const char* name, const char* owner,
+                               uint64_t time_ns, bool begin) {
+  const std::thread::id id = std::this_thread::get_id();
+  std::lock_guard<std::mutex> lock(mutex_);
+  const std::vector<std::thread::id>::iterator it =
+      std::find(threads_.begin(), threads_.end(), id);
+  const int thread = static_cast<int>(it - threads_.begin());
+  if (it == threads_.end()) {
+    threads_.push_back(id);
+  }
+
+  Event e;
+  e.name = name;
+  e.owner = owner;
+  e.time_ns = time_ns;
+  e.thread = thread;
+  e.begin = begin;
+  events_.push_back(e);
+}
+
+void ChromeTraceWriter::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  events_.clear();
+  start_ns_ = TraceTimeNs();
+}
+
+size_t ChromeTraceWriter::NumEvents() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return events_.size();
+}
+
+bool ChromeTraceWriter::Write(const char* file_name) const {
+  FILE* file = fopen(file_name, "w");
+  if (file == nullptr) return false;
+
+  // Names are identifiers, so they need no escaping. Times are in
+  // microseconds, which the format allows to be fractional.
+  std::lock_guard<std::mutex> lock(mutex_);
+  fprintf(file, "{\"traceEvents\": [");
+  for (size_t i = 0; i < events_.size(); ++i) {
+    const Event& e = events_[i];
+    const double usec = (static_cast<double>(e.time_ns) -
+                         static_cast<double>(start_ns_)) * 1e-3;
+    fprintf(file,
+            "%s\n  {\"name\": \"%s::%s\", \"cat\": \"motive\", \"ph\": "
+            "\"%c\", \"ts\": %.3f, \"pid\": 0, \"tid\": %d}",
+            i == 0 ? "" : ",", e.owner, e.name, e.begin ? 'B' : 'E', usec,
+            e.thread);
+  }
+  fprintf(file, "\n], \"displayTimeUnit\": \"ns\"}\n");
+  return fclose(file) == 0;
+}
+
+}  // namespace motive
@@ -0,0 +1,136 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Bake .motiveanim files into a pose texture, for crowds that are animated
+// on the GPU. See motive::PoseTexture for the layout.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "motive/anim_table.h"
+#include "motive/pose_texture.h"
+
+using motive::AnimTable;
+using motive::PoseTexture;
+
+static void PrintUsage() {
+  printf(
+      "Usage: pose_baker [-f float|half|quantized] [-t FRAME_TIME]\n"
+      "                  -o OUTPUT_FILE ANIM_FILE...\n"
+      "\n"
+      "Bake the global bone transforms of every ANIM_FILE into one pose\n"
+      "texture, one clip per file, in the order given. Every ANIM_FILE must\n"
+      "animate the same rig.\n\n"
+      "Options:\n"
+      "  -f, --format FORMAT\n"
+      "                element format of the texels. Defaults to half.\n"
+      "  -t, --frame_time FRAME_TIME\n"
+      "                maximum time between frames, in the units of the\n"
+      "                animations. Defaults to 33.\n"
+      "  -o, --out OUTPUT_FILE\n"
+      "                file to write the texture and its metadata to.\n");
+}
+
+static const char* LoadFile(const char* file_name, std::string* scratch_buf) {
+  std::ifstream file(file_name, std::ios::binary);
+  if (!file) return nullptr;
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  *scratch_buf = contents.str();
+  return scratch_buf->c_str();
+}
+
+static bool ParseFormat(const char* arg, PoseTexture::Format* format) {
+  if (strcmp(arg, "float") == 0) {
+    *format = PoseTexture::kFloat;
+  } else if (strcmp(arg, "half") == 0) {
+    *format = PoseTexture::kHalf;
+  } else if (strcmp(arg, "quantized") == 0) {
+    *format = PoseTexture::kQuantized;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  PoseTexture::Format format = PoseTexture::kHalf;
+  float frame_time = 33.0f;
+  std::string out_file;
+  AnimTable::ListFileNames anim_files;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if ((arg == "-f" || arg == "--format") && has_value) {
+      if (!ParseFormat(argv[++i], &format)) {
+        fprintf(stderr, "Unknown format '%s'.\n", argv[i]);
+        return 1;
+      }
+    } else if ((arg == "-t" || arg == "--frame_time") && has_value) {
+      frame_time = static_cast<float>(atof(argv[++i]));
+    } else if ((arg == "-o" || arg == "--out") && has_value) {
+      out_file = argv[++i];
+    } else if (arg == "-h" || arg == "--help") {
+      PrintUsage();
+      return 0;
+    } else if (!arg.empty() && arg[0] == '-') {
+      fprintf(stderr, "Unknown option '%s'.\n", arg.c_str());
+      PrintUsage();
+      return 1;
+    } else {
+      anim_files.push_back(arg);
+    }
+  }
+  if (out_file.empty() || anim_files.empty() || frame_time <= 0.0f) {
+    PrintUsage();
+    return 1;
+  }
+
+  AnimTable table;
+  if (!table.InitFromAnimFileNames(anim_files, LoadFile)) {
+    fprintf(stderr, "Failed to load the animations.\n");
+    return 1;
+  }
+
+  std::vector<int> anim_indices(anim_files.size());
+  for (size_t i = 0; i < anim_indices.size(); ++i) {
+    anim_indices[i] = static_cast<int>(i);
+  }
+  PoseTexture texture;
+  if (!texture.Bake(table, 0, anim_indices.data(),
+                    static_cast<int>(anim_indices.size()), frame_time,
+                    format)) {
+    fprintf(stderr, "Animations must all animate the same rig.\n");
+    return 1;
+  }
+
+  std::vector<uint8_t> buffer;
+  texture.Serialize(&buffer);
+  std::ofstream out(out_file.c_str(), std::ios::binary);
+  out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+  if (!out) {
+    fprintf(stderr, "Failed to write '%s'.\n", out_file.c_str());
+    return 1;
+  }
+  printf("Baked %d clips into a %dx%d texture, %zu bytes.\n",
+         static_cast<int>(texture.clips().size()), texture.width(),
+         texture.height(), buffer.size());
+  return 0;
+}
@@ -15,6 +15,7 @@
 #include "motive/engine.h"
 #include "motive/init.h"
 #include "motive/math/curve.h"
+#include "motive/soa_processor_template.h"
 
 using motive::MotivatorInit;
 using motive::MotiveProcessorNf;
@@ -26,6 +27,7 @@ using motive::MotiveTarget1f;
 using motive::MotivatorType;
 using motive::MotiveNode1f;
 using motive::Motivator1f;
+using motive::SoaProcessorTemplate;
 using mathfu::vec2;
 
 //! [Own Processor LinearInit]
@@ -48,29 +50,32 @@ class LinearInit : public MotivatorInit {
 //! [Own Processor LinearInit]
 
 //! [Own Processor LinearMotiveProcessor]
-class LinearMotiveProcessor : public MotiveProcessorNf {
+// The per-index state is a target value and a target time. Deriving from
+// SoaProcessorTemplate stores each of them in its own contiguous array, and
+// handles moving and resizing indices for us.
+class LinearMotiveProcessor : public SoaProcessorTemplate<float, float> {
  public:
   virtual ~LinearMotiveProcessor() {}
 
   // Once per frame, the MotiveEngine calls this function. In this one call,
   // we advance the simulation of _all_ linear Motivators. Bulk processing
-  // allows us to use SIMD or multi-threading when appropriate.
+  // allows us to use SIMD or multi-threading when appropriate. Since each
+  // field is a separate array, the compiler can vectorize this loop.
   virtual void AdvanceFrame(MotiveTime delta_time) {
-    // We could optimize this using SIMD.
-    for (size_t i = 0; i < data_.size(); ++i) {
-      LinearData& d = data_[i];
-      float& value = values_[i];
-
+    float* values = values_.data();
+    const float* target_values = TargetValueArray();
+    float* target_times = TargetTimeArray();
+    const float dt = static_cast<float>(delta_time);
+    for (size_t i = 0; i < values_.size(); ++i) {
       // Advance the value by linearly interpolating towards the target.
-      if (d.target_time > 0.0f) {
-        const float percent_complete = delta_time / d.target_time;
-        value = mathfu::Lerp(value, d.target_value, percent_complete);
-      } else {
-        value = d.target_value;
-      }
+      const float percent_complete = dt / target_times[i];
+      values[i] = target_times[i] > 0.0f
+                      ? mathfu::Lerp(values[i], target_values[i],
+                                     percent_complete)
+                      : target_values[i];
 
       // Decrement the target time.
-      d.target_time -= delta_time;
+      target_times[i] -= dt;
     }
   }
 
@@ -78,24 +83,20 @@ class LinearMotiveProcessor : public MotiveProcessorNf {
   virtual int Priority() const { return 0; }
 
   // Accessors to allow the user to get and set simulation values.
-  virtual const float* Values(MotiveIndex index) const {
-    return &values_[index];
-  }
   virtual void Velocities(MotiveIndex index, MotiveDimension dimensions,
                           float* out) const {
-    const LinearData* d = &Data(index);
-    const float* values = &values_[index];
-    for (MotiveDimension i = 0; i < dimensions; ++i, ++d, ++values) {
-      out[i] = d->target_time <= 0.0f ? 0.0f : (d->target_value - *values) /
-                                                   d->target_time;
+    for (MotiveIndex i = index; i < index + dimensions; ++i) {
+      const float target_time = TargetTimeArray()[i];
+      out[i - index] = target_time <= 0.0f
+                           ? 0.0f
+                           : (TargetValueArray()[i] - values_[i]) /
+                                 target_time;
     }
   }
   virtual void TargetValues(MotiveIndex index, MotiveDimension dimensions,
                             float* out) const {
-    const LinearData* d = &Data(index);
-    for (MotiveDimension i = 0; i < dimensions; ++i, ++d) {
-      out[i] = d->target_value;
-    }
+    std::copy(TargetValueArray() + index,
+              TargetValueArray() + index + dimensions, out);
   }
   virtual void TargetVelocities(MotiveIndex /*index*/, MotiveDimension dimensions,
                                 float* out) const {
@@ -105,18 +106,16 @@ class LinearMotiveProcessor : public MotiveProcessorNf {
   }
   virtual void Differences(MotiveIndex index, MotiveDimension dimensions,
                            float* out) const {
-    const LinearData* d = &Data(index);
-    const float* values = &values_[index];
-    for (MotiveDimension i = 0; i < dimensions; ++i, ++d, ++values) {
-      out[i] = d->target_value - *values;
+    for (MotiveIndex i = index; i < index + dimensions; ++i) {
+      out[i - index] = TargetValueArray()[i] - values_[i];
     }
   }
   virtual MotiveTime TargetTime(MotiveIndex index,
                                 MotiveDimension dimensions) const {
     MotiveTime greatest = std::numeric_limits<MotiveTime>::min();
-    for (MotiveDimension i = 0; i < dimensions; ++i) {
+    for (MotiveIndex i = index; i < index + dimensions; ++i) {
       greatest = std::max(greatest,
-                          static_cast<MotiveTime>(Data(index).target_time));
+                          static_cast<MotiveTime>(TargetTimeArray()[i]));
     }
     return greatest;
   }
@@ -127,7 +126,6 @@ class LinearMotiveProcessor : public MotiveProcessorNf {
   virtual void SetTargets(MotiveIndex index, MotiveDimension dimensions,
                           const MotiveTarget1f* ts) {
     for (int i = 0; i < dimensions; ++i) {
-      LinearData& d = Data(index + i);
       const MotiveTarget1f& t = ts[i];
 
       // If the first node specifies time=0, that means we want to override the
@@ -139,91 +137,43 @@ class LinearMotiveProcessor : public MotiveProcessorNf {
       }
 
       // If the first node specifies time > 0, that means we want to override
-      // the
-      // target values with it. Or, if two nodes are specified, we use the
+      // the target values with it. Or, if two nodes are specified, we use the
       // second for the target values.
       const MotiveNode1f* target_node =
           override_current ? (t.num_nodes() > 1 ? &t.Node(1) : nullptr)
                            : &node0;
       if (target_node != nullptr) {
-        d.target_value = target_node->value;
-        d.target_time = static_cast<float>(target_node->time);
+        TargetValueArray()[index + i] = target_node->value;
+        TargetTimeArray()[index + i] = static_cast<float>(target_node->time);
       }
     }
   }
 
  protected:
-  struct LinearData {
-    float target_value;
-    float target_time;
-
-    LinearData() { Reset(); }
-    void Reset() {
-      target_value = 0.0f;
-      target_time = 0.0f;
-    }
-  };
+  // Positions of the per-index fields in our SoaProcessorTemplate.
+  enum { kTargetValue, kTargetTime };
 
   // When an Motivator is initialized with LinearInit, this function will
-  // be called. We initialize data for the new Motivator.
-  virtual void InitializeIndices(const MotivatorInit& init, MotiveIndex index,
-                                 MotiveDimension dimensions,
+  // be called. The base class has already reset the fields of unused indices
+  // to 0, which is the state we want for new Motivators.
+  virtual void InitializeIndices(const MotivatorInit& init,
+                                 MotiveIndex /*index*/,
+                                 MotiveDimension /*dimensions*/,
                                  MotiveEngine* /*engine*/) {
     (void)init;
     assert(init.type() == LinearInit::kType);
-    for (MotiveIndex i = index; i < index + dimensions; ++i) {
-      Data(i).Reset();
-      values_[i] = 0;
-    }
   }
 
-  // This function is called when an index is removed. We don't have to do
-  // anything, but for ease of debugging, we call reset.
-  virtual void RemoveIndices(MotiveIndex index, MotiveDimension dimensions) {
-    for (MotiveIndex i = index; i < index + dimensions; ++i) {
-      Data(i).Reset();
-      values_[i] = 0;
-    }
-  }
-
-  // The base class endeavors to keep our data contiguous in memory, so
-  // whenever Defragment() is called, we may shuffle some indices around.
-  virtual void MoveIndices(MotiveIndex old_index, MotiveIndex new_index,
-                           MotiveDimension dimensions) {
-    MotiveIndex old_i = old_index;
-    MotiveIndex new_i = new_index;
-    for (MotiveDimension i = 0; i < dimensions; ++i, ++new_i, ++old_i) {
-      data_[new_i] = data_[old_i];
-      values_[new_i] = values_[old_i];
-    }
-  }
-
-  // When new Motivators are being added or removed, this function may be
-  // called. As we grow, resize() might cause reallocs to occur, which is
-  // slow. However, once we reach the high-water mark, reallocs will stop.
-  // This is a reasonable tradeoff between the benefits and slowdowns of
-  // dynamically growing arrays.
-  virtual void SetNumIndices(MotiveIndex num_indices) {
-    data_.resize(num_indices);
-    values_.resize(num_indices);
-  }
-
-  // Handy accessors that double-check the validity of 'index'.
-  const LinearData& Data(MotiveIndex index) const {
-    assert(ValidIndex(index));
-    return data_[index];
+  // Handy accessors for the contiguous array of each field. During
+  // Defragment(), the base class plugs the holes from indices that have been
+  // removed. This allows us to process data by streaming it in, and maximize
+  // memory bandwidth.
+  float* TargetValueArray() { return Field<kTargetValue>().data(); }
+  const float* TargetValueArray() const {
+    return Field<kTargetValue>().data();
   }
-
-  LinearData& Data(MotiveIndex index) {
-    assert(ValidIndex(index));
-    return data_[index];
-  }
-
-  // Contiguous array of data. During Defragment(), we plug the holes from
-  // indices that have been removed. This allows us to process data by
-  // streaming it in, and maximize memory bandwidth.
-  std::vector<LinearData> data_;
-  std::vector<float> values_;
+  float* TargetTimeArray() { return Field<kTargetTime>().data(); }
+  const float* TargetTimeArray() const { return Field<kTargetTime>().data(); }
 };
 
 MOTIVE_INSTANCE(LinearInit, LinearMotiveProcessor);
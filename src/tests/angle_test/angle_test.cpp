@@ -114,6 +114,19 @@ TEST_F(AngleTests, ModAbovePi) {
   EXPECT_TRUE(a.IsValid());
 }
 
+// Normalizing many angles at once should match normalizing them one by one.
+TEST_F(AngleTests, NormalizeWithinThreePi) {
+  const float angles[] = {-kPi,         kPi,          below_negative_pi_,
+                          above_pi_,    0.0f,         2.5f * kPi,
+                          -2.5f * kPi,  kHalfPi,      -kQuarterPi};
+  const size_t kNumAngles = sizeof(angles) / sizeof(angles[0]);
+  float normalized[kNumAngles];
+  Angle::NormalizeWithinThreePi(angles, kNumAngles, normalized);
+  for (size_t i = 0; i < kNumAngles; ++i) {
+    EXPECT_EQ(Angle::FromWithinThreePi(angles[i]).ToRadians(), normalized[i]);
+  }
+}
+
 // Addition should use modular arithmetic.
 TEST_F(AngleTests, Addition) {
   const Angle sum = half_pi_ + half_pi_ + half_pi_ + half_pi_;
@@ -22,6 +22,7 @@ using motive::QuadraticInitWithOrigin;
 using motive::QuadraticInitWithPoint;
 using motive::CubicCurve;
 using motive::CubicInit;
+using motive::FixedCubic;
 using motive::Range;
 using mathfu::vec2;
 using mathfu::vec2i;
@@ -261,6 +262,88 @@ TEST_F(CurveTests, CubicWithWidth) {
   EXPECT_LT(std::fabs(c.Evaluate(init.width_x) - init.end_y), epsilon);
 }
 
+// The batch initializer should give exactly the same coefficients as
+// CubicCurve::Init(), including for zero widths.
+TEST_F(CurveTests, InitCubicCoefficientsMatchesInit) {
+  static const int kNumCubics = 6;
+  const float start_y[kNumCubics] = {1.0f, 0.0f, -3.0f, 0.5f, 2.0f, 7.0f};
+  const float start_derivative[kNumCubics] = {-8.0f, 0.0f, 1.0f,
+                                              0.1f,  -2.0f, 3.0f};
+  const float end_y[kNumCubics] = {0.3f, 1.0f, -3.0f, 0.25f, 0.0f, -1.0f};
+  const float end_derivative[kNumCubics] = {-4.0f, 0.0f, -1.0f,
+                                            0.0f,  5.0f, 0.2f};
+  const float width_x[kNumCubics] = {1.0f, 0.0f, 10.0f, 0.001f, 3.5f, 100.0f};
+
+  float c[CubicCurve::kNumCoeff][kNumCubics];
+  float* const coefficients[] = {c[0], c[1], c[2], c[3]};
+  motive::InitCubicCoefficients(start_y, start_derivative, end_y,
+                                end_derivative, width_x, kNumCubics,
+                                coefficients);
+  for (int i = 0; i < kNumCubics; ++i) {
+    const CubicCurve expected(CubicInit(start_y[i], start_derivative[i],
+                                        end_y[i], end_derivative[i],
+                                        width_x[i]));
+    EXPECT_EQ(expected, CubicCurve(c[3][i], c[2][i], c[1][i], c[0][i]));
+  }
+}
+
+// EvaluateFixed() should be within 2^-25 of the largest coefficient, once the
+// cubic is scaled to the range [0, 1]. Test curves of very different scales.
+TEST_F(CurveTests, FixedCubicEvaluateWithinBound) {
+  const float kWidths[] = {0.01f, 1.0f, 37.0f, 4000.0f};
+  const float kYScales[] = {0.001f, 1.0f, 250.0f};
+  for (size_t w = 0; w < MOTIVE_ARRAY_SIZE(kWidths); ++w) {
+    for (size_t s = 0; s < MOTIVE_ARRAY_SIZE(kYScales); ++s) {
+      const float width = kWidths[w];
+      const float y = kYScales[s];
+      const CubicCurve c(CubicInit(-0.3f * y, 2.0f * y / width, 0.7f * y,
+                                   -1.5f * y / width, width));
+      for (int i = 0; i <= 10; ++i) {
+        FixedCubic fixed;
+        fixed.Init(c, width * 0.1f * i, width);
+
+        double max_coeff = 0.0;
+        for (int k = 0; k < CubicCurve::kNumCoeff; ++k) {
+          max_coeff = std::max(
+              max_coeff,
+              std::fabs(c.Coeff(k) * std::pow(2.0, k * fixed.x_shift())));
+        }
+        const double x = fixed.X();
+        const double exact =
+            ((c.Coeff(3) * x + c.Coeff(2)) * x + c.Coeff(1)) * x + c.Coeff(0);
+        const double fixed_y =
+            static_cast<double>(fixed.EvaluateFixed()) * fixed.y_unit();
+        EXPECT_NEAR(exact, fixed_y, max_coeff * std::pow(2.0, -25.0));
+        EXPECT_NEAR(c.Evaluate(fixed.X()), fixed.Evaluate(),
+                    max_coeff * std::pow(2.0, -21.0));
+      }
+    }
+  }
+}
+
+// Advance() should add each step exactly, and report the step that passes the
+// end of the curve.
+TEST_F(CurveTests, FixedCubicAdvance) {
+  static const float kWidth = 100.0f;
+  static const float kDeltaX = 16.0f;
+  static const float kPlaybackRate = 0.75f;
+  FixedCubic fixed;
+  fixed.Init(CubicCurve(0.0f, 0.0f, 1.0f, 0.0f), 0.0f, kWidth);
+  const int64_t delta_x = FixedCubic::DeltaX(kDeltaX);
+  const int32_t rate = FixedCubic::PlaybackRate(kPlaybackRate);
+
+  // 100 / (16 * 0.75) = 8.33, so the ninth step passes the end.
+  for (int i = 1; i < 9; ++i) {
+    EXPECT_FALSE(fixed.Advance(delta_x, rate));
+    EXPECT_EQ(i * kDeltaX * kPlaybackRate, fixed.X());
+    EXPECT_EQ(fixed.X(), fixed.Evaluate());
+  }
+  EXPECT_TRUE(fixed.Advance(delta_x, rate));
+
+  // Converting back to a CubicCurve should give the same curve.
+  EXPECT_EQ(CubicCurve(0.0f, 0.0f, 1.0f, 0.0f), fixed.ToCubic());
+}
+
 typedef void ShiftFn(float shift, CubicCurve* c);
 static void ShiftLeft(float shift, CubicCurve* c) { c->ShiftLeft(shift); }
 static void ShiftRight(float shift, CubicCurve* c) { c->ShiftRight(shift); }
@@ -158,6 +158,19 @@ TEST_F(FloatingPointTests, ClampNearZero) {
   EXPECT_EQ(0.00001f, motive::ClampNearZero(0.00001f, 0.000001f));
 }
 
+TEST_F(FloatingPointTests, FloatToHalf) {
+  EXPECT_EQ(0x0000, motive::FloatToHalf(0.0f));
+  EXPECT_EQ(0x8000, motive::FloatToHalf(-0.0f));
+  EXPECT_EQ(0x3C00, motive::FloatToHalf(1.0f));
+  EXPECT_EQ(0xC000, motive::FloatToHalf(-2.0f));
+  EXPECT_EQ(0x3555, motive::FloatToHalf(1.0f / 3.0f));
+  EXPECT_EQ(0x7BFF, motive::FloatToHalf(65504.0f));
+  EXPECT_EQ(0x7C00, motive::FloatToHalf(100000.0f));
+  EXPECT_EQ(0x7C00, motive::FloatToHalf(kInfinity));
+  EXPECT_EQ(0x0001, motive::FloatToHalf(motive::ExponentFromInt(-24)));
+  EXPECT_EQ(0x0000, motive::FloatToHalf(motive::ExponentFromInt(-30)));
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
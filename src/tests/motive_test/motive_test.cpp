@@ -12,6 +12,12 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
 #include "flatbuffers/flatbuffers.h"
 #include "gtest/gtest.h"
 #include "mathfu/constants.h"
@@ -21,12 +27,26 @@
 #include "motive/engine.h"
 #include "motive/math/angle.h"
 #include "motive/math/curve_util.h"
+#include "motive/math/transform_kernels.h"
 #include "motive/matrix_init.h"
 #include "motive/matrix_motivator.h"
 #include "motive/matrix_op.h"
+#include "motive/motivator_handle.h"
 #include "motive/overshoot_init.h"
+#include "motive/rig_anim.h"
+#include "motive/rig_anim_sampler.h"
+#include "motive/rig_init.h"
+#include "motive/rig_motivator.h"
 #include "motive/spline_init.h"
+#include "motive/spline_processor.h"
+#include "motive/spring_init.h"
 #include "motive/sqt_init.h"
+#include "motive/task_scheduler.h"
+#include "motive/thread_pool.h"
+#include "motive/util/recorder.h"
+#include "motive/util/replayer.h"
+#include "motive/util/replication.h"
+#include "motive/util/trace.h"
 
 #define DEBUG_PRINT_MATRICES 0
 
@@ -76,6 +96,7 @@ using motive::Range;
 using motive::Settled1f;
 using motive::SimpleInitTemplate;
 using motive::SplineInit;
+using motive::SplineMotivator3f;
 using motive::SplinePlayback;
 using motive::SqtInit;
 
@@ -230,6 +251,9 @@ class MotiveTests : public ::testing::Test {
     motive::EaseInEaseOutInit::Register();
     motive::MatrixInit::Register();
     motive::SqtInit::Register();
+    motive::RigInit::Register();
+    motive::SpringInit::Register();
+    motive::ConstInit::Register();
 
     // Create an OvershootInit with reasonable values.
     overshoot_angle_init_.set_modular(true);
@@ -524,6 +548,30 @@ void EventuallySettles(MotiveTests& t) {
 }
 TEST_ALL_VECTOR_MOTIVATORS_F(EventuallySettles)
 
+// Settled overshoot motivators stop being processed, but should stay on their
+// target and wake up again when given a new one.
+TEST_F(MotiveTests, SettledOvershootWakesOnNewTarget) {
+  Motivator1f motivator;
+  InitOvershootMotivator(&motivator);
+  TimeToSettle(motivator, overshoot_percent_init_.at_target());
+  for (int i = 0; i < 10; ++i) {
+    engine_.AdvanceFrame(kTimePerFrame);
+  }
+  const float settled_value = motivator.Value();
+  EXPECT_EQ(motivator.TargetValue(), settled_value);
+  EXPECT_EQ(0.0f, motivator.Velocity());
+
+  engine_.AdvanceFrame(kTimePerFrame);
+  EXPECT_EQ(settled_value, motivator.Value());
+
+  motivator.SetTarget(motive::Target1f(50.0f, 0.0f, 1));
+  engine_.AdvanceFrame(kTimePerFrame);
+  EXPECT_NE(settled_value, motivator.Value());
+  TimeToSettle(motivator, overshoot_percent_init_.at_target());
+  EXPECT_NEAR(50.0f, motivator.Value(),
+              overshoot_percent_init_.at_target().max_difference);
+}
+
 // Ensure the simulation settles when the target is the max bound in a modular
 // type. It will oscillate between the max and min bound a lot.
 template <class MotivatorT>
@@ -999,6 +1047,180 @@ TEST_F(MotiveTests, MatrixTranslateRotateScaleGoneWild) {
   TestMatrixMotivator(MatrixInit(ops), &engine_);
 }
 
+// Common sequences of matrix operations have specialized kernels, which should
+// give exactly the same result as interpreting the operations.
+TEST_F(MotiveTests, MatrixKernelMatchesInterpreter) {
+  std::vector<MatrixOperationInit> inits;
+  inits.emplace_back(0, motive::kTranslateX, spline_scalar_init, -1.6f);
+  inits.emplace_back(1, motive::kTranslateY, spline_scalar_init, 1.0f);
+  inits.emplace_back(2, motive::kTranslateZ, spline_scalar_init, 2.2f);
+  inits.emplace_back(3, motive::kRotateAboutZ, spline_angle_init_, 0.3f);
+  inits.emplace_back(4, motive::kRotateAboutY, spline_angle_init_, -1.1f);
+  inits.emplace_back(5, motive::kRotateAboutX, spline_angle_init_, 0.7f);
+  inits.emplace_back(6, motive::kScaleUniformly, spline_scalar_init, 1.7f);
+  TestMatrixMotivator(MatrixInit(inits), &engine_);
+
+  std::vector<motive::MatrixOperation> ops;
+  for (size_t i = 0; i < inits.size(); ++i) {
+    ops.emplace_back(inits[i], &engine_);
+  }
+  const motive::MatrixOperation::Kernel kernel =
+      motive::MatrixOperation::FindKernel(ops.data(), ops.size());
+  EXPECT_NE(&motive::MatrixOperation::ApplyOperations, kernel);
+
+  motive::MatrixOperation::ResultColumns interpreted;
+  motive::MatrixOperation::ResultColumns compiled;
+  motive::MatrixOperation::ApplyOperations(ops.data(), ops.size(),
+                                           &interpreted);
+  kernel(ops.data(), ops.size(), &compiled);
+  ExpectMatricesEqual(interpreted.Matrix(), compiled.Matrix(), 0.0f);
+  EXPECT_EQ(interpreted.scale.x, compiled.scale.x);
+  EXPECT_EQ(interpreted.scale.y, compiled.scale.y);
+  EXPECT_EQ(interpreted.scale.z, compiled.scale.z);
+
+  // Uncommon sequences fall back to the interpreter.
+  EXPECT_EQ(&motive::MatrixOperation::ApplyOperations,
+            motive::MatrixOperation::FindKernel(ops.data() + 1, 2));
+}
+
+// Leading constant ops are precomputed, which shouldn't change the result.
+// When a constant op becomes animated, and later blends back to its default,
+// the result should follow it.
+TEST_F(MotiveTests, MatrixConstantOpsFolded) {
+  std::vector<MatrixOperationInit> inits;
+  inits.emplace_back(0, motive::kTranslateX, 2.0f);
+  inits.emplace_back(1, motive::kTranslateY, -1.0f);
+  inits.emplace_back(2, motive::kTranslateZ, 0.5f);
+  inits.emplace_back(3, motive::kRotateAboutY, spline_angle_init_, 0.6f);
+  inits.emplace_back(4, motive::kScaleUniformly, 1.5f);
+  const MatrixInit matrix_init(inits);
+  MatrixMotivator4f matrix(matrix_init, &engine_);
+  engine_.AdvanceFrame(kTimePerFrame);
+
+  std::vector<motive::MatrixOperation> ops;
+  for (size_t i = 0; i < inits.size(); ++i) {
+    ops.emplace_back(inits[i], &engine_);
+  }
+  ExpectMatricesEqual(motive::MatrixOperation::CalculateResultMatrix(
+                          ops.data(), ops.size()),
+                      matrix.Value(), 0.0f);
+
+  // Animate the constant translation.
+  const MotiveTarget1f target = motive::Target1f(5.0f, 0.0f, 100);
+  std::vector<MatrixOperationInit> animated;
+  animated.emplace_back(0, motive::kTranslateX, spline_scalar_init, target);
+  const SplinePlayback playback(0.0f, false, 1.0f, 100.0f);
+  matrix.BlendToOps(animated, playback);
+  for (MotiveTime t = 0; t <= kMaxTime && matrix.TimeRemaining() > 0;
+       t += kTimePerFrame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+  }
+  engine_.AdvanceFrame(kTimePerFrame);
+  EXPECT_NEAR(5.0f, matrix.Value().TranslationVector3D().x, kMatrixEpsilon);
+
+  // Blend the now animated translation back to its default.
+  const std::vector<MatrixOperationInit> none;
+  matrix.BlendToOps(none, playback);
+  for (MotiveTime t = 0; t <= kMaxTime && matrix.TimeRemaining() > 0;
+       t += kTimePerFrame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+  }
+  engine_.AdvanceFrame(kTimePerFrame);
+  ExpectMatricesEqual(mat4::Identity(), matrix.Value(), kMatrixEpsilon);
+}
+
+// Matrices are processed in pools that share a sequence of operations. Each
+// matrix in a pool should still get its own result, including after it blends
+// to a different sequence of operations and so changes pools.
+TEST_F(MotiveTests, MatrixPoolsMatchIndividualMatrices) {
+  static const int kNumMatrices = 9;
+  std::vector<MatrixInit> inits;
+  for (int i = 0; i < kNumMatrices; ++i) {
+    const float value = 0.1f * static_cast<float>(i + 1);
+    std::vector<MatrixOperationInit> ops;
+    if (i % 3 == 2) {
+      // Uncommon sequence that's processed without a pool.
+      ops.emplace_back(0, motive::kRotateAboutY, spline_angle_init_, value);
+      ops.emplace_back(1, motive::kTranslateX, spline_scalar_init, value);
+    } else {
+      ops.emplace_back(0, motive::kTranslateX, spline_scalar_init, value);
+      ops.emplace_back(1, motive::kTranslateY, spline_scalar_init, -value);
+      ops.emplace_back(2, motive::kTranslateZ, spline_scalar_init, 2.0f);
+      if (i % 3 == 1) {
+        ops.emplace_back(3, motive::kRotateAboutY, spline_angle_init_, value);
+      }
+    }
+    inits.push_back(MatrixInit(ops));
+  }
+
+  std::vector<MatrixMotivator4f> matrices(kNumMatrices);
+  for (int i = 0; i < kNumMatrices; ++i) {
+    matrices[i].Initialize(inits[i], &engine_);
+  }
+  engine_.AdvanceFrame(kTimePerFrame);
+  for (int i = 0; i < kNumMatrices; ++i) {
+    ExpectMatricesEqual(CreateMatrixFromOps(inits[i]), matrices[i].Value(),
+                        kMatrixEpsilon);
+  }
+
+  // Move the first matrix into the pool of the second.
+  const SplinePlayback playback(0.0f, false, 1.0f, 100.0f);
+  matrices[0].BlendToOps(inits[1].ops(), playback);
+  for (MotiveTime t = 0; t <= kMaxTime && matrices[0].TimeRemaining() > 0;
+       t += kTimePerFrame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+  }
+  engine_.AdvanceFrame(kTimePerFrame);
+  ExpectMatricesEqual(CreateMatrixFromOps(inits[1]), matrices[0].Value(),
+                      kMatrixEpsilon);
+  ExpectMatricesEqual(CreateMatrixFromOps(inits[1]), matrices[1].Value(),
+                      kMatrixEpsilon);
+}
+
+// Merge plans are kept between blends, keyed by the ops being blended to.
+// Blending back and forth should follow the same plans, and ops that reuse
+// the memory of earlier ops, but have different IDs, should get a new plan.
+TEST_F(MotiveTests, MatrixBlendPlansReusedAcrossBlends) {
+  std::vector<MatrixOperationInit> first;
+  first.emplace_back(0, motive::kTranslateX, spline_scalar_init, 1.0f);
+  first.emplace_back(2, motive::kTranslateZ, spline_scalar_init, 2.0f);
+  std::vector<MatrixOperationInit> second;
+  second.emplace_back(1, motive::kTranslateY, spline_scalar_init, -1.0f);
+  second.emplace_back(2, motive::kTranslateZ, spline_scalar_init, 3.0f);
+  second.emplace_back(3, motive::kRotateAboutY, spline_angle_init_, 0.5f);
+  const MatrixInit first_init(first);
+  const MatrixInit second_init(second);
+
+  MatrixMotivator4f matrix(first_init, &engine_);
+  const SplinePlayback playback(0.0f, false, 1.0f, 100.0f);
+  for (int i = 0; i < 3; ++i) {
+    const bool to_second = i % 2 == 0;
+    matrix.BlendToOps(to_second ? second : first, playback);
+    for (MotiveTime t = 0; t <= kMaxTime && matrix.TimeRemaining() > 0;
+         t += kTimePerFrame) {
+      engine_.AdvanceFrame(kTimePerFrame);
+    }
+    engine_.AdvanceFrame(kTimePerFrame);
+    ExpectMatricesEqual(
+        CreateMatrixFromOps(to_second ? second_init : first_init),
+        matrix.Value(), kMatrixEpsilon);
+  }
+
+  // Same memory, different IDs.
+  second.clear();
+  second.emplace_back(0, motive::kTranslateX, spline_scalar_init, -2.0f);
+  second.emplace_back(4, motive::kScaleUniformly, spline_scalar_init, 2.0f);
+  const MatrixInit reused_init(second);
+  matrix.BlendToOps(second, playback);
+  for (MotiveTime t = 0; t <= kMaxTime && matrix.TimeRemaining() > 0;
+       t += kTimePerFrame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+  }
+  engine_.AdvanceFrame(kTimePerFrame);
+  ExpectMatricesEqual(CreateMatrixFromOps(reused_init), matrix.Value(),
+                      kMatrixEpsilon);
+}
+
 // Return the matrix equivalent to the Sqt operations from 'sqt_init'.
 static mat4 CreateMatrixForSqt(const SqtInit& sqt_init) {
   const std::vector<MatrixOperationInit>& ops = sqt_init.ops();
@@ -1092,6 +1314,89 @@ TEST_F(MotiveTests, SqtTranslateQuaternionScale) {
   TestSqtMotivator(SqtInit(ops), &engine_);
 }
 
+// SQT matrices are calculated several at a time. Each should match the
+// transform built from its own child values.
+TEST_F(MotiveTests, SqtBatchMatchesChildValues) {
+  // Enough to fill one batch and part of another.
+  static const int kNumSqts = 13;
+  MatrixMotivator4f sqts[kNumSqts];
+  for (int i = 0; i < kNumSqts; ++i) {
+    std::vector<MatrixOperationInit> ops;
+    ops.emplace_back(0, motive::kTranslateX, spline_scalar_init, 0.1f * i);
+    ops.emplace_back(1, motive::kQuaternionW, spline_scalar_init, 1.0f);
+    ops.emplace_back(2, motive::kQuaternionY, spline_scalar_init,
+                     simple_spline_);
+    ops.emplace_back(3, motive::kScaleZ, spline_scalar_init, 1.0f + 0.1f * i);
+    sqts[i].Initialize(SqtInit(ops), &engine_);
+  }
+
+  for (MotiveTime time = 0; time < 20 * kTimePerFrame;
+       time += kTimePerFrame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+    for (int i = 0; i < kNumSqts; ++i) {
+      const mathfu::quat rotation(sqts[i].ChildValue1f(1), 0.0f,
+                                  sqts[i].ChildValue1f(2), 0.0f);
+      const mat4 expected = mat4::Transform(
+          vec3(sqts[i].ChildValue1f(0), 0.0f, 0.0f),
+          rotation.Normalized().ToMatrix(),
+          vec3(1.0f, 1.0f, sqts[i].ChildValue1f(3)));
+      ExpectMatricesEqual(expected, sqts[i].Value(), kMatrixEpsilon);
+    }
+  }
+}
+
+// The transform functions of every supported optimization should match the
+// C++ functions exactly, including for the transforms left over after the
+// last full SIMD register.
+TEST_F(MotiveTests, TransformKernelsMatchUnoptimized) {
+  static const int kMaxCount = 13;
+  static const int kStride = kMaxCount + 3;
+  static const int kNumSqtValues = motive::kNumSqtElements * kStride;
+  static const int kNumAffineValues = motive::kNumAffineElements * kStride;
+
+  float parents[kNumAffineValues];
+  float locals[kNumAffineValues];
+  float sqts[kNumSqtValues];
+  for (int k = 0; k < kNumAffineValues; ++k) {
+    parents[k] = 0.37f * k - 10.0f;
+    locals[k] = 1.5f - 0.11f * k;
+  }
+  for (int k = 0; k < kNumSqtValues; ++k) {
+    sqts[k] = 0.5f + 0.23f * (k % 17) - 0.07f * k;
+  }
+
+  const motive::ProcessorOptimization best =
+      motive::BestProcessorOptimization();
+  for (int o = motive::kNoOptimizations; o <= best; ++o) {
+    const motive::TransformKernels* kernels = motive::TransformKernelsFor(
+        static_cast<motive::ProcessorOptimization>(o));
+    if (kernels == nullptr) continue;
+
+    for (int count = 0; count <= kMaxCount; ++count) {
+      float expected[kNumAffineValues] = {0.0f};
+      float actual[kNumAffineValues] = {0.0f};
+      motive::MultiplyAffines_C(parents, locals, count, kStride, expected);
+      kernels->multiply_affines(parents, locals, count, kStride, actual);
+      for (int k = 0; k < kNumAffineValues; ++k) {
+        EXPECT_EQ(expected[k], actual[k]);
+      }
+
+      float expected_sqts[kNumSqtValues];
+      float actual_sqts[kNumSqtValues];
+      std::copy(sqts, sqts + kNumSqtValues, expected_sqts);
+      std::copy(sqts, sqts + kNumSqtValues, actual_sqts);
+      motive::SqtsToAffines_C(expected_sqts, count, kStride, expected);
+      kernels->sqts_to_affines(actual_sqts, count, kStride, actual);
+      for (int k = 0; k < kNumSqtValues; ++k) {
+        EXPECT_EQ(expected_sqts[k], actual_sqts[k]);
+      }
+      for (int k = 0; k < kNumAffineValues; ++k) {
+        EXPECT_EQ(expected[k], actual[k]);
+      }
+    }
+  }
+}
+
 // Test the MotivatorVector::SplineTime() function.
 template <class MotivatorT>
 void SplineTime(MotiveTests& t) {
@@ -1253,6 +1558,2306 @@ void Splines(MotiveTests& t) {
 }
 TEST_ALL_VECTOR_MOTIVATORS_F(Splines)
 
+// Overshoot motivators are simulated in batches. A motivator that takes more
+// iteration steps than the others in its batch should get exactly the same
+// result as when simulated on its own.
+TEST_F(MotiveTests, OvershootBatchMatchesSolo) {
+  OvershootInit fine_init = overshoot_percent_init_;
+  fine_init.set_max_delta_time(3);
+  const MotiveTarget1f target =
+      motive::CurrentToTarget1f(0.0f, 1.0f, 80.0f, 0.0f, 100);
+
+  // Enough to fill one batch and part of another.
+  Motivator1f batched[11];
+  for (size_t i = 0; i < MOTIVE_ARRAY_SIZE(batched); ++i) {
+    batched[i].InitializeWithTarget(i % 2 == 0 ? fine_init
+                                               : overshoot_percent_init_,
+                                    &engine_, target);
+  }
+  MotiveEngine solo_engine;
+  Motivator1f solo(fine_init, &solo_engine);
+  solo.SetTarget(target);
+
+  for (MotiveTime time = 0; time < kMaxTime; time += kTimePerFrame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+    solo_engine.AdvanceFrame(kTimePerFrame);
+    for (size_t i = 0; i < MOTIVE_ARRAY_SIZE(batched); i += 2) {
+      EXPECT_EQ(solo.Value(), batched[i].Value());
+      EXPECT_EQ(solo.Velocity(), batched[i].Velocity());
+    }
+  }
+}
+
+// Overshoot motivators share one copy of each distinct set of params. Once
+// every motivator using some params is gone, their slot is reused by new
+// params, which mustn't affect the motivators using other params.
+TEST_F(MotiveTests, OvershootSharedParamsMatchSolo) {
+  OvershootInit fine_init = overshoot_percent_init_;
+  fine_init.set_max_delta_time(3);
+  const MotiveTarget1f target =
+      motive::CurrentToTarget1f(0.0f, 1.0f, 80.0f, 0.0f, 100);
+
+  Motivator1f percent(overshoot_percent_init_, &engine_);
+  {
+    Motivator1f removed(overshoot_angle_init_, &engine_);
+  }
+  Motivator1f fine(fine_init, &engine_);
+  percent.SetTarget(target);
+  fine.SetTarget(target);
+
+  MotiveEngine solo_engine;
+  Motivator1f solo_percent(overshoot_percent_init_, &solo_engine);
+  Motivator1f solo_fine(fine_init, &solo_engine);
+  solo_percent.SetTarget(target);
+  solo_fine.SetTarget(target);
+
+  for (MotiveTime time = 0; time < kMaxTime; time += kTimePerFrame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+    solo_engine.AdvanceFrame(kTimePerFrame);
+    EXPECT_EQ(solo_percent.Value(), percent.Value());
+    EXPECT_EQ(solo_fine.Value(), fine.Value());
+  }
+}
+
+// Ease motivators share their curve shapes, so should behave the same as
+// motivators that have a processor to themselves, even after the shape of a
+// removed motivator is replaced.
+TEST_F(MotiveTests, EaseSharedShapesMatchSolo) {
+  const motive::EaseInEaseOutInit1f init(1.0f, 0.0f);
+  const MotiveCurveShape fast(10.0f, 50.0f, 0.5f);
+  const MotiveCurveShape slow(10.0f, 200.0f, 0.3f);
+
+  Motivator1f a(init, &engine_);
+  Motivator1f b(init, &engine_);
+  {
+    Motivator1f removed(init, &engine_);
+    removed.SetTargetWithShape(5.0f, 0.0f, MotiveCurveShape(1.0f, 1.0f, 1.0f));
+  }
+  a.SetTargetWithShape(10.0f, 0.0f, fast);
+  b.SetTargetWithShape(10.0f, 0.0f, slow);
+  Motivator1f c(init, &engine_);
+  c.SetTargetWithShape(-10.0f, 0.0f, fast);
+
+  MotiveEngine solo_engine;
+  Motivator1f solo_fast(init, &solo_engine);
+  Motivator1f solo_slow(init, &solo_engine);
+  solo_fast.SetTargetWithShape(10.0f, 0.0f, fast);
+  solo_slow.SetTargetWithShape(10.0f, 0.0f, slow);
+
+  EXPECT_EQ(slow.typical_total_time, b.MotiveShape().typical_total_time);
+  EXPECT_EQ(slow.bias, b.MotiveShape().bias);
+  for (MotiveTime time = 0; time < kMaxTime; time += kTimePerFrame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+    solo_engine.AdvanceFrame(kTimePerFrame);
+    EXPECT_EQ(solo_fast.Value(), a.Value());
+    EXPECT_EQ(solo_slow.Value(), b.Value());
+    EXPECT_NEAR(2.0f - solo_fast.Value(), c.Value(), 1e-4f);
+  }
+}
+
+// Seeking a spring should give the same value as advancing it to the same
+// time, frame by frame, since both evaluate the same closed-form curve.
+TEST_F(MotiveTests, SpringSeekMatchesAdvance) {
+  static const MotiveTime kSeekTime = 250;
+  const motive::SpringInit1f init(0.0f, 0.0f);
+  const motive::MotiveCurveShape shape(10.0f, 100.0f, 0.5f);
+  Motivator1f advanced;
+  advanced.InitializeWithTargetShape(init, &engine_, 1, shape, 10.0f, 0.0f);
+  for (MotiveTime time = 0; time < kSeekTime; time += kTimePerFrame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+  }
+
+  MotiveEngine seek_engine;
+  Motivator1f seeked;
+  seeked.InitializeWithTargetShape(init, &seek_engine, 1, shape, 10.0f, 0.0f);
+  seeked.SetSplineTime(kSeekTime);
+
+  EXPECT_EQ(kSeekTime, advanced.SplineTime());
+  EXPECT_EQ(kSeekTime, seeked.SplineTime());
+  EXPECT_NEAR(advanced.Value(), seeked.Value(), 1e-4f);
+  EXPECT_NEAR(advanced.Velocity(), seeked.Velocity(), 1e-4f);
+  EXPECT_NE(0.0f, seeked.Value());
+}
+
+// A damped spring never quite stops oscillating, so it should be put to sleep,
+// exactly on its target, once it's close enough and slow enough.
+TEST_F(MotiveTests, DampedSpringSettlesOnTarget) {
+  const motive::SpringInit1f init(0.0f, 0.0f);
+  const motive::MotiveCurveShape shape(10.0f, 100.0f, 0.5f);
+  Motivator1f motivator;
+  motivator.InitializeWithTargetShape(init, &engine_, 1, shape, 10.0f, 0.0f);
+  for (int i = 0; i < 1000; ++i) {
+    engine_.AdvanceFrame(kTimePerFrame);
+  }
+  EXPECT_EQ(10.0f, motivator.Value());
+
+  engine_.AdvanceFrame(kTimePerFrame);
+  EXPECT_EQ(10.0f, motivator.Value());
+
+  motivator.SetTargetWithShape(-10.0f, 0.0f, shape);
+  engine_.AdvanceFrame(kTimePerFrame);
+  EXPECT_GT(10.0f, motivator.Value());
+}
+
+// Advancing processors of the same priority on several threads should give
+// exactly the same results as advancing them one-by-one.
+TEST_F(MotiveTests, ThreadedAdvanceFrameMatchesSerial) {
+  MotiveEngine threaded_engine;
+  threaded_engine.set_num_threads(4);
+  MotiveEngine* engines[] = {&engine_, &threaded_engine};
+
+  std::vector<MatrixOperationInit> ops;
+  ops.emplace_back(0, kRotateAboutY, spline_angle_init_, simple_spline_);
+  ops.emplace_back(1, kTranslateX, spline_scalar_init, 2.0f);
+
+  Motivator1f overshoots[MOTIVE_ARRAY_SIZE(engines)];
+  Motivator1f splines[MOTIVE_ARRAY_SIZE(engines)];
+  MatrixMotivator4f matrices[MOTIVE_ARRAY_SIZE(engines)];
+  for (size_t i = 0; i < MOTIVE_ARRAY_SIZE(engines); ++i) {
+    overshoots[i].InitializeWithTarget(
+        overshoot_percent_init_, engines[i],
+        motive::CurrentToTarget1f(0.0f, 1.0f, 80.0f, 0.0f, 100));
+    splines[i].Initialize(spline_scalar_init, engines[i]);
+    splines[i].SetSpline(simple_spline_, SplinePlayback(0.0f, true));
+    matrices[i].Initialize(MatrixInit(ops), engines[i]);
+  }
+
+  for (MotiveTime time = 0; time < kMaxTime; time += kTimePerFrame) {
+    for (size_t i = 0; i < MOTIVE_ARRAY_SIZE(engines); ++i) {
+      engines[i]->AdvanceFrame(kTimePerFrame);
+    }
+    EXPECT_EQ(overshoots[0].Value(), overshoots[1].Value());
+    EXPECT_EQ(splines[0].Value(), splines[1].Value());
+    ExpectMatricesEqual(matrices[0].Value(), matrices[1].Value(), 0.0f);
+  }
+}
+
+// Init for FollowerProcessor.
+class FollowerInit : public motive::MotivatorInit {
+ public:
+  MOTIVE_INTERFACE();
+  explicit FollowerInit(const Motivator1f* leader)
+      : motive::MotivatorInit(kType), leader(leader) {}
+
+  const Motivator1f* leader;
+};
+
+// Copies the value of a Motivator1f every frame. Its priority says it should
+// advance before every other processor, but it registers a dependency on its
+// leader, so it should advance after the leader's processor instead.
+class FollowerProcessor : public motive::MotiveProcessor {
+ public:
+  void AdvanceFrame(MotiveTime /*delta_time*/) override {
+    for (size_t i = 0; i < leaders_.size(); ++i) {
+      if (leaders_[i] != nullptr) values_[i] = leaders_[i]->Value();
+    }
+  }
+  motive::MotivatorType Type() const override { return FollowerInit::kType; }
+  int Priority() const override { return -1; }
+  float Value(motive::MotiveIndex index) const { return values_[index]; }
+
+ protected:
+  void InitializeIndices(const motive::MotivatorInit& init,
+                         motive::MotiveIndex index,
+                         motive::MotiveDimension /*dimensions*/,
+                         MotiveEngine* engine) override {
+    leaders_[index] = static_cast<const FollowerInit&>(init).leader;
+    dependencies_[index] = engine->RegisterDependency(this, *leaders_[index]);
+    values_[index] = 0.0f;
+  }
+  void RemoveIndices(motive::MotiveIndex index,
+                     motive::MotiveDimension /*dimensions*/) override {
+    Engine()->UnregisterDependency(this, dependencies_[index]);
+    leaders_[index] = nullptr;
+    dependencies_[index] = nullptr;
+  }
+  void MoveIndices(motive::MotiveIndex old_index,
+                   motive::MotiveIndex new_index,
+                   motive::MotiveDimension /*dimensions*/) override {
+    leaders_[new_index] = leaders_[old_index];
+    dependencies_[new_index] = dependencies_[old_index];
+    values_[new_index] = values_[old_index];
+    leaders_[old_index] = nullptr;
+    dependencies_[old_index] = nullptr;
+  }
+  void SetNumIndices(motive::MotiveIndex num_indices) override {
+    leaders_.resize(num_indices, nullptr);
+    dependencies_.resize(num_indices, nullptr);
+    values_.resize(num_indices, 0.0f);
+  }
+
+ private:
+  std::vector<const Motivator1f*> leaders_;
+  std::vector<const motive::MotiveProcessor*> dependencies_;
+  std::vector<float> values_;
+};
+
+MOTIVE_INSTANCE(FollowerInit, FollowerProcessor);
+
+class FollowerMotivator : public motive::Motivator {
+ public:
+  FollowerMotivator(const FollowerInit& init, MotiveEngine* engine)
+      : motive::Motivator(init, engine, 1) {}
+  float Value() const {
+    return static_cast<const FollowerProcessor*>(processor_)->Value(index_);
+  }
+};
+
+// Processors should advance after the processors they've registered
+// dependencies on, whatever their priorities, so followers see their leaders'
+// values from the same frame.
+TEST_F(MotiveTests, DependenciesOverridePriorityOrder) {
+  FollowerInit::Register();
+  MotiveEngine threaded_engine;
+  threaded_engine.set_num_threads(4);
+  MotiveEngine* engines[] = {&engine_, &threaded_engine};
+
+  for (size_t i = 0; i < MOTIVE_ARRAY_SIZE(engines); ++i) {
+    // Create the follower's processor first, so that it's also first in the
+    // order of creation.
+    Motivator1f leader;
+    FollowerMotivator follower(FollowerInit(&leader), engines[i]);
+    leader.Initialize(spline_scalar_init, engines[i]);
+    leader.SetSpline(simple_spline_, SplinePlayback(0.0f, true));
+
+    for (MotiveTime time = 0; time < kMaxTime; time += kTimePerFrame) {
+      engines[i]->AdvanceFrame(kTimePerFrame);
+      EXPECT_EQ(leader.Value(), follower.Value());
+    }
+  }
+}
+
+// Scheduler that queues tasks and runs them, in reverse order, when waited on.
+// Lets us check that the engine waits on and covers all the work it submits.
+class ReverseOrderScheduler : public motive::MotiveTaskScheduler {
+ public:
+  ReverseOrderScheduler() : num_tasks_run_(0) {}
+
+  motive::MotiveTaskGroupId BeginGroup() override {
+    groups_.push_back(std::vector<motive::MotiveTask>());
+    return static_cast<motive::MotiveTaskGroupId>(groups_.size() - 1);
+  }
+  void Submit(motive::MotiveTaskGroupId group,
+              const motive::MotiveTask& task) override {
+    groups_[group].push_back(task);
+  }
+  void Wait(motive::MotiveTaskGroupId group) override {
+    // Tasks may begin groups of their own, so don't hold references into
+    // groups_ while running them.
+    while (!groups_[group].empty()) {
+      const motive::MotiveTask task = groups_[group].back();
+      groups_[group].pop_back();
+      task();
+      num_tasks_run_++;
+    }
+  }
+  int NumThreads() const override { return 4; }
+
+  int num_tasks_run() const { return num_tasks_run_; }
+
+ private:
+  std::vector<std::vector<motive::MotiveTask>> groups_;
+  int num_tasks_run_;
+};
+
+// Advancing through a task scheduler should give exactly the same results as
+// advancing on the calling thread.
+TEST_F(MotiveTests, TaskSchedulerMatchesSerial) {
+  ReverseOrderScheduler scheduler;
+  MotiveEngine scheduled_engine;
+  scheduled_engine.set_task_scheduler(&scheduler);
+  MotiveEngine* engines[] = {&engine_, &scheduled_engine};
+
+  std::vector<MatrixOperationInit> ops;
+  ops.emplace_back(0, kRotateAboutY, spline_angle_init_, simple_spline_);
+  ops.emplace_back(1, kTranslateX, spline_scalar_init, 2.0f);
+
+  static const int kNumMatrices = 300;
+  std::vector<MatrixMotivator4f> matrices[MOTIVE_ARRAY_SIZE(engines)];
+  for (size_t i = 0; i < MOTIVE_ARRAY_SIZE(engines); ++i) {
+    matrices[i].resize(kNumMatrices);
+    for (int j = 0; j < kNumMatrices; ++j) {
+      matrices[i][j].Initialize(MatrixInit(ops), engines[i]);
+    }
+  }
+
+  for (MotiveTime time = 0; time < 100 * kTimePerFrame;
+       time += kTimePerFrame) {
+    for (size_t i = 0; i < MOTIVE_ARRAY_SIZE(engines); ++i) {
+      engines[i]->AdvanceFrame(kTimePerFrame);
+    }
+    for (int j = 0; j < kNumMatrices; ++j) {
+      ExpectMatricesEqual(matrices[0][j].Value(), matrices[1][j].Value(), 0.0f);
+    }
+  }
+
+  // The matrices should have been split across several tasks.
+  EXPECT_LT(0, scheduler.num_tasks_run());
+}
+
+// A thread pool should run every task exactly once, including tasks that wait
+// on groups of their own, whatever its number of workers.
+TEST_F(MotiveTests, ThreadPoolRunsNestedTasks) {
+  static const int kCount = 100;
+  for (int num_workers = 0; num_workers < 4; ++num_workers) {
+    motive::MotiveThreadPool pool(num_workers);
+    EXPECT_EQ(num_workers + 1, pool.NumThreads());
+    for (int iteration = 0; iteration < 10; ++iteration) {
+      std::atomic<int> total(0);
+      pool.ParallelFor(kCount, 3, [&pool, &total](int begin, int end) {
+        pool.ParallelFor(end - begin, 1, [&total](int b, int e) {
+          total += e - b;
+        });
+      });
+      EXPECT_EQ(kCount, total.load());
+    }
+  }
+}
+
+// Engines that share spline data should advance independently, whether
+// batched through a scheduler or run on threads of their own.
+TEST_F(MotiveTests, ConcurrentEnginesShareSplines) {
+  static const int kNumEngines = 8;
+  static const int kNumMotivators = 50;
+  static const int kNumFrames = 100;
+  const motive::SplinePlayback playback(0.0f, true);
+  std::vector<MotiveEngine> engines(kNumEngines);
+  std::vector<std::vector<Motivator1f>> motivators(kNumEngines);
+  std::vector<MotiveEngine*> engine_ptrs;
+  for (int i = 0; i < kNumEngines; ++i) {
+    engine_ptrs.push_back(&engines[i]);
+    motivators[i].resize(kNumMotivators);
+    for (int j = 0; j < kNumMotivators; ++j) {
+      motivators[i][j].Initialize(spline_scalar_init, &engines[i]);
+      motivators[i][j].SetSpline(simple_spline_, playback);
+    }
+  }
+  Motivator1f reference(spline_scalar_init, &engine_);
+  reference.SetSpline(simple_spline_, playback);
+
+  ReverseOrderScheduler scheduler;
+  for (int frame = 0; frame < kNumFrames; ++frame) {
+    MotiveEngine::AdvanceFrames(engine_ptrs.data(), engine_ptrs.size(),
+                                kTimePerFrame, &scheduler);
+  }
+  EXPECT_LT(0, scheduler.num_tasks_run());
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumEngines; ++i) {
+    threads.emplace_back([&engines, i]() {
+      for (int frame = 0; frame < kNumFrames; ++frame) {
+        engines[i].AdvanceFrame(kTimePerFrame);
+      }
+    });
+  }
+  for (auto it = threads.begin(); it != threads.end(); ++it) it->join();
+
+  for (int frame = 0; frame < 2 * kNumFrames; ++frame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+  }
+  for (int i = 0; i < kNumEngines; ++i) {
+    for (int j = 0; j < kNumMotivators; ++j) {
+      EXPECT_EQ(reference.Value(), motivators[i][j].Value());
+    }
+  }
+}
+
+// Wide rigs are split across tasks one level of the hierarchy at a time, which
+// should give exactly the same transforms as calculating bone-by-bone.
+TEST_F(MotiveTests, TaskSchedulerRigMatchesSerial) {
+  ReverseOrderScheduler scheduler;
+  MotiveEngine scheduled_engine;
+  scheduled_engine.set_task_scheduler(&scheduler);
+  MotiveEngine* engines[] = {&engine_, &scheduled_engine};
+
+  // One root, with a wide level of children, each of which has one child.
+  static const motive::BoneIndex kNumChildren = 100;
+  static const motive::BoneIndex kNumBones = 2 * kNumChildren + 1;
+  motive::RigAnim anim;
+  anim.Init("wide", kNumBones, false);
+  for (motive::BoneIndex i = 0; i < kNumBones; ++i) {
+    const motive::BoneIndex parent =
+        i == 0 ? motive::kInvalidBoneIdx
+               : i <= kNumChildren ? 0 : i - kNumChildren;
+    std::vector<MatrixOperationInit>& ops =
+        anim.InitMatrixAnim(i, parent, "").ops();
+    ops.emplace_back(0, kRotateAboutY, spline_angle_init_, simple_spline_);
+    ops.emplace_back(1, kTranslateX, spline_scalar_init, 0.1f * i);
+  }
+
+  const motive::RigInit init(anim, anim.bone_parents(), kNumBones);
+  motive::RigMotivator rigs[MOTIVE_ARRAY_SIZE(engines)];
+  for (size_t i = 0; i < MOTIVE_ARRAY_SIZE(engines); ++i) {
+    rigs[i].Initialize(init, engines[i]);
+    rigs[i].BlendToAnim(anim, SplinePlayback());
+  }
+
+  for (MotiveTime time = 0; time < 100 * kTimePerFrame;
+       time += kTimePerFrame) {
+    for (size_t i = 0; i < MOTIVE_ARRAY_SIZE(engines); ++i) {
+      engines[i]->AdvanceFrame(kTimePerFrame);
+    }
+    for (motive::BoneIndex j = 0; j < kNumBones; ++j) {
+      ExpectMatricesEqual(
+          mat4::FromAffineTransform(rigs[0].GlobalTransforms()[j]),
+          mat4::FromAffineTransform(rigs[1].GlobalTransforms()[j]), 0.0f);
+    }
+  }
+}
+
+// Global transforms are calculated in batches of affine multiplies, which
+// should match multiplying the parent and child matrices directly.
+TEST_F(MotiveTests, RigAffineBatchMatchesMatrixMultiply) {
+  // One root with enough children to fill one batch and part of another.
+  static const motive::BoneIndex kNumBones = 13;
+  motive::RigAnim anim;
+  anim.Init("batch", kNumBones, false);
+  MatrixMotivator4f locals[kNumBones];
+  for (motive::BoneIndex i = 0; i < kNumBones; ++i) {
+    std::vector<MatrixOperationInit>& ops =
+        anim.InitMatrixAnim(i, i == 0 ? motive::kInvalidBoneIdx : 0, "")
+            .ops();
+    ops.emplace_back(0, kRotateAboutY, spline_angle_init_, simple_spline_);
+    ops.emplace_back(1, kTranslateX, spline_scalar_init, 0.1f * i);
+    ops.emplace_back(2, kScaleZ, spline_scalar_init, 1.0f + 0.1f * i);
+    locals[i].Initialize(MatrixInit(ops), &engine_);
+  }
+
+  const motive::RigInit init(anim, anim.bone_parents(), kNumBones);
+  motive::RigMotivator rig;
+  rig.Initialize(init, &engine_);
+  rig.BlendToAnim(anim, SplinePlayback());
+
+  for (MotiveTime time = 0; time < 20 * kTimePerFrame;
+       time += kTimePerFrame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+    const mathfu::AffineTransform* globals = rig.GlobalTransforms();
+    for (motive::BoneIndex i = 1; i < kNumBones; ++i) {
+      ExpectMatricesEqual(locals[0].Value() * locals[i].Value(),
+                          mat4::FromAffineTransform(globals[i]), 1e-5f);
+    }
+  }
+}
+
+// Blending animations whose quaternions are in opposite hemispheres should
+// average their orientations, not cancel them out.
+TEST_F(MotiveTests, RigBlendOppositeQuaternions) {
+  static const float kAngle = 0.5f;
+  const float signs[] = {1.0f, -1.0f};
+  motive::RigAnim anims[MOTIVE_ARRAY_SIZE(signs)];
+  for (size_t i = 0; i < MOTIVE_ARRAY_SIZE(signs); ++i) {
+    anims[i].Init("sqt", 1, false);
+    motive::MatrixAnim& matrix_anim =
+        anims[i].InitMatrixAnim(0, motive::kInvalidBoneIdx, "");
+    matrix_anim.SetSqtAnim();
+    std::vector<MatrixOperationInit>& ops = matrix_anim.ops();
+    ops.emplace_back(0, motive::kTranslateX, 2.0f + 2.0f * i);
+    ops.emplace_back(1, motive::kQuaternionW, signs[i] * cos(kAngle));
+    ops.emplace_back(2, motive::kQuaternionY, signs[i] * sin(kAngle));
+  }
+
+  const motive::RigInit init(anims[0], anims[0].bone_parents(), 1);
+  motive::RigMotivator rig;
+  rig.Initialize(init, &engine_);
+  const motive::RigAnim* anim_ptrs[] = {&anims[0], &anims[1]};
+  const SplinePlayback playbacks[] = {SplinePlayback(), SplinePlayback()};
+  const float weights[] = {0.5f, 0.5f};
+  rig.BlendToAnims(anim_ptrs, playbacks, weights, 2);
+  engine_.AdvanceFrame(kTimePerFrame);
+
+  const mat4 expected = mat4::Transform(
+      mathfu::vec3(3.0f, 0.0f, 0.0f),
+      mathfu::quat(cos(kAngle), 0.0f, sin(kAngle), 0.0f).ToMatrix(),
+      mathfu::kOnes3f);
+  ExpectMatricesEqual(expected,
+                      mat4::FromAffineTransform(rig.GlobalTransforms()[0]),
+                      kMatrixEpsilon);
+}
+
+// An additive layer should apply its weighted difference from the reference
+// pose on top of the base animation, and removing it should restore the base.
+TEST_F(MotiveTests, RigAdditiveLayerAppliesDelta) {
+  // Base, layer and reference poses, as translation, rotation angle and scale.
+  const float translations[] = {2.0f, 5.0f, 4.0f};
+  const float angles[] = {0.5f, 0.5f, 0.3f};
+  const float scales[] = {1.0f, 3.0f, 2.0f};
+  motive::RigAnim anims[MOTIVE_ARRAY_SIZE(translations)];
+  for (size_t i = 0; i < MOTIVE_ARRAY_SIZE(translations); ++i) {
+    anims[i].Init("additive", 1, false);
+    motive::MatrixAnim& matrix_anim =
+        anims[i].InitMatrixAnim(0, motive::kInvalidBoneIdx, "");
+    matrix_anim.SetSqtAnim();
+    std::vector<MatrixOperationInit>& ops = matrix_anim.ops();
+    ops.emplace_back(0, motive::kTranslateX, translations[i]);
+    ops.emplace_back(1, motive::kQuaternionW, cos(angles[i]));
+    ops.emplace_back(2, motive::kQuaternionY, sin(angles[i]));
+    ops.emplace_back(3, motive::kScaleX, scales[i]);
+  }
+
+  const motive::RigInit init(anims[0], anims[0].bone_parents(), 1);
+  motive::RigMotivator rig;
+  rig.Initialize(init, &engine_);
+  rig.BlendToAnim(anims[0], SplinePlayback());
+  const motive::RigAdditiveLayer layer(&anims[1], SplinePlayback(), 0.5f,
+                                       &anims[2]);
+  rig.SetAdditiveLayers(&layer, 1);
+  engine_.AdvanceFrame(kTimePerFrame);
+
+  // Half of the layer's offset of 1, turn of 0.2 and scale ratio of 1.5.
+  const mat4 expected = mat4::Transform(
+      mathfu::vec3(2.5f, 0.0f, 0.0f),
+      mathfu::quat(cos(0.6f), 0.0f, sin(0.6f), 0.0f).ToMatrix(),
+      mathfu::vec3(1.25f, 1.0f, 1.0f));
+  ExpectMatricesEqual(expected,
+                      mat4::FromAffineTransform(rig.GlobalTransforms()[0]),
+                      kMatrixEpsilon);
+
+  rig.SetAdditiveLayers(nullptr, 0);
+  engine_.AdvanceFrame(kTimePerFrame);
+  const mat4 base = mat4::Transform(
+      mathfu::vec3(2.0f, 0.0f, 0.0f),
+      mathfu::quat(cos(0.5f), 0.0f, sin(0.5f), 0.0f).ToMatrix(),
+      mathfu::kOnes3f);
+  ExpectMatricesEqual(base,
+                      mat4::FromAffineTransform(rig.GlobalTransforms()[0]),
+                      kMatrixEpsilon);
+}
+
+// Once only one animation of a blend is still playing, the rig should collapse
+// back to that animation and give the same results as playing it alone.
+TEST_F(MotiveTests, RigBlendCollapsesToSingleAnim) {
+  motive::RigAnim anims[2];
+  for (int i = 0; i < 2; ++i) {
+    anims[i].Init("collapse", 1, false);
+    std::vector<MatrixOperationInit>& ops =
+        anims[i].InitMatrixAnim(0, motive::kInvalidBoneIdx, "").ops();
+    ops.emplace_back(0, kRotateAboutY, spline_angle_init_, simple_spline_);
+    ops.emplace_back(1, kTranslateX, spline_scalar_init, 1.0f + i);
+  }
+
+  const motive::RigInit init(anims[0], anims[0].bone_parents(), 1);
+  motive::RigMotivator blended;
+  motive::RigMotivator single;
+  blended.Initialize(init, &engine_);
+  single.Initialize(init, &engine_);
+  const motive::RigAnim* anim_ptrs[] = {&anims[0], &anims[1]};
+  // The second animation plays at half speed, so outlasts the first.
+  const SplinePlayback slow_playback(0.0f, false, 0.5f);
+  const SplinePlayback playbacks[] = {SplinePlayback(), slow_playback};
+  const float weights[] = {0.0f, 1.0f};
+  blended.BlendToAnims(anim_ptrs, playbacks, weights, 2);
+  single.BlendToAnim(anims[1], slow_playback);
+  EXPECT_EQ(&anims[0], blended.CurrentAnim());
+
+  // The zero-weight animation is kept until it finishes playing.
+  for (MotiveTime time = 0; time < kMaxTime; time += kTimePerFrame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+    if (blended.ChildTimeRemaining(0) == 0) break;
+    EXPECT_LT(0, blended.ChildTimeRemaining(1));
+  }
+
+  // On the next frame, the blend collapses to the remaining animation.
+  engine_.AdvanceFrame(kTimePerFrame);
+  EXPECT_LT(0, single.TimeRemaining());
+  EXPECT_EQ(single.TimeRemaining(), blended.ChildTimeRemaining(0));
+  EXPECT_EQ(0, blended.ChildTimeRemaining(1));
+  EXPECT_EQ(&anims[1], blended.CurrentAnim());
+  ExpectMatricesEqual(
+      mat4::FromAffineTransform(single.GlobalTransforms()[0]),
+      mat4::FromAffineTransform(blended.GlobalTransforms()[0]), 0.0f);
+
+  // Rates for the animations that were collapsed away are ignored.
+  const float rates[] = {2.0f, 3.0f};
+  blended.SetPlaybackRates(rates, 2);
+  single.SetPlaybackRate(2.0f);
+  engine_.AdvanceFrame(kTimePerFrame);
+  EXPECT_EQ(single.TimeRemaining(), blended.ChildTimeRemaining(0));
+  ExpectMatricesEqual(
+      mat4::FromAffineTransform(single.GlobalTransforms()[0]),
+      mat4::FromAffineTransform(blended.GlobalTransforms()[0]), 0.0f);
+}
+
+// Rigs playing the same animation at the same time should share one set of
+// global transforms, but only when they've asked to.
+TEST_F(MotiveTests, RigInstancesShareTransforms) {
+  motive::RigAnim anim;
+  anim.Init("instanced", 1, false);
+  std::vector<MatrixOperationInit>& ops =
+      anim.InitMatrixAnim(0, motive::kInvalidBoneIdx, "").ops();
+  ops.emplace_back(0, kRotateAboutY, spline_angle_init_, simple_spline_);
+
+  const motive::RigInit init(anim, anim.bone_parents(), 1);
+  motive::RigMotivator rigs[3];
+  for (size_t i = 0; i < MOTIVE_ARRAY_SIZE(rigs); ++i) {
+    rigs[i].Initialize(init, &engine_);
+    rigs[i].BlendToAnim(anim, SplinePlayback());
+  }
+  rigs[0].SetInstanceTimeQuantum(1);
+  rigs[1].SetInstanceTimeQuantum(1);
+
+  for (MotiveTime time = 0; time < 10 * kTimePerFrame;
+       time += kTimePerFrame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+    EXPECT_EQ(rigs[0].GlobalTransforms(), rigs[1].GlobalTransforms());
+    EXPECT_NE(rigs[0].GlobalTransforms(), rigs[2].GlobalTransforms());
+    ExpectMatricesEqual(
+        mat4::FromAffineTransform(rigs[2].GlobalTransforms()[0]),
+        mat4::FromAffineTransform(rigs[1].GlobalTransforms()[0]), 0.0f);
+  }
+
+  // Once their playback rates differ, the rigs are no longer shared.
+  rigs[1].SetPlaybackRate(2.0f);
+  engine_.AdvanceFrame(kTimePerFrame);
+  EXPECT_NE(rigs[0].GlobalTransforms(), rigs[1].GlobalTransforms());
+}
+
+// Blending a crowd of rigs in bulk should give exactly the same poses as
+// blending each rig on its own, whatever the layout of their old ops.
+TEST_F(MotiveTests, RigBlendInBulkMatchesIndividual) {
+  motive::RigAnim anims[3];
+  for (size_t i = 0; i < MOTIVE_ARRAY_SIZE(anims); ++i) {
+    anims[i].Init("bulk", 1, false);
+    std::vector<MatrixOperationInit>& ops =
+        anims[i].InitMatrixAnim(0, motive::kInvalidBoneIdx, "").ops();
+    if (i != 1) {
+      ops.emplace_back(0, kTranslateX, spline_scalar_init, simple_spline_);
+    }
+    ops.emplace_back(1, kRotateAboutY, spline_angle_init_, simple_spline_);
+    if (i != 0) {
+      ops.emplace_back(2, kScaleUniformly, spline_scalar_init, simple_spline_);
+    }
+  }
+
+  // Start the rigs on the first two animations, so that their ops have two
+  // different layouts when they blend to the third.
+  static const int kNumRigs = 6;
+  const motive::RigInit init(anims[0], anims[0].bone_parents(), 1);
+  motive::RigMotivator solo[kNumRigs];
+  motive::RigMotivator bulk[kNumRigs];
+  motive::RigMotivator* bulk_ptrs[kNumRigs];
+  for (int i = 0; i < kNumRigs; ++i) {
+    const SplinePlayback start(static_cast<float>(i), true);
+    solo[i].Initialize(init, &engine_);
+    solo[i].BlendToAnim(anims[i % 2], start);
+    bulk[i].Initialize(init, &engine_);
+    bulk[i].BlendToAnim(anims[i % 2], start);
+    bulk_ptrs[i] = &bulk[i];
+  }
+  engine_.AdvanceFrame(kTimePerFrame);
+
+  const SplinePlayback playback(0.0f, true, 1.0f, 5.0f);
+  for (int i = 0; i < kNumRigs; ++i) {
+    solo[i].BlendToAnim(anims[2], playback);
+  }
+  motive::RigMotivator::BlendToAnimInBulk(bulk_ptrs, kNumRigs, anims[2],
+                                          playback);
+
+  for (int frame = 0; frame < 10; ++frame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+    for (int i = 0; i < kNumRigs; ++i) {
+      ExpectMatricesEqual(
+          mat4::FromAffineTransform(solo[i].GlobalTransforms()[0]),
+          mat4::FromAffineTransform(bulk[i].GlobalTransforms()[0]), 0.0f);
+      EXPECT_EQ(solo[i].TimeRemaining(), bulk[i].TimeRemaining());
+    }
+  }
+}
+
+// Rigs playing a replaced animation should carry on from the same time in the
+// new one, and other rigs should be left alone.
+TEST_F(MotiveTests, RigReplaceAnimKeepsPlaybackTime) {
+  motive::RigAnim anims[3];
+  for (size_t i = 0; i < MOTIVE_ARRAY_SIZE(anims); ++i) {
+    anims[i].Init("reloaded", 1, false);
+    std::vector<MatrixOperationInit>& ops =
+        anims[i].InitMatrixAnim(0, motive::kInvalidBoneIdx, "").ops();
+    ops.emplace_back(0, kRotateAboutY, spline_angle_init_, simple_spline_);
+  }
+  motive::RigAnim& old_anim = anims[0];
+  motive::RigAnim& new_anim = anims[1];
+  motive::RigAnim& other_anim = anims[2];
+
+  const motive::RigInit init(old_anim, old_anim.bone_parents(), 1);
+  motive::RigMotivator replaced(init, &engine_);
+  motive::RigMotivator reference(init, &engine_);
+  motive::RigMotivator other(init, &engine_);
+  replaced.BlendToAnim(old_anim, SplinePlayback());
+  reference.BlendToAnim(old_anim, SplinePlayback());
+  other.BlendToAnim(other_anim, SplinePlayback());
+  for (int i = 0; i < 5; ++i) engine_.AdvanceFrame(kTimePerFrame);
+
+  EXPECT_EQ(engine_.ReplaceRigAnim(old_anim, new_anim, 0), 2);
+  EXPECT_EQ(replaced.CurrentAnim(), &new_anim);
+  EXPECT_EQ(other.CurrentAnim(), &other_anim);
+
+  // The new animation is identical, so playback should be seamless.
+  reference.BlendToAnim(other_anim, SplinePlayback(5.0f * kTimePerFrame));
+  for (int i = 0; i < 5; ++i) {
+    engine_.AdvanceFrame(kTimePerFrame);
+    ExpectMatricesEqual(
+        mat4::FromAffineTransform(reference.GlobalTransforms()[0]),
+        mat4::FromAffineTransform(replaced.GlobalTransforms()[0]), 1e-5f);
+  }
+}
+
+// Masked bones and their ancestors should be evaluated as usual, but other
+// bones should be skipped.
+TEST_F(MotiveTests, RigBoneMaskSkipsOtherBones) {
+  // A root with two children.
+  static const motive::BoneIndex kNumBones = 3;
+  motive::RigAnim anim;
+  anim.Init("masked", kNumBones, false);
+  for (motive::BoneIndex i = 0; i < kNumBones; ++i) {
+    std::vector<MatrixOperationInit>& ops =
+        anim.InitMatrixAnim(i, i == 0 ? motive::kInvalidBoneIdx : 0, "")
+            .ops();
+    ops.emplace_back(0, kRotateAboutY, spline_angle_init_, simple_spline_);
+    ops.emplace_back(1, kTranslateX, spline_scalar_init, 1.0f + i);
+  }
+
+  motive::RigInit full_init(anim, anim.bone_parents(), kNumBones);
+  motive::RigInit masked_init(anim, anim.bone_parents(), kNumBones);
+  masked_init.set_bone_mask(std::vector<motive::BoneIndex>(1, 1));
+  motive::RigMotivator full(full_init, &engine_);
+  motive::RigMotivator masked(masked_init, &engine_);
+  full.BlendToAnim(anim, SplinePlayback());
+  masked.BlendToAnim(anim, SplinePlayback());
+
+  const mat4 initial = mat4::FromAffineTransform(masked.GlobalTransforms()[2]);
+  for (MotiveTime time = 0; time < 10 * kTimePerFrame;
+       time += kTimePerFrame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+    for (motive::BoneIndex i = 0; i < 2; ++i) {
+      ExpectMatricesEqual(
+          mat4::FromAffineTransform(full.GlobalTransforms()[i]),
+          mat4::FromAffineTransform(masked.GlobalTransforms()[i]), 0.0f);
+    }
+    ExpectMatricesEqual(
+        initial, mat4::FromAffineTransform(masked.GlobalTransforms()[2]),
+        0.0f);
+  }
+
+  // Removing the mask evaluates every bone again.
+  masked.SetBoneMask(nullptr, 0);
+  engine_.AdvanceFrame(kTimePerFrame);
+  ExpectMatricesEqual(mat4::FromAffineTransform(full.GlobalTransforms()[2]),
+                      mat4::FromAffineTransform(masked.GlobalTransforms()[2]),
+                      kMatrixEpsilon);
+}
+
+// Bones culled by the level of detail should follow their parent at their
+// default pose offset, and pick up the animation again at full detail.
+TEST_F(MotiveTests, RigLodCullsLeafBones) {
+  // A chain of three bones.
+  static const motive::BoneIndex kNumBones = 3;
+  motive::RigAnim anim;
+  anim.Init("lod", kNumBones, false);
+  for (motive::BoneIndex i = 0; i < kNumBones; ++i) {
+    std::vector<MatrixOperationInit>& ops =
+        anim.InitMatrixAnim(i, i == 0 ? motive::kInvalidBoneIdx : i - 1, "")
+            .ops();
+    ops.emplace_back(0, kRotateAboutY, spline_angle_init_, simple_spline_);
+    ops.emplace_back(1, kTranslateX, spline_scalar_init, 1.0f + i);
+  }
+
+  // Culling one level of leaves drops the end of the chain.
+  const std::vector<motive::BoneIndex> kept =
+      motive::RigInit::CullLeafBones(anim.bone_parents(), kNumBones, 1);
+  ASSERT_EQ(2u, kept.size());
+  EXPECT_EQ(0, kept[0]);
+  EXPECT_EQ(1, kept[1]);
+
+  motive::RigInit init(anim, anim.bone_parents(), kNumBones);
+  init.set_lods(std::vector<std::vector<motive::BoneIndex>>(1, kept));
+  motive::RigMotivator full(init, &engine_);
+  motive::RigMotivator culled(init, &engine_);
+  full.BlendToAnim(anim, SplinePlayback());
+  culled.BlendToAnim(anim, SplinePlayback());
+  culled.SetLod(1);
+
+  motive::RigAnimSampler sampler(anim);
+  mathfu::AffineTransform bind[kNumBones];
+  sampler.LocalTransforms(0.0f, false, bind);
+  for (MotiveTime time = 0; time < 10 * kTimePerFrame;
+       time += kTimePerFrame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+    for (motive::BoneIndex i = 0; i < 2; ++i) {
+      ExpectMatricesEqual(
+          mat4::FromAffineTransform(full.GlobalTransforms()[i]),
+          mat4::FromAffineTransform(culled.GlobalTransforms()[i]), 0.0f);
+    }
+    ExpectMatricesEqual(
+        mat4::FromAffineTransform(culled.GlobalTransforms()[1]) *
+            mat4::FromAffineTransform(bind[2]),
+        mat4::FromAffineTransform(culled.GlobalTransforms()[2]),
+        kMatrixEpsilon);
+  }
+
+  // Back at full detail, every bone is evaluated again.
+  culled.SetLod(0);
+  engine_.AdvanceFrame(kTimePerFrame);
+  ExpectMatricesEqual(mat4::FromAffineTransform(full.GlobalTransforms()[2]),
+                      mat4::FromAffineTransform(culled.GlobalTransforms()[2]),
+                      kMatrixEpsilon);
+}
+
+// Lazy rigs should give the same transforms as eager rigs, whether resolved
+// on access or in a batch.
+TEST_F(MotiveTests, RigLazyMatchesEager) {
+  motive::RigAnim anim;
+  anim.Init("lazy", 2, false);
+  for (motive::BoneIndex i = 0; i < 2; ++i) {
+    std::vector<MatrixOperationInit>& ops =
+        anim.InitMatrixAnim(i, i == 0 ? motive::kInvalidBoneIdx : 0, "")
+            .ops();
+    ops.emplace_back(0, kRotateAboutY, spline_angle_init_, simple_spline_);
+    ops.emplace_back(1, kTranslateX, spline_scalar_init, 1.0f + i);
+  }
+
+  const motive::RigInit init(anim, anim.bone_parents(), 2);
+  motive::RigMotivator rigs[3];
+  for (size_t i = 0; i < MOTIVE_ARRAY_SIZE(rigs); ++i) {
+    rigs[i].Initialize(init, &engine_);
+    rigs[i].BlendToAnim(anim, SplinePlayback());
+  }
+  rigs[1].SetLazy(true);
+  rigs[2].SetLazy(true);
+
+  for (MotiveTime time = 0; time < 10 * kTimePerFrame;
+       time += kTimePerFrame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+  }
+
+  // Resolve one rig in a batch, and the other on access.
+  motive::RigMotivator* batch[] = {&rigs[2]};
+  motive::RigMotivator::ResolveDirty(batch, 1);
+  for (size_t i = 1; i < MOTIVE_ARRAY_SIZE(rigs); ++i) {
+    for (motive::BoneIndex j = 0; j < 2; ++j) {
+      ExpectMatricesEqual(
+          mat4::FromAffineTransform(rigs[0].GlobalTransforms()[j]),
+          mat4::FromAffineTransform(rigs[i].GlobalTransforms()[j]), 0.0f);
+    }
+  }
+}
+
+// Skinning matrices written to a caller's buffer should be the global
+// transforms multiplied by the inverse bind pose.
+TEST_F(MotiveTests, RigSkinningOutput) {
+  static const motive::BoneIndex kNumBones = 2;
+  motive::RigAnim anim;
+  anim.Init("skinned", kNumBones, false);
+  for (motive::BoneIndex i = 0; i < kNumBones; ++i) {
+    std::vector<MatrixOperationInit>& ops =
+        anim.InitMatrixAnim(i, i == 0 ? motive::kInvalidBoneIdx : 0, "")
+            .ops();
+    ops.emplace_back(0, kRotateAboutY, spline_angle_init_, simple_spline_);
+    ops.emplace_back(1, kTranslateX, spline_scalar_init, 1.0f + i);
+  }
+  const mathfu::AffineTransform inverse_bind_pose[kNumBones] = {
+      mat4::ToAffineTransform(mat4::FromTranslationVector(vec3(0, 1, 0))),
+      mat4::ToAffineTransform(mat4::FromScaleVector(vec3(2, 2, 2)))};
+
+  const motive::RigInit init(anim, anim.bone_parents(), kNumBones);
+  motive::RigMotivator rig(init, &engine_);
+  rig.BlendToAnim(anim, SplinePlayback());
+
+  // Pad each matrix, to check that the stride is respected.
+  static const size_t kStride = 16;
+  float affine[kNumBones * kStride];
+  float matrices[kNumBones * kStride];
+  rig.SetSkinningOutput(motive::SkinningOutput(
+      affine, kStride * sizeof(float), motive::SkinningOutput::kAffineFloat,
+      inverse_bind_pose));
+  engine_.AdvanceFrame(kTimePerFrame);
+  for (motive::BoneIndex i = 0; i < kNumBones; ++i) {
+    const mat4 expected =
+        mat4::FromAffineTransform(rig.GlobalTransforms()[i]) *
+        mat4::FromAffineTransform(inverse_bind_pose[i]);
+    const float* m = &affine[i * kStride];
+    for (int r = 0; r < 3; ++r) {
+      for (int c = 0; c < 4; ++c) {
+        EXPECT_NEAR(expected(r, c), m[r * 4 + c], kMatrixEpsilon);
+      }
+    }
+  }
+
+  rig.SetSkinningOutput(motive::SkinningOutput(
+      matrices, kStride * sizeof(float),
+      motive::SkinningOutput::kMatrixFloat, inverse_bind_pose));
+  engine_.AdvanceFrame(kTimePerFrame);
+  for (motive::BoneIndex i = 0; i < kNumBones; ++i) {
+    const mat4 expected =
+        mat4::FromAffineTransform(rig.GlobalTransforms()[i]) *
+        mat4::FromAffineTransform(inverse_bind_pose[i]);
+    ExpectMatricesEqual(expected, mat4(&matrices[i * kStride]),
+                        kMatrixEpsilon);
+  }
+}
+
+// Matrices and rigs whose children have stopped changing should stop being
+// recalculated, but pick up any later change.
+TEST_F(MotiveTests, UnchangedMatricesAreSkipped) {
+  motive::RigAnim anim;
+  anim.Init("settles", 2, false);
+  for (motive::BoneIndex i = 0; i < 2; ++i) {
+    std::vector<MatrixOperationInit>& ops =
+        anim.InitMatrixAnim(i, i == 0 ? motive::kInvalidBoneIdx : 0, "")
+            .ops();
+    ops.emplace_back(0, kRotateAboutY, spline_angle_init_, simple_spline_);
+    ops.emplace_back(1, kTranslateX, 1.0f + i);
+  }
+  const motive::RigInit init(anim, anim.bone_parents(), 2);
+  motive::RigMotivator rig(init, &engine_);
+  rig.BlendToAnim(anim, SplinePlayback());
+
+  std::vector<MatrixOperationInit> ops;
+  ops.emplace_back(0, kRotateAboutY, spline_angle_init_, simple_spline_);
+  ops.emplace_back(1, kTranslateX, 2.0f);
+  MatrixMotivator4f matrix(MatrixInit(ops), &engine_);
+
+  for (MotiveTime t = 0; t <= kMaxTime && matrix.TimeRemaining() > 0;
+       t += kTimePerFrame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+  }
+  engine_.AdvanceFrame(kTimePerFrame);
+  const uint32_t changed_frame = matrix.ChangedFrame();
+  const mat4 settled = matrix.Value();
+  const mathfu::AffineTransform settled_bone = rig.GlobalTransforms()[1];
+
+  for (int i = 0; i < 5; ++i) {
+    engine_.AdvanceFrame(kTimePerFrame);
+  }
+  EXPECT_EQ(changed_frame, matrix.ChangedFrame());
+  ExpectMatricesEqual(settled, matrix.Value(), 0.0f);
+  ExpectMatricesEqual(mat4::FromAffineTransform(settled_bone),
+                      mat4::FromAffineTransform(rig.GlobalTransforms()[1]),
+                      0.0f);
+
+  // Changing a constant op should be picked up on the next frame.
+  matrix.SetChildValue1f(1, 3.0f);
+  engine_.AdvanceFrame(kTimePerFrame);
+  EXPECT_LT(changed_frame, matrix.ChangedFrame());
+  // The translation is applied after the rotation, so it moves along the
+  // rotated x-axis.
+  const vec3 expected = settled.TranslationVector3D() +
+                        vec3(settled(0, 0), settled(1, 0), settled(2, 0));
+  const vec3 translation = matrix.Value().TranslationVector3D();
+  EXPECT_NEAR(expected.x, translation.x, kMatrixEpsilon);
+  EXPECT_NEAR(expected.y, translation.y, kMatrixEpsilon);
+  EXPECT_NEAR(expected.z, translation.z, kMatrixEpsilon);
+}
+
+// The affine result of a matrix motivator should match its 4x4 value, and its
+// position should be the translation column.
+TEST_F(MotiveTests, MatrixAffineValueMatchesValue) {
+  std::vector<MatrixOperationInit> ops;
+  ops.emplace_back(0, kRotateAboutY, spline_angle_init_, simple_spline_);
+  ops.emplace_back(1, kTranslateX, spline_scalar_init, 2.0f);
+  ops.emplace_back(2, kScaleZ, spline_scalar_init, 3.0f);
+  MatrixMotivator4f matrix(MatrixInit(ops), &engine_);
+
+  for (MotiveTime time = 0; time < 20 * kTimePerFrame;
+       time += kTimePerFrame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+    ExpectMatricesEqual(matrix.Value(),
+                        mat4::FromAffineTransform(matrix.AffineValue()), 0.0f);
+    EXPECT_EQ(matrix.Value().TranslationVector3D().x, matrix.Position().x);
+    EXPECT_EQ(matrix.Value().TranslationVector3D().z, matrix.Position().z);
+  }
+}
+
+// Matrix operations read their spline values directly from the spline
+// processor. Those reads should stay correct when the processor grows.
+TEST_F(MotiveTests, MatrixOpsReadSplinesAfterReallocation) {
+  std::vector<MatrixOperationInit> ops;
+  ops.emplace_back(0, kRotateAboutY, spline_angle_init_, simple_spline_);
+  ops.emplace_back(1, kTranslateX, spline_scalar_init, 2.0f);
+  const MatrixInit init(ops);
+  MatrixMotivator4f before(init, &engine_);
+  const mat4 initial = before.Value();
+
+  // Grow the spline processor's arrays past their current capacity.
+  std::vector<Motivator1f> splines(256);
+  for (size_t i = 0; i < splines.size(); ++i) {
+    splines[i].Initialize(spline_scalar_init, &engine_);
+  }
+  MatrixMotivator4f after(init, &engine_);
+
+  for (MotiveTime time = 0; time < 20 * kTimePerFrame;
+       time += kTimePerFrame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+    ExpectMatricesEqual(before.Value(), after.Value(), 0.0f);
+  }
+  EXPECT_NE(initial(0, 0), before.Value()(0, 0));
+}
+
+// Each frame's counters should cover the work done since the previous frame,
+// and the process totals should only grow.
+TEST_F(MotiveTests, FrameCountersCountHotPathEvents) {
+  std::vector<MatrixOperationInit> ops;
+  ops.emplace_back(0, kRotateAboutY, spline_angle_init_, simple_spline_);
+  MatrixMotivator4f matrix(MatrixInit(ops), &engine_);
+  motive::MotiveCounters start;
+  motive::ReadMotiveCounters(&start);
+
+  engine_.AdvanceFrame(kTimePerFrame);
+  const motive::MotiveCounters& frame = engine_.frame_counters();
+  EXPECT_LT(0u, frame[motive::kCounterCubicInits]);
+  EXPECT_LE(1u, frame[motive::kCounterMatricesRecomputed]);
+  EXPECT_EQ(0u, frame[motive::kCounterMatrixBlends]);
+
+  matrix.BlendToOps(ops, motive::SplinePlayback());
+  engine_.AdvanceFrame(kTimePerFrame);
+  EXPECT_EQ(1u, engine_.frame_counters()[motive::kCounterMatrixBlends]);
+
+  motive::MotiveCounters end;
+  motive::ReadMotiveCounters(&end);
+  const motive::MotiveCounters total = end - start;
+  EXPECT_LE(1u, total[motive::kCounterMatrixBlends]);
+  EXPECT_LE(2u, total[motive::kCounterMatricesRecomputed]);
+  EXPECT_STREQ("matrix_blends",
+               motive::MotiveCounterName(motive::kCounterMatrixBlends));
+}
+
+// Records the spans sent to it, checking that they nest.
+class RecordingTraceSink : public motive::MotiveTraceSink {
+ public:
+  void BeginSpan(const char* name, const char* owner,
+                 uint64_t /*time_ns*/) override {
+    open_.push_back(std::string(owner) + "::" + name);
+    spans_.push_back(open_.back());
+  }
+  void EndSpan(const char* name, const char* owner,
+               uint64_t /*time_ns*/) override {
+    ASSERT_FALSE(open_.empty());
+    EXPECT_EQ(std::string(owner) + "::" + name, open_.back());
+    open_.pop_back();
+  }
+  const std::vector<std::string>& spans() const { return spans_; }
+  bool AllEnded() const { return open_.empty(); }
+
+ private:
+  std::vector<std::string> open_;
+  std::vector<std::string> spans_;
+};
+
+// A frame should be traced as one span, holding a span for each processor.
+TEST_F(MotiveTests, TraceSinkReceivesFrameSpans) {
+  Motivator1f motivator(spline_scalar_init, &engine_);
+  RecordingTraceSink sink;
+  motive::SetMotiveTraceSink(&sink);
+  engine_.AdvanceFrame(kTimePerFrame);
+  motive::SetMotiveTraceSink(nullptr);
+  engine_.AdvanceFrame(kTimePerFrame);
+
+  ASSERT_FALSE(sink.spans().empty());
+  EXPECT_EQ("MotiveEngine::AdvanceFrame", sink.spans().front());
+  EXPECT_TRUE(sink.AllEnded());
+  const std::string spline_frame =
+      std::string(motive::SplineInit::kType->name) + "::AdvanceFrame";
+  EXPECT_EQ(1, std::count(sink.spans().begin(), sink.spans().end(),
+                          spline_frame));
+  EXPECT_EQ(1, std::count(sink.spans().begin(), sink.spans().end(),
+                          "MotiveEngine::AdvanceFrame"));
+}
+
+// Const motivators are never advanced, so removing one must plug its hole
+// immediately, without waiting for the next AdvanceFrame().
+TEST_F(MotiveTests, StaticProcessorDefragmentsOnRemove) {
+  Motivator1f a(motive::ConstInit1f(1.0f, 0.0f), &engine_);
+  Motivator1f b(motive::ConstInit1f(2.0f, 0.0f), &engine_);
+  Motivator1f c(motive::ConstInit1f(3.0f, 0.0f), &engine_);
+  EXPECT_TRUE(a.Processor()->IsStatic());
+
+  b.Invalidate();
+  a.Processor()->VerifyInternalState();
+  EXPECT_EQ(1.0f, a.Value());
+  EXPECT_EQ(3.0f, c.Value());
+
+  // Values and changed frames are untouched by the engine.
+  for (int i = 0; i < 10; ++i) {
+    engine_.AdvanceFrame(kTimePerFrame);
+  }
+  EXPECT_EQ(1.0f, a.Value());
+  EXPECT_EQ(3.0f, c.Value());
+  EXPECT_EQ(0u, c.ChangedFrame());
+}
+
+// Returns the number of `type` events for `motivator` in the last frame.
+static int CountEvents(const MotiveEngine& engine,
+                       const motive::Motivator& motivator,
+                       motive::MotiveEventType type) {
+  int count = 0;
+  for (size_t i = 0; i < engine.events().size(); ++i) {
+    const motive::MotiveEvent& event = engine.events()[i];
+    if (event.motivator == &motivator && event.type == type) ++count;
+  }
+  return count;
+}
+
+// The engine should report the end of a matrix animation on the frame that
+// its TimeRemaining() reaches 0, and only on that frame.
+TEST_F(MotiveTests, PlaybackEndedEventMatchesTimeRemaining) {
+  MatrixMotivator4f matrix(MatrixInit(std::vector<MatrixOperationInit>()),
+                           &engine_);
+  const MotiveTarget1f target = motive::Target1f(5.0f, 0.0f, 100);
+  std::vector<MatrixOperationInit> animated;
+  animated.emplace_back(0, motive::kTranslateX, spline_scalar_init, target);
+  matrix.BlendToOps(animated, SplinePlayback(0.0f, false, 2.0f));
+
+  int num_ended = 0;
+  for (MotiveTime t = 0; t <= kMaxTime; t += kTimePerFrame) {
+    const bool playing = matrix.TimeRemaining() > 0;
+    engine_.AdvanceFrame(kTimePerFrame);
+    const int count = CountEvents(engine_, matrix,
+                                  motive::kMotiveEventPlaybackEnded);
+    EXPECT_EQ(playing && matrix.TimeRemaining() <= 0 ? 1 : 0, count);
+    num_ended += count;
+  }
+  EXPECT_EQ(1, num_ended);
+}
+
+// Overshoot motivators should report settling on their target once.
+TEST_F(MotiveTests, TargetReachedEventOnSettle) {
+  Motivator1f overshoot(overshoot_percent_init_, &engine_);
+  overshoot.SetTarget(motive::CurrentToTarget1f(0.0f, 1.0f, 80.0f, 0.0f, 100));
+
+  int num_reached = 0;
+  for (MotiveTime t = 0; t <= kMaxTime; t += kTimePerFrame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+    num_reached += CountEvents(engine_, overshoot,
+                               motive::kMotiveEventTargetReached);
+  }
+  EXPECT_EQ(1, num_reached);
+  EXPECT_EQ(80.0f, overshoot.Value());
+}
+
+// Setting the targets of many motivators at once should give the same results
+// as setting them one at a time, including when the motivators' indices
+// aren't contiguous.
+TEST_F(MotiveTests, BulkSetTargetsMatchesIndividual) {
+  static const int kNumMotivators = 20;
+  std::vector<Motivator1f> splines(kNumMotivators);
+  std::vector<Motivator1f> eases(kNumMotivators);
+  const motive::EaseInEaseOutInit1f ease_init(1.0f, 0.0f);
+  for (int i = 0; i < kNumMotivators; ++i) {
+    splines[i].Initialize(spline_scalar_init, &engine_);
+    eases[i].Initialize(ease_init, &engine_);
+  }
+  engine_.AdvanceFrame(kTimePerFrame);
+
+  // The odd motivators get their targets individually, and the even ones in
+  // bulk.
+  const MotiveCurveShape shape(10.0f, 100.0f, 0.5f);
+  std::vector<Motivator1f> bulk_splines;
+  std::vector<Motivator1f> bulk_eases;
+  std::vector<MotiveTarget1f> targets;
+  std::vector<float> target_values;
+  std::vector<float> target_velocities;
+  for (int i = 0; i < kNumMotivators; i += 2) {
+    const float value = static_cast<float>(i);
+    splines[i + 1].SetTarget(
+        motive::CurrentToTarget1f(0.0f, 0.0f, value, 0.0f, 100));
+    eases[i + 1].SetTargetWithShape(value, 0.0f, shape);
+    bulk_splines.push_back(std::move(splines[i]));
+    bulk_eases.push_back(std::move(eases[i]));
+    targets.push_back(motive::CurrentToTarget1f(0.0f, 0.0f, value, 0.0f, 100));
+    target_values.push_back(value);
+    target_velocities.push_back(0.0f);
+  }
+  Motivator1f::SetTargetsInBulk(bulk_splines.data(), bulk_splines.size(),
+                                targets.data());
+  Motivator1f::SetTargetsWithShapeInBulk(
+      bulk_eases.data(), bulk_eases.size(), target_values.data(),
+      target_velocities.data(), shape);
+
+  for (MotiveTime t = 0; t < 200; t += kTimePerFrame) {
+    for (size_t j = 0; j < bulk_splines.size(); ++j) {
+      EXPECT_EQ(splines[2 * j + 1].Value(), bulk_splines[j].Value());
+      EXPECT_EQ(eases[2 * j + 1].Value(), bulk_eases[j].Value());
+    }
+    engine_.AdvanceFrame(kTimePerFrame);
+  }
+  EXPECT_NEAR(18.0f, bulk_splines.back().Value(), 0.01f);
+}
+
+// Commands pushed from many threads at once should all be applied by the
+// next AdvanceFrame(), in the order they were pushed for each motivator, with
+// the same result as calling SetTarget() directly.
+TEST_F(MotiveTests, CommandQueueAppliesCommandsFromManyThreads) {
+  static const int kNumThreads = 4;
+  static const int kNumMotivatorsPerThread = 16;
+  static const int kNumMotivators = kNumThreads * kNumMotivatorsPerThread;
+  std::vector<Motivator1f> queued(kNumMotivators);
+  std::vector<Motivator1f> direct(kNumMotivators);
+  for (int i = 0; i < kNumMotivators; ++i) {
+    queued[i].Initialize(spline_scalar_init, &engine_);
+    direct[i].Initialize(spline_scalar_init, &engine_);
+  }
+  engine_.AdvanceFrame(kTimePerFrame);
+
+  // Nothing can be queued until the queue has a capacity. Each motivator
+  // gets two commands, and only the second should stick.
+  const MotiveTarget1f unused = motive::Target1f(-1.0f, 0.0f, 100);
+  EXPECT_FALSE(engine_.commands().SetTargets(&queued[0], 1, &unused));
+  engine_.set_command_capacity(2 * kNumMotivators);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; ++t) {
+    threads.emplace_back([this, &queued, &unused, t]() {
+      for (int j = 0; j < kNumMotivatorsPerThread; ++j) {
+        const int i = t * kNumMotivatorsPerThread + j;
+        const MotiveTarget1f target =
+            motive::Target1f(static_cast<float>(i), 0.0f, 100);
+        EXPECT_TRUE(engine_.commands().SetTargets(&queued[i], 1, &unused));
+        EXPECT_TRUE(engine_.commands().SetTargets(&queued[i], 1, &target));
+      }
+    });
+  }
+  for (auto it = threads.begin(); it != threads.end(); ++it) it->join();
+  EXPECT_FALSE(engine_.commands().SetTargets(&queued[0], 1, &unused));
+
+  for (int i = 0; i < kNumMotivators; ++i) {
+    direct[i].SetTarget(motive::Target1f(static_cast<float>(i), 0.0f, 100));
+  }
+  for (MotiveTime t = 0; t < 200; t += kTimePerFrame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+    for (int i = 0; i < kNumMotivators; ++i) {
+      EXPECT_EQ(direct[i].Value(), queued[i].Value());
+    }
+  }
+  EXPECT_NEAR(static_cast<float>(kNumMotivators - 1), queued.back().Value(),
+              0.01f);
+}
+
+// Rig commands applied from the queue should be recorded once each, like
+// direct calls, so that replays of sessions that use the queue match.
+TEST_F(MotiveTests, QueuedRigCommandsAreRecorded) {
+  motive::RigAnim anim;
+  anim.Init("queued", 1, false);
+  anim.InitMatrixAnim(0, motive::kInvalidBoneIdx, "")
+      .ops()
+      .emplace_back(0, kRotateAboutY, spline_angle_init_, simple_spline_);
+  const motive::RigInit init(anim, anim.bone_parents(), 1);
+
+  motive::MotiveRecorder recorder;
+  engine_.set_recorder(&recorder);
+  engine_.set_command_capacity(4);
+  motive::RigMotivator rig(init, &engine_);
+  const size_t num_calls = recorder.NumCalls();
+
+  EXPECT_TRUE(engine_.commands().BlendToAnim(&rig, anim, SplinePlayback()));
+  EXPECT_TRUE(engine_.commands().SetPlaybackRate(&rig, 0.5f));
+  engine_.AdvanceFrame(kTimePerFrame);
+  engine_.set_recorder(nullptr);
+
+  // BlendToAnim(), SetPlaybackRate() and AdvanceFrame().
+  EXPECT_EQ(num_calls + 3, recorder.NumCalls());
+}
+
+// Exported values and velocities should be written in the order of the
+// motivators, at the requested stride, even after the processor has moved
+// their indices around.
+TEST_F(MotiveTests, ExportValuesFollowsMotivatorOrder) {
+  static const int kNumMotivators = 8;
+  static const size_t kStride = 4;
+  std::vector<Motivator1f> motivators(kNumMotivators);
+  for (int i = 0; i < kNumMotivators; ++i) {
+    motivators[i].InitializeWithTarget(
+        spline_scalar_init, &engine_,
+        motive::CurrentToTarget1f(static_cast<float>(i), 0.0f, 10.0f, 0.0f,
+                                  100));
+  }
+
+  // Free some indices so that Defragment() moves the remaining ones.
+  motivators[1].Invalidate();
+  motivators[2].Invalidate();
+  motivators.erase(motivators.begin() + 1, motivators.begin() + 3);
+  engine_.AdvanceFrame(kTimePerFrame);
+
+  std::vector<float> values(motivators.size() * kStride, -1.0f);
+  std::vector<float> velocities(motivators.size() * kStride, -1.0f);
+  Motivator1f::ExportValues(motivators.data(), motivators.size(), kStride,
+                            values.data());
+  Motivator1f::ExportVelocities(motivators.data(), motivators.size(),
+                                kStride, velocities.data());
+  for (size_t i = 0; i < motivators.size(); ++i) {
+    EXPECT_EQ(motivators[i].Value(), values[i * kStride]);
+    EXPECT_EQ(motivators[i].Velocity(), velocities[i * kStride]);
+    EXPECT_EQ(-1.0f, values[i * kStride + 1]);
+  }
+}
+
+// Typed spline motivators read the processor directly, but should see
+// exactly what the generic motivators see through the virtual accessors.
+TEST_F(MotiveTests, TypedSplineMotivatorMatchesGeneric) {
+  const MotiveTarget3f target = Motivator3f::TargetBuilder::CurrentToTarget(
+      vec3(1.0f, -2.0f, 3.0f), vec3(0.1f, 0.0f, -0.1f),
+      vec3(10.0f, 20.0f, -30.0f), mathfu::kZeros3f, 200);
+  Motivator3f generic(spline_scalar_init, &engine_, target);
+  SplineMotivator3f typed(spline_scalar_init, &engine_, target);
+
+  for (int i = 0; i < 10; ++i) {
+    engine_.AdvanceFrame(kTimePerFrame);
+    EXPECT_TRUE(VectorEqual(generic.Value(), typed.Value()));
+    EXPECT_TRUE(VectorEqual(generic.Velocity(), typed.Velocity()));
+    EXPECT_TRUE(VectorEqual(generic.Direction(), typed.Direction()));
+    EXPECT_TRUE(VectorEqual(generic.TargetValue(), typed.TargetValue()));
+    EXPECT_TRUE(VectorEqual(generic.TargetVelocity(), typed.TargetVelocity()));
+    EXPECT_TRUE(VectorEqual(generic.Difference(), typed.Difference()));
+  }
+}
+
+// After reserving, initializing up to the reserved number of motivators
+// should not reallocate the processor's arrays, so the values stay put.
+TEST_F(MotiveTests, ReserveKeepsValuesInPlace) {
+  static const int kNumMotivators = 100;
+  EXPECT_FALSE(engine_.Reserve(motive::kMotivatorTypeInvalid, kNumMotivators));
+  EXPECT_TRUE(engine_.Reserve(motive::SplineInit::kType, kNumMotivators));
+
+  std::vector<Motivator1f> motivators(kNumMotivators);
+  motivators[0].Initialize(spline_scalar_init, &engine_);
+  const float* first_value = motivators[0].Values();
+  for (int i = 1; i < kNumMotivators; ++i) {
+    motivators[i].Initialize(spline_scalar_init, &engine_);
+  }
+  EXPECT_EQ(first_value, motivators[0].Values());
+}
+
+// Reserving more room while a motivator is live reallocates the processor's
+// arrays, so the motivator should then read its values from the new ones.
+TEST_F(MotiveTests, ReserveWithLiveMotivator) {
+  Motivator1f motivator(spline_scalar_init, &engine_);
+  motivator.SetTarget(motive::Current1f(3.0f));
+  engine_.AdvanceFrame(kTimePerFrame);
+  EXPECT_TRUE(engine_.Reserve(motive::SplineInit::kType, 1000));
+
+  const motive::MotiveProcessorNf* processor =
+      static_cast<const motive::MotiveProcessorNf*>(
+          engine_.Processor(motive::SplineInit::kType));
+  EXPECT_EQ(processor->Values(0), motivator.Values());
+  EXPECT_EQ(3.0f, motivator.Value());
+}
+
+// Registered types should have dense ids, and both lookups should find the
+// processor that the motivators were created in.
+TEST_F(MotiveTests, ProcessorLookupByTypeId) {
+  const int id = motive::SplineInit::kType->id;
+  EXPECT_LE(0, id);
+  EXPECT_NE(id, motive::MatrixInit::kType->id);
+  motive::SplineInit::Register();
+  EXPECT_EQ(id, motive::SplineInit::kType->id);
+
+  Motivator1f motivator(spline_scalar_init, &engine_);
+  motive::MotiveProcessor* processor = engine_.Processor<motive::SplineInit>();
+  EXPECT_NE(nullptr, processor);
+  EXPECT_EQ(processor, engine_.Processor(motive::SplineInit::kType));
+  EXPECT_EQ(motive::SplineInit::kType, motivator.Type());
+  EXPECT_EQ(nullptr, engine_.Processor(motive::kMotivatorTypeInvalid));
+}
+
+// When defragmenting is limited to one move per frame, the motivators that
+// remain should keep animating correctly while the holes are filled in.
+TEST_F(MotiveTests, BudgetedDefragmentKeepsValues) {
+  static const int kNumMotivators = 16;
+  EXPECT_TRUE(engine_.SetDefragmentBudget(motive::SplineInit::kType, 1, -1));
+
+  std::vector<Motivator1f> motivators(kNumMotivators);
+  for (int i = 0; i < kNumMotivators; ++i) {
+    motivators[i].InitializeWithTarget(
+        spline_scalar_init, &engine_,
+        motive::CurrentToTarget1f(0.0f, 0.0f, static_cast<float>(i), 0.0f,
+                                  100));
+  }
+
+  // Leave a hole at every other index.
+  for (int i = 0; i < kNumMotivators; i += 2) {
+    motivators[i].Invalidate();
+  }
+  for (MotiveTime t = 0; t < 200; t += kTimePerFrame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+  }
+  for (int i = 1; i < kNumMotivators; i += 2) {
+    EXPECT_NEAR(static_cast<float>(i), motivators[i].Value(), 0.01f);
+  }
+}
+
+// Reordering should store a matrix's children next to each other, in op
+// order, without changing any values.
+TEST_F(MotiveTests, ReorderIndicesGroupsMatrixChildren) {
+  static const int kNumFillers = 6;
+  std::vector<Motivator1f> fillers(kNumFillers);
+  for (int i = 0; i < kNumFillers; ++i) {
+    fillers[i].InitializeWithTarget(
+        spline_scalar_init, &engine_,
+        motive::CurrentToTarget1f(static_cast<float>(i), 0.0f, 10.0f, 0.0f,
+                                  100));
+  }
+
+  // The matrix's children fill the holes, between the remaining fillers.
+  for (int i = 0; i < kNumFillers; i += 2) {
+    fillers[i].Invalidate();
+  }
+  std::vector<MatrixOperationInit> ops;
+  ops.emplace_back(0, kTranslateX, spline_scalar_init, 1.0f);
+  ops.emplace_back(1, kTranslateY, spline_scalar_init, 2.0f);
+  ops.emplace_back(2, kTranslateZ, spline_scalar_init, 3.0f);
+  MatrixMotivator4f matrix(MatrixInit(ops), &engine_);
+  EXPECT_NE(matrix.ChildMotivator1f(0)->Values() + 1,
+            matrix.ChildMotivator1f(1)->Values());
+
+  const mat4 before = matrix.Value();
+  engine_.ReorderIndices();
+  for (int i = 1; i < 3; ++i) {
+    EXPECT_EQ(matrix.ChildMotivator1f(0)->Values() + i,
+              matrix.ChildMotivator1f(i)->Values());
+  }
+  for (int i = 1; i < kNumFillers; i += 2) {
+    EXPECT_EQ(static_cast<float>(i), fillers[i].Value());
+  }
+  ExpectMatricesEqual(before, matrix.Value(), 0.0f);
+
+  engine_.AdvanceFrame(kTimePerFrame);
+  ExpectMatricesEqual(before, matrix.Value(), 0.0f);
+}
+
+// Suspended motivators should hold their values while the engine advances,
+// then jump to where they'd be had they never been suspended.
+TEST_F(MotiveTests, SuspendedMotivatorsCatchUpWhenResumed) {
+  static const int kNumFrames = 5;
+  const motive::MotiveTarget1f target =
+      motive::CurrentToTarget1f(0.0f, 0.0f, 10.0f, 0.0f, 100);
+  Motivator1f suspended(spline_scalar_init, &engine_, target);
+  Motivator1f reference(spline_scalar_init, &engine_, target);
+  Motivator1f behind(spline_scalar_init, &engine_, target);
+  engine_.AdvanceFrame(kTimePerFrame);
+
+  const motive::Motivator* motivators[] = {&suspended};
+  engine_.SuspendMotivators(motivators, 1);
+  const float held = suspended.Value();
+  for (int i = 0; i < kNumFrames; ++i) {
+    engine_.AdvanceFrame(kTimePerFrame);
+    EXPECT_EQ(held, suspended.Value());
+  }
+  EXPECT_LT(held, reference.Value());
+  EXPECT_EQ(reference.Value(), behind.Value());
+
+  engine_.ResumeMotivators(motivators, 1);
+  EXPECT_NEAR(reference.Value(), suspended.Value(), 1e-4f);
+  engine_.AdvanceFrame(kTimePerFrame);
+  EXPECT_NEAR(reference.Value(), suspended.Value(), 1e-4f);
+}
+
+// Handles can be copied as plain bytes, still resolve to their motivator, and
+// become stale once that motivator is destroyed, even if its slot is reused.
+TEST_F(MotiveTests, MotivatorHandlesDetectStaleness) {
+  motive::MotivatorHandleTable<Motivator1f> table;
+  const motive::MotiveHandle handle = table.Create();
+  table.Get(handle)->InitializeWithTarget(
+      spline_scalar_init, &engine_,
+      motive::CurrentToTarget1f(0.0f, 0.0f, 10.0f, 0.0f, 100));
+
+  motive::MotiveHandle copy;
+  memcpy(&copy, &handle, sizeof(copy));
+  EXPECT_EQ(table.Get(handle), table.Get(copy));
+  engine_.AdvanceFrame(kTimePerFrame);
+  EXPECT_LT(0.0f, table.Get(copy)->Value());
+
+  table.Destroy(handle);
+  EXPECT_FALSE(table.Alive(copy));
+  EXPECT_EQ(nullptr, table.Get(copy));
+
+  const motive::MotiveHandle reused = table.Create();
+  EXPECT_EQ(handle.index, reused.index);
+  EXPECT_NE(handle, reused);
+  EXPECT_FALSE(table.Get(reused)->Valid());
+  EXPECT_EQ(1u, table.Size());
+}
+
+// Transient motivators should animate like any other, then be destroyed by
+// the engine once they reach their target, freeing their slot for reuse.
+TEST_F(MotiveTests, TransientMotivatorsExpireAtTargetTime) {
+  static const MotiveTime kTargetTime = 100;
+  const motive::MotiveTarget1f target =
+      motive::CurrentToTarget1f(0.0f, 0.0f, 10.0f, 0.0f, kTargetTime);
+  const motive::MotiveHandle handle =
+      engine_.CreateTransient(spline_scalar_init, 1, &target);
+  EXPECT_EQ(1u, engine_.NumTransients());
+
+  engine_.AdvanceFrame(kTimePerFrame);
+  ASSERT_NE(nullptr, engine_.Transient(handle));
+  EXPECT_LT(0.0f, engine_.Transient(handle)->Values()[0]);
+
+  for (MotiveTime t = kTimePerFrame; t <= kTargetTime; t += kTimePerFrame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+  }
+  EXPECT_EQ(nullptr, engine_.Transient(handle));
+  EXPECT_EQ(0u, engine_.NumTransients());
+
+  const motive::MotiveHandle reused =
+      engine_.CreateTransient(spline_scalar_init, 1, &target);
+  EXPECT_EQ(handle.index, reused.index);
+  EXPECT_NE(handle, reused);
+  engine_.DestroyTransient(reused);
+  EXPECT_EQ(0u, engine_.NumTransients());
+}
+
+// With a fixed time step, values should only move once a whole step has
+// accumulated, and be interpolated between steps in the meantime.
+TEST_F(MotiveTests, FixedTimeStepInterpolatesBetweenSteps) {
+  static const MotiveTime kStep = 2 * kTimePerFrame;
+  engine_.set_fixed_time_step(kStep);
+  Motivator1f motivator(spline_scalar_init, &engine_,
+                        motive::CurrentToTarget1f(0.0f, 1.0f, 10.0f, 0.0f,
+                                                  10 * kStep));
+
+  // Not yet a whole step, so nothing moves.
+  engine_.AdvanceFrame(kTimePerFrame);
+  EXPECT_EQ(0u, engine_.frame_count());
+  EXPECT_EQ(0.0f, motivator.Value());
+  EXPECT_FLOAT_EQ(0.5f, engine_.render_alpha());
+  EXPECT_EQ(0.0f, motivator.InterpolatedValue(engine_.render_alpha()));
+
+  // One whole step, with nothing left over.
+  engine_.AdvanceFrame(kTimePerFrame);
+  EXPECT_EQ(1u, engine_.frame_count());
+  EXPECT_EQ(0.0f, engine_.render_alpha());
+  const float after_one_step = motivator.Value();
+  EXPECT_LT(0.0f, after_one_step);
+  EXPECT_EQ(0.0f, motivator.InterpolatedValue(0.0f));
+  EXPECT_EQ(after_one_step, motivator.InterpolatedValue(1.0f));
+
+  // A step and a half. Half-way to the next step is half-way between the
+  // two latest steps' values.
+  engine_.AdvanceFrame(kStep + kTimePerFrame);
+  EXPECT_EQ(2u, engine_.frame_count());
+  const float after_two_steps = motivator.Value();
+  EXPECT_LT(after_one_step, after_two_steps);
+  EXPECT_FLOAT_EQ(0.5f, engine_.render_alpha());
+  EXPECT_FLOAT_EQ(0.5f * (after_one_step + after_two_steps),
+                  motivator.InterpolatedValue(engine_.render_alpha()));
+
+  engine_.set_fixed_time_step(0);
+  engine_.AdvanceFrame(kTimePerFrame);
+  EXPECT_EQ(3u, engine_.frame_count());
+  EXPECT_LT(after_two_steps, motivator.Value());
+}
+
+// While a fixed step is advancing in the background, a double-buffered
+// engine should interpolate between the steps of the previous frame.
+TEST_F(MotiveTests, FixedTimeStepAsyncInterpolatesPreviousFrame) {
+  static const MotiveTime kStep = 2 * kTimePerFrame;
+  MotiveEngine async_engine;
+  async_engine.set_double_buffered(true);
+  MotiveEngine* engines[] = {&engine_, &async_engine};
+  Motivator1f motivators[MOTIVE_ARRAY_SIZE(engines)];
+  for (size_t i = 0; i < MOTIVE_ARRAY_SIZE(engines); ++i) {
+    engines[i]->set_fixed_time_step(kStep);
+    motivators[i].InitializeWithTarget(
+        spline_scalar_init, engines[i],
+        motive::CurrentToTarget1f(0.0f, 1.0f, 10.0f, 0.0f, 10 * kStep));
+  }
+
+  for (MotiveTime time = 0; time < 10 * kStep; time += kTimePerFrame) {
+    async_engine.AdvanceFrameAsync(kTimePerFrame);
+    EXPECT_EQ(motivators[0].InterpolatedValue(0.5f),
+              motivators[1].InterpolatedValue(0.5f));
+    engine_.AdvanceFrame(kTimePerFrame);
+  }
+
+  async_engine.WaitForFrame();
+  EXPECT_EQ(motivators[0].InterpolatedValue(0.5f),
+            motivators[1].InterpolatedValue(0.5f));
+}
+
+// Value outputs should be written in their format every frame, follow their
+// motivator when it's moved, and stop once reset.
+TEST_F(MotiveTests, ValueOutputsWrittenInFormat) {
+  const MotiveTarget1f targets[] = {
+      motive::CurrentToTarget1f(-0.5f, 0.0f, 0.5f, 0.0f, 100),
+      motive::CurrentToTarget1f(2.0f, 0.0f, 4.0f, 0.0f, 100)};
+  Motivator1f padding(spline_scalar_init, &engine_);
+  motive::MotivatorNf motivators[4];
+  for (int i = 0; i < 4; ++i) {
+    motivators[i].InitializeWithTargets(spline_scalar_init, &engine_, 2,
+                                        targets);
+  }
+  float floats[2] = {0.0f, 0.0f};
+  uint16_t halves[2] = {0, 0};
+  int16_t snorms[2] = {0, 0};
+  uint16_t unorms[2] = {0, 0};
+  const Range ranges[2] = {Range(-1.0f, 1.0f), Range(0.0f, 4.0f)};
+  motivators[0].SetValueOutput(
+      motive::ValueOutput(floats, motive::ValueOutput::kFloat));
+  motivators[1].SetValueOutput(
+      motive::ValueOutput(halves, motive::ValueOutput::kHalf));
+  motivators[2].SetValueOutput(
+      motive::ValueOutput(snorms, motive::ValueOutput::kSnorm16));
+  motivators[3].SetValueOutput(motive::ValueOutput(
+      unorms, motive::ValueOutput::kUnorm16InRange, ranges));
+
+  // Free up space before the motivators, so that they're moved.
+  padding.Invalidate();
+  engine_.AdvanceFrame(kTimePerFrame);
+
+  const float* values = motivators[0].Values();
+  EXPECT_LT(-0.5f, values[0]);
+  EXPECT_EQ(values[0], floats[0]);
+  EXPECT_EQ(values[1], floats[1]);
+  EXPECT_EQ(motive::FloatToHalf(values[0]), halves[0]);
+  EXPECT_EQ(motive::FloatToHalf(values[1]), halves[1]);
+  EXPECT_EQ(motive::FloatToSnorm16(values[0]), snorms[0]);
+  EXPECT_EQ(32767, snorms[1]);
+  EXPECT_EQ(motive::FloatToUnorm16(values[0], ranges[0]), unorms[0]);
+  EXPECT_EQ(motive::FloatToUnorm16(values[1], ranges[1]), unorms[1]);
+
+  // Reset motivators stop writing.
+  motivators[0].Invalidate();
+  floats[0] = floats[1] = 0.0f;
+  engine_.AdvanceFrame(kTimePerFrame);
+  EXPECT_EQ(0.0f, floats[0]);
+  EXPECT_EQ(0.0f, floats[1]);
+  EXPECT_EQ(motive::FloatToHalf(motivators[1].Values()[0]), halves[0]);
+}
+
+// Freeing and reusing indices scattered across many bitmap words should keep
+// every remaining motivator driving its own value.
+TEST_F(MotiveTests, IndexChurnKeepsMotivatorsSane) {
+  static const int kNumMotivators = 5000;
+  std::vector<Motivator1f> motivators(kNumMotivators);
+  const auto initialize = [this, &motivators](int i) {
+    motivators[i].InitializeWithTarget(
+        spline_scalar_init, &engine_,
+        motive::CurrentToTarget1f(static_cast<float>(i), 0.0f,
+                                  static_cast<float>(i), 0.0f, 100));
+  };
+  for (int i = 0; i < kNumMotivators; ++i) initialize(i);
+
+  // Free every third motivator, then reuse half of those indices before the
+  // next Defragment().
+  for (int i = 0; i < kNumMotivators; i += 3) motivators[i].Invalidate();
+  for (int i = 0; i < kNumMotivators; i += 6) initialize(i);
+  engine_.AdvanceFrame(kTimePerFrame);
+
+  for (int i = 0; i < kNumMotivators; ++i) {
+    EXPECT_TRUE(motivators[i].Sane());
+    EXPECT_EQ(i % 3 != 0 || i % 6 == 0, motivators[i].Valid());
+    if (motivators[i].Valid()) {
+      EXPECT_NEAR(static_cast<float>(i), motivators[i].Value(), 0.01f);
+    }
+  }
+}
+
+// Memory stats should include the local splines built for targets, and count
+// reserved but unused capacity as slack.
+TEST_F(MotiveTests, MemoryStatsReportSplinesAndSlack) {
+  static const int kNumMotivators = 10;
+  std::vector<Motivator1f> motivators(kNumMotivators);
+  for (int i = 0; i < kNumMotivators; ++i) {
+    motivators[i].InitializeWithTarget(
+        spline_scalar_init, &engine_,
+        motive::CurrentToTarget1f(0.0f, 0.0f, 10.0f, 0.0f, 100));
+  }
+  std::map<motive::MotivatorType, motive::MemoryStats> stats;
+  engine_.GetMemoryStats(&stats);
+  const motive::MemoryStats before = stats[motive::SplineInit::kType];
+  EXPECT_LT(0u, before.live_bytes);
+  EXPECT_LT(0u, before.spline_header_bytes);
+  EXPECT_LT(0u, before.spline_node_bytes);
+  EXPECT_LE(before.spline_header_bytes + before.spline_node_bytes,
+            before.live_bytes);
+
+  engine_.Reserve(motive::SplineInit::kType, 100 * kNumMotivators);
+  engine_.GetMemoryStats(&stats);
+  const motive::MemoryStats after = stats[motive::SplineInit::kType];
+  EXPECT_EQ(before.live_bytes, after.live_bytes);
+  EXPECT_LT(before.slack_bytes, after.slack_bytes);
+}
+
+// Trimming after a peak should release the slack, whether asked for or once
+// the processor has been underused for long enough, and keep every value.
+TEST_F(MotiveTests, TrimReleasesMemoryAfterPeak) {
+  static const int kPeak = 1000;
+  static const int kRemaining = 10;
+  static const uint32_t kAutoTrimFrames = 3;
+  std::vector<Motivator1f> motivators(kPeak);
+  for (int i = 0; i < kPeak; ++i) {
+    motivators[i].InitializeWithTarget(
+        spline_scalar_init, &engine_,
+        motive::CurrentToTarget1f(static_cast<float>(i), 0.0f,
+                                  static_cast<float>(i), 0.0f, 100));
+  }
+  std::map<motive::MotivatorType, motive::MemoryStats> stats;
+  engine_.GetMemoryStats(&stats);
+  const motive::MemoryStats peak = stats[motive::SplineInit::kType];
+
+  // Keep every hundredth motivator, so that the rest are scattered.
+  const auto shrink = [&motivators]() {
+    for (int i = 0; i < kPeak; ++i) {
+      if (i % (kPeak / kRemaining) != 0) motivators[i].Invalidate();
+    }
+  };
+  shrink();
+  engine_.AdvanceFrame(kTimePerFrame);
+  engine_.Trim();
+  engine_.GetMemoryStats(&stats);
+  const motive::MemoryStats trimmed = stats[motive::SplineInit::kType];
+  EXPECT_GT(peak.TotalBytes() / 4, trimmed.TotalBytes());
+  for (int i = 0; i < kPeak; i += kPeak / kRemaining) {
+    EXPECT_FLOAT_EQ(static_cast<float>(i), motivators[i].Value());
+  }
+
+  // Peak again, then let the automatic trim catch the drop.
+  engine_.set_auto_trim_frames(kAutoTrimFrames);
+  for (int i = 0; i < kPeak; ++i) {
+    if (motivators[i].Valid()) continue;
+    motivators[i].InitializeWithTarget(
+        spline_scalar_init, &engine_,
+        motive::CurrentToTarget1f(static_cast<float>(i), 0.0f,
+                                  static_cast<float>(i), 0.0f, 100));
+  }
+  engine_.AdvanceFrame(kTimePerFrame);
+  shrink();
+  for (uint32_t frame = 1; frame < kAutoTrimFrames; ++frame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+  }
+  engine_.GetMemoryStats(&stats);
+  EXPECT_LT(peak.TotalBytes() / 4,
+            stats[motive::SplineInit::kType].TotalBytes());
+  engine_.AdvanceFrame(kTimePerFrame);
+  engine_.GetMemoryStats(&stats);
+  EXPECT_GT(peak.TotalBytes() / 4,
+            stats[motive::SplineInit::kType].TotalBytes());
+  for (int i = 0; i < kPeak; i += kPeak / kRemaining) {
+    EXPECT_FLOAT_EQ(static_cast<float>(i), motivators[i].Value());
+  }
+}
+
+// Matrices should skip the holes left by a budgeted defragment, and the
+// remaining matrices should keep animating correctly.
+TEST_F(MotiveTests, BudgetedDefragmentKeepsMatrices) {
+  static const int kNumMatrices = 16;
+  EXPECT_TRUE(engine_.SetDefragmentBudget(motive::MatrixInit::kType, 1, -1));
+
+  std::vector<MatrixMotivator4f> matrices(kNumMatrices);
+  for (int i = 0; i < kNumMatrices; ++i) {
+    std::vector<MatrixOperationInit> ops;
+    ops.emplace_back(0, motive::kTranslateX, spline_scalar_init,
+                     motive::Target1f(static_cast<float>(i), 0.0f, 100));
+    ops.emplace_back(1, motive::kRotateAboutY, spline_angle_init_, 0.0f);
+    matrices[i].Initialize(MatrixInit(ops), &engine_);
+  }
+
+  // Leave a hole at every other index.
+  for (int i = 0; i < kNumMatrices; i += 2) {
+    matrices[i].Invalidate();
+  }
+  for (MotiveTime t = 0; t < 200; t += kTimePerFrame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+  }
+  for (int i = 1; i < kNumMatrices; i += 2) {
+    EXPECT_NEAR(static_cast<float>(i),
+                matrices[i].Value().TranslationVector3D().x, kMatrixEpsilon);
+  }
+}
+
+// Rigs should skip the holes left by a budgeted defragment, and the
+// remaining rigs should keep animating correctly.
+TEST_F(MotiveTests, BudgetedDefragmentKeepsRigs) {
+  static const int kNumRigs = 8;
+  EXPECT_TRUE(engine_.SetDefragmentBudget(motive::RigInit::kType, 1, -1));
+
+  motive::RigAnim anims[kNumRigs];
+  std::vector<motive::RigMotivator> rigs(kNumRigs);
+  for (int i = 0; i < kNumRigs; ++i) {
+    anims[i].Init("defragment", 1, false);
+    std::vector<MatrixOperationInit>& ops =
+        anims[i].InitMatrixAnim(0, motive::kInvalidBoneIdx, "").ops();
+    ops.emplace_back(0, kTranslateX, spline_scalar_init,
+                     static_cast<float>(i));
+    rigs[i].Initialize(motive::RigInit(anims[i], anims[i].bone_parents(), 1),
+                       &engine_);
+    rigs[i].BlendToAnim(anims[i], SplinePlayback());
+  }
+
+  // Leave a hole at every other index.
+  for (int i = 0; i < kNumRigs; i += 2) {
+    rigs[i].Invalidate();
+  }
+  for (int frame = 0; frame < kNumRigs; ++frame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+    for (int i = 1; i < kNumRigs; i += 2) {
+      const mat4 transform =
+          mat4::FromAffineTransform(rigs[i].GlobalTransforms()[0]);
+      EXPECT_NEAR(static_cast<float>(i), transform.TranslationVector3D().x,
+                  kMatrixEpsilon);
+    }
+  }
+}
+
+// Forwards to the default allocator, counting the calls made through it.
+class CountingAllocator : public motive::MotiveAllocator {
+ public:
+  CountingAllocator() : num_allocations_(0), num_frees_(0) {}
+  void* Allocate(size_t size, size_t alignment) override {
+    ++num_allocations_;
+    return MotiveAllocator::Default()->Allocate(size, alignment);
+  }
+  void Free(void* p) override {
+    if (p != nullptr) ++num_frees_;
+    MotiveAllocator::Default()->Free(p);
+  }
+  int num_allocations() const { return num_allocations_; }
+  int num_frees() const { return num_frees_; }
+
+ private:
+  int num_allocations_;
+  int num_frees_;
+};
+
+// Spline data, including the local splines built for targets, should come
+// from the engine's allocator, and all of it should be returned to that
+// allocator when the engine is reset.
+TEST_F(MotiveTests, EngineAllocatorHoldsSplineData) {
+  CountingAllocator allocator;
+  MotiveEngine engine;
+  engine.set_allocator(&allocator);
+  EXPECT_EQ(&allocator, engine.allocator());
+  {
+    Motivator1f motivator;
+    motivator.InitializeWithTarget(
+        spline_scalar_init, &engine,
+        motive::CurrentToTarget1f(0.0f, 0.0f, 10.0f, 0.0f, 100));
+    engine.AdvanceFrame(kTimePerFrame);
+    EXPECT_LT(0, allocator.num_allocations());
+  }
+  engine.Reset();
+  EXPECT_EQ(allocator.num_allocations(), allocator.num_frees());
+}
+
+// The per-index arrays of every processor, and the ops of matrix motivators,
+// should come from the engine's allocator too.
+TEST_F(MotiveTests, EngineAllocatorHoldsProcessorData) {
+  CountingAllocator allocator;
+  MotiveEngine engine;
+  engine.set_allocator(&allocator);
+  {
+    Motivator1f overshoot;
+    overshoot.InitializeWithTarget(
+        overshoot_percent_init_, &engine,
+        motive::CurrentToTarget1f(0.0f, 1.0f, 80.0f, 0.0f, 100));
+    const int overshoot_allocations = allocator.num_allocations();
+    EXPECT_LT(0, overshoot_allocations);
+
+    std::vector<MatrixOperationInit> ops;
+    ops.emplace_back(0, kTranslateX, 2.0f);
+    MatrixMotivator4f matrix(MatrixInit(ops), &engine);
+    EXPECT_LT(overshoot_allocations, allocator.num_allocations());
+    engine.AdvanceFrame(kTimePerFrame);
+  }
+  engine.Reset();
+  EXPECT_EQ(allocator.num_allocations(), allocator.num_frees());
+}
+
+// While a frame is advancing in the background, a double-buffered engine
+// should present the results of the previous frame.
+TEST_F(MotiveTests, AdvanceFrameAsyncPresentsPreviousFrame) {
+  MotiveEngine async_engine;
+  async_engine.set_double_buffered(true);
+  MotiveEngine* engines[] = {&engine_, &async_engine};
+
+  std::vector<MatrixOperationInit> ops;
+  ops.emplace_back(0, kRotateAboutY, spline_angle_init_, simple_spline_);
+  ops.emplace_back(1, kTranslateX, spline_scalar_init, 2.0f);
+
+  Motivator1f overshoots[MOTIVE_ARRAY_SIZE(engines)];
+  MatrixMotivator4f matrices[MOTIVE_ARRAY_SIZE(engines)];
+  for (size_t i = 0; i < MOTIVE_ARRAY_SIZE(engines); ++i) {
+    overshoots[i].InitializeWithTarget(
+        overshoot_percent_init_, engines[i],
+        motive::CurrentToTarget1f(0.0f, 1.0f, 80.0f, 0.0f, 100));
+    matrices[i].Initialize(MatrixInit(ops), engines[i]);
+  }
+
+  for (MotiveTime time = 0; time < kMaxTime; time += kTimePerFrame) {
+    async_engine.AdvanceFrameAsync(kTimePerFrame);
+    EXPECT_EQ(overshoots[0].Value(), overshoots[1].Value());
+    ExpectMatricesEqual(matrices[0].Value(), matrices[1].Value(), 0.0f);
+    engine_.AdvanceFrame(kTimePerFrame);
+  }
+
+  async_engine.WaitForFrame();
+  EXPECT_EQ(overshoots[0].Value(), overshoots[1].Value());
+  ExpectMatricesEqual(matrices[0].Value(), matrices[1].Value(), 0.0f);
+}
+
+// A thread reading a double-buffered engine inside ReadPublished() should
+// never see outputs from two different frames, even while frames are being
+// published.
+TEST_F(MotiveTests, ReadPublishedSeesWholeFrames) {
+  MotiveEngine async_engine;
+  async_engine.set_double_buffered(true);
+  Motivator3f motivator(
+      spline_scalar_init, &async_engine,
+      Motivator3f::TargetBuilder::CurrentToTarget(
+          vec3(0.0f), vec3(0.0f), vec3(100.0f), vec3(0.0f), kMaxTime));
+
+  std::atomic<bool> done(false);
+  std::atomic<int> num_torn(0);
+  std::thread reader([&motivator, &done, &num_torn]() {
+    while (!done.load()) {
+      vec3 value;
+      motivator.ReadPublished([&motivator, &value]() {
+        value = motivator.Value();
+      });
+      if (value.x != value.y || value.x != value.z) ++num_torn;
+    }
+  });
+
+  for (MotiveTime time = 0; time < kMaxTime; time += kTimePerFrame) {
+    async_engine.AdvanceFrameAsync(kTimePerFrame);
+  }
+  async_engine.WaitForFrame();
+  done.store(true);
+  reader.join();
+  EXPECT_EQ(0, num_torn.load());
+  EXPECT_NEAR(100.0f, motivator.Value().x, 0.01f);
+}
+
+TEST_F(MotiveTests, ReplayMatchesRecordedSession) {
+  const char kRecordingFile[] = "motive_test_recording.txt";
+  motive::MotiveRecorder recorder;
+  engine_.set_recorder(&recorder);
+
+  // Ids are assigned in order of initialization: the overshoot is 0, the
+  // splines are 1 and 2. The matrix is 3, and can't be replayed.
+  std::vector<Motivator1f> motivators(3);
+  motivators[0].InitializeWithTarget(
+      overshoot_percent_init_, &engine_,
+      motive::CurrentToTarget1f(0.0f, 1.0f, 80.0f, 0.0f, 100));
+  motivators[1].InitializeWithTarget(
+      spline_scalar_init, &engine_,
+      motive::CurrentToTarget1f(0.0f, 0.0f, 10.0f, 0.0f, 200));
+  motivators[2].InitializeWithTarget(
+      spline_scalar_init, &engine_,
+      motive::CurrentToTarget1f(5.0f, 0.0f, -5.0f, 0.0f, 300));
+  std::vector<MatrixOperationInit> ops;
+  ops.emplace_back(0, kTranslateX, spline_scalar_init, 2.0f);
+  MatrixMotivator4f matrix;
+  matrix.Initialize(MatrixInit(ops), &engine_);
+
+  // Moving the Motivators keeps their ids. Removing one is recorded too.
+  motivators.reserve(10);
+  std::vector<float> recorded_values;
+  for (int frame = 0; frame < 20; ++frame) {
+    if (frame == 5) {
+      motivators[1].SetTarget(motive::Target1f(-3.0f, 0.0f, 100));
+    }
+    if (frame == 10) {
+      motivators[2].Invalidate();
+    }
+    engine_.AdvanceFrame(kTimePerFrame);
+    recorded_values.push_back(motivators[0].Value());
+    recorded_values.push_back(motivators[1].Value());
+  }
+  engine_.set_recorder(nullptr);
+  ASSERT_TRUE(recorder.Write(kRecordingFile));
+
+  MotiveEngine replay_engine;
+  motive::MotiveReplayer replayer(&replay_engine);
+  ASSERT_TRUE(replayer.Load(kRecordingFile));
+  remove(kRecordingFile);
+  EXPECT_EQ(20, replayer.NumFrames());
+
+  std::vector<float> replayed_values;
+  while (replayer.ReplayFrame()) {
+    replayed_values.push_back(replayer.Vector(0)->Values()[0]);
+    replayed_values.push_back(replayer.Vector(1)->Values()[0]);
+  }
+  EXPECT_EQ(recorded_values, replayed_values);
+  EXPECT_EQ(nullptr, replayer.Vector(2));
+  EXPECT_EQ(1, replayer.num_skipped_calls());
+}
+
+// Restoring a snapshot should rewind every Motivator, so that simulating the
+// same frames again gives the same values, whatever happened in between.
+TEST_F(MotiveTests, RestoreSnapshotRewindsState) {
+  Motivator1f overshoot;
+  overshoot.InitializeWithTarget(
+      overshoot_percent_init_, &engine_,
+      motive::CurrentToTarget1f(0.0f, 1.0f, 80.0f, 0.0f, 100));
+  Motivator1f spline;
+  spline.InitializeWithTarget(
+      spline_scalar_init, &engine_,
+      motive::CurrentToTarget1f(0.0f, 0.0f, 10.0f, 0.0f, 200));
+  std::vector<MatrixOperationInit> ops;
+  ops.emplace_back(0, kRotateAboutY, spline_angle_init_, simple_spline_);
+  ops.emplace_back(1, kTranslateX, spline_scalar_init, 2.0f);
+  MatrixMotivator4f matrix;
+  matrix.Initialize(MatrixInit(ops), &engine_);
+
+  for (int frame = 0; frame < 5; ++frame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+  }
+  motive::MotiveSnapshot snapshot;
+  engine_.Snapshot(&snapshot);
+  EXPECT_LT(0u, snapshot.Size());
+  const float snapshot_spline = spline.Value();
+  const mat4 snapshot_matrix = matrix.Value();
+
+  std::vector<float> values;
+  std::vector<mat4> matrices;
+  for (int frame = 0; frame < 10; ++frame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+    values.push_back(overshoot.Value());
+    values.push_back(spline.Value());
+    matrices.push_back(matrix.Value());
+  }
+
+  // Diverge, then roll back.
+  spline.SetTarget(motive::Target1f(-3.0f, 0.0f, 100));
+  matrix.SetChildValue1f(1, 5.0f);
+  overshoot.SetTarget(motive::Target1f(20.0f, 0.0f, 100));
+  engine_.AdvanceFrame(kTimePerFrame);
+  ASSERT_TRUE(engine_.Restore(snapshot));
+  EXPECT_EQ(snapshot_spline, spline.Value());
+  ExpectMatricesEqual(snapshot_matrix, matrix.Value(), 0.0f);
+  EXPECT_EQ(engine_.frame_count(), spline.ChangedFrame());
+
+  for (int frame = 0; frame < 10; ++frame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+    EXPECT_EQ(values[2 * frame], overshoot.Value());
+    EXPECT_EQ(values[2 * frame + 1], spline.Value());
+    ExpectMatricesEqual(matrices[frame], matrix.Value(), 0.0f);
+  }
+}
+
+// Structure isn't restored, so restoring after a Motivator is initialized
+// should fail, and leave the engine alone.
+TEST_F(MotiveTests, RestoreSnapshotRejectsNewMotivators) {
+  Motivator1f spline;
+  spline.InitializeWithTarget(
+      spline_scalar_init, &engine_,
+      motive::CurrentToTarget1f(0.0f, 0.0f, 10.0f, 0.0f, 200));
+  motive::MotiveSnapshot snapshot;
+  engine_.Snapshot(&snapshot);
+  engine_.AdvanceFrame(kTimePerFrame);
+
+  Motivator1f late_spline;
+  late_spline.InitializeWithTarget(
+      spline_scalar_init, &engine_,
+      motive::CurrentToTarget1f(0.0f, 0.0f, 10.0f, 0.0f, 200));
+  const float value = spline.Value();
+  EXPECT_FALSE(engine_.Restore(snapshot));
+  EXPECT_EQ(value, spline.Value());
+}
+
+// Rigs should return to the same playback time and global transforms.
+TEST_F(MotiveTests, RigRestoreSnapshotRewindsPlayback) {
+  motive::RigAnim anim;
+  anim.Init("rollback", 2, false);
+  for (motive::BoneIndex i = 0; i < 2; ++i) {
+    std::vector<MatrixOperationInit>& ops =
+        anim.InitMatrixAnim(i, i == 0 ? motive::kInvalidBoneIdx : 0, "")
+            .ops();
+    ops.emplace_back(0, kRotateAboutY, spline_angle_init_, simple_spline_);
+    ops.emplace_back(1, kTranslateX, spline_scalar_init, 1.0f + i);
+  }
+
+  const motive::RigInit init(anim, anim.bone_parents(), 2);
+  motive::RigMotivator rig;
+  rig.Initialize(init, &engine_);
+  rig.BlendToAnim(anim, SplinePlayback());
+  for (int frame = 0; frame < 3; ++frame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+  }
+  motive::MotiveSnapshot snapshot;
+  engine_.Snapshot(&snapshot);
+  const MotiveTime time_remaining = rig.TimeRemaining();
+
+  std::vector<mat4> transforms;
+  for (int frame = 0; frame < 5; ++frame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+    transforms.push_back(mat4::FromAffineTransform(rig.GlobalTransforms()[1]));
+  }
+
+  rig.SetPlaybackRate(2.0f);
+  engine_.AdvanceFrame(kTimePerFrame);
+  ASSERT_TRUE(engine_.Restore(snapshot));
+  EXPECT_EQ(time_remaining, rig.TimeRemaining());
+  for (int frame = 0; frame < 5; ++frame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+    ExpectMatricesEqual(
+        transforms[frame],
+        mat4::FromAffineTransform(rig.GlobalTransforms()[1]), 0.0f);
+  }
+}
+
+// A client that applies the server's replicated spline states should follow
+// the server, including through a blend, without re-deriving the blend.
+TEST_F(MotiveTests, ReplicatedSplineStatesFollowServer) {
+  const CompactSpline* table[] = {&simple_splines_[0], &simple_splines_[1],
+                                  &simple_splines_[2], &simple_splines_[3]};
+  const motive::SplineStateCodec codec(table, MOTIVE_ARRAY_SIZE(table));
+
+  // The targeted Motivator plays a local spline, which isn't in the table,
+  // so is sent as its current value.
+  Motivator2f server;
+  server.Initialize(spline_scalar_init, &engine_);
+  server.SetSplines(simple_splines_, SplinePlayback(0.0f, true));
+  Motivator1f server_target;
+  server_target.InitializeWithTarget(
+      spline_scalar_init, &engine_,
+      motive::CurrentToTarget1f(0.0f, 0.0f, 10.0f, 0.0f, 200));
+
+  MotiveEngine client_engine;
+  Motivator2f client;
+  client.Initialize(spline_scalar_init, &client_engine);
+  Motivator1f client_target;
+  client_target.Initialize(spline_scalar_init, &client_engine);
+
+  motive::SplineState sent[3];
+  motive::SplineState previous[3];
+  motive::SplineState received[3];
+  std::vector<uint8_t> bytes;
+  for (int frame = 0; frame < 40; ++frame) {
+    if (frame == 20) {
+      server.SetSplines(&simple_splines_[2],
+                        SplinePlayback(100.0f, true, 1.0f, 50.0f));
+    }
+    server.SplineStates(sent);
+    server_target.SplineStates(&sent[2]);
+    bytes.clear();
+    const motive::SplineState* base = frame == 0 ? nullptr : previous;
+    codec.Encode(sent, base, 3, &bytes);
+    ASSERT_EQ(bytes.size(), codec.Decode(bytes.data(), bytes.size(), base, 3,
+                                         received));
+    std::copy(sent, sent + 3, previous);
+    client.SetSplineStates(received);
+    client_target.SetSplineStates(&received[2]);
+
+    // Steady playback only sends x. The target's value changes every frame.
+    if (frame == 1) {
+      EXPECT_EQ(2 * 5u + 1u + 4 * 4u, bytes.size());
+    }
+    EXPECT_EQ(table[frame < 20 ? 0 : 2], received[0].spline);
+    EXPECT_EQ(nullptr, received[2].spline);
+    EXPECT_NEAR(server_target.Value(), client_target.Value(), 1e-5f);
+
+    // The client continues on its own until the next update.
+    engine_.AdvanceFrame(kTimePerFrame);
+    client_engine.AdvanceFrame(kTimePerFrame);
+    EXPECT_NEAR(server.Values()[0], client.Values()[0], 1e-5f);
+    EXPECT_NEAR(server.Values()[1], client.Values()[1], 1e-5f);
+  }
+
+  // Truncated and malformed updates are rejected.
+  EXPECT_EQ(0u, codec.Decode(bytes.data(), bytes.size() - 1, previous, 3,
+                             received));
+  const uint8_t unknown_spline[] = {1, 9, 0, 0, 0};
+  EXPECT_EQ(0u, codec.Decode(unknown_spline, sizeof(unknown_spline), nullptr,
+                             1, received));
+}
+
+// Sampling an animation directly should give the same pose as playing it
+// on a RigMotivator, at any time and in any order.
+TEST_F(MotiveTests, RigAnimSamplerMatchesPlayback) {
+  motive::RigAnim anim;
+  anim.Init("sampled", 3, false);
+  for (motive::BoneIndex i = 0; i < 3; ++i) {
+    std::vector<MatrixOperationInit>& ops =
+        anim.InitMatrixAnim(i, i == 0 ? motive::kInvalidBoneIdx : i - 1, "")
+            .ops();
+    ops.emplace_back(0, kRotateAboutY, spline_angle_init_, simple_spline_);
+    ops.emplace_back(1, kTranslateX, spline_scalar_init, 1.0f + i);
+    ops.emplace_back(2, kScaleY, spline_scalar_init, simple_splines_[i]);
+  }
+
+  const motive::RigInit init(anim, anim.bone_parents(), 3);
+  motive::RigMotivator rig;
+  rig.Initialize(init, &engine_);
+  rig.BlendToAnim(anim, SplinePlayback());
+
+  motive::RigAnimSampler sampler(anim);
+  ASSERT_EQ(3, sampler.NumBones());
+  mathfu::AffineTransform sampled[3];
+  std::vector<std::vector<mat4>> poses;
+  for (MotiveTime time = kTimePerFrame; time < 1000; time += kTimePerFrame) {
+    engine_.AdvanceFrame(kTimePerFrame);
+    sampler.GlobalTransforms(static_cast<float>(time), false, sampled);
+    poses.emplace_back();
+    for (int j = 0; j < 3; ++j) {
+      const mat4 played = mat4::FromAffineTransform(rig.GlobalTransforms()[j]);
+      poses.back().push_back(mat4::FromAffineTransform(sampled[j]));
+      ExpectMatricesEqual(played, poses.back().back(), 1e-4f);
+    }
+  }
+
+  // Sampling backwards, from the cached segments, gives the same poses.
+  for (int k = static_cast<int>(poses.size()) - 1; k >= 0; k -= 7) {
+    sampler.GlobalTransforms(static_cast<float>((k + 1) * kTimePerFrame),
+                             false, sampled);
+    for (int j = 0; j < 3; ++j) {
+      ExpectMatricesEqual(poses[k][j], mat4::FromAffineTransform(sampled[j]),
+                          0.0f);
+    }
+  }
+}
+
+// In GPU playback, rigs track which animations play, and how far they've
+// blended, without evaluating their bones.
+TEST_F(MotiveTests, RigGpuPlaybackTracksBlend) {
+  motive::RigAnim anims[2];
+  for (int k = 0; k < 2; ++k) {
+    anims[k].Init(k == 0 ? "first" : "second", 1, false);
+    anims[k]
+        .InitMatrixAnim(0, motive::kInvalidBoneIdx, "")
+        .ops()
+        .emplace_back(0, kTranslateX, spline_scalar_init, simple_spline_);
+  }
+
+  const motive::RigInit init(anims[0], anims[0].bone_parents(), 1);
+  motive::RigMotivator rig;
+  rig.Initialize(init, &engine_);
+  motive::RigGpuPlayback playback;
+  EXPECT_FALSE(rig.GpuPlayback(&playback));
+
+  rig.SetGpuPlayback(true);
+  rig.BlendToAnim(anims[0], SplinePlayback());
+  engine_.AdvanceFrame(kTimePerFrame);
+  const mat4 held = mat4::FromAffineTransform(rig.GlobalTransforms()[0]);
+  ASSERT_TRUE(rig.GpuPlayback(&playback));
+  EXPECT_EQ(&anims[0], playback.anim);
+  EXPECT_FLOAT_EQ(static_cast<float>(kTimePerFrame), playback.time);
+  EXPECT_EQ(nullptr, playback.previous_anim);
+  EXPECT_EQ(1.0f, playback.blend);
+
+  // Half way through the blend, both animations are reported.
+  SplinePlayback blend;
+  blend.blend_x = static_cast<float>(4 * kTimePerFrame);
+  rig.BlendToAnim(anims[1], blend);
+  engine_.AdvanceFrame(2 * kTimePerFrame);
+  ASSERT_TRUE(rig.GpuPlayback(&playback));
+  EXPECT_EQ(&anims[1], playback.anim);
+  EXPECT_FLOAT_EQ(static_cast<float>(2 * kTimePerFrame), playback.time);
+  EXPECT_EQ(&anims[0], playback.previous_anim);
+  EXPECT_FLOAT_EQ(static_cast<float>(3 * kTimePerFrame),
+                  playback.previous_time);
+  EXPECT_FLOAT_EQ(0.5f, playback.blend);
+
+  // The bones are not evaluated.
+  ExpectMatricesEqual(
+      held, mat4::FromAffineTransform(rig.GlobalTransforms()[0]), 0.0f);
+
+  // Back on the CPU, the bones pick up the animation where it's up to.
+  rig.SetGpuPlayback(false);
+  engine_.AdvanceFrame(2 * kTimePerFrame);
+  EXPECT_FALSE(rig.GpuPlayback(&playback));
+  EXPECT_NEAR(simple_spline_.YCalculatedSlowly(
+                  static_cast<float>(4 * kTimePerFrame)),
+              rig.GlobalTransforms()[0](3, 0), 1e-4f);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
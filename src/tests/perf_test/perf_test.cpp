@@ -0,0 +1,217 @@
+// Copyright 2018 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Performance budgets. Rather than timing anything, these tests count the
+// operations and allocations that Motive's hot paths perform, so that they
+// give the same answer on every machine, and catch algorithmic regressions
+// in CI.
+
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "motive/common.h"
+#include "motive/ease_in_ease_out_init.h"
+#include "motive/engine.h"
+#include "motive/math/bulk_spline_evaluator.h"
+#include "motive/math/compact_spline.h"
+#include "motive/overshoot_init.h"
+#include "motive/spline_init.h"
+#include "motive/util/counters.h"
+#include "motive/vector_motivator.h"
+
+using motive::BulkSplineEvaluator;
+using motive::CompactSpline;
+using motive::MotiveCounters;
+using motive::MotiveCurveShape;
+using motive::MotiveEngine;
+using motive::MotiveTime;
+using motive::Motivator1f;
+using motive::Range;
+using motive::SplinePlayback;
+
+// Every heap allocation in the process, counted by the operator new below.
+static std::atomic<uint64_t> g_num_allocations(0);
+
+void* operator new(size_t size) {
+  g_num_allocations.fetch_add(1, std::memory_order_relaxed);
+  void* p = malloc(size == 0 ? 1 : size);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+
+static const MotiveTime kTimePerFrame = 10;
+static const float kDeltaX = 0.3f;
+
+// Frames to advance before measuring, so that scratch buffers and per-thread
+// counters have been created.
+static const int kNumWarmUpFrames = 10;
+
+// The difference in every MotiveCounter since construction.
+class CounterDelta {
+ public:
+  CounterDelta() { motive::ReadMotiveCounters(&start_); }
+
+  uint64_t operator[](motive::MotiveCounter counter) const {
+    MotiveCounters now;
+    motive::ReadMotiveCounters(&now);
+    return (now - start_)[counter];
+  }
+
+ private:
+  MotiveCounters start_;
+};
+
+// The number of allocations since construction.
+class AllocationDelta {
+ public:
+  AllocationDelta() : start_(g_num_allocations.load()) {}
+  uint64_t Count() const { return g_num_allocations.load() - start_; }
+
+ private:
+  uint64_t start_;
+};
+
+class PerfTests : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    motive::SplineInit::Register();
+    motive::OvershootInit::Register();
+    motive::EaseInEaseOutInit::Register();
+
+    // Unevenly spaced, so that finding a segment can't be done by division.
+    spline_.Init(Range(0.0f, 1.0f), 0.01f);
+    spline_.AddNode(0.0f, 0.1f, 0.0f, motive::kAddWithoutModification);
+    spline_.AddNode(1.0f, 0.4f, 0.0f, motive::kAddWithoutModification);
+    spline_.AddNode(4.0f, 0.2f, 0.0f, motive::kAddWithoutModification);
+    spline_.AddNode(40.0f, 0.2f, 0.0f, motive::kAddWithoutModification);
+    spline_.AddNode(100.0f, 1.0f, 0.0f, motive::kAddWithoutModification);
+  }
+  virtual void TearDown() {}
+
+  int NumSegments() const { return spline_.num_nodes() - 1; }
+
+  CompactSpline spline_;
+};
+
+// Starting N indices part way along their splines should find each one's
+// segment with at most one binary search.
+TEST_F(PerfTests, SetSplinesSearchesAtMostOncePerIndex) {
+  static const int kNumIndices = 64;
+  BulkSplineEvaluator evaluator;
+  evaluator.SetNumIndices(kNumIndices);
+
+  const CounterDelta counters;
+  for (int i = 0; i < kNumIndices; ++i) {
+    const SplinePlayback playback(static_cast<float>(i) * 1.5f);
+    evaluator.SetSplines(i, 1, &spline_, playback);
+  }
+  EXPECT_GE(static_cast<uint64_t>(kNumIndices),
+            counters[motive::kCounterIndexForXSearches]);
+  EXPECT_GE(static_cast<uint64_t>(kNumIndices),
+            counters[motive::kCounterCubicInits]);
+}
+
+// Playing forward only ever moves onto the next segment, so should never
+// search, and should initialize each segment only once.
+TEST_F(PerfTests, AdvanceFrameNeverSearches) {
+  static const int kNumIndices = 64;
+  static const int kNumFrames = 300;  // Stays before the end of the spline.
+  BulkSplineEvaluator evaluator;
+  evaluator.SetNumIndices(kNumIndices);
+  for (int i = 0; i < kNumIndices; ++i) {
+    evaluator.SetSplines(i, 1, &spline_, SplinePlayback());
+  }
+
+  const CounterDelta counters;
+  for (int frame = 0; frame < kNumFrames; ++frame) {
+    evaluator.AdvanceFrame(kDeltaX);
+  }
+  EXPECT_EQ(0u, counters[motive::kCounterIndexForXSearches]);
+  EXPECT_GE(static_cast<uint64_t>(kNumIndices * NumSegments()),
+            counters[motive::kCounterCubicInits]);
+}
+
+// Once its buffers have grown, advancing a BulkSplineEvaluator, including
+// moving onto new segments and wrapping repeated splines, should never
+// allocate.
+TEST_F(PerfTests, SteadyStateSplineAdvanceDoesNotAllocate) {
+  static const int kNumIndices = 37;
+  static const int kNumFrames = 1000;
+  BulkSplineEvaluator evaluator;
+  evaluator.SetNumIndices(kNumIndices);
+  for (int i = 0; i < kNumIndices; ++i) {
+    const SplinePlayback playback(static_cast<float>(i) * 2.5f, true);
+    evaluator.SetSplines(i, 1, &spline_, playback);
+  }
+  for (int frame = 0; frame < kNumWarmUpFrames; ++frame) {
+    evaluator.AdvanceFrame(kDeltaX);
+  }
+
+  const AllocationDelta allocations;
+  for (int frame = 0; frame < kNumFrames; ++frame) {
+    evaluator.AdvanceFrame(kDeltaX);
+  }
+  EXPECT_EQ(0u, allocations.Count());
+}
+
+// Likewise for a MotiveEngine that's only advancing Motivators, without any
+// being created, destroyed, or retargeted.
+TEST_F(PerfTests, SteadyStateEngineAdvanceDoesNotAllocate) {
+  static const int kNumMotivators = 20;
+  static const int kNumFrames = 500;
+  MotiveEngine engine;
+
+  motive::OvershootInit overshoot_init;
+  overshoot_init.set_range(Range(0.0f, 100.0f));
+  overshoot_init.set_max_velocity(0.1f);
+  overshoot_init.set_max_delta(50.0f);
+  overshoot_init.set_accel_per_difference(0.001f);
+  overshoot_init.set_wrong_direction_multiplier(4.0f);
+  overshoot_init.set_max_delta_time(10);
+  const motive::EaseInEaseOutInit1f ease_init(0.0f, 0.0f);
+  const MotiveCurveShape shape(10.0f, 300.0f, 0.5f);
+
+  std::vector<Motivator1f> splines(kNumMotivators);
+  std::vector<Motivator1f> overshoots(kNumMotivators);
+  std::vector<Motivator1f> eases(kNumMotivators);
+  for (int i = 0; i < kNumMotivators; ++i) {
+    const float value = static_cast<float>(i);
+    splines[i].Initialize(motive::SplineInit(), &engine);
+    splines[i].SetSpline(spline_, SplinePlayback(value, true));
+    overshoots[i].InitializeWithTarget(
+        overshoot_init, &engine,
+        motive::CurrentToTarget1f(0.0f, 0.0f, value, 0.0f, 1000));
+    eases[i].InitializeWithTargetShape(ease_init, &engine, 1, shape, value,
+                                       0.0f);
+  }
+  for (int frame = 0; frame < kNumWarmUpFrames; ++frame) {
+    engine.AdvanceFrame(kTimePerFrame);
+  }
+
+  const AllocationDelta allocations;
+  for (int frame = 0; frame < kNumFrames; ++frame) {
+    engine.AdvanceFrame(kTimePerFrame);
+  }
+  EXPECT_EQ(0u, allocations.Count());
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
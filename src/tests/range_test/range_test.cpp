@@ -285,6 +285,12 @@ static float NormalizeClose(const Range& r, float x) {
   return r.NormalizeCloseValue(x);
 }
 
+static float NormalizeCloseBatch(const Range& r, float x) {
+  float out;
+  r.NormalizeCloseValues(&x, 1, &out);
+  return out;
+}
+
 void TestNormalize_Inside(NormalizeFn* fn) {
   const Range a(-kPi, kPi);
   const Range zero_one(0.0f, 1.0f);
@@ -362,6 +368,58 @@ TEST_F(RangeTests, NormalizeClose_Distant) {
   TestNormalize_Distant(NormalizeClose);
 }
 
+TEST_F(RangeTests, NormalizeCloseBatch_Inside) {
+  TestNormalize_Inside(NormalizeCloseBatch);
+}
+TEST_F(RangeTests, NormalizeCloseBatch_Border) {
+  TestNormalize_Border(NormalizeCloseBatch);
+}
+TEST_F(RangeTests, NormalizeCloseBatch_JustOutside) {
+  TestNormalize_JustOutside(NormalizeCloseBatch);
+}
+TEST_F(RangeTests, NormalizeCloseBatch_FartherOutside) {
+  TestNormalize_FartherOutside(NormalizeCloseBatch);
+}
+TEST_F(RangeTests, NormalizeCloseBatch_Distant) {
+  TestNormalize_Distant(NormalizeCloseBatch);
+}
+
+// The batch functions should match their one-value versions exactly, for
+// values that need zero, one or several adjustments.
+TEST_F(RangeTests, BatchMatchesSingle) {
+  static const float kXs[] = {0.0f,        -0.0f,        kPi,
+                              -kPi,        kPi + 0.5f,   -kPi - 0.5f,
+                              2.5f * kPi,  -2.5f * kPi,  6.9f * kPi,
+                              -1.9f,       1.0f,         -3.0f * kPi};
+  static const size_t kNumXs = sizeof(kXs) / sizeof(kXs[0]);
+  const Range a(-kPi, kPi);
+
+  float out[kNumXs];
+  a.NormalizeCloseValues(kXs, kNumXs, out);
+  for (size_t i = 0; i < kNumXs; ++i) {
+    EXPECT_EQ(a.NormalizeCloseValue(kXs[i]), out[i]);
+  }
+
+  // Normalize() requires values within one length of the range.
+  a.NormalizeValues(kXs, 8, out);
+  for (size_t i = 0; i < 8; ++i) {
+    EXPECT_EQ(a.Normalize(kXs[i]), out[i]);
+  }
+
+  // Pair each value with the next, and take differences that Normalize()
+  // can handle.
+  static const motive::ModularDirection kDirections[] = {
+      motive::kDirectionClosest, motive::kDirectionFarthest,
+      motive::kDirectionPositive, motive::kDirectionNegative,
+      motive::kDirectionDirect};
+  for (size_t d = 0; d < sizeof(kDirections) / sizeof(kDirections[0]); ++d) {
+    a.ModDiffs(kXs, kXs + 1, 5, kDirections[d], out);
+    for (size_t i = 0; i < 5; ++i) {
+      EXPECT_EQ(a.ModDiff(kXs[i], kXs[i + 1], kDirections[d]), out[i]);
+    }
+  }
+}
+
 TEST_F(RangeTests, Covers) {
   const float a[] = {1.0f, -3.0f, 2.0f, 5.0f, 0.0f, 6.0f};
   const Range covers = Range::Covers(a, MOTIVE_ARRAY_SIZE(a));
@@ -12,11 +12,15 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+
 #include "gtest/gtest.h"
 #include "motive/common.h"
 #include "motive/math/angle.h"
 #include "motive/math/bulk_spline_evaluator.h"
 #include "motive/math/compact_spline.h"
+#include "motive/math/compact_spline_packing.h"
+#include "motive/math/spline_stream.h"
 
 using motive::QuadraticCurve;
 using motive::CubicCurve;
@@ -24,6 +28,7 @@ using motive::CubicInit;
 using motive::Range;
 using motive::CompactSpline;
 using motive::CompactSplineIndex;
+using motive::CompactSplinePacking;
 using motive::BulkSplineEvaluator;
 using motive::Angle;
 using motive::kPi;
@@ -433,6 +438,37 @@ TEST_F(SplineTests, BulkYsVsSlowYs) {
   }
 }
 
+// A cursor should match the slow path, whichever direction it moves in, and
+// step to adjacent segments as x crosses them.
+TEST_F(SplineTests, CursorVsSlowYs) {
+  motive::CompactSplineCursor cursor(&short_spline_);
+  EXPECT_EQ(motive::kInvalidSplineIndex, cursor.index());
+
+  static const float kXs[] = {-5.0f, 0.0f,   0.5f,   0.9f,  1.0f,
+                              3.0f,  20.0f,  60.0f,  100.0f, 105.0f,
+                              50.0f, 2.0f,   0.2f,   -1.0f};
+  for (size_t i = 0; i < MOTIVE_ARRAY_SIZE(kXs); ++i) {
+    const float x = kXs[i];
+    EXPECT_NEAR(short_spline_.YCalculatedSlowly(x), cursor.Y(x),
+                kNodeYPrecision);
+    EXPECT_NEAR(short_spline_.CalculatedSlowly(x, motive::kCurveDerivative),
+                cursor.Calculated(x, motive::kCurveDerivative),
+                kDerivativePrecision);
+    EXPECT_EQ(short_spline_.IndexForX(x, 0), cursor.index());
+  }
+
+  static const int kNumYs = 9;
+  float ys[kNumYs];
+  float derivatives[kNumYs];
+  cursor.Ys(110.0f, -15.0f, kNumYs, ys, derivatives);
+  for (int i = 0; i < kNumYs; ++i) {
+    const float x = 110.0f - 15.0f * i;
+    EXPECT_NEAR(short_spline_.YCalculatedSlowly(x), ys[i], kNodeYPrecision);
+    EXPECT_NEAR(short_spline_.CalculatedSlowly(x, motive::kCurveDerivative),
+                derivatives[i], kDerivativePrecision);
+  }
+}
+
 // BulkYs should return the proper start and end values.
 TEST_F(SplineTests, BulkYsVec3) {
   static const int kDimensions = 3;
@@ -480,6 +516,34 @@ static void CheckUncompressedNodes(const CompactSpline& spline,
   }
 }
 
+// BakeYs should match slowly calculated values, inside and outside of each
+// spline, with each spline's points contiguous.
+TEST_F(SplineTests, BakeYsVsSlowYs) {
+  static const int kNumSplines = 2;
+  static const int kNumPoints = 40;
+  CompactSpline uncompressed;
+  uncompressed.InitFromNodes(kUncompressed, MOTIVE_ARRAY_SIZE(kUncompressed));
+  const CompactSpline* splines[kNumSplines] = {&short_spline_,
+                                                &uncompressed};
+
+  float ys[kNumSplines * kNumPoints];
+  float derivatives[kNumSplines * kNumPoints];
+  const float delta_x = uncompressed.EndX() / (kNumPoints - 10);
+  const float start_x = -5.0f * delta_x;
+  CompactSpline::BakeYs(splines, kNumSplines, start_x, delta_x, kNumPoints, ys,
+                        derivatives);
+
+  for (int i = 0; i < kNumSplines; ++i) {
+    for (int j = 0; j < kNumPoints; ++j) {
+      const float x = start_x + j * delta_x;
+      EXPECT_NEAR(splines[i]->YCalculatedSlowly(x), ys[i * kNumPoints + j],
+                  kNodeYPrecision);
+      EXPECT_NEAR(splines[i]->CalculatedSlowly(x, motive::kCurveDerivative),
+                  derivatives[i * kNumPoints + j], kDerivativePrecision);
+    }
+  }
+}
+
 // Uncompressed nodes should be evaluated pretty much unchanged.
 TEST_F(SplineTests, InitFromUncompressedNodes) {
   CompactSpline* spline = CompactSpline::CreateFromNodes(
@@ -557,6 +621,871 @@ TEST_F(SplineTests, YScaleAndOffset) {
   }
 }
 
+// Advancing shard-by-shard, in any order, should match advancing all at once.
+TEST_F(SplineTests, AdvanceFrameShards) {
+  static const int kNumIndices = 3 * BulkSplineEvaluator::kIndicesPerShard + 7;
+  static const float kDeltaX = 0.7f;
+
+  BulkSplineEvaluator whole;
+  BulkSplineEvaluator sharded;
+  whole.SetNumIndices(kNumIndices);
+  sharded.SetNumIndices(kNumIndices);
+  for (int i = 0; i < kNumIndices; ++i) {
+    // Start each index at a different point to exercise the re-init step.
+    const motive::SplinePlayback playback(static_cast<float>(i % 100), true);
+    whole.SetSplines(i, 1, &short_spline_, playback);
+    sharded.SetSplines(i, 1, &short_spline_, playback);
+  }
+  EXPECT_EQ(4, sharded.NumShards());
+
+  for (int frame = 0; frame < 200; ++frame) {
+    whole.AdvanceFrame(kDeltaX);
+    for (int shard = sharded.NumShards() - 1; shard >= 0; --shard) {
+      sharded.AdvanceFrameShards(kDeltaX, shard, shard + 1);
+    }
+    for (int i = 0; i < kNumIndices; ++i) {
+      EXPECT_EQ(whole.Y(i), sharded.Y(i));
+    }
+  }
+}
+
+// Splines with an update divisor should only change value on due frames, but
+// should then match splines that are evaluated every frame.
+TEST_F(SplineTests, UpdateDivisors) {
+  static const int kNumIndices = 8;
+  static const int kDivisor = 4;
+  static const float kDeltaX = 0.7f;
+
+  BulkSplineEvaluator every_frame;
+  BulkSplineEvaluator divided;
+  every_frame.SetNumIndices(kNumIndices);
+  divided.SetNumIndices(kNumIndices);
+  for (int i = 0; i < kNumIndices; ++i) {
+    const motive::SplinePlayback playback(static_cast<float>(i * 10), true);
+    every_frame.SetSplines(i, 1, &short_spline_, playback);
+    divided.SetSplines(i, 1, &short_spline_, playback);
+  }
+  divided.SetUpdateDivisors(0, kNumIndices,
+                            motive::MotiveUpdateDivisor(kDivisor, 0));
+
+  for (int frame = 0; frame < 200; ++frame) {
+    std::vector<float> previous_ys(divided.Ys(0), divided.Ys(0) + kNumIndices);
+    every_frame.AdvanceFrame(kDeltaX);
+    divided.AdvanceFrame(kDeltaX);
+    for (int i = 0; i < kNumIndices; ++i) {
+      if (frame % kDivisor == 0) {
+        EXPECT_NEAR(every_frame.Y(i), divided.Y(i), kNodeYPrecision);
+      } else {
+        EXPECT_EQ(previous_ys[i], divided.Y(i));
+      }
+    }
+  }
+}
+
+// A few indices with update divisors should not change the results of the
+// indices around them, in the same shard or in others.
+TEST_F(SplineTests, UpdateDivisorsOnlyAffectTheirIndices) {
+  static const int kNumIndices = 3 * BulkSplineEvaluator::kIndicesPerShard;
+  static const int kDivisor = 3;
+  static const float kDeltaX = 0.7f;
+  const int divided_indices[] = {5, 6, BulkSplineEvaluator::kIndicesPerShard,
+                                 kNumIndices - 1};
+
+  BulkSplineEvaluator every_frame;
+  BulkSplineEvaluator mixed;
+  every_frame.SetNumIndices(kNumIndices);
+  mixed.SetNumIndices(kNumIndices);
+  for (int i = 0; i < kNumIndices; ++i) {
+    const motive::SplinePlayback playback(static_cast<float>(i % 17), true);
+    every_frame.SetSplines(i, 1, &short_spline_, playback);
+    mixed.SetSplines(i, 1, &short_spline_, playback);
+  }
+  for (size_t j = 0; j < MOTIVE_ARRAY_SIZE(divided_indices); ++j) {
+    mixed.SetUpdateDivisors(divided_indices[j], 1,
+                            motive::MotiveUpdateDivisor(kDivisor, 0));
+  }
+
+  for (int frame = 0; frame < 100; ++frame) {
+    every_frame.AdvanceFrame(kDeltaX);
+    mixed.AdvanceFrame(kDeltaX);
+    for (int i = 0; i < kNumIndices; ++i) {
+      const int* divided_end = divided_indices +
+                               MOTIVE_ARRAY_SIZE(divided_indices);
+      const bool divided =
+          std::find(divided_indices, divided_end, i) != divided_end;
+      if (!divided) {
+        EXPECT_EQ(every_frame.Y(i), mixed.Y(i));
+      } else if (frame % kDivisor == 0) {
+        EXPECT_NEAR(every_frame.Y(i), mixed.Y(i), kNodeYPrecision);
+      }
+    }
+  }
+}
+
+// The SIMD functions should produce exactly the same results as the C++
+// functions, including for the indices that don't fill a whole register.
+TEST_F(SplineTests, OptimizedMatchesUnoptimized) {
+  static const int kNumIndices = 29;
+  static const float kDeltaX = 0.3f;
+
+  BulkSplineEvaluator optimized;
+  BulkSplineEvaluator unoptimized;
+  unoptimized.set_optimization(motive::kNoOptimizations);
+  optimized.SetNumIndices(kNumIndices);
+  unoptimized.SetNumIndices(kNumIndices);
+  for (int i = 0; i < kNumIndices; ++i) {
+    motive::SplinePlayback playback(static_cast<float>(i * 3), true);
+    playback.playback_rate = 0.5f + 0.1f * i;
+    optimized.SetSplines(i, 1, &short_spline_, playback);
+    unoptimized.SetSplines(i, 1, &short_spline_, playback);
+  }
+
+  for (int frame = 0; frame < 200; ++frame) {
+    optimized.AdvanceFrame(kDeltaX);
+    unoptimized.AdvanceFrame(kDeltaX);
+    for (int i = 0; i < kNumIndices; ++i) {
+      EXPECT_EQ(unoptimized.X(i), optimized.X(i));
+      EXPECT_EQ(unoptimized.Y(i), optimized.Y(i));
+    }
+  }
+}
+
+static void InitStaggeredSplines(const CompactSpline& spline, int num_indices,
+                                 BulkSplineEvaluator* evaluator) {
+  evaluator->SetNumIndices(num_indices);
+  for (int i = 0; i < num_indices; ++i) {
+    const motive::SplinePlayback playback(static_cast<float>(i * 5), true);
+    evaluator->SetSplines(i, 1, &spline, playback);
+  }
+}
+
+// Every x86 instruction set that the CPU supports should be selectable, even
+// those without functions of their own, and produce the same results.
+TEST_F(SplineTests, EverySupportedOptimizationMatchesUnoptimized) {
+  static const int kNumIndices = 13;
+  static const float kDeltaX = 0.3f;
+
+  // Each instruction set includes all the ones before it.
+  static const motive::ProcessorOptimization kX86Optimizations[] = {
+      motive::kSse2Optimizations,  motive::kSse3Optimizations,
+      motive::kSsse3Optimizations, motive::kSse41Optimizations,
+      motive::kAvx2Optimizations,  motive::kAvx512Optimizations};
+  const motive::ProcessorOptimization* x86_end =
+      kX86Optimizations + MOTIVE_ARRAY_SIZE(kX86Optimizations);
+
+  const motive::ProcessorOptimization best =
+      motive::BestProcessorOptimization();
+  EXPECT_NE(nullptr, motive::ProcessorOptimizationName(best));
+  const motive::ProcessorOptimization* best_it =
+      std::find(kX86Optimizations, x86_end, best);
+  if (best_it == x86_end) return;
+
+  BulkSplineEvaluator unoptimized;
+  unoptimized.set_optimization(motive::kNoOptimizations);
+  InitStaggeredSplines(short_spline_, kNumIndices, &unoptimized);
+
+  std::vector<BulkSplineEvaluator> optimized(best_it - kX86Optimizations + 1);
+  for (size_t j = 0; j < optimized.size(); ++j) {
+    optimized[j].set_optimization(kX86Optimizations[j]);
+    InitStaggeredSplines(short_spline_, kNumIndices, &optimized[j]);
+  }
+
+  for (int frame = 0; frame < 100; ++frame) {
+    unoptimized.AdvanceFrame(kDeltaX);
+    for (size_t j = 0; j < optimized.size(); ++j) {
+      optimized[j].AdvanceFrame(kDeltaX);
+      for (int i = 0; i < kNumIndices; ++i) {
+        EXPECT_EQ(unoptimized.Y(i), optimized[j].Y(i));
+      }
+    }
+  }
+}
+
+// Update divisors split a shard into runs that start and end anywhere. Every
+// supported optimization should advance those runs without touching the
+// indices around them, including optimizations whose functions only process
+// whole groups of indices.
+TEST_F(SplineTests, UpdateDivisorsWithEveryOptimization) {
+  static const int kNumIndices = 23;
+  static const int kDivisor = 3;
+  static const float kDeltaX = 0.7f;
+  const int divided_indices[] = {1, 5, 6, 11, 17};
+  const int* divided_end =
+      divided_indices + MOTIVE_ARRAY_SIZE(divided_indices);
+
+  const motive::ProcessorOptimization best =
+      motive::BestProcessorOptimization();
+  for (int o = motive::kNoOptimizations; o <= best; ++o) {
+    const motive::ProcessorOptimization optimization =
+        static_cast<motive::ProcessorOptimization>(o);
+    BulkSplineEvaluator every_frame;
+    BulkSplineEvaluator mixed;
+    every_frame.set_optimization(optimization);
+    mixed.set_optimization(optimization);
+    InitStaggeredSplines(short_spline_, kNumIndices, &every_frame);
+    InitStaggeredSplines(short_spline_, kNumIndices, &mixed);
+    for (const int* it = divided_indices; it != divided_end; ++it) {
+      mixed.SetUpdateDivisors(*it, 1,
+                              motive::MotiveUpdateDivisor(kDivisor, 0));
+    }
+
+    for (int frame = 0; frame < 100; ++frame) {
+      std::vector<float> previous_ys(mixed.Ys(0), mixed.Ys(0) + kNumIndices);
+      every_frame.AdvanceFrame(kDeltaX);
+      mixed.AdvanceFrame(kDeltaX);
+      for (int i = 0; i < kNumIndices; ++i) {
+        const bool divided =
+            std::find(divided_indices, divided_end, i) != divided_end;
+        if (!divided || frame % kDivisor == 0) {
+          EXPECT_NEAR(every_frame.Y(i), mixed.Y(i), kNodeYPrecision);
+        } else {
+          EXPECT_EQ(previous_ys[i], mixed.Y(i));
+        }
+      }
+    }
+  }
+}
+
+// Indices at or above NumActiveIndices() should keep their values with every
+// supported optimization, even when the active indices end part way through
+// a group of indices that the optimized functions process together.
+TEST_F(SplineTests, SuspendedIndicesHoldWithEveryOptimization) {
+  static const int kNumIndices = 12;
+  static const int kNumActive = 5;
+  static const float kDeltaX = 0.7f;
+
+  const motive::ProcessorOptimization best =
+      motive::BestProcessorOptimization();
+  for (int o = motive::kNoOptimizations; o <= best; ++o) {
+    BulkSplineEvaluator interpolator;
+    interpolator.set_optimization(
+        static_cast<motive::ProcessorOptimization>(o));
+    InitStaggeredSplines(short_spline_, kNumIndices, &interpolator);
+    interpolator.SetNumActiveIndices(kNumActive);
+    std::vector<float> suspended_xs;
+    std::vector<float> suspended_ys;
+    for (int i = kNumActive; i < kNumIndices; ++i) {
+      suspended_xs.push_back(interpolator.X(i));
+      suspended_ys.push_back(interpolator.Y(i));
+    }
+
+    for (int frame = 0; frame < 20; ++frame) {
+      interpolator.AdvanceFrame(kDeltaX);
+    }
+    for (int i = kNumActive; i < kNumIndices; ++i) {
+      EXPECT_EQ(suspended_xs[i - kNumActive], interpolator.X(i));
+      EXPECT_EQ(suspended_ys[i - kNumActive], interpolator.Y(i));
+    }
+  }
+}
+
+// Modular indices should normalize the same way with every supported
+// optimization, whether their values are inside the range, one length
+// outside, or several lengths outside.
+TEST_F(SplineTests, NormalizeYsMatchesNormalizeY) {
+  static const int kNumIndices = 21;
+
+  const motive::ProcessorOptimization best =
+      motive::BestProcessorOptimization();
+  for (int o = motive::kNoOptimizations; o <= best; ++o) {
+    BulkSplineEvaluator interpolator;
+    interpolator.set_optimization(
+        static_cast<motive::ProcessorOptimization>(o));
+    interpolator.SetNumIndices(kNumIndices);
+
+    // Every third index isn't modular.
+    float ys[kNumIndices];
+    for (int i = 0; i < kNumIndices; ++i) {
+      if (i % 3 != 0) interpolator.SetYRanges(i, 1, kAngleRange);
+      ys[i] = (i - kNumIndices / 2) * 0.7f * kPi;
+    }
+    float normalized[kNumIndices];
+    std::copy(ys, ys + kNumIndices, normalized);
+    interpolator.NormalizeYs(0, kNumIndices, normalized);
+    for (int i = 0; i < kNumIndices; ++i) {
+      EXPECT_EQ(interpolator.NormalizeY(i, ys[i]), normalized[i]);
+    }
+  }
+}
+
+// Both coefficient layouts should produce the same results, and switching
+// layouts part way through should preserve the current cubics.
+TEST_F(SplineTests, CoefficientLayoutsMatch) {
+  static const int kNumIndices = 11;
+  static const float kDeltaX = 0.3f;
+
+  BulkSplineEvaluator interleaved;
+  BulkSplineEvaluator separate;
+  interleaved.set_coefficient_layout(
+      BulkSplineEvaluator::kInterleavedCoefficients);
+  separate.set_coefficient_layout(BulkSplineEvaluator::kSeparateCoefficients);
+  InitStaggeredSplines(short_spline_, kNumIndices, &interleaved);
+  InitStaggeredSplines(short_spline_, kNumIndices, &separate);
+
+  for (int frame = 0; frame < 100; ++frame) {
+    if (frame == 50) {
+      separate.set_coefficient_layout(
+          BulkSplineEvaluator::kInterleavedCoefficients);
+      interleaved.set_coefficient_layout(
+          BulkSplineEvaluator::kSeparateCoefficients);
+    }
+    interleaved.AdvanceFrame(kDeltaX);
+    separate.AdvanceFrame(kDeltaX);
+    for (int i = 0; i < kNumIndices; ++i) {
+      EXPECT_EQ(interleaved.Y(i), separate.Y(i));
+      EXPECT_EQ(interleaved.Cubic(i), separate.Cubic(i));
+    }
+  }
+}
+
+// The fixed-point layout should track the float layouts to within its error
+// bounds, including after switching layouts part way through.
+TEST_F(SplineTests, FixedPointLayoutTracksFloat) {
+  static const int kNumIndices = 13;
+  static const float kDeltaX = 0.37f;
+  static const float kXEpsilon = 1e-3f;
+  static const float kYEpsilon = 1e-4f;
+
+  BulkSplineEvaluator floating;
+  BulkSplineEvaluator fixed;
+  floating.set_coefficient_layout(BulkSplineEvaluator::kSeparateCoefficients);
+  fixed.set_coefficient_layout(BulkSplineEvaluator::kFixedPointCoefficients);
+  InitStaggeredSplines(short_spline_, kNumIndices, &floating);
+  InitStaggeredSplines(short_spline_, kNumIndices, &fixed);
+
+  for (int frame = 0; frame < 100; ++frame) {
+    if (frame == 50) {
+      floating.set_coefficient_layout(
+          BulkSplineEvaluator::kFixedPointCoefficients);
+      fixed.set_coefficient_layout(BulkSplineEvaluator::kSeparateCoefficients);
+    }
+    floating.AdvanceFrame(kDeltaX);
+    fixed.AdvanceFrame(kDeltaX);
+    for (int i = 0; i < kNumIndices; ++i) {
+      EXPECT_NEAR(floating.X(i), fixed.X(i), kXEpsilon);
+      EXPECT_NEAR(floating.Y(i), fixed.Y(i), kYEpsilon);
+    }
+  }
+}
+
+// Initialize more cubics at once than fit in one batch, both when setting the
+// splines and when they all roll over to their next segment together.
+TEST_F(SplineTests, BulkInitMatchesSpline) {
+  static const int kNumIndices = 150;
+  static const float kDeltaX = 0.5f;
+
+  BulkSplineEvaluator interpolator;
+  interpolator.SetNumIndices(kNumIndices);
+  for (int i = 0; i < kNumIndices; ++i) {
+    interpolator.SetSplines(i, 1, &short_spline_,
+                            motive::SplinePlayback(0.0f, true));
+  }
+
+  for (int frame = 0; frame < 100; ++frame) {
+    for (int i = 0; i < kNumIndices; ++i) {
+      EXPECT_NEAR(short_spline_.YCalculatedSlowly(interpolator.X(i)),
+                  interpolator.Y(i), kNodeYPrecision);
+    }
+    interpolator.AdvanceFrame(kDeltaX);
+  }
+}
+
+// Blending many indices in one call solves their blend cubics in batches,
+// which should give the same cubics as blending each index on its own.
+TEST_F(SplineTests, BatchedBlendsMatchSingleBlends) {
+  static const int kNumIndices = 150;
+  static const float kDeltaX = 0.5f;
+
+  CompactSpline* splines = CompactSpline::CreateArray(4, kNumIndices);
+  CompactSpline* spline = splines;
+  for (int i = 0; i < kNumIndices; ++i, spline = spline->Next()) {
+    spline->Init(Range(0.0f, 1.0f), 0.01f);
+    spline->AddNode(0.0f, 0.01f * (i % 90), 0.0f,
+                    motive::kAddWithoutModification);
+    spline->AddNode(3.0f, 0.9f, 0.1f, motive::kAddWithoutModification);
+    spline->AddNode(10.0f, 0.2f, 0.0f, motive::kAddWithoutModification);
+  }
+
+  BulkSplineEvaluator together;
+  BulkSplineEvaluator separate;
+  InitStaggeredSplines(short_spline_, kNumIndices, &together);
+  InitStaggeredSplines(short_spline_, kNumIndices, &separate);
+  together.AdvanceFrame(kDeltaX);
+  separate.AdvanceFrame(kDeltaX);
+
+  motive::SplinePlayback playback(1.0f, true);
+  playback.blend_x = 2.0f;
+  together.SetSplines(0, kNumIndices, splines, playback);
+  spline = splines;
+  for (int i = 0; i < kNumIndices; ++i, spline = spline->Next()) {
+    separate.SetSplines(i, 1, spline, playback);
+  }
+
+  for (int frame = 0; frame < 20; ++frame) {
+    for (int i = 0; i < kNumIndices; ++i) {
+      EXPECT_EQ(separate.Cubic(i), together.Cubic(i));
+      EXPECT_EQ(separate.Y(i), together.Y(i));
+    }
+    together.AdvanceFrame(kDeltaX);
+    separate.AdvanceFrame(kDeltaX);
+  }
+  CompactSpline::DestroyArray(splines, kNumIndices);
+}
+
+// Evenly spaced nodes should be detected, and looked up without searching.
+TEST_F(SplineTests, UniformXIndexForX) {
+  EXPECT_FALSE(short_spline_.HasUniformX());
+
+  CompactSpline uniform(Range(0.0f, 1.0f), 0.01f);
+  for (int i = 0; i < CompactSpline::kDefaultMaxNodes; ++i) {
+    uniform.AddNode(static_cast<float>(i), 0.1f * i, 0.0f,
+                    motive::kAddWithoutModification);
+  }
+  EXPECT_TRUE(uniform.HasUniformX());
+
+  const CompactSplineIndex last_segment = uniform.LastSegmentIndex();
+  for (float x = 0.0f; x < uniform.EndX(); x += 0.13f) {
+    const CompactSplineIndex index =
+        uniform.IndexForX(x, kRidiculousSplineIndex);
+    EXPECT_EQ(static_cast<CompactSplineIndex>(x + 0.005f), index);
+  }
+  EXPECT_EQ(last_segment, uniform.IndexForX(uniform.EndX(), 0));
+  EXPECT_EQ(motive::kAfterSplineIndex,
+            uniform.IndexForX(uniform.EndX() + 1.0f, 0));
+
+  // Clearing the spline forgets the spacing.
+  uniform.Clear();
+  uniform.AddNode(0.0f, 0.0f, 0.0f, motive::kAddWithoutModification);
+  uniform.AddNode(1.0f, 0.0f, 0.0f, motive::kAddWithoutModification);
+  uniform.AddNode(3.0f, 0.0f, 0.0f, motive::kAddWithoutModification);
+  EXPECT_FALSE(uniform.HasUniformX());
+}
+
+// Packing with full-width fields should reproduce the nodes exactly, and
+// packing for a tolerance should stay within that tolerance.
+TEST_F(SplineTests, PackedNodes) {
+  const CompactSplinePacking lossless;
+  std::vector<uint8_t> bits(lossless.PackedSize(short_spline_.num_nodes()));
+  PackCompactSplineNodes(short_spline_, lossless, bits.data());
+
+  CompactSpline unpacked(short_spline_.y_range(),
+                         short_spline_.x_granularity());
+  EXPECT_TRUE(UnpackCompactSplineNodes(bits.data(), bits.size(),
+                                       short_spline_.num_nodes(), lossless,
+                                       &unpacked));
+  EXPECT_EQ(short_spline_.num_nodes(), unpacked.num_nodes());
+  for (CompactSplineIndex i = 0; i < short_spline_.num_nodes(); ++i) {
+    EXPECT_EQ(short_spline_.NodeX(i), unpacked.NodeX(i));
+    EXPECT_EQ(short_spline_.NodeY(i), unpacked.NodeY(i));
+    EXPECT_EQ(short_spline_.NodeDerivative(i), unpacked.NodeDerivative(i));
+  }
+
+  static const float kTolerance = 0.01f;
+  const CompactSplinePacking packing =
+      CompactSplinePacking::ForTolerance(short_spline_, kTolerance);
+  EXPECT_TRUE(packing.Valid());
+  EXPECT_LT(packing.BitsPerNode(), lossless.BitsPerNode());
+
+  bits.resize(packing.PackedSize(short_spline_.num_nodes()));
+  PackCompactSplineNodes(short_spline_, packing, bits.data());
+  unpacked.Clear();
+  EXPECT_TRUE(UnpackCompactSplineNodes(bits.data(), bits.size(),
+                                       short_spline_.num_nodes(), packing,
+                                       &unpacked));
+  for (float x = 0.0f; x <= short_spline_.EndX(); x += 0.25f) {
+    EXPECT_NEAR(short_spline_.YCalculatedSlowly(x),
+                unpacked.YCalculatedSlowly(x), kTolerance);
+  }
+
+  // Too few bytes should be rejected.
+  unpacked.Clear();
+  EXPECT_FALSE(UnpackCompactSplineNodes(bits.data(), bits.size() - 1,
+                                        short_spline_.num_nodes(), packing,
+                                        &unpacked));
+
+  // So should more nodes than the spline has room for.
+  EXPECT_TRUE(UnpackCompactSplineNodes(bits.data(), bits.size(),
+                                       short_spline_.num_nodes(), packing,
+                                       &unpacked));
+  EXPECT_FALSE(UnpackCompactSplineNodes(bits.data(), bits.size(),
+                                        short_spline_.num_nodes(), packing,
+                                        &unpacked));
+  EXPECT_EQ(short_spline_.num_nodes(), unpacked.num_nodes());
+}
+
+// A view over a spline's nodes should evaluate exactly like the spline.
+TEST_F(SplineTests, ViewMatchesSpline) {
+  CompactSpline* view = CompactSpline::CreateView(
+      short_spline_.y_range(), short_spline_.x_granularity(),
+      short_spline_.nodes(), short_spline_.num_nodes());
+  EXPECT_TRUE(view->IsView());
+  EXPECT_FALSE(short_spline_.IsView());
+  EXPECT_EQ(short_spline_.nodes(), view->nodes());
+  EXPECT_EQ(short_spline_.num_nodes(), view->num_nodes());
+  EXPECT_EQ(short_spline_.HasUniformX(), view->HasUniformX());
+
+  BulkSplineEvaluator original;
+  BulkSplineEvaluator viewed;
+  original.SetNumIndices(1);
+  viewed.SetNumIndices(1);
+  original.SetSplines(0, 1, &short_spline_, motive::SplinePlayback());
+  viewed.SetSplines(0, 1, view, motive::SplinePlayback());
+  for (float x = 0.0f; x <= short_spline_.EndX(); x += 0.25f) {
+    EXPECT_EQ(short_spline_.IndexForX(x, kRidiculousSplineIndex),
+              view->IndexForX(x, kRidiculousSplineIndex));
+    EXPECT_EQ(original.Y(0), viewed.Y(0));
+    original.AdvanceFrame(0.25f);
+    viewed.AdvanceFrame(0.25f);
+  }
+
+  // Copying a view copies its nodes.
+  CompactSpline copy;
+  copy = *view;
+  EXPECT_FALSE(copy.IsView());
+  EXPECT_EQ(short_spline_.NodeY(1), copy.NodeY(1));
+  CompactSpline::Destroy(view);
+}
+
+// Splines with the same x keys share segment lookups in the evaluator, which
+// should give the same results as evaluating them separately.
+TEST_F(SplineTests, SharedXKeysMatchSeparate) {
+  CompactSpline other(Range(0.0f, 1.0f), 0.01f);
+  for (CompactSplineIndex i = 0; i < short_spline_.num_nodes(); ++i) {
+    other.AddNode(short_spline_.NodeX(i), 0.9f - short_spline_.NodeY(i), 0.5f,
+                  motive::kAddWithoutModification);
+  }
+  EXPECT_TRUE(short_spline_.SharesXKeys(other));
+  other.AddNode(short_spline_.EndX() + 1.0f, 0.5f, 0.0f,
+                motive::kAddWithoutModification);
+  EXPECT_FALSE(short_spline_.SharesXKeys(other));
+  other.Clear();
+  for (CompactSplineIndex i = 0; i < short_spline_.num_nodes(); ++i) {
+    other.AddNode(short_spline_.NodeX(i), 0.9f - short_spline_.NodeY(i), 0.5f,
+                  motive::kAddWithoutModification);
+  }
+
+  static const int kNumIndices = 3;
+  const CompactSpline* splines[kNumIndices] = {&short_spline_, &other,
+                                               &short_spline_};
+  BulkSplineEvaluator together;
+  together.SetNumIndices(kNumIndices);
+  BulkSplineEvaluator separate[kNumIndices];
+  const motive::SplinePlayback playback(0.0f, true);
+  for (int i = 0; i < kNumIndices; ++i) {
+    together.SetSplines(i, 1, splines[i], playback);
+    separate[i].SetNumIndices(1);
+    separate[i].SetSplines(0, 1, splines[i], playback);
+  }
+
+  for (int frame = 0; frame < 200; ++frame) {
+    together.AdvanceFrame(0.7f);
+    for (int i = 0; i < kNumIndices; ++i) {
+      separate[i].AdvanceFrame(0.7f);
+      EXPECT_EQ(separate[i].Y(0), together.Y(i));
+    }
+  }
+}
+
+// Channels pack splines with the same x keys into one allocation, and should
+// evaluate exactly like the splines they were created from.
+TEST_F(SplineTests, ChannelsMatchSeparate) {
+  CompactSpline other(Range(-1.0f, 1.0f), 0.01f);
+  for (CompactSplineIndex i = 0; i < short_spline_.num_nodes(); ++i) {
+    other.AddNode(short_spline_.NodeX(i), -short_spline_.NodeY(i), -0.5f,
+                  motive::kAddWithoutModification);
+  }
+
+  static const int kNumChannels = 3;
+  const CompactSpline* splines[kNumChannels] = {&short_spline_, &other,
+                                                &short_spline_};
+  CompactSpline* channels =
+      CompactSpline::CreateChannels(splines, kNumChannels);
+  ASSERT_NE(nullptr, channels);
+  for (int i = 0; i < kNumChannels; ++i) {
+    const CompactSpline* channel = channels->NextAtIdx(i);
+    EXPECT_TRUE(channel->IsChannel());
+    EXPECT_TRUE(channel->IsView());
+    EXPECT_EQ(nullptr, channel->nodes());
+    EXPECT_TRUE(channel->SharesXKeys(*channels));
+    ASSERT_EQ(splines[i]->num_nodes(), channel->num_nodes());
+    for (CompactSplineIndex j = 0; j < channel->num_nodes(); ++j) {
+      EXPECT_EQ(splines[i]->NodeX(j), channel->NodeX(j));
+      EXPECT_EQ(splines[i]->NodeY(j), channel->NodeY(j));
+      EXPECT_EQ(splines[i]->NodeDerivative(j), channel->NodeDerivative(j));
+    }
+
+    // Copies hold whole nodes again.
+    CompactSpline copy;
+    copy = *channel;
+    EXPECT_FALSE(copy.IsChannel());
+    EXPECT_EQ(splines[i]->EndY(), copy.EndY());
+  }
+
+  // The channels play back together, as a Motivator3f would play them.
+  BulkSplineEvaluator together;
+  together.SetNumIndices(kNumChannels);
+  BulkSplineEvaluator separate[kNumChannels];
+  const motive::SplinePlayback playback(0.0f, true);
+  together.SetSplines(0, kNumChannels, channels, playback);
+  for (int i = 0; i < kNumChannels; ++i) {
+    separate[i].SetNumIndices(1);
+    separate[i].SetSplines(0, 1, splines[i], playback);
+  }
+  for (int frame = 0; frame < 200; ++frame) {
+    together.AdvanceFrame(0.7f);
+    for (int i = 0; i < kNumChannels; ++i) {
+      separate[i].AdvanceFrame(0.7f);
+      EXPECT_EQ(separate[i].Y(0), together.Y(i));
+    }
+  }
+  CompactSpline::DestroyArray(channels, kNumChannels);
+
+  // Splines with different x keys can't be packed.
+  other.AddNode(short_spline_.EndX() + 1.0f, 0.5f, 0.0f,
+                motive::kAddWithoutModification);
+  EXPECT_EQ(nullptr, CompactSpline::CreateChannels(splines, kNumChannels));
+}
+
+// Serves chunks from memory, `latency` frames after they're prefetched. The
+// first chunk is always ready, so that playback can start.
+class TestChunkSource : public motive::SplineChunkSource {
+ public:
+  TestChunkSource(const motive::UncompressedNode* nodes, size_t num_nodes,
+                  size_t nodes_per_chunk, int latency)
+      : latency_(latency), frame_(0), max_resident_(0) {
+    motive::CreateSplineChunks(nodes, num_nodes, nodes_per_chunk, &chunks_,
+                               &start_xs_);
+    ready_frames_.resize(chunks_.size(), -1);
+  }
+  ~TestChunkSource() {
+    for (size_t i = 0; i < chunks_.size(); ++i) {
+      CompactSpline::Destroy(chunks_[i]);
+    }
+  }
+
+  int NumChunks() const override { return static_cast<int>(chunks_.size()); }
+  float ChunkStartX(int chunk) const override { return start_xs_[chunk]; }
+  void Prefetch(int chunk) override {
+    if (ready_frames_[chunk] < 0) {
+      ready_frames_[chunk] = chunk == 0 ? frame_ : frame_ + latency_;
+    }
+    int resident = 0;
+    for (size_t i = 0; i < ready_frames_.size(); ++i) {
+      resident += ready_frames_[i] >= 0 ? 1 : 0;
+    }
+    max_resident_ = std::max(max_resident_, resident);
+  }
+  const CompactSpline* Chunk(int chunk) override {
+    const int ready_frame = ready_frames_[chunk];
+    return ready_frame >= 0 && ready_frame <= frame_ ? chunks_[chunk] : nullptr;
+  }
+  void Evict(int chunk) override { ready_frames_[chunk] = -1; }
+
+  void AdvanceFrame() { frame_++; }
+  int max_resident() const { return max_resident_; }
+
+ private:
+  std::vector<CompactSpline*> chunks_;
+  std::vector<float> start_xs_;
+  std::vector<int> ready_frames_;
+  int latency_;
+  int frame_;
+  int max_resident_;
+};
+
+static std::vector<motive::UncompressedNode> LongCurveNodes() {
+  std::vector<motive::UncompressedNode> nodes(40);
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    const float t = static_cast<float>(i) * 0.3f;
+    nodes[i].x = static_cast<float>(i) * 10.0f;
+    nodes[i].y = sin(t);
+    nodes[i].derivative = cos(t) * 0.03f;
+  }
+  return nodes;
+}
+
+// Streaming a curve in chunks should play it back like the whole spline,
+// with only two chunks ever resident.
+TEST_F(SplineTests, StreamedChunksMatchWholeSpline) {
+  static const float kDeltaX = 0.7f;
+  static const float kXPrecision = 0.001f;
+  const std::vector<motive::UncompressedNode> nodes = LongCurveNodes();
+  CompactSpline* whole_spline =
+      CompactSpline::CreateFromNodes(nodes.data(), nodes.size());
+  TestChunkSource source(nodes.data(), nodes.size(), 8, 0);
+  EXPECT_EQ(6, source.NumChunks());
+
+  BulkSplineEvaluator whole;
+  BulkSplineEvaluator streamed;
+  whole.SetNumIndices(1);
+  streamed.SetNumIndices(1);
+  const motive::SplinePlayback playback(5.0f);
+  whole.SetSplines(0, 1, whole_spline, playback);
+  motive::SplineStreamer streamer;
+  streamer.Start(&streamed, 0, &source, playback);
+
+  while (whole.X(0) < whole.EndX(0)) {
+    whole.AdvanceFrame(kDeltaX);
+    streamed.AdvanceFrame(kDeltaX);
+    source.AdvanceFrame();
+    streamer.Update();
+    EXPECT_FALSE(streamer.starved());
+    EXPECT_NEAR(std::min(whole.X(0), whole.EndX(0)), streamer.X(),
+                kXPrecision);
+    EXPECT_NEAR(whole.Y(0), streamed.Y(0), kFixedPointEpsilon);
+  }
+  EXPECT_EQ(source.NumChunks() - 1, streamer.chunk());
+  EXPECT_EQ(2, source.max_resident());
+  streamer.Stop();
+  CompactSpline::Destroy(whole_spline);
+}
+
+// A chunk that arrives late should hold the value at the chunk boundary, and
+// then catch up with where playback would have been.
+TEST_F(SplineTests, StarvedStreamHoldsThenCatchesUp) {
+  static const float kDeltaX = 0.7f;
+  const std::vector<motive::UncompressedNode> nodes = LongCurveNodes();
+  CompactSpline* whole_spline =
+      CompactSpline::CreateFromNodes(nodes.data(), nodes.size());
+  TestChunkSource source(nodes.data(), nodes.size(), 8, 120);
+
+  BulkSplineEvaluator whole;
+  BulkSplineEvaluator streamed;
+  whole.SetNumIndices(1);
+  streamed.SetNumIndices(1);
+  whole.SetSplines(0, 1, whole_spline, motive::SplinePlayback());
+  motive::SplineStreamer streamer;
+  streamer.Start(&streamed, 0, &source, motive::SplinePlayback());
+  EXPECT_FALSE(streamer.starved());
+
+  bool was_starved = false;
+  float held_y = 0.0f;
+  for (int frame = 0; frame < 300; ++frame) {
+    whole.AdvanceFrame(kDeltaX);
+    streamed.AdvanceFrame(kDeltaX);
+    source.AdvanceFrame();
+    streamer.Update();
+    if (streamer.starved()) {
+      if (was_starved) EXPECT_EQ(held_y, streamed.Y(0));
+      held_y = streamed.Y(0);
+      was_starved = true;
+    } else if (!streamer.starved() && was_starved) {
+      EXPECT_NEAR(whole.Y(0), streamed.Y(0), kFixedPointEpsilon);
+    }
+  }
+  EXPECT_TRUE(was_starved);
+  streamer.Stop();
+  CompactSpline::Destroy(whole_spline);
+}
+
+// A curve that's appended to while it plays should play back like the whole
+// spline, keeping only a few chunks in memory. Playback that catches up with
+// the data should hold, and then continue once more nodes arrive.
+TEST_F(SplineTests, LiveStreamPlaysNodesAsTheyArrive) {
+  static const float kDeltaX = 0.7f;
+  static const float kLeadX = 80.0f;
+  const std::vector<motive::UncompressedNode> nodes = LongCurveNodes();
+  CompactSpline* whole_spline =
+      CompactSpline::CreateFromNodes(nodes.data(), nodes.size());
+  motive::LiveSplineChunkSource source(8, 2);
+  size_t num_added = 0;
+  while (num_added < 8) source.AddNode(nodes[num_added++]);
+  EXPECT_EQ(1, source.NumChunks());
+
+  BulkSplineEvaluator whole;
+  BulkSplineEvaluator streamed;
+  whole.SetNumIndices(1);
+  streamed.SetNumIndices(1);
+  whole.SetSplines(0, 1, whole_spline, motive::SplinePlayback());
+  motive::SplineStreamer streamer;
+  streamer.Start(&streamed, 0, &source, motive::SplinePlayback());
+
+  // Keep the data a little over a chunk ahead of playback.
+  while (whole.X(0) < whole.EndX(0)) {
+    whole.AdvanceFrame(kDeltaX);
+    streamed.AdvanceFrame(kDeltaX);
+    while (num_added < nodes.size() &&
+           nodes[num_added].x < whole.X(0) + kLeadX) {
+      source.AddNode(nodes[num_added++]);
+    }
+    if (num_added == nodes.size()) source.Flush();
+    streamer.Update();
+    EXPECT_FALSE(streamer.starved());
+    EXPECT_NEAR(whole.Y(0), streamed.Y(0), kFixedPointEpsilon);
+    EXPECT_GE(3, source.NumResidentChunks());
+  }
+  EXPECT_EQ(6, source.NumChunks());
+  EXPECT_EQ(source.NumChunks() - 1, streamer.chunk());
+
+  // Playback has caught up with the data, so it holds at the last node.
+  for (int frame = 0; frame < 10; ++frame) {
+    streamed.AdvanceFrame(kDeltaX);
+    streamer.Update();
+  }
+  EXPECT_TRUE(streamer.held_at_end());
+  EXPECT_NEAR(nodes.back().y, streamed.Y(0), kFixedPointEpsilon);
+
+  // New data continues the curve, without restarting playback.
+  motive::UncompressedNode next = nodes.back();
+  next.x += 100.0f;
+  next.y += 1.0f;
+  source.AddNode(next);
+  source.Flush();
+  streamed.AdvanceFrame(kDeltaX);
+  streamer.Update();
+  EXPECT_FALSE(streamer.held_at_end());
+  EXPECT_EQ(source.NumChunks() - 1, streamer.chunk());
+  EXPECT_LT(nodes.back().x, streamer.X());
+  streamer.Stop();
+  CompactSpline::Destroy(whole_spline);
+}
+
+// Values added to a RingSpline while it plays should come out a steady
+// latency later, around the ring many times, without restarting playback.
+// If the data stops, playback should slow down rather than pass the most
+// recent value, and then recover the latency once the data resumes.
+TEST_F(SplineTests, RingSplinePlaysLiveData) {
+  static const float kStepX = 10.0f;
+  static const float kLatency = 30.0f;
+  motive::RingSpline ring(8, kStepX, Range(-1.0f, 1.0f));
+  motive::RingSplineClock clock(kLatency);
+  int num_values = 0;
+  while (num_values < 4) ring.AddValue(sin(0.1f * num_values++));
+
+  BulkSplineEvaluator evaluator;
+  evaluator.SetNumIndices(1);
+  evaluator.SetSplines(0, 1, &ring.spline(), clock.Start(ring));
+  const CompactSpline* spline = &ring.spline();
+
+  // Play around the ring a few times, one value per frame.
+  for (int frame = 0; frame < 30; ++frame) {
+    ring.AddValue(sin(0.1f * num_values++));
+    evaluator.AdvanceFrame(kStepX);
+    evaluator.SetPlaybackRates(0, 1, clock.Update(ring, kStepX));
+    EXPECT_NEAR(kLatency, clock.lag(), 1e-3f);
+    EXPECT_NEAR(sin(0.1f * (num_values - 4)), evaluator.Y(0),
+                kFixedPointEpsilon);
+  }
+  EXPECT_EQ(spline, &ring.spline());
+
+  // The data stops, so playback slows down before reaching the newest value.
+  for (int frame = 0; frame < 10; ++frame) {
+    evaluator.AdvanceFrame(kStepX);
+    evaluator.SetPlaybackRates(0, 1, clock.Update(ring, kStepX));
+    EXPECT_LT(0.0f, clock.lag());
+    EXPECT_GT(1.0f, clock.playback_rate());
+  }
+
+  // The data resumes, and the latency recovers.
+  for (int frame = 0; frame < 40; ++frame) {
+    ring.AddValue(sin(0.1f * num_values++));
+    evaluator.AdvanceFrame(kStepX);
+    evaluator.SetPlaybackRates(0, 1, clock.Update(ring, kStepX));
+  }
+  EXPECT_NEAR(kLatency, clock.lag(), 0.1f);
+  EXPECT_NEAR(1.0f, clock.playback_rate(), 0.01f);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
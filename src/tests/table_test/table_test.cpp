@@ -12,11 +12,21 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <atomic>
+
+#include "anim_bundle_generated.h"
 #include "anim_generated.h"
 #include "anim_table_generated.h"
 #include "gtest/gtest.h"
 #include "motive/anim_table.h"
-
+#include "motive/io/flatbuffers.h"
+#include "motive/pose_database.h"
+#include "motive/pose_texture.h"
+#include "motive/preset_table.h"
+#include "motive/rig_anim_sampler.h"
+#include "motive_generated.h"
+
+using motive::AnimName;
 using motive::AnimTable;
 using motive::AnimListFb;
 using motive::AnimTableFb;
@@ -26,6 +36,8 @@ enum AnimTableInitMethod {
   kInitFromNames,
   kInitFromFlatBufferNames,
   kInitFromFlatBufferEmbedded,
+  kInitFromBuffers,
+  kInitFromNamesAsync,
 };
 
 class TableTests : public ::testing::Test {
@@ -41,6 +53,12 @@ class TableTests : public ::testing::Test {
   }                                                             \
   TEST_F(TableTests, TestFn##FlatBufferEmbedded) {              \
     TestFn(kInitFromFlatBufferEmbedded);                        \
+  }                                                             \
+  TEST_F(TableTests, TestFn##Buffers) {                         \
+    TestFn(kInitFromBuffers);                                   \
+  }                                                             \
+  TEST_F(TableTests, TestFn##NamesAsync) {                      \
+    TestFn(kInitFromNamesAsync);                                \
   }
 
 // For internal mock data, only say files that start with "valid" are valid.
@@ -48,8 +66,35 @@ static bool ValidTestName(const char* name) {
   return strncmp(name, "valid", 5) == 0;
 }
 
+// Files that start with "valid_spline" have one bone, animated by the same
+// spline in every file.
+static bool SplineTestName(const char* name) {
+  return strncmp(name, "valid_spline", 12) == 0;
+}
+
+static flatbuffers::Offset<motive::RigAnimFb> CreateSplineRigAnimFbOffset(
+    flatbuffers::FlatBufferBuilder& fbb, const std::string& name) {
+  const std::vector<motive::CompactSplineNodeFb> nodes = {
+      motive::CompactSplineNodeFb(0, 0, 0),
+      motive::CompactSplineNodeFb(100, 65535, 0)};
+  auto spline_fb = motive::CreateCompactSplineFb(
+      fbb, 0.0f, 1.0f, 1.0f, fbb.CreateVectorOfStructs(nodes));
+  const std::vector<flatbuffers::Offset<motive::MatrixOpFb>> ops = {
+      motive::CreateMatrixOpFb(
+          fbb, 0, motive::MatrixOperationTypeFb_kTranslateX,
+          motive::MatrixOpValueFb_CompactSplineFb, spline_fb.Union())};
+  const std::vector<flatbuffers::Offset<motive::MatrixAnimFb>> matrix_anims = {
+      motive::CreateMatrixAnimFb(fbb, fbb.CreateVector(ops))};
+  const std::vector<uint8_t> parents = {motive::kInvalidBoneIdx};
+  return motive::CreateRigAnimFb(fbb, fbb.CreateVector(matrix_anims),
+                                 fbb.CreateVector(parents), 0, false,
+                                 fbb.CreateString(name));
+}
+
 static flatbuffers::Offset<motive::RigAnimFb> CreateRigAnimFbOffset(
     flatbuffers::FlatBufferBuilder& fbb, const std::string& name) {
+  if (SplineTestName(name.c_str()))
+    return CreateSplineRigAnimFbOffset(fbb, name);
   return ValidTestName(name.c_str())
              ? motive::CreateRigAnimFb(fbb, 0, 0, 0, false,
                                        fbb.CreateString(name))
@@ -70,6 +115,31 @@ static const char* RigAnimFbLoadFn(const char* file_name,
   return scratch_buf->c_str();
 }
 
+// Number of buffers handed out by RigAnimFbBufferLoadFn and not yet released.
+static int g_live_buffers = 0;
+
+static void ReleaseRigAnimFbBuffer(const char* data, size_t /*size*/,
+                                   void* /*context*/) {
+  delete[] data;
+  g_live_buffers--;
+}
+
+static bool RigAnimFbBufferLoadFn(const char* file_name,
+                                  AnimTable::AnimBuffer* buffer) {
+  std::string scratch_buf;
+  const char* anim_buf = RigAnimFbLoadFn(file_name, &scratch_buf);
+  if (anim_buf == nullptr) return false;
+
+  // Hand the table memory that it must release, as a file mapping would be.
+  char* data = new char[scratch_buf.size()];
+  memcpy(data, scratch_buf.data(), scratch_buf.size());
+  buffer->data = data;
+  buffer->size = scratch_buf.size();
+  buffer->release = ReleaseRigAnimFbBuffer;
+  g_live_buffers++;
+  return true;
+}
+
 static flatbuffers::Offset<AnimSource> CreateAnimSourceOffset(
     flatbuffers::FlatBufferBuilder& fbb, const std::string& name,
     motive::AnimSourceUnion source) {
@@ -128,6 +198,12 @@ static bool InitFromList(const AnimTable::ListFileNames& names,
                          AnimTableInitMethod method, AnimTable* table) {
   if (method == kInitFromNames)
     return table->InitFromAnimFileNames(names, RigAnimFbLoadFn);
+  if (method == kInitFromBuffers)
+    return table->InitFromAnimFileNamesInPlace(names, RigAnimFbBufferLoadFn);
+  if (method == kInitFromNamesAsync) {
+    table->InitFromAnimFileNamesAsync(names, RigAnimFbLoadFn);
+    return table->WaitForLoad();
+  }
 
   const motive::AnimSourceUnion source =
       method == kInitFromFlatBufferNames
@@ -143,6 +219,12 @@ static bool InitFromTable(const AnimTable::TableFileNames& names,
                           AnimTableInitMethod method, AnimTable* table) {
   if (method == kInitFromNames)
     return table->InitFromAnimFileNames(names, RigAnimFbLoadFn);
+  if (method == kInitFromBuffers)
+    return table->InitFromAnimFileNamesInPlace(names, RigAnimFbBufferLoadFn);
+  if (method == kInitFromNamesAsync) {
+    table->InitFromAnimFileNamesAsync(names, RigAnimFbLoadFn);
+    return table->WaitForLoad();
+  }
 
   const motive::AnimSourceUnion source =
       method == kInitFromFlatBufferNames
@@ -191,6 +273,305 @@ void ListDuplicate(AnimTableInitMethod method) {
 }
 TEST_ALL_INIT_METHODS(ListDuplicate)
 
+void ListSharedSplines(AnimTableInitMethod method) {
+  AnimTable::ListFileNames names;
+  names.push_back("valid_spline1.motiveanim");
+  names.push_back("valid_spline2.motiveanim");
+
+  AnimTable table;
+  EXPECT_TRUE(InitFromList(names, method, &table));
+  EXPECT_EQ(table.NumUniqueAnims(), 2);
+
+  // Both animations should point at the same spline.
+  const motive::MatrixOperationInit& op0 = table.Query(0, 0)->Anim(0).ops()[0];
+  const motive::MatrixOperationInit& op1 = table.Query(0, 1)->Anim(0).ops()[0];
+  EXPECT_EQ(op0.spline, op1.spline);
+
+  // Splines that reference loaded buffers own only their headers.
+  EXPECT_EQ(table.SharedSplineBytes(),
+            motive::CompactSpline::Size(method == kInitFromBuffers ? 0 : 2));
+}
+TEST_ALL_INIT_METHODS(ListSharedSplines)
+
+// Buffers handed to the table should be referenced, and released only when the
+// table is destroyed.
+TEST_F(TableTests, BuffersReleasedWithTable) {
+  AnimTable::ListFileNames names;
+  names.push_back("valid_spline1.motiveanim");
+  names.push_back("valid_spline2.motiveanim");
+  names.push_back("invalid.motiveanim");
+  {
+    AnimTable table;
+    EXPECT_FALSE(table.InitFromAnimFileNamesInPlace(names,
+                                                    RigAnimFbBufferLoadFn));
+    EXPECT_EQ(table.NumUniqueAnims(), 2);
+    EXPECT_EQ(g_live_buffers, 2);
+
+    // The spline is read from the buffer, so the table holds no nodes.
+    EXPECT_EQ(table.GetMemoryStats().spline_node_bytes, 0u);
+    EXPECT_EQ(table.Query(0, 0)->Anim(0).ops()[0].spline->num_nodes(), 2);
+  }
+  EXPECT_EQ(g_live_buffers, 0);
+}
+
+// Objects should become available as their animations finish loading, and
+// the callback should report the result of the whole load.
+TEST_F(TableTests, AsyncLoadCompletes) {
+  AnimTable::TableFileNames names(3);
+  names[0].push_back("valid_spline1.motiveanim");
+  names[0].push_back("valid1.motiveanim");
+  names[1].push_back("invalid.motiveanim");
+  names[1].push_back("valid1.motiveanim");
+
+  std::atomic<int> num_callbacks(0);
+  std::atomic<bool> callback_success(true);
+  AnimTable table;
+  table.InitFromAnimFileNamesAsync(names, RigAnimFbLoadFn,
+                                   [&](bool success) {
+                                     callback_success = success;
+                                     num_callbacks++;
+                                   });
+
+  // Object 2 has no animations, so it's available straight away.
+  EXPECT_TRUE(table.IsObjectLoaded(2));
+  EXPECT_FALSE(table.WaitForLoad());
+  EXPECT_EQ(num_callbacks, 1);
+  EXPECT_FALSE(callback_success);
+  for (int object = 0; object < table.NumObjects(); ++object) {
+    EXPECT_TRUE(table.IsObjectLoaded(object));
+  }
+  EXPECT_EQ(table.NumUniqueAnims(), 2);
+  EXPECT_NE(table.Query(0, 0), nullptr);
+  EXPECT_EQ(table.Query(1, 0), nullptr);
+  EXPECT_EQ(table.Query(1, 1), table.Query(0, 1));
+  EXPECT_EQ(table.DefiningAnim(0).NumBones(), 1);
+}
+
+// On-demand tables should load animations when acquired, and evict the least
+// recently released ones to stay within the budget.
+TEST_F(TableTests, ResidencyBudgetEvictsLeastRecentlyReleased) {
+  AnimTable::ListFileNames names;
+  names.push_back("valid_spline1.motiveanim");
+  names.push_back("valid_spline2.motiveanim");
+  names.push_back("valid_spline3.motiveanim");
+
+  // With no room at all, animations are only resident while pinned.
+  size_t anim_bytes = 0;
+  {
+    AnimTable table;
+    table.set_residency_budget(1);
+    EXPECT_TRUE(table.InitFromAnimFileNames(names, RigAnimFbLoadFn));
+    EXPECT_EQ(table.ResidentBytes(), 0u);
+    EXPECT_EQ(table.Query(0, 0), nullptr);
+    EXPECT_NE(table.Acquire(0, 0), nullptr);
+    anim_bytes = table.ResidentBytes();
+    EXPECT_GT(anim_bytes, 0u);
+    table.Release(0, 0);
+    EXPECT_EQ(table.ResidentBytes(), 0u);
+  }
+
+  // Room for two. Initialization releases the animations in order, so the
+  // first one is evicted.
+  AnimTable table;
+  table.set_residency_budget(2 * anim_bytes);
+  EXPECT_TRUE(table.InitFromAnimFileNames(names, RigAnimFbLoadFn));
+  EXPECT_EQ(table.DefiningAnim(0).NumBones(), 1);
+  EXPECT_EQ(table.Query(0, 0), nullptr);
+  EXPECT_NE(table.Query(0, 1), nullptr);
+  EXPECT_NE(table.Query(0, 2), nullptr);
+
+  // Bringing the first one back evicts the least recently released.
+  EXPECT_NE(table.Acquire(0, 0), nullptr);
+  EXPECT_EQ(table.Query(0, 1), nullptr);
+  EXPECT_NE(table.Query(0, 2), nullptr);
+  EXPECT_EQ(table.ResidentBytes(), 2 * anim_bytes);
+  table.Release(0, 0);
+  EXPECT_EQ(table.NumUniqueAnims(), 2);
+}
+
+// Reloading an animation should replace only that animation, and reuse the
+// splines that haven't changed.
+TEST_F(TableTests, ReloadAnimSharesUnchangedSplines) {
+  AnimTable::ListFileNames names;
+  names.push_back("valid_spline1.motiveanim");
+  names.push_back("valid1.motiveanim");
+  AnimTable table;
+  EXPECT_TRUE(table.InitFromAnimFileNames(names, RigAnimFbLoadFn));
+  const motive::RigAnim* original = table.Query(0, 0);
+  const motive::RigAnim* untouched = table.Query(0, 1);
+
+  const motive::RigAnim* old_anim = nullptr;
+  const motive::RigAnim* anim = table.ReloadAnim(
+      "valid_spline1.motiveanim", RigAnimFbLoadFn, &old_anim);
+  ASSERT_NE(anim, nullptr);
+  EXPECT_NE(anim, original);
+  EXPECT_EQ(old_anim, original);
+  EXPECT_EQ(table.Query(0, 0), anim);
+  EXPECT_EQ(table.Query(0, 1), untouched);
+  EXPECT_EQ(table.NumUniqueAnims(), 2);
+  EXPECT_EQ(anim->Anim(0).ops()[0].spline,
+            original->Anim(0).ops()[0].spline);
+
+  EXPECT_EQ(table.ReloadAnim("missing.motiveanim", RigAnimFbLoadFn), nullptr);
+}
+
+// Decoding into one block should give the same animation as decoding
+// normally.
+TEST_F(TableTests, ContiguousDecodeMatchesDefault) {
+  flatbuffers::FlatBufferBuilder fbb;
+  FinishRigAnimFbBuffer(
+      fbb, CreateSplineRigAnimFbOffset(fbb, "valid_spline1.motiveanim"));
+  const motive::RigAnimFb& anim_fb =
+      *motive::GetRigAnimFb(fbb.GetBufferPointer());
+
+  motive::RigAnim anim;
+  motive::RigAnim contiguous;
+  EXPECT_TRUE(motive::RigAnimFromFlatBuffers(anim_fb, &anim));
+  EXPECT_TRUE(motive::RigAnimFromFlatBuffersContiguous(anim_fb, &contiguous));
+  ASSERT_EQ(contiguous.NumBones(), anim.NumBones());
+  EXPECT_EQ(contiguous.end_time(), anim.end_time());
+
+  const motive::CompactSpline* spline = anim.Anim(0).ops()[0].spline;
+  const motive::CompactSpline* contiguous_spline =
+      contiguous.Anim(0).ops()[0].spline;
+  ASSERT_EQ(contiguous_spline->num_nodes(), spline->num_nodes());
+  for (motive::CompactSplineIndex i = 0; i < spline->num_nodes(); ++i) {
+    EXPECT_EQ(contiguous_spline->nodes()[i], spline->nodes()[i]);
+  }
+
+  // The same nodes are held either way.
+  motive::MemoryStats anim_stats;
+  motive::MemoryStats contiguous_stats;
+  anim.AddMemoryStats(&anim_stats);
+  contiguous.AddMemoryStats(&contiguous_stats);
+  EXPECT_EQ(contiguous_stats.spline_node_bytes, anim_stats.spline_node_bytes);
+}
+
+// A packed spline with too few bits for its nodes should fail verification,
+// and fail to decode when verification is skipped.
+TEST_F(TableTests, TruncatedPackedSplineFailsToLoad) {
+  flatbuffers::FlatBufferBuilder fbb;
+  const std::vector<uint8_t> bits(2, 0);
+  auto spline_fb = motive::CreateCompactSplinePackedFb(
+      fbb, 0.0f, 1.0f, 1.0f, 4, 16, 16, 16, fbb.CreateVector(bits));
+  const std::vector<flatbuffers::Offset<motive::MatrixOpFb>> ops = {
+      motive::CreateMatrixOpFb(
+          fbb, 0, motive::MatrixOperationTypeFb_kTranslateX,
+          motive::MatrixOpValueFb_CompactSplinePackedFb, spline_fb.Union())};
+  const std::vector<flatbuffers::Offset<motive::MatrixAnimFb>> matrix_anims = {
+      motive::CreateMatrixAnimFb(fbb, fbb.CreateVector(ops))};
+  const std::vector<uint8_t> parents = {motive::kInvalidBoneIdx};
+  FinishRigAnimFbBuffer(
+      fbb, motive::CreateRigAnimFb(fbb, fbb.CreateVector(matrix_anims),
+                                   fbb.CreateVector(parents), 0, false,
+                                   fbb.CreateString("truncated")));
+
+  EXPECT_FALSE(motive::VerifyRigAnimFlatBuffer(fbb.GetBufferPointer(),
+                                               fbb.GetSize()));
+  motive::RigAnim anim;
+  EXPECT_FALSE(motive::RigAnimFromFlatBuffers(
+      fbb.GetBufferPointer(), fbb.GetSize(), false, &anim));
+  EXPECT_EQ(anim.Anim(0).ops()[0].union_type,
+            motive::MatrixOperationInit::kUnionEmpty);
+}
+
+// A table written to a bundle should load back with the same layout, whether
+// or not the bundle is packed.
+TEST_F(TableTests, BundleRoundTrips) {
+  AnimTable::TableFileNames names(2);
+  names[0].push_back("valid_spline1.motiveanim");
+  names[0].push_back("valid1.motiveanim");
+  names[1].push_back("valid_spline2.motiveanim");
+  names[1].push_back("");
+  names[1].push_back("valid1.motiveanim");
+  AnimTable source;
+  EXPECT_TRUE(source.InitFromAnimFileNames(names, RigAnimFbLoadFn));
+
+  const float kTolerances[] = {0.0f, 0.01f};
+  for (size_t i = 0; i < MOTIVE_ARRAY_SIZE(kTolerances); ++i) {
+    flatbuffers::FlatBufferBuilder fbb;
+    motive::AnimTableToFlatBuffers(source, kTolerances[i], &fbb);
+    const motive::AnimBundleFb& bundle =
+        *motive::GetAnimBundleFb(fbb.GetBufferPointer());
+
+    // Anims are numbered in the order they're first referenced. The shared
+    // spline is written once, at an aligned offset.
+    ASSERT_EQ(bundle.anims()->size(), 3u);
+    const size_t data_offset =
+        bundle.spline_data()->data() - fbb.GetBufferPointer();
+    EXPECT_EQ(data_offset % 64, 0u);
+    EXPECT_EQ(bundle.anims()->Get(0)->splines()->Get(0)->offset(),
+              bundle.anims()->Get(2)->splines()->Get(0)->offset());
+
+    AnimTable table;
+    EXPECT_TRUE(table.InitFromBundle(bundle));
+    EXPECT_EQ(table.NumObjects(), 2);
+    EXPECT_EQ(table.NumAnims(1), 3);
+    EXPECT_EQ(table.NumUniqueAnims(), 3);
+    EXPECT_EQ(table.Query(1, 1), nullptr);
+    EXPECT_EQ(table.Query(0, 1), table.Query(1, 2));
+    EXPECT_EQ(table.Query(1, 0)->anim_name(), "valid_spline2.motiveanim");
+    EXPECT_EQ(table.Query(1, 0)->Anim(0).ops()[0].spline->num_nodes(), 2);
+    EXPECT_EQ(table.DefiningAnim(1).NumBones(), 1);
+  }
+
+  // Uncompressed bundles can be referenced in place.
+  flatbuffers::FlatBufferBuilder fbb;
+  motive::AnimTableToFlatBuffers(source, 0.0f, &fbb);
+  AnimTable::AnimBuffer buffer;
+  buffer.data = reinterpret_cast<const char*>(fbb.GetBufferPointer());
+  buffer.size = fbb.GetSize();
+  AnimTable table;
+  EXPECT_TRUE(table.InitFromBundleInPlace(buffer));
+  EXPECT_EQ(table.GetMemoryStats().spline_node_bytes, 0u);
+  EXPECT_EQ(table.Query(0, 0)->Anim(0).ops()[0].spline->num_nodes(), 2);
+}
+
+// Trusted bundles are checked against their checksum instead of verified.
+// Corrupt node data is only caught by the checksum, and a truncated buffer
+// only by verification.
+TEST_F(TableTests, BundleChecksAreChosenByTrust) {
+  AnimTable::ListFileNames names;
+  names.push_back("valid_spline1.motiveanim");
+  AnimTable source;
+  EXPECT_TRUE(source.InitFromAnimFileNames(names, RigAnimFbLoadFn));
+  flatbuffers::FlatBufferBuilder fbb;
+  motive::AnimTableToFlatBuffers(source, 0.0f, &fbb);
+  const std::string file(reinterpret_cast<const char*>(fbb.GetBufferPointer()),
+                         fbb.GetSize());
+  const motive::AnimBundleFb& bundle = *motive::GetAnimBundleFb(file.data());
+  const size_t node_offset = bundle.spline_data()->data() -
+                             reinterpret_cast<const uint8_t*>(file.data());
+
+  std::string corrupt = file;
+  corrupt[node_offset] ^= 1;
+  const std::string truncated = file.substr(0, file.size() / 2);
+  EXPECT_TRUE(motive::CheckAnimBundleChecksum(file.data(), file.size()));
+  EXPECT_FALSE(
+      motive::CheckAnimBundleChecksum(corrupt.data(), corrupt.size()));
+  EXPECT_TRUE(motive::VerifyAnimBundleFlatBuffer(file.data(), file.size()));
+  EXPECT_TRUE(
+      motive::VerifyAnimBundleFlatBuffer(corrupt.data(), corrupt.size()));
+  EXPECT_FALSE(
+      motive::VerifyAnimBundleFlatBuffer(truncated.data(), truncated.size()));
+
+  for (int trust = 0; trust < 2; ++trust) {
+    AnimTable::AnimBuffer buffer;
+    buffer.data = file.data();
+    buffer.size = file.size();
+    AnimTable table;
+    table.set_trust_files(trust != 0);
+    EXPECT_TRUE(table.InitFromBundleInPlace(buffer));
+    EXPECT_EQ(table.NumUniqueAnims(), 1);
+
+    // A trusted bundle with corrupt nodes is rejected before decoding.
+    buffer.data = corrupt.data();
+    AnimTable corrupt_table;
+    corrupt_table.set_trust_files(trust != 0);
+    EXPECT_EQ(corrupt_table.InitFromBundleInPlace(buffer), trust == 0);
+  }
+}
+
 void ListConsecutiveDuplicates(AnimTableInitMethod method) {
   AnimTable::ListFileNames names;
   names.push_back("valid1.motiveanim");
@@ -226,6 +607,34 @@ void ListSingleInvalid(AnimTableInitMethod method) {
 }
 TEST_ALL_INIT_METHODS(ListSingleInvalid)
 
+void ListFindAnimByName(AnimTableInitMethod method) {
+  static const int kNumAnims = 100;
+  AnimTable::ListFileNames names;
+  for (int i = 0; i < kNumAnims; ++i) {
+    names.push_back("valid" + std::to_string(i) + ".motiveanim");
+  }
+  names.push_back("valid1.motiveanim");
+
+  AnimTable table;
+  EXPECT_TRUE(InitFromList(names, method, &table));
+  for (int i = 0; i < kNumAnims; ++i) {
+    const AnimTable::AnimHandle handle =
+        table.FindAnim(AnimName(names[i].c_str()));
+    EXPECT_NE(AnimTable::kInvalidAnimHandle, handle);
+    EXPECT_EQ(table.Query(0, i), table.QueryByHandle(handle));
+  }
+
+  // Names can be hashed at compile time.
+  constexpr AnimName kValid1("valid1.motiveanim");
+  const AnimTable::AnimHandle valid1 = table.FindAnim(kValid1);
+  EXPECT_EQ(table.Query(0, kNumAnims), table.QueryByHandle(valid1));
+  EXPECT_EQ(table.Query(0, 2), table.QueryByName("valid2.motiveanim"));
+  EXPECT_EQ(AnimTable::kInvalidAnimHandle,
+            table.FindAnim(AnimName("valid100.motiveanim")));
+  EXPECT_EQ(nullptr, table.QueryByName("invalid.motiveanim"));
+}
+TEST_ALL_INIT_METHODS(ListFindAnimByName)
+
 void TableEmpty(AnimTableInitMethod method) {
   AnimTable::TableFileNames names;
 
@@ -305,6 +714,177 @@ void TableInvalids(AnimTableInitMethod method) {
 }
 TEST_ALL_INIT_METHODS(TableInvalids)
 
+// Every frame of every clip should be baked into its own row, and survive
+// serialization.
+TEST_F(TableTests, PoseTextureBakesEveryFrame) {
+  AnimTable::ListFileNames names;
+  names.push_back("valid_spline1.motiveanim");
+  names.push_back("valid_spline2.motiveanim");
+  AnimTable table;
+  ASSERT_TRUE(table.InitFromAnimFileNames(names, RigAnimFbLoadFn));
+
+  const int anim_indices[] = {0, 1};
+  const float duration = static_cast<float>(table.Query(0, 0)->end_time());
+  motive::PoseTexture baked;
+  ASSERT_TRUE(baked.Bake(table, 0, anim_indices, 2, duration / 4.0f,
+                         motive::PoseTexture::kFloat));
+  ASSERT_EQ(baked.clips().size(), 2u);
+  EXPECT_EQ(baked.clips()[0].num_frames, 5u);
+  EXPECT_EQ(baked.clips()[1].first_frame, 5u);
+  EXPECT_EQ(baked.width(), 3);
+  EXPECT_EQ(baked.height(), 10);
+
+  std::vector<uint8_t> buffer;
+  baked.Serialize(&buffer);
+  motive::PoseTexture texture;
+  ASSERT_TRUE(texture.InitFromBuffer(buffer.data(), buffer.size()));
+  EXPECT_FALSE(texture.InitFromBuffer(buffer.data(), buffer.size() - 1));
+  ASSERT_TRUE(texture.InitFromBuffer(buffer.data(), buffer.size()));
+
+  // The single op translates along x, which is the last element of the first
+  // texel of each row.
+  const motive::CompactSpline& spline =
+      *table.Query(0, 0)->Anim(0).ops()[0].spline;
+  const float* texels = reinterpret_cast<const float*>(texture.data());
+  for (int frame = 0; frame < texture.height(); ++frame) {
+    const float time = (frame % 5) * duration / 4.0f;
+    EXPECT_NEAR(spline.YCalculatedSlowly(time),
+                texels[frame * texture.width() * 4 + 3], 1e-5f);
+  }
+
+  // Rigs in GPU playback are found by their animation's name.
+  motive::RigGpuPlayback playback;
+  playback.anim = table.Query(0, 1);
+  playback.time = duration / 2.0f;
+  motive::PoseTextureSample sample;
+  ASSERT_TRUE(texture.Locate(playback, &sample));
+  EXPECT_EQ(sample.clip, 1);
+  EXPECT_FLOAT_EQ(sample.frame, 2.0f);
+  EXPECT_EQ(sample.previous_clip, -1);
+}
+
+// The features of a sampled pose, computed at runtime from the same
+// transforms, should find that pose.
+TEST_F(TableTests, PoseDatabaseFindsSampledPose) {
+  AnimTable::ListFileNames names;
+  names.push_back("valid_spline1.motiveanim");
+  names.push_back("valid_spline2.motiveanim");
+  AnimTable table;
+  ASSERT_TRUE(table.InitFromAnimFileNames(names, RigAnimFbLoadFn));
+
+  const int anim_indices[] = {0, 1};
+  const motive::BoneIndex bones[] = {0};
+  const float duration = static_cast<float>(table.Query(0, 0)->end_time());
+  const float pose_time = duration / 4.0f;
+  motive::PoseDatabase database;
+  ASSERT_TRUE(
+      database.Build(table, 0, anim_indices, 2, pose_time, bones, 1));
+  ASSERT_EQ(database.clips().size(), 2u);
+  EXPECT_EQ(database.NumPoses(), 10);
+  EXPECT_EQ(database.NumFeatures(), motive::PoseDatabase::kFeaturesPerBone);
+
+  // Bones that aren't in the rig can't be matched.
+  const motive::BoneIndex missing_bones[] = {200};
+  motive::PoseDatabase invalid;
+  EXPECT_FALSE(
+      invalid.Build(table, 0, anim_indices, 2, pose_time, missing_bones, 1));
+
+  const motive::RigAnim& anim = *table.Query(0, 0);
+  motive::RigAnimSampler sampler(anim);
+  std::vector<mathfu::AffineTransform,
+              mathfu::simd_allocator<mathfu::AffineTransform>>
+      globals(anim.NumBones());
+  std::vector<mathfu::AffineTransform,
+              mathfu::simd_allocator<mathfu::AffineTransform>>
+      previous_globals(anim.NumBones());
+  sampler.GlobalTransforms(2.0f * pose_time, false, globals.data());
+  sampler.GlobalTransforms(pose_time, false, previous_globals.data());
+  std::vector<float> features(database.NumFeatures());
+  database.ComputeFeatures(globals.data(), previous_globals.data(), pose_time,
+                           features.data());
+
+  motive::PoseMatch match;
+  ASSERT_TRUE(database.Search(features.data(), &match));
+  EXPECT_NEAR(match.distance, 0.0f, 1e-5f);
+  EXPECT_FLOAT_EQ(match.time, 2.0f * pose_time);
+  EXPECT_EQ(&database.Anim(match), table.Query(0, match.clip));
+  EXPECT_FLOAT_EQ(database.Playback(match, 10.0f).start_x, match.time);
+
+  // Every stored pose is its own closest match.
+  std::vector<float> pose_features(database.NumFeatures());
+  for (int pose = 0; pose < database.NumPoses(); ++pose) {
+    database.PoseFeatures(pose, pose_features.data());
+    ASSERT_TRUE(database.Search(pose_features.data(), &match));
+    EXPECT_NEAR(match.distance, 0.0f, 1e-5f);
+  }
+}
+
+// Presets are decoded once, and found by name or ID. Presets with the same
+// parameters share one init.
+TEST_F(TableTests, PresetTableFromFlatBuffers) {
+  flatbuffers::FlatBufferBuilder fbb;
+  auto overshoot = [&fbb](float max_velocity) {
+    return motive::CreateOvershootParameters(
+               fbb, motive::CreateModularParameters(fbb, false, 0.0f, 100.0f),
+               max_velocity, 50.0f,
+               motive::CreateSettled1fParameters(fbb, 0.1f, 0.01f), 0.001f,
+               4.0f, 10)
+        .Union();
+  };
+  const std::vector<flatbuffers::Offset<motive::MotivatorPresetFb>> presets = {
+      motive::CreateMotivatorPresetFb(
+          fbb, fbb.CreateString("slow"),
+          motive::MotivatorPresetParametersFb_OvershootParameters,
+          overshoot(1.0f)),
+      motive::CreateMotivatorPresetFb(
+          fbb, fbb.CreateString("fast"),
+          motive::MotivatorPresetParametersFb_OvershootParameters,
+          overshoot(10.0f)),
+      motive::CreateMotivatorPresetFb(
+          fbb, fbb.CreateString("also_slow"),
+          motive::MotivatorPresetParametersFb_OvershootParameters,
+          overshoot(1.0f)),
+      motive::CreateMotivatorPresetFb(
+          fbb, fbb.CreateString("angle"),
+          motive::MotivatorPresetParametersFb_SplineParameters,
+          motive::CreateSplineParameters(
+              fbb, motive::CreateModularParameters(fbb, true, -1.0f, 1.0f))
+              .Union())};
+  motive::FinishMotivatorPresetsFbBuffer(
+      fbb,
+      motive::CreateMotivatorPresetsFb(fbb, fbb.CreateVector(presets)));
+
+  motive::PresetTable table;
+  const char garbage[] = "not a preset file";
+  EXPECT_FALSE(motive::PresetTableFromFlatBuffers(garbage, sizeof(garbage),
+                                                  true, &table));
+  EXPECT_EQ(0, table.NumPresets());
+  ASSERT_TRUE(motive::PresetTableFromFlatBuffers(
+      fbb.GetBufferPointer(), fbb.GetSize(), true, &table));
+  EXPECT_EQ(4, table.NumPresets());
+
+  const motive::PresetId slow = table.FindId("slow");
+  const motive::PresetId fast = table.FindId("fast");
+  ASSERT_NE(motive::kInvalidPresetId, slow);
+  ASSERT_NE(motive::kInvalidPresetId, fast);
+  EXPECT_EQ(motive::kInvalidPresetId, table.FindId("missing"));
+  EXPECT_EQ(nullptr, table.Find("missing"));
+  EXPECT_EQ(&table.Preset(slow), table.Find("also_slow"));
+  EXPECT_NE(&table.Preset(slow), &table.Preset(fast));
+
+  EXPECT_EQ(motive::OvershootInit::kType, table.Preset(fast).type());
+  const motive::OvershootInit& fast_init =
+      static_cast<const motive::OvershootInit&>(table.Preset(fast));
+  EXPECT_EQ(10.0f, fast_init.max_velocity());
+  EXPECT_EQ(10, fast_init.max_delta_time());
+
+  ASSERT_NE(nullptr, table.Find("angle"));
+  EXPECT_EQ(motive::SplineInit::kType, table.Find("angle")->type());
+  EXPECT_EQ(motive::Range(-1.0f, 1.0f),
+            static_cast<const motive::SplineInit*>(table.Find("angle"))
+                ->range());
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
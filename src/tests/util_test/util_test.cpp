@@ -541,6 +541,164 @@ TEST_F(UtilTests, CubicSplineInterpolation) {
   }
 }
 
+// Test that bulk conversion creates the same curves, in the same op order, as
+// converting each bone separately, and uses exactly the buffer it asks for.
+TEST_F(UtilTests, AddBulkCurvesMatchesPerBone) {
+  const size_t num_times = 3;
+  const float times[num_times] = {0.f, 1.f, 2.f};
+  const float translations[9] = {
+      0.f, 1.f, 2.f, 1.f, 3.f, 2.f, 2.f, 0.f, 5.f,
+  };
+  // The middle quaternion is flipped relative to its neighbours.
+  const float rotations[12] = {
+      0.5f,  0.5f,  0.5f,  0.5f,
+      -0.5f, -0.4f, -0.6f, -0.5f,
+      0.6f,  0.4f,  0.5f,  0.5f,
+  };
+
+  KeyframeData translation_data;
+  translation_data.times = times;
+  translation_data.values = translations;
+  translation_data.count = num_times;
+  translation_data.ms_per_time_unit = 1.f;
+  KeyframeData rotation_data = translation_data;
+  rotation_data.values = rotations;
+
+  MatrixAnim expected;
+  MatrixAnim::Spline* expected_splines = expected.Construct(7);
+  motive::AddVector3Curves(&expected, expected_splines, motive::kTranslateX, 0,
+                           translation_data);
+  motive::AddQuaternionCurves(&expected, expected_splines + 3, 3,
+                              motive::kOrderXYZW, rotation_data);
+
+  MatrixAnim bulk;
+  MatrixAnim::Spline* bulk_splines = bulk.Construct(7);
+  motive::KeyframeCurveGroup groups[2];
+  groups[0].anim = &bulk;
+  groups[0].splines = bulk_splines;
+  groups[0].base_type = motive::kTranslateX;
+  groups[0].base_id = 0;
+  groups[0].data = translation_data;
+  groups[1].anim = &bulk;
+  groups[1].splines = bulk_splines + 3;
+  groups[1].base_id = 3;
+  groups[1].is_quaternion = true;
+  groups[1].order = motive::kOrderXYZW;
+  groups[1].data = rotation_data;
+
+  const size_t buffer_size = motive::GetRequiredBulkBufferSize(groups, 2);
+  EXPECT_EQ(buffer_size, GetRequiredBufferSize(num_times, 7, motive::kLinear));
+  std::vector<uint8_t> buffer(buffer_size);
+  EXPECT_EQ(motive::AddBulkCurves(buffer.data(), groups, 2), buffer_size);
+
+  const std::vector<MatrixOperationInit>& expected_ops = expected.ops();
+  const std::vector<MatrixOperationInit>& bulk_ops = bulk.ops();
+  ASSERT_EQ(bulk_ops.size(), expected_ops.size());
+  for (size_t i = 0; i < bulk_ops.size(); ++i) {
+    EXPECT_EQ(bulk_ops[i].type, expected_ops[i].type);
+    EXPECT_EQ(bulk_ops[i].id, expected_ops[i].id);
+    ASSERT_EQ(bulk_ops[i].union_type,
+              MatrixOperationInit::UnionType::kUnionSpline);
+
+    float expected_ys[20];
+    float bulk_ys[20];
+    expected_ops[i].spline->Ys(times[0], 0.1f, 20, expected_ys);
+    bulk_ops[i].spline->Ys(times[0], 0.1f, 20, bulk_ys);
+    for (int j = 0; j < 20; ++j) {
+      EXPECT_NEAR(bulk_ys[j], expected_ys[j], kEpsilon);
+    }
+  }
+}
+
+// Test that keyframes appended to a stream in several batches make the same
+// curves as converting them all at once, including quaternion flips across
+// batches.
+TEST_F(UtilTests, KeyframeStreamMatchesQuaternionCurves) {
+  const size_t num_times = 3;
+  const float times[num_times] = {0.f, 1.f, 2.f};
+  // The middle quaternion is flipped relative to its neighbours.
+  const float rotations[12] = {
+      0.5f,  0.5f,  0.5f,  0.5f,
+      -0.5f, -0.4f, -0.6f, -0.5f,
+      0.6f,  0.4f,  0.5f,  0.5f,
+  };
+
+  KeyframeData data;
+  data.times = times;
+  data.values = rotations;
+  data.count = num_times;
+  data.ms_per_time_unit = 1.f;
+  MatrixAnim expected;
+  MatrixAnim::Spline* expected_splines = expected.Construct(4);
+  motive::AddQuaternionCurves(&expected, expected_splines, 0,
+                              motive::kOrderXYZW, data);
+
+  motive::KeyframeStream stream(motive::kOrderXYZW, 16, 2);
+  KeyframeData first = data;
+  first.count = 2;
+  stream.AppendKeyframes(first);
+  KeyframeData second = data;
+  second.times = times + 2;
+  second.values = rotations + 8;
+  second.count = 1;
+  stream.AppendKeyframes(second);
+  stream.Flush();
+
+  const std::vector<MatrixOperationInit>& expected_ops = expected.ops();
+  ASSERT_EQ(stream.channel_count(), expected_ops.size());
+  for (size_t i = 0; i < expected_ops.size(); ++i) {
+    ASSERT_EQ(1, stream.Source(i)->NumChunks());
+    const CompactSpline* streamed = stream.Source(i)->Chunk(0);
+    ASSERT_NE(nullptr, streamed);
+
+    float expected_ys[20];
+    float streamed_ys[20];
+    expected_ops[i].spline->Ys(times[0], 0.1f, 20, expected_ys);
+    streamed->Ys(times[0], 0.1f, 20, streamed_ys);
+    for (int j = 0; j < 20; ++j) {
+      EXPECT_NEAR(streamed_ys[j], expected_ys[j], kEpsilon);
+    }
+  }
+}
+
+// Test that ring curves reference the rings' splines, and that quaternions
+// appended to rings are flipped to stay near the previous quaternion.
+TEST_F(UtilTests, RingCurvesPlayRings) {
+  const motive::Range kQuatRange(-1.f, 1.f);
+  std::unique_ptr<motive::RingSpline> rings[4];
+  motive::RingSpline* ring_ptrs[4];
+  for (int i = 0; i < 4; ++i) {
+    rings[i].reset(new motive::RingSpline(4, 10.f, kQuatRange));
+    ring_ptrs[i] = rings[i].get();
+  }
+
+  MatrixAnim anim;
+  motive::AddVector3RingCurves(&anim, ring_ptrs, motive::kTranslateX, 0);
+  motive::AddQuaternionRingCurves(&anim, ring_ptrs, 3);
+  const std::vector<MatrixOperationInit>& ops = anim.ops();
+  ASSERT_EQ(7u, ops.size());
+  for (size_t i = 0; i < ops.size(); ++i) {
+    const MatrixOperationType expected_type =
+        i < 3 ? static_cast<MatrixOperationType>(motive::kTranslateX + i)
+              : static_cast<MatrixOperationType>(motive::kQuaternionW + i - 3);
+    EXPECT_EQ(static_cast<MatrixOpId>(i), ops[i].id);
+    EXPECT_EQ(expected_type, ops[i].type);
+    ASSERT_EQ(ops[i].union_type, MatrixOperationInit::UnionType::kUnionSpline);
+    EXPECT_EQ(&rings[i < 3 ? i : i - 3]->spline(), ops[i].spline);
+  }
+
+  // The second quaternion is nearer the first once negated, so it is flipped.
+  const float first[4] = {0.5f, 0.5f, 0.5f, 0.5f};
+  const float second[4] = {-0.6f, -0.4f, -0.5f, -0.5f};
+  motive::AddRingQuaternionValue(ring_ptrs, first, motive::kOrderXYZW);
+  motive::AddRingQuaternionValue(ring_ptrs, second, motive::kOrderXYZW);
+  const float expected_wxyz[4] = {0.5f, 0.6f, 0.4f, 0.5f};
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(2u, rings[i]->num_added());
+    EXPECT_NEAR(expected_wxyz[i], rings[i]->newest_y(), kEpsilon);
+  }
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -15,6 +15,10 @@
 #include <cassert>
 #include <cmath>
 #include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <random>
 #include "anim_generated.h"
 #include "fplbase/asset_manager.h"
 #include "fplbase/input.h"
@@ -31,6 +35,7 @@
 #include "motive/rig_anim.h"
 #include "motive/rig_init.h"
 #include "motive/rig_motivator.h"
+#include "motive/util/trace.h"
 
 using mathfu::mat3;
 using mathfu::mat4;
@@ -54,6 +59,7 @@ struct ViewerArgs {
       : playback_rate(1.0f),
         blend_time(0.0f),
         bone_idx(-1),
+        num_instances(0),
         coordinate_system(motive::kAngleToVectorXY) {}
 
   std::vector<std::string> anim_files;
@@ -62,6 +68,7 @@ struct ViewerArgs {
   float playback_rate;
   float blend_time;
   int bone_idx;
+  int num_instances;
   AngleToVectorSystem coordinate_system;
 };
 
@@ -93,6 +100,32 @@ static const float kMaxPlaybackRate = 10.0f;
 static const float kPersepectiveFieldOfViewY =
     45.0f * motive::kDegreesToRadians;
 
+// Stress test instances are this many mesh widths apart.
+static const float kStressSpacing = 1.5f;
+
+// Stress test instances blend to a random clip at random intervals in this
+// range, in ms, taking kStressBlendTime to do so.
+static const MotiveTime kStressMinBlendInterval = 1000;
+static const MotiveTime kStressMaxBlendInterval = 5000;
+static const float kStressBlendTime = 250.0f;
+
+// Layout of the stress test's timing chart, in pixels.
+static const float kChartPixelsPerMs = 100.0f;
+static const float kChartBarHeight = 12.0f;
+static const float kChartBarGap = 4.0f;
+static const float kChartMargin = 10.0f;
+
+// Colors of the timing chart's bars, named in the legend printed to stdout.
+static const int kNumChartColors = 6;
+static const float kChartColors[kNumChartColors][4] = {
+    {1.0f, 0.2f, 0.2f, 1.0f}, {0.2f, 1.0f, 0.2f, 1.0f},
+    {0.3f, 0.3f, 1.0f, 1.0f}, {1.0f, 1.0f, 0.2f, 1.0f},
+    {1.0f, 0.2f, 1.0f, 1.0f}, {0.2f, 1.0f, 1.0f, 1.0f},
+};
+static const char* const kChartColorNames[kNumChartColors] = {
+    "red", "green", "blue", "yellow", "magenta", "cyan",
+};
+
 // No skinning, so just draw on screen.
 static const char kVertexShaderMonolythic[] =
     "attribute vec4 aPosition;\n"
@@ -159,6 +192,24 @@ static const char kVertexShaderSkinned[] =
     "  vNormal = (model_view_projection * vec4(aNormal, 0)).xyz;\n"
     "}\n";
 
+// Flat colored quads in screen space, for the stress test's timing chart.
+static const char kVertexShaderChart[] =
+    "attribute vec4 aPosition;\n"
+    "\n"
+    "uniform mat4 model_view_projection;\n"
+    "\n"
+    "void main()\n"
+    "{\n"
+    "  gl_Position = model_view_projection * aPosition;\n"
+    "}\n";
+
+static const char kFragmentShaderChart[] =
+    "uniform lowp vec4 color;\n"
+    "void main()\n"
+    "{\n"
+    "  gl_FragColor = color;\n"
+    "}\n";
+
 // When no textures exist, draw using two Phong light sources.
 static const char kFragmentShaderPhong[] =
     "const vec4 kAmbientColor = vec4(0.3, 0.3, 0.3, 0);\n"
@@ -189,6 +240,7 @@ static const char kFragmentShaderFlatTexture[] =
 static const char kCommandLineUsage[] =
     "Usage: fplviewer [-x|-y|-z] [-f FRAMES_PER_SECOND] [-b BONE_IDX]\n"
     "                 [-t BLEND_TIME] [-o ANIM_DEBUG_OUTPUT.csv]\n"
+    "                 [-n NUM_INSTANCES]\n"
     "                 [ANIMATION_FILE.motiveanim] [MESH_FILE.fplmesh]\n"
     "\n"
     "Tool to preview and debug FPL meshes and Motive animations.\n"
@@ -208,6 +260,11 @@ static const char kCommandLineUsage[] =
     "                        all the animation channels. Open in any\n"
     "                        spreadsheet to examine and graph.\n"
     "                        If unspecified, we write to ANIMATION_FILE.csv\n"
+    "  -n, --stress          Stress test with this many instances of the\n"
+    "                        rig, on a grid, playing random clips from\n"
+    "                        random phases and blending at random times.\n"
+    "                        Motive's time in each processor is charted\n"
+    "                        on screen, and its legend printed every second.\n"
     "  MESH_FILE             Mesh to display. If unspecified,\n"
     "                        tries to load ANIMATION_FILE.fplmesh.\n"
     "  ANIMATION_FILE        The name of the motiveanim file to preview.\n"
@@ -289,6 +346,16 @@ static bool ParseCommandLine(int argc, char* argv[], ViewerArgs* args) {
       args->out_file = option_value;
       continue;
     }
+
+    if (option == "-n" || option == "--stress") {
+      args->num_instances = atoi(option_value.c_str());
+      if (args->num_instances <= 0 || args->num_instances > 100000) {
+        printf("ERROR: Invalid number of instances %d.\n\n",
+               args->num_instances);
+        return false;
+      }
+      continue;
+    }
   }
 
   // Parse mesh and animation file names.
@@ -326,6 +393,12 @@ static bool ParseCommandLine(int argc, char* argv[], ViewerArgs* args) {
     return false;
   }
 
+  // The stress test instances need something to play.
+  if (args->num_instances > 0 && args->anim_files.empty()) {
+    printf("ERROR: Must specify a motiveanim file to stress test.\n\n");
+    return false;
+  }
+
   return true;
 }
 
@@ -484,6 +557,139 @@ static const char* AnimLoadFn(const char* file_name, std::string* scratch_buf) {
   return scratch_buf->c_str();
 }
 
+// Totals the time spent in each processor's AdvanceFrame(), from the spans
+// that Motive emits, for the stress test's timing chart. The engine's own
+// AdvanceFrame() is totalled under "MotiveEngine".
+class ProcessorTimes : public motive::MotiveTraceSink {
+ public:
+  void BeginSpan(const char* /*name*/, const char* /*owner*/,
+                 uint64_t time_ns) override {
+    BeginTimes().push_back(time_ns);
+  }
+
+  void EndSpan(const char* name, const char* owner,
+               uint64_t time_ns) override {
+    std::vector<uint64_t>& begin_times = BeginTimes();
+    const uint64_t duration_ns = time_ns - begin_times.back();
+    begin_times.pop_back();
+    if (strcmp(name, "AdvanceFrame") != 0) return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    totals_ns_[owner] += duration_ns;
+  }
+
+  // Average ms per frame of each owner over the last `num_frames` frames.
+  // Owners stay in the map once seen, so the chart's colors don't change.
+  void TakeAverages(int num_frames, std::map<std::string, double>* ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = totals_ns_.begin(); it != totals_ns_.end(); ++it) {
+      (*ms)[it->first] = 1e-6 * it->second / num_frames;
+      it->second = 0;
+    }
+  }
+
+ private:
+  // Spans are nested on each thread, so their begin times form a stack.
+  static std::vector<uint64_t>& BeginTimes() {
+    static thread_local std::vector<uint64_t> begin_times;
+    return begin_times;
+  }
+
+  std::mutex mutex_;
+  std::map<std::string, uint64_t> totals_ns_;
+};
+
+// One rig of the stress test.
+struct StressInstance {
+  StressInstance() : time_to_blend(0) {}
+
+  motive::RigMotivator motivator;
+  vec3 position;
+  MotiveTime time_to_blend;
+};
+
+static int RandomInt(std::mt19937* rng, int max_inclusive) {
+  return std::uniform_int_distribution<int>(0, max_inclusive)(*rng);
+}
+
+// Blend `instance` to a random clip, from a random phase, and pick when it
+// next blends.
+static void BlendStressInstance(const motive::AnimTable& anim_table,
+                                float playback_rate, std::mt19937* rng,
+                                StressInstance* instance) {
+  const motive::RigAnim& anim =
+      *anim_table.Query(0, RandomInt(rng, anim_table.NumAnims(0) - 1));
+  const float phase = static_cast<float>(RandomInt(rng, anim.end_time()));
+  const motive::SplinePlayback playback(phase, true, playback_rate,
+                                        kStressBlendTime);
+  instance->motivator.BlendToAnim(anim, playback);
+  instance->time_to_blend =
+      kStressMinBlendInterval +
+      RandomInt(rng, kStressMaxBlendInterval - kStressMinBlendInterval);
+}
+
+// Lay out `instances` on a square grid, centered on the origin, in the plane
+// perpendicular to `up`. Returns the offset of the grid's furthest corner.
+static vec3 LayOutStressGrid(const vec3& up, float spacing,
+                             std::vector<StressInstance>* instances) {
+  // `up` is an axis, so rotating its components gives the other two axes.
+  const vec3 across(up.z, up.x, up.y);
+  const vec3 down(up.y, up.z, up.x);
+  const int num_instances = static_cast<int>(instances->size());
+  const int columns =
+      static_cast<int>(std::ceil(std::sqrt(static_cast<float>(num_instances))));
+  if (num_instances == 0) return kZeros3f;
+  const float center = 0.5f * (columns - 1);
+  for (int i = 0; i < num_instances; ++i) {
+    const float column = static_cast<float>(i % columns) - center;
+    const float row = static_cast<float>(i / columns) - center;
+    (*instances)[i].position = spacing * (column * across + row * down);
+  }
+  return spacing * center * (across + down);
+}
+
+// Draw a bar for each entry of `ms`, from the top left of the screen, with
+// lengths proportional to their times.
+static void DrawTimingChart(const std::map<std::string, double>& ms,
+                            fplbase::Shader* shader,
+                            fplbase::Renderer* renderer) {
+  const vec2 window_size(renderer->window_size());
+  renderer->set_model_view_projection(
+      mat4::Ortho(0.0f, window_size.x, 0.0f, window_size.y, -1.0f, 1.0f));
+  renderer->SetShader(shader);
+  renderer->DepthTest(false);
+
+  float top = window_size.y - kChartMargin;
+  int color = 0;
+  for (auto it = ms.begin(); it != ms.end(); ++it) {
+    const float length = std::min(static_cast<float>(it->second) *
+                                      kChartPixelsPerMs,
+                                  window_size.x - 2.0f * kChartMargin);
+    const float* rgba = kChartColors[color % kNumChartColors];
+    renderer->set_color(mathfu::vec4(rgba[0], rgba[1], rgba[2], rgba[3]));
+    fplbase::Mesh::RenderAAQuadAlongX(
+        vec3(kChartMargin, top - kChartBarHeight, 0.0f),
+        vec3(kChartMargin + length, top, 0.0f));
+    top -= kChartBarHeight + kChartBarGap;
+    color++;
+  }
+
+  renderer->set_color(mathfu::kOnes4f);
+  renderer->DepthTest(true);
+}
+
+// Print which processor each bar of the timing chart is.
+static void PrintTimingLegend(const std::map<std::string, double>& ms,
+                              int num_instances, double frames_per_second) {
+  printf("%d rigs at %.1f fps:\n", num_instances, frames_per_second);
+  int color = 0;
+  for (auto it = ms.begin(); it != ms.end(); ++it) {
+    printf("  %-8s %7.3f ms  %s\n", kChartColorNames[color % kNumChartColors],
+           it->second, it->first.c_str());
+    color++;
+  }
+}
+
 extern "C" int FPL_main(int argc, char* argv[]) {
   // Output command-line usage if arguments invalid.
   ViewerArgs args;
@@ -525,9 +731,20 @@ extern "C" int FPL_main(int argc, char* argv[]) {
   while (!asset_manager.TryFinalize()) {
   }
 
-  // UX values.
+  // Lay out the stress test instances, if any.
+  const bool stress = args.num_instances > 0;
+  const vec3 mesh_size = mesh->max_position() - mesh->min_position();
+  std::vector<StressInstance> instances(args.num_instances);
+  const vec3 grid_extent = LayOutStressGrid(
+      VectorSystemUp(args.coordinate_system),
+      kStressSpacing *
+          std::max(std::max(mesh_size.x, mesh_size.y), mesh_size.z),
+      &instances);
+
+  // UX values. Frame the whole grid when stress testing.
   Camera camera(args.coordinate_system, AspectRatio(renderer),
-                mesh->min_position(), mesh->max_position());
+                mesh->min_position() - grid_extent,
+                mesh->max_position() + grid_extent);
   AnimationState animation_state = anim_table.NumObjects() > 0
                                        ? kAnimationStateAnimating
                                        : kAnimationStateNoAnimation;
@@ -549,6 +766,16 @@ extern "C" int FPL_main(int argc, char* argv[]) {
            renderer.last_error().c_str());
     return 1;
   }
+  fplbase::Shader* chart_shader = nullptr;
+  if (stress) {
+    chart_shader =
+        renderer.CompileAndLinkShader(kVertexShaderChart, kFragmentShaderChart);
+    if (!chart_shader) {
+      printf("ERROR: Could not compile chart shaders.\n\n%s\n\n",
+             renderer.last_error().c_str());
+      return 1;
+    }
+  }
 
   // Ensure the mesh and the animation are compatible.
   const bool compatible =
@@ -564,18 +791,28 @@ extern "C" int FPL_main(int argc, char* argv[]) {
   }
 
   // Initialize the RigMotivator to animate the `mesh` according to the
-  // defining animation.
+  // defining animation. When stress testing, initialize every instance
+  // instead, each playing a random clip. The seed is fixed so that runs are
+  // comparable.
   motive::MotiveEngine engine;
   motive::RigMotivator motivator;
   motive::SplinePlayback playback(0.0f, true, args.playback_rate,
                                   args.blend_time);
+  std::mt19937 rng(0);
   int anim_idx = 0;
   if (animation_state != kAnimationStateNoAnimation) {
     const motive::RigInit init(
         anim_table.DefiningAnim(0), mesh->bone_parents(),
         static_cast<motive::BoneIndex>(mesh->num_bones()));
-    motivator.Initialize(init, &engine);
-    motivator.BlendToAnim(*anim_table.Query(0, anim_idx), playback);
+    if (stress) {
+      for (auto it = instances.begin(); it != instances.end(); ++it) {
+        it->motivator.Initialize(init, &engine);
+        BlendStressInstance(anim_table, playback.playback_rate, &rng, &*it);
+      }
+    } else {
+      motivator.Initialize(init, &engine);
+      motivator.BlendToAnim(*anim_table.Query(0, anim_idx), playback);
+    }
   }
 
   // Create an array to hold the bone matrices that are pushed to the shader.
@@ -584,13 +821,13 @@ extern "C" int FPL_main(int argc, char* argv[]) {
 
   // Output how-to-use message, with commands.
   printf(kControls);
-  const vec3 mesh_size = mesh->max_position() - mesh->min_position();
   printf("Displaying mesh with width %.2f, height %.2f, and depth %.2f\n",
          mesh_size.x, mesh_size.y, mesh_size.z);
 
-  // Open file that recieves debug info.
+  // Open file that recieves debug info. There's too much of it to be useful
+  // when stress testing.
   FILE* out_file = nullptr;
-  if (animation_state != kAnimationStateNoAnimation) {
+  if (animation_state != kAnimationStateNoAnimation && !stress) {
     out_file = fopen(args.out_file.c_str(), "w");
     const char* out_file_msg = out_file ? "Open `%s` in a spreadsheet for "
                                           "values on every animation channel.\n"
@@ -604,15 +841,33 @@ extern "C" int FPL_main(int argc, char* argv[]) {
     fprintf(out_file, "%s", motivator.CsvHeaderForDebugging().c_str());
   }
 
+  // Chart Motive's time in each processor when stress testing.
+  ProcessorTimes processor_times;
+  std::map<std::string, double> chart_ms;
+  int chart_frames = 0;
+  double chart_seconds = 0.0;
+  if (stress) {
+    motive::SetMotiveTraceSink(&processor_times);
+  }
+
   while (!(input.exit_requested() ||
            input.GetButton(fplbase::FPLK_AC_BACK).went_down())) {
     const MotiveTime motive_delta_time =
         static_cast<MotiveTime>(kMotiveAnimTicksPerSecond * input.DeltaTime());
 
+    const bool animating = animation_state == kAnimationStateAnimating ||
+                           animation_state == kAnimationStateStepOneFrame;
+
     // Start next animation if we've reached the end of the current one.
-    if ((animation_state == kAnimationStateAnimating ||
-         animation_state == kAnimationStateStepOneFrame) &&
-        motivator.TimeRemaining() < motive_delta_time) {
+    // Stress test instances instead blend to random clips at random times.
+    if (animating && stress) {
+      for (auto it = instances.begin(); it != instances.end(); ++it) {
+        it->time_to_blend -= motive_delta_time;
+        if (it->time_to_blend <= 0) {
+          BlendStressInstance(anim_table, playback.playback_rate, &rng, &*it);
+        }
+      }
+    } else if (animating && motivator.TimeRemaining() < motive_delta_time) {
       anim_idx = (anim_idx + 1) % anim_table.NumAnims(0);
       motivator.BlendToAnim(*anim_table.Query(0, anim_idx), playback);
     }
@@ -621,22 +876,29 @@ extern "C" int FPL_main(int argc, char* argv[]) {
     UpdateCamera(&input, &camera);
     animation_state = UpdateAnimationState(animation_state, &input);
     if (UpdatePlaybackRate(animation_state, &input, &playback.playback_rate)) {
-      motivator.SetPlaybackRate(playback.playback_rate);
+      if (stress) {
+        for (auto it = instances.begin(); it != instances.end(); ++it) {
+          it->motivator.SetPlaybackRate(playback.playback_rate);
+        }
+      } else {
+        motivator.SetPlaybackRate(playback.playback_rate);
+      }
     }
 
     // Update sub-systems.
     renderer.AdvanceFrame(input.minimized(), input.Time());
     input.AdvanceFrame(&renderer.window_size());
-    if (animation_state == kAnimationStateAnimating ||
-        animation_state == kAnimationStateStepOneFrame) {
+    if (animating) {
       engine.AdvanceFrame(motive_delta_time);
+      chart_frames++;
+      chart_seconds += input.DeltaTime();
 
       // Output debug information for this frame.
       if (out_file) {
         fprintf(out_file, "%s\n", motivator.CsvValuesForDebugging().c_str());
       }
 
-      if (args.bone_idx >= 0) {
+      if (args.bone_idx >= 0 && !stress) {
         printf("%s", motivator
                          .LocalTransformsForDebugging(
                              static_cast<motive::BoneIndex>(args.bone_idx))
@@ -644,10 +906,42 @@ extern "C" int FPL_main(int argc, char* argv[]) {
       }
     }
 
+    // Refresh the timing chart, and print its legend, every second.
+    if (stress && chart_seconds >= 1.0 && chart_frames > 0) {
+      processor_times.TakeAverages(chart_frames, &chart_ms);
+      PrintTimingLegend(chart_ms, args.num_instances,
+                        chart_frames / chart_seconds);
+      chart_frames = 0;
+      chart_seconds = 0.0;
+    }
+
     // Render the mesh.
     renderer.ClearFrameBuffer(mathfu::vec4(0.0, 0.0f, 0.0, 1.0f));
     mat4 mvp = CalculateMvp(camera);
 
+    // Render every stress test instance, then the chart over them. Each
+    // instance has its own pose, so needs its own bone transforms.
+    if (stress) {
+      for (auto it = instances.begin(); it != instances.end(); ++it) {
+        mat4 instance_mvp = mvp * mat4::FromTranslationVector(it->position);
+        if (use_skinning) {
+          mesh->GatherShaderTransforms(it->motivator.GlobalTransforms(),
+                                       shader_transforms.data());
+          renderer.SetBoneTransforms(
+              shader_transforms.data(),
+              static_cast<int>(mesh->num_shader_bones()));
+        } else {
+          instance_mvp *=
+              mat4::FromAffineTransform(it->motivator.GlobalTransforms()[0]);
+        }
+        renderer.set_model_view_projection(instance_mvp);
+        renderer.SetShader(shader);
+        renderer.Render(mesh);
+      }
+      DrawTimingChart(chart_ms, chart_shader, &renderer);
+      continue;
+    }
+
     if (use_skinning) {
       // If not animating, use default identity matrices.
       if (animation_state != kAnimationStateNoAnimation) {
@@ -667,6 +961,7 @@ extern "C" int FPL_main(int argc, char* argv[]) {
     renderer.Render(mesh);
   }
 
+  motive::SetMotiveTraceSink(nullptr);
   asset_manager.ClearAllAssets();
   renderer.ShutDown();
 